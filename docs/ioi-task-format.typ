@@ -41,6 +41,12 @@ The following are the most commonly set keys in this file:
   seconds.
 - `memory_limit`: the maximum amount of memory that a solution can use, in
   mebibytes.
+- `instruction_limit`: the maximum number of instructions that a solution can
+  execute in user space. It's checked only when the instructions are counted,
+  i.e. with `--hardware-counters` on a Linux host with the performance counters
+  available, and then it's used instead of `time_limit` for the verdict, which
+  becomes independent of the load and the speed of the machine. The solutions
+  are still killed after `time_limit` plus the extra time.
 - `controller_time_limit`: the maximum amount of time that the controller can run
   for, in seconds (defaults to `time_limit + 1.0`).
 - `controller_wall_time_limit`: the maximum amount of wall time that the
@@ -52,11 +58,24 @@ The following are the most commonly set keys in this file:
 - `interactive_concurrent`: whether the solution processes are assumed to be
   concurrent (wall time max-ed, memory summed) or sequential (wall time sum-ed,
   memory max-ed). Defaults to `true`.
+- `batch_checker`: set this to `true` if the checker also supports the batch
+  protocol (see #ref(<checker>)), so that all the outputs of a solution are
+  checked by a single execution of the checker. Defaults to `false`.
+- `batch_validator`: set this to `true` if the validator also supports the
+  batch protocol (see #ref(<validator>)), so that all the input files are
+  validated by a single execution of the validator. Defaults to `false`.
+- `builtin_checker`: the rules for comparing the outputs when there is no
+  custom checker (see #ref(<checker>)). Defaults to comparing them ignoring
+  the whitespace.
+- `batch_generator`: set this to `true` if the generators also support the
+  batch protocol (see #ref(<generator>)), so that many input files are
+  generated by a single execution. Defaults to `false`.
 - `score_precision`: the number of decimal digits to round scores for this task
   to (defaults to 0, i.e. integers).
 - `user_io`: set this value to `fifo_io` to have solutions in communication
   tasks communicate via FIFOs (by default they communicate via standard I/O,
-  which is `std_io`).
+  which is `std_io`), or to `shared_memory` to have them communicate through
+  shared memory.
   See #ref(<communication>) for further information on communication tasks.
 - `feedback_level`: set this to `oi_restricted` to instruct CMS to use IOI
   rules for showing feedback for this task. Defaults to `full`.
@@ -285,10 +304,24 @@ A testcase in the `testcases` list can be:
 )
 
 == `generator.<ext>`
+<generator>
 
 A generator should read its command line arguments and produce the testcase on
 standard output.
 
+If `batch_generator` is set in `task.toml` (or `task.yaml`), `task-maker-rust`
+generates many testcases with a single execution of the generator, avoiding
+the cost of starting a process for each of them. In this case the generator is
+executed with the single argument `--batch`, and reads from standard input one
+line for each testcase, with its arguments quoted like in a shell. The testcase
+of the `i`-th line (starting from 0) has to be written to the file `input_i`,
+instead of standard output, and then `ok` has to be written to the file
+`outcome_i`. If a testcase cannot be generated, the generator writes the reason
+to `outcome_i` and goes on with the next line: only that testcase fails. It has
+to exit with a non-zero code only if it cannot generate any testcase. Each
+execution generates at most 64 testcases, so that the generation is still split
+between the workers.
+
 Generators *should be deterministic*, i.e. they should produce the same output
 given the same command line. Ideally, this output should also be consistent
 across different versions of the programming language used. This means, for
@@ -338,11 +371,24 @@ with a template command line to search for test cases that make certain solution
 fail.
 
 == `validator.<ext>`
+<validator>
 
 The validator ensures that each generated testcase satisfies the constraints
 of its subtask. It is recommended for the validator to read the constraints
 directly from `gen.toml`.
 
+If `batch_validator` is set in `task.toml` (or `task.yaml`), `task-maker-rust`
+validates all the input files with a single execution of the validator. In this
+case the validator is executed with the single argument `--batch`, and reads
+from standard input one line for each input file, with the arguments it would
+receive for that file quoted like in a shell (the input files are named
+`input_0`, `input_1`, ...). For the `i`-th line (starting from 0) it has to
+write to the file `outcome_i` `ok` if the file is valid, or the reason why it
+is not. It has to exit with a non-zero code only if it cannot validate the
+files, since then none of them is used: an invalid file blocks only its own
+testcase. The `TM_SUBTASK`, `TM_TESTCASE` and `TM_SUBTASK_NAME` environment
+variables are not set.
+
 #figure(
   ```python
   #!/usr/bin/env python3
@@ -503,6 +549,7 @@ we suggest including at least the following:
   corresponding to sample interactions in communication tasks.
 
 = `check` folder
+<checker>
 
 The `check` folder can contain either a `checker.<ext>` file, or a
 `manager.<ext>` file, or a `controller.<ext>` file, or be empty.
@@ -513,6 +560,21 @@ task, for which details are given in #ref(<communication>).
 If it contains `controller.<ext>`, the task is interpreted as an interactive
 task, for which details are given in #ref(<interactive>).
 
+If it is empty, the outputs are compared by `task-maker-rust` itself, ignoring
+the differences in the whitespace. With `builtin_checker` in `task.toml` (or
+`task.yaml`) they are instead compared token by token, with these rules:
+- `ignore_case`: the letters are compared ignoring the case (defaults to
+  `false`);
+- `absolute_tolerance`: two numbers match if their difference is at most this
+  value;
+- `relative_tolerance`: two numbers match if their difference is at most this
+  value times the number in the correct output.
+
+For example `builtin_checker = { absolute_tolerance = 1e-6 }` accepts the
+floating point outputs with an error up to $10^(-6)$. The comparison is done
+in a streaming way, without starting a checker process for each testcase. The
+rules are not exported to CMS, which still needs a checker for them.
+
 The `checker.<ext>` file will be compiled by `task-maker-rust` (if necessary),
 and gets executed both by `task-maker-rust` and by CMS with three command line
 arguments, in order:
@@ -531,7 +593,29 @@ mark evaluation as failed in that case.
 To aid in ensuring that this does not happen, `task-maker-rust` has the
 `task-maker-tools fuzz-checker` tool, which will use a fuzzing engine to try to
 crash the checker. This tool works significantly better if there is no global
-state in the checker, so try to avoid global variables.
+state in the checker, so try to avoid global variables. At the end, the failures
+are run again and grouped by the sanitizer report or failed assertion that
+caused them: only one failure per group is kept in `fuzz/failures`, minimized
+unless `--no-minimize` is passed.
+
+C and C++ checkers can `#include "checker_lib.h"`, a header provided by
+`task-maker-rust` at compile time. It reads the files through `mmap` and parses
+the tokens in place (`tm_open`, `tm_read_token`, `tm_read_int`,
+`tm_read_double`, `tm_eof`), which is much faster than `std::ifstream` on large
+outputs, and it has helpers for printing the score and the message (`tm_score`,
+`tm_accept`, `tm_partial`, `tm_wrong`). If the `check` folder already contains
+a `checker_lib.h`, that file is used instead.
+
+If `batch_checker` is set in `task.toml` (or `task.yaml`), `task-maker-rust`
+checks all the outputs of a solution with a single execution of the checker,
+avoiding the cost of starting a process for each testcase. In this case the
+checker is executed with the single argument `--batch`, and reads from standard
+input one line for each testcase, with the paths of the three files above
+separated by a space. For each line, in order, it has to write on standard
+output a line with the score, followed by a space and by the message. The
+testcases where the solution failed are still listed, with an empty output;
+their lines are ignored. CMS still executes the checker once per testcase, so it
+has to support both modes.
 
 #figure(
   ```cpp
@@ -574,6 +658,18 @@ FIFOs if `user_io: fifo_io`; this last mode is only recommended when using a
 stub.
 // TODO: std_io seems broken in tmr.
 
+With `user_io: shared_memory`, each solution process receives instead the path
+of a shared memory file, and the manager receives the paths of the files of
+all the processes, in order. C and C++ managers and stubs can
+`#include "shm_lib.h"`, a header provided by `task-maker-rust` at compile time,
+to open the file (`tm_channel_open`) and exchange messages through two ring
+buffers in it (`tm_write`, `tm_read`, `tm_write_int`, `tm_read_int`,
+`tm_channel_close`). Sending a message does not need a system call, so
+protocols with millions of short messages measure the solution and not the
+latency of the pipes. If a process exits or crashes with its channel open, the
+other side reads the end of the data instead of waiting for it. CMS does not
+support this mode.
+
 Note that it is very easy to deadlock execution in communication tasks. You
 should take care to ensure that FIFOs are opened in the correct order, and that
 all writes are flushed.
@@ -649,8 +745,16 @@ After each `START_SOLUTION`, it should read two integers from standard input,
 representing the file descriptors (fds) for writing to and reading from the
 solution, respectively.
 
+To start many solution processes at once, the controller can instead print
+`START_SOLUTIONS <n>`, followed by a newline, and then read $n$ pairs of
+integers, one for each solution. The solutions are started in parallel, which is
+much faster than starting them one at a time when there are many of them.
+
 The controller then communicates with the solution(s) using these fds (e.g.,
 using `fdopen`).
+With many solutions, `serve_solutions` from `controller_lib.h` waits with
+`poll` for whichever solution has something to say, instead of blocking on
+each of them in order.
 
 To report the score and messages, the controller must print to standard error
 using the following prefixes:
@@ -681,6 +785,7 @@ int main() {
 
 ```cpp
 #include <assert.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -709,14 +814,12 @@ int start_one_solution(int (*handler)(FILE *to_solution, FILE *from_solution)) {
   return ret;
 }
 
-int start_many_solutions(int (*handler)(FILE **to_solution,
-                                        FILE **from_solution, int num),
-                         int num) {
-  FILE **to_solution = (FILE **)malloc(sizeof(FILE *) * num);
-  FILE **from_solution = (FILE **)malloc(sizeof(FILE *) * num);
+// Start `num` solutions with a single request, so that they all start in
+// parallel. Returns 0 on success.
+int start_solutions(FILE **to_solution, FILE **from_solution, int num) {
+  printf("START_SOLUTIONS %d\n", num);
+  fflush(stdout);
   for (int i = 0; i < num; i++) {
-    printf("START_SOLUTION\n");
-    fflush(stdout);
     int fdin, fdout;
     if (scanf("%d %d", &fdin, &fdout) != 2) return 1;
     to_solution[i] = fdopen(fdin, "w");
@@ -724,6 +827,15 @@ int start_many_solutions(int (*handler)(FILE **to_solution,
     assert(to_solution[i]);
     assert(from_solution[i]);
   }
+  return 0;
+}
+
+int start_many_solutions(int (*handler)(FILE **to_solution,
+                                        FILE **from_solution, int num),
+                         int num) {
+  FILE **to_solution = (FILE **)malloc(sizeof(FILE *) * num);
+  FILE **from_solution = (FILE **)malloc(sizeof(FILE *) * num);
+  if (start_solutions(to_solution, from_solution, num) != 0) return 1;
   int ret = handler(to_solution, from_solution, num);
   for (int i = 0; i < num; i++) {
     fclose(to_solution[i]);
@@ -733,5 +845,51 @@ int start_many_solutions(int (*handler)(FILE **to_solution,
   free(from_solution);
   return ret;
 }
+
+// Whether some data from the solution is already buffered inside the FILE, so
+// that reading it does not block even if the pipe is empty.
+int solution_has_buffered_data(FILE *from_solution) {
+#ifdef __GLIBC__
+  return from_solution->_IO_read_ptr < from_solution->_IO_read_end;
+#else
+  (void)from_solution;
+  return 0;
+#endif
+}
+
+// Call `on_ready` every time one of the solutions has something to read,
+// without blocking on the slower ones. `on_ready` receives the index of the
+// solution and should return non-zero when the solution does not need to be
+// served anymore (e.g. it exited or sent its last message). Returns when no
+// solution needs to be served.
+void serve_solutions(FILE **from_solution, int num,
+                     int (*on_ready)(int index, void *data), void *data) {
+  struct pollfd *fds = (struct pollfd *)malloc(sizeof(struct pollfd) * num);
+  int active = num;
+  for (int i = 0; i < num; i++) {
+    fds[i].fd = fileno(from_solution[i]);
+    fds[i].events = POLLIN;
+  }
+  while (active > 0) {
+    int buffered = 0;
+    for (int i = 0; i < num; i++) {
+      if (fds[i].fd >= 0 && solution_has_buffered_data(from_solution[i])) {
+        fds[i].revents = POLLIN;
+        buffered = 1;
+      } else {
+        fds[i].revents = 0;
+      }
+    }
+    if (!buffered && poll(fds, num, -1) < 0) break;
+    for (int i = 0; i < num; i++) {
+      if (fds[i].fd < 0 || !fds[i].revents) continue;
+      if (on_ready(i, data)) {
+        fds[i].fd = -1;
+        active--;
+      }
+    }
+  }
+  free(fds);
+}
 ```
 
@@ -2,15 +2,20 @@
 //!
 //! The structs here follow a multi-step builder pattern, moving from a struct to the next adding
 //! more and more context.
+use std::path::PathBuf;
 use std::sync::{Arc, Mutex};
 use std::thread::JoinHandle;
 
 use anyhow::{anyhow, bail, Context, Error};
-use task_maker_cache::Cache;
+use task_maker_cache::{Cache, RemoteCache};
 use task_maker_dag::CacheMode;
+use task_maker_exec::cgroup::CgroupRoot;
+use task_maker_exec::cpu_pinning::CpuPinning;
 use task_maker_exec::ductile::{new_local_channel, ChannelReceiver, ChannelSender};
-use task_maker_exec::executors::{LocalExecutor, RemoteEntityMessage, RemoteEntityMessageResponse};
-use task_maker_exec::proto::{ExecutorClientMessage, ExecutorServerMessage};
+use task_maker_exec::executors::{
+    LocalExecutor, LocalExecutorConnector, RemoteEntityMessage, RemoteEntityMessageResponse,
+};
+use task_maker_exec::proto::{ExecutorClientMessage, ExecutorServerMessage, FileEncoding};
 use task_maker_exec::ExecutorClient;
 use task_maker_format::ui::{UIChannelReceiver, UIMessage, UIType, UI};
 use task_maker_format::{EvaluationData, TaskFormat, UISender, VALID_TAGS};
@@ -44,6 +49,7 @@ pub struct ConnectedExecutor {
     pub tx: ChannelSender<ExecutorClientMessage>,
     pub rx: ChannelReceiver<ExecutorServerMessage>,
     pub local_executor: Option<JoinHandle<Result<(), Error>>>,
+    pub trace_file: Option<PathBuf>,
 }
 
 /// Third step: start the UI thread.
@@ -55,12 +61,23 @@ pub struct ConnectedExecutorWithUI {
     pub tx: ChannelSender<ExecutorClientMessage>,
     pub rx: ChannelReceiver<ExecutorServerMessage>,
     pub local_executor: Option<JoinHandle<Result<(), Error>>>,
+    pub trace_file: Option<PathBuf>,
 
     // new fields
     pub ui_thread: JoinHandle<()>,
     pub client_sender: Arc<Mutex<Option<ChannelSender<ExecutorClientMessage>>>>,
 }
 
+/// An executor that many [`RuntimeContext`]s can connect to, also at the same time, sharing its
+/// workers and the local file store.
+pub struct SharedExecutor {
+    /// The local file store.
+    file_store: Arc<FileStore>,
+    /// The connector of the long running local executor, or `None` for connecting each context
+    /// to the remote executor.
+    local: Option<LocalExecutorConnector>,
+}
+
 impl RuntimeContext {
     /// Create a [`RuntimeContext`] for the given task. In the provided closure you should build the
     /// execution DAG for the execution. The closure is given a reference to the given task and a
@@ -79,23 +96,43 @@ impl RuntimeContext {
         let config = eval.dag.config_mut();
         config
             .keep_sandboxes(opt.keep_sandboxes)
-            .dry_run(opt.dry_run)
+            .dry_run(opt.dry_run || opt.estimate)
+            .estimate_only(opt.estimate)
             .cache_mode(
                 CacheMode::try_from(&opt.no_cache, &VALID_TAGS).context("Invalid cache mode")?,
             )
             .copy_exe(opt.copy_exe)
             .copy_logs(opt.copy_logs)
-            .priority(opt.priority);
+            .priority(opt.priority)
+            .critical_path(opt.critical_path);
         if let Some(extra_time) = opt.extra_time {
             if extra_time < 0.0 {
                 bail!("The extra time ({}) cannot be negative!", extra_time);
             }
             config.extra_time(extra_time);
         }
+        if !(opt.fair_share > 0.0) {
+            bail!("The fair share ({}) must be positive!", opt.fair_share);
+        }
+        config.fair_share(opt.fair_share);
+        if !(opt.timing_margin >= 0.0) {
+            bail!(
+                "The timing margin ({}) cannot be negative!",
+                opt.timing_margin
+            );
+        }
+        config.timing_reruns(opt.timing_reruns, opt.timing_margin / 100.0);
+        config.hardware_counters(opt.hardware_counters);
         if let Some(extra_memory) = opt.extra_memory {
             config.extra_memory(extra_memory);
         }
 
+        let mut sandbox_runner = ToolsSandboxRunner::default();
+        if let Some(cgroup_root) = &opt.cgroup_root {
+            let cgroup_root = CgroupRoot::new(cgroup_root).context("Invalid cgroup root")?;
+            sandbox_runner = sandbox_runner.with_cgroup_root(cgroup_root);
+        }
+
         // build the execution dag
         build_dag(&mut task, &mut eval)?;
 
@@ -111,7 +148,7 @@ impl RuntimeContext {
             task,
             eval,
             ui_receiver,
-            sandbox_runner: ToolsSandboxRunner::default(),
+            sandbox_runner,
         })
     }
 
@@ -120,66 +157,49 @@ impl RuntimeContext {
         self.sandbox_runner = sandbox_runner;
     }
 
+    /// Connect to an executor that is shared with other contexts, which may be evaluating at the
+    /// same time.
+    pub fn connect_shared_executor(
+        self,
+        executor: &SharedExecutor,
+        opt: &ExecutionOpt,
+    ) -> Result<ConnectedExecutor, Error> {
+        let (tx, rx) = match (&executor.local, &opt.evaluate_on) {
+            (Some(connector), _) => connector.connect("Local client")?,
+            (None, Some(evaluate_on)) => connect_to_remote(opt, evaluate_on)?,
+            (None, None) => bail!("The shared executor is neither local nor remote"),
+        };
+        Ok(ConnectedExecutor {
+            task: self.task,
+            eval: self.eval,
+            ui_receiver: self.ui_receiver,
+
+            file_store: executor.file_store.clone(),
+            tx,
+            rx,
+            local_executor: None,
+            trace_file: opt.trace_file.clone(),
+        })
+    }
+
     /// Start the local executor or connect to a remote one.
     pub fn connect_executor(
         self,
         opt: &ExecutionOpt,
         storage_opt: &StorageOpt,
     ) -> Result<ConnectedExecutor, Error> {
-        // setup the file store
-        let store_path = storage_opt.store_dir();
-        let file_store = Arc::new(
-            FileStore::new(
-                store_path.join("store"),
-                storage_opt.max_cache * 1024 * 1024,
-                storage_opt.min_cache * 1024 * 1024,
-            )
-            .context(
-                "Cannot create the file store (You can try wiping it with task-maker-tools reset)",
-            )?,
-        );
+        let file_store = open_file_store(storage_opt)?;
 
         // connect either to the remote executor or spawn a local one
         let (tx, rx, local_executor) = if let Some(evaluate_on) = &opt.evaluate_on {
-            let (tx, rx) = connect_to_remote_server(evaluate_on, 27182)
-                .context("Cannot connect to the remote server")?;
-            let name = opt.name.clone().unwrap_or_else(|| {
-                format!(
-                    "{}@{}",
-                    whoami::username(),
-                    whoami::fallible::hostname().unwrap()
-                )
-            });
-            tx.send(RemoteEntityMessage::Welcome {
-                name,
-                version: VERSION.into(),
-            })
-            .context("Cannot send welcome to the server")?;
-            if let RemoteEntityMessageResponse::Rejected(err) =
-                rx.recv().context("Failed to receive welcome response")?
-            {
-                bail!("The server rejected the client connection: {}", err);
-            }
-            (tx.change_type(), rx.change_type(), None)
+            let (tx, rx) = connect_to_remote(opt, evaluate_on)?;
+            (tx, rx, None)
         } else {
             // start the server and the client
             let (tx, rx_remote) = new_local_channel();
             let (tx_remote, rx) = new_local_channel();
-
-            // setup the local cache
-            let cache_path = store_path.join("cache");
-            let cache = Cache::new(cache_path).context("Cannot create the cache")?;
-
-            // setup the local executor
-            let num_cores = opt.num_cores.unwrap_or_else(num_cpus::get_physical);
-            let sandbox_path = storage_opt.store_dir().join("sandboxes");
-            let executor = LocalExecutor::new(
-                file_store.clone(),
-                cache,
-                num_cores,
-                sandbox_path,
-                self.sandbox_runner,
-            )?;
+            let executor =
+                local_executor(opt, storage_opt, file_store.clone(), self.sandbox_runner)?;
             let local_executor = std::thread::Builder::new()
                 .name("Executor thread".into())
                 .spawn(move || executor.evaluate(tx_remote, rx_remote))
@@ -196,10 +216,41 @@ impl RuntimeContext {
             tx,
             rx,
             local_executor,
+            trace_file: opt.trace_file.clone(),
         })
     }
 }
 
+impl SharedExecutor {
+    /// Open the local file store and start the local executor in background, unless the
+    /// evaluations are done on a remote executor.
+    pub fn new(
+        opt: &ExecutionOpt,
+        storage_opt: &StorageOpt,
+        sandbox_runner: ToolsSandboxRunner,
+    ) -> Result<SharedExecutor, Error> {
+        let file_store = open_file_store(storage_opt)?;
+        let local = if opt.evaluate_on.is_none() {
+            let executor = local_executor(opt, storage_opt, file_store.clone(), sandbox_runner)?;
+            let connector = executor
+                .serve()
+                .context("Failed to start the local executor")?;
+            Some(connector)
+        } else {
+            None
+        };
+        Ok(SharedExecutor { file_store, local })
+    }
+
+    /// Stop the local executor, if any, storing its cache.
+    pub fn stop(&self) -> Result<(), Error> {
+        match &self.local {
+            Some(local) => local.stop(),
+            None => Ok(()),
+        }
+    }
+}
+
 impl ConnectedExecutor {
     /// Now that we are connected to an executor, we can start the UI thread in background. This
     /// thread will run until the execution is completed or until it is stopped.
@@ -260,6 +311,7 @@ impl ConnectedExecutor {
             tx: self.tx,
             rx: self.rx,
             local_executor: self.local_executor,
+            trace_file: self.trace_file,
 
             ui_thread,
             client_sender,
@@ -280,6 +332,7 @@ impl ConnectedExecutorWithUI {
         let local_executor = self.local_executor;
         let ui_thread = self.ui_thread;
         let sender = self.eval.sender.clone();
+        let trace_file = self.trace_file;
         defer! {
             // wait for the executor and the ui to exit
             if let Some(local_executor) = local_executor {
@@ -289,6 +342,12 @@ impl ConnectedExecutorWithUI {
                     .unwrap()
                     .expect("Local executor failed");
             }
+            // all the events have been recorded now that the executor has exited
+            if let Some(trace_file) = &trace_file {
+                if let Err(e) = task_maker_exec::trace::write(trace_file) {
+                    warn!("Failed to write the trace file: {e:?}");
+                }
+            }
             let _ = sender.send(UIMessage::StopUI);
             ui_thread
                 .join()
@@ -310,9 +369,109 @@ impl ConnectedExecutorWithUI {
         // disable the ctrl-c handler dropping the owned clone of the sender, letting the client exit
         client_sender.lock().unwrap().take();
 
+        // without running anything there is nothing to check
+        if self.eval.dag.config_mut().estimate_only {
+            return Ok(());
+        }
         self.task
             .sanity_check_post_hook(&mut self.eval)
             .context("Sanity checks failed")?;
         Ok(())
     }
 }
+
+/// Open the local file store.
+fn open_file_store(storage_opt: &StorageOpt) -> Result<Arc<FileStore>, Error> {
+    let store_path = storage_opt.store_dir();
+    let mut file_store = FileStore::new(
+        store_path.join("store"),
+        storage_opt.max_cache * 1024 * 1024,
+        storage_opt.min_cache * 1024 * 1024,
+    )
+    .context("Cannot create the file store (You can try wiping it with task-maker-tools reset)")?;
+    file_store.set_compress_cold_files(storage_opt.compress_store);
+    Ok(Arc::new(file_store))
+}
+
+/// Connect to the remote executor at `evaluate_on`, introducing this client.
+fn connect_to_remote(
+    opt: &ExecutionOpt,
+    evaluate_on: &str,
+) -> Result<
+    (
+        ChannelSender<ExecutorClientMessage>,
+        ChannelReceiver<ExecutorServerMessage>,
+    ),
+    Error,
+> {
+    let (tx, rx) = connect_to_remote_server(evaluate_on, 27182)
+        .context("Cannot connect to the remote server")?;
+    let name = opt.name.clone().unwrap_or_else(|| {
+        format!(
+            "{}@{}",
+            whoami::username(),
+            whoami::fallible::hostname().unwrap()
+        )
+    });
+    tx.send(RemoteEntityMessage::Welcome {
+        name,
+        version: VERSION.into(),
+    })
+    .context("Cannot send welcome to the server")?;
+    tx.send(RemoteEntityMessage::FileEncodings(vec![
+        FileEncoding::Plain,
+    ]))
+    .context("Cannot send the file encodings to the server")?;
+    if let RemoteEntityMessageResponse::Rejected(err) =
+        rx.recv().context("Failed to receive welcome response")?
+    {
+        bail!("The server rejected the client connection: {}", err);
+    }
+    Ok((tx.change_type(), rx.change_type()))
+}
+
+/// Make the local executor with its cache, and the workers.
+fn local_executor(
+    opt: &ExecutionOpt,
+    storage_opt: &StorageOpt,
+    file_store: Arc<FileStore>,
+    sandbox_runner: ToolsSandboxRunner,
+) -> Result<LocalExecutor, Error> {
+    // setup the local cache
+    let cache_path = storage_opt.store_dir().join("cache");
+    let mut cache = Cache::new(cache_path).context("Cannot create the cache")?;
+    cache.set_size_limits(
+        storage_opt.max_execution_cache * 1024 * 1024,
+        storage_opt.min_execution_cache * 1024 * 1024,
+    );
+    if let Some(url) = &storage_opt.remote_cache {
+        cache.set_remote(RemoteCache::new(url).context("Cannot use the remote cache")?);
+    }
+
+    if opt.trace_file.is_some() {
+        task_maker_exec::trace::enable();
+    }
+
+    // setup the local executor
+    let num_cores = opt.num_cores.unwrap_or_else(num_cpus::get_physical);
+    let sandbox_path = storage_opt.store_dir().join("sandboxes");
+    let cpu_pinning = opt
+        .timing_cores
+        .map(CpuPinning::reserve)
+        .transpose()
+        .context("Cannot reserve the cores for the evaluation")?;
+    let mut executor = LocalExecutor::with_cpu_pinning(
+        file_store,
+        cache,
+        num_cores,
+        sandbox_path,
+        sandbox_runner,
+        cpu_pinning,
+    )?;
+    let memory_budget = opt
+        .memory_budget
+        .map(|mib| mib * 1024)
+        .or_else(LocalExecutor::machine_memory);
+    executor.set_memory_budget(memory_budget);
+    Ok(executor)
+}
@@ -1,5 +1,6 @@
 use anyhow::{bail, Context, Error};
 use task_maker_format::ui::{UIMessage, UI};
+use task_maker_store::hash_memo;
 
 use crate::context::RuntimeContext;
 use crate::error::NiceError;
@@ -48,12 +49,20 @@ where
         return Ok(Evaluation::Clean);
     }
 
+    // the provided files that didn't change since the last run are not hashed again
+    if let Err(e) = hash_memo::enable(opt.storage.store_dir().join("hashes.bin")) {
+        warn!("Cannot load the file hashes: {:?}", e);
+    }
+
     // setup the configuration and the evaluation metadata
     let context = RuntimeContext::new(task, &opt.execution, |task, eval| {
         // build the DAG for the task
         task.build_dag(eval, &eval_config)
             .context("Cannot build the task DAG")
     })?;
+    if let Err(e) = hash_memo::save() {
+        warn!("Cannot save the file hashes: {:?}", e);
+    }
 
     // start the execution
     let executor = context.connect_executor(&opt.execution, &opt.storage)?;
@@ -5,6 +5,7 @@ use anyhow::{Context, Error};
 use clap::{ArgAction, Parser};
 use itertools::Itertools;
 use task_maker_dag::DagPriority;
+use task_maker_format::ioi::TestcaseId;
 use task_maker_format::terry::Seed;
 use task_maker_format::{
     find_task, get_sanity_check_list, EvaluationConfig, TaskFormat, VALID_TAGS,
@@ -75,7 +76,11 @@ pub struct FindTaskOpt {
 
 #[derive(Parser, Debug, Clone)]
 pub struct UIOpt {
-    /// Which UI to use, available UIs are: print, raw, curses, json.
+    /// Which UI to use, available UIs are: print, raw, curses, json, json-batch, json-binary.
+    ///
+    /// json-batch prints every 100ms a line with the json array of the messages of that interval,
+    /// the interval can be changed with `json-batch=<ms>`. json-binary is the same, but each array
+    /// is prefixed by its length as a 4 bytes big-endian integer instead of ending with a new line.
     ///
     /// Note that the JSON api is not stable yet.
     #[clap(long = "ui", default_value = "curses")]
@@ -92,6 +97,31 @@ pub struct ExecutionOpt {
     #[clap(long = "dry-run")]
     pub dry_run: bool,
 
+    /// Do not run anything, only print the estimated cost of the evaluation: the cache hits and
+    /// how long the executions that miss the cache would take
+    ///
+    /// The evaluation stops as soon as the estimate is computed, and no file is written inside the
+    /// task directory.
+    #[clap(long)]
+    pub estimate: bool,
+
+    /// Stop evaluating a solution on a subtask as soon as one of its testcases scores zero
+    ///
+    /// Only for the tasks whose subtask score is the minimum of the testcases: the evaluations of
+    /// the solution on the remaining testcases of the subtask that haven't started yet are skipped.
+    /// The testcases also in other subtasks are still evaluated, unless those failed too. The
+    /// scores are the same, but the skipped testcases are not checked.
+    #[clap(long = "skip-failed-subtasks")]
+    pub skip_failed_subtasks: bool,
+
+    /// Evaluate only the solutions and the testcases that changed since the last evaluation
+    ///
+    /// The results of the previous evaluations are stored inside bin/, keyed by the content of the
+    /// solution, of the files that generate the testcase and of the checker. The evaluations whose
+    /// files did not change are not run again, and their results are shown as they were.
+    #[clap(long)]
+    pub incremental: bool,
+
     /// Disable the cache for this comma separated list of tags
     #[clap(long = "no-cache", long_help = no_cache_long_help(), require_equals = true)]
     #[allow(clippy::option_option)]
@@ -121,6 +151,60 @@ pub struct ExecutionOpt {
     #[clap(long = "num-cores")]
     pub num_cores: Option<usize>,
 
+    /// Reserve this number of cores for the evaluation of the solutions.
+    ///
+    /// Each running solution gets a reserved core for itself, while the compilations, the
+    /// generators and the checkers run on the other cores, making the timings more stable. Only
+    /// local evaluations on Linux support it.
+    #[clap(long)]
+    pub timing_cores: Option<usize>,
+
+    /// Run again this many times the evaluations whose CPU time is close to the time limit
+    ///
+    /// The verdict uses the run with the median time, and the minimum, median and maximum times
+    /// are shown. Only the evaluations within --timing-margin of the limit are run again.
+    #[clap(long, default_value = "0")]
+    pub timing_reruns: usize,
+
+    /// How close to the time limit the CPU time must be for --timing-reruns, in percent of the
+    /// limit
+    #[clap(long, default_value = "10")]
+    pub timing_margin: f64,
+
+    /// Count the instructions and the cycles of the executions with the hardware counters
+    ///
+    /// Unlike the CPU time they don't depend on the load and on the frequency of the machine. The
+    /// tasks with an `instruction_limit` use it for the verdict instead of the time limit. Only
+    /// Linux hosts with the performance counters available support it, the others ignore it.
+    #[clap(long)]
+    pub hardware_counters: bool,
+
+    /// Profile the solutions on these comma separated testcases with `perf`
+    ///
+    /// The evaluations on these testcases are run again under `perf record`, so their results are
+    /// not affected. The functions where the solutions spent most of their time are shown at the
+    /// end, and the folded stacks, for the flame graph tools, are stored in bin/profiles/. Only
+    /// Batch tasks support it, and `perf` must be installed.
+    #[clap(long, value_delimiter = ',')]
+    pub profile: Vec<TestcaseId>,
+
+    /// Run each sandbox in its own cgroup inside this cgroup v2 directory
+    ///
+    /// The memory is then measured and limited on all the processes of the execution together,
+    /// including the page cache they fill. The directory must be writable, have the memory
+    /// controller available and no processes, and task-maker must run in another cgroup inside it.
+    /// Only local evaluations support it.
+    #[clap(long)]
+    pub cgroup_root: Option<PathBuf>,
+
+    /// The maximum total memory, in MiB, of the executions running at the same time.
+    ///
+    /// The memory limits of the running executions are summed, and the executions that would
+    /// exceed the budget wait for the others to finish. Defaults to the memory of the machine.
+    /// Only local evaluations support it.
+    #[clap(long)]
+    pub memory_budget: Option<u64>,
+
     /// Run the evaluation on a remote server instead of locally
     #[clap(long = "evaluate-on")]
     pub evaluate_on: Option<String>,
@@ -133,6 +217,26 @@ pub struct ExecutionOpt {
     /// locally.
     #[clap(long, default_value = "0")]
     pub priority: DagPriority,
+
+    /// Run first the executions with the longest chain of executions depending on them
+    ///
+    /// The duration of the executions is estimated from the previous runs stored in the cache.
+    #[clap(long)]
+    pub critical_path: bool,
+
+    /// Share of the workers of the remote server this evaluation is entitled to
+    ///
+    /// When more clients with the same priority are using the server, each of them gets a number
+    /// of jobs proportional to its share.
+    #[clap(long, default_value = "1")]
+    pub fair_share: f64,
+
+    /// Write a timeline of the evaluation to this file, in the Chrome trace-event format
+    ///
+    /// The file can be opened with Perfetto or chrome://tracing. Only local evaluations are
+    /// recorded: for remote ones use the option of the same name of the worker.
+    #[clap(long)]
+    pub trace_file: Option<PathBuf>,
 }
 
 #[derive(Parser, Debug, Clone)]
@@ -148,6 +252,29 @@ pub struct StorageOpt {
     /// When the storage is flushed, this is the new maximum size, in MiB.
     #[clap(long = "min-cache", default_value = "2048")]
     pub min_cache: u64,
+
+    /// Maximum size of the cache of the executions, in MiB
+    #[clap(long = "max-execution-cache", default_value = "256")]
+    pub max_execution_cache: u64,
+
+    /// When the cache of the executions is flushed, this is the new maximum size, in MiB.
+    #[clap(long = "min-execution-cache", default_value = "128")]
+    pub min_execution_cache: u64,
+
+    /// Compress the least recently used files of the storage, instead of removing them
+    ///
+    /// When the storage is full its oldest files are compressed, and only the ones already
+    /// compressed are removed. The files are decompressed again when needed.
+    #[clap(long = "compress-store")]
+    pub compress_store: bool,
+
+    /// URL of a cache of the executions shared with other machines
+    ///
+    /// The server must support the HTTP cache protocol of Bazel (`GET`/`PUT` of `/ac/<hash>` and
+    /// `/cas/<hash>`). The executions not in the local cache are looked up there, and the new
+    /// ones are uploaded to it.
+    #[clap(long = "remote-cache")]
+    pub remote_cache: Option<String>,
 }
 
 #[derive(Parser, Debug, Clone)]
@@ -170,6 +297,14 @@ pub struct TerryOpt {
     /// Force this seed instead of a random one.
     #[clap(long)]
     pub seed: Option<Seed>,
+
+    /// Run each solution and its checker together, piping the output into the checker
+    ///
+    /// The output of the solution is not stored, which saves a sandbox and a copy of the output
+    /// for each solution. The checker must read the output file sequentially. Ignored with
+    /// --copy-exe, since the output files are not available.
+    #[clap(long = "terry-fused")]
+    pub terry_fused: bool,
 }
 
 #[derive(Parser, Debug, Clone)]
@@ -228,7 +363,11 @@ impl Opt {
             solution_paths: self.filter.solution.clone(),
             disabled_sanity_checks: self.skip_sanity_checks.clone(),
             seed: self.terry.seed,
-            dry_run: self.execution.dry_run,
+            dry_run: self.execution.dry_run || self.execution.estimate,
+            skip_failed_subtasks: self.execution.skip_failed_subtasks,
+            incremental: self.execution.incremental,
+            terry_fused: self.terry.terry_fused,
+            profile: self.execution.profile.clone(),
         }
     }
 
@@ -8,18 +8,30 @@ use task_maker_exec::ductile::{
 };
 use url::{ParseError, Url};
 
+/// Parse the server url address, the scheme defaults to tcp.
+fn parse_server_url(server_url: &str) -> Result<Url, Error> {
+    match Url::parse(server_url) {
+        Ok(u) => Ok(u),
+        Err(ParseError::RelativeUrlWithoutBase) => {
+            Url::parse(&format!("tcp://{server_url}")).context("Invalid server url")
+        }
+        Err(e) => Err(e.into()),
+    }
+}
+
+/// The password in the server url address, if any.
+pub fn server_password<Str: AsRef<str>>(server_url: Str) -> Result<Option<String>, Error> {
+    Ok(parse_server_url(server_url.as_ref())?
+        .password()
+        .map(String::from))
+}
+
 /// Parse the server url address and try to connect to that host.
 pub fn connect_to_remote_server<S, R, Str: AsRef<str>>(
     server_url: Str,
     default_port: u16,
 ) -> Result<(ChannelSender<S>, ChannelReceiver<R>), Error> {
-    let url = match Url::parse(server_url.as_ref()) {
-        Ok(u) => u,
-        Err(ParseError::RelativeUrlWithoutBase) => {
-            Url::parse(&format!("tcp://{}", server_url.as_ref())).context("Invalid server url")?
-        }
-        Err(e) => return Err(e.into()),
-    };
+    let url = parse_server_url(server_url.as_ref())?;
 
     enum Schema {
         Tcp(Vec<SocketAddr>),
@@ -3,22 +3,49 @@ use std::fs::File;
 use std::io::BufWriter;
 use std::path::{Path, PathBuf};
 use std::process::Command;
-use std::sync::atomic::{AtomicU32, Ordering};
+use std::sync::atomic::{AtomicBool, AtomicU32, Ordering};
 use std::sync::Arc;
 
 use anyhow::{bail, Context, Error};
 use tabox::configuration::SandboxConfiguration;
-use tabox::result::SandboxExecutionResult;
 use tabox::{Sandbox, SandboxImplementation};
+use task_maker_exec::cgroup::{CgroupRoot, JoinedCgroup, CGROUP_ARG};
 use task_maker_exec::find_tools::find_tools_path;
+use task_maker_exec::hardware_counters::{CounterSet, HARDWARE_COUNTERS_ARG};
 use task_maker_exec::{RawSandboxResult, SandboxRunner};
 use tempfile::NamedTempFile;
 
-fn run_sandbox(config: &str) -> Result<SandboxExecutionResult, Error> {
-    let config = serde_json::from_str(config).context("Cannot parse configuration")?;
+fn run_sandbox(
+    config: &str,
+    counters: Option<&CounterSet>,
+    cgroup: Option<PathBuf>,
+) -> Result<RawSandboxResult, Error> {
+    let mut config: SandboxConfiguration =
+        serde_json::from_str(config).context("Cannot parse configuration")?;
+    // the memory limit is enforced on the whole cgroup instead of on each process
+    let cgroup = match cgroup {
+        Some(path) => Some(JoinedCgroup::join(path, config.memory_limit.take())?),
+        None => None,
+    };
     let sandbox = SandboxImplementation::run(config).context("Failed to create sandbox")?;
-    let res = sandbox.wait().context("Failed to wait sandbox")?;
-    Ok(res)
+    let done = AtomicBool::new(false);
+    let (res, anon_peak) = std::thread::scope(|scope| {
+        let anon_peak = cgroup
+            .as_ref()
+            .map(|cgroup| scope.spawn(|| cgroup.anon_peak(&done)));
+        let res = sandbox.wait();
+        done.store(true, Ordering::Release);
+        (res, anon_peak.map(|peak| peak.join()))
+    });
+    let mut res = res.context("Failed to wait sandbox")?;
+    // without memory.stat only the limit is enforced by the cgroup
+    if let Some(Ok(Ok(peak))) = anon_peak {
+        let usage = &mut res.resource_usage.memory_usage;
+        *usage = (*usage).max(peak);
+    }
+    // the counters are optional: without them the result is still valid
+    let counters = counters.and_then(|counters| counters.read().ok());
+    Ok(RawSandboxResult::Success(res, counters))
 }
 
 /// Run the sandbox for an execution.
@@ -26,8 +53,18 @@ pub fn main_sandbox() {
     let mut args = env::args().skip(2);
     let configuration = args.next().unwrap();
     let output_file = args.next().unwrap();
-    let result = match run_sandbox(&configuration) {
-        Ok(res) => RawSandboxResult::Success(res),
+    let mut counters = None;
+    let mut cgroup = None;
+    while let Some(arg) = args.next() {
+        if arg == HARDWARE_COUNTERS_ARG {
+            // the counters must be opened before spawning the sandbox, for being inherited by it
+            counters = CounterSet::open().ok();
+        } else if arg == CGROUP_ARG {
+            cgroup = args.next().map(PathBuf::from);
+        }
+    }
+    let result = match run_sandbox(&configuration, counters.as_ref(), cgroup) {
+        Ok(res) => res,
         Err(e) => {
             let err = format!("Error: {e:?}");
             RawSandboxResult::Error(err)
@@ -45,37 +82,70 @@ pub fn main_sandbox() {
 pub struct ToolsSandboxRunner {
     /// Path to the tools executable.
     tools_path: PathBuf,
+    /// Where to create the cgroups of the sandboxes, if they are used.
+    cgroup_root: Option<CgroupRoot>,
+}
+
+impl ToolsSandboxRunner {
+    /// Run each sandbox in its own cgroup inside `cgroup_root`, that measures and limits the memory
+    /// of all the processes of the sandbox together.
+    pub fn with_cgroup_root(mut self, cgroup_root: CgroupRoot) -> Self {
+        self.cgroup_root = Some(cgroup_root);
+        self
+    }
 }
 
 impl Default for ToolsSandboxRunner {
     fn default() -> Self {
         ToolsSandboxRunner {
             tools_path: find_tools_path(),
+            cgroup_root: None,
         }
     }
 }
 
 impl SandboxRunner for ToolsSandboxRunner {
-    fn run(&self, config: SandboxConfiguration, pid: Arc<AtomicU32>) -> RawSandboxResult {
-        tools_sandbox_internal(&self.tools_path, config, pid).into()
+    fn run(
+        &self,
+        config: SandboxConfiguration,
+        pid: Arc<AtomicU32>,
+        hardware_counters: bool,
+    ) -> RawSandboxResult {
+        tools_sandbox_internal(
+            &self.tools_path,
+            self.cgroup_root.as_ref(),
+            config,
+            pid,
+            hardware_counters,
+        )
+        .into()
     }
 }
 
 /// Actually run the sandbox, but with a return type that supports the `?` operator.
 fn tools_sandbox_internal(
     tools_path: &Path,
+    cgroup_root: Option<&CgroupRoot>,
     config: SandboxConfiguration,
     pid: Arc<AtomicU32>,
+    hardware_counters: bool,
 ) -> Result<RawSandboxResult, Error> {
     let config = serde_json::to_string(&config).context("Failed to serialize config")?;
     // TODO(veluca): it would be nice to write the result in the sandbox.
     let outfile = NamedTempFile::new().context("Failed creating output tempfile")?;
-    let mut cmd = Command::new(tools_path)
-        .arg("internal-sandbox")
+    let mut cmd = Command::new(tools_path);
+    cmd.arg("internal-sandbox")
         .arg(config)
-        .arg(outfile.path().as_os_str())
-        .spawn()
-        .context("Cannot spawn the sandbox")?;
+        .arg(outfile.path().as_os_str());
+    if hardware_counters {
+        cmd.arg(HARDWARE_COUNTERS_ARG);
+    }
+    // removed after the sandbox exited
+    let cgroup = cgroup_root.map(CgroupRoot::create).transpose()?;
+    if let Some(cgroup) = &cgroup {
+        cmd.arg(CGROUP_ARG).arg(cgroup.path());
+    }
+    let mut cmd = cmd.spawn().context("Cannot spawn the sandbox")?;
     pid.store(cmd.id(), Ordering::SeqCst);
     let status = cmd.wait().context("Failed to wait for the process")?;
     if !status.success() {
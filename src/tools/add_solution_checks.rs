@@ -62,6 +62,10 @@ pub fn main_add_solution_checks(
         disabled_sanity_checks: Default::default(),
         seed: Default::default(),
         dry_run: true,
+        skip_failed_subtasks: false,
+        incremental: false,
+        terry_fused: false,
+        profile: vec![],
     };
     let task = opt
         .find_task
@@ -0,0 +1,387 @@
+//! The metrics of the server, and the hook for scaling the number of workers with its load.
+//!
+//! The scheduler sends its metrics every few seconds. They are served at `/metrics`, in the text
+//! format of Prometheus, and they are used to decide when to call the hook: when the executions
+//! waiting for workers would take too long with the current workers, or when some workers have
+//! been idle for a while with nothing to run.
+
+use std::net::TcpListener;
+use std::process::Command;
+use std::sync::mpsc::{channel, Sender};
+use std::sync::{Arc, Mutex};
+use std::time::{Duration, Instant};
+
+use anyhow::{bail, Context, Error};
+use axum::extract::State;
+use axum::routing::get;
+use axum::Router;
+use clap::Parser;
+use task_maker_exec::{ExecutorMetrics, PhaseHistogram};
+
+/// Timeout of the requests to the webhook.
+const WEBHOOK_TIMEOUT: Duration = Duration::from_secs(30);
+
+#[derive(Parser, Debug, Clone)]
+pub struct AutoscaleOpt {
+    /// Address to serve the metrics of the server on, at `/metrics` in the Prometheus format
+    #[clap(long)]
+    pub metrics_addr: Option<String>,
+
+    /// Command or URL to call when the server needs more or fewer workers
+    ///
+    /// A command is run with `sh -c`, with the event (`scale-up` or `scale-down`) in
+    /// `TM_SCALE_EVENT` and the metrics in `TM_CONNECTED_WORKERS`, `TM_IDLE_WORKERS`,
+    /// `TM_READY_EXECS`, `TM_WAITING_EXECS` and `TM_BACKLOG_SECS`. An `http://` or `https://` URL
+    /// receives a POST with the event and the metrics in JSON.
+    #[clap(long)]
+    pub scale_hook: Option<String>,
+
+    /// Ask for more workers when the estimated backlog exceeds these seconds per worker
+    #[clap(long, default_value = "300")]
+    pub scale_up_backlog: u64,
+
+    /// Ask for fewer workers when some of them are idle, with nothing to run, for these seconds
+    #[clap(long, default_value = "600")]
+    pub scale_down_idle: u64,
+
+    /// Minimum number of seconds between two calls of the scale hook
+    #[clap(long, default_value = "300")]
+    pub scale_cooldown: u64,
+}
+
+/// A change of the number of workers the server needs.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+enum ScaleEvent {
+    /// The server needs more workers.
+    ScaleUp,
+    /// The server has more workers than it needs.
+    ScaleDown,
+}
+
+/// Decides when the hook should be called, from the metrics of the server.
+#[derive(Debug)]
+struct Autoscaler {
+    /// The backlog per worker above which more workers are needed.
+    scale_up_backlog: Duration,
+    /// For how long some workers should be idle before fewer workers are needed.
+    scale_down_idle: Duration,
+    /// The minimum time between two events.
+    cooldown: Duration,
+    /// When the last event was fired, if any.
+    last_event: Option<Instant>,
+    /// Since when some workers are idle with nothing to run.
+    idle_since: Option<Instant>,
+}
+
+impl ScaleEvent {
+    /// The name of the event, passed to the hook.
+    fn name(&self) -> &'static str {
+        match self {
+            ScaleEvent::ScaleUp => "scale-up",
+            ScaleEvent::ScaleDown => "scale-down",
+        }
+    }
+}
+
+impl Autoscaler {
+    /// Make an autoscaler with the thresholds of the options.
+    fn new(opt: &AutoscaleOpt) -> Autoscaler {
+        Autoscaler {
+            scale_up_backlog: Duration::from_secs(opt.scale_up_backlog),
+            scale_down_idle: Duration::from_secs(opt.scale_down_idle),
+            cooldown: Duration::from_secs(opt.scale_cooldown),
+            last_event: None,
+            idle_since: None,
+        }
+    }
+
+    /// Update the state with the metrics received at `now`, returning the event to fire, if any.
+    fn update(&mut self, metrics: &ExecutorMetrics, now: Instant) -> Option<ScaleEvent> {
+        if metrics.ready_execs == 0 && metrics.idle_workers > 0 {
+            self.idle_since.get_or_insert(now);
+        } else {
+            self.idle_since = None;
+        }
+        let workers = metrics.connected_workers.max(1) as u32;
+        let event = if metrics.ready_execs > 0
+            && (metrics.connected_workers == 0 || metrics.backlog / workers > self.scale_up_backlog)
+        {
+            ScaleEvent::ScaleUp
+        } else if self
+            .idle_since
+            .is_some_and(|since| now - since >= self.scale_down_idle)
+        {
+            ScaleEvent::ScaleDown
+        } else {
+            return None;
+        };
+        if let Some(last_event) = self.last_event {
+            if now - last_event < self.cooldown {
+                return None;
+            }
+        }
+        self.last_event = Some(now);
+        self.idle_since = None;
+        Some(event)
+    }
+}
+
+/// Start serving the metrics and calling the scale hook, as configured in the options. Returns the
+/// channel where the metrics of the scheduler should be sent, if they are needed.
+pub fn start_autoscaling(opt: &AutoscaleOpt) -> Result<Option<Sender<ExecutorMetrics>>, Error> {
+    if opt.metrics_addr.is_none() && opt.scale_hook.is_none() {
+        return Ok(None);
+    }
+    let current = Arc::new(Mutex::new(ExecutorMetrics::default()));
+    if let Some(addr) = &opt.metrics_addr {
+        serve_metrics(addr, current.clone())?;
+    }
+    let (sender, receiver) = channel();
+    let hook = opt.scale_hook.clone();
+    let mut autoscaler = Autoscaler::new(opt);
+    std::thread::Builder::new()
+        .name("Autoscaler".into())
+        .spawn(move || {
+            while let Ok(metrics) = receiver.recv() {
+                let event = autoscaler.update(&metrics, Instant::now());
+                if let (Some(hook), Some(event)) = (&hook, event) {
+                    info!("Calling the scale hook for {}: {metrics:?}", event.name());
+                    if let Err(e) = call_hook(hook, event, &metrics) {
+                        warn!("The scale hook failed: {e:?}");
+                    }
+                }
+                *current.lock().unwrap() = metrics;
+            }
+        })
+        .context("Failed to spawn the autoscaler thread")?;
+    Ok(Some(sender))
+}
+
+/// Serve the last metrics received at `/metrics` of `addr`, from a new thread.
+fn serve_metrics(addr: &str, metrics: Arc<Mutex<ExecutorMetrics>>) -> Result<(), Error> {
+    // bind here, so that the errors are reported when the server starts
+    let listener = TcpListener::bind(addr)
+        .with_context(|| format!("Failed to bind the metrics address {addr}"))?;
+    listener
+        .set_nonblocking(true)
+        .context("Failed to set the metrics socket as non-blocking")?;
+    info!("Serving the metrics at http://{addr}/metrics");
+    let runtime = tokio::runtime::Builder::new_current_thread()
+        .enable_all()
+        .build()
+        .context("Failed to start the runtime of the metrics server")?;
+    std::thread::Builder::new()
+        .name("Metrics server".into())
+        .spawn(move || {
+            let result = runtime.block_on(async move {
+                let listener = tokio::net::TcpListener::from_std(listener)?;
+                let app = Router::new()
+                    .route("/metrics", get(get_metrics))
+                    .with_state(metrics);
+                axum::serve(listener, app).await
+            });
+            if let Err(e) = result {
+                error!("The metrics server failed: {e:?}");
+            }
+        })
+        .context("Failed to spawn the metrics server thread")?;
+    Ok(())
+}
+
+/// The handler of `/metrics`.
+async fn get_metrics(State(metrics): State<Arc<Mutex<ExecutorMetrics>>>) -> String {
+    let metrics = metrics.lock().unwrap().clone();
+    prometheus_metrics(&metrics)
+}
+
+/// Format the metrics in the text format of Prometheus.
+fn prometheus_metrics(metrics: &ExecutorMetrics) -> String {
+    let gauges = [
+        (
+            "connected_workers",
+            "Number of connected workers.",
+            metrics.connected_workers as f64,
+        ),
+        (
+            "idle_workers",
+            "Number of connected workers without a job.",
+            metrics.idle_workers as f64,
+        ),
+        (
+            "ready_execs",
+            "Number of executions waiting for workers.",
+            metrics.ready_execs as f64,
+        ),
+        (
+            "waiting_execs",
+            "Number of executions waiting for dependencies.",
+            metrics.waiting_execs as f64,
+        ),
+        (
+            "backlog_seconds",
+            "Estimated time for a single worker to run the executions waiting for workers.",
+            metrics.backlog.as_secs_f64(),
+        ),
+    ];
+    let mut text = String::new();
+    for (name, help, value) in gauges {
+        text += &format!("# HELP task_maker_{name} {help}\n");
+        text += &format!("# TYPE task_maker_{name} gauge\n");
+        text += &format!("task_maker_{name} {value}\n");
+    }
+
+    let name = "task_maker_sandbox_overhead_seconds";
+    text += &format!("# HELP {name} Time spent by the workers in each phase of the executions.\n");
+    text += &format!("# TYPE {name} histogram\n");
+    for (worker, overhead) in &metrics.worker_overhead {
+        for (phase, histogram) in &overhead.phases {
+            let labels = format!("worker=\"{}\",phase=\"{phase}\"", worker.escape_default());
+            let mut cumulative = 0;
+            for (index, count) in histogram.buckets.iter().enumerate() {
+                cumulative += count;
+                let bound = PhaseHistogram::bucket_bound(index).as_secs_f64();
+                text += &format!("{name}_bucket{{{labels},le=\"{bound}\"}} {cumulative}\n");
+            }
+            text += &format!("{name}_bucket{{{labels},le=\"+Inf\"}} {}\n", histogram.count);
+            let sum = histogram.total_us as f64 / 1e6;
+            text += &format!("{name}_sum{{{labels}}} {sum}\n");
+            text += &format!("{name}_count{{{labels}}} {}\n", histogram.count);
+        }
+    }
+    text
+}
+
+/// Call the hook for the event, either running the command or sending the request to the URL.
+fn call_hook(hook: &str, event: ScaleEvent, metrics: &ExecutorMetrics) -> Result<(), Error> {
+    if hook.starts_with("http://") || hook.starts_with("https://") {
+        let body = serde_json::json!({
+            "event": event.name(),
+            "connected_workers": metrics.connected_workers,
+            "idle_workers": metrics.idle_workers,
+            "ready_execs": metrics.ready_execs,
+            "waiting_execs": metrics.waiting_execs,
+            "backlog_secs": metrics.backlog.as_secs_f64(),
+        });
+        let response = reqwest::blocking::Client::builder()
+            .timeout(WEBHOOK_TIMEOUT)
+            .build()
+            .context("Failed to build the HTTP client")?
+            .post(hook)
+            .header("Content-Type", "application/json")
+            .body(body.to_string())
+            .send()
+            .context("Failed to send the request to the webhook")?;
+        if !response.status().is_success() {
+            bail!("The webhook responded with {}", response.status());
+        }
+    } else {
+        let status = Command::new("sh")
+            .arg("-c")
+            .arg(hook)
+            .env("TM_SCALE_EVENT", event.name())
+            .env(
+                "TM_CONNECTED_WORKERS",
+                metrics.connected_workers.to_string(),
+            )
+            .env("TM_IDLE_WORKERS", metrics.idle_workers.to_string())
+            .env("TM_READY_EXECS", metrics.ready_execs.to_string())
+            .env("TM_WAITING_EXECS", metrics.waiting_execs.to_string())
+            .env("TM_BACKLOG_SECS", metrics.backlog.as_secs().to_string())
+            .status()
+            .context("Failed to run the scale hook")?;
+        if !status.success() {
+            bail!("The scale hook exited with {status}");
+        }
+    }
+    Ok(())
+}
+
+#[cfg(test)]
+mod tests {
+    use task_maker_exec::OverheadHistograms;
+
+    use super::*;
+
+    #[test]
+    fn test_autoscaler() {
+        let mut autoscaler = Autoscaler::new(&AutoscaleOpt {
+            metrics_addr: None,
+            scale_hook: None,
+            scale_up_backlog: 100,
+            scale_down_idle: 60,
+            scale_cooldown: 30,
+        });
+        let start = Instant::now();
+        let at = |secs| start + Duration::from_secs(secs);
+        let busy = ExecutorMetrics {
+            connected_workers: 2,
+            idle_workers: 0,
+            ready_execs: 50,
+            backlog: Duration::from_secs(500),
+            ..Default::default()
+        };
+        let idle = ExecutorMetrics {
+            connected_workers: 2,
+            idle_workers: 1,
+            ..Default::default()
+        };
+
+        assert_eq!(autoscaler.update(&busy, at(0)), Some(ScaleEvent::ScaleUp));
+        // still too much work, but the workers asked have yet to come
+        assert_eq!(autoscaler.update(&busy, at(10)), None);
+        assert_eq!(autoscaler.update(&busy, at(40)), Some(ScaleEvent::ScaleUp));
+        // some workers need to be idle for a while
+        assert_eq!(autoscaler.update(&idle, at(100)), None);
+        assert_eq!(autoscaler.update(&idle, at(150)), None);
+        assert_eq!(
+            autoscaler.update(&idle, at(160)),
+            Some(ScaleEvent::ScaleDown)
+        );
+        assert_eq!(autoscaler.update(&idle, at(200)), None);
+        // the backlog is small enough for the workers
+        let small = ExecutorMetrics {
+            backlog: Duration::from_secs(150),
+            ..busy
+        };
+        assert_eq!(autoscaler.update(&small, at(300)), None);
+        // a job without workers always needs one
+        let no_workers = ExecutorMetrics {
+            connected_workers: 0,
+            ready_execs: 1,
+            ..Default::default()
+        };
+        assert_eq!(
+            autoscaler.update(&no_workers, at(400)),
+            Some(ScaleEvent::ScaleUp)
+        );
+    }
+
+    #[test]
+    fn test_prometheus_metrics() {
+        let mut overhead = OverheadHistograms::default();
+        overhead.phases.insert(
+            "setup".into(),
+            PhaseHistogram {
+                count: 3,
+                total_us: 2500,
+                buckets: vec![1, 0, 2],
+            },
+        );
+        let text = prometheus_metrics(&ExecutorMetrics {
+            connected_workers: 3,
+            backlog: Duration::from_millis(1500),
+            worker_overhead: [("w1".to_string(), overhead)].into_iter().collect(),
+            ..Default::default()
+        });
+        assert!(text.contains("# TYPE task_maker_connected_workers gauge\n"));
+        assert!(text.contains("\ntask_maker_connected_workers 3\n"));
+        assert!(text.contains("\ntask_maker_backlog_seconds 1.5\n"));
+        let bucket = "task_maker_sandbox_overhead_seconds_bucket{worker=\"w1\",phase=\"setup\"";
+        assert!(text.contains(&format!("\n{bucket},le=\"0.000002\"}} 1\n")));
+        assert!(text.contains(&format!("\n{bucket},le=\"0.000008\"}} 3\n")));
+        assert!(text.contains(&format!("\n{bucket},le=\"+Inf\"}} 3\n")));
+        assert!(text.contains(
+            "\ntask_maker_sandbox_overhead_seconds_sum{worker=\"w1\",phase=\"setup\"} 0.0025\n"
+        ));
+    }
+}
@@ -0,0 +1,165 @@
+//! Benchmark of the scheduler on large synthetic DAGs.
+//!
+//! The DAG is made of `depth` layers of `width` executions: each execution of the first layer reads
+//! a provided file, the ones of the other layers read the outputs of two executions of the previous
+//! layer. The executions don't actually run anything, so the time measured is only the overhead
+//! of task-maker: building and checking the DAG, scheduling the executions, preparing the
+//! sandboxes and moving the files around.
+
+use std::path::Path;
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::sync::Arc;
+use std::time::{Duration, Instant};
+
+use anyhow::{bail, Context, Error};
+use clap::Parser;
+use task_maker_dag::{CompactDAG, Execution, ExecutionCommand, ExecutionDAG, File};
+use task_maker_exec::{check_dag, eval_dag_locally, ExecutionDAGWatchSet, SuccessSandboxRunner};
+
+#[derive(Parser, Debug)]
+pub struct BenchSchedulerOpt {
+    /// Number of executions in each layer of the DAG
+    #[clap(long, default_value = "1000")]
+    pub width: usize,
+
+    /// Number of layers of the DAG
+    ///
+    /// The executions after the first layer depend on the outputs of two executions of the
+    /// previous layer.
+    #[clap(long, default_value = "10")]
+    pub depth: usize,
+
+    /// The number of local workers to use
+    #[clap(long = "num-cores")]
+    pub num_cores: Option<usize>,
+}
+
+pub fn main_bench_scheduler(opt: BenchSchedulerOpt) -> Result<(), Error> {
+    if opt.width == 0 || opt.depth == 0 {
+        bail!("The DAG must have at least one execution");
+    }
+    let num_cores = opt.num_cores.unwrap_or_else(num_cpus::get_physical);
+    let tmpdir = tempfile::TempDir::new().context("Failed to create temporary directory")?;
+
+    let start = Instant::now();
+    let (dag, num_groups) = build_dag(opt.width, opt.depth)?;
+    let dag_time = start.elapsed();
+
+    let check_time = time_check_dag(&dag)?;
+    // the check must stay linear: compare it with the one of a DAG with half the layers
+    let half_check_time = if opt.depth > 1 {
+        let (half, _) = build_dag(opt.width, opt.depth / 2)?;
+        let time = time_check_dag(&half)?;
+        Some(time.as_secs_f64() * opt.depth as f64 / (opt.depth / 2) as f64)
+    } else {
+        None
+    };
+
+    let completed = Arc::new(AtomicUsize::new(0));
+    let mut dag = dag;
+    let groups: Vec<_> = dag.data.execution_groups.keys().copied().collect();
+    for group in &groups {
+        let completed = completed.clone();
+        dag.on_execution_done(group, move |_| {
+            completed.fetch_add(1, Ordering::Relaxed);
+            Ok(())
+        });
+    }
+
+    let start = Instant::now();
+    eval_dag_locally(
+        dag,
+        tmpdir.path().join("store"),
+        num_cores,
+        tmpdir.path().join("sandboxes"),
+        1 << 30,
+        1 << 29,
+        SuccessSandboxRunner,
+    );
+    let eval_time = start.elapsed();
+    let completed = completed.load(Ordering::Relaxed);
+    if completed != num_groups {
+        bail!("Only {completed} of the {num_groups} executions completed");
+    }
+
+    let per_group = |time: Duration| time.as_secs_f64() * 1e6 / num_groups as f64;
+    println!(
+        "{} executions ({} x {}), {} workers",
+        num_groups, opt.width, opt.depth, num_cores
+    );
+    println!(
+        "Building the DAG:   {:>10.3}s {:>10.1}µs/execution",
+        dag_time.as_secs_f64(),
+        per_group(dag_time)
+    );
+    println!(
+        "Checking the DAG:   {:>10.3}s {:>10.1}µs/execution",
+        check_time.as_secs_f64(),
+        per_group(check_time)
+    );
+    if let Some(half_check_time) = half_check_time {
+        println!(
+            "Checking, linear:   {:>10.3}s (extrapolated from the DAG with half the layers)",
+            half_check_time
+        );
+    }
+    println!(
+        "Evaluating the DAG: {:>10.3}s {:>10.1}µs/execution",
+        eval_time.as_secs_f64(),
+        per_group(eval_time)
+    );
+    match peak_memory() {
+        Some(peak) => println!("Peak memory:        {:>10.1}MiB", peak as f64 / 1024.0),
+        None => println!("Peak memory:        unknown"),
+    }
+    Ok(())
+}
+
+/// Check the DAG, including building its compact representation, returning how long it took.
+fn time_check_dag(dag: &ExecutionDAG) -> Result<Duration, Error> {
+    let data = dag.data.clone();
+    let start = Instant::now();
+    let compact = CompactDAG::new(data);
+    check_dag(&compact, &ExecutionDAGWatchSet::default()).context("Invalid DAG")?;
+    Ok(start.elapsed())
+}
+
+/// Build the synthetic DAG, returning it with its number of executions.
+fn build_dag(width: usize, depth: usize) -> Result<(ExecutionDAG, usize), Error> {
+    let mut dag = ExecutionDAG::new();
+    let input = File::new("Input");
+    let input_uuid = input.uuid;
+    dag.provide_file(input, Path::new("/dev/null"))
+        .context("Failed to provide the input file")?;
+    let mut previous: Vec<File> = vec![];
+    for layer in 0..depth {
+        let mut outputs = Vec::with_capacity(width);
+        for index in 0..width {
+            let mut exec = Execution::new(
+                format!("Execution {index} of layer {layer}"),
+                ExecutionCommand::system("true"),
+            );
+            // different arguments make the executions different for the cache
+            exec.args(vec![layer.to_string(), index.to_string()]);
+            if previous.is_empty() {
+                exec.stdin(input_uuid);
+            } else {
+                exec.input(&previous[index], "first", false);
+                exec.input(&previous[(index + 1) % width], "second", false);
+            }
+            outputs.push(exec.capture_stdout(None));
+            dag.add_execution(exec);
+        }
+        previous = outputs;
+    }
+    Ok((dag, width * depth))
+}
+
+/// The peak resident memory of this process, in KiB, if it is known.
+pub(crate) fn peak_memory() -> Option<u64> {
+    let status = std::fs::read_to_string("/proc/self/status").ok()?;
+    status
+        .lines()
+        .find_map(|line| line.strip_prefix("VmHWM:"))
+        .and_then(|value| value.trim().trim_end_matches("kB").trim().parse().ok())
+}
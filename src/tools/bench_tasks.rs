@@ -0,0 +1,303 @@
+//! End-to-end benchmark of the evaluation of whole tasks, by default the ones used by the tests.
+//!
+//! Each task is evaluated a first time with an empty store (cold) and then again reusing it, so
+//! that the executions come from the cache (warm). For each run the wall time of each phase is
+//! measured from the first execution of the phase that starts to the last one that completes,
+//! together with the time for building the DAG, the peak memory of this process and the ratio of
+//! the executions taken from the cache. The results are written as JSON, for comparing them
+//! between versions.
+
+use std::collections::BTreeMap;
+use std::path::{Path, PathBuf};
+use std::sync::{Arc, Mutex};
+use std::time::Instant;
+
+use anyhow::{bail, Context, Error};
+use clap::Parser;
+use serde::Serialize;
+use task_maker_dag::ExecutionResult;
+use task_maker_format::ui::UIType;
+use task_maker_format::{find_task, EvaluationConfig};
+
+use crate::context::RuntimeContext;
+use crate::tools::bench_scheduler::peak_memory;
+use crate::{ExecutionOpt, StorageOpt};
+
+/// The phase of the executions without a tag.
+const UNTAGGED_PHASE: &str = "other";
+
+#[derive(Parser, Debug)]
+pub struct BenchTasksOpt {
+    /// The directories of the tasks to evaluate
+    ///
+    /// By default all the tasks inside `--tasks-dir` are evaluated.
+    pub tasks: Vec<PathBuf>,
+
+    /// Where to look for the tasks when none is specified
+    #[clap(long, default_value = "tests/tasks")]
+    pub tasks_dir: PathBuf,
+
+    /// Number of warm runs of each task, after the cold one
+    #[clap(long, default_value = "1")]
+    pub warm_runs: usize,
+
+    /// Write the results to this file instead of the standard output
+    #[clap(long, short)]
+    pub output: Option<PathBuf>,
+
+    #[clap(flatten, next_help_heading = Some("EXECUTION"))]
+    pub execution: ExecutionOpt,
+
+    // each task uses a new store in a temporary directory, so `--store-dir` is ignored
+    #[clap(flatten, next_help_heading = Some("STORAGE"))]
+    pub storage: StorageOpt,
+}
+
+/// The results of the benchmark.
+#[derive(Debug, Serialize)]
+struct BenchReport {
+    /// The version of task-maker benchmarked.
+    version: &'static str,
+    /// The results of each task.
+    tasks: Vec<TaskReport>,
+}
+
+/// The results of the runs of a task.
+#[derive(Debug, Serialize)]
+struct TaskReport {
+    /// The directory of the task.
+    task: PathBuf,
+    /// The cold run first, then the warm ones.
+    runs: Vec<RunReport>,
+}
+
+/// The measurements of a single evaluation of a task.
+#[derive(Debug, Serialize, Default)]
+struct RunReport {
+    /// Whether the store was already filled by a previous run.
+    warm: bool,
+    /// The error that stopped the evaluation, if any.
+    error: Option<String>,
+    /// The wall time of the whole run, in seconds.
+    total_secs: f64,
+    /// The wall time for parsing the task and building its DAG, in seconds.
+    dag_build_secs: f64,
+    /// The executions of each phase, by the name of their tag.
+    phases: BTreeMap<String, PhaseReport>,
+    /// The peak resident memory of task-maker during the run, in KiB, if known.
+    peak_rss_kib: Option<u64>,
+    /// The fraction of the completed executions taken from the cache.
+    cache_hit_ratio: f64,
+}
+
+/// The measurements of the executions with the same tag.
+#[derive(Debug, Serialize, Default, Clone)]
+struct PhaseReport {
+    /// The time from the first execution that started to the last that completed, in seconds.
+    wall_secs: f64,
+    /// The number of executions completed.
+    executions: usize,
+    /// The number of executions taken from the cache.
+    cached: usize,
+    /// When the first execution started or completed.
+    #[serde(skip)]
+    first: Option<Instant>,
+    /// When the last execution completed.
+    #[serde(skip)]
+    last: Option<Instant>,
+}
+
+impl PhaseReport {
+    /// An execution of the phase started, or completed for the cached ones that never start.
+    fn started(&mut self, now: Instant) {
+        self.first = Some(self.first.map_or(now, |first| first.min(now)));
+    }
+
+    /// An execution of the phase completed with these results.
+    fn done(&mut self, results: &[ExecutionResult]) {
+        let now = Instant::now();
+        self.started(now);
+        self.last = Some(self.last.map_or(now, |last| last.max(now)));
+        self.executions += 1;
+        if results.iter().all(|result| result.was_cached) {
+            self.cached += 1;
+        }
+        if let (Some(first), Some(last)) = (self.first, self.last) {
+            self.wall_secs = (last - first).as_secs_f64();
+        }
+    }
+}
+
+pub fn main_bench_tasks(opt: BenchTasksOpt) -> Result<(), Error> {
+    let tasks = if opt.tasks.is_empty() {
+        list_tasks(&opt.tasks_dir)?
+    } else {
+        opt.tasks.clone()
+    };
+    if tasks.is_empty() {
+        bail!("No task to evaluate");
+    }
+
+    let mut report = BenchReport {
+        version: env!("CARGO_PKG_VERSION"),
+        tasks: vec![],
+    };
+    for task in tasks {
+        let store_dir = tempfile::TempDir::new().context("Failed to create temporary directory")?;
+        let mut runs = vec![];
+        for run in 0..=opt.warm_runs {
+            info!("Evaluating {} (run {})", task.display(), run);
+            let mut run_report = run_task(&task, store_dir.path(), &opt);
+            run_report.warm = run > 0;
+            if let Some(error) = &run_report.error {
+                warn!("Evaluation of {} failed: {}", task.display(), error);
+            }
+            runs.push(run_report);
+        }
+        report.tasks.push(TaskReport { task, runs });
+    }
+
+    let json = serde_json::to_string_pretty(&report).context("Failed to serialize the report")?;
+    match &opt.output {
+        Some(output) => std::fs::write(output, json)
+            .with_context(|| format!("Failed to write {}", output.display()))?,
+        None => println!("{json}"),
+    }
+    Ok(())
+}
+
+/// The directories inside `tasks_dir`, sorted by name.
+fn list_tasks(tasks_dir: &Path) -> Result<Vec<PathBuf>, Error> {
+    let mut tasks = vec![];
+    for entry in std::fs::read_dir(tasks_dir)
+        .with_context(|| format!("Failed to list {}", tasks_dir.display()))?
+    {
+        let path = entry.context("Failed to list the tasks")?.path();
+        if path.is_dir() {
+            tasks.push(path);
+        }
+    }
+    tasks.sort();
+    Ok(tasks)
+}
+
+/// Evaluate the task using the store in `store_dir`, measuring the run. If the evaluation fails
+/// the error is reported together with what was measured until then.
+fn run_task(task_dir: &Path, store_dir: &Path, opt: &BenchTasksOpt) -> RunReport {
+    let phases = Arc::new(Mutex::new(BTreeMap::new()));
+    let mut report = RunReport::default();
+    reset_peak_memory();
+    let start = Instant::now();
+    if let Err(e) = evaluate_task(task_dir, store_dir, opt, &phases, &mut report) {
+        report.error = Some(format!("{e:?}"));
+    }
+    report.total_secs = start.elapsed().as_secs_f64();
+    report.peak_rss_kib = peak_memory();
+    report.phases = phases.lock().unwrap().clone();
+    let executions: usize = report.phases.values().map(|p| p.executions).sum();
+    let cached: usize = report.phases.values().map(|p| p.cached).sum();
+    if executions > 0 {
+        report.cache_hit_ratio = cached as f64 / executions as f64;
+    }
+    report
+}
+
+/// Build the DAG of the task and evaluate it, recording the executions of each phase.
+fn evaluate_task(
+    task_dir: &Path,
+    store_dir: &Path,
+    opt: &BenchTasksOpt,
+    phases: &Arc<Mutex<BTreeMap<String, PhaseReport>>>,
+    report: &mut RunReport,
+) -> Result<(), Error> {
+    // the benchmark must not touch the task directories
+    let mut execution = opt.execution.clone();
+    execution.dry_run = true;
+    let eval_config = EvaluationConfig {
+        no_statement: true,
+        dry_run: true,
+        ..Default::default()
+    };
+
+    let start = Instant::now();
+    let task = find_task(Some(task_dir.into()), 1, &eval_config)
+        .with_context(|| format!("Invalid task directory {}", task_dir.display()))?;
+    let mut context = RuntimeContext::new(task, &execution, |task, eval| {
+        task.build_dag(eval, &eval_config)
+            .context("Cannot build the task DAG")
+    })?;
+    report.dag_build_secs = start.elapsed().as_secs_f64();
+
+    let dag = &mut context.eval.dag;
+    let groups: Vec<_> = dag
+        .data
+        .execution_groups
+        .values()
+        .map(|group| {
+            let phase = group
+                .tag
+                .as_ref()
+                .map_or(UNTAGGED_PHASE.to_string(), |tag| tag.name.clone());
+            (group.uuid, phase)
+        })
+        .collect();
+    for (group, phase) in groups {
+        phases.lock().unwrap().entry(phase.clone()).or_default();
+        let on_start = (phases.clone(), phase.clone());
+        dag.on_execution_start(&group, move |_| {
+            let (phases, phase) = on_start;
+            if let Some(phase) = phases.lock().unwrap().get_mut(&phase) {
+                phase.started(Instant::now());
+            }
+            Ok(())
+        });
+        let phases = phases.clone();
+        dag.on_execution_done(&group, move |results| {
+            if let Some(phase) = phases.lock().unwrap().get_mut(&phase) {
+                phase.done(results);
+            }
+            Ok(())
+        });
+    }
+
+    let storage = StorageOpt {
+        store_dir: Some(store_dir.into()),
+        ..opt.storage.clone()
+    };
+    let executor = context.connect_executor(&execution, &storage)?;
+    let executor = executor.start_ui(&UIType::Silent, |_, _| {})?;
+    executor.execute()
+}
+
+/// Reset the peak resident memory of this process to the current one, so that the peak of each run
+/// is measured separately.
+fn reset_peak_memory() {
+    if let Err(e) = std::fs::write("/proc/self/clear_refs", "5") {
+        debug!("Cannot reset the peak memory: {e}");
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use std::time::Duration;
+
+    use super::*;
+
+    #[test]
+    fn test_phase_report() {
+        let mut phase = PhaseReport::default();
+        let start = Instant::now();
+        phase.started(start);
+        std::thread::sleep(Duration::from_millis(10));
+        let cached = ExecutionResult {
+            was_cached: true,
+            ..Default::default()
+        };
+        phase.done(&[cached.clone(), cached.clone()]);
+        phase.done(&[cached, ExecutionResult::default()]);
+        assert_eq!(phase.executions, 2);
+        assert_eq!(phase.cached, 1);
+        assert_eq!(phase.first, Some(start));
+        assert!(phase.wall_secs >= 0.01);
+    }
+}
@@ -50,6 +50,10 @@ pub fn main_booklet(mut opt: BookletOpt, logger_opt: LoggerOpt) -> Result<(), Er
         disabled_sanity_checks: vec![],
         seed: None,
         dry_run: opt.execution.dry_run,
+        skip_failed_subtasks: false,
+        incremental: false,
+        terry_fused: false,
+        profile: vec![],
     };
 
     if opt.contest_dir.is_some() && !opt.task_dir.is_empty() {
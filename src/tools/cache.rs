@@ -0,0 +1,180 @@
+use std::collections::HashMap;
+use std::path::PathBuf;
+
+use anyhow::{Context, Error};
+use clap::Parser;
+use task_maker_cache::{Cache, CacheBundle, CacheResult};
+use task_maker_dag::{ExecutionDAGData, ExecutionGroup, FileUuid, ProvidedFile};
+use task_maker_format::EvaluationConfig;
+use task_maker_store::{FileStore, FileStoreHandle};
+
+use crate::context::RuntimeContext;
+use crate::{BookletOpt, ExecutionOpt, FilterOpt, FindTaskOpt, StorageOpt};
+
+#[derive(Parser, Debug)]
+pub struct CacheOpt {
+    /// What to do with the cache
+    #[clap(subcommand)]
+    pub action: CacheAction,
+}
+
+#[derive(Parser, Debug)]
+pub enum CacheAction {
+    /// Export the cached executions of a task, with their output files, to a bundle
+    Export(CacheExportOpt),
+    /// Import a bundle made by `export` into the local cache
+    Import(CacheImportOpt),
+}
+
+#[derive(Parser, Debug)]
+pub struct CacheExportOpt {
+    /// Where to write the bundle
+    pub bundle: PathBuf,
+
+    #[clap(flatten, next_help_heading = Some("TASK SEARCH"))]
+    pub find_task: FindTaskOpt,
+
+    #[clap(flatten, next_help_heading = Some("FILTER"))]
+    pub filter: FilterOpt,
+
+    #[clap(flatten, next_help_heading = Some("BOOKLET"))]
+    pub booklet: BookletOpt,
+
+    #[clap(flatten, next_help_heading = Some("EXECUTION"))]
+    pub execution: ExecutionOpt,
+
+    #[clap(flatten, next_help_heading = Some("STORAGE"))]
+    pub storage: StorageOpt,
+}
+
+#[derive(Parser, Debug)]
+pub struct CacheImportOpt {
+    /// The bundle to import
+    pub bundle: PathBuf,
+
+    #[clap(flatten, next_help_heading = Some("STORAGE"))]
+    pub storage: StorageOpt,
+}
+
+pub fn main_cache(opt: CacheOpt) -> Result<(), Error> {
+    match opt.action {
+        CacheAction::Export(opt) => main_cache_export(opt),
+        CacheAction::Import(opt) => main_cache_import(opt),
+    }
+}
+
+/// Open the file store and the cache of the executions.
+fn open_cache(storage: &StorageOpt) -> Result<(FileStore, Cache), Error> {
+    let store_path = storage.store_dir();
+    let file_store = FileStore::new(
+        store_path.join("store"),
+        storage.max_cache * 1024 * 1024,
+        storage.min_cache * 1024 * 1024,
+    )
+    .context("Cannot create the file store")?;
+    let cache = Cache::new(store_path.join("cache")).context("Cannot create the cache")?;
+    Ok((file_store, cache))
+}
+
+fn main_cache_export(opt: CacheExportOpt) -> Result<(), Error> {
+    let eval_config = EvaluationConfig {
+        solution_filter: opt.filter.filter,
+        booklet_solutions: opt.booklet.booklet_solutions,
+        no_statement: opt.booklet.no_statement,
+        solution_paths: opt.filter.solution,
+        disabled_sanity_checks: Default::default(),
+        seed: Default::default(),
+        dry_run: true,
+        skip_failed_subtasks: false,
+        incremental: false,
+        terry_fused: false,
+        profile: vec![],
+    };
+    let task = opt
+        .find_task
+        .find_task(&eval_config)
+        .context("Failed to locate the task")?;
+    let context = RuntimeContext::new(task, &opt.execution, |task, eval| {
+        task.build_dag(eval, &eval_config)
+            .context("Cannot build the task DAG")
+    })?;
+    let dag = &context.eval.dag.data;
+
+    let (file_store, mut cache) = open_cache(&opt.storage)?;
+    let mut bundle = CacheBundle::new();
+    let exported = export_dag(dag, &mut cache, &file_store, &mut bundle)?;
+    bundle
+        .write(&opt.bundle)
+        .context("Failed to write the bundle")?;
+    println!(
+        "Exported {} of the {} executions, with {} files, to {}",
+        exported,
+        dag.execution_groups.len(),
+        bundle.num_files(),
+        opt.bundle.display()
+    );
+    Ok(())
+}
+
+/// Add to the bundle the cached executions of the DAG, returning how many they are.
+///
+/// The DAG is visited like the scheduler does with the cache hits: the executions whose inputs are
+/// known are looked up in the cache, and the outputs of the hits make more executions ready.
+fn export_dag(
+    dag: &ExecutionDAGData,
+    cache: &mut Cache,
+    file_store: &FileStore,
+    bundle: &mut CacheBundle,
+) -> Result<usize, Error> {
+    let mut handles: HashMap<FileUuid, FileStoreHandle> = HashMap::new();
+    for (uuid, file) in &dag.provided_files {
+        let handle = match file {
+            ProvidedFile::LocalFile {
+                key, local_path, ..
+            } => file_store.store_file(key, local_path),
+            ProvidedFile::Content { key, content, .. } => {
+                file_store.store(key, std::iter::once(content.clone()))
+            }
+        }
+        .context("Failed to store a provided file")?;
+        handles.insert(*uuid, handle);
+    }
+
+    let mut exported = 0;
+    let mut pending: Vec<&ExecutionGroup> = dag.execution_groups.values().collect();
+    loop {
+        let (ready, waiting): (Vec<_>, Vec<_>) = pending.into_iter().partition(|group| {
+            group
+                .dependencies()
+                .iter()
+                .all(|file| handles.contains_key(file))
+        });
+        if ready.is_empty() {
+            break;
+        }
+        for group in ready {
+            if let CacheResult::Hit { outputs, .. } =
+                cache.export(group, &handles, file_store, bundle)
+            {
+                handles.extend(outputs);
+                exported += 1;
+            }
+        }
+        pending = waiting;
+    }
+    Ok(exported)
+}
+
+fn main_cache_import(opt: CacheImportOpt) -> Result<(), Error> {
+    let (file_store, mut cache) = open_cache(&opt.storage)?;
+    let import = cache
+        .import(&opt.bundle, &file_store)
+        .with_context(|| format!("Failed to import {}", opt.bundle.display()))?;
+    println!(
+        "Imported {} cache entries and {} files ({} already present)",
+        import.entries,
+        import.files,
+        import.files - import.new_files
+    );
+    Ok(())
+}
@@ -40,6 +40,10 @@ pub fn copy_competition_files_main(
         disabled_sanity_checks: vec![],
         seed: None,
         dry_run: opt.execution.dry_run,
+        skip_failed_subtasks: false,
+        incremental: false,
+        terry_fused: false,
+        profile: vec![],
     };
 
     // create folder for competition files
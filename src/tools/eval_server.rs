@@ -1,5 +1,7 @@
 use std::collections::HashSet;
+use std::convert::Infallible;
 use std::path::PathBuf;
+use std::sync::atomic::{AtomicBool, Ordering};
 use std::sync::{Arc, Mutex};
 
 use anyhow::{Context, Error};
@@ -7,21 +9,33 @@ use axum::{
     extract::{DefaultBodyLimit, Request, State},
     http::StatusCode,
     middleware::{self, Next},
+    response::sse::{Event, KeepAlive, Sse},
     response::Response,
     routing::{get, post},
     Json, Router,
 };
 use bytes::Bytes;
 use clap::Parser;
+use futures_util::Stream;
 use serde::{Deserialize, Serialize};
-use task_maker_dag::{ExecutionDAG, ExecutionStatus, File};
+use task_maker_cache::Cache;
+use task_maker_dag::{Execution, ExecutionDAG, ExecutionGroupUuid, ExecutionStatus, File};
+use task_maker_exec::ductile::ChannelSender;
+use task_maker_exec::executors::{LocalExecutor, LocalExecutorConnector};
+use task_maker_exec::proto::ExecutorClientMessage;
+use task_maker_exec::{ExecutorClient, SandboxRunner};
 use task_maker_lang::{LanguageManager, SourceFile};
+use task_maker_store::FileStore;
 use tempfile::TempDir;
 use tokio::net::TcpListener;
+use tokio::sync::mpsc::{UnboundedReceiver, UnboundedSender};
 use tower_http::trace::TraceLayer;
 
 use crate::sandbox::ToolsSandboxRunner;
 
+/// The maximum number of bytes of the outputs sent back to the client.
+const OUTPUT_LIMIT: usize = 10 * 1024 * 1024;
+
 #[derive(Parser, Debug, Clone)]
 pub struct EvalServerOpt {
     /// Address to bind the server on
@@ -60,6 +74,16 @@ pub struct EvalServerOpt {
     #[clap(long, default_value = "2")]
     pub client_max_body_size: usize,
 
+    /// Maximum number of inputs of a batch evaluation request
+    #[clap(long, default_value = "100")]
+    pub max_batch_inputs: usize,
+
+    /// Number of workers evaluating the requests, shared by all the requests.
+    ///
+    /// Defaults to the number of physical cores.
+    #[clap(long)]
+    pub num_cores: Option<usize>,
+
     #[clap(flatten, next_help_heading = Some("STORAGE"))]
     pub storage: crate::StorageOpt,
 }
@@ -68,6 +92,11 @@ struct AppState {
     require_header: bool,
     allowed_languages: HashSet<String>,
     opt: EvalServerOpt,
+    /// The file store shared by all the requests.
+    file_store: Arc<FileStore>,
+    /// The executor evaluating all the requests. It's started once, so its cache stays warm and
+    /// the resubmissions of the same files are not compiled again.
+    executor: LocalExecutorConnector,
 }
 
 #[derive(Debug, Serialize, Deserialize)]
@@ -119,6 +148,18 @@ struct EvalRequest {
     language: Option<String>,
 }
 
+/// A request for evaluating the same source file with many inputs.
+#[derive(Debug, Deserialize)]
+struct EvalBatchRequest {
+    files: Vec<SourceFileContent>,
+    #[serde(deserialize_with = "validate_filename")]
+    main_filename: String,
+    inputs: Vec<Content>,
+    time_limit: Option<f64>,
+    memory_limit: Option<u64>,
+    language: Option<String>,
+}
+
 #[derive(Debug, Serialize)]
 struct ExecutionResult {
     status: String,
@@ -129,12 +170,44 @@ struct ExecutionResult {
     memory: f64,
 }
 
+/// The result of one of the inputs of a batch evaluation, `execution` is `None` if it was skipped
+/// (for example because the compilation failed).
+#[derive(Debug, Serialize)]
+struct EvalBatchCase {
+    case: usize,
+    execution: Option<ExecutionResult>,
+}
+
 #[derive(Debug, Serialize)]
 struct EvalResponse {
     execution: Option<ExecutionResult>,
     compilation: Option<ExecutionResult>,
 }
 
+impl ExecutionResult {
+    /// Build the result sent to the client from the result of the execution and its outputs.
+    fn new(result: &task_maker_dag::ExecutionResult, stdout: Content, stderr: Content) -> Self {
+        ExecutionResult {
+            status: format!("{:?}", result.status),
+            exit_code: match result.status {
+                ExecutionStatus::ReturnCode(c) => c,
+                _ => 0,
+            },
+            stdout,
+            stderr,
+            time: result.resources.cpu_time,
+            memory: result.resources.memory as f64 / 1024.0,
+        }
+    }
+
+    /// Build the result sent to the client from the result of an execution that captured its
+    /// outputs.
+    fn captured(result: &task_maker_dag::ExecutionResult) -> Self {
+        let output = |output: &Option<Vec<u8>>| Content::from(output.clone().unwrap_or_default());
+        ExecutionResult::new(result, output(&result.stdout), output(&result.stderr))
+    }
+}
+
 #[derive(Debug, Serialize)]
 struct LanguageInfo {
     name: String,
@@ -143,15 +216,11 @@ struct LanguageInfo {
 
 #[tokio::main]
 pub async fn main_eval_server(opt: EvalServerOpt) -> Result<(), Error> {
-    let allowed_languages = opt.allowed_languages.iter().cloned().collect();
-    let state = Arc::new(AppState {
-        require_header: opt.require_header,
-        allowed_languages,
-        opt,
-    });
+    let state = Arc::new(AppState::new(opt, ToolsSandboxRunner::default())?);
 
     let app = Router::new()
         .route("/evaluate", post(evaluate))
+        .route("/evaluate_batch", post(evaluate_batch))
         .layer(middleware::from_fn_with_state(
             state.clone(),
             auth_middleware,
@@ -166,7 +235,89 @@ pub async fn main_eval_server(opt: EvalServerOpt) -> Result<(), Error> {
         .await
         .context("Failed to bind address")?;
     info!("Eval server listening on {}", addr);
-    axum::serve(listener, app).await.context("Server error")
+    axum::serve(listener, app)
+        .with_graceful_shutdown(shutdown_signal())
+        .await
+        .context("Server error")?;
+
+    // The executor runs as long as the server, its cache is stored only when it stops.
+    info!("Eval server stopping, storing the cache");
+    tokio::task::spawn_blocking(move || state.executor.stop())
+        .await
+        .context("Failed to stop the executor")?
+        .context("Failed to stop the executor")
+}
+
+/// Wait for SIGTERM or ctrl-c.
+async fn shutdown_signal() {
+    let terminate = async {
+        match tokio::signal::unix::signal(tokio::signal::unix::SignalKind::terminate()) {
+            Ok(mut signal) => {
+                signal.recv().await;
+            }
+            Err(e) => {
+                error!("Failed to listen for SIGTERM: {e:?}");
+                std::future::pending::<()>().await;
+            }
+        }
+    };
+    tokio::select! {
+        _ = tokio::signal::ctrl_c() => {}
+        _ = terminate => {}
+    }
+}
+
+impl AppState {
+    /// Make the state of the server, starting the executor shared by all the requests.
+    fn new<R: SandboxRunner + 'static>(
+        opt: EvalServerOpt,
+        sandbox_runner: R,
+    ) -> Result<AppState, Error> {
+        let allowed_languages = opt.allowed_languages.iter().cloned().collect();
+        let (file_store, executor) = start_executor(&opt, sandbox_runner)?;
+        Ok(AppState {
+            require_header: opt.require_header,
+            allowed_languages,
+            opt,
+            file_store,
+            executor,
+        })
+    }
+}
+
+/// Start the local executor shared by all the requests, together with its file store and cache.
+fn start_executor<R: SandboxRunner + 'static>(
+    opt: &EvalServerOpt,
+    sandbox_runner: R,
+) -> Result<(Arc<FileStore>, LocalExecutorConnector), Error> {
+    let store_dir = opt.storage.store_dir();
+    let mut file_store = FileStore::new(
+        store_dir.join("store"),
+        opt.storage.max_cache * 1024 * 1024,
+        opt.storage.min_cache * 1024 * 1024,
+    )
+    .context("Cannot create the file store (You can try wiping it with task-maker-tools reset)")?;
+    file_store.set_compress_cold_files(opt.storage.compress_store);
+    let file_store = Arc::new(file_store);
+
+    let mut cache = Cache::new(store_dir.join("cache")).context("Cannot create the cache")?;
+    cache.set_size_limits(
+        opt.storage.max_execution_cache * 1024 * 1024,
+        opt.storage.min_execution_cache * 1024 * 1024,
+    );
+
+    let num_cores = opt.num_cores.unwrap_or_else(num_cpus::get_physical);
+    let mut executor = LocalExecutor::new(
+        file_store.clone(),
+        cache,
+        num_cores,
+        store_dir.join("eval-sandboxes"),
+        sandbox_runner,
+    )
+    .context("Failed to start the local executor")?;
+    executor.set_memory_budget(LocalExecutor::machine_memory());
+    let executor = executor.serve()?;
+    Ok((file_store, executor))
 }
 
 async fn auth_middleware(
@@ -229,10 +380,7 @@ async fn evaluate(
     extensions: axum::http::Extensions,
     Json(payload): Json<EvalRequest>,
 ) -> Result<Json<EvalResponse>, (StatusCode, String)> {
-    let token = extensions
-        .get::<String>()
-        .cloned()
-        .unwrap_or_else(|| "none".to_string());
+    let token = request_token(&extensions);
     debug!(
         "Evaluation request from token {}: main_filename={}, files={}",
         token,
@@ -240,104 +388,20 @@ async fn evaluate(
         payload.files.len()
     );
 
-    let temp_dir =
-        TempDir::new().map_err(|e| (StatusCode::INTERNAL_SERVER_ERROR, e.to_string()))?;
-
-    for file in payload.files {
-        let file_path = temp_dir.path().join(&file.name);
-        std::fs::write(&file_path, file.content.into_bytes())
-            .map_err(|e| (StatusCode::INTERNAL_SERVER_ERROR, e.to_string()))?;
-    }
-
-    let main_path = temp_dir.path().join(&payload.main_filename);
-    if !main_path.exists() {
-        return Err((
-            StatusCode::BAD_REQUEST,
-            "Main filename not found in files list".to_string(),
-        ));
-    }
+    check_limits(&state, payload.time_limit, payload.memory_limit)?;
+    let (temp_dir, source_file) = prepare_source(
+        &state,
+        payload.files,
+        &payload.main_filename,
+        payload.language.as_deref(),
+    )?;
 
     let mut dag = ExecutionDAG::new();
-    let source_file = if let Some(lang_name) = &payload.language {
-        let lang = LanguageManager::from_name(lang_name)
-            .ok_or_else(|| (StatusCode::BAD_REQUEST, "Unknown language".to_string()))?;
-        SourceFile {
-            path: main_path.clone(),
-            base_path: temp_dir.path().to_owned(),
-            language: lang,
-            executable: Arc::new(Mutex::new(None)),
-            grader_map: None,
-            copy_exe: false,
-            write_bin_to: None,
-            link_static: false,
-        }
-    } else {
-        SourceFile::new(&main_path, temp_dir.path(), None, None::<PathBuf>).ok_or_else(|| {
-            (
-                StatusCode::BAD_REQUEST,
-                "Could not detect language".to_string(),
-            )
-        })?
-    };
-
-    // Check if the language is allowed
-    if !state.allowed_languages.is_empty()
-        && !state
-            .allowed_languages
-            .contains(source_file.language.name())
-    {
-        return Err((
-            StatusCode::FORBIDDEN,
-            format!("Language '{}' is not allowed", source_file.language.name()),
-        ));
-    }
-
     let (comp_uuid, mut exec) = source_file
         .execute(&mut dag, "Evaluation", vec![])
         .map_err(|e| (StatusCode::INTERNAL_SERVER_ERROR, e.to_string()))?;
-
-    if let Some(cuuid) = comp_uuid {
-        if let Some(comp_group) = dag.data.execution_groups.get_mut(&cuuid) {
-            for exec in &mut comp_group.executions {
-                exec.limits.cpu_time(state.opt.compilation_time_limit);
-                exec.limits
-                    .wall_time(state.opt.compilation_time_limit * 2.0);
-                exec.limits
-                    .memory(state.opt.compilation_memory_limit * 1024);
-            }
-        }
-    }
-
-    // Set limits
-    if let Some(tl) = payload.time_limit {
-        if tl > state.opt.max_time_limit {
-            return Err((
-                StatusCode::BAD_REQUEST,
-                format!(
-                    "Time limit {:.2}s exceeds maximum allowed ({:.2}s)",
-                    tl, state.opt.max_time_limit
-                ),
-            ));
-        }
-    }
-    if let Some(ml) = payload.memory_limit {
-        if ml > state.opt.max_memory_limit {
-            return Err((
-                StatusCode::BAD_REQUEST,
-                format!(
-                    "Memory limit {}MB exceeds maximum allowed ({}MB)",
-                    ml, state.opt.max_memory_limit
-                ),
-            ));
-        }
-    }
-
-    exec.limits
-        .cpu_time(payload.time_limit.unwrap_or(state.opt.max_time_limit));
-    exec.limits
-        .wall_time(payload.time_limit.unwrap_or(state.opt.max_time_limit) * 2.0);
-    exec.limits
-        .memory(payload.memory_limit.unwrap_or(state.opt.max_memory_limit) * 1024);
+    set_compilation_limits(&state, &mut dag, comp_uuid);
+    set_execution_limits(&state, &mut exec, payload.time_limit, payload.memory_limit);
 
     // Input file
     let input_file = File::new("input.txt");
@@ -355,8 +419,6 @@ async fn evaluate(
     let comp_result_capture = Arc::new(Mutex::new(None));
     let stdout_capture = Arc::new(Mutex::new(Bytes::new()));
     let stderr_capture = Arc::new(Mutex::new(Bytes::new()));
-    let comp_stdout_capture = Arc::new(Mutex::new(Bytes::new()));
-    let comp_stderr_capture = Arc::new(Mutex::new(Bytes::new()));
 
     {
         let result_capture = result_capture.clone();
@@ -368,89 +430,40 @@ async fn evaluate(
         });
 
         let stdout_capture = stdout_capture.clone();
-        dag.get_file_content(&stdout, 10 * 1024 * 1024, move |content| {
+        dag.get_file_content(&stdout, OUTPUT_LIMIT, move |content| {
             *stdout_capture.lock().unwrap() = Bytes::from(content);
             Ok(())
         });
 
         let stderr_capture = stderr_capture.clone();
-        dag.get_file_content(&stderr, 10 * 1024 * 1024, move |content| {
+        dag.get_file_content(&stderr, OUTPUT_LIMIT, move |content| {
             *stderr_capture.lock().unwrap() = Bytes::from(content);
             Ok(())
         });
 
         if let Some(cuuid) = comp_uuid {
             let comp_result_capture = comp_result_capture.clone();
-            let comp_stdout_capture = comp_stdout_capture.clone();
-            let comp_stderr_capture = comp_stderr_capture.clone();
-
             dag.on_execution_done(&cuuid, move |results| {
                 if let Some(res) = results.first() {
-                    *comp_result_capture.lock().unwrap() = Some(res.clone());
-                    if let Some(out) = &res.stdout {
-                        *comp_stdout_capture.lock().unwrap() = Bytes::from(out.clone());
-                    }
-                    if let Some(err) = &res.stderr {
-                        *comp_stderr_capture.lock().unwrap() = Bytes::from(err.clone());
-                    }
+                    *comp_result_capture.lock().unwrap() = Some(ExecutionResult::captured(res));
                 }
                 Ok(())
             });
         }
     }
 
-    let store_dir = state.opt.storage.store_dir();
-    let sandbox_path = store_dir.join("eval-sandboxes");
-    let max_cache = state.opt.storage.max_cache * 1024 * 1024;
-    let min_cache = state.opt.storage.min_cache * 1024 * 1024;
-
-    tokio::task::spawn_blocking(move || {
-        task_maker_exec::eval_dag_locally(
-            dag,
-            store_dir,
-            1,
-            sandbox_path,
-            max_cache,
-            min_cache,
-            ToolsSandboxRunner::default(),
-        );
-    })
-    .await
-    .map_err(|e| (StatusCode::INTERNAL_SERVER_ERROR, e.to_string()))?;
+    run_dag(&state, &token, dag).await?;
+    drop(temp_dir);
 
     let final_result = result_capture.lock().unwrap().take();
-
-    let compilation = comp_result_capture
-        .lock()
-        .unwrap()
-        .take()
-        .map(|r| ExecutionResult {
-            status: format!("{:?}", r.status),
-            exit_code: match r.status {
-                ExecutionStatus::ReturnCode(c) => c,
-                _ => 0,
-            },
-            stdout: Content::from(comp_stdout_capture.lock().unwrap().clone()),
-            stderr: Content::from(comp_stderr_capture.lock().unwrap().clone()),
-            time: r.resources.cpu_time,
-            memory: r.resources.memory as f64 / 1024.0,
-        });
-
-    let execution = if let Some(res) = final_result {
-        Some(ExecutionResult {
-            status: format!("{:?}", res.status),
-            exit_code: match res.status {
-                ExecutionStatus::ReturnCode(c) => c,
-                _ => 0,
-            },
-            stdout: Content::from(stdout_capture.lock().unwrap().clone()),
-            stderr: Content::from(stderr_capture.lock().unwrap().clone()),
-            time: res.resources.cpu_time,
-            memory: res.resources.memory as f64 / 1024.0,
-        })
-    } else {
-        None
-    };
+    let compilation = comp_result_capture.lock().unwrap().take();
+    let execution = final_result.map(|res| {
+        ExecutionResult::new(
+            &res,
+            Content::from(stdout_capture.lock().unwrap().clone()),
+            Content::from(stderr_capture.lock().unwrap().clone()),
+        )
+    });
 
     let response = EvalResponse {
         execution,
@@ -486,3 +499,394 @@ async fn evaluate(
 
     Ok(Json(response))
 }
+
+/// Evaluate many inputs with the same source file. The source is compiled once and the inputs are
+/// executed in parallel; the results are streamed back as Server-Sent Events as soon as each of
+/// them is ready:
+/// - `compilation`: the result of the compilation, if the language is compiled;
+/// - `case`: the result of the execution of an input, `execution` is null if it was skipped;
+/// - `done` or `error`: the last event, when the evaluation is over.
+async fn evaluate_batch(
+    State(state): State<Arc<AppState>>,
+    extensions: axum::http::Extensions,
+    Json(payload): Json<EvalBatchRequest>,
+) -> Result<Sse<impl Stream<Item = Result<Event, Infallible>>>, (StatusCode, String)> {
+    let token = request_token(&extensions);
+    let receiver = start_batch_evaluation(&state, token, payload)?;
+    let stream = futures_util::stream::unfold(receiver, |mut receiver| async move {
+        let event = receiver.recv().await?;
+        Some((Ok::<_, Infallible>(event.into_sse()), receiver))
+    });
+    Ok(Sse::new(stream).keep_alive(KeepAlive::default()))
+}
+
+/// Start the evaluation of a batch request in background, returning the receiver of its events.
+/// The evaluation is stopped as soon as the receiver is dropped.
+fn start_batch_evaluation(
+    state: &AppState,
+    token: String,
+    payload: EvalBatchRequest,
+) -> Result<UnboundedReceiver<BatchEvent>, (StatusCode, String)> {
+    debug!(
+        "Batch evaluation request from token {}: main_filename={}, files={}, inputs={}",
+        token,
+        payload.main_filename,
+        payload.files.len(),
+        payload.inputs.len()
+    );
+
+    if payload.inputs.len() > state.opt.max_batch_inputs {
+        return Err((
+            StatusCode::BAD_REQUEST,
+            format!(
+                "{} inputs exceed the maximum allowed ({})",
+                payload.inputs.len(),
+                state.opt.max_batch_inputs
+            ),
+        ));
+    }
+    check_limits(state, payload.time_limit, payload.memory_limit)?;
+    let (temp_dir, source_file) = prepare_source(
+        state,
+        payload.files,
+        &payload.main_filename,
+        payload.language.as_deref(),
+    )?;
+
+    let (tx, rx) = state
+        .executor
+        .connect(&format!("Eval server batch request from {token}"))
+        .map_err(|e| (StatusCode::INTERNAL_SERVER_ERROR, e.to_string()))?;
+    let (sender, receiver) = tokio::sync::mpsc::unbounded_channel();
+    let events = BatchEvents::new(sender, tx.clone());
+    let mut dag = ExecutionDAG::new();
+    for (case, input) in payload.inputs.into_iter().enumerate() {
+        // The executable is shared by all the executions, only the first one compiles it.
+        let (comp_uuid, mut exec) = source_file
+            .execute(&mut dag, format!("Evaluation of case {case}"), vec![])
+            .map_err(|e| (StatusCode::INTERNAL_SERVER_ERROR, e.to_string()))?;
+        if let Some(cuuid) = comp_uuid {
+            set_compilation_limits(state, &mut dag, Some(cuuid));
+            let events = events.clone();
+            dag.on_execution_done(&cuuid, move |results| {
+                if let Some(res) = results.first() {
+                    events.send(BatchEvent::Compilation(ExecutionResult::captured(res)));
+                }
+                Ok(())
+            });
+        }
+        set_execution_limits(state, &mut exec, payload.time_limit, payload.memory_limit);
+
+        let input_file = File::new(format!("input {case}"));
+        dag.provide_content(input_file.clone(), input.into_bytes());
+        exec.stdin(input_file);
+        exec.capture_stdout(Some(OUTPUT_LIMIT));
+        exec.capture_stderr(Some(OUTPUT_LIMIT));
+
+        let exec_uuid = dag.add_execution(exec);
+        let done = events.clone();
+        dag.on_execution_done(&exec_uuid, move |results| {
+            let execution = results.first().map(ExecutionResult::captured);
+            done.send(BatchEvent::Case(EvalBatchCase { case, execution }));
+            Ok(())
+        });
+        let skipped = events.clone();
+        dag.on_execution_skip(&exec_uuid, move || {
+            let execution = None;
+            skipped.send(BatchEvent::Case(EvalBatchCase { case, execution }));
+            Ok(())
+        });
+    }
+
+    let file_store = state.file_store.clone();
+    tokio::task::spawn_blocking(move || {
+        // the submitted files are read while evaluating
+        let _temp_dir = temp_dir;
+        match ExecutorClient::evaluate(dag, tx, &rx, file_store, |_| Ok(())) {
+            Ok(()) => {
+                info!("Batch evaluation finished for token {}", token);
+                events.send(BatchEvent::Done);
+            }
+            Err(e) => {
+                warn!("Batch evaluation failed for token {}: {:?}", token, e);
+                events.send(BatchEvent::Error(format!("{e:?}")));
+            }
+        }
+    });
+    Ok(receiver)
+}
+
+/// An event of a batch evaluation, sent to the client as soon as it happens.
+#[derive(Debug)]
+enum BatchEvent {
+    /// The result of the compilation.
+    Compilation(ExecutionResult),
+    /// The result of the execution of an input.
+    Case(EvalBatchCase),
+    /// The evaluation is over.
+    Done,
+    /// The evaluation failed.
+    Error(String),
+}
+
+impl BatchEvent {
+    /// The Server-Sent Event with the name and the serialized data of this event.
+    fn into_sse(self) -> Event {
+        let event = match &self {
+            BatchEvent::Compilation(result) => {
+                Event::default().event("compilation").json_data(result)
+            }
+            BatchEvent::Case(case) => Event::default().event("case").json_data(case),
+            BatchEvent::Done => Event::default().event("done").json_data(()),
+            BatchEvent::Error(error) => Event::default().event("error").json_data(error),
+        };
+        event.unwrap_or_else(|e| {
+            warn!("Cannot serialize the event {:?}: {}", self, e);
+            Event::default()
+                .event("error")
+                .data("Cannot serialize the event")
+        })
+    }
+}
+
+/// The sender of the events of a batch evaluation. When the client disconnects nobody reads the
+/// results anymore, so the evaluation is stopped.
+#[derive(Clone)]
+struct BatchEvents {
+    /// The channel to the client.
+    events: UnboundedSender<BatchEvent>,
+    /// The channel to the executor, for stopping the evaluation.
+    executor: ChannelSender<ExecutorClientMessage>,
+    /// Whether the evaluation has already been stopped.
+    stopped: Arc<AtomicBool>,
+}
+
+impl BatchEvents {
+    /// Make the sender of the events of an evaluation connected to the executor with `executor`.
+    fn new(
+        events: UnboundedSender<BatchEvent>,
+        executor: ChannelSender<ExecutorClientMessage>,
+    ) -> BatchEvents {
+        BatchEvents {
+            events,
+            executor,
+            stopped: Arc::new(AtomicBool::new(false)),
+        }
+    }
+
+    /// Send an event to the client, stopping the evaluation if it's no longer connected.
+    fn send(&self, event: BatchEvent) {
+        if self.events.send(event).is_ok() || self.stopped.swap(true, Ordering::Relaxed) {
+            return;
+        }
+        info!("The client of the batch evaluation is gone, stopping it");
+        if let Err(e) = self.executor.send(ExecutorClientMessage::Stop) {
+            warn!("Cannot stop the batch evaluation: {e:?}");
+        }
+    }
+}
+
+/// The token of the client making the request, if any.
+fn request_token(extensions: &axum::http::Extensions) -> String {
+    extensions
+        .get::<String>()
+        .cloned()
+        .unwrap_or_else(|| "none".to_string())
+}
+
+/// Check that the limits requested by the client are within the maximum allowed.
+fn check_limits(
+    state: &AppState,
+    time_limit: Option<f64>,
+    memory_limit: Option<u64>,
+) -> Result<(), (StatusCode, String)> {
+    if let Some(tl) = time_limit {
+        if tl > state.opt.max_time_limit {
+            return Err((
+                StatusCode::BAD_REQUEST,
+                format!(
+                    "Time limit {:.2}s exceeds maximum allowed ({:.2}s)",
+                    tl, state.opt.max_time_limit
+                ),
+            ));
+        }
+    }
+    if let Some(ml) = memory_limit {
+        if ml > state.opt.max_memory_limit {
+            return Err((
+                StatusCode::BAD_REQUEST,
+                format!(
+                    "Memory limit {}MB exceeds maximum allowed ({}MB)",
+                    ml, state.opt.max_memory_limit
+                ),
+            ));
+        }
+    }
+    Ok(())
+}
+
+/// Write the submitted files in a new temporary directory and find the language of the main file,
+/// checking that it's allowed.
+fn prepare_source(
+    state: &AppState,
+    files: Vec<SourceFileContent>,
+    main_filename: &str,
+    language: Option<&str>,
+) -> Result<(TempDir, SourceFile), (StatusCode, String)> {
+    let temp_dir =
+        TempDir::new().map_err(|e| (StatusCode::INTERNAL_SERVER_ERROR, e.to_string()))?;
+
+    for file in files {
+        let file_path = temp_dir.path().join(&file.name);
+        std::fs::write(&file_path, file.content.into_bytes())
+            .map_err(|e| (StatusCode::INTERNAL_SERVER_ERROR, e.to_string()))?;
+    }
+
+    let main_path = temp_dir.path().join(main_filename);
+    if !main_path.exists() {
+        return Err((
+            StatusCode::BAD_REQUEST,
+            "Main filename not found in files list".to_string(),
+        ));
+    }
+
+    let source_file = if let Some(lang_name) = language {
+        let lang = LanguageManager::from_name(lang_name)
+            .ok_or_else(|| (StatusCode::BAD_REQUEST, "Unknown language".to_string()))?;
+        SourceFile {
+            path: main_path.clone(),
+            base_path: temp_dir.path().to_owned(),
+            language: lang,
+            executable: Arc::new(Mutex::new(None)),
+            runtime_outputs: Arc::new(Mutex::new(Vec::new())),
+            grader_map: None,
+            copy_exe: false,
+            write_bin_to: None,
+            link_static: false,
+            compilation_files: Vec::new(),
+        }
+    } else {
+        SourceFile::new(&main_path, temp_dir.path(), None, None::<PathBuf>).ok_or_else(|| {
+            (
+                StatusCode::BAD_REQUEST,
+                "Could not detect language".to_string(),
+            )
+        })?
+    };
+
+    // Check if the language is allowed
+    if !state.allowed_languages.is_empty()
+        && !state
+            .allowed_languages
+            .contains(source_file.language.name())
+    {
+        return Err((
+            StatusCode::FORBIDDEN,
+            format!("Language '{}' is not allowed", source_file.language.name()),
+        ));
+    }
+
+    Ok((temp_dir, source_file))
+}
+
+/// Apply the compilation limits to the compilation execution, if any.
+fn set_compilation_limits(
+    state: &AppState,
+    dag: &mut ExecutionDAG,
+    comp_uuid: Option<ExecutionGroupUuid>,
+) {
+    if let Some(cuuid) = comp_uuid {
+        if let Some(comp_group) = dag.data.execution_groups.get_mut(&cuuid) {
+            for exec in &mut comp_group.executions {
+                exec.limits.cpu_time(state.opt.compilation_time_limit);
+                exec.limits
+                    .wall_time(state.opt.compilation_time_limit * 2.0);
+                exec.limits
+                    .memory(state.opt.compilation_memory_limit * 1024);
+            }
+        }
+    }
+}
+
+/// Apply the limits requested by the client, or the maximum ones, to the execution.
+fn set_execution_limits(
+    state: &AppState,
+    exec: &mut Execution,
+    time_limit: Option<f64>,
+    memory_limit: Option<u64>,
+) {
+    exec.limits
+        .cpu_time(time_limit.unwrap_or(state.opt.max_time_limit));
+    exec.limits
+        .wall_time(time_limit.unwrap_or(state.opt.max_time_limit) * 2.0);
+    exec.limits
+        .memory(memory_limit.unwrap_or(state.opt.max_memory_limit) * 1024);
+}
+
+/// Evaluate the DAG of a request with the shared executor.
+async fn run_dag(
+    state: &AppState,
+    token: &str,
+    dag: ExecutionDAG,
+) -> Result<(), (StatusCode, String)> {
+    // The submitted files are read by the executor while evaluating, so they are stored in the
+    // file store by their content: the paths in the temporary directory don't matter and the same
+    // files submitted again hit the cache.
+    let (tx, rx) = state
+        .executor
+        .connect(&format!("Eval server request from {token}"))
+        .map_err(|e| (StatusCode::INTERNAL_SERVER_ERROR, e.to_string()))?;
+    let file_store = state.file_store.clone();
+    tokio::task::spawn_blocking(move || {
+        ExecutorClient::evaluate(dag, tx, &rx, file_store, |_| Ok(()))
+    })
+    .await
+    .map_err(|e| (StatusCode::INTERNAL_SERVER_ERROR, e.to_string()))?
+    .map_err(|e| (StatusCode::INTERNAL_SERVER_ERROR, format!("{e:?}")))
+}
+
+#[cfg(test)]
+mod tests {
+    use task_maker_exec::SuccessSandboxRunner;
+
+    use super::*;
+
+    #[tokio::test]
+    async fn test_evaluate_batch_events() {
+        let store_dir = TempDir::new().unwrap();
+        let store_dir = store_dir.path().to_str().unwrap();
+        let opt = EvalServerOpt::parse_from(["eval-server", "--store-dir", store_dir]);
+        let state = AppState::new(opt, SuccessSandboxRunner).unwrap();
+        let payload = EvalBatchRequest {
+            files: vec![SourceFileContent {
+                name: "sol.cpp".into(),
+                content: Content::Text("int main() {}".into()),
+            }],
+            main_filename: "sol.cpp".into(),
+            inputs: vec![Content::Text("1".into()), Content::Text("2".into())],
+            time_limit: None,
+            memory_limit: None,
+            language: None,
+        };
+
+        let mut receiver = start_batch_evaluation(&state, "token".into(), payload).unwrap();
+        let mut events = vec![];
+        let mut cases = vec![];
+        while let Some(event) = receiver.recv().await {
+            match event {
+                BatchEvent::Compilation(_) => events.push("compilation"),
+                BatchEvent::Case(case) => {
+                    assert!(case.execution.is_some());
+                    cases.push(case.case);
+                    events.push("case");
+                }
+                BatchEvent::Done => events.push("done"),
+                BatchEvent::Error(e) => panic!("Batch evaluation failed: {e}"),
+            }
+        }
+        // the compilation comes first, and the evaluation ends with done
+        assert_eq!(events, ["compilation", "case", "case", "done"]);
+        cases.sort();
+        assert_eq!(cases, [0, 1]);
+    }
+}
@@ -45,6 +45,10 @@ pub fn main_export_booklet(opt: ExportBookletOpt) -> Result<(), Error> {
         disabled_sanity_checks: vec![],
         seed: None,
         dry_run: true,
+        skip_failed_subtasks: false,
+        incremental: false,
+        terry_fused: false,
+        profile: vec![],
     };
 
     if opt.contest_dir.is_some() && !opt.task_dir.is_empty() {
@@ -8,10 +8,11 @@ use task_maker_format::ui::{inner_block, render_block, render_server_status, Cur
 
 use crate::tools::find_bad_case::state::{SharedUIState, TestcaseStatus, UIState};
 
+#[derive(Default)]
 pub struct CursesUI;
 
 impl CursesDrawer<UIState> for CursesUI {
-    fn draw(state: &UIState, frame: &mut Frame, loading: char, frame_index: usize) {
+    fn draw(&mut self, state: &UIState, frame: &mut Frame, loading: char, frame_index: usize) {
         CursesUI::draw_frame(state, frame, loading, frame_index);
     }
 }
@@ -4,7 +4,7 @@ use std::sync::Arc;
 
 use anyhow::{anyhow, bail, Context, Error};
 use task_maker_format::ioi::{
-    InputGenerator, SubtaskInfo, TestcaseId, TestcaseInfo, GENERATION_PRIORITY,
+    Checker, InputGenerator, SubtaskInfo, TaskType, TestcaseId, TestcaseInfo, GENERATION_PRIORITY,
 };
 use task_maker_format::{EvaluationData, SourceFile, TaskFormat};
 
@@ -26,20 +26,29 @@ pub struct TestcaseData {
 /// A set of testcases that will be put in a single DAG.
 #[derive(Debug, Clone, Default)]
 pub struct Batch {
+    /// The id of the first testcase of the batch, the ids of the testcases are consecutive.
+    pub first_testcase: TestcaseId,
+    /// The testcases of the batch, by their id.
     pub testcases: HashMap<TestcaseId, TestcaseData>,
 }
 
 /// Modify the task changing the subtasks and testcases in order to produce a DAG that runs the test
-/// testcases instead of the normal ones.
+/// testcases instead of the normal ones. The testcases of the batch have the ids starting from
+/// `first_testcase`.
+#[allow(clippy::too_many_arguments)]
 pub fn patch_task_for_batch(
     task: &mut TaskFormat,
     generator: &Option<Arc<SourceFile>>,
     generator_args: &[String],
+    first_testcase: TestcaseId,
     batch_size: usize,
     batch_index: usize,
     working_directory: &Path,
 ) -> Result<Batch, Error> {
-    let mut batch = Batch::default();
+    let mut batch = Batch {
+        first_testcase,
+        ..Default::default()
+    };
 
     match task {
         TaskFormat::IOI(task) => {
@@ -56,7 +65,7 @@ pub fn patch_task_for_batch(
             // Create a single subtask with all the testcases of this batch.
             let mut testcases = HashMap::new();
             for testcase_index in 0..batch_size {
-                let testcase_id = (batch_index * batch_size + testcase_index) as TestcaseId;
+                let testcase_id = first_testcase + testcase_index as TestcaseId;
 
                 // [0, i32::MAX] is a safe range for the seeds, since it is compatible with `stoi` in c++.
                 let seed = fastrand::i32(0..i32::MAX);
@@ -113,6 +122,27 @@ pub fn patch_task_for_batch(
     Ok(batch)
 }
 
+/// Make the generator, the validator and the custom checker of the task use the batch protocol,
+/// producing, validating and checking many testcases with a single execution. The solutions are
+/// still run once per testcase.
+pub fn enable_batch_protocols(task: &mut TaskFormat) -> Result<(), Error> {
+    match task {
+        TaskFormat::IOI(task) => {
+            task.batch_generator = true;
+            task.batch_validator = true;
+            if let TaskType::Batch(data) = &mut task.task_type {
+                if matches!(data.checker, Checker::Custom(_)) {
+                    data.batch_checker = true;
+                }
+            }
+        }
+        TaskFormat::Terry(_) => {
+            bail!("Terry tasks are not currently supported")
+        }
+    }
+    Ok(())
+}
+
 /// Produce the set of arguments of the generator replacing '{}' with the seed.
 fn generator_args_for_testcase(args: &[String], seed: i32) -> Vec<String> {
     args.iter()
@@ -128,8 +158,10 @@ fn generator_args_for_testcase(args: &[String], seed: i32) -> Vec<String> {
 /// we want to save also the output produced by the solution to test. Additionally, we want to
 /// change the priorities of the executions, making generations as important as executions (so that
 /// we don't have to wait for all the generations before starting evaluating).
-pub fn patch_dag(eval: &mut EvaluationData, batch_size: usize, batch: &Batch) -> Result<(), Error> {
-    let mut processed = 0;
+pub fn patch_dag(eval: &mut EvaluationData, batch: &Batch) -> Result<(), Error> {
+    let batch_size = batch.testcases.len();
+    let mut evaluations = 0;
+    let mut checks = 0;
     let get_testcase_id = |path: &Path| -> Option<TestcaseId> {
         let file_name = path.file_name().expect("Path without a file name");
         let file_name = file_name.to_string_lossy().to_string();
@@ -190,7 +222,7 @@ pub fn patch_dag(eval: &mut EvaluationData, batch_size: usize, batch: &Batch) ->
             if tag.name == "evaluation" {
                 // The priority of generation is GENERATION_PRIORITY - testcase id.
                 group.priority = GENERATION_PRIORITY + 1;
-                processed += 1;
+                evaluations += 1;
                 for exec in &group.executions {
                     if let task_maker_dag::ExecutionOutputBehaviour::Capture {
                         file: stdout, ..
@@ -215,7 +247,7 @@ pub fn patch_dag(eval: &mut EvaluationData, batch_size: usize, batch: &Batch) ->
             if tag.name == "checking" {
                 // The priority of the checker is GENERATION_PRIORITY - testcase id.
                 group.priority = GENERATION_PRIORITY + 1;
-                processed += 1;
+                checks += 1;
             }
         }
     }
@@ -223,11 +255,13 @@ pub fn patch_dag(eval: &mut EvaluationData, batch_size: usize, batch: &Batch) ->
         eval.dag.write_file_to_allow_fail(file_id, path, false);
     }
 
-    if processed != batch_size * 2 {
+    // With the batch protocol a single checker checks all the outputs.
+    if evaluations != batch_size || checks == 0 || checks > batch_size {
         bail!(
-            "Failed to find the {} executions: {} found",
-            batch_size * 2,
-            processed
+            "Failed to find the {} evaluations and their checks: {} evaluations and {} checks found",
+            batch_size,
+            evaluations,
+            checks
         );
     }
     Ok(())
@@ -1,17 +1,25 @@
+use std::collections::HashMap;
 use std::path::{Path, PathBuf};
+use std::sync::atomic::{AtomicBool, AtomicUsize, Ordering};
+use std::sync::mpsc::Sender;
 use std::sync::{Arc, Mutex};
+use std::thread::ScopedJoinHandle;
+use std::time::{Duration, Instant};
 
 use anyhow::{anyhow, bail, Context, Error};
 use clap::{Parser, ValueHint};
+use task_maker_dag::{DagPriority, ExecutionDAG};
 use task_maker_exec::ductile::ChannelSender;
 use task_maker_exec::proto::ExecutorClientMessage;
 use task_maker_exec::ExecutorClient;
-use task_maker_format::ioi::get_generator;
+use task_maker_format::ioi::{get_generator, TestcaseId};
 use task_maker_format::ui::{CursesUI, StdoutPrinter, UIMessage, BLUE, BOLD, RED, UI, YELLOW};
-use task_maker_format::{cwrite, cwriteln, get_sanity_check_list, EvaluationConfig};
+use task_maker_format::{cwrite, cwriteln, get_sanity_check_list, EvaluationConfig, SourceFile};
 
-use crate::context::RuntimeContext;
-use crate::tools::find_bad_case::dag::{patch_dag, patch_task_for_batch, TestcaseData};
+use crate::context::{RuntimeContext, SharedExecutor};
+use crate::tools::find_bad_case::dag::{
+    enable_batch_protocols, patch_dag, patch_task_for_batch, Batch, TestcaseData,
+};
 use crate::tools::find_bad_case::state::{SharedUIState, UIState};
 use crate::{ExecutionOpt, FindTaskOpt, StorageOpt};
 
@@ -20,6 +28,17 @@ mod dag;
 mod finish_ui;
 mod state;
 
+/// The wall time each batch should take to start all its evaluations, when the next batch is
+/// submitted. The size of the batches is adapted to the observed speed to reach it: longer batches
+/// are prepared less often, shorter ones stop sooner after a failing testcase.
+const TARGET_BATCH_DURATION: Duration = Duration::from_secs(10);
+/// The smallest size of an adapted batch.
+const MIN_BATCH_SIZE: usize = 10;
+/// The largest size of an adapted batch.
+const MAX_BATCH_SIZE: usize = 10_000;
+/// The maximum factor by which the batch size changes between two batches.
+const MAX_BATCH_SIZE_CHANGE: f64 = 4.0;
+
 #[derive(Parser, Debug, Clone)]
 #[clap(trailing_var_arg = true)]
 pub struct FindBadCaseOpt {
@@ -32,12 +51,29 @@ pub struct FindBadCaseOpt {
     #[clap(flatten, next_help_heading = Some("STORAGE"))]
     pub storage: StorageOpt,
 
-    /// Number of input files to generate for each batch.
+    /// Number of input files to generate for the first batch.
     ///
-    /// Setting this to a small value may reduce the speed of this tool.
+    /// The size of the following batches is adapted to the time taken by the previous ones, unless
+    /// --fixed-batch-size is used. Each batch is submitted when all the evaluations of the previous
+    /// one have started, and it uses the workers the previous one leaves idle.
     #[clap(long, short, default_value = "100")]
     pub batch_size: usize,
 
+    /// Use the same number of input files (--batch-size) for all the batches.
+    ///
+    /// Setting this to a small value may reduce the speed of this tool.
+    #[clap(long)]
+    pub fixed_batch_size: bool,
+
+    /// Run the generator, the validator and the checker with the batch protocol.
+    ///
+    /// Each of them is started once for many testcases instead of once per testcase, which speeds
+    /// up the search when the testcases are small. They must support the `--batch` argument, as
+    /// described by `batch_generator`, `batch_validator` and `batch_checker` in the task format
+    /// documentation. The solutions are still run once per testcase.
+    #[clap(long)]
+    pub batch_protocol: bool,
+
     /// Name of the generator to use.
     #[clap(long, short)]
     pub generator: Option<String>,
@@ -55,6 +91,9 @@ pub fn main_find_bad_case(opt: FindBadCaseOpt) -> Result<(), Error> {
     if !opt.solution.exists() {
         bail!("Cannot find solution at {}", opt.solution.display());
     }
+    if opt.batch_size == 0 {
+        bail!("The batch size cannot be zero");
+    }
 
     let eval_config = EvaluationConfig {
         solution_filter: vec![],
@@ -67,17 +106,21 @@ pub fn main_find_bad_case(opt: FindBadCaseOpt) -> Result<(), Error> {
             .collect(),
         seed: None,
         dry_run: false,
+        skip_failed_subtasks: false,
+        incremental: false,
+        terry_fused: false,
+        profile: vec![],
     };
     let working_directory =
         tempfile::TempDir::new().context("Failed to create working directory")?;
 
-    // A reference to the current executor, used for sending messages to it.
-    let current_executor_sender: Arc<Mutex<Option<ChannelSender<_>>>> = Arc::new(Mutex::new(None));
+    // The senders to the executor of the batches being evaluated, by batch index, used for
+    // stopping them.
+    let executor_senders: ExecutorSenders = Arc::new(Mutex::new(HashMap::new()));
     let stop_evaluation = {
-        let current_executor_sender = current_executor_sender.clone();
+        let executor_senders = executor_senders.clone();
         move || {
-            let current_executor_sender = current_executor_sender.lock().unwrap();
-            if let Some(sender) = current_executor_sender.as_ref() {
+            for sender in executor_senders.lock().unwrap().values() {
                 let _ = sender.send(ExecutorClientMessage::Stop);
             }
         }
@@ -112,11 +155,10 @@ pub fn main_find_bad_case(opt: FindBadCaseOpt) -> Result<(), Error> {
     // Bind the ctrl-c handler that will make the UI and the executor stop.
     ctrlc::set_handler({
         let shared_state = shared_state.clone();
-        let current_executor_sender = current_executor_sender.clone();
+        let executor_senders = executor_senders.clone();
         move || {
             shared_state.write().unwrap().should_stop = true;
-            let current_executor_sender = current_executor_sender.lock().unwrap();
-            if let Some(sender) = current_executor_sender.as_ref() {
+            for sender in executor_senders.lock().unwrap().values() {
                 if sender.send(ExecutorClientMessage::Stop).is_err() {
                     error!("Cannot tell the server to stop");
                 }
@@ -125,93 +167,85 @@ pub fn main_find_bad_case(opt: FindBadCaseOpt) -> Result<(), Error> {
     })
     .context("Failed to set ctrl-c handler")?;
 
-    for batch_index in 0.. {
-        let mut task = opt.find_task.find_task(&eval_config)?;
-        let batch = patch_task_for_batch(
-            &mut task,
+    // The next batch is submitted as soon as all the evaluations of the current one have started,
+    // so that the workers left idle by the last ones are used. Each batch has a lower priority than
+    // the previous one, so it gets only those workers. Its size is adapted to the time the current
+    // batch took to start all its evaluations.
+    let prepare = |first_testcase, batch_size, batch_index| {
+        prepare_batch(
+            &opt,
+            &eval_config,
             &generator,
-            &opt.generator_args,
-            opt.batch_size,
+            first_testcase,
+            batch_size,
             batch_index,
             working_directory.path(),
-        )?;
-
-        {
-            let mut shared_state = shared_state.write().unwrap();
-            shared_state.last_batch = Some(batch.clone());
-            shared_state.batch_index = batch_index;
-        }
-
-        // Setup the configuration and the evaluation metadata.
-        let context = RuntimeContext::new(task, &opt.execution, |task, eval| {
-            task.build_dag(eval, &eval_config)
-                .context("Cannot build the task DAG")?;
-            patch_dag(eval, opt.batch_size, &batch).context("Cannot patch the DAG")
-        })?;
-
-        let mut executor = context.connect_executor(&opt.execution, &opt.storage)?;
+        )
+    };
+    let mut next_batch = Some(prepare(0, opt.batch_size, 0)?);
+    let sandbox_runner = next_batch.as_ref().unwrap().1.sandbox_runner.clone();
+    let executor = SharedExecutor::new(&opt.execution, &opt.storage, sandbox_runner)?;
+    std::thread::scope(|scope| -> Result<(), Error> {
+        let mut batch_size = opt.batch_size;
+        let mut first_testcase = 0;
+        let mut evaluating = None;
+        for batch_index in 0.. {
+            let (batch, context) = match next_batch.take() {
+                Some(batch) => batch,
+                None => prepare(first_testcase, batch_size, batch_index)?,
+            };
+            first_testcase = batch.first_testcase + batch.testcases.len() as TestcaseId;
+            let current_batch_size = batch.testcases.len();
+            {
+                let mut shared_state = shared_state.write().unwrap();
+                shared_state.previous_batch = shared_state.last_batch.replace(batch);
+                shared_state.batch_index = batch_index;
+            }
 
-        let ui_receiver = executor.ui_receiver;
-        let ui_thread = std::thread::Builder::new()
-            .name("UI".to_owned())
-            .spawn({
+            let (tail_sender, tail) = std::sync::mpsc::channel();
+            let start = Instant::now();
+            let evaluation = scope.spawn({
+                let (opt, executor) = (&opt, &executor);
+                let (executor_senders, shared_state) = (&executor_senders, &shared_state);
                 let sender = sender.clone();
                 move || {
-                    while let Ok(message) = ui_receiver.recv() {
-                        if let UIMessage::StopUI = message {
-                            break;
-                        }
-                        let _ = sender.send(Some(message));
-                    }
+                    let batch = BatchEvaluation {
+                        batch_index,
+                        executor_senders,
+                        ui_sender: sender,
+                        tail: tail_sender,
+                    };
+                    evaluate_batch(context, batch, opt, executor).inspect_err(|_| {
+                        shared_state.write().unwrap().should_stop = true;
+                    })
                 }
-            })
-            .context("Failed to spawn UI thread")?;
-
-        let mut dag = executor.eval.dag.clone();
-        std::mem::swap(&mut dag, &mut executor.eval.dag);
-
-        // Run the actual computation and block until it ends.
-        let sender = sender.clone();
-        *current_executor_sender.lock().unwrap() = Some(executor.tx.clone());
-        ExecutorClient::evaluate(
-            dag,
-            executor.tx,
-            &executor.rx,
-            executor.file_store,
-            move |status| {
-                sender
-                    .send(Some(UIMessage::ServerStatus { status }))
-                    .map_err(|e| anyhow!("{:?}", e))
-            },
-        )
-        .with_context(|| {
-            shared_state.write().unwrap().should_stop = true;
-            "Client failed"
-        })?;
-
-        // Disable the ctrl-c handler dropping the owned clone of the sender, letting the client exit.
-        current_executor_sender.lock().unwrap().take();
-
-        drop(executor.eval);
-        drop(executor.task);
-        drop(executor.rx);
+            });
+            // The sender is dropped if the batch ends before notifying.
+            let _ = tail.recv();
+            let elapsed = start.elapsed();
+            // The previous batch has a higher priority, it usually ends before this point.
+            if let Some(previous) = evaluating.replace(evaluation) {
+                join_evaluation(previous)?;
+            }
 
-        if let Some(local_executor) = executor.local_executor {
-            local_executor
-                .join()
-                .map_err(|e| anyhow!("Executor panicked: {:?}", e))
-                .unwrap()
-                .expect("Local executor failed");
+            if shared_state.read().unwrap().should_stop {
+                break;
+            }
+            if !opt.fixed_batch_size {
+                batch_size = adapt_batch_size(current_batch_size, elapsed);
+                debug!(
+                    "Batch {} of {} testcases started all its evaluations in {:?}, the next size \
+                     is {}",
+                    batch_index, current_batch_size, elapsed, batch_size
+                );
+            }
         }
-        ui_thread
-            .join()
-            .map_err(|e| anyhow!("UI panicked: {:?}", e))
-            .unwrap();
-
-        if shared_state.read().unwrap().should_stop {
-            break;
+        if let Some(last) = evaluating {
+            join_evaluation(last)?;
         }
-    }
+        Ok(())
+    })?;
+    executor.stop()?;
 
     let _ = sender.send(None);
     global_ui_join_handle
@@ -236,7 +270,13 @@ pub fn main_find_bad_case(opt: FindBadCaseOpt) -> Result<(), Error> {
     cwrite!(printer, BOLD, "Solution:           ");
     println!("{}", opt.solution.display());
     cwrite!(printer, BOLD, "Batch size:         ");
-    println!("{}", opt.batch_size);
+    println!(
+        "{}",
+        shared_state
+            .last_batch
+            .as_ref()
+            .map_or(opt.batch_size, |b| b.testcases.len())
+    );
 
     cwriteln!(printer, BOLD, "Failed testcase:");
     cwrite!(printer, BOLD, "    Generator args: ");
@@ -268,6 +308,182 @@ pub fn main_find_bad_case(opt: FindBadCaseOpt) -> Result<(), Error> {
     Ok(())
 }
 
+/// Build the DAG of a batch: the task is loaded again and patched to contain only the testcases of
+/// the batch.
+#[allow(clippy::too_many_arguments)]
+fn prepare_batch(
+    opt: &FindBadCaseOpt,
+    eval_config: &EvaluationConfig,
+    generator: &Option<Arc<SourceFile>>,
+    first_testcase: TestcaseId,
+    batch_size: usize,
+    batch_index: usize,
+    working_directory: &Path,
+) -> Result<(Batch, RuntimeContext), Error> {
+    let mut task = opt.find_task.find_task(eval_config)?;
+    let batch = patch_task_for_batch(
+        &mut task,
+        generator,
+        &opt.generator_args,
+        first_testcase,
+        batch_size,
+        batch_index,
+        working_directory,
+    )?;
+    if opt.batch_protocol {
+        enable_batch_protocols(&mut task)?;
+    }
+
+    // Setup the configuration and the evaluation metadata.
+    let context = RuntimeContext::new(task, &opt.execution, |task, eval| {
+        task.build_dag(eval, eval_config)
+            .context("Cannot build the task DAG")?;
+        patch_dag(eval, &batch).context("Cannot patch the DAG")
+    })?;
+    Ok((batch, context))
+}
+
+/// The senders to the executor of the batches being evaluated, by batch index.
+type ExecutorSenders = Arc<Mutex<HashMap<usize, ChannelSender<ExecutorClientMessage>>>>;
+
+/// What `evaluate_batch` needs for evaluating a batch next to the other ones.
+struct BatchEvaluation<'a> {
+    /// The index of the batch.
+    batch_index: usize,
+    /// Where the sender to the executor is kept while the batch is evaluated.
+    executor_senders: &'a ExecutorSenders,
+    /// The channel to the global UI.
+    ui_sender: Sender<Option<UIMessage>>,
+    /// The channel notified when all the evaluations of the batch have started.
+    tail: Sender<()>,
+}
+
+/// Evaluate a batch on the shared executor, blocking until it ends.
+fn evaluate_batch(
+    context: RuntimeContext,
+    batch: BatchEvaluation,
+    opt: &FindBadCaseOpt,
+    executor: &SharedExecutor,
+) -> Result<(), Error> {
+    let mut executor = context.connect_shared_executor(executor, &opt.execution)?;
+
+    let ui_receiver = executor.ui_receiver;
+    let ui_thread = std::thread::Builder::new()
+        .name("UI".to_owned())
+        .spawn({
+            let sender = batch.ui_sender.clone();
+            move || {
+                while let Ok(message) = ui_receiver.recv() {
+                    if let UIMessage::StopUI = message {
+                        break;
+                    }
+                    let _ = sender.send(Some(message));
+                }
+            }
+        })
+        .context("Failed to spawn UI thread")?;
+
+    let mut dag = executor.eval.dag.clone();
+    std::mem::swap(&mut dag, &mut executor.eval.dag);
+    let priority = opt.execution.priority - batch.batch_index as DagPriority;
+    dag.config_mut().priority(priority);
+    notify_tail(&mut dag, batch.tail);
+
+    // Run the actual computation and block until it ends.
+    let sender = batch.ui_sender;
+    let senders = batch.executor_senders;
+    senders
+        .lock()
+        .unwrap()
+        .insert(batch.batch_index, executor.tx.clone());
+    let result = ExecutorClient::evaluate(
+        dag,
+        executor.tx,
+        &executor.rx,
+        executor.file_store,
+        move |status| {
+            sender
+                .send(Some(UIMessage::ServerStatus { status }))
+                .map_err(|e| anyhow!("{:?}", e))
+        },
+    );
+    // Drop the owned clone of the sender, letting the client exit.
+    senders.lock().unwrap().remove(&batch.batch_index);
+    result.context("Client failed")?;
+
+    drop(executor.eval);
+    drop(executor.task);
+    drop(executor.rx);
+    ui_thread
+        .join()
+        .map_err(|e| anyhow!("UI panicked: {:?}", e))
+        .unwrap();
+    Ok(())
+}
+
+/// Notify `tail` when all the evaluations of the DAG have started, or have been skipped or found in
+/// the cache.
+fn notify_tail(dag: &mut ExecutionDAG, tail: Sender<()>) {
+    let evaluations = dag
+        .data
+        .execution_groups
+        .values()
+        .filter(|group| {
+            group
+                .tag
+                .as_ref()
+                .is_some_and(|tag| tag.name == "evaluation")
+        })
+        .map(|group| group.uuid)
+        .collect::<Vec<_>>();
+    let remaining = Arc::new(AtomicUsize::new(evaluations.len()));
+    let tail = Arc::new(Mutex::new(tail));
+    for uuid in evaluations {
+        let started = AtomicBool::new(false);
+        let (remaining, tail) = (remaining.clone(), tail.clone());
+        let notify = Arc::new(move || {
+            if !started.swap(true, Ordering::Relaxed)
+                && remaining.fetch_sub(1, Ordering::Relaxed) == 1
+            {
+                let _ = tail.lock().unwrap().send(());
+            }
+        });
+        let on_start = notify.clone();
+        dag.on_execution_start(&uuid, move |_| {
+            on_start();
+            Ok(())
+        });
+        let on_skip = notify.clone();
+        dag.on_execution_skip(&uuid, move || {
+            on_skip();
+            Ok(())
+        });
+        dag.on_execution_done(&uuid, move |_| {
+            notify();
+            Ok(())
+        });
+    }
+}
+
+/// Wait for the end of the evaluation of a batch.
+fn join_evaluation(evaluation: ScopedJoinHandle<Result<(), Error>>) -> Result<(), Error> {
+    evaluation
+        .join()
+        .map_err(|e| anyhow!("Batch evaluation panicked: {:?}", e))?
+}
+
+/// The size of the next batch, such that at the speed of the last one it takes
+/// `TARGET_BATCH_DURATION`. The size changes at most by `MAX_BATCH_SIZE_CHANGE` times.
+fn adapt_batch_size(batch_size: usize, elapsed: Duration) -> usize {
+    let ratio = TARGET_BATCH_DURATION.as_secs_f64() / elapsed.as_secs_f64().max(1e-3);
+    let ratio = ratio.clamp(1.0 / MAX_BATCH_SIZE_CHANGE, MAX_BATCH_SIZE_CHANGE);
+    let size = (batch_size as f64 * ratio).round() as usize;
+    size.clamp(
+        MIN_BATCH_SIZE.min(batch_size),
+        MAX_BATCH_SIZE.max(batch_size),
+    )
+}
+
 fn copy_testcase(
     testcase: &TestcaseData,
     task_path: &Path,
@@ -363,3 +579,25 @@ fn print_failures(shared: &SharedUIState, printer: &mut StdoutPrinter) {
         }
     }
 }
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_adapt_batch_size() {
+        assert_eq!(adapt_batch_size(100, TARGET_BATCH_DURATION), 100);
+        assert_eq!(adapt_batch_size(100, TARGET_BATCH_DURATION * 2), 50);
+        assert_eq!(adapt_batch_size(100, TARGET_BATCH_DURATION / 2), 200);
+        // the size doesn't change too much at once
+        assert_eq!(adapt_batch_size(100, Duration::ZERO), 400);
+        assert_eq!(adapt_batch_size(100, TARGET_BATCH_DURATION * 100), 25);
+        // and stays within the bounds
+        assert_eq!(
+            adapt_batch_size(20, TARGET_BATCH_DURATION * 4),
+            MIN_BATCH_SIZE
+        );
+        assert_eq!(adapt_batch_size(5, TARGET_BATCH_DURATION * 4), 5);
+        assert_eq!(adapt_batch_size(9_000, Duration::ZERO), MAX_BATCH_SIZE);
+    }
+}
@@ -23,8 +23,10 @@ pub struct UIState {
     pub solution: PathBuf,
     /// The template arguments passed to the generator.
     pub generator_args: Vec<String>,
-    /// The size of the batch.
+    /// The size of the current batch.
     pub batch_size: usize,
+    /// The id of the first testcase of the current batch.
+    pub first_testcase: TestcaseId,
 
     /// The current status of the executor, if any.
     pub executor_status: Option<ExecutorStatus<SystemTime>>,
@@ -107,12 +109,24 @@ pub struct SharedUIState {
     pub should_stop: bool,
     /// The last batch being evaluated.
     pub last_batch: Option<Batch>,
+    /// The batch before the last one, which may still be finishing its evaluation.
+    pub previous_batch: Option<Batch>,
     /// A testcase that made the solution fail, together with a failing message.
     pub failing_testcase: Option<(TestcaseData, String)>,
     /// A testcase that failed to generate, together with a message and the result of the execution.
     pub errored_testcase: Option<(TestcaseData, String, ExecutionResult)>,
 }
 
+impl SharedUIState {
+    /// The data of a testcase of one of the batches being evaluated.
+    pub fn testcase(&self, testcase: TestcaseId) -> Option<&TestcaseData> {
+        [&self.last_batch, &self.previous_batch]
+            .into_iter()
+            .flatten()
+            .find_map(|batch| batch.testcases.get(&testcase))
+    }
+}
+
 impl UIState {
     pub fn new(opt: &FindBadCaseOpt, stop_evaluation: impl Fn() + Send + Sync + 'static) -> Self {
         Self {
@@ -120,6 +134,7 @@ impl UIState {
             solution: opt.solution.clone(),
             generator_args: opt.generator_args.clone(),
             batch_size: opt.batch_size,
+            first_testcase: 0,
             executor_status: None,
             batches: vec![],
             progress: Default::default(),
@@ -130,15 +145,29 @@ impl UIState {
 
 impl UIStateT for UIState {
     fn apply(&mut self, message: UIMessage) {
+        if let UIMessage::IOITask { .. } = message {
+            // The batches have different sizes, the UI starts showing the batch being evaluated.
+            if let Some(batch) = &self.shared.read().unwrap().last_batch {
+                self.batch_size = batch.testcases.len();
+                self.first_testcase = batch.first_testcase;
+            }
+            self.batches.push(CurrentBatch::new(self.batch_size));
+            return;
+        }
         let mut set = |testcase: TestcaseId, state: TestcaseStatus| {
-            let testcase = &mut self.batches.last_mut().unwrap().testcase_status
-                [testcase as usize % self.batch_size];
-            *testcase = state;
+            // Ignore the messages of a batch that has already been replaced.
+            let index = testcase.checked_sub(self.first_testcase);
+            let status = index.and_then(|index| {
+                self.batches
+                    .last_mut()?
+                    .testcase_status
+                    .get_mut(index as usize)
+            });
+            if let Some(status) = status {
+                *status = state;
+            }
         };
         match message {
-            UIMessage::IOITask { .. } => {
-                self.batches.push(CurrentBatch::new(self.batch_size));
-            }
             UIMessage::ServerStatus { status } => self.executor_status = Some(status),
             UIMessage::IOIGeneration {
                 testcase, status, ..
@@ -154,15 +183,10 @@ impl UIStateT for UIState {
                     } else {
                         set(testcase, TestcaseStatus::Error);
                         let mut shared = self.shared.write().unwrap();
-                        let testcase = shared
-                            .last_batch
-                            .as_ref()
-                            .unwrap()
-                            .testcases
-                            .get(&testcase)
-                            .unwrap();
-                        shared.errored_testcase =
-                            Some((testcase.clone(), "Generator failed".into(), result));
+                        if let Some(testcase) = shared.testcase(testcase).cloned() {
+                            shared.errored_testcase =
+                                Some((testcase, "Generator failed".into(), result));
+                        }
                     }
                 }
                 _ => {}
@@ -179,15 +203,10 @@ impl UIStateT for UIState {
                     } else {
                         set(testcase, TestcaseStatus::Error);
                         let mut shared = self.shared.write().unwrap();
-                        let testcase = shared
-                            .last_batch
-                            .as_ref()
-                            .unwrap()
-                            .testcases
-                            .get(&testcase)
-                            .unwrap();
-                        shared.errored_testcase =
-                            Some((testcase.clone(), "Validator failed".into(), result));
+                        if let Some(testcase) = shared.testcase(testcase).cloned() {
+                            shared.errored_testcase =
+                                Some((testcase, "Validator failed".into(), result));
+                        }
                     }
                 }
                 _ => {}
@@ -225,8 +244,8 @@ impl UIStateT for UIState {
                 } else {
                     set(testcase, TestcaseStatus::Failed(message.clone()));
                     let mut shared = self.shared.write().unwrap();
-                    let testcase = shared.last_batch.as_ref().unwrap().testcases.get(&testcase);
-                    shared.failing_testcase = testcase.map(|tc| (tc.clone(), message));
+                    let testcase = shared.testcase(testcase).cloned();
+                    shared.failing_testcase = testcase.map(|tc| (tc, message));
                     shared.should_stop = true;
                     self.stop_evaluation.stop();
                 }
@@ -14,6 +14,10 @@ use task_maker_format::{cwrite, EvaluationConfig, TaskFormat};
 use crate::context::RuntimeContext;
 use crate::{ExecutionOpt, FindTaskOpt, StorageOpt};
 
+mod triage;
+
+use triage::{FailureBucket, Reproducer};
+
 #[derive(Parser, Debug, Clone)]
 pub struct FuzzCheckerOpt {
     #[clap(flatten, next_help_heading = Some("TASK SEARCH"))]
@@ -63,6 +67,37 @@ pub struct FuzzCheckerOpt {
     #[clap(long)]
     pub no_build: bool,
 
+    /// Store the fuzzed outputs in temporary files inside the fuzz directory.
+    ///
+    /// By default the harness keeps them in memory, reusing the same descriptors across the
+    /// iterations, and preloads the testcase input and output files in memory.
+    #[clap(long)]
+    pub disk_io: bool,
+
+    /// Don't use the token-aware mutator, leave all the mutations to libFuzzer.
+    #[clap(long)]
+    pub no_custom_mutator: bool,
+
+    /// Restore the global state of the checker after each iteration.
+    ///
+    /// The writable data of the checker is saved after loading it and restored after each call,
+    /// and the file descriptors it leaves open are closed. This makes checkers with global or
+    /// static variables work without forking, at the cost of copying their data segment at every
+    /// iteration. Leak detection is disabled since the restored pointers leak the memory the
+    /// checker allocated.
+    #[clap(long)]
+    pub snapshot: bool,
+
+    /// Don't minimize the failures found by the fuzzer.
+    ///
+    /// By default the failures are grouped by their cause, and one per group is minimized.
+    #[clap(long)]
+    pub no_minimize: bool,
+
+    /// Maximum number of seconds spent minimizing each failure.
+    #[clap(long, default_value = "30")]
+    pub minimize_time: usize,
+
     #[clap(flatten, next_help_heading = Some("EXECUTION"))]
     pub execution: ExecutionOpt,
 
@@ -72,16 +107,41 @@ pub struct FuzzCheckerOpt {
 
 const CHECKER_HEADER: &[u8] = include_bytes!("./fuzz_checker/checker_header.h");
 const FUZZER: &[u8] = include_bytes!("./fuzz_checker/fuzzer.cpp");
+const FUZZER_COMMON: &[u8] = include_bytes!("./fuzz_checker/fuzzer_common.h");
+const MANAGER_FUZZER: &[u8] = include_bytes!("./fuzz_checker/manager_fuzzer.cpp");
+const MUTATOR: &[u8] = include_bytes!("./fuzz_checker/mutator.cpp");
 const README: &str = include_str!("./fuzz_checker/README");
+const MANAGER_README: &str = include_str!("./fuzz_checker/README.manager");
+
+/// The component of the task that is fuzzed.
+#[derive(Debug, Clone, PartialEq, Eq)]
+enum FuzzTarget {
+    /// The checker of a Batch task, fed with fuzzed contestant outputs.
+    Checker,
+    /// The manager of a Communication task, fed with fuzzed streams from the solutions.
+    Manager {
+        /// Number of solution processes the manager talks with.
+        num_processes: u8,
+    },
+    /// The controller of an Interactive task, fed with fuzzed streams from the solutions.
+    Controller,
+}
 
 #[derive(Debug)]
 struct FuzzData {
     /// Base directory of the task.
     task_dir: PathBuf,
-    /// Path to the checker source file.
+    /// What is being fuzzed.
+    target: FuzzTarget,
+    /// Path to the source file of the checker, manager or controller.
     checker_source: PathBuf,
+    /// Paths to the input files, in the same order as in the task.
+    input_files: Vec<PathBuf>,
     /// Paths to the initial output files, in the same order as in the task.
     initial_output_files: Vec<PathBuf>,
+    /// Name of the file the manager or controller reads the input from, `None` if it is read from
+    /// stdin.
+    infile: Option<PathBuf>,
     /// Fuzzer options.
     opt: FuzzCheckerOpt,
 }
@@ -98,45 +158,69 @@ pub fn main_fuzz_checker(opt: FuzzCheckerOpt) -> Result<(), Error> {
         bail!("The fuzz-checker tool only supports IOI-tasks for now");
     };
 
-    let task_type = if let TaskType::Batch(task_type) = &task.task_type {
-        task_type
-    } else {
-        bail!("Only Batch tasks are supported");
-    };
-
-    let checker = if let Checker::Custom(checker) = &task_type.checker {
-        checker
-    } else {
-        bail!("Only tasks with a checker are supported");
+    let (target, source, infile) = match &task.task_type {
+        TaskType::Batch(task_type) => {
+            if let Checker::Custom(checker) = &task_type.checker {
+                (FuzzTarget::Checker, checker.clone(), None)
+            } else {
+                bail!("Only Batch tasks with a checker are supported");
+            }
+        }
+        TaskType::Communication(data) => (
+            FuzzTarget::Manager {
+                num_processes: data.num_processes,
+            },
+            data.manager.clone(),
+            task.infile.clone(),
+        ),
+        TaskType::Interactive(data) => (
+            FuzzTarget::Controller,
+            data.controller.clone(),
+            Some(task.infile.clone().unwrap_or_else(|| "input.txt".into())),
+        ),
+        TaskType::None => bail!("Only Batch, Communication and Interactive tasks are supported"),
     };
-    let checker_bin_path = checker
+    let checker_bin_path = source
         .write_bin_to
         .clone()
         .expect("Missing checker write_bin_to");
 
-    let language = checker.language();
+    let language = source.language();
     if language.name() != "C++" {
-        bail!("Only C++ checkers are supported");
+        bail!("Only C++ checkers, managers and controllers are supported");
     }
 
     let num_testcases: usize = task.subtasks.values().map(|st| st.testcases.len()).sum();
 
     let task_dir = task.path.clone();
     let fuzz_data = FuzzData {
-        checker_source: checker.path.clone(),
+        target,
+        checker_source: source.path.clone(),
+        input_files: (0..num_testcases)
+            .map(|i| task_dir.join(format!("input/input{i}.txt")))
+            .collect(),
         initial_output_files: (0..num_testcases)
             .map(|i| task_dir.join(format!("output/output{i}.txt")))
             .collect(),
+        infile,
         task_dir,
         opt,
     };
 
     trace!("Fuzz data: {fuzz_data:#?}");
+    if fuzz_data.opt.snapshot && fuzz_data.target != FuzzTarget::Checker {
+        warn!("--snapshot is supported only when fuzzing checkers, ignoring it");
+    }
 
     if fuzz_data.opt.no_build {
-        for output in &fuzz_data.initial_output_files {
-            if !output.exists() {
-                bail!("The output files haven't been generated, please run task-maker");
+        let (files, kind) = if fuzz_data.target == FuzzTarget::Checker {
+            (&fuzz_data.initial_output_files, "output")
+        } else {
+            (&fuzz_data.input_files, "input")
+        };
+        for file in files {
+            if !file.exists() {
+                bail!("The {kind} files haven't been generated, please run task-maker");
             }
         }
     } else {
@@ -170,10 +254,14 @@ pub fn main_fuzz_checker(opt: FuzzCheckerOpt) -> Result<(), Error> {
     }
 
     write_initial_corpus(&fuzz_dir, &fuzz_data)?;
-    let (checker_source, fuzzer_source) = write_checker_source(&fuzz_dir, &fuzz_data)?;
-    let fuzz_binary = compile_fuzzer(&fuzz_dir, &fuzz_data, &checker_source, &fuzzer_source)?;
+    if fuzz_data.target != FuzzTarget::Checker {
+        write_testcases_dir(&fuzz_dir, &fuzz_data)?;
+    }
+    let (checker_source, fuzzer_sources) = write_checker_source(&fuzz_dir, &fuzz_data)?;
+    let fuzz_binary = compile_fuzzer(&fuzz_dir, &fuzz_data, &checker_source, &fuzzer_sources)?;
     let artifacts = run_fuzzer(&fuzz_dir, &fuzz_data, &fuzz_binary)?;
-    organize_failures(&fuzz_dir, &fuzz_data, &artifacts, &checker_bin_path)?;
+    let buckets = triage_failures(&fuzz_dir, &fuzz_data, &fuzz_binary, &artifacts)?;
+    organize_failures(&fuzz_dir, &fuzz_data, &buckets, &checker_bin_path)?;
 
     Ok(())
 }
@@ -190,7 +278,18 @@ fn write_initial_corpus(fuzz_dir: &Path, data: &FuzzData) -> Result<(), Error> {
         })?;
     }
 
-    for (index, output) in data.initial_output_files.iter().enumerate() {
+    // the checker is seeded with the correct outputs, the managers with the input files since the
+    // solution streams are not known.
+    let seeds = if data.target == FuzzTarget::Checker {
+        &data.initial_output_files
+    } else {
+        &data.input_files
+    };
+    let num_streams = match data.target {
+        FuzzTarget::Manager { num_processes } => num_processes.max(1) as usize,
+        _ => 1,
+    };
+    for (index, output) in seeds.iter().enumerate() {
         let path = initial_corpus_dir.join(format!("{index}.txt"));
         if path.exists() {
             debug!("Removing old corpus at {}", path.display());
@@ -206,8 +305,10 @@ fn write_initial_corpus(fuzz_dir: &Path, data: &FuzzData) -> Result<(), Error> {
         file.write_all(&index_bytes)
             .with_context(|| anyhow!("Failed to write index to {}", path.display()))?;
 
-        let output_content = std::fs::read(output)
+        let content = std::fs::read(output)
             .with_context(|| anyhow!("Failed to read {}", output.display()))?;
+        // the streams of the solution processes are separated by a NUL byte
+        let output_content = vec![content; num_streams].join(&0);
 
         // write the rest of the output file
         file.write_all(&output_content).with_context(|| {
@@ -222,7 +323,36 @@ fn write_initial_corpus(fuzz_dir: &Path, data: &FuzzData) -> Result<(), Error> {
     Ok(())
 }
 
-fn write_checker_source(fuzz_dir: &Path, data: &FuzzData) -> Result<(PathBuf, PathBuf), Error> {
+/// Prepare a directory for each testcase, containing the input file with the name the manager or
+/// controller expects. The harness changes its working directory to it before every call.
+fn write_testcases_dir(fuzz_dir: &Path, data: &FuzzData) -> Result<(), Error> {
+    let testcases_dir = fuzz_dir.join("testcases");
+    if testcases_dir.exists() {
+        debug!("Removing old testcases at {}", testcases_dir.display());
+        std::fs::remove_dir_all(&testcases_dir)
+            .with_context(|| anyhow!("Failed to remove {}", testcases_dir.display()))?;
+    }
+    let infile = data.infile.as_deref().unwrap_or(Path::new("input.txt"));
+    for (index, input) in data.input_files.iter().enumerate() {
+        let target = testcases_dir.join(index.to_string()).join(infile);
+        let parent = target.parent().context("Invalid infile")?;
+        std::fs::create_dir_all(parent)
+            .with_context(|| anyhow!("Failed to create {}", parent.display()))?;
+        std::os::unix::fs::symlink(input, &target).with_context(|| {
+            anyhow!(
+                "Failed to create symlink: {} -> {}",
+                target.display(),
+                input.display()
+            )
+        })?;
+    }
+    Ok(())
+}
+
+fn write_checker_source(
+    fuzz_dir: &Path,
+    data: &FuzzData,
+) -> Result<(PathBuf, Vec<PathBuf>), Error> {
     let sources_dir = fuzz_dir.join("sources");
     std::fs::create_dir_all(&sources_dir)
         .with_context(|| anyhow!("Failed to create sources dir at {}", sources_dir.display()))?;
@@ -256,22 +386,62 @@ fn write_checker_source(fuzz_dir: &Path, data: &FuzzData) -> Result<(PathBuf, Pa
         })?;
 
     let fuzzer = sources_dir.join("fuzzer.cpp");
+    let fuzzer_content = if data.target == FuzzTarget::Checker {
+        FUZZER
+    } else {
+        MANAGER_FUZZER
+    };
     info!("Writing fuzzer source at {}", fuzzer.display());
     std::fs::File::create(&fuzzer)
         .with_context(|| anyhow!("Failed to create {}", fuzzer.display()))?
-        .write_all(FUZZER)
+        .write_all(fuzzer_content)
         .with_context(|| {
             anyhow!(
                 "Failed to write {} bytes of fuzzer at {}",
-                FUZZER.len(),
+                fuzzer_content.len(),
                 fuzzer.display()
             )
         })?;
+    let mut fuzzer_sources = vec![fuzzer];
+
+    // included by both the fuzzers, it's found next to them
+    let common = sources_dir.join("fuzzer_common.h");
+    std::fs::File::create(&common)
+        .with_context(|| anyhow!("Failed to create {}", common.display()))?
+        .write_all(FUZZER_COMMON)
+        .with_context(|| {
+            anyhow!(
+                "Failed to write {} bytes of fuzzer header at {}",
+                FUZZER_COMMON.len(),
+                common.display()
+            )
+        })?;
+
+    if !data.opt.no_custom_mutator {
+        let mutator = sources_dir.join("mutator.cpp");
+        info!("Writing mutator source at {}", mutator.display());
+        std::fs::File::create(&mutator)
+            .with_context(|| anyhow!("Failed to create {}", mutator.display()))?
+            .write_all(MUTATOR)
+            .with_context(|| {
+                anyhow!(
+                    "Failed to write {} bytes of mutator at {}",
+                    MUTATOR.len(),
+                    mutator.display()
+                )
+            })?;
+        fuzzer_sources.push(mutator);
+    }
 
-    Ok((path, fuzzer))
+    Ok((path, fuzzer_sources))
 }
 
 fn checker_sanity_check(data: &FuzzData, checker_content: &str) -> Result<(), Error> {
+    // with the snapshots the global state is restored after each iteration
+    if data.opt.snapshot {
+        debug!("Skipping the global variables check since --snapshot is used");
+        return Ok(());
+    }
     let mut command = std::process::Command::new("ctags");
     command.arg("--output-format=json");
     command.arg("--c-kinds=v");
@@ -347,12 +517,16 @@ fn compile_fuzzer(
     fuzz_dir: &Path,
     data: &FuzzData,
     checker_source_path: &Path,
-    fuzzer_source_path: &Path,
+    fuzzer_sources: &[PathBuf],
 ) -> Result<PathBuf, Error> {
     let fuzzer_dir = fuzz_dir.join("fuzzer");
     std::fs::create_dir_all(&fuzzer_dir)
         .with_context(|| anyhow!("Failed to create fuzzer dir at {}", fuzzer_dir.display()))?;
-    let checker_shared_object_path = fuzzer_dir.join("checker.so");
+    let checker_shared_object_path = if data.target == FuzzTarget::Checker {
+        fuzzer_dir.join("checker.so")
+    } else {
+        fuzzer_dir.join("manager.so")
+    };
     info!(
         "Compiling {} with clang++",
         checker_shared_object_path.display()
@@ -364,6 +538,12 @@ fn compile_fuzzer(
     command.arg("-fPIC");
     command.arg("-o");
     command.arg(&checker_shared_object_path);
+    // the patched source is not next to the original one, keep its headers reachable (e.g.
+    // controller_lib.h)
+    if let Some(source_dir) = data.checker_source.parent() {
+        command.arg("-I");
+        command.arg(source_dir);
+    }
 
     let mut sanitizers = "-fsanitize=fuzzer".to_string();
     if !data.opt.sanitizers.is_empty() {
@@ -396,14 +576,34 @@ fn compile_fuzzer(
     let target = fuzzer_dir.join("fuzzer");
     info!("Compiling {} with clang++", target.display());
     let mut command = std::process::Command::new("clang++");
-    command.arg(fuzzer_source_path);
+    command.args(fuzzer_sources);
     command.arg("-std=c++17");
     command.arg("-o");
     command.arg(&target);
 
-    command.arg(format!("-DNUM_INPUTS={}", data.initial_output_files.len()));
+    command.arg(format!("-DNUM_INPUTS={}", data.input_files.len()));
     command.arg(format!("-DFUZZ_DIRECTORY=\"{}\"", fuzz_dir.display()));
     command.arg(format!("-DTASK_DIRECTORY=\"{}\"", data.task_dir.display()));
+    match data.target {
+        FuzzTarget::Checker => {
+            if data.opt.snapshot {
+                command.arg("-DFUZZ_SNAPSHOT");
+            }
+        }
+        FuzzTarget::Manager { num_processes } => {
+            command.arg("-DFUZZ_MANAGER");
+            command.arg(format!("-DNUM_PROCESSES={num_processes}"));
+            if data.infile.is_none() {
+                command.arg("-DINPUT_FROM_STDIN");
+            }
+        }
+        FuzzTarget::Controller => {
+            command.arg("-DFUZZ_CONTROLLER");
+        }
+    }
+    if data.opt.disk_io {
+        command.arg("-DFUZZ_DISK_IO");
+    }
 
     let mut sanitizers = "-fsanitize=fuzzer".to_string();
     if !data.opt.sanitizers.is_empty() {
@@ -433,6 +633,24 @@ fn compile_fuzzer(
     Ok(target)
 }
 
+/// Number of fuzzer processes to run in parallel.
+fn fuzzer_jobs(data: &FuzzData) -> usize {
+    if let Some(jobs) = data.opt.jobs {
+        jobs
+    } else {
+        num_cpus::get()
+    }
+}
+
+/// Arguments to pass to the fuzzer both while fuzzing and while reproducing the failures.
+fn fuzzer_args(data: &FuzzData) -> Vec<String> {
+    let mut args = vec![format!("-timeout={}", data.opt.checker_timeout)];
+    if data.opt.snapshot {
+        args.push("-detect_leaks=0".into());
+    }
+    args
+}
+
 fn run_fuzzer(fuzz_dir: &Path, data: &FuzzData, fuzzer: &Path) -> Result<Vec<PathBuf>, Error> {
     let artifacts = fuzz_dir.join("artifacts");
     if artifacts.exists() {
@@ -453,13 +671,8 @@ fn run_fuzzer(fuzz_dir: &Path, data: &FuzzData, fuzzer: &Path) -> Result<Vec<Pat
     }
 
     let mut command = std::process::Command::new(fuzzer);
-    let jobs = if let Some(jobs) = data.opt.jobs {
-        jobs
-    } else {
-        num_cpus::get()
-    };
-    command.arg(format!("-fork={jobs}"));
-    command.arg(format!("-timeout={}", data.opt.checker_timeout));
+    command.arg(format!("-fork={}", fuzzer_jobs(data)));
+    command.args(fuzzer_args(data));
     command.arg(format!("-max_total_time={}", data.opt.max_time));
     command.arg(fuzz_dir.join("initial_corpus"));
     command.arg(format!("-artifact_prefix={}/", artifacts.display()));
@@ -500,13 +713,47 @@ fn run_fuzzer(fuzz_dir: &Path, data: &FuzzData, fuzzer: &Path) -> Result<Vec<Pat
     Ok(paths)
 }
 
-fn organize_failures(
+/// Run again the failures found by the fuzzer, group them by their cause and minimize one failure
+/// per group.
+fn triage_failures(
     fuzz_dir: &Path,
     data: &FuzzData,
+    fuzzer: &Path,
     artifacts: &[PathBuf],
+) -> Result<Vec<FailureBucket>, Error> {
+    if artifacts.is_empty() {
+        return Ok(vec![]);
+    }
+    let reproducer = Reproducer {
+        fuzzer,
+        args: fuzzer_args(data),
+        jobs: fuzzer_jobs(data),
+    };
+    info!("Reproducing {} failures", artifacts.len());
+    let mut buckets = reproducer.deduplicate(artifacts)?;
+    info!(
+        "Found {} distinct failures out of {}",
+        buckets.len(),
+        artifacts.len()
+    );
+    if !data.opt.no_minimize {
+        info!("Minimizing {} failures", buckets.len());
+        reproducer.minimize(
+            &mut buckets,
+            &fuzz_dir.join("minimized"),
+            data.opt.minimize_time,
+        )?;
+    }
+    Ok(buckets)
+}
+
+fn organize_failures(
+    fuzz_dir: &Path,
+    data: &FuzzData,
+    buckets: &[FailureBucket],
     checker_bin_path: &Path,
 ) -> Result<(), Error> {
-    if artifacts.is_empty() {
+    if buckets.is_empty() {
         info!("No failure found!");
         return Ok(());
     }
@@ -525,9 +772,16 @@ fn organize_failures(
 
     let mut printer = StdoutPrinter::default();
     let checker_bin_path = checker_bin_path.to_string_lossy();
-    let readme = README.replace("@@CHECKER@@", &checker_bin_path);
+    let readme = if data.target == FuzzTarget::Checker {
+        README
+    } else {
+        MANAGER_README
+    };
+    let readme = readme.replace("@@CHECKER@@", &checker_bin_path);
 
-    for (artifact_id, artifact) in artifacts.iter().enumerate() {
+    for (bucket_id, bucket) in buckets.iter().enumerate() {
+        let artifact = bucket.minimized.as_ref().unwrap_or(&bucket.representative);
+        let fail_type = &bucket.fail_type;
         let mut file = std::fs::File::open(artifact)
             .with_context(|| anyhow!("Failed to open artifact at {}", artifact.display()))?;
 
@@ -535,7 +789,7 @@ fn organize_failures(
         let mut id = [0u8; 4];
         file.read_exact(&mut id)
             .with_context(|| anyhow!("Failed to read testcase id from {}", artifact.display()))?;
-        let id = u32::from_le_bytes(id) % data.initial_output_files.len() as u32;
+        let id = u32::from_le_bytes(id) % data.input_files.len() as u32;
 
         // read the actual output file
         let mut output = vec![];
@@ -546,15 +800,7 @@ fn organize_failures(
             )
         })?;
 
-        // obtain the failure type from the artifact file name (crash-... timeout-... ecc)
-        let artifact_name = artifact.file_name().unwrap();
-        let fail_type = if let Some(fail_type) = artifact_name.to_str().unwrap().split('-').next() {
-            fail_type
-        } else {
-            bail!("Invalid artifact name {}", artifact.display());
-        };
-
-        let target_dir = failures.join(format!("fail-{artifact_id}"));
+        let target_dir = failures.join(format!("fail-{bucket_id}"));
         std::fs::create_dir(&target_dir).with_context(|| {
             anyhow!(
                 "Failed to create artifact output directory at {}",
@@ -583,15 +829,17 @@ fn organize_failures(
                 source_input_path.display()
             )
         })?;
-        std::os::unix::fs::symlink(&source_correct_path, &target_output_path).with_context(
-            || {
-                anyhow!(
-                    "Failed to create symlink: {} -> {}",
-                    target_output_path.display(),
-                    source_correct_path.display()
-                )
-            },
-        )?;
+        if data.target == FuzzTarget::Checker {
+            std::os::unix::fs::symlink(&source_correct_path, &target_output_path).with_context(
+                || {
+                    anyhow!(
+                        "Failed to create symlink: {} -> {}",
+                        target_output_path.display(),
+                        source_correct_path.display()
+                    )
+                },
+            )?;
+        }
         std::os::unix::fs::symlink(artifact, &target_artifact_path).with_context(|| {
             anyhow!(
                 "Failed to create symlink: {} -> {}",
@@ -599,15 +847,40 @@ fn organize_failures(
                 artifact.display()
             )
         })?;
+        if bucket.minimized.is_some() {
+            let target_original_path = target_dir.join("original.bin");
+            std::os::unix::fs::symlink(&bucket.representative, &target_original_path)
+                .with_context(|| {
+                    anyhow!(
+                        "Failed to create symlink: {} -> {}",
+                        target_original_path.display(),
+                        bucket.representative.display()
+                    )
+                })?;
+        }
+        std::fs::write(target_dir.join("report.txt"), &bucket.report)
+            .context("Failed to write report.txt")?;
+        let duplicates = bucket
+            .duplicates
+            .iter()
+            .map(|path| format!("{}\n", path.display()))
+            .collect::<String>();
+        std::fs::write(target_dir.join("duplicates.txt"), duplicates)
+            .context("Failed to write duplicates.txt")?;
         #[allow(clippy::needless_borrow)] // https://github.com/rust-lang/rust-clippy/issues/9778
         std::fs::write(target_dir.join("README"), &readme).context("Failed to write README")?;
         cwrite!(printer, RED, "[FAIL] {:<8}", fail_type);
-        println!(" {}", target_dir.display());
+        print!(" {}", target_dir.display());
+        if !bucket.duplicates.is_empty() {
+            print!(" (+{} duplicates)", bucket.duplicates.len());
+        }
+        println!();
+        debug!("{}: {}", target_dir.display(), bucket.signature);
     }
 
     warn!(
         "{} checker failure written to {}",
-        artifacts.len(),
+        buckets.len(),
         failures.display()
     );
 
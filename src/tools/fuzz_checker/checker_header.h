@@ -1,4 +1,5 @@
 #include <stdlib.h>
+#include <unistd.h>
 
 // Override the common exit functions, EXIT will throw an exception caught by
 // the fuzzer
@@ -2,55 +2,193 @@
 #undef NDEBUG
 #endif
 
-#include <assert.h>
-#include <dlfcn.h>
-#include <fcntl.h>
-#include <stdint.h>
+#include <errno.h>
 #include <stdio.h>
 #include <string.h>
-#include <unistd.h>
 
-#include <iostream>
-#include <string>
+#ifdef FUZZ_SNAPSHOT
+#include <link.h>
+#include <sys/uio.h>
+#endif
+
 #include <vector>
 
-typedef int (*new_main_t)(int argc, char **argv);
-
-struct Exit {
-  int status;
-};
+#include "fuzzer_common.h"
 
 #ifndef NUM_INPUTS
 #error Missing NUM_INPUTS
 #endif
 
-#ifndef FUZZ_DIRECTORY
-#error Missing FUZZ_DIRECTORY
-#endif
-
 #ifndef TASK_DIRECTORY
 #error Missing TASK_DIRECTORY
 #endif
 
-new_main_t setupDlOpen() {
-  void *dl = dlopen(FUZZ_DIRECTORY "/fuzzer/checker.so", RTLD_NOW);
-  if (!dl) {
-    std::cerr << "Cannot open checker.so: " << dlerror() << '\n';
+// The descriptors used by the harness. They are opened only once and reused
+// for all the iterations, avoiding a handful of syscalls per input.
+struct HarnessFiles {
+  // File with the fuzzed contestant output.
+  int in_fd;
+  // File where the stdout of the checker is redirected to.
+  int out_fd;
+  // /dev/null, used for suppressing the stderr of the checker.
+  int null_fd;
+  // The original stderr of the fuzzer.
+  int old_stderr;
+  // The path of in_fd, passed to the checker.
+  std::string output_file;
+};
+
+HarnessFiles setupFiles() {
+  HarnessFiles files;
+  files.in_fd = makeScratchFile("output");
+  files.out_fd = makeScratchFile("stdout");
+  assert(dup2(files.out_fd, STDOUT_FILENO) != -1);
+  files.null_fd = open("/dev/null", O_WRONLY);
+  assert(files.null_fd != -1);
+  files.old_stderr = dup(STDERR_FILENO);
+  assert(files.old_stderr != -1);
+  files.output_file = "/dev/fd/" + std::to_string(files.in_fd);
+  return files;
+}
+
+// Paths of the reference files of a testcase, as passed to the checker.
+struct TestcaseFiles {
+  std::string input_file;
+  std::string cor_file;
+};
+
+// Copy the content of the file at path into a new in-memory file, returning
+// the /dev/fd path to it. If the file cannot be kept in memory the original
+// path is returned.
+std::string preloadFile(const std::string &path) {
+#if !defined(FUZZ_DISK_IO) && defined(MFD_CLOEXEC)
+  int src = open(path.c_str(), O_RDONLY);
+  if (src == -1) {
+    std::cerr << "Cannot open " << path << ": " << strerror(errno) << '\n';
     std::exit(1);
   }
+  int fd = memfd_create("testcase", 0);
+  if (fd == -1) {
+    close(src);
+    return path;
+  }
+  char buffer[1 << 16];
+  ssize_t len;
+  while ((len = read(src, buffer, sizeof(buffer))) > 0)
+    writeAll(fd, (const uint8_t *)buffer, len);
+  close(src);
+  if (len != 0) {
+    close(fd);
+    return path;
+  }
+  return "/dev/fd/" + std::to_string(fd);
+#else
+  return path;
+#endif
+}
+
+// Load all the reference input/output files once, so that the checker reads
+// them from memory instead of from the task directory at every iteration.
+std::vector<TestcaseFiles> setupTestcases() {
+  std::vector<TestcaseFiles> testcases;
+  testcases.reserve(NUM_INPUTS);
+  for (int i = 0; i < NUM_INPUTS; i++) {
+    testcases.push_back(TestcaseFiles{
+        preloadFile(TASK_DIRECTORY "/input/input" + std::to_string(i) + ".txt"),
+        preloadFile(TASK_DIRECTORY "/output/output" + std::to_string(i) +
+                    ".txt"),
+    });
+  }
+  return testcases;
+}
 
-  new_main_t checker_main = (new_main_t)dlsym(dl, "main");
-  if (!checker_main) {
-    std::cerr << "Cannot find main function from checker.so: " << dlerror()
-              << '\n';
+#ifdef FUZZ_SNAPSHOT
+// A copy of a writable memory region of checker.so.
+struct Segment {
+  void *start;
+  std::vector<char> data;
+};
+
+// The state of the checker right after it has been loaded, restored after
+// each iteration so that checkers with global state and leaked descriptors
+// behave as if they were run in a new process.
+struct Snapshot {
+  std::vector<Segment> segments;
+  // All the descriptors from this one on are opened by the checker.
+  int first_leaked_fd;
+};
+
+// Copy memory using the kernel. The writable segments contain the redzones
+// of the globals, which must not be touched by (instrumented) user-space code.
+void copyMemory(void *dest, void *src, size_t len) {
+  struct iovec local = {dest, len};
+  struct iovec remote = {src, len};
+  ssize_t copied = syscall(SYS_process_vm_readv, getpid(), &local, 1, &remote,
+                           1, 0);
+  assert(copied == (ssize_t)len);
+}
+
+int collectSegments(struct dl_phdr_info *info, size_t, void *arg) {
+  if (strcmp(info->dlpi_name, FUZZ_DIRECTORY "/fuzzer/checker.so") != 0)
+    return 0;
+  auto *segments = (std::vector<Segment> *)arg;
+  uintptr_t page_size = sysconf(_SC_PAGESIZE);
+  // The RELRO part of the writable segment becomes read-only after the
+  // relocations, and it doesn't change anyway.
+  uintptr_t relro_end = 0;
+  for (int i = 0; i < info->dlpi_phnum; i++) {
+    const auto &phdr = info->dlpi_phdr[i];
+    if (phdr.p_type == PT_GNU_RELRO)
+      relro_end =
+          (info->dlpi_addr + phdr.p_vaddr + phdr.p_memsz) & ~(page_size - 1);
+  }
+  for (int i = 0; i < info->dlpi_phnum; i++) {
+    const auto &phdr = info->dlpi_phdr[i];
+    if (phdr.p_type != PT_LOAD || !(phdr.p_flags & PF_W))
+      continue;
+    uintptr_t start = info->dlpi_addr + phdr.p_vaddr;
+    uintptr_t end = start + phdr.p_memsz;
+    if (start < relro_end)
+      start = relro_end;
+    if (start >= end)
+      continue;
+    Segment segment{(void *)start, std::vector<char>(end - start)};
+    copyMemory(segment.data.data(), segment.start, segment.data.size());
+    segments->push_back(std::move(segment));
+  }
+  return 1;
+}
+
+Snapshot setupSnapshot() {
+  Snapshot snapshot;
+  dl_iterate_phdr(collectSegments, &snapshot.segments);
+  if (snapshot.segments.empty()) {
+    std::cerr << "Cannot find the writable segments of checker.so\n";
     std::exit(1);
   }
+  snapshot.first_leaked_fd = firstUnusedFd();
+  return snapshot;
+}
 
-  return checker_main;
+void restoreSnapshot(Snapshot &snapshot) {
+  for (auto &segment : snapshot.segments) {
+    struct iovec local = {segment.data.data(), segment.data.size()};
+    struct iovec remote = {segment.start, segment.data.size()};
+    ssize_t copied = syscall(SYS_process_vm_writev, getpid(), &local, 1,
+                             &remote, 1, 0);
+    assert(copied == (ssize_t)segment.data.size());
+  }
+  closeLeakedFiles(snapshot.first_leaked_fd);
 }
+#endif
 
 extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
-  static auto checker_main = setupDlOpen();
+  static auto checker_main = loadMain(FUZZ_DIRECTORY "/fuzzer/checker.so");
+  static auto files = setupFiles();
+  static auto testcases = setupTestcases();
+#ifdef FUZZ_SNAPSHOT
+  static auto snapshot = setupSnapshot();
+#endif
 
   // Prepare input ID.
   if (size <= 4)
@@ -60,33 +198,18 @@ extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
   input_id = input_id % NUM_INPUTS;
 
   // Prepare input file.
-  int in_fd = open(FUZZ_DIRECTORY, O_TMPFILE | O_RDWR, S_IRUSR | S_IWUSR);
-  assert(in_fd != -1);
-  size_t pos = 4;
-  while (pos < size) {
-    ssize_t written = write(in_fd, data + pos, size - pos);
-    assert(written > 0);
-    pos += written;
-  }
-  lseek(in_fd, 0, SEEK_SET);
+  resetScratchFile(files.in_fd);
+  writeAll(files.in_fd, data + 4, size - 4);
+  lseek(files.in_fd, 0, SEEK_SET);
 
-  // Prepare stdout file.
-  int out_fd = open(FUZZ_DIRECTORY, O_TMPFILE | O_RDWR, S_IRUSR | S_IWUSR);
-  assert(out_fd != -1);
-  assert(dup2(out_fd, STDOUT_FILENO) != -1);
-
-  // Suppress stderr from the checker.
-  int err_fd = open("/dev/null", O_RDONLY);
-  int old_stderr = dup(STDERR_FILENO);
-  assert(old_stderr != -1);
-  assert(err_fd != -1);
+  // Prepare stdout file. It is shared with STDOUT_FILENO, so this also rewinds
+  // the checker's stdout.
+  fflush(stdout);
+  resetScratchFile(files.out_fd);
 
   // Prepare argv.
-  std::string input_file =
-      TASK_DIRECTORY "/input/input" + std::to_string(input_id) + ".txt";
-  std::string cor_file =
-      TASK_DIRECTORY "/output/output" + std::to_string(input_id) + ".txt";
-  std::string output_file = "/dev/fd/" + std::to_string(in_fd);
+  const std::string &input_file = testcases[input_id].input_file;
+  const std::string &cor_file = testcases[input_id].cor_file;
 
   const char arg0_c[] = FUZZ_DIRECTORY "/checker";
   std::vector<char> arg0(std::begin(arg0_c), std::end(arg0_c));
@@ -95,36 +218,34 @@ extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
   i_file.push_back(0);
   std::vector<char> c_file(cor_file.begin(), cor_file.end());
   c_file.push_back(0);
-  std::vector<char> o_file(output_file.begin(), output_file.end());
+  std::vector<char> o_file(files.output_file.begin(), files.output_file.end());
   o_file.push_back(0);
   char *argv[5] = {arg0.data(), i_file.data(), c_file.data(), o_file.data(),
                    nullptr};
 
-  // Call the checker.
-  assert(dup2(err_fd, STDERR_FILENO) != -1);
+  // Call the checker, suppressing its stderr.
+  assert(dup2(files.null_fd, STDERR_FILENO) != -1);
   int ret;
   try {
     ret = checker_main(4, argv);
   } catch (Exit r) {
     ret = r.status;
   }
-  assert(dup2(old_stderr, STDERR_FILENO) != -1);
+  assert(dup2(files.old_stderr, STDERR_FILENO) != -1);
+#ifdef FUZZ_SNAPSHOT
+  restoreSnapshot(snapshot);
+#endif
   assert(ret == 0);
 
   // Check that the checker produced a [0, 1] float.
   fflush(stdout);
-  lseek(out_fd, 0, SEEK_SET);
-  FILE *f = fdopen(out_fd, "r");
+  char buffer[64];
+  ssize_t len = pread(files.out_fd, buffer, sizeof(buffer) - 1, 0);
+  assert(len > 0);
+  buffer[len] = 0;
   float score;
-  assert(fscanf(f, "%f", &score) == 1);
+  assert(sscanf(buffer, "%f", &score) == 1);
   assert(!(score < 0));
   assert(!(score > 1));
-
-  // Close FDs.
-  fclose(f);
-  close(in_fd);
-  close(out_fd);
-  close(err_fd);
-  close(old_stderr);
   return 0;
 }
@@ -0,0 +1,110 @@
+// Helpers shared by the harnesses of fuzz-checker: loading the fuzzed program
+// as a shared object and managing the scratch files the harness reuses across
+// iterations.
+
+#ifndef FUZZER_COMMON_H
+#define FUZZER_COMMON_H
+
+#include <assert.h>
+#include <dirent.h>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <string>
+
+#ifndef FUZZ_DIRECTORY
+#error Missing FUZZ_DIRECTORY
+#endif
+
+typedef int (*new_main_t)(int argc, char **argv);
+
+// Thrown by the patched exit() of the fuzzed program.
+struct Exit {
+  int status;
+};
+
+// Load the shared object at path and find its main function.
+new_main_t loadMain(const char *path) {
+  void *dl = dlopen(path, RTLD_NOW);
+  if (!dl) {
+    std::cerr << "Cannot open " << path << ": " << dlerror() << '\n';
+    std::exit(1);
+  }
+
+  new_main_t fuzzed_main = (new_main_t)dlsym(dl, "main");
+  if (!fuzzed_main) {
+    std::cerr << "Cannot find main function from " << path << ": "
+              << dlerror() << '\n';
+    std::exit(1);
+  }
+
+  return fuzzed_main;
+}
+
+// Create an anonymous read-write file. Unless FUZZ_DISK_IO is defined the file
+// lives only in memory (memfd), falling back to an unlinked file inside
+// FUZZ_DIRECTORY if memfd_create is not available.
+int makeScratchFile(const char *name) {
+  int fd = -1;
+#if !defined(FUZZ_DISK_IO) && defined(MFD_CLOEXEC)
+  fd = memfd_create(name, 0);
+#else
+  (void)name;
+#endif
+  if (fd == -1)
+    fd = open(FUZZ_DIRECTORY, O_TMPFILE | O_RDWR, S_IRUSR | S_IWUSR);
+  assert(fd != -1);
+  return fd;
+}
+
+// Empty a scratch file and rewind it, so that it can be reused by the next
+// iteration.
+void resetScratchFile(int fd) {
+  assert(ftruncate(fd, 0) != -1);
+  assert(lseek(fd, 0, SEEK_SET) != -1);
+}
+
+void writeAll(int fd, const uint8_t *data, size_t size) {
+  size_t pos = 0;
+  while (pos < size) {
+    ssize_t written = write(fd, data + pos, size - pos);
+    assert(written > 0);
+    pos += written;
+  }
+}
+
+// The descriptor after the highest one currently open.
+int firstUnusedFd() {
+  DIR *dir = opendir("/proc/self/fd");
+  assert(dir);
+  int max_fd = STDERR_FILENO;
+  while (struct dirent *entry = readdir(dir)) {
+    int fd = atoi(entry->d_name);
+    if (fd > max_fd && fd != dirfd(dir))
+      max_fd = fd;
+  }
+  closedir(dir);
+  return max_fd + 1;
+}
+
+// Close all the descriptors from first_fd on, the ones left open by the fuzzed
+// program: they would run out after a few hundred iterations.
+void closeLeakedFiles(int first_fd) {
+#ifdef SYS_close_range
+  if (syscall(SYS_close_range, first_fd, ~0U, 0) == 0)
+    return;
+#endif
+  long max_fd = sysconf(_SC_OPEN_MAX);
+  if (max_fd < 0 || max_fd > 65536)
+    max_fd = 65536;
+  for (int fd = first_fd; fd < max_fd; fd++)
+    close(fd);
+}
+
+#endif
@@ -0,0 +1,229 @@
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+
+// Harness for fuzzing the managers of Communication tasks and the controllers
+// of Interactive tasks.
+//
+// The manager (or controller) is loaded as a shared object and called
+// in-process. The fuzzer input is made of a 4-byte testcase index followed by
+// the streams written by the solutions, separated by NUL bytes. Instead of the
+// FIFOs used by task-maker, each stream is stored in an in-memory file: the
+// harness runs in a single thread, so real pipes would deadlock as soon as the
+// manager writes more than the pipe capacity. The data written to the
+// solutions is discarded.
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <vector>
+
+#include "fuzzer_common.h"
+
+#ifndef NUM_INPUTS
+#error Missing NUM_INPUTS
+#endif
+
+#if !defined(FUZZ_MANAGER) && !defined(FUZZ_CONTROLLER)
+#error Missing FUZZ_MANAGER or FUZZ_CONTROLLER
+#endif
+
+#if defined(FUZZ_MANAGER) && !defined(NUM_PROCESSES)
+#error Missing NUM_PROCESSES
+#endif
+
+// Maximum number of solutions a controller can start.
+#ifndef MAX_SOLUTIONS
+#define MAX_SOLUTIONS 16
+#endif
+
+#ifdef FUZZ_MANAGER
+#define NUM_STREAMS NUM_PROCESSES
+#else
+#define NUM_STREAMS MAX_SOLUTIONS
+#endif
+
+// The descriptors used by the harness. They are opened only once and reused
+// for all the iterations.
+struct HarnessFiles {
+  // The streams written by the solutions, read by the manager.
+  int sol2man[NUM_STREAMS];
+  // The streams written by the manager, which nobody reads.
+  int man2sol[NUM_STREAMS];
+#ifdef FUZZ_CONTROLLER
+  // The responses to the START_SOLUTION commands, read by the controller from
+  // its stdin.
+  int control_fd;
+#endif
+#ifdef INPUT_FROM_STDIN
+  // The input files of the testcases, for the managers that read them from
+  // stdin.
+  int input_fd[NUM_INPUTS];
+#endif
+  // File where the stdout of the manager is redirected to.
+  int out_fd;
+  // File where the stderr of the manager is redirected to.
+  int err_fd;
+  // The original stderr of the fuzzer.
+  int old_stderr;
+  // All the descriptors from this one on are opened by the manager, and they
+  // are closed after each iteration.
+  int first_leaked_fd;
+};
+
+HarnessFiles setupFiles() {
+  HarnessFiles files;
+  for (int i = 0; i < NUM_STREAMS; i++) {
+    files.sol2man[i] = makeScratchFile("sol2man");
+    files.man2sol[i] = makeScratchFile("man2sol");
+  }
+#ifdef FUZZ_CONTROLLER
+  files.control_fd = makeScratchFile("control");
+#endif
+#ifdef INPUT_FROM_STDIN
+  for (int i = 0; i < NUM_INPUTS; i++) {
+    std::string path = FUZZ_DIRECTORY "/testcases/" + std::to_string(i) +
+                       "/input.txt";
+    files.input_fd[i] = open(path.c_str(), O_RDONLY);
+    if (files.input_fd[i] == -1) {
+      std::cerr << "Cannot open " << path << ": " << strerror(errno) << '\n';
+      std::exit(1);
+    }
+  }
+#endif
+  files.out_fd = makeScratchFile("stdout");
+  assert(dup2(files.out_fd, STDOUT_FILENO) != -1);
+  files.err_fd = makeScratchFile("stderr");
+  files.old_stderr = dup(STDERR_FILENO);
+  assert(files.old_stderr != -1);
+  files.first_leaked_fd = firstUnusedFd();
+  return files;
+}
+
+std::string fdPath(int fd) { return "/dev/fd/" + std::to_string(fd); }
+
+std::vector<char> toArg(const std::string &s) {
+  std::vector<char> arg(s.begin(), s.end());
+  arg.push_back(0);
+  return arg;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+  static auto manager_main = loadMain(FUZZ_DIRECTORY "/fuzzer/manager.so");
+  static auto files = setupFiles();
+
+  // Prepare input ID.
+  if (size < 4)
+    return 0;
+  uint32_t input_id;
+  memcpy(&input_id, data, 4);
+  input_id = input_id % NUM_INPUTS;
+
+  // Split the solution streams.
+  int num_streams = 0;
+  size_t pos = 4;
+  while (num_streams < NUM_STREAMS && (num_streams == 0 || pos < size)) {
+    const uint8_t *end = (const uint8_t *)memchr(data + pos, 0, size - pos);
+    size_t len = end ? end - (data + pos) : size - pos;
+    resetScratchFile(files.sol2man[num_streams]);
+    writeAll(files.sol2man[num_streams], data + pos, len);
+    lseek(files.sol2man[num_streams], 0, SEEK_SET);
+    resetScratchFile(files.man2sol[num_streams]);
+    num_streams++;
+    pos += len + 1;
+  }
+#ifdef FUZZ_MANAGER
+  // A manager always talks with all its processes.
+  for (int i = num_streams; i < NUM_STREAMS; i++) {
+    resetScratchFile(files.sol2man[i]);
+    resetScratchFile(files.man2sol[i]);
+  }
+  num_streams = NUM_STREAMS;
+#endif
+
+  // Prepare the input file of the testcase.
+  std::string testcase_dir =
+      FUZZ_DIRECTORY "/testcases/" + std::to_string(input_id);
+  assert(chdir(testcase_dir.c_str()) == 0);
+#ifdef INPUT_FROM_STDIN
+  assert(dup2(files.input_fd[input_id], STDIN_FILENO) != -1);
+  assert(fseek(stdin, 0, SEEK_SET) == 0);
+#endif
+
+  // Prepare argv.
+  std::vector<std::vector<char>> args;
+  args.push_back(toArg(FUZZ_DIRECTORY "/manager"));
+#ifdef FUZZ_MANAGER
+  for (int i = 0; i < num_streams; i++) {
+    args.push_back(toArg(fdPath(files.sol2man[i])));
+    args.push_back(toArg(fdPath(files.man2sol[i])));
+  }
+#else
+  // The controller starts the solutions by itself, reading the descriptors
+  // of their pipes from stdin. It will close them, so pass duplicates. They are
+  // placed after first_leaked_fd, so that the ones the controller doesn't
+  // close are closed with the others after the iteration, even if there are
+  // unused descriptors before it.
+  resetScratchFile(files.control_fd);
+  std::string control;
+  for (int i = 0; i < num_streams; i++) {
+    int to_solution = fcntl(files.man2sol[i], F_DUPFD, files.first_leaked_fd);
+    assert(to_solution != -1);
+    int from_solution = fcntl(files.sol2man[i], F_DUPFD, files.first_leaked_fd);
+    assert(from_solution != -1);
+    control += std::to_string(to_solution) + " " +
+               std::to_string(from_solution) + "\n";
+  }
+  writeAll(files.control_fd, (const uint8_t *)control.data(), control.size());
+  assert(dup2(files.control_fd, STDIN_FILENO) != -1);
+  assert(fseek(stdin, 0, SEEK_SET) == 0);
+#endif
+  std::vector<char *> argv;
+  for (auto &arg : args)
+    argv.push_back(arg.data());
+  argv.push_back(nullptr);
+
+  // Prepare stdout and stderr files.
+  fflush(stdout);
+  resetScratchFile(files.out_fd);
+  resetScratchFile(files.err_fd);
+
+  // Call the manager, capturing its stderr.
+  assert(dup2(files.err_fd, STDERR_FILENO) != -1);
+  int ret;
+  try {
+    ret = manager_main(argv.size() - 1, argv.data());
+  } catch (Exit r) {
+    ret = r.status;
+  }
+  fflush(stdout);
+  fflush(stderr);
+  assert(dup2(files.old_stderr, STDERR_FILENO) != -1);
+  closeLeakedFiles(files.first_leaked_fd);
+  assert(ret == 0);
+
+  // Check that the score is a [0, 1] float. Managers print it to stdout,
+  // controllers print a "SCORE: " line to stderr.
+  char buffer[4096];
+#ifdef FUZZ_MANAGER
+  ssize_t len = pread(files.out_fd, buffer, sizeof(buffer) - 1, 0);
+  assert(len > 0);
+  buffer[len] = 0;
+  const char *score_str = buffer;
+#else
+  ssize_t len = pread(files.err_fd, buffer, sizeof(buffer) - 1, 0);
+  assert(len >= 0);
+  buffer[len] = 0;
+  const char *score_str = strstr(buffer, "SCORE: ");
+  // Without a score the solution gets zero points.
+  if (!score_str)
+    return 0;
+  score_str += strlen("SCORE: ");
+#endif
+  float score;
+  assert(sscanf(score_str, "%f", &score) == 1);
+  assert(!(score < 0));
+  assert(!(score > 1));
+  return 0;
+}
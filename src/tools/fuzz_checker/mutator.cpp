@@ -0,0 +1,260 @@
+// Structure-aware mutator for the fuzz-checker harness.
+//
+// The fuzzer inputs are made of a 4-byte testcase index followed by a
+// contestant output. Byte-level mutations of the output are very likely to be
+// rejected by the checker while parsing, so this mutator works on the
+// whitespace-separated tokens of the output: it perturbs the numbers near
+// their boundaries, swaps, drops and duplicates tokens and lines, and adds
+// whitespace noise. Sometimes the mutation is left to libFuzzer, so that the
+// byte-level exploration is not lost.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cmath>
+#include <random>
+#include <string>
+#include <vector>
+
+extern "C" size_t LLVMFuzzerMutate(uint8_t *data, size_t size, size_t max_size);
+
+namespace {
+
+// A piece of the output: either a token or the whitespace between two tokens.
+struct Piece {
+  std::string text;
+  bool is_space;
+};
+
+bool isSpace(char c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' ||
+         c == '\f';
+}
+
+std::vector<Piece> tokenize(const std::string &text) {
+  std::vector<Piece> pieces;
+  size_t i = 0;
+  while (i < text.size()) {
+    bool space = isSpace(text[i]);
+    size_t j = i;
+    while (j < text.size() && isSpace(text[j]) == space)
+      j++;
+    pieces.push_back(Piece{text.substr(i, j - i), space});
+    i = j;
+  }
+  return pieces;
+}
+
+std::string join(const std::vector<Piece> &pieces) {
+  std::string text;
+  for (const auto &piece : pieces)
+    text += piece.text;
+  return text;
+}
+
+bool isInteger(const std::string &token) {
+  size_t i = (token[0] == '-' || token[0] == '+') ? 1 : 0;
+  if (i == token.size())
+    return false;
+  for (; i < token.size(); i++)
+    if (token[i] < '0' || token[i] > '9')
+      return false;
+  return true;
+}
+
+bool isFloat(const std::string &token) {
+  char *end;
+  strtod(token.c_str(), &end);
+  return end != token.c_str() && *end == 0;
+}
+
+class Mutator {
+public:
+  explicit Mutator(unsigned int seed) : rng(seed) {}
+
+  // Mutate the output, returning false if no mutation was possible.
+  bool mutate(std::string &text) {
+    std::vector<Piece> pieces = tokenize(text);
+    std::vector<size_t> tokens;
+    for (size_t i = 0; i < pieces.size(); i++)
+      if (!pieces[i].is_space)
+        tokens.push_back(i);
+
+    switch (pick(7)) {
+    case 0:
+      if (!perturbNumber(pieces, tokens))
+        return false;
+      break;
+    case 1:
+      if (tokens.size() < 2)
+        return false;
+      std::swap(pieces[tokens[pick(tokens.size())]].text,
+                pieces[tokens[pick(tokens.size())]].text);
+      break;
+    case 2:
+      if (tokens.empty())
+        return false;
+      pieces.erase(pieces.begin() + tokens[pick(tokens.size())]);
+      break;
+    case 3: {
+      if (tokens.empty())
+        return false;
+      size_t token = tokens[pick(tokens.size())];
+      Piece copy = pieces[token];
+      pieces.insert(pieces.begin() + token, {copy, Piece{" ", true}});
+      break;
+    }
+    case 4:
+      return mutateLines(text);
+    case 5:
+      addWhitespaceNoise(pieces);
+      break;
+    default:
+      if (!perturbNumber(pieces, tokens))
+        return false;
+      // A second mutation helps with outputs where values depend on each
+      // other (e.g. a count followed by a list).
+      addWhitespaceNoise(pieces);
+      break;
+    }
+    text = join(pieces);
+    return true;
+  }
+
+private:
+  std::minstd_rand rng;
+
+  size_t pick(size_t n) { return rng() % n; }
+
+  bool perturbNumber(std::vector<Piece> &pieces,
+                     const std::vector<size_t> &tokens) {
+    std::vector<size_t> numbers;
+    for (size_t token : tokens)
+      if (isFloat(pieces[token].text))
+        numbers.push_back(token);
+    if (numbers.empty())
+      return false;
+    std::string &number = pieces[numbers[pick(numbers.size())]].text;
+    if (isInteger(number))
+      number = perturbInteger(number);
+    else
+      number = perturbReal(number);
+    return true;
+  }
+
+  std::string perturbInteger(const std::string &number) {
+    static const char *boundaries[] = {
+        "0",
+        "1",
+        "-1",
+        "2147483647",
+        "-2147483648",
+        "2147483648",
+        "4294967295",
+        "4294967296",
+        "9223372036854775807",
+        "-9223372036854775808",
+        "9223372036854775808",
+        "18446744073709551616",
+        "100000000000000000000000000000",
+        "-0",
+        "+1",
+        "00",
+    };
+    long long value = strtoll(number.c_str(), nullptr, 10);
+    switch (pick(4)) {
+    case 0:
+      return boundaries[pick(sizeof(boundaries) / sizeof(*boundaries))];
+    case 1:
+      return std::to_string(
+          (long long)((unsigned long long)value + pick(5) - 2));
+    case 2:
+      return std::to_string((long long)(0ULL - (unsigned long long)value));
+    default:
+      // Append a digit, making the number one order of magnitude bigger.
+      return number + std::to_string(pick(10));
+    }
+  }
+
+  std::string perturbReal(const std::string &number) {
+    static const char *specials[] = {
+        "nan", "-nan", "inf", "-inf", "-0.0", "1e308", "1e309",
+        "4.9e-324", "0.0000000001", "1e-9", "1.", ".5", "0x1p3",
+    };
+    double value = strtod(number.c_str(), nullptr);
+    switch (pick(3)) {
+    case 0:
+      return specials[pick(sizeof(specials) / sizeof(*specials))];
+    case 1: {
+      double eps = std::pow(10.0, -(double)pick(12));
+      char buffer[64];
+      snprintf(buffer, sizeof(buffer), "%.*f", (int)pick(15),
+               value + (pick(2) ? eps : -eps));
+      return buffer;
+    }
+    default: {
+      char buffer[64];
+      snprintf(buffer, sizeof(buffer), "%.20g", value);
+      return buffer;
+    }
+    }
+  }
+
+  bool mutateLines(std::string &text) {
+    std::vector<std::string> lines;
+    size_t start = 0;
+    while (start < text.size()) {
+      size_t end = text.find('\n', start);
+      end = end == std::string::npos ? text.size() : end + 1;
+      lines.push_back(text.substr(start, end - start));
+      start = end;
+    }
+    if (lines.empty())
+      return false;
+    size_t line = pick(lines.size());
+    switch (pick(3)) {
+    case 0:
+      lines.erase(lines.begin() + line);
+      break;
+    case 1:
+      lines.insert(lines.begin() + line, lines[line]);
+      break;
+    default:
+      std::swap(lines[line], lines[pick(lines.size())]);
+      break;
+    }
+    text.clear();
+    for (const auto &l : lines)
+      text += l;
+    return true;
+  }
+
+  void addWhitespaceNoise(std::vector<Piece> &pieces) {
+    static const char *noise[] = {" ", "  ", "\t", "\n", "\r\n", "\n\n", ""};
+    std::string space = noise[pick(sizeof(noise) / sizeof(*noise))];
+    size_t where = pieces.empty() ? 0 : pick(pieces.size() + 1);
+    if (where < pieces.size() && pieces[where].is_space)
+      pieces[where].text = space;
+    else
+      pieces.insert(pieces.begin() + where, Piece{space, true});
+  }
+};
+
+} // namespace
+
+extern "C" size_t LLVMFuzzerCustomMutator(uint8_t *data, size_t size,
+                                          size_t max_size, unsigned int seed) {
+  Mutator mutator(seed);
+  // Leave some of the mutations to libFuzzer, including the ones of the
+  // testcase index.
+  if (size <= 4 || seed % 8 == 0)
+    return LLVMFuzzerMutate(data, size, max_size);
+
+  std::string text((const char *)data + 4, size - 4);
+  if (!mutator.mutate(text) || text.size() + 4 > max_size)
+    return LLVMFuzzerMutate(data, size, max_size);
+  memcpy(data + 4, text.data(), text.size());
+  return text.size() + 4;
+}
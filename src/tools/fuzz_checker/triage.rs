@@ -0,0 +1,311 @@
+//! Deduplication and minimization of the failures found by the fuzzer.
+//!
+//! Every failure is run again through the fuzzer binary, and the failures are grouped by a
+//! signature extracted from the report printed by the sanitizers: the failed assertion, or the
+//! kind of error and the top frames of the stack trace. Only one failure per group is kept and
+//! minimized.
+
+use std::collections::BTreeMap;
+use std::path::{Path, PathBuf};
+use std::process::{Command, Stdio};
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::sync::Mutex;
+
+use anyhow::{anyhow, Context, Error};
+use regex::Regex;
+
+/// Number of stack frames of the program that identify a failure.
+const SIGNATURE_FRAMES: usize = 3;
+
+/// A group of failures with the same cause.
+#[derive(Debug)]
+pub(super) struct FailureBucket {
+    /// What identifies the cause of the failures.
+    pub signature: String,
+    /// The kind of failure, from the artifact name (crash, timeout, leak, ...).
+    pub fail_type: String,
+    /// The failure chosen to represent the group, the smallest one.
+    pub representative: PathBuf,
+    /// The minimized version of the representative, if the minimization succeeded.
+    pub minimized: Option<PathBuf>,
+    /// What the fuzzer printed while running the representative.
+    pub report: String,
+    /// The other failures of the group.
+    pub duplicates: Vec<PathBuf>,
+}
+
+/// How to run the fuzzer binary on the failures.
+pub(super) struct Reproducer<'a> {
+    /// Path to the fuzzer binary.
+    pub fuzzer: &'a Path,
+    /// Arguments to pass to the fuzzer, in addition to the file to run.
+    pub args: Vec<String>,
+    /// Number of fuzzer processes to run in parallel.
+    pub jobs: usize,
+}
+
+impl Reproducer<'_> {
+    /// Run the fuzzer on a single failure, returning its report.
+    fn run(&self, artifact: &Path, extra_args: &[String]) -> Result<String, Error> {
+        let mut command = Command::new(self.fuzzer);
+        command
+            .args(&self.args)
+            .args(extra_args)
+            .arg(artifact)
+            .stdin(Stdio::null())
+            .stdout(Stdio::null())
+            .stderr(Stdio::piped());
+        let output = command
+            .output()
+            .with_context(|| anyhow!("Failed to run the fuzzer with {command:?}"))?;
+        Ok(String::from_utf8_lossy(&output.stderr).into_owned())
+    }
+
+    /// Run the failures again and group them by their signature.
+    pub(super) fn deduplicate(&self, artifacts: &[PathBuf]) -> Result<Vec<FailureBucket>, Error> {
+        let reports = parallel_map(artifacts, self.jobs, |artifact| self.run(artifact, &[]));
+        let mut buckets: BTreeMap<String, Vec<(u64, PathBuf, String, String)>> = BTreeMap::new();
+        for (artifact, report) in artifacts.iter().zip(reports) {
+            let report = report?;
+            let fail_type = artifact_fail_type(artifact)?;
+            let signature = failure_signature(&fail_type, &report);
+            let size = std::fs::metadata(artifact)
+                .with_context(|| anyhow!("Failed to stat failure at {}", artifact.display()))?
+                .len();
+            buckets
+                .entry(signature)
+                .or_default()
+                .push((size, artifact.clone(), fail_type, report));
+        }
+        Ok(buckets
+            .into_iter()
+            .map(|(signature, mut failures)| {
+                failures.sort();
+                let mut failures = failures.into_iter();
+                let (_, representative, fail_type, report) = failures.next().unwrap();
+                FailureBucket {
+                    signature,
+                    fail_type,
+                    representative,
+                    minimized: None,
+                    report,
+                    duplicates: failures.map(|(_, path, _, _)| path).collect(),
+                }
+            })
+            .collect())
+    }
+
+    /// Minimize the representative of each group, keeping the result only if it still fails for
+    /// the same cause. The minimized files are written inside `target_dir`.
+    pub(super) fn minimize(
+        &self,
+        buckets: &mut [FailureBucket],
+        target_dir: &Path,
+        max_time: usize,
+    ) -> Result<(), Error> {
+        if target_dir.exists() {
+            std::fs::remove_dir_all(target_dir).with_context(|| {
+                anyhow!("Failed to remove minimized dir at {}", target_dir.display())
+            })?;
+        }
+        std::fs::create_dir_all(target_dir).with_context(|| {
+            anyhow!("Failed to create minimized dir at {}", target_dir.display())
+        })?;
+
+        let minimized = parallel_map(buckets, self.jobs, |bucket| -> Result<_, Error> {
+            // Minimizing a timeout would take the timeout for every attempt.
+            if bucket.fail_type != "crash" && bucket.fail_type != "leak" {
+                return Ok(None);
+            }
+            let name = bucket.representative.file_name().unwrap();
+            let path = target_dir.join(name);
+            self.run(
+                &bucket.representative,
+                &[
+                    "-minimize_crash=1".into(),
+                    format!("-max_total_time={max_time}"),
+                    format!("-exact_artifact_path={}", path.display()),
+                ],
+            )?;
+            if !path.exists() {
+                return Ok(None);
+            }
+            let report = self.run(&path, &[])?;
+            if failure_signature(&bucket.fail_type, &report) != bucket.signature {
+                debug!(
+                    "The minimized version of {} fails for a different cause, ignoring it",
+                    bucket.representative.display()
+                );
+                return Ok(None);
+            }
+            Ok(Some((path, report)))
+        });
+        for (bucket, minimized) in buckets.iter_mut().zip(minimized) {
+            if let Some((path, report)) = minimized? {
+                bucket.minimized = Some(path);
+                bucket.report = report;
+            }
+        }
+        Ok(())
+    }
+}
+
+/// Obtain the failure type from the artifact file name (crash-... timeout-... ecc).
+pub(super) fn artifact_fail_type(artifact: &Path) -> Result<String, Error> {
+    artifact
+        .file_name()
+        .and_then(|name| name.to_str())
+        .and_then(|name| name.split('-').next())
+        .map(String::from)
+        .ok_or_else(|| anyhow!("Invalid artifact name {}", artifact.display()))
+}
+
+/// Extract from the report of the fuzzer what identifies the cause of a failure.
+fn failure_signature(fail_type: &str, report: &str) -> String {
+    lazy_static! {
+        static ref FRAME: Regex =
+            Regex::new(r"^\s*#\d+ 0x[0-9a-f]+ in (.+) (\S+?):(\d+)(?::\d+)?$").unwrap();
+        static ref RUNTIME_ERROR: Regex =
+            Regex::new(r"(\S+?:\d+):\d+: runtime error: (.*)$").unwrap();
+    }
+
+    // Failed assertions already tell where the failure happened.
+    if let Some(line) = report.lines().find(|line| line.contains("Assertion `")) {
+        let assertion = line.split_once(": ").map_or(line, |(_, rest)| rest);
+        return format!("{fail_type}: {assertion}");
+    }
+
+    let mut parts = vec![fail_type.to_string()];
+    if let Some(line) = report.lines().find(|line| line.starts_with("SUMMARY: ")) {
+        // e.g. "SUMMARY: AddressSanitizer: heap-buffer-overflow /path/checker.cpp:12:5 in main"
+        let kind = line.split_whitespace().skip(1).take(2).collect::<Vec<_>>();
+        parts.push(kind.join(" "));
+    }
+    if let Some(captures) = report.lines().find_map(|line| RUNTIME_ERROR.captures(line)) {
+        parts.push(format!("{}: {}", &captures[1], &captures[2]));
+    }
+
+    // Only the first stack trace identifies the failure, the others are about where the memory
+    // was allocated or freed.
+    let mut frames = vec![];
+    let mut in_stack = false;
+    for line in report.lines() {
+        match FRAME.captures(line) {
+            Some(captures) => {
+                in_stack = true;
+                let function = &captures[1];
+                let file = &captures[2];
+                if is_runtime_frame(function, file) {
+                    continue;
+                }
+                let file_name = Path::new(file)
+                    .file_name()
+                    .map_or(file.into(), |name| name.to_string_lossy());
+                frames.push(format!("{function} at {file_name}:{}", &captures[3]));
+                if frames.len() == SIGNATURE_FRAMES {
+                    break;
+                }
+            }
+            None if in_stack => break,
+            None => {}
+        }
+    }
+    if !frames.is_empty() {
+        parts.push(frames.join(" <- "));
+    }
+    if parts.len() == 1 {
+        parts.push("no sanitizer report".into());
+    }
+    parts.join(" | ")
+}
+
+/// Whether a stack frame belongs to the sanitizers, to the fuzzer or to the system libraries, so it
+/// doesn't tell anything about the failure.
+fn is_runtime_frame(function: &str, file: &str) -> bool {
+    function.starts_with("__")
+        || function.starts_with("fuzzer::")
+        || function.starts_with("LLVMFuzzer")
+        || file.contains("compiler-rt")
+        || file.starts_with("/usr/")
+}
+
+/// Apply `f` to all the items using `jobs` threads, returning the results in the same order.
+fn parallel_map<T, R, F>(items: &[T], jobs: usize, f: F) -> Vec<R>
+where
+    T: Sync,
+    R: Send,
+    F: Fn(&T) -> R + Sync,
+{
+    let next = AtomicUsize::new(0);
+    let results = Mutex::new(Vec::with_capacity(items.len()));
+    std::thread::scope(|scope| {
+        for _ in 0..jobs.clamp(1, items.len().max(1)) {
+            scope.spawn(|| loop {
+                let index = next.fetch_add(1, Ordering::Relaxed);
+                if index >= items.len() {
+                    break;
+                }
+                let result = f(&items[index]);
+                results.lock().unwrap().push((index, result));
+            });
+        }
+    });
+    let mut results = results.into_inner().unwrap();
+    results.sort_by_key(|(index, _)| *index);
+    results.into_iter().map(|(_, result)| result).collect()
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    const ASAN_REPORT: &str = "==12==ERROR: AddressSanitizer: heap-buffer-overflow on address 0x1
+READ of size 4 at 0x602000000014 thread T0
+    #0 0x55d1 in read_output(int) /task/fuzz/fuzzer/checker.cpp:27:12
+    #1 0x55d2 in main_checker(int, char**) /task/fuzz/fuzzer/checker.cpp:40:3
+    #2 0x55d3 in LLVMFuzzerTestOneInput /task/fuzz/fuzzer/fuzzer.cpp:200:11
+    #3 0x55d4 in fuzzer::Fuzzer::ExecuteCallback(unsigned char const*, unsigned long) (/task/fuzz/fuzzer/fuzzer+0x1)
+
+0x602000000014 is located 0 bytes after 4-byte region
+allocated by thread T0 here:
+    #0 0x55e1 in operator new(unsigned long) /src/compiler-rt/lib/asan/asan_new_delete.cpp:95:3
+    #1 0x55e2 in main_checker(int, char**) /task/fuzz/fuzzer/checker.cpp:35:3
+
+SUMMARY: AddressSanitizer: heap-buffer-overflow /task/fuzz/fuzzer/checker.cpp:27:12 in read_output(int)
+";
+
+    #[test]
+    fn test_failure_signature_asan() {
+        assert_eq!(
+            failure_signature("crash", ASAN_REPORT),
+            "crash | AddressSanitizer: heap-buffer-overflow | read_output(int) at checker.cpp:27 \
+             <- main_checker(int, char**) at checker.cpp:40"
+        );
+    }
+
+    #[test]
+    fn test_failure_signature_assertion() {
+        let report = "fuzzer: /task/fuzz/fuzzer/fuzzer.cpp:120: int LLVMFuzzerTestOneInput(const uint8_t *, size_t): Assertion `score <= 1' failed.\n==1== ERROR: libFuzzer: deadly signal\n";
+        assert_eq!(
+            failure_signature("crash", report),
+            "crash: /task/fuzz/fuzzer/fuzzer.cpp:120: int LLVMFuzzerTestOneInput(const uint8_t *, \
+             size_t): Assertion `score <= 1' failed."
+        );
+    }
+
+    #[test]
+    fn test_failure_signature_different_addresses() {
+        let other = ASAN_REPORT
+            .replace("0x55d", "0x77a")
+            .replace("0x6020", "0x6030");
+        assert_eq!(
+            failure_signature("crash", ASAN_REPORT),
+            failure_signature("crash", &other)
+        );
+        let other = ASAN_REPORT.replace("checker.cpp:27:12", "checker.cpp:28:12");
+        assert_ne!(
+            failure_signature("crash", ASAN_REPORT),
+            failure_signature("crash", &other)
+        );
+    }
+}
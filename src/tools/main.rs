@@ -4,7 +4,10 @@ use std::path::PathBuf;
 use clap::Parser;
 use task_maker_rust::error::NiceError;
 use task_maker_rust::tools::add_solution_checks::main_add_solution_checks;
+use task_maker_rust::tools::bench_scheduler::main_bench_scheduler;
+use task_maker_rust::tools::bench_tasks::main_bench_tasks;
 use task_maker_rust::tools::booklet::main_booklet;
+use task_maker_rust::tools::cache::main_cache;
 use task_maker_rust::tools::clear::main_clear;
 use task_maker_rust::tools::copy_competition_files::copy_competition_files_main;
 use task_maker_rust::tools::eval_server::main_eval_server;
@@ -58,6 +61,9 @@ fn main() {
         Tool::ExportBooklet(opt) => main_export_booklet(opt),
         Tool::EvalServer(opt) => main_eval_server(opt),
         Tool::TaskController(opt) => main_task_controller(opt),
+        Tool::BenchScheduler(opt) => main_bench_scheduler(opt),
+        Tool::BenchTasks(opt) => main_bench_tasks(opt),
+        Tool::Cache(opt) => main_cache(opt),
     }
     .nice_unwrap()
 }
@@ -1,5 +1,9 @@
 pub mod add_solution_checks;
+pub mod autoscale;
+pub mod bench_scheduler;
+pub mod bench_tasks;
 pub mod booklet;
+pub mod cache;
 pub mod clear;
 pub mod copy_competition_files;
 pub mod eval_server;
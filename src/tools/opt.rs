@@ -1,7 +1,10 @@
 use clap::Parser;
 
 use crate::tools::add_solution_checks::AddSolutionChecksOpt;
+use crate::tools::bench_scheduler::BenchSchedulerOpt;
+use crate::tools::bench_tasks::BenchTasksOpt;
 use crate::tools::booklet::BookletOpt;
+use crate::tools::cache::CacheOpt;
 use crate::tools::clear::ClearOpt;
 use crate::tools::copy_competition_files::CopyCompetitionFilesOpt;
 use crate::tools::eval_server::EvalServerOpt;
@@ -54,7 +57,7 @@ pub enum Tool {
     CopyCompetitionFiles(CopyCompetitionFilesOpt),
     /// Build terry statements by adding the subtask table
     TerryStatement(TerryStatementOpt),
-    /// Fuzz the checker of a task.
+    /// Fuzz the checker, the manager or the controller of a task.
     FuzzChecker(FuzzCheckerOpt),
     /// Generate and search for an input file that make a solution fail.
     FindBadCase(FindBadCaseOpt),
@@ -68,4 +71,10 @@ pub enum Tool {
     EvalServer(EvalServerOpt),
     /// Run a solution with an interactor.
     TaskController(TaskControllerOpt),
+    /// Measure the overhead of the scheduler on a large synthetic DAG.
+    BenchScheduler(BenchSchedulerOpt),
+    /// Measure the evaluation of whole tasks, with an empty and with a warm cache.
+    BenchTasks(BenchTasksOpt),
+    /// Export or import the cached executions of a task, for warming up new machines.
+    Cache(CacheOpt),
 }
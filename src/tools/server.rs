@@ -1,11 +1,12 @@
 use std::sync::Arc;
 
-use anyhow::{Context, Error};
+use anyhow::{bail, Context, Error};
 use clap::Parser;
-use task_maker_cache::Cache;
+use task_maker_cache::{Cache, RemoteCache};
 use task_maker_exec::executors::RemoteExecutor;
 use task_maker_store::FileStore;
 
+use crate::tools::autoscale::{start_autoscaling, AutoscaleOpt};
 use crate::StorageOpt;
 
 #[derive(Parser, Debug, Clone)]
@@ -26,25 +27,67 @@ pub struct ServerOpt {
     #[clap(long = "worker-password")]
     pub worker_password: Option<String>,
 
+    /// Maximum number of jobs of the same client running at the same time
+    ///
+    /// By default a client can use all the workers that the other clients don't need.
+    #[clap(long)]
+    pub max_jobs_per_client: Option<usize>,
+
+    /// Maximum share of the workers a client can ask for with --fair-share
+    ///
+    /// The clients asking for a bigger share get this one, so that a client cannot take the
+    /// workers away from the others just by asking.
+    #[clap(long, default_value = "1")]
+    pub max_fair_share: f64,
+
+    /// Don't start a copy of the jobs stuck on a slow worker
+    ///
+    /// By default the jobs, except the evaluations of the solutions, running for much longer than
+    /// expected are also started on an idle worker, and the first result is used.
+    #[clap(long)]
+    pub no_speculative_execution: bool,
+
     #[clap(flatten, next_help_heading = Some("STORAGE"))]
     pub storage: StorageOpt,
+
+    #[clap(flatten, next_help_heading = Some("AUTOSCALING"))]
+    pub autoscale: AutoscaleOpt,
 }
 
 /// Entry point for the server.
 pub fn main_server(opt: ServerOpt) -> Result<(), Error> {
+    if !(opt.max_fair_share > 0.0) {
+        bail!(
+            "The maximum fair share ({}) must be positive!",
+            opt.max_fair_share
+        );
+    }
     // setup the executor
     let store_path = opt.storage.store_dir();
-    let file_store = Arc::new(
-        FileStore::new(
-            store_path.join("store"),
-            opt.storage.max_cache * 1024 * 1024,
-            opt.storage.min_cache * 1024 * 1024,
-        )
-        .context("Cannot create the file store")?,
+    let mut file_store = FileStore::new(
+        store_path.join("store"),
+        opt.storage.max_cache * 1024 * 1024,
+        opt.storage.min_cache * 1024 * 1024,
+    )
+    .context("Cannot create the file store")?;
+    file_store.set_compress_cold_files(opt.storage.compress_store);
+    let file_store = Arc::new(file_store);
+    let mut cache = Cache::new(store_path.join("cache")).context("Cannot create the cache")?;
+    cache.set_size_limits(
+        opt.storage.max_execution_cache * 1024 * 1024,
+        opt.storage.min_execution_cache * 1024 * 1024,
     );
-    let cache = Cache::new(store_path.join("cache")).context("Cannot create the cache")?;
+    if let Some(url) = &opt.storage.remote_cache {
+        cache.set_remote(RemoteCache::new(url).context("Cannot use the remote cache")?);
+    }
 
-    let remote_executor = RemoteExecutor::new(file_store);
+    let mut remote_executor = RemoteExecutor::new(file_store);
+    remote_executor.set_max_jobs_per_client(opt.max_jobs_per_client);
+    remote_executor.set_max_fair_share(opt.max_fair_share);
+    remote_executor.set_speculative_execution(!opt.no_speculative_execution);
+    if let Some(metrics) = start_autoscaling(&opt.autoscale)? {
+        remote_executor.set_metrics_sender(metrics);
+    }
 
     remote_executor.start(
         &opt.client_addr,
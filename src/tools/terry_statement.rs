@@ -48,6 +48,10 @@ pub fn main_terry_statement(opt: TerryStatementOpt, _logger_opt: LoggerOpt) -> R
         disabled_sanity_checks: vec![],
         seed: None,
         dry_run: false,
+        skip_failed_subtasks: false,
+        incremental: false,
+        terry_fused: false,
+        profile: vec![],
     };
 
     let (statement_path, subtasks_path, output_path) =
@@ -1,12 +1,16 @@
+use std::path::PathBuf;
 use std::sync::Arc;
+use std::time::Duration;
 
 use anyhow::{bail, Context, Error};
 use clap::Parser;
+use task_maker_exec::cgroup::CgroupRoot;
 use task_maker_exec::executors::{RemoteEntityMessage, RemoteEntityMessageResponse};
-use task_maker_exec::Worker;
+use task_maker_exec::proto::FileEncoding;
+use task_maker_exec::{calibrate, derive_key_from_password, TimeNormalization, Worker};
 use task_maker_store::FileStore;
 
-use crate::remote::connect_to_remote_server;
+use crate::remote::{connect_to_remote_server, server_password};
 use crate::sandbox::ToolsSandboxRunner;
 use crate::StorageOpt;
 
@@ -22,6 +26,71 @@ pub struct WorkerOpt {
     #[clap(long)]
     pub name: Option<String>,
 
+    /// Number of jobs to ask the server for at the same time.
+    ///
+    /// The jobs after the first one wait for the current one to complete, but their files are
+    /// downloaded from the server in the meantime.
+    #[clap(long, default_value = "1")]
+    pub job_slots: usize,
+
+    /// Write a timeline of the jobs run by the worker to this file, in the Chrome trace-event
+    /// format
+    ///
+    /// The file is written when the worker exits.
+    #[clap(long)]
+    pub trace_file: Option<PathBuf>,
+
+    /// Put the sandboxes inside this directory, that should be on a tmpfs
+    ///
+    /// Only the sandboxes whose inputs and expected outputs (the file size limit, up to 64 MiB for
+    /// each output) fit in --sandbox-tmpfs-size go there, the other ones stay on disk. An
+    /// execution that fails after writing more than that is run again on disk.
+    #[clap(long)]
+    pub sandbox_tmpfs: Option<PathBuf>,
+
+    /// Space of the tmpfs (in MiB) the sandboxes can use
+    #[clap(long, default_value = "1024")]
+    pub sandbox_tmpfs_size: u64,
+
+    /// Send the output files bigger than this size (in MiB) while the execution is still running
+    ///
+    /// The executions that depend on big outputs, like the ones of the generators, can start as
+    /// soon as the execution ends, without waiting for the whole transfer.
+    #[clap(long)]
+    pub stream_outputs: Option<u64>,
+
+    /// Serve the files of this worker to the other workers, listening at this address
+    ///
+    /// For example 0.0.0.0:27184. The server tells the other workers to fetch the files this
+    /// worker has from it, instead of sending them itself. The connections are encrypted with the
+    /// password of the server address, if any.
+    #[clap(long)]
+    pub serve_files: Option<String>,
+
+    /// Normalize the times of the executions to the ones of a reference machine, on which the
+    /// calibration takes this many milliseconds
+    ///
+    /// The worker runs a CPU-bound calibration when it starts, and logs how long it took. With this
+    /// option the times measured by the worker are scaled by its speed relative to the reference
+    /// machine, so that the workers with different CPUs give comparable verdicts.
+    #[clap(long)]
+    pub calibration_reference: Option<f64>,
+
+    /// Also scale the time limits of the executions by the speed of the worker
+    ///
+    /// Without this, a worker slower than the reference kills the processes at the original time
+    /// limit, before their normalized time reaches it. Requires --calibration-reference.
+    #[clap(long, requires = "calibration_reference")]
+    pub normalize_limits: bool,
+
+    /// Run each sandbox in its own cgroup inside this cgroup v2 directory
+    ///
+    /// The memory is then measured and limited on all the processes of the execution together.
+    /// The directory must be writable, have the memory controller available and no processes, and
+    /// the worker must run in another cgroup inside it.
+    #[clap(long)]
+    pub cgroup_root: Option<PathBuf>,
+
     #[clap(flatten, next_help_heading = Some("STORAGE"))]
     pub storage: StorageOpt,
 }
@@ -32,14 +101,14 @@ const VERSION: &str = env!("CARGO_PKG_VERSION");
 /// Entry point for the worker.
 pub fn main_worker(opt: WorkerOpt) -> Result<(), Error> {
     let store_path = opt.storage.store_dir();
-    let file_store = Arc::new(
-        FileStore::new(
-            store_path.join("store"),
-            opt.storage.max_cache * 1024 * 1024,
-            opt.storage.min_cache * 1024 * 1024,
-        )
-        .context("Cannot create the file store")?,
-    );
+    let mut file_store = FileStore::new(
+        store_path.join("store"),
+        opt.storage.max_cache * 1024 * 1024,
+        opt.storage.min_cache * 1024 * 1024,
+    )
+    .context("Cannot create the file store")?;
+    file_store.set_compress_cold_files(opt.storage.compress_store);
+    let file_store = Arc::new(file_store);
     let sandbox_path = store_path.join("sandboxes");
 
     let name = opt.name.unwrap_or_else(|| {
@@ -57,12 +126,21 @@ pub fn main_worker(opt: WorkerOpt) -> Result<(), Error> {
             version: VERSION.into(),
         })
         .context("Cannot send welcome to the server")?;
-    if let RemoteEntityMessageResponse::Rejected(err) = executor_rx
+    executor_tx
+        .send(RemoteEntityMessage::FileEncodings(vec![
+            FileEncoding::Zstd,
+            FileEncoding::Plain,
+        ]))
+        .context("Cannot send the file encodings to the server")?;
+    let file_encoding = match executor_rx
         .recv()
         .context("Remote executor didn't reply to the welcome message")?
     {
-        bail!("The server rejected the worker connection: {}", err);
-    }
+        RemoteEntityMessageResponse::Accepted(file_encoding) => file_encoding,
+        RemoteEntityMessageResponse::Rejected(err) => {
+            bail!("The server rejected the worker connection: {}", err)
+        }
+    };
 
     let name = if let Some(wid) = opt.worker_id {
         format!("{name} {wid}")
@@ -70,14 +148,63 @@ pub fn main_worker(opt: WorkerOpt) -> Result<(), Error> {
         name
     };
 
-    let worker = Worker::new_with_channel(
+    let mut sandbox_runner = ToolsSandboxRunner::default();
+    if let Some(cgroup_root) = &opt.cgroup_root {
+        let cgroup_root = CgroupRoot::new(cgroup_root).context("Invalid cgroup root")?;
+        sandbox_runner = sandbox_runner.with_cgroup_root(cgroup_root);
+    }
+    let mut worker = Worker::new_with_channel(
         name,
         file_store,
         sandbox_path,
         executor_tx.change_type(),
         executor_rx.change_type(),
-        Arc::new(ToolsSandboxRunner::default()),
+        Arc::new(sandbox_runner),
     )
     .context("Failed to start worker")?;
-    worker.work()
+    worker.set_job_slots(opt.job_slots);
+    worker.set_file_encoding(file_encoding);
+    // the other workers use the same password of the server
+    worker.set_peer_key(server_password(&opt.server_addr)?.map(derive_key_from_password));
+    if let Some(bind_addr) = &opt.serve_files {
+        worker
+            .serve_files(bind_addr.clone())
+            .context("Failed to serve the files to the other workers")?;
+    }
+    if let Some(tmpfs) = &opt.sandbox_tmpfs {
+        worker
+            .set_sandbox_tmpfs(tmpfs, opt.sandbox_tmpfs_size * 1024 * 1024)
+            .context("Failed to put the sandboxes on tmpfs")?;
+    }
+    if let Some(threshold) = opt.stream_outputs {
+        worker.set_stream_outputs(threshold * 1024 * 1024);
+    }
+    let calibration = calibrate();
+    info!(
+        "Calibration took {:.1}ms",
+        calibration.as_secs_f64() * 1000.0
+    );
+    if let Some(reference) = opt.calibration_reference {
+        if !(reference > 0.0) {
+            bail!("The calibration reference ({reference}) must be positive");
+        }
+        let normalization = TimeNormalization::new(
+            calibration,
+            Duration::from_secs_f64(reference / 1000.0),
+            opt.normalize_limits,
+        );
+        info!(
+            "The worker is {:.2} times as fast as the reference",
+            normalization.speed
+        );
+        worker.set_time_normalization(normalization);
+    }
+    if opt.trace_file.is_some() {
+        task_maker_exec::trace::enable();
+    }
+    worker.work()?;
+    if let Some(trace_file) = &opt.trace_file {
+        task_maker_exec::trace::write(trace_file).context("Failed to write the trace file")?;
+    }
+    Ok(())
 }
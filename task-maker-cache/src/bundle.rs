@@ -0,0 +1,281 @@
+//! Bundles of cache entries, together with the files they reference, for moving the cache of a
+//! task to another machine.
+//!
+//! A bundle is a tar archive with an `entries.bin` file, with the cache entries serialized with
+//! bincode after a magic string, followed by the output files of the entries as `files/<key>`.
+
+use std::collections::HashMap;
+use std::ffi::OsStr;
+use std::fs::File;
+use std::io::{BufReader, BufWriter, Read};
+use std::path::{Path, PathBuf};
+
+use anyhow::{bail, Context, Error};
+use const_format::formatcp;
+use task_maker_store::{FileStore, FileStoreHandle, FileStoreKey};
+
+use crate::entry::CacheEntry;
+use crate::key::CacheKey;
+
+/// Magic string at the beginning of the entries of a bundle, to avoid importing the entries of
+/// another version of task-maker.
+///
+/// The newline at the end of the string is required. For example, let's say there are 2 versions:
+/// v0.1 and v0.11; running v0.11 first, and then v0.1, without the newline the magic of the old
+/// version is a prefix of the magic of the new version.
+const MAGIC: &[u8] =
+    formatcp!("task-maker-cache-bundle v{}\n", env!("CARGO_PKG_VERSION")).as_bytes();
+/// The name of the file with the entries inside the bundle.
+const ENTRIES_FILE: &str = "entries.bin";
+/// The directory with the output files inside the bundle.
+const FILES_DIR: &str = "files";
+
+/// A set of cache entries to export, with the files they reference. The files are kept in the
+/// store until the bundle is dropped.
+#[derive(Debug, Default)]
+pub struct CacheBundle {
+    /// The entries to export, for each cache key.
+    entries: HashMap<CacheKey, Vec<CacheEntry>>,
+    /// The output files of the entries.
+    files: HashMap<FileStoreKey, FileStoreHandle>,
+}
+
+/// What has been imported from a bundle.
+#[derive(Debug, Clone, Copy, Default, PartialEq, Eq)]
+pub struct BundleImport {
+    /// The number of entries in the bundle.
+    pub entries: usize,
+    /// The number of files in the bundle.
+    pub files: usize,
+    /// The number of files of the bundle that were not already in the store.
+    pub new_files: usize,
+}
+
+impl CacheBundle {
+    /// Make a new empty bundle.
+    pub fn new() -> CacheBundle {
+        Default::default()
+    }
+
+    /// The number of cache keys in the bundle.
+    pub fn num_keys(&self) -> usize {
+        self.entries.len()
+    }
+
+    /// The number of files in the bundle.
+    pub fn num_files(&self) -> usize {
+        self.files.len()
+    }
+
+    /// Add an entry of a key, with its output files.
+    pub(crate) fn add<I>(&mut self, key: CacheKey, entry: CacheEntry, files: I)
+    where
+        I: IntoIterator<Item = FileStoreHandle>,
+    {
+        let entries = self.entries.entry(key).or_default();
+        // the same execution may be exported more than once
+        match entries.iter().position(|e| e.same_limits(&entry)) {
+            Some(pos) => entries[pos] = entry,
+            None => entries.push(entry),
+        }
+        for file in files {
+            self.files.insert(file.key().clone(), file);
+        }
+    }
+
+    /// Write the bundle to the provided path.
+    pub fn write<P: AsRef<Path>>(&self, path: P) -> Result<(), Error> {
+        let path = path.as_ref();
+        let file = File::create(path)
+            .with_context(|| format!("Failed to create bundle at {}", path.display()))?;
+        let mut builder = tar::Builder::new(BufWriter::new(file));
+        let entries: Vec<_> = self.entries.iter().collect();
+        let mut data = MAGIC.to_vec();
+        bincode::serialize_into(&mut data, &entries).context("Failed to serialize the entries")?;
+        let mut header = tar::Header::new_gnu();
+        header.set_size(data.len() as u64);
+        header.set_mode(0o644);
+        header.set_cksum();
+        builder
+            .append_data(&mut header, ENTRIES_FILE, data.as_slice())
+            .context("Failed to write the entries to the bundle")?;
+        for (key, handle) in &self.files {
+            builder
+                .append_path_with_name(handle.path(), Path::new(FILES_DIR).join(key.to_string()))
+                .with_context(|| {
+                    format!("Failed to add {} to the bundle", handle.path().display())
+                })?;
+        }
+        builder
+            .into_inner()
+            .context("Failed to write the bundle")?
+            .into_inner()
+            .context("Failed to write the bundle")?;
+        Ok(())
+    }
+}
+
+/// Read a bundle, storing its files in the store if they are not already there, and returning its
+/// entries.
+pub(crate) fn read_bundle(
+    path: &Path,
+    file_store: &FileStore,
+) -> Result<(Vec<(CacheKey, Vec<CacheEntry>)>, BundleImport), Error> {
+    let file =
+        File::open(path).with_context(|| format!("Failed to open bundle {}", path.display()))?;
+    let mut archive = tar::Archive::new(BufReader::new(file));
+    let tmpdir = tempfile::TempDir::new().context("Failed to create temporary directory")?;
+    let mut entries = None;
+    let mut import = BundleImport::default();
+    for item in archive.entries().context("Failed to read the bundle")? {
+        let mut item = item.context("Failed to read the bundle")?;
+        let name: PathBuf = item.path().context("Invalid file in the bundle")?.into();
+        if name == Path::new(ENTRIES_FILE) {
+            let mut data = Vec::new();
+            item.read_to_end(&mut data)
+                .context("Failed to read the entries of the bundle")?;
+            if !data.starts_with(MAGIC) {
+                bail!("The bundle was made by another version of task-maker");
+            }
+            let bundle_entries: Vec<(CacheKey, Vec<CacheEntry>)> =
+                bincode::deserialize(&data[MAGIC.len()..])
+                    .context("Failed to deserialize the entries of the bundle")?;
+            import.entries = bundle_entries.iter().map(|(_, e)| e.len()).sum();
+            entries = Some(bundle_entries);
+        } else if name.starts_with(FILES_DIR) {
+            let tmpfile = tmpdir.path().join("file");
+            let mut output = File::create(&tmpfile).context("Failed to create temporary file")?;
+            std::io::copy(&mut item, &mut output)
+                .with_context(|| format!("Failed to extract {}", name.display()))?;
+            drop(output);
+            // the files are content-addressed, check that they are not corrupted
+            let key = FileStoreKey::from_file(&tmpfile)?;
+            if name.file_name() != Some(OsStr::new(&key.to_string())) {
+                bail!("Corrupted file in the bundle: {}", name.display());
+            }
+            import.files += 1;
+            if file_store.get(&key).is_none() {
+                file_store.store_file(&key, &tmpfile)?;
+                import.new_files += 1;
+            }
+        } else {
+            warn!("Unknown file in the bundle: {}", name.display());
+        }
+    }
+    match entries {
+        Some(entries) => Ok((entries, import)),
+        None => bail!("The bundle doesn't contain the cache entries"),
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use task_maker_dag::{
+        Execution, ExecutionCommand, ExecutionGroup, ExecutionResourcesUsage, ExecutionResult,
+        ExecutionStatus,
+    };
+
+    use crate::{Cache, CacheResult};
+
+    use super::*;
+
+    #[test]
+    fn test_export_import() {
+        let tmpdir = tempfile::TempDir::new().unwrap();
+        let output_path = tmpdir.path().join("output");
+        std::fs::write(&output_path, "output").unwrap();
+        let output_key = FileStoreKey::from_file(&output_path).unwrap();
+        let bundle_path = tmpdir.path().join("bundle.tar");
+
+        let mut exec = Execution::new("exec", ExecutionCommand::system("true"));
+        let output = exec.output("output");
+        let group: ExecutionGroup = exec.into();
+        let result = ExecutionResult {
+            status: ExecutionStatus::Success,
+            was_killed: false,
+            was_cached: false,
+            resources: ExecutionResourcesUsage {
+                cpu_time: 1.0,
+                sys_time: 0.0,
+                wall_time: 1.0,
+                memory: 0,
+                counters: None,
+            },
+            stdout: None,
+            stderr: None,
+            timing: None,
+        };
+
+        {
+            let store = FileStore::new(tmpdir.path().join("store1"), 1 << 20, 1 << 20).unwrap();
+            let mut cache = Cache::new(tmpdir.path().join("cache1")).unwrap();
+            let mut file_keys = HashMap::new();
+            let handle = store.store_file(&output_key, &output_path).unwrap();
+            file_keys.insert(output.uuid, handle);
+            cache.insert(&group, &file_keys, vec![result]);
+
+            let mut bundle = CacheBundle::new();
+            let hit = cache.export(&group, &HashMap::new(), &store, &mut bundle);
+            assert!(matches!(hit, CacheResult::Hit { .. }));
+            assert_eq!(bundle.num_keys(), 1);
+            assert_eq!(bundle.num_files(), 1);
+            bundle.write(&bundle_path).unwrap();
+        }
+
+        let store = FileStore::new(tmpdir.path().join("store2"), 1 << 20, 1 << 20).unwrap();
+        let mut cache = Cache::new(tmpdir.path().join("cache2")).unwrap();
+        let import = cache.import(&bundle_path, &store).unwrap();
+        assert_eq!(
+            import,
+            BundleImport {
+                entries: 1,
+                files: 1,
+                new_files: 1
+            }
+        );
+        match cache.get(&group, &HashMap::new(), &store) {
+            CacheResult::Miss => panic!("Expecting a hit"),
+            CacheResult::Hit { outputs, .. } => {
+                let content = std::fs::read(outputs[&output.uuid].path()).unwrap();
+                assert_eq!(content, b"output");
+            }
+        }
+        // importing again doesn't duplicate anything
+        let import = cache.import(&bundle_path, &store).unwrap();
+        assert_eq!(import.new_files, 0);
+    }
+
+    #[test]
+    fn test_export_only_hit() {
+        let tmpdir = tempfile::TempDir::new().unwrap();
+        let store = FileStore::new(tmpdir.path().join("store"), 1 << 20, 1 << 20).unwrap();
+        let mut cache = Cache::new(tmpdir.path().join("cache")).unwrap();
+        let group = |cpu_time| -> ExecutionGroup {
+            let mut exec = Execution::new("exec", ExecutionCommand::system("true"));
+            exec.limits_mut().cpu_time(cpu_time);
+            exec.into()
+        };
+        let result = ExecutionResult {
+            status: ExecutionStatus::Success,
+            was_killed: false,
+            was_cached: false,
+            resources: ExecutionResourcesUsage::default(),
+            stdout: None,
+            stderr: None,
+            timing: None,
+        };
+        // two entries of the same key, with different limits
+        cache.insert(&group(1.0), &HashMap::new(), vec![result.clone()]);
+        cache.insert(&group(2.0), &HashMap::new(), vec![result]);
+        let key = CacheKey::from_execution_group(&group(1.0), &HashMap::new());
+        assert_eq!(cache.file.get(&key).unwrap().len(), 2);
+
+        let mut bundle = CacheBundle::new();
+        let hit = cache.export(&group(1.0), &HashMap::new(), &store, &mut bundle);
+        assert!(matches!(hit, CacheResult::Hit { .. }));
+        assert_eq!(bundle.entries[&key].len(), 1);
+        // exporting it again doesn't duplicate it
+        cache.export(&group(1.0), &HashMap::new(), &store, &mut bundle);
+        assert_eq!(bundle.entries[&key].len(), 1);
+    }
+}
@@ -9,7 +9,7 @@ use task_maker_dag::{
 use task_maker_store::{FileStore, FileStoreHandle, FileStoreKey};
 
 /// The entry relative to an execution inside the group.
-#[derive(Debug, Serialize, Deserialize, PartialEq)]
+#[derive(Debug, Clone, Serialize, Deserialize, PartialEq)]
 pub struct CacheEntryItem {
     /// The result of the `Execution`.
     pub result: ExecutionResult,
@@ -29,7 +29,7 @@ pub struct CacheEntryItem {
 ///
 /// The entry is composed by a number of item, one for each execution in the group. The order of the
 /// items is the same as the order of the executions in the group.
-#[derive(Debug, Serialize, Deserialize, PartialEq)]
+#[derive(Debug, Clone, Serialize, Deserialize, PartialEq)]
 pub struct CacheEntry {
     /// The items of the entry, one for each execution in the group, in the same order.
     pub items: Vec<CacheEntryItem>,
@@ -95,6 +95,14 @@ impl CacheEntry {
         }
     }
 
+    /// The time it took to run the group: the wall time of its slowest execution.
+    pub fn wall_time(&self) -> f64 {
+        self.items
+            .iter()
+            .map(|item| item.result.resources.wall_time)
+            .fold(0.0, f64::max)
+    }
+
     pub fn same_limits(&self, other: &CacheEntry) -> bool {
         if self.items.len() != other.items.len() {
             return false;
@@ -107,6 +115,16 @@ impl CacheEntry {
         true
     }
 
+    /// The keys of all the output files of the entry, including stdout and stderr.
+    pub fn output_keys(&self) -> impl Iterator<Item = &FileStoreKey> {
+        self.items.iter().flat_map(|item| {
+            item.stdout
+                .iter()
+                .chain(item.stderr.iter())
+                .chain(item.outputs.values())
+        })
+    }
+
     /// Search in the file store the handles of all the output files. Will return `None` if at least
     /// one of them is missing.
     pub fn outputs(
@@ -274,9 +292,11 @@ mod tests {
                             sys_time: 0.0,
                             wall_time: 0.0,
                             memory: 0,
+                            counters: None,
                         },
                         stdout: None,
                         stderr: None,
+                        timing: None,
                     },
                     limits: Default::default(),
                     stdout: None,
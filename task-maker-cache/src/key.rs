@@ -8,6 +8,30 @@ use task_maker_dag::{
 };
 use task_maker_store::{FileStoreHandle, FileStoreKey};
 
+/// The part of a [`CacheKeyItem`] that doesn't depend on the content of the files.
+#[derive(Debug, Clone, PartialEq, Eq, Hash, Serialize, Deserialize)]
+struct ShapeKeyItem {
+    /// The command of the execution.
+    command: ExecutionCommand,
+    /// The list of command line arguments.
+    args: Vec<String>,
+    /// Whether the stdin comes from a file.
+    stdin: bool,
+    /// The path of the input files, and if they are executable. Sorted lexicographically.
+    inputs: Vec<(PathBuf, bool)>,
+    /// The list of environment variables to set. Sorted by the variable name.
+    env: Vec<(String, String)>,
+}
+
+/// A cache key without the content of the input files. The executions that differ only by their
+/// inputs (like a solution run on different testcases) have the same `ShapeKey`, which is known
+/// even before their inputs are produced.
+#[derive(Debug, Clone, PartialEq, Eq, Hash, Serialize, Deserialize)]
+pub struct ShapeKey {
+    /// The items of the key, one for each execution in the group.
+    items: Vec<ShapeKeyItem>,
+}
+
 /// The cache key of a single execution of a group.
 #[derive(Debug, Clone, PartialEq, Eq, Hash, Serialize, Deserialize)]
 struct CacheKeyItem {
@@ -54,32 +78,52 @@ impl CacheKeyItem {
             .sorted()
             .collect_vec();
         let env = execution.env.clone().into_iter().sorted().collect_vec();
-        let args = if let Some(group) = group {
-            let mut fifos = HashMap::new();
-            for (i, fifo) in group.fifo.iter().enumerate() {
-                let name = fifo.sandbox_path().to_string_lossy().to_string();
-                fifos.insert(name, format!("tm_fifo_{i}"));
-            }
-            let mut args = Vec::new();
-            for arg in &execution.args {
-                if let Some(name) = fifos.get(arg) {
-                    args.push(name.clone());
-                } else {
-                    args.push(arg.clone());
-                }
-            }
-            args
-        } else {
-            execution.args.clone()
-        };
         CacheKeyItem {
             command: execution.command.clone(),
-            args,
+            args: key_args(execution, group),
             stdin,
             inputs,
             env,
         }
     }
+
+    /// The part of this key that doesn't depend on the content of the files.
+    fn shape(&self) -> ShapeKeyItem {
+        ShapeKeyItem {
+            command: self.command.clone(),
+            args: self.args.clone(),
+            stdin: self.stdin.is_some(),
+            inputs: self
+                .inputs
+                .iter()
+                .map(|(path, _, executable)| (path.clone(), *executable))
+                .collect(),
+            env: self.env.clone(),
+        }
+    }
+}
+
+/// The arguments of an execution, with the paths of the FIFOs of the group replaced by names that
+/// don't depend on the group.
+fn key_args(execution: &Execution, group: Option<&ExecutionGroup>) -> Vec<String> {
+    if let Some(group) = group {
+        let mut fifos = HashMap::new();
+        for (i, fifo) in group.fifo.iter().enumerate() {
+            let name = fifo.sandbox_path().to_string_lossy().to_string();
+            fifos.insert(name, format!("tm_fifo_{i}"));
+        }
+        let mut args = Vec::new();
+        for arg in &execution.args {
+            if let Some(name) = fifos.get(arg) {
+                args.push(name.clone());
+            } else {
+                args.push(arg.clone());
+            }
+        }
+        args
+    } else {
+        execution.args.clone()
+    }
 }
 
 impl CacheKey {
@@ -97,6 +141,37 @@ impl CacheKey {
                 .collect(),
         }
     }
+
+    /// The part of this key that doesn't depend on the content of the files.
+    pub fn shape(&self) -> ShapeKey {
+        ShapeKey {
+            items: self.items.iter().map(CacheKeyItem::shape).collect(),
+        }
+    }
+}
+
+impl ShapeKey {
+    /// Make a new `ShapeKey` based on an `ExecutionGroup`, without knowing its input files.
+    pub fn from_execution_group(group: &ExecutionGroup) -> ShapeKey {
+        ShapeKey {
+            items: group
+                .executions
+                .iter()
+                .map(|execution| ShapeKeyItem {
+                    command: execution.command.clone(),
+                    args: key_args(execution, Some(group)),
+                    stdin: matches!(execution.stdin, ExecutionInputBehaviour::File(_)),
+                    inputs: execution
+                        .input_files
+                        .iter()
+                        .map(|(path, input)| (path.clone(), input.executable))
+                        .sorted()
+                        .collect(),
+                    env: execution.env.clone().into_iter().sorted().collect(),
+                })
+                .collect(),
+        }
+    }
 }
 
 #[cfg(test)]
@@ -303,4 +378,31 @@ mod tests {
         let key2 = CacheKey::from_execution_group(&group2, &HashMap::new());
         assert_eq!(key1, key2);
     }
+
+    #[test]
+    fn test_shape() {
+        let tmpdir = tempfile::TempDir::new().unwrap();
+        let store = FileStore::new(tmpdir.path(), 1000, 1000).unwrap();
+        let handle1 = fake_file(tmpdir.path().join("file1"), "foo", &store);
+        let handle2 = fake_file(tmpdir.path().join("file2"), "bar", &store);
+        let file = task_maker_dag::File::new("file");
+        let make_group = |arg: &str| {
+            let mut exec = Execution::new("exec", ExecutionCommand::local("foo"));
+            exec.args(vec![arg]);
+            exec.stdin(file.uuid);
+            exec.input(file.uuid, "input.txt", false);
+            ExecutionGroup::from(exec)
+        };
+        let group1 = make_group("bar");
+        let group2 = make_group("baz");
+        let map1: HashMap<_, _> = [(file.uuid, handle1)].into_iter().collect();
+        let map2: HashMap<_, _> = [(file.uuid, handle2)].into_iter().collect();
+
+        let key1 = CacheKey::from_execution_group(&group1, &map1);
+        let key2 = CacheKey::from_execution_group(&group1, &map2);
+        assert_ne!(key1, key2);
+        assert_eq!(key1.shape(), key2.shape());
+        assert_eq!(key1.shape(), ShapeKey::from_execution_group(&group1));
+        assert_ne!(key1.shape(), ShapeKey::from_execution_group(&group2));
+    }
 }
@@ -1,9 +1,9 @@
 //! Crate for managing the cache of the executions of a DAG.
 //!
-//! It provides the `Cache` struct which holds the cache data and stores it on disk on Drop. The
-//! executions are cached computing a cache key based on the execution command, arguments and
-//! inputs. For each cache key there may be more than one cache entry, allowing different execution
-//! limits to be used.
+//! It provides the `Cache` struct which reads the cache data lazily from disk and stores the changed
+//! entries on Drop. The executions are cached computing a cache key based on the execution command,
+//! arguments and inputs. For each cache key there may be more than one cache entry, allowing
+//! different execution limits to be used.
 //!
 //! The algorithm for extending a cache entry for a different limit is the following:
 //! - call `E1` the cached execution's result and `L1` its limits
@@ -47,12 +47,14 @@
 //!         cpu_time: 1.123,
 //!         sys_time: 0.2,
 //!         wall_time: 1.5,
-//!         memory: 12345
+//!         memory: 12345,
+//!         counters: None,
 //!     },
 //!     was_killed: false,
 //!     was_cached: false,
 //!     stderr: None,
 //!     stdout: None,
+//!     timing: None,
 //! };
 //!
 //! // make the FileUuid -> FileStoreHandle map
@@ -80,20 +82,26 @@
 #[macro_use]
 extern crate log;
 
+mod bundle;
 mod entry;
 mod key;
+mod remote;
 mod storage;
-use std::collections::hash_map::Entry;
-use std::collections::HashMap;
+use std::collections::{HashMap, HashSet};
 use std::fs::create_dir_all;
-use std::path::PathBuf;
+use std::io::Read;
+use std::path::{Path, PathBuf};
 
 use anyhow::{Context, Error};
+pub use bundle::{BundleImport, CacheBundle};
 use entry::CacheEntry;
 use itertools::Itertools;
-use key::CacheKey;
+use key::{CacheKey, ShapeKey};
+pub use remote::RemoteCache;
 use storage::CacheFile;
-use task_maker_dag::{ExecutionGroup, ExecutionResult, ExecutionStatus, FileUuid};
+use task_maker_dag::{
+    ExecutionGroup, ExecutionOutputBehaviour, ExecutionResult, ExecutionStatus, FileUuid,
+};
 use task_maker_store::{FileStore, FileStoreHandle};
 
 /// The name of the file which holds the cache data.
@@ -102,8 +110,11 @@ const CACHE_FILE: &str = "cache.bin";
 /// Handle the cached executions, loading and storing them to disk.
 #[derive(Debug)]
 pub struct Cache {
-    /// Cache entries.
+    /// Cache entries, and the durations of the cached executions for estimating how long an
+    /// execution will take.
     file: CacheFile,
+    /// The cache shared with other machines, looked up when an execution is not in this cache.
+    remote: Option<RemoteCache>,
 }
 
 /// The result of a cache query, can be either successful (`Hit`) or unsuccessful (`Miss`).
@@ -129,7 +140,13 @@ impl Cache {
         })?;
         let path = cache_dir.join(CACHE_FILE);
         let file = CacheFile::load(path).context("Failed to load cache file")?;
-        Ok(Self { file })
+        Ok(Self { file, remote: None })
+    }
+
+    /// Share the executions with other machines using a remote cache: the executions not found in
+    /// this cache are looked up in the remote one, and the new executions are uploaded to it.
+    pub fn set_remote(&mut self, remote: RemoteCache) {
+        self.remote = Some(remote);
     }
 
     /// Insert a new entry inside the cache. They key is computed based on the execution's metadata
@@ -142,16 +159,80 @@ impl Cache {
         result: Vec<ExecutionResult>,
     ) {
         let key = CacheKey::from_execution_group(group, file_keys);
-        let set = self.file.entry(key).or_default();
         let entry = CacheEntry::from_execution_group(group, file_keys, result);
+        self.file.add_duration(key.shape(), entry.wall_time());
+        let outputs: HashSet<_> = entry.output_keys().cloned().collect();
+        self.add_entry(key.clone(), entry);
+        if let Some(remote) = &self.remote {
+            let files = file_keys
+                .values()
+                .filter(|handle| outputs.contains(handle.key()))
+                .cloned()
+                .collect();
+            remote.put(&key, self.file.get_mut(key.clone()), files);
+        }
+    }
+
+    /// Add an entry to the ones of a key, returning whether there wasn't one with the same limits.
+    fn add_entry(&mut self, key: CacheKey, entry: CacheEntry) -> bool {
+        let set = self.file.get_mut(key);
         // Do not insert duplicated keys, replace if the limits are the same.
         let pos = set.iter().find_position(|e| e.same_limits(&entry));
         if let Some((pos, _)) = pos {
             set[pos] = entry;
+            false
         } else {
             set.push(entry);
+            true
         }
-        self.file.mark_dirty();
+    }
+
+    /// Search in the cache for a valid entry like `get`, adding the entry of the hit and its output
+    /// files to the bundle. The other entries of the same key are not exported, since their output
+    /// files may be different.
+    pub fn export(
+        &mut self,
+        group: &ExecutionGroup,
+        file_keys: &HashMap<FileUuid, FileStoreHandle>,
+        file_store: &FileStore,
+        bundle: &mut CacheBundle,
+    ) -> CacheResult {
+        let result = self.get(group, file_keys, file_store);
+        if let CacheResult::Hit { outputs, .. } = &result {
+            let key = CacheKey::from_execution_group(group, file_keys);
+            // the same entry `get_local` found: the first compatible one with all the outputs
+            let hit = self.file.get(&key).and_then(|entries| {
+                entries
+                    .iter()
+                    .find(|entry| {
+                        entry.is_compatible(group) && entry.outputs(file_store, group).is_some()
+                    })
+                    .cloned()
+            });
+            if let Some(entry) = hit {
+                bundle.add(key, entry, outputs.values().cloned());
+            }
+        }
+        result
+    }
+
+    /// Merge in this cache the entries of a bundle written by `CacheBundle::write`, storing its
+    /// files in the store if not already present.
+    pub fn import<P: AsRef<Path>>(
+        &mut self,
+        path: P,
+        file_store: &FileStore,
+    ) -> Result<BundleImport, Error> {
+        let (entries, import) = bundle::read_bundle(path.as_ref(), file_store)?;
+        for (key, entries) in entries {
+            for entry in entries {
+                let wall_time = entry.wall_time();
+                if self.add_entry(key.clone(), entry) {
+                    self.file.add_duration(key.shape(), wall_time);
+                }
+            }
+        }
+        Ok(import)
     }
 
     /// Search in the cache for a valid entry, returning a cache hit if it's found or a cache miss
@@ -159,6 +240,8 @@ impl Cache {
     ///
     /// The result contains the handles to the files in the `FileStore`, preventing the flushing
     /// from erasing them.
+    ///
+    /// If the execution is not in this cache it's looked up in the remote cache, if any.
     pub fn get(
         &mut self,
         group: &ExecutionGroup,
@@ -166,31 +249,54 @@ impl Cache {
         file_store: &FileStore,
     ) -> CacheResult {
         let key = CacheKey::from_execution_group(group, file_keys);
-        let entry = self.file.entry(key);
-        let entry = match &entry {
-            Entry::Vacant(_) => return CacheResult::Miss,
-            Entry::Occupied(entry) => entry.get(),
+        let result = self.get_local(&key, group, file_store);
+        if !matches!(result, CacheResult::Miss) {
+            return result;
+        }
+        let Some(remote) = &mut self.remote else {
+            return result;
+        };
+        // the handles keep the downloaded outputs in the store until they are looked up
+        let (entries, _handles) = match remote.get(&key, group, file_store) {
+            Ok(entries) => entries,
+            Err(e) => {
+                warn!("Remote cache lookup failed: {e:?}");
+                return result;
+            }
+        };
+        if entries.is_empty() {
+            return result;
+        }
+        debug!("Execution {} found in the remote cache", group.uuid);
+        for entry in entries {
+            self.add_entry(key.clone(), entry);
+        }
+        self.get_local(&key, group, file_store)
+    }
+
+    /// Search in this cache for a valid entry of the key.
+    fn get_local(
+        &mut self,
+        key: &CacheKey,
+        group: &ExecutionGroup,
+        file_store: &FileStore,
+    ) -> CacheResult {
+        let entries = match self.file.get(key) {
+            None => return CacheResult::Miss,
+            Some(entries) => entries,
         };
 
-        for entry in entry.iter() {
+        // the entries whose outputs have been flushed from the store
+        let mut dead = Vec::new();
+        let mut hit = None;
+        for (index, entry) in entries.iter().enumerate() {
             match entry.outputs(file_store, group) {
-                None => {
-                    // TODO: remove the entry because it's not valid anymore
-                }
+                None => dead.push(index),
                 Some(outputs) if entry.is_compatible(group) => {
                     let mut results = Vec::new();
                     for (exec, item) in group.executions.iter().zip(entry.items.iter()) {
-                        let stdout = item.stdout.as_ref().and_then(|key| {
-                            file_store
-                                .get(key)
-                                .and_then(|handle| std::fs::read(handle.path()).ok())
-                        });
-
-                        let stderr = item.stderr.as_ref().and_then(|key| {
-                            file_store
-                                .get(key)
-                                .and_then(|handle| std::fs::read(handle.path()).ok())
-                        });
+                        let stdout = read_stream(&exec.stdout, &outputs);
+                        let stderr = read_stream(&exec.stderr, &outputs);
 
                         results.push(ExecutionResult {
                             status: exec.status(&item.result.status, &item.result.resources),
@@ -199,17 +305,48 @@ impl Cache {
                             resources: item.result.resources.clone(),
                             stdout,
                             stderr,
+                            timing: item.result.timing.clone(),
                         });
                     }
-                    return CacheResult::Hit {
+                    hit = Some(CacheResult::Hit {
                         result: results,
                         outputs,
-                    };
+                    });
+                    break;
                 }
                 _ => {}
             }
         }
-        CacheResult::Miss
+        if !dead.is_empty() {
+            let entries = self.file.get_mut(key.clone());
+            for index in dead.into_iter().rev() {
+                entries.remove(index);
+            }
+        }
+        hit.unwrap_or(CacheResult::Miss)
+    }
+
+    /// Write the changes to the cache file, without waiting for the cache to be dropped. This is
+    /// needed by the caches that live as long as the process, which may be killed.
+    pub fn store(&mut self) -> Result<(), Error> {
+        self.file.store()
+    }
+
+    /// Bound the size of the cache file: when its entries take more than `max_size` bytes, the
+    /// least recently used ones are removed until they take at most `min_size` bytes.
+    pub fn set_size_limits(&mut self, max_size: u64, min_size: u64) {
+        self.file.set_size_limits(max_size, min_size);
+    }
+
+    /// Estimate how many seconds an execution group will take, using the average wall time of the
+    /// cached executions that differ from it only by the content of their inputs. This doesn't
+    /// need the inputs of the group to be ready.
+    pub fn estimated_duration(&self, group: &ExecutionGroup) -> Option<f64> {
+        let (total, count) = self.file.duration(&ShapeKey::from_execution_group(group))?;
+        if count == 0 {
+            return None;
+        }
+        Some(total / count as f64)
     }
 
     /// Checks whether a result is allowed in the cache.
@@ -218,9 +355,27 @@ impl Cache {
     }
 }
 
+/// Read the content of a captured stream of a cached execution, up to the size limit of the
+/// capture: the stream may be much bigger than the part the execution is interested in.
+fn read_stream(
+    behaviour: &ExecutionOutputBehaviour,
+    outputs: &HashMap<FileUuid, FileStoreHandle>,
+) -> Option<Vec<u8>> {
+    let ExecutionOutputBehaviour::Capture { file, size_limit } = behaviour else {
+        return None;
+    };
+    let handle = outputs.get(&file.uuid)?;
+    let file = std::fs::File::open(handle.path()).ok()?;
+    let mut content = Vec::new();
+    file.take(size_limit.map_or(u64::MAX, |limit| limit as u64))
+        .read_to_end(&mut content)
+        .ok()?;
+    Some(content)
+}
+
 impl Drop for Cache {
     fn drop(&mut self) {
-        if let Err(e) = self.file.store() {
+        if let Err(e) = self.store() {
             warn!("Failed to store cache file: {e:?}");
         }
     }
@@ -0,0 +1,392 @@
+//! Cache of the executions shared between many machines, stored on a remote HTTP server.
+//!
+//! The protocol is the one of the HTTP remote cache of Bazel: the server stores blobs by key,
+//! supporting `GET`, `HEAD` and `PUT`, so any server implementing it (bazel-remote, nginx with
+//! WebDAV, ...) can be used. There are two kinds of blobs:
+//! - `<url>/ac/<hash>`: the cache entries of a cache key, `<hash>` being the hash of the key;
+//! - `<url>/cas/<hash>`: the content of a file, `<hash>` being its `FileStoreKey`.
+//!
+//! The entries are looked up when an execution misses the local cache, downloading the outputs of
+//! the compatible entries into the local file store. The new entries are uploaded in background,
+//! together with their outputs. The last machine that uploads the entries of a key wins.
+
+use std::sync::mpsc::{channel, Sender};
+use std::thread::JoinHandle;
+use std::time::Duration;
+
+use anyhow::{bail, Context, Error};
+use const_format::formatcp;
+use reqwest::blocking::Client;
+use reqwest::StatusCode;
+use task_maker_dag::ExecutionGroup;
+use task_maker_store::{FileStore, FileStoreHandle, FileStoreKey};
+
+use crate::entry::CacheEntry;
+use crate::key::CacheKey;
+
+/// Prefix of the hashed cache keys, so that different versions of task-maker don't share their
+/// entries.
+const VERSION: &str = formatcp!("task-maker-remote-cache v{}\n", env!("CARGO_PKG_VERSION"));
+/// Timeout for connecting to the remote cache.
+const CONNECT_TIMEOUT: Duration = Duration::from_secs(5);
+/// Timeout of a single request to the remote cache.
+const REQUEST_TIMEOUT: Duration = Duration::from_secs(60);
+
+/// The entries of a key to upload to the remote cache.
+struct Upload {
+    /// The hash of the cache key.
+    key: String,
+    /// The serialized entries of the key.
+    entries: Vec<u8>,
+    /// The output files of the entries, kept in the store until they are uploaded.
+    files: Vec<FileStoreHandle>,
+}
+
+/// Connection to a remote cache shared between many machines.
+#[derive(Debug)]
+pub struct RemoteCache {
+    /// The client for the requests to the remote cache.
+    client: Client,
+    /// The base URL of the remote cache, without the trailing slash.
+    url: String,
+    /// Where to send the entries to upload, `None` when the uploader is stopping.
+    uploads: Option<Sender<Upload>>,
+    /// The thread that uploads the new entries.
+    uploader: Option<JoinHandle<()>>,
+    /// Whether the lookups are disabled because the server is not reachable: the lookups block the
+    /// scheduling of the executions, so they are not retried.
+    unreachable: bool,
+}
+
+impl RemoteCache {
+    /// Use the remote cache at the provided URL, for example `http://cache.example.com:8080/tm`.
+    /// The server is contacted only when needed.
+    pub fn new<S: Into<String>>(url: S) -> Result<RemoteCache, Error> {
+        let url = url.into().trim_end_matches('/').to_string();
+        let client = Client::builder()
+            .connect_timeout(CONNECT_TIMEOUT)
+            .timeout(REQUEST_TIMEOUT)
+            .build()
+            .context("Failed to build the HTTP client")?;
+        let (sender, receiver) = channel::<Upload>();
+        let uploader_client = client.clone();
+        let uploader_url = url.clone();
+        let uploader = std::thread::Builder::new()
+            .name("Remote cache uploader".into())
+            .spawn(move || {
+                for upload in receiver {
+                    if let Err(e) = upload_entries(&uploader_client, &uploader_url, upload) {
+                        warn!("Failed to upload to the remote cache: {e:?}");
+                    }
+                }
+            })
+            .context("Failed to spawn the remote cache uploader")?;
+        Ok(RemoteCache {
+            client,
+            url,
+            uploads: Some(sender),
+            uploader: Some(uploader),
+            unreachable: false,
+        })
+    }
+
+    /// Download the entries of a key that are compatible with the group, fetching their outputs
+    /// into the file store. The returned handles keep the outputs in the store.
+    pub(crate) fn get(
+        &mut self,
+        key: &CacheKey,
+        group: &ExecutionGroup,
+        file_store: &FileStore,
+    ) -> Result<(Vec<CacheEntry>, Vec<FileStoreHandle>), Error> {
+        if self.unreachable {
+            return Ok((vec![], vec![]));
+        }
+        let url = format!("{}/ac/{}", self.url, remote_key(key)?);
+        let response = match self.client.get(&url).send() {
+            Ok(response) => response,
+            Err(e) => {
+                if e.is_connect() || e.is_timeout() {
+                    warn!("The remote cache is not reachable, not using it for the lookups");
+                    self.unreachable = true;
+                }
+                return Err(e).with_context(|| format!("Failed to get {url}"));
+            }
+        };
+        if response.status() == StatusCode::NOT_FOUND {
+            return Ok((vec![], vec![]));
+        }
+        let data = response
+            .error_for_status()
+            .and_then(|response| response.bytes())
+            .with_context(|| format!("Failed to get {url}"))?;
+        let entries: Vec<CacheEntry> =
+            bincode::deserialize(&data).context("Invalid entries in the remote cache")?;
+        let mut compatible = Vec::new();
+        let mut handles = Vec::new();
+        for entry in entries {
+            if !entry.is_compatible(group) {
+                continue;
+            }
+            match self.fetch_outputs(&entry, file_store) {
+                Ok(outputs) => {
+                    handles.extend(outputs);
+                    compatible.push(entry);
+                }
+                Err(e) => debug!("Outputs of a remote cache entry not available: {e:?}"),
+            }
+        }
+        Ok((compatible, handles))
+    }
+
+    /// Upload in background the entries of a key, with the provided output files.
+    pub(crate) fn put(&self, key: &CacheKey, entries: &[CacheEntry], files: Vec<FileStoreHandle>) {
+        let upload = || -> Result<Upload, Error> {
+            Ok(Upload {
+                key: remote_key(key)?,
+                entries: bincode::serialize(entries).context("Failed to serialize the entries")?,
+                files,
+            })
+        };
+        match upload() {
+            Ok(upload) => {
+                if let Some(uploads) = &self.uploads {
+                    // the uploader only stops when this is dropped
+                    let _ = uploads.send(upload);
+                }
+            }
+            Err(e) => warn!("Cannot upload to the remote cache: {e:?}"),
+        }
+    }
+
+    /// Download into the file store the outputs of an entry that are not already there.
+    fn fetch_outputs(
+        &self,
+        entry: &CacheEntry,
+        file_store: &FileStore,
+    ) -> Result<Vec<FileStoreHandle>, Error> {
+        let mut handles = Vec::new();
+        for key in entry.output_keys() {
+            if let Some(handle) = file_store.get(key) {
+                handles.push(handle);
+                continue;
+            }
+            let url = format!("{}/cas/{}", self.url, key);
+            let data = self
+                .client
+                .get(&url)
+                .send()
+                .and_then(|response| response.error_for_status())
+                .and_then(|response| response.bytes())
+                .with_context(|| format!("Failed to get {url}"))?;
+            if FileStoreKey::from_content(&data) != *key {
+                bail!("The content of {url} doesn't match its hash");
+            }
+            handles.push(file_store.store(key, std::iter::once(data.to_vec()))?);
+        }
+        Ok(handles)
+    }
+}
+
+impl Drop for RemoteCache {
+    fn drop(&mut self) {
+        // closing the channel stops the uploader after the pending uploads
+        self.uploads.take();
+        if let Some(uploader) = self.uploader.take() {
+            debug!("Waiting for the uploads to the remote cache");
+            if uploader.join().is_err() {
+                warn!("The remote cache uploader panicked");
+            }
+        }
+    }
+}
+
+/// The key of the remote entries of a cache key.
+fn remote_key(key: &CacheKey) -> Result<String, Error> {
+    let data = bincode::serialize(key).context("Failed to serialize cache key")?;
+    let mut hasher = blake3::Hasher::new();
+    hasher.update(VERSION.as_bytes());
+    hasher.update(&data);
+    Ok(hasher.finalize().to_hex().to_string())
+}
+
+/// Upload the output files of some entries, if not already present, and then the entries, so that
+/// the entries are visible only when their outputs are.
+fn upload_entries(client: &Client, base_url: &str, upload: Upload) -> Result<(), Error> {
+    for file in &upload.files {
+        let url = format!("{}/cas/{}", base_url, file.key());
+        // the files are content-addressed: if present they are the same
+        let present = client
+            .head(&url)
+            .send()
+            .is_ok_and(|response| response.status().is_success());
+        if present {
+            continue;
+        }
+        let content = std::fs::File::open(file.path())
+            .with_context(|| format!("Failed to open {}", file.path().display()))?;
+        client
+            .put(&url)
+            .body(content)
+            .send()
+            .and_then(|response| response.error_for_status())
+            .with_context(|| format!("Failed to put {url}"))?;
+    }
+    let url = format!("{}/ac/{}", base_url, upload.key);
+    client
+        .put(&url)
+        .body(upload.entries)
+        .send()
+        .and_then(|response| response.error_for_status())
+        .with_context(|| format!("Failed to put {url}"))?;
+    Ok(())
+}
+
+#[cfg(test)]
+mod tests {
+    use std::collections::HashMap;
+    use std::io::{BufRead, BufReader, Read, Write};
+    use std::net::{TcpListener, TcpStream};
+    use std::sync::{Arc, Mutex};
+
+    use task_maker_dag::{
+        Execution, ExecutionCommand, ExecutionResourcesUsage, ExecutionResult, ExecutionStatus,
+        File,
+    };
+    use task_maker_store::ReadFileIterator;
+
+    use crate::{Cache, CacheResult};
+
+    use super::*;
+
+    type Blobs = Arc<Mutex<HashMap<String, Vec<u8>>>>;
+
+    /// A minimal HTTP server storing the blobs in memory, returning its URL.
+    fn fake_server(blobs: Blobs) -> String {
+        let listener = TcpListener::bind("127.0.0.1:0").unwrap();
+        let url = format!("http://{}/prefix", listener.local_addr().unwrap());
+        std::thread::spawn(move || {
+            for stream in listener.incoming() {
+                let blobs = blobs.clone();
+                std::thread::spawn(move || serve(stream.unwrap(), blobs));
+            }
+        });
+        url
+    }
+
+    /// Serve the requests of a connection.
+    fn serve(stream: TcpStream, blobs: Blobs) {
+        let mut reader = BufReader::new(stream.try_clone().unwrap());
+        let mut stream = stream;
+        loop {
+            let mut line = String::new();
+            if reader.read_line(&mut line).unwrap_or(0) == 0 {
+                return;
+            }
+            let mut parts = line.split_whitespace();
+            let method = parts.next().unwrap().to_string();
+            let path = parts.next().unwrap().to_string();
+            let mut length = 0;
+            loop {
+                let mut header = String::new();
+                reader.read_line(&mut header).unwrap();
+                if header.trim().is_empty() {
+                    break;
+                }
+                if let Some((name, value)) = header.split_once(':') {
+                    if name.eq_ignore_ascii_case("content-length") {
+                        length = value.trim().parse().unwrap();
+                    }
+                }
+            }
+            let mut body = vec![0; length];
+            reader.read_exact(&mut body).unwrap();
+            let mut blobs = blobs.lock().unwrap();
+            let response = match (method.as_str(), blobs.get(&path)) {
+                ("PUT", _) => {
+                    blobs.insert(path, body);
+                    (200, vec![])
+                }
+                ("GET", Some(blob)) => (200, blob.clone()),
+                ("HEAD", Some(_)) => (200, vec![]),
+                _ => (404, vec![]),
+            };
+            write!(
+                stream,
+                "HTTP/1.1 {} X\r\nContent-Length: {}\r\n\r\n",
+                response.0,
+                response.1.len()
+            )
+            .unwrap();
+            stream.write_all(&response.1).unwrap();
+        }
+    }
+
+    #[test]
+    fn test_remote_cache() {
+        let blobs = Blobs::default();
+        let url = fake_server(blobs.clone());
+        let tmpdir = tempfile::TempDir::new().unwrap();
+        let input_path = tmpdir.path().join("input");
+        let output_path = tmpdir.path().join("output");
+        std::fs::write(&input_path, "input").unwrap();
+        std::fs::write(&output_path, "output").unwrap();
+        let input_key = FileStoreKey::from_file(&input_path).unwrap();
+        let output_key = FileStoreKey::from_file(&output_path).unwrap();
+
+        let mut exec = Execution::new("exec", ExecutionCommand::system("true"));
+        let input = File::new("input");
+        exec.input(&input, "input", false);
+        let stdout = exec.capture_stdout(None);
+        let group: ExecutionGroup = exec.into();
+        let result = ExecutionResult {
+            status: ExecutionStatus::Success,
+            was_killed: false,
+            was_cached: false,
+            resources: ExecutionResourcesUsage {
+                cpu_time: 1.0,
+                sys_time: 0.0,
+                wall_time: 1.0,
+                memory: 0,
+                counters: None,
+            },
+            stdout: None,
+            stderr: None,
+            timing: None,
+        };
+
+        // the first machine runs the execution
+        {
+            let store = FileStore::new(tmpdir.path().join("store1"), 1 << 20, 1 << 20).unwrap();
+            let mut cache = Cache::new(tmpdir.path().join("cache1")).unwrap();
+            cache.set_remote(RemoteCache::new(url.clone()).unwrap());
+            let mut file_keys = HashMap::new();
+            let iter = ReadFileIterator::new(&input_path).unwrap();
+            file_keys.insert(input.uuid, store.store(&input_key, iter).unwrap());
+            let iter = ReadFileIterator::new(&output_path).unwrap();
+            file_keys.insert(stdout.uuid, store.store(&output_key, iter).unwrap());
+            cache.insert(&group, &file_keys, vec![result]);
+            // waits for the uploads
+        }
+        assert_eq!(blobs.lock().unwrap().len(), 2);
+
+        // the second machine finds it in the remote cache
+        let store = FileStore::new(tmpdir.path().join("store2"), 1 << 20, 1 << 20).unwrap();
+        let mut cache = Cache::new(tmpdir.path().join("cache2")).unwrap();
+        let mut file_keys = HashMap::new();
+        let iter = ReadFileIterator::new(&input_path).unwrap();
+        file_keys.insert(input.uuid, store.store(&input_key, iter).unwrap());
+        assert!(matches!(
+            cache.get(&group, &file_keys, &store),
+            CacheResult::Miss
+        ));
+        cache.set_remote(RemoteCache::new(url).unwrap());
+        match cache.get(&group, &file_keys, &store) {
+            CacheResult::Miss => panic!("Expecting a hit"),
+            CacheResult::Hit { result, outputs } => {
+                assert_eq!(result[0].status, ExecutionStatus::Success);
+                assert_eq!(result[0].stdout.as_deref(), Some(&b"output"[..]));
+                assert_eq!(outputs[&stdout.uuid].key(), &output_key);
+            }
+        }
+    }
+}
@@ -1,15 +1,16 @@
-use std::collections::hash_map::Entry;
-use std::collections::HashMap;
-use std::io::{BufReader, BufWriter, Read, Write};
+use std::cmp::Reverse;
+use std::collections::{HashMap, HashSet};
+use std::fs::{File, OpenOptions};
+use std::io::{BufWriter, Seek, SeekFrom, Write};
+use std::os::unix::fs::FileExt;
 use std::path::PathBuf;
+use std::time::{SystemTime, UNIX_EPOCH};
 
-use anyhow::{Context, Error};
+use anyhow::{bail, Context, Error};
 use const_format::formatcp;
-use itertools::Itertools;
-use serde::{Deserialize, Serialize};
 
 use crate::entry::CacheEntry;
-use crate::key::CacheKey;
+use crate::key::{CacheKey, ShapeKey};
 
 /// Magic string that is prepended to the cache file to avoid accidental loading of invalid cache
 /// files.
@@ -17,99 +18,578 @@ use crate::key::CacheKey;
 /// The newline at the end of the string is required. For example, let's say there are 2 versions:
 /// v0.1 and v0.11; running v0.11 first, and then v0.1, without the newline the magic of the old
 /// version is a prefix of the magic of the new version.
-const MAGIC: &[u8] = formatcp!("task-maker-cache v{}\n", env!("CARGO_PKG_VERSION")).as_bytes();
+const MAGIC: &[u8] =
+    formatcp!("task-maker-cache v{} indexed\n", env!("CARGO_PKG_VERSION")).as_bytes();
+/// The size of the header of the file: the magic string, the offset and the size of the index.
+const HEADER_LEN: usize = MAGIC.len() + 16;
+/// The size of a slot of the index: the hash of the key, the offset and the size of the entries,
+/// and the time of their last use.
+const SLOT_LEN: usize = 32;
+/// The file is rewritten from scratch only if more than half of it is outdated, and the outdated
+/// part is at least this big.
+const MIN_COMPACTION_SIZE: u64 = 1 << 20;
 
 /// A cache file.
-#[derive(Debug, Serialize, Deserialize)]
+///
+/// The file starts with the magic string and the position of the index, followed by the entries of
+/// each cache key, serialized separately. The index is a table with the position of the entries of
+/// each key, sorted by the hash of the key, followed by the durations of the cached executions.
+/// Loading the file reads only the index and the durations: the entries of a key are read and
+/// deserialized the first time they are asked for.
+///
+/// Storing the file appends the changed entries and a new index, and only then points the header to
+/// the new index: an interrupted write leaves the previous content of the cache valid. When most of
+/// the file is made of outdated entries it's rewritten from scratch. The index also keeps when the
+/// entries of each key have been used for the last time, for evicting the least recently used ones.
+#[derive(Debug)]
 pub(crate) struct CacheFile {
-    /// The set of entries in this cache file.
-    entries: HashMap<CacheKey, Vec<CacheEntry>>,
     /// Where this file is stored.
     path: PathBuf,
-    /// Whether this file should be flushed.
-    dirty: bool,
+    /// The file opened when it was loaded, if it was valid. The entries are read from it, even if
+    /// the file has since been replaced by another process.
+    file: Option<File>,
+    /// The size of `file` when it was loaded.
+    file_len: u64,
+    /// The slots of the index of `file`.
+    slots: Vec<u8>,
+    /// The position of the first slot of the index in `file`.
+    slots_start: usize,
+    /// The number of slots of the index of `file`.
+    num_slots: usize,
+    /// The entries read from the file or inserted since it was loaded.
+    entries: HashMap<CacheKey, Vec<CacheEntry>>,
+    /// The index of the slot of the entries read from the file.
+    loaded_slots: HashMap<CacheKey, usize>,
+    /// The keys whose entries changed since the file was loaded.
+    dirty: HashSet<CacheKey>,
+    /// The total wall time and the number of the cached executions with the same shape.
+    durations: HashMap<ShapeKey, (f64, usize)>,
+    /// The maximum size of the entries, and the size to shrink them to when it's exceeded.
+    size_limits: Option<(u64, u64)>,
+}
+
+/// The position of the entries of a key inside the file.
+#[derive(Debug, Clone, Copy)]
+struct Slot {
+    /// The hash of the key.
+    hash: u64,
+    /// Where the serialized key and entries start.
+    offset: u64,
+    /// The size of the serialized key and entries.
+    len: u64,
+    /// When the entries have been used for the last time, in seconds from the epoch.
+    last_used: u64,
 }
 
 impl CacheFile {
-    /// Read the cache file, check the magic string and deserialize all the entries in it.
+    /// Open the cache file, checking the magic string and reading its index.
     pub fn load(path: PathBuf) -> Result<CacheFile, Error> {
+        let mut cache = CacheFile {
+            path,
+            file: None,
+            file_len: 0,
+            slots: Vec::new(),
+            slots_start: 0,
+            num_slots: 0,
+            entries: Default::default(),
+            loaded_slots: Default::default(),
+            dirty: Default::default(),
+            durations: Default::default(),
+            size_limits: None,
+        };
+        let path = &cache.path;
         if !path.exists() {
-            return Ok(Self {
-                entries: Default::default(),
-                path,
-                dirty: false,
-            });
+            return Ok(cache);
         }
 
-        let file = std::fs::File::open(&path)
+        // The file is not mapped in memory: another process may truncate it while it's in use, and
+        // reading from a file descriptor turns that into an error instead of a crash.
+        let file = File::open(path)
             .with_context(|| format!("Cannot open cache file at {}", path.display()))?;
-        let mut reader = BufReader::new(file);
-        let mut magic = [0u8; MAGIC.len()];
-
-        if reader.read_exact(&mut magic).is_ok_and(|_| magic != MAGIC) {
+        let file_len = file
+            .metadata()
+            .with_context(|| format!("Cannot stat cache file at {}", path.display()))?
+            .len();
+        if file_len < MAGIC.len() as u64 {
+            bail!("Cache file at {} is truncated", path.display());
+        }
+        let header = read_at(&file, file_len, 0, file_len.min(HEADER_LEN as u64))
+            .context("Invalid cache header")?;
+        let magic = &header[..MAGIC.len()];
+        if magic != MAGIC {
             info!("Cache version mismatch:\nExpected: {MAGIC:?}\nFound: {magic:?}");
-            return Ok(Self {
-                entries: Default::default(),
-                path,
-                dirty: false,
-            });
+            return Ok(cache);
         }
 
-        let entries = bincode::deserialize_from::<_, HashMap<CacheKey, Vec<CacheEntry>>>(reader)
-            .context("Failed to deserialize cache content")?;
+        let index_offset = read_u64(&header, MAGIC.len()).context("Invalid cache header")?;
+        let index_len = read_u64(&header, MAGIC.len() + 8).context("Invalid cache header")?;
+        let index = read_at(&file, file_len, index_offset, index_len)
+            .context("Invalid cache index position")?;
+        let num_slots = read_u64(&index, 0).context("Invalid cache index")? as usize;
+        let durations_start = num_slots
+            .checked_mul(SLOT_LEN)
+            .and_then(|len| len.checked_add(8))
+            .filter(|start| *start <= index.len())
+            .context("Invalid cache index size")?;
+        let durations: Vec<(ShapeKey, (f64, usize))> =
+            bincode::deserialize(&index[durations_start..])
+                .context("Failed to deserialize cache durations")?;
 
-        Ok(Self {
-            entries,
-            path,
-            dirty: false,
-        })
+        cache.durations = durations.into_iter().collect();
+        cache.slots = index[8..durations_start].to_vec();
+        cache.slots_start = index_offset as usize + 8;
+        cache.num_slots = num_slots;
+        cache.file = Some(file);
+        cache.file_len = file_len;
+        Ok(cache)
     }
 
-    /// Store the content of the cache to the cache file, including the magic string.
-    pub fn store(&self) -> Result<(), Error> {
-        // Do not write the file if it's not dirty.
-        if !self.dirty {
+    /// Store the changed entries to the cache file, and the time of the last use of the entries
+    /// read from it. If the entries take more than the maximum size, the least recently used ones
+    /// are removed until they take at most the minimum size.
+    pub fn store(&mut self) -> Result<(), Error> {
+        if self.dirty.is_empty() && self.loaded_slots.is_empty() {
             return Ok(());
         }
 
         let path = &self.path;
         std::fs::create_dir_all(path.parent().context("Invalid cache file")?)
             .with_context(|| format!("Failed to create cache directory for {}", path.display()))?;
+
+        let now = SystemTime::now()
+            .duration_since(UNIX_EPOCH)
+            .map_or(0, |time| time.as_secs());
+        let replaced: HashSet<usize> = self
+            .dirty
+            .iter()
+            .filter_map(|key| self.loaded_slots.get(key).copied())
+            .collect();
+        let used: HashSet<usize> = self.loaded_slots.values().copied().collect();
+        // the entries to write, with their content if it's not already in the file
+        let mut slots: Vec<(Slot, Option<Vec<u8>>)> = (0..self.num_slots)
+            .filter(|index| !replaced.contains(index))
+            .map(|index| {
+                let mut slot = self.slot(index);
+                if used.contains(&index) {
+                    slot.last_used = now;
+                }
+                (slot, None)
+            })
+            .collect();
+        for key in &self.dirty {
+            let entries = &self.entries[key];
+            // all the entries of the key have been removed
+            if entries.is_empty() {
+                continue;
+            }
+            let data =
+                bincode::serialize(&(key, entries)).context("Failed to serialize cache entry")?;
+            let slot = Slot {
+                hash: key_hash(key)?,
+                offset: 0,
+                len: data.len() as u64,
+                last_used: now,
+            };
+            slots.push((slot, Some(data)));
+        }
+
+        let mut live_size: u64 = slots.iter().map(|(slot, _)| slot.len).sum();
+        let mut evicted = 0;
+        if let Some((max_size, min_size)) = self.size_limits {
+            if live_size > max_size {
+                // the new entries are kept over the ones used in the same second
+                slots.sort_by_key(|(slot, data)| Reverse((slot.last_used, data.is_some())));
+                while live_size > min_size {
+                    let Some((slot, _)) = slots.pop() else {
+                        break;
+                    };
+                    live_size -= slot.len;
+                    evicted += 1;
+                }
+                debug!("Evicted {evicted} keys from the cache");
+            }
+        }
+
+        if self.dirty.is_empty() && evicted == 0 {
+            // only the time of the last use changed, it can be updated in place
+            let file = OpenOptions::new()
+                .write(true)
+                .open(path)
+                .context("Failed to open cache file")?;
+            for index in used {
+                let position = self.slots_start + index * SLOT_LEN + 24;
+                file.write_all_at(&now.to_le_bytes(), position as u64)
+                    .context("Failed to write cache index")?;
+            }
+            self.loaded_slots.clear();
+            return Ok(());
+        }
+
+        let append = self.file.is_some() && self.file_len <= 2 * live_size + MIN_COMPACTION_SIZE;
         let tmp = path.with_extension("tmp");
-        let file = std::fs::File::create(&tmp).context("Failed to create cache file")?;
-        let mut writer = BufWriter::new(file);
+        let mut file = if append {
+            OpenOptions::new()
+                .write(true)
+                .open(path)
+                .context("Failed to open cache file")?
+        } else {
+            let mut file = File::create(&tmp).context("Failed to create cache file")?;
+            file.write_all(MAGIC)
+                .context("Failed to write cache magic number")?;
+            file.write_all(&[0; HEADER_LEN - MAGIC.len()])
+                .context("Failed to write cache header")?;
+            file
+        };
+        let mut offset = file
+            .seek(SeekFrom::End(0))
+            .context("Failed to seek cache file")?;
 
+        let mut writer = BufWriter::new(&file);
+        for (slot, data) in slots.iter_mut() {
+            let data = match (data.take(), &self.file) {
+                (Some(data), _) => data,
+                // the entries already in the file are copied without deserializing them
+                (None, Some(old)) if !append => read_at(old, self.file_len, slot.offset, slot.len)
+                    .context("Cache entry out of bounds")?,
+                _ => continue,
+            };
+            writer
+                .write_all(&data)
+                .context("Failed to write cache content")?;
+            slot.offset = offset;
+            offset += slot.len;
+        }
+        let index = self.index(slots.into_iter().map(|(slot, _)| slot).collect())?;
         writer
-            .write_all(MAGIC)
-            .context("Failed to write cache magic number")?;
-
-        bincode::serialize_into(writer, &self.entries.iter().collect_vec())
-            .context("Failed to write cache content")?;
-        std::fs::rename(&tmp, &self.path).with_context(|| {
-            format!(
-                "Failed to move {} -> {}",
-                tmp.display(),
-                self.path.display()
-            )
-        })?;
+            .write_all(&index)
+            .context("Failed to write cache index")?;
+        writer.flush().context("Failed to write cache file")?;
+        drop(writer);
+
+        // the new content must be on disk before the header points to it
+        file.sync_data().context("Failed to sync cache file")?;
+        let mut header = [0; HEADER_LEN - MAGIC.len()];
+        header[..8].copy_from_slice(&offset.to_le_bytes());
+        header[8..].copy_from_slice(&(index.len() as u64).to_le_bytes());
+        file.write_all_at(&header, MAGIC.len() as u64)
+            .context("Failed to write cache header")?;
+        if !append {
+            std::fs::rename(&tmp, path).with_context(|| {
+                format!("Failed to move {} -> {}", tmp.display(), path.display())
+            })?;
+        }
+
+        let size_limits = self.size_limits;
+        *self = CacheFile::load(self.path.clone())?;
+        self.size_limits = size_limits;
         Ok(())
     }
 
-    pub fn entry(&mut self, key: CacheKey) -> Entry<'_, CacheKey, Vec<CacheEntry>> {
-        self.entries.entry(key)
+    /// Bound the size of the entries in the file: when they take more than `max_size` bytes, the
+    /// least recently used ones are removed until they take at most `min_size` bytes.
+    pub fn set_size_limits(&mut self, max_size: u64, min_size: u64) {
+        self.size_limits = Some((max_size, min_size));
+    }
+
+    /// The entries of a key, if any.
+    pub fn get(&mut self, key: &CacheKey) -> Option<&Vec<CacheEntry>> {
+        self.load_entries(key);
+        self.entries.get(key)
+    }
+
+    /// The entries of a key, that will be written to the file when stored.
+    pub fn get_mut(&mut self, key: CacheKey) -> &mut Vec<CacheEntry> {
+        self.load_entries(&key);
+        self.dirty.insert(key.clone());
+        self.entries.entry(key).or_default()
+    }
+
+    /// The total wall time and the number of the cached executions with the same shape.
+    pub fn duration(&self, shape: &ShapeKey) -> Option<(f64, usize)> {
+        self.durations.get(shape).copied()
+    }
+
+    /// Account a new cached execution in the durations of its shape.
+    pub fn add_duration(&mut self, shape: ShapeKey, wall_time: f64) {
+        let duration = self.durations.entry(shape).or_default();
+        duration.0 += wall_time;
+        duration.1 += 1;
+    }
+
+    /// Read from the file the entries of a key, if they are not already known.
+    fn load_entries(&mut self, key: &CacheKey) {
+        if self.entries.contains_key(key) || self.file.is_none() {
+            return;
+        }
+        let hash = match key_hash(key) {
+            Ok(hash) => hash,
+            Err(e) => {
+                warn!("Invalid cache key: {e:?}");
+                return;
+            }
+        };
+        // binary search of the first slot with the hash of the key
+        let (mut low, mut high) = (0, self.num_slots);
+        while low < high {
+            let mid = (low + high) / 2;
+            if self.slot(mid).hash < hash {
+                low = mid + 1;
+            } else {
+                high = mid;
+            }
+        }
+        // different keys may have the same hash
+        for index in (low..self.num_slots).take_while(|index| self.slot(*index).hash == hash) {
+            match self.read_slot(index) {
+                Ok((slot_key, entries)) if &slot_key == key => {
+                    self.entries.insert(slot_key.clone(), entries);
+                    self.loaded_slots.insert(slot_key, index);
+                    return;
+                }
+                Ok(_) => {}
+                Err(e) => warn!("Invalid cache entry: {e:?}"),
+            }
+        }
     }
 
-    pub fn mark_dirty(&mut self) {
-        self.dirty = true;
+    /// The slot of the index of `file` at the given index.
+    fn slot(&self, index: usize) -> Slot {
+        let start = index * SLOT_LEN;
+        Slot {
+            hash: read_u64(&self.slots, start).expect("Slot out of bounds"),
+            offset: read_u64(&self.slots, start + 8).expect("Slot out of bounds"),
+            len: read_u64(&self.slots, start + 16).expect("Slot out of bounds"),
+            last_used: read_u64(&self.slots, start + 24).expect("Slot out of bounds"),
+        }
+    }
+
+    /// Deserialize the key and the entries pointed by a slot of the index.
+    fn read_slot(&self, index: usize) -> Result<(CacheKey, Vec<CacheEntry>), Error> {
+        let file = self.file.as_ref().expect("Cache file not loaded");
+        let slot = self.slot(index);
+        let data = read_at(file, self.file_len, slot.offset, slot.len)
+            .context("Cache entry out of bounds")?;
+        bincode::deserialize(&data).context("Failed to deserialize cache entry")
+    }
+
+    /// Serialize the index with the provided slots and the durations.
+    fn index(&self, mut slots: Vec<Slot>) -> Result<Vec<u8>, Error> {
+        slots.sort_by_key(|slot| slot.hash);
+        let mut index = Vec::with_capacity(8 + slots.len() * SLOT_LEN);
+        index.extend_from_slice(&(slots.len() as u64).to_le_bytes());
+        for slot in slots {
+            index.extend_from_slice(&slot.hash.to_le_bytes());
+            index.extend_from_slice(&slot.offset.to_le_bytes());
+            index.extend_from_slice(&slot.len.to_le_bytes());
+            index.extend_from_slice(&slot.last_used.to_le_bytes());
+        }
+        let durations: Vec<_> = self.durations.iter().collect();
+        bincode::serialize_into(&mut index, &durations)
+            .context("Failed to serialize cache durations")?;
+        Ok(index)
+    }
+}
+
+/// The hash of a key, for finding it in the index.
+fn key_hash(key: &CacheKey) -> Result<u64, Error> {
+    let data = bincode::serialize(key).context("Failed to serialize cache key")?;
+    let hash = blake3::hash(&data);
+    let mut bytes = [0; 8];
+    bytes.copy_from_slice(&hash.as_bytes()[..8]);
+    Ok(u64::from_le_bytes(bytes))
+}
+
+/// Read `len` bytes of `file`, whose size is `file_len`, from the position `offset`. The position is
+/// checked against the size of the file, so that a corrupted index doesn't allocate huge buffers.
+fn read_at(file: &File, file_len: u64, offset: u64, len: u64) -> Result<Vec<u8>, Error> {
+    if offset.checked_add(len).map_or(true, |end| end > file_len) {
+        bail!("Range {offset}+{len} past the end of the file ({file_len} bytes)");
     }
+    let mut data = vec![0; len as usize];
+    file.read_exact_at(&mut data, offset)
+        .context("Failed to read cache file")?;
+    Ok(data)
+}
+
+/// Read a little endian `u64` at the given position, if it's inside `data`.
+fn read_u64(data: &[u8], at: usize) -> Option<u64> {
+    let bytes = data.get(at..at.checked_add(8)?)?;
+    Some(u64::from_le_bytes(bytes.try_into().ok()?))
 }
 
 #[cfg(test)]
 mod tests {
-    use std::fs::File;
+    use std::collections::HashMap;
+
+    use task_maker_dag::{
+        Execution, ExecutionCommand, ExecutionGroup, ExecutionResourcesUsage, ExecutionResult,
+        ExecutionStatus,
+    };
 
     use super::*;
 
+    fn group(arg: usize) -> ExecutionGroup {
+        let mut exec = Execution::new("exec", ExecutionCommand::local("foo"));
+        exec.args(vec![arg.to_string()]);
+        exec.into()
+    }
+
+    fn entry(group: &ExecutionGroup, wall_time: f64) -> CacheEntry {
+        let result = ExecutionResult {
+            status: ExecutionStatus::Success,
+            was_killed: false,
+            was_cached: false,
+            resources: ExecutionResourcesUsage {
+                cpu_time: 0.0,
+                sys_time: 0.0,
+                wall_time,
+                memory: 0,
+                counters: None,
+            },
+            stdout: None,
+            stderr: None,
+            timing: None,
+        };
+        CacheEntry::from_execution_group(group, &HashMap::new(), vec![result])
+    }
+
+    fn insert(file: &mut CacheFile, arg: usize, wall_time: f64) -> CacheKey {
+        let group = group(arg);
+        let key = CacheKey::from_execution_group(&group, &HashMap::new());
+        let entries = file.get_mut(key.clone());
+        entries.clear();
+        entries.push(entry(&group, wall_time));
+        file.add_duration(key.shape(), wall_time);
+        key
+    }
+
+    fn wall_time(file: &mut CacheFile, key: &CacheKey) -> Option<f64> {
+        file.get(key).map(|entries| entries[0].wall_time())
+    }
+
+    #[test]
+    fn test_store_load() {
+        let tmpdir = tempfile::TempDir::new().unwrap();
+        let path = tmpdir.path().join("cache");
+        let mut file = CacheFile::load(path.clone()).unwrap();
+        let keys: Vec<_> = (0..10).map(|i| insert(&mut file, i, i as f64)).collect();
+        file.store().unwrap();
+        drop(file);
+
+        let mut file = CacheFile::load(path.clone()).unwrap();
+        assert!(file.entries.is_empty());
+        assert_eq!(wall_time(&mut file, &keys[3]), Some(3.0));
+        assert_eq!(file.entries.len(), 1);
+        assert_eq!(file.duration(&keys[3].shape()), Some((3.0, 1)));
+        let missing = CacheKey::from_execution_group(&group(42), &HashMap::new());
+        assert_eq!(wall_time(&mut file, &missing), None);
+
+        // only the changed entry is appended
+        let size = std::fs::metadata(&path).unwrap().len();
+        insert(&mut file, 3, 30.0);
+        file.store().unwrap();
+        assert!(std::fs::metadata(&path).unwrap().len() > size);
+        let mut file = CacheFile::load(path).unwrap();
+        assert_eq!(wall_time(&mut file, &keys[3]), Some(30.0));
+        assert_eq!(wall_time(&mut file, &keys[4]), Some(4.0));
+        assert_eq!(file.num_slots, 10);
+    }
+
+    #[test]
+    fn test_store_compaction() {
+        let tmpdir = tempfile::TempDir::new().unwrap();
+        let path = tmpdir.path().join("cache");
+        let mut file = CacheFile::load(path.clone()).unwrap();
+        let key = insert(&mut file, 0, 0.0);
+        file.store().unwrap();
+        let size = std::fs::metadata(&path).unwrap().len();
+        for i in 1..100 {
+            insert(&mut file, 0, i as f64);
+            file.store().unwrap();
+        }
+        // the outdated entries are not enough for rewriting the file
+        assert!(std::fs::metadata(&path).unwrap().len() > 50 * size);
+
+        // pretend that the outdated entries take a lot of space
+        let file_len = file.file_len;
+        let live = file.slot(0).len;
+        assert!(file_len > 2 * live);
+        assert!(file_len <= 2 * live + MIN_COMPACTION_SIZE);
+        file.file = None;
+        file.num_slots = 0;
+        file.loaded_slots.clear();
+        insert(&mut file, 0, 100.0);
+        file.store().unwrap();
+        assert!(std::fs::metadata(&path).unwrap().len() < 2 * size);
+        assert_eq!(wall_time(&mut file, &key), Some(100.0));
+        assert_eq!(file.duration(&key.shape()), Some((5050.0, 101)));
+    }
+
+    #[test]
+    fn test_store_eviction() {
+        let tmpdir = tempfile::TempDir::new().unwrap();
+        let path = tmpdir.path().join("cache");
+        let mut file = CacheFile::load(path.clone()).unwrap();
+        let keys: Vec<_> = (0..10).map(|i| insert(&mut file, i, i as f64)).collect();
+        file.store().unwrap();
+        // pretend that all the entries have been used a long time ago
+        let f = OpenOptions::new().write(true).open(&path).unwrap();
+        for index in 0..file.num_slots {
+            let position = file.slots_start + index * SLOT_LEN + 24;
+            f.write_all_at(&0u64.to_le_bytes(), position as u64)
+                .unwrap();
+        }
+
+        // using the entries updates the index in place
+        let mut file = CacheFile::load(path.clone()).unwrap();
+        let size = std::fs::metadata(&path).unwrap().len();
+        for key in &keys[5..] {
+            assert!(wall_time(&mut file, key).is_some());
+        }
+        file.store().unwrap();
+        assert_eq!(std::fs::metadata(&path).unwrap().len(), size);
+
+        let mut file = CacheFile::load(path.clone()).unwrap();
+        let live_size: u64 = (0..file.num_slots).map(|i| file.slot(i).len).sum();
+        file.set_size_limits(live_size, live_size / 2);
+        let new_key = insert(&mut file, 10, 10.0);
+        file.store().unwrap();
+        assert!(file.num_slots >= 4 && file.num_slots <= 5);
+        for key in &keys[..5] {
+            assert_eq!(wall_time(&mut file, key), None);
+        }
+        assert_eq!(wall_time(&mut file, &new_key), Some(10.0));
+    }
+
+    #[test]
+    fn test_store_removed_key() {
+        let tmpdir = tempfile::TempDir::new().unwrap();
+        let path = tmpdir.path().join("cache");
+        let mut file = CacheFile::load(path.clone()).unwrap();
+        let keys: Vec<_> = (0..3).map(|i| insert(&mut file, i, i as f64)).collect();
+        file.store().unwrap();
+        file.get_mut(keys[1].clone()).clear();
+        file.store().unwrap();
+        assert_eq!(file.num_slots, 2);
+        assert_eq!(wall_time(&mut file, &keys[1]), None);
+        assert_eq!(wall_time(&mut file, &keys[2]), Some(2.0));
+    }
+
+    #[test]
+    fn test_load_interrupted_store() {
+        let tmpdir = tempfile::TempDir::new().unwrap();
+        let path = tmpdir.path().join("cache");
+        let mut file = CacheFile::load(path.clone()).unwrap();
+        let key = insert(&mut file, 0, 1.0);
+        file.store().unwrap();
+        // some entries written without updating the header
+        let mut f = OpenOptions::new().append(true).open(&path).unwrap();
+        f.write_all(b"half-written entry").unwrap();
+
+        let mut file = CacheFile::load(path).unwrap();
+        assert_eq!(wall_time(&mut file, &key), Some(1.0));
+    }
+
     #[test]
     fn test_load_reject_wrong_magic() {
         let tmpdir = tempfile::TempDir::new().unwrap();
@@ -0,0 +1,285 @@
+//! A compact, read-only representation of an `ExecutionDAGData`, for the DAGs with many executions.
+//!
+//! The DAG sent by the clients keys everything by UUID, and following the dependencies means
+//! hashing UUIDs and allocating the lists of files of each group over and over. A `CompactDAG`
+//! assigns a dense index to each execution group and to each file, and stores the links between
+//! them in flat arrays, so that visiting the DAG costs a few array lookups. The groups are kept
+//! behind an `Arc`, so that they can be shared (for example with the jobs sent to the workers)
+//! without cloning them. The UUIDs are still used at the boundary, to look up the indices.
+
+use std::collections::HashMap;
+use std::ops::Index;
+use std::sync::Arc;
+
+use serde::{Deserialize, Serialize};
+
+use crate::{
+    ExecutionDAGConfig, ExecutionDAGData, ExecutionGroup, ExecutionGroupUuid, FileUuid,
+    ProvidedFile,
+};
+
+/// The index of an execution group inside a `CompactDAG`.
+#[derive(Debug, Clone, Copy, PartialEq, Eq, PartialOrd, Ord, Hash, Serialize, Deserialize)]
+pub struct GroupId(u32);
+
+/// The index of a file inside a `CompactDAG`.
+#[derive(Debug, Clone, Copy, PartialEq, Eq, PartialOrd, Ord, Hash, Serialize, Deserialize)]
+pub struct FileId(u32);
+
+/// A list of items for each index, stored in a single array.
+#[derive(Debug, Clone)]
+struct Adjacency<T> {
+    /// The items of the index `i` are `items[offsets[i]..offsets[i + 1]]`.
+    offsets: Vec<u32>,
+    /// The items of all the indices, one after the other.
+    items: Vec<T>,
+}
+
+/// An `ExecutionDAGData` with dense indices for the groups and the files, see the module
+/// documentation.
+#[derive(Debug, Clone)]
+pub struct CompactDAG {
+    /// The configuration of the DAG.
+    pub config: ExecutionDAGConfig,
+    /// The execution groups, by their index.
+    groups: Vec<Arc<ExecutionGroup>>,
+    /// The index of each execution group.
+    group_ids: HashMap<ExecutionGroupUuid, GroupId>,
+    /// The UUIDs of the files, by their index.
+    files: Vec<FileUuid>,
+    /// The index of each file.
+    file_ids: HashMap<FileUuid, FileId>,
+    /// The files provided by the client.
+    provided: Vec<FileId>,
+    /// The distinct dependencies of each group.
+    inputs: Adjacency<FileId>,
+    /// The files produced by each group.
+    outputs: Adjacency<FileId>,
+    /// The groups that depend on each file.
+    consumers: Adjacency<GroupId>,
+}
+
+impl<T: Copy> Adjacency<T> {
+    /// Build the lists from the list of each index.
+    fn from_lists<I: IntoIterator<Item = Vec<T>>>(lists: I) -> Adjacency<T> {
+        let mut offsets = vec![0];
+        let mut items = vec![];
+        for list in lists {
+            items.extend(list);
+            offsets.push(items.len() as u32);
+        }
+        Adjacency { offsets, items }
+    }
+
+    /// The items of the index `index`.
+    fn get(&self, index: usize) -> &[T] {
+        &self.items[self.offsets[index] as usize..self.offsets[index + 1] as usize]
+    }
+}
+
+impl CompactDAG {
+    /// Build the compact representation of the DAG. The content of the provided files is not kept.
+    pub fn new(dag: ExecutionDAGData) -> CompactDAG {
+        CompactDAG::with_provided_files(dag).0
+    }
+
+    /// Build the compact representation of the DAG, returning with it the provided files, whose
+    /// content is not kept inside it.
+    pub fn with_provided_files(
+        dag: ExecutionDAGData,
+    ) -> (CompactDAG, HashMap<FileUuid, ProvidedFile>) {
+        let mut files = vec![];
+        let mut file_ids = HashMap::new();
+        let mut file_id = |uuid: FileUuid| {
+            *file_ids.entry(uuid).or_insert_with(|| {
+                files.push(uuid);
+                FileId(files.len() as u32 - 1)
+            })
+        };
+
+        let mut groups = Vec::with_capacity(dag.execution_groups.len());
+        let mut group_ids = HashMap::with_capacity(dag.execution_groups.len());
+        let mut inputs = Vec::with_capacity(dag.execution_groups.len());
+        let mut outputs = Vec::with_capacity(dag.execution_groups.len());
+        for (uuid, group) in dag.execution_groups {
+            let mut group_inputs: Vec<_> =
+                group.dependencies().into_iter().map(&mut file_id).collect();
+            group_inputs.sort_unstable();
+            group_inputs.dedup();
+            inputs.push(group_inputs);
+            outputs.push(group.outputs().into_iter().map(&mut file_id).collect());
+            group_ids.insert(uuid, GroupId(groups.len() as u32));
+            groups.push(Arc::new(group));
+        }
+        let provided = dag
+            .provided_files
+            .keys()
+            .copied()
+            .map(&mut file_id)
+            .collect();
+
+        let mut consumers = vec![vec![]; files.len()];
+        for (group, group_inputs) in inputs.iter().enumerate() {
+            for file in group_inputs {
+                consumers[file.0 as usize].push(GroupId(group as u32));
+            }
+        }
+        let compact = CompactDAG {
+            config: dag.config,
+            groups,
+            group_ids,
+            files,
+            file_ids,
+            provided,
+            inputs: Adjacency::from_lists(inputs),
+            outputs: Adjacency::from_lists(outputs),
+            consumers: Adjacency::from_lists(consumers),
+        };
+        (compact, dag.provided_files)
+    }
+
+    /// The number of execution groups.
+    pub fn num_groups(&self) -> usize {
+        self.groups.len()
+    }
+
+    /// The number of distinct files used or produced by the groups, or provided by the client.
+    pub fn num_files(&self) -> usize {
+        self.files.len()
+    }
+
+    /// The index of the execution group with this UUID, if it's in the DAG.
+    pub fn group_id(&self, uuid: &ExecutionGroupUuid) -> Option<GroupId> {
+        self.group_ids.get(uuid).copied()
+    }
+
+    /// The execution group with this UUID, if it's in the DAG.
+    pub fn get(&self, uuid: &ExecutionGroupUuid) -> Option<&Arc<ExecutionGroup>> {
+        self.group_id(uuid).map(|id| self.group(id))
+    }
+
+    /// The execution group with this index.
+    pub fn group(&self, id: GroupId) -> &Arc<ExecutionGroup> {
+        &self.groups[id.0 as usize]
+    }
+
+    /// A mutable reference to the execution group with this UUID, cloning it if it's shared.
+    pub fn get_mut(&mut self, uuid: &ExecutionGroupUuid) -> Option<&mut ExecutionGroup> {
+        let id = self.group_id(uuid)?;
+        Some(Arc::make_mut(&mut self.groups[id.0 as usize]))
+    }
+
+    /// The execution groups with their indices.
+    pub fn groups(&self) -> impl Iterator<Item = (GroupId, &Arc<ExecutionGroup>)> {
+        self.groups
+            .iter()
+            .enumerate()
+            .map(|(index, group)| (GroupId(index as u32), group))
+    }
+
+    /// The index of the file with this UUID, if it's in the DAG.
+    pub fn file_id(&self, uuid: &FileUuid) -> Option<FileId> {
+        self.file_ids.get(uuid).copied()
+    }
+
+    /// The UUID of the file with this index.
+    pub fn file_uuid(&self, id: FileId) -> FileUuid {
+        self.files[id.0 as usize]
+    }
+
+    /// The files provided by the client.
+    pub fn provided_files(&self) -> &[FileId] {
+        &self.provided
+    }
+
+    /// The distinct dependencies of the group, including `stdin`.
+    pub fn inputs(&self, group: GroupId) -> &[FileId] {
+        self.inputs.get(group.0 as usize)
+    }
+
+    /// The files produced by the group, including `stdout` and `stderr`.
+    pub fn outputs(&self, group: GroupId) -> &[FileId] {
+        self.outputs.get(group.0 as usize)
+    }
+
+    /// The groups that depend on the file.
+    pub fn consumers(&self, file: FileId) -> &[GroupId] {
+        self.consumers.get(file.0 as usize)
+    }
+
+    /// The groups that depend on a file produced by the group, possibly repeated.
+    pub fn successors(&self, group: GroupId) -> impl Iterator<Item = GroupId> + '_ {
+        self.outputs(group)
+            .iter()
+            .flat_map(|file| self.consumers(*file).iter().copied())
+    }
+}
+
+impl GroupId {
+    /// The index as a `usize`, for indexing the vectors with an item for each group.
+    pub fn index(self) -> usize {
+        self.0 as usize
+    }
+}
+
+impl FileId {
+    /// The index as a `usize`, for indexing the vectors with an item for each file.
+    pub fn index(self) -> usize {
+        self.0 as usize
+    }
+}
+
+impl Index<&ExecutionGroupUuid> for CompactDAG {
+    type Output = Arc<ExecutionGroup>;
+
+    fn index(&self, uuid: &ExecutionGroupUuid) -> &Self::Output {
+        self.get(uuid)
+            .unwrap_or_else(|| panic!("Unknown execution group {uuid}"))
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use crate::{Execution, ExecutionCommand, ExecutionDAG, File};
+
+    use super::*;
+
+    #[test]
+    fn test_compact_dag() {
+        let mut dag = ExecutionDAG::new();
+        let provided = File::new("provided");
+        dag.provide_content(provided.clone(), vec![1, 2, 3]);
+        let mut gen = Execution::new("gen", ExecutionCommand::local("gen"));
+        gen.input(&provided, "provided", false);
+        let input = gen.output("input.txt");
+        let mut sol = Execution::new("sol", ExecutionCommand::local("sol"));
+        sol.input(&input, "input.txt", false)
+            .input(&input, "again.txt", false)
+            .input(&provided, "provided", false);
+        let output = sol.stdout();
+        let gen = dag.add_execution(gen);
+        let sol = dag.add_execution(sol);
+
+        let compact = CompactDAG::new(dag.data);
+        assert_eq!(compact.num_groups(), 2);
+        assert_eq!(compact.num_files(), 3);
+        let gen_id = compact.group_id(&gen).unwrap();
+        let sol_id = compact.group_id(&sol).unwrap();
+        assert_eq!(compact[&sol].description, "sol");
+        let file = |uuid| compact.file_id(&uuid).unwrap();
+        assert_eq!(compact.provided_files(), &[file(provided.uuid)]);
+        assert_eq!(compact.outputs(gen_id), &[file(input.uuid)]);
+        assert_eq!(compact.outputs(sol_id), &[file(output.uuid)]);
+        // the same file used twice is a single dependency
+        assert_eq!(compact.inputs(sol_id).len(), 2);
+        let mut consumers = compact.consumers(file(provided.uuid)).to_vec();
+        consumers.sort();
+        let mut expected = vec![gen_id, sol_id];
+        expected.sort();
+        assert_eq!(consumers, expected);
+        assert_eq!(compact.successors(gen_id).collect::<Vec<_>>(), vec![sol_id]);
+        assert_eq!(compact.successors(sol_id).count(), 0);
+        assert_eq!(compact.file_uuid(file(output.uuid)), output.uuid);
+        assert!(compact.get(&provided.uuid).is_none());
+    }
+}
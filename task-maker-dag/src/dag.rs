@@ -1,5 +1,6 @@
 use std::collections::{HashMap, HashSet};
 use std::path::PathBuf;
+use std::sync::{Arc, Mutex};
 
 use anyhow::{bail, Context, Error};
 use serde::{Deserialize, Serialize};
@@ -41,6 +42,26 @@ pub struct ExecutionDAGConfig {
     pub copy_logs: bool,
     /// Priority of this DAG.
     pub priority: DagPriority,
+    /// Whether to run first the executions with the longest chain of executions after them,
+    /// estimating their duration from the previous runs, instead of following only their
+    /// priority.
+    pub critical_path: bool,
+    /// The share of the workers of a remote executor this DAG is entitled to, relative to the
+    /// other DAGs with the same priority.
+    pub fair_share: f64,
+    /// How many more times the executions whose CPU time is close to their limit are run, for
+    /// measuring it better. The result of the run with the median time is kept.
+    pub timing_reruns: usize,
+    /// How close to the limit the CPU time must be for running the execution again, as a fraction
+    /// of the limit.
+    pub timing_margin: f64,
+    /// Whether to measure the instructions and the cycles of the sandboxed processes with the
+    /// hardware performance counters, where the host supports them. They are always measured for
+    /// the executions with a limit on the instructions.
+    pub hardware_counters: bool,
+    /// Only estimate the cost of evaluating this DAG from the cache of the executor, without
+    /// running any execution. The evaluation ends as soon as the estimate is sent to the client.
+    pub estimate_only: bool,
 }
 
 /// A wrapper around a `File` provided by the client, this means that the client knows the
@@ -90,8 +111,17 @@ pub struct ExecutionDAGCallbacks {
     /// others will be sent at the end of the evaluation. Note that sending big files during the
     /// evaluation can cause performance degradations.
     pub urgent_files: HashSet<FileUuid>,
+    /// The executions the callbacks asked to skip.
+    pub skipper: ExecutionSkipper,
 }
 
+/// A handle the callbacks can use for asking to skip some executions of the DAG, for example when
+/// their results are not needed anymore. The executions that haven't started yet are skipped, like
+/// the ones whose dependencies failed, and so are the executions depending on them. The ones
+/// already started complete as usual.
+#[derive(Debug, Clone, Default)]
+pub struct ExecutionSkipper(Arc<Mutex<Vec<ExecutionGroupUuid>>>);
+
 /// A computation DAG, this is not serializable because it contains the callbacks of the client.
 #[derive(Debug)]
 pub struct ExecutionDAG {
@@ -117,6 +147,7 @@ impl ExecutionDAG {
                 execution_callbacks: HashMap::new(),
                 file_callbacks: HashMap::new(),
                 urgent_files: HashSet::new(),
+                skipper: ExecutionSkipper::default(),
             }),
         }
     }
@@ -128,7 +159,7 @@ impl ExecutionDAG {
             file.uuid,
             ProvidedFile::LocalFile {
                 file,
-                key: FileStoreKey::from_file(&path)
+                key: FileStoreKey::from_file_memo(&path)
                     .with_context(|| format!("Failed to compute file key of {}", path.display()))?,
                 local_path: path,
             },
@@ -321,6 +352,27 @@ impl ExecutionDAG {
     pub fn urgent_files(&mut self) -> &mut HashSet<FileUuid> {
         &mut self.callbacks.as_mut().unwrap().urgent_files
     }
+
+    /// Get a handle for asking to skip some executions during the evaluation.
+    pub fn skipper(&self) -> ExecutionSkipper {
+        self.callbacks
+            .as_ref()
+            .expect("Cannot change callbacks after cloning")
+            .skipper
+            .clone()
+    }
+}
+
+impl ExecutionSkipper {
+    /// Ask to skip the execution, if it hasn't started yet.
+    pub fn skip(&self, execution: ExecutionGroupUuid) {
+        self.0.lock().unwrap().push(execution);
+    }
+
+    /// Take the executions asked to be skipped since the last call.
+    pub fn take(&self) -> Vec<ExecutionGroupUuid> {
+        std::mem::take(&mut *self.0.lock().unwrap())
+    }
 }
 
 impl Clone for ExecutionDAG {
@@ -346,6 +398,12 @@ impl ExecutionDAGConfig {
             copy_exe: false,
             copy_logs: false,
             priority: 0,
+            critical_path: false,
+            fair_share: 1.0,
+            timing_reruns: 0,
+            timing_margin: 0.1,
+            hardware_counters: false,
+            estimate_only: false,
         }
     }
 
@@ -397,6 +455,60 @@ impl ExecutionDAGConfig {
         self.priority = priority;
         self
     }
+
+    /// Set whether to schedule first the executions on the longest chain of remaining executions.
+    pub fn critical_path(&mut self, critical_path: bool) -> &mut Self {
+        self.critical_path = critical_path;
+        self
+    }
+
+    /// Set the share of the workers of a remote executor this DAG is entitled to.
+    pub fn fair_share(&mut self, fair_share: f64) -> &mut Self {
+        self.fair_share = fair_share;
+        self
+    }
+
+    /// Run `reruns` more times the executions whose CPU time is within `margin` (a fraction) of
+    /// their limit.
+    pub fn timing_reruns(&mut self, reruns: usize, margin: f64) -> &mut Self {
+        assert!(margin >= 0.0);
+        self.timing_reruns = reruns;
+        self.timing_margin = margin;
+        self
+    }
+
+    /// Set whether to measure the hardware counters of the sandboxed processes.
+    pub fn hardware_counters(&mut self, hardware_counters: bool) -> &mut Self {
+        self.hardware_counters = hardware_counters;
+        self
+    }
+
+    /// Set whether to only estimate the cost of the DAG, without running it.
+    pub fn estimate_only(&mut self, estimate_only: bool) -> &mut Self {
+        self.estimate_only = estimate_only;
+        self
+    }
+
+    /// Whether the group, that got these results, should be run again for measuring its time
+    /// better. Only the groups with a single execution are run again, when its CPU time is close to
+    /// the limit and it was not already run enough times.
+    pub fn needs_timing_reruns(&self, group: &ExecutionGroup, results: &[ExecutionResult]) -> bool {
+        let (Some(execution), Some(result)) = (group.executions.first(), results.first()) else {
+            return false;
+        };
+        let Some(limit) = execution.limits.cpu_time else {
+            return false;
+        };
+        // the verdict on the instructions doesn't depend on the load of the machine
+        if execution.limits.instructions.is_some() && result.resources.counters.is_some() {
+            return false;
+        }
+        let runs = result.timing.as_ref().map_or(1, |timing| timing.runs);
+        self.timing_reruns > 0
+            && group.executions.len() == 1
+            && runs <= self.timing_reruns
+            && (result.resources.cpu_time - limit).abs() <= limit * self.timing_margin
+    }
 }
 
 impl Default for ExecutionDAGConfig {
@@ -626,6 +738,15 @@ mod tests {
         assert!(dag.callbacks.unwrap().urgent_files.contains(&file.uuid));
     }
 
+    #[test]
+    fn test_skipper() {
+        let dag = ExecutionDAG::new();
+        let exec = Execution::new("exec", ExecutionCommand::local("foo")).into_group();
+        dag.skipper().skip(exec.uuid);
+        assert_eq!(dag.skipper().take(), vec![exec.uuid]);
+        assert!(dag.skipper().take().is_empty());
+    }
+
     #[test]
     fn test_cache_mode_try_from() {
         assert_eq!(
@@ -642,4 +763,41 @@ mod tests {
         );
         assert!(CacheMode::try_from(&Some(Some("tag1".to_string())), &[]).is_err());
     }
+
+    #[test]
+    fn test_needs_timing_reruns() {
+        let mut exec = Execution::new("exec", ExecutionCommand::local("foo"));
+        exec.limits_mut().cpu_time(1.0);
+        let group = exec.into_group();
+        let result = |cpu_time, runs| ExecutionResult {
+            resources: ExecutionResourcesUsage {
+                cpu_time,
+                ..Default::default()
+            },
+            timing: runs,
+            ..Default::default()
+        };
+        let timing = |runs| {
+            Some(TimingStats {
+                runs,
+                min: 0.9,
+                median: 0.95,
+                max: 1.0,
+            })
+        };
+
+        let mut config = ExecutionDAGConfig::new();
+        assert!(!config.needs_timing_reruns(&group, &[result(0.95, None)]));
+        config.timing_reruns(2, 0.1);
+        assert!(config.needs_timing_reruns(&group, &[result(0.95, None)]));
+        assert!(config.needs_timing_reruns(&group, &[result(1.05, None)]));
+        assert!(!config.needs_timing_reruns(&group, &[result(0.5, None)]));
+        assert!(!config.needs_timing_reruns(&group, &[result(1.5, None)]));
+        // already run enough times, e.g. when it comes from the cache
+        assert!(config.needs_timing_reruns(&group, &[result(0.95, timing(2))]));
+        assert!(!config.needs_timing_reruns(&group, &[result(0.95, timing(3))]));
+
+        let group = Execution::new("exec", ExecutionCommand::local("foo")).into_group();
+        assert!(!config.needs_timing_reruns(&group, &[result(0.95, None)]));
+    }
 }
@@ -63,6 +63,68 @@ pub enum ExecutionCommand {
         /// Key-value pairs for sys.inputs for the compilation.
         inputs: Vec<(String, String)>,
     },
+    /// Whitespace-insensitive comparison of two input files, done unsandboxed by task-maker
+    /// itself. Like `diff --ignore-blank-lines --ignore-space-change`, the execution succeeds if
+    /// the files match and exits with return code 1 otherwise.
+    WhiteDiff {
+        /// Path of the first input file to compare.
+        correct: PathBuf,
+        /// Path of the second input file to compare.
+        test: PathBuf,
+    },
+    /// Token by token comparison of two input files, done unsandboxed by task-maker itself. The
+    /// tokens are the sequences of non-whitespace characters, compared with the rules in
+    /// `options`. The execution succeeds if the files match and exits with return code 1
+    /// otherwise.
+    TokenDiff {
+        /// Path of the first input file to compare.
+        correct: PathBuf,
+        /// Path of the second input file to compare.
+        test: PathBuf,
+        /// How the tokens are compared.
+        options: TokenDiffOptions,
+    },
+}
+
+/// How the tokens are compared by an `ExecutionCommand::TokenDiff`.
+#[derive(Debug, Clone, Copy, Default, Serialize, Deserialize)]
+pub struct TokenDiffOptions {
+    /// Whether the letters are compared ignoring the case.
+    #[serde(default)]
+    pub ignore_case: bool,
+    /// The maximum absolute difference between two tokens that are both numbers. When neither
+    /// this nor `relative_tolerance` is set, the numbers are compared as the other tokens.
+    #[serde(default)]
+    pub absolute_tolerance: Option<f64>,
+    /// The maximum difference between two tokens that are both numbers, relative to the correct
+    /// one.
+    #[serde(default)]
+    pub relative_tolerance: Option<f64>,
+}
+
+impl TokenDiffOptions {
+    /// The fields of the options, with the floats as bits so that they can be compared and hashed.
+    fn key(&self) -> (bool, Option<u64>, Option<u64>) {
+        (
+            self.ignore_case,
+            self.absolute_tolerance.map(f64::to_bits),
+            self.relative_tolerance.map(f64::to_bits),
+        )
+    }
+}
+
+impl PartialEq for TokenDiffOptions {
+    fn eq(&self, other: &Self) -> bool {
+        self.key() == other.key()
+    }
+}
+
+impl Eq for TokenDiffOptions {}
+
+impl std::hash::Hash for TokenDiffOptions {
+    fn hash<H: std::hash::Hasher>(&self, state: &mut H) {
+        self.key().hash(state);
+    }
 }
 
 /// An input file of an [`Execution`](struct.Execution.html), can be marked as executable if it has
@@ -73,6 +135,10 @@ pub struct ExecutionInput {
     pub file: FileUuid,
     /// Whether this file should be marked as executable.
     pub executable: bool,
+    /// Whether the execution should run even if this file fails, getting an empty file in its
+    /// place. See [`Execution::optional_input`].
+    #[serde(default)]
+    pub optional: bool,
 }
 
 /// The callbacks to be called when an event of an execution occurs.
@@ -238,6 +304,10 @@ pub struct ExecutionLimits {
     /// Do not filter syscalls. This is necessary for running 32-bit executables on 64-bit systems
     /// and implies allow_multiprocess and !read_only.
     pub permissive: bool,
+    /// Limit on the number of instructions the process can retire in user space. It's checked
+    /// only when the hardware counters are available, and then it's used instead of the CPU time
+    /// limit for the verdict.
+    pub instructions: Option<u64>,
 }
 
 /// Status of a completed [`Execution`](struct.Execution.html).
@@ -276,6 +346,19 @@ pub struct ExecutionResourcesUsage {
     pub wall_time: f64,
     /// Number of KiB used _at most_ by the process.
     pub memory: u64,
+    /// The hardware counters of the process, if they were requested and the host supports them.
+    #[serde(default)]
+    pub counters: Option<HardwareCounters>,
+}
+
+/// The values of the hardware performance counters of a process, measured only in user space.
+/// Unlike the CPU time they don't depend on the load or on the frequency of the machine.
+#[derive(Debug, Clone, Copy, Serialize, Deserialize, PartialEq, Eq, Default)]
+pub struct HardwareCounters {
+    /// Number of instructions retired.
+    pub instructions: u64,
+    /// Number of CPU cycles.
+    pub cycles: u64,
 }
 
 /// The result of an [`Execution`](struct.Execution.html).
@@ -293,6 +376,23 @@ pub struct ExecutionResult {
     pub stdout: Option<Vec<u8>>,
     /// Captured standard error of the execution, if the capture was requested.
     pub stderr: Option<Vec<u8>>,
+    /// The CPU times of the runs, if the execution was run more than once because its time was
+    /// close to the limit.
+    pub timing: Option<TimingStats>,
+}
+
+/// The CPU times of the runs of an execution, see
+/// [`ExecutionDAGConfig::timing_reruns`](struct.ExecutionDAGConfig.html#structfield.timing_reruns).
+#[derive(Debug, Clone, Serialize, Deserialize, PartialEq)]
+pub struct TimingStats {
+    /// The number of runs, including the first one.
+    pub runs: usize,
+    /// The minimum CPU time, in seconds.
+    pub min: f64,
+    /// The median CPU time, in seconds. The result of the execution is the one of this run.
+    pub median: f64,
+    /// The maximum CPU time, in seconds.
+    pub max: f64,
 }
 
 impl ExecutionLimits {
@@ -314,6 +414,7 @@ impl ExecutionLimits {
             mount_proc: true,
             extra_readable_dirs: Vec::new(),
             permissive: true,
+            instructions: None,
         }
     }
 
@@ -341,6 +442,12 @@ impl ExecutionLimits {
         self
     }
 
+    /// Set the limit on the number of instructions retired in user space.
+    pub fn instructions(&mut self, limit: u64) -> &mut Self {
+        self.instructions = Some(limit);
+        self
+    }
+
     /// Allow multiple processes.
     pub fn allow_multiprocess(&mut self) -> &mut Self {
         self.allow_multiprocess = true;
@@ -422,6 +529,7 @@ impl Default for ExecutionLimits {
             mount_proc: false,
             extra_readable_dirs: Vec::new(),
             permissive: false,
+            instructions: None,
         }
     }
 }
@@ -580,6 +688,28 @@ impl Execution {
             ExecutionInput {
                 file: file.into(),
                 executable,
+                optional: false,
+            },
+        );
+        self
+    }
+
+    /// Bind a file inside the sandbox to the specified file, like [`Execution::input`], but
+    /// without skipping the execution when the file fails: in that case the sandbox gets an empty
+    /// file in its place. Useful for the executions that process the outputs of many other
+    /// executions and don't need all of them to succeed.
+    pub fn optional_input<F: Into<FileUuid>, P: Into<PathBuf>>(
+        &mut self,
+        file: F,
+        path: P,
+        executable: bool,
+    ) -> &mut Self {
+        self.input_files.insert(
+            path.into(),
+            ExecutionInput {
+                file: file.into(),
+                executable,
+                optional: true,
             },
         );
         self
@@ -656,8 +786,18 @@ impl Execution {
     ) -> ExecutionStatus {
         // it's important to check those before the signals because exceeding those
         // limits may trigger a SIGKILL from the sandbox
+        let instructions = resources.counters.map(|counters| counters.instructions);
+        let instruction_limit = self.limits.instructions.zip(instructions);
+        if let Some((limit, instructions)) = instruction_limit {
+            if instructions > limit {
+                return ExecutionStatus::TimeLimitExceeded;
+            }
+        }
         if let Some(cpu_time_limit) = self.limits.cpu_time {
-            if resources.cpu_time > cpu_time_limit {
+            // with the instructions counted the CPU time matters only if the process didn't exit
+            // by itself, since it may have been killed by the sandbox
+            let checked = instruction_limit.is_none() || *status != ExecutionStatus::Success;
+            if checked && resources.cpu_time > cpu_time_limit {
                 return ExecutionStatus::TimeLimitExceeded;
             }
         }
@@ -718,6 +858,7 @@ impl std::fmt::Debug for ExecutionResult {
                     .as_ref()
                     .map(|s| String::from_utf8_lossy(s).to_string()),
             )
+            .field("timing", &self.timing)
             .finish()
     }
 }
@@ -742,6 +883,7 @@ mod tests {
                 sys_time: 0.0,
                 wall_time: 0.0,
                 memory: 0,
+                counters: None,
             },
         );
         assert_eq!(ExecutionStatus::Success, status);
@@ -758,11 +900,43 @@ mod tests {
                 sys_time: 0.0,
                 wall_time: 0.0,
                 memory: 0,
+                counters: None,
             },
         );
         assert_eq!(ExecutionStatus::TimeLimitExceeded, status);
     }
 
+    #[test]
+    fn test_status_instructions() {
+        let mut exec = Execution::new("foo", ExecutionCommand::local("foo"));
+        exec.limits_mut().cpu_time(1.0).instructions(1000);
+        let resources = |cpu_time, instructions| ExecutionResourcesUsage {
+            cpu_time,
+            sys_time: 0.0,
+            wall_time: 0.0,
+            memory: 0,
+            counters: Some(HardwareCounters {
+                instructions,
+                cycles: 0,
+            }),
+        };
+        let status = exec.status(&ExecutionStatus::Success, &resources(0.5, 1001));
+        assert_eq!(ExecutionStatus::TimeLimitExceeded, status);
+        // the CPU time is not used for the verdict when the instructions are counted
+        let status = exec.status(&ExecutionStatus::Success, &resources(1.1, 1000));
+        assert_eq!(ExecutionStatus::Success, status);
+        let status = exec.status(
+            &ExecutionStatus::Signal(9, "Killed".into()),
+            &resources(1.1, 1000),
+        );
+        assert_eq!(ExecutionStatus::TimeLimitExceeded, status);
+        // without the counters the CPU time limit is used
+        let mut no_counters = resources(1.1, 0);
+        no_counters.counters = None;
+        let status = exec.status(&ExecutionStatus::Success, &no_counters);
+        assert_eq!(ExecutionStatus::TimeLimitExceeded, status);
+    }
+
     #[test]
     fn test_status_sys_time() {
         let mut exec = Execution::new("foo", ExecutionCommand::local("foo"));
@@ -774,6 +948,7 @@ mod tests {
                 sys_time: 1.1,
                 wall_time: 0.0,
                 memory: 0,
+                counters: None,
             },
         );
         assert_eq!(ExecutionStatus::SysTimeLimitExceeded, status);
@@ -790,6 +965,7 @@ mod tests {
                 sys_time: 0.0,
                 wall_time: 1.1,
                 memory: 0,
+                counters: None,
             },
         );
         assert_eq!(ExecutionStatus::WallTimeLimitExceeded, status);
@@ -806,6 +982,7 @@ mod tests {
                 sys_time: 0.0,
                 wall_time: 0.0,
                 memory: 1235,
+                counters: None,
             },
         );
         assert_eq!(ExecutionStatus::MemoryLimitExceeded, status);
@@ -821,6 +998,7 @@ mod tests {
                 sys_time: 0.0,
                 wall_time: 0.0,
                 memory: 0,
+                counters: None,
             },
         );
         assert_eq!(ExecutionStatus::Signal(11, "Killed".into()), status);
@@ -836,6 +1014,7 @@ mod tests {
                 sys_time: 0.0,
                 wall_time: 0.0,
                 memory: 0,
+                counters: None,
             },
         );
         assert_eq!(ExecutionStatus::ReturnCode(1), status);
@@ -27,6 +27,17 @@ pub struct Fifo {
     pub uuid: FifoUuid,
 }
 
+/// A file of a fixed size, filled with zeros, that the executions of a group can map in memory to
+/// share it. It's placed in the same directory of the FIFOs, and its UUID is unique inside the same
+/// `ExecutionGroup`, together with the ones of the FIFOs.
+#[derive(Debug, Clone, Copy, Serialize, Deserialize)]
+pub struct SharedMemory {
+    /// The UUID of this `SharedMemory`.
+    pub uuid: FifoUuid,
+    /// The size of the file, in bytes.
+    pub size: u64,
+}
+
 /// Settings for execution groups that use a controller.
 #[derive(Debug, Clone, Serialize, Deserialize, Copy)]
 pub struct ControllerSettings {
@@ -49,6 +60,8 @@ pub struct ExecutionGroup {
     pub executions: Vec<Execution>,
     /// The list of FIFO pipes to create for this group.
     pub fifo: Vec<Fifo>,
+    /// The list of shared memory files to create for this group.
+    pub shared_memory: Vec<SharedMemory>,
     /// The configuration of the underlying DAG. Will be overwritten by
     /// `ExecutionDAG.add_execution`.
     pub config: ExecutionDAGConfig,
@@ -83,6 +96,21 @@ impl Fifo {
     }
 }
 
+impl SharedMemory {
+    /// Make a new `SharedMemory` of the specified size with a random uuid.
+    fn new(size: u64) -> SharedMemory {
+        SharedMemory {
+            uuid: Uuid::new_v4(),
+            size,
+        }
+    }
+
+    /// The path inside the sandbox that this file is mapped to.
+    pub fn sandbox_path(&self) -> PathBuf {
+        Path::new(FIFO_SANDBOX_DIR).join(self.uuid.to_string())
+    }
+}
+
 impl ExecutionGroup {
     /// Create an empty execution group.
     pub fn new<S: Into<String>>(descr: S) -> ExecutionGroup {
@@ -91,6 +119,7 @@ impl ExecutionGroup {
             description: descr.into(),
             executions: vec![],
             fifo: vec![],
+            shared_memory: vec![],
             config: ExecutionDAGConfig::new(),
             priority: Priority::default(),
             tag: None,
@@ -111,6 +140,13 @@ impl ExecutionGroup {
         fifo
     }
 
+    /// Create a new `SharedMemory` of the specified size, in bytes, and return it.
+    pub fn new_shared_memory(&mut self, size: u64) -> SharedMemory {
+        let shared_memory = SharedMemory::new(size);
+        self.shared_memory.push(shared_memory);
+        shared_memory
+    }
+
     /// List of all the [File](struct.File.html) dependencies of the execution
     /// group, including `stdin`.
     pub fn dependencies(&self) -> Vec<FileUuid> {
@@ -126,6 +162,26 @@ impl ExecutionGroup {
         deps
     }
 
+    /// Whether the execution group can run even if the file fails: it's used only as an optional
+    /// input (see [`Execution::optional_input`]).
+    pub fn is_optional_dependency(&self, file: FileUuid) -> bool {
+        let mut used = false;
+        for exec in &self.executions {
+            if matches!(exec.stdin, ExecutionInputBehaviour::File(stdin) if stdin == file) {
+                return false;
+            }
+            for input in exec.input_files.values() {
+                if input.file == file {
+                    if !input.optional {
+                        return false;
+                    }
+                    used = true;
+                }
+            }
+        }
+        used
+    }
+
     /// List of all the [File](struct.File.html) produced by the execution
     /// group, including `stdout` and `stderr`.
     pub fn outputs(&self) -> Vec<FileUuid> {
@@ -44,11 +44,13 @@
 #[macro_use]
 extern crate approx;
 
+mod compact;
 mod dag;
 mod execution;
 mod execution_group;
 mod file;
 
+pub use compact::*;
 pub use dag::*;
 pub use execution::*;
 pub use execution_group::*;
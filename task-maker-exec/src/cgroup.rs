@@ -0,0 +1,215 @@
+//! Accounting and limits of the memory of the sandboxes with the cgroups v2.
+//!
+//! The memory reported by the sandbox is the peak resident set size of the process: it misses the
+//! other processes and threads of the program. With a cgroup root each sandbox gets its own
+//! cgroup, created by the worker. The sandbox process joins it just before spawning the program,
+//! so all the processes of the program are inside it: the memory limit is enforced on all of them
+//! together with `memory.max`. The memory the sandbox process used before joining stays charged to
+//! its previous cgroup, so only the program is counted.
+//!
+//! The memory reported is the peak of the anonymous memory of the cgroup, the `anon` entry of
+//! `memory.stat`, sampled while the program runs, and never less than the peak resident set size
+//! of the process. `memory.peak` is not used since it also counts the page cache, so a program
+//! writing a large output would be reported as using the size of the output. The page cache of
+//! the files on disk is reclaimed before hitting `memory.max`, but the outputs of a sandbox on a
+//! tmpfs are not reclaimable and still count toward the limit.
+//!
+//! The root must be a directory of the cgroup v2 hierarchy that the user running the sandboxes can
+//! write, with the memory controller available and without processes, for example one created by
+//! root and then given to the user with `chown -R`. Since moving a process to another cgroup needs
+//! the permission on their common ancestor, task-maker itself must run in a cgroup inside the root,
+//! like `<root>/main`.
+//!
+//! The cgroups of the controllers of the interactive tasks are not supported: those sandboxes still
+//! use the limits of the sandbox.
+
+use std::fs;
+use std::path::{Path, PathBuf};
+use std::sync::atomic::{AtomicBool, Ordering};
+use std::time::Duration;
+
+use anyhow::{bail, Context, Error};
+use uuid::Uuid;
+
+/// The argument of `internal-sandbox` followed by the path of the cgroup to join.
+pub const CGROUP_ARG: &str = "--cgroup";
+
+/// How often the anonymous memory of the cgroup is sampled while the program runs.
+const ANON_SAMPLE_INTERVAL: Duration = Duration::from_millis(10);
+
+/// The directory of the cgroup hierarchy where the cgroups of the sandboxes are created.
+#[derive(Debug, Clone)]
+pub struct CgroupRoot {
+    /// The path of the directory.
+    path: PathBuf,
+}
+
+/// The cgroup of a sandbox, removed when dropped after killing what's still running inside.
+#[derive(Debug)]
+pub struct SandboxCgroup {
+    /// The path of the cgroup.
+    path: PathBuf,
+}
+
+/// The cgroup joined by the sandbox process.
+#[derive(Debug)]
+pub struct JoinedCgroup {
+    /// The path of the cgroup.
+    path: PathBuf,
+}
+
+impl CgroupRoot {
+    /// Use the cgroup at `path` as the root of the cgroups of the sandboxes, enabling the memory
+    /// controller for its children.
+    pub fn new<P: Into<PathBuf>>(path: P) -> Result<CgroupRoot, Error> {
+        let path = path.into();
+        let controllers = fs::read_to_string(path.join("cgroup.controllers"))
+            .with_context(|| format!("{} is not a cgroup v2 directory", path.display()))?;
+        if !controllers.split_whitespace().any(|c| c == "memory") {
+            bail!(
+                "The memory controller is not available in the cgroup {}",
+                path.display()
+            );
+        }
+        let subtree_control = path.join("cgroup.subtree_control");
+        let enabled = fs::read_to_string(&subtree_control)
+            .with_context(|| format!("Failed to read {}", subtree_control.display()))?;
+        if !enabled.split_whitespace().any(|c| c == "memory") {
+            fs::write(&subtree_control, "+memory").with_context(|| {
+                format!(
+                    "Failed to enable the memory controller in {}",
+                    path.display()
+                )
+            })?;
+        }
+        Ok(CgroupRoot { path })
+    }
+
+    /// Create the cgroup of a new sandbox.
+    pub fn create(&self) -> Result<SandboxCgroup, Error> {
+        let path = self.path.join(format!("sandbox-{}", Uuid::new_v4()));
+        fs::create_dir(&path)
+            .with_context(|| format!("Failed to create the cgroup {}", path.display()))?;
+        let cgroup = SandboxCgroup { path };
+        // with the swap the program could use more memory than the limit
+        let swap_max = cgroup.path.join("memory.swap.max");
+        if swap_max.exists() {
+            fs::write(&swap_max, "0")
+                .with_context(|| format!("Failed to write {}", swap_max.display()))?;
+        }
+        Ok(cgroup)
+    }
+}
+
+impl SandboxCgroup {
+    /// The path of the cgroup, to pass to the sandbox after `CGROUP_ARG`.
+    pub fn path(&self) -> &Path {
+        &self.path
+    }
+}
+
+impl Drop for SandboxCgroup {
+    fn drop(&mut self) {
+        // the processes left running by the program would keep the cgroup busy
+        let _ = fs::write(self.path.join("cgroup.kill"), "1");
+        for _ in 0..10 {
+            if fs::remove_dir(&self.path).is_ok() {
+                return;
+            }
+            std::thread::sleep(Duration::from_millis(10));
+        }
+        warn!("Failed to remove the cgroup {}", self.path.display());
+    }
+}
+
+impl JoinedCgroup {
+    /// Move this process inside the cgroup at `path`, limiting the memory of the processes that
+    /// will be spawned inside it to `memory_limit` bytes.
+    pub fn join<P: Into<PathBuf>>(
+        path: P,
+        memory_limit: Option<u64>,
+    ) -> Result<JoinedCgroup, Error> {
+        let path = path.into();
+        let memory_max = memory_limit.map_or_else(|| "max".to_string(), |limit| limit.to_string());
+        fs::write(path.join("memory.max"), memory_max)
+            .with_context(|| format!("Failed to set the memory limit of {}", path.display()))?;
+        fs::write(path.join("cgroup.procs"), "0")
+            .with_context(|| format!("Failed to join the cgroup {}", path.display()))?;
+        Ok(JoinedCgroup { path })
+    }
+
+    /// The anonymous memory currently used inside the cgroup, in bytes, without the page cache.
+    pub fn anon_memory(&self) -> Result<u64, Error> {
+        let stat = self.path.join("memory.stat");
+        let content = fs::read_to_string(&stat)
+            .with_context(|| format!("Failed to read {}", stat.display()))?;
+        let anon = content
+            .lines()
+            .find_map(|line| line.strip_prefix("anon "))
+            .with_context(|| format!("Missing anon in {}", stat.display()))?;
+        anon.trim()
+            .parse()
+            .with_context(|| format!("Invalid anon in {}: {anon:?}", stat.display()))
+    }
+
+    /// Sample the anonymous memory used inside the cgroup until `done` is set, returning the
+    /// maximum in bytes. The memory is sampled one last time after `done` is set. A peak shorter
+    /// than `ANON_SAMPLE_INTERVAL` may be missed.
+    pub fn anon_peak(&self, done: &AtomicBool) -> Result<u64, Error> {
+        let mut peak = 0;
+        loop {
+            let finished = done.load(Ordering::Acquire);
+            peak = peak.max(self.anon_memory()?);
+            if finished {
+                return Ok(peak);
+            }
+            std::thread::sleep(ANON_SAMPLE_INTERVAL);
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use tempfile::TempDir;
+
+    use super::*;
+
+    #[test]
+    fn test_cgroup_root() {
+        let dir = TempDir::new().unwrap();
+        assert!(CgroupRoot::new(dir.path()).is_err());
+
+        fs::write(dir.path().join("cgroup.controllers"), "cpu io\n").unwrap();
+        fs::write(dir.path().join("cgroup.subtree_control"), "").unwrap();
+        assert!(CgroupRoot::new(dir.path()).is_err());
+
+        fs::write(dir.path().join("cgroup.controllers"), "cpu memory io\n").unwrap();
+        CgroupRoot::new(dir.path()).unwrap();
+        let subtree_control = fs::read_to_string(dir.path().join("cgroup.subtree_control"));
+        assert_eq!(subtree_control.unwrap(), "+memory");
+    }
+
+    #[test]
+    fn test_anon_memory_without_page_cache() {
+        let dir = TempDir::new().unwrap();
+        let cgroup = JoinedCgroup {
+            path: dir.path().to_owned(),
+        };
+        assert!(cgroup.anon_memory().is_err());
+
+        // a program with a 32 MiB limit that wrote a 1 GiB output: the page cache is not counted
+        fs::write(dir.path().join("memory.peak"), "1090519040\n").unwrap();
+        fs::write(
+            dir.path().join("memory.stat"),
+            "anon 8388608\nfile 1073741824\nkernel 65536\nshmem 0\nfile_dirty 1073741824\n",
+        )
+        .unwrap();
+        assert_eq!(cgroup.anon_memory().unwrap(), 8 << 20);
+
+        let done = AtomicBool::new(true);
+        assert_eq!(cgroup.anon_peak(&done).unwrap(), 8 << 20);
+
+        fs::write(dir.path().join("memory.stat"), "file 1073741824\n").unwrap();
+        assert!(cgroup.anon_memory().is_err());
+    }
+}
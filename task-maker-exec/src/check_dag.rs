@@ -1,6 +1,4 @@
-use std::collections::{HashMap, HashSet, VecDeque};
-
-use task_maker_dag::{ExecutionDAGData, ExecutionGroupUuid, FifoUuid, FileUuid};
+use task_maker_dag::{CompactDAG, ExecutionGroupUuid, FifoUuid, FileUuid, GroupId};
 use thiserror::Error;
 
 use crate::executor::ExecutionDAGWatchSet;
@@ -35,7 +33,7 @@ pub enum DAGError {
         /// The duplicated UUID.
         uuid: FileUuid,
     },
-    /// There is a duplicate Fifo UUID.
+    /// There is a duplicate Fifo or SharedMemory UUID.
     #[error("duplicate FIFO UUID {uuid}")]
     DuplicateFifoUUID {
         /// The duplicated UUID.
@@ -55,118 +53,140 @@ pub enum DAGError {
     },
 }
 
+/// Where a file of the DAG comes from.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+enum FileSource {
+    /// Nothing produces the file.
+    Missing,
+    /// The file is provided by the client.
+    Provided,
+    /// The file is an output of the group.
+    Group(GroupId),
+}
+
 /// Validate the DAG checking if all the required pieces are present and they actually make a DAG.
 /// It's checked that no duplicated UUID are present, no files are missing, all the executions are
 /// reachable and no cycles are present.
-pub fn check_dag(dag: &ExecutionDAGData, callbacks: &ExecutionDAGWatchSet) -> Result<(), DAGError> {
-    let mut dependencies: HashMap<FileUuid, Vec<ExecutionGroupUuid>> = HashMap::new();
-    let mut num_dependencies: HashMap<ExecutionGroupUuid, usize> = HashMap::new();
-    let mut known_files: HashSet<FileUuid> = HashSet::new();
-    let mut known_execs: HashSet<ExecutionGroupUuid> = HashSet::new();
-    let mut ready_groups: VecDeque<ExecutionGroupUuid> = VecDeque::new();
-    let mut ready_files: VecDeque<FileUuid> = VecDeque::new();
-
-    let mut add_dependency = |file: FileUuid, group: ExecutionGroupUuid| {
-        dependencies.entry(file).or_default().push(group);
-    };
-
-    // add the executions and check for duplicated UUIDs
-    for (group_uuid, group) in dag.execution_groups.iter() {
+///
+/// The DAG is visited once in topological order, using only an array of counters for the groups
+/// and one for the files, so the time is linear in the size of the DAG.
+pub fn check_dag(dag: &CompactDAG, callbacks: &ExecutionDAGWatchSet) -> Result<(), DAGError> {
+    let mut sources = vec![FileSource::Missing; dag.num_files()];
+    let mut missing_deps = Vec::with_capacity(dag.num_groups());
+    let mut ready_groups = Vec::new();
+    for (id, group) in dag.groups() {
         if group.executions.is_empty() {
-            return Err(DAGError::EmptyGroup { uuid: *group_uuid });
-        }
-        let mut fifo_uuids = HashSet::new();
-        for fifo in group.fifo.iter() {
-            if !fifo_uuids.insert(fifo.uuid) {
-                return Err(DAGError::DuplicateFifoUUID { uuid: fifo.uuid });
-            }
+            return Err(DAGError::EmptyGroup { uuid: group.uuid });
         }
-        let mut count = 0;
-        if !known_execs.insert(group.uuid) {
+        // the groups are found by their UUID, which must also be their key in the DAG
+        if dag.group_id(&group.uuid) != Some(id) {
             return Err(DAGError::DuplicateExecutionUUID { uuid: group.uuid });
         }
-        let deps = group.dependencies();
-        count += deps.len();
-        for dep in deps.into_iter() {
-            add_dependency(dep, *group_uuid);
+        // the FIFOs and the shared memory files are in the same directory
+        let pipes: Vec<_> = group
+            .fifo
+            .iter()
+            .map(|fifo| fifo.uuid)
+            .chain(group.shared_memory.iter().map(|shm| shm.uuid))
+            .collect();
+        for (index, uuid) in pipes.iter().enumerate() {
+            if pipes[..index].contains(uuid) {
+                return Err(DAGError::DuplicateFifoUUID { uuid: *uuid });
+            }
         }
-        for out in group.outputs().into_iter() {
-            if !known_files.insert(out) {
-                return Err(DAGError::DuplicateFileUUID { uuid: out });
+        for output in dag.outputs(id) {
+            if sources[output.index()] != FileSource::Missing {
+                return Err(DAGError::DuplicateFileUUID {
+                    uuid: dag.file_uuid(*output),
+                });
             }
+            sources[output.index()] = FileSource::Group(id);
         }
-        num_dependencies.insert(*group_uuid, count);
-        if count == 0 {
-            ready_groups.push_back(*group_uuid);
+        missing_deps.push(dag.inputs(id).len());
+        if dag.inputs(id).is_empty() {
+            ready_groups.push(id);
         }
     }
-    // add the provided files
-    for uuid in dag.provided_files.keys() {
-        ready_files.push_back(*uuid);
-        if !known_files.insert(*uuid) {
-            return Err(DAGError::DuplicateFileUUID { uuid: *uuid });
+    let mut ready_files = Vec::with_capacity(dag.provided_files().len());
+    for file in dag.provided_files() {
+        if sources[file.index()] != FileSource::Missing {
+            return Err(DAGError::DuplicateFileUUID {
+                uuid: dag.file_uuid(*file),
+            });
         }
+        sources[file.index()] = FileSource::Provided;
+        ready_files.push(*file);
     }
-    // visit the DAG for finding the unreachable executions / cycles
+
+    // visit the DAG in topological order: a group is visited when all its inputs are ready
+    let mut visited = 0;
     while !ready_groups.is_empty() || !ready_files.is_empty() {
         for file in ready_files.drain(..) {
-            if !dependencies.contains_key(&file) {
-                continue;
-            }
-            for group_uuid in dependencies[&file].iter() {
-                let num_deps = num_dependencies
-                    .get_mut(group_uuid)
-                    .expect("num_dependencies of an unknown execution group");
-                assert_ne!(
-                    *num_deps, 0,
-                    "num_dependencies is going to be negative for {group_uuid}"
-                );
-                *num_deps -= 1;
-                if *num_deps == 0 {
-                    ready_groups.push_back(*group_uuid);
+            for group in dag.consumers(file) {
+                missing_deps[group.index()] -= 1;
+                if missing_deps[group.index()] == 0 {
+                    ready_groups.push(*group);
                 }
             }
         }
-        for group_uuid in ready_groups.drain(..) {
-            let group = dag
-                .execution_groups
-                .get(&group_uuid)
-                .expect("No such exec group");
-            for file in group.outputs() {
-                ready_files.push_back(file);
-            }
+        for group in ready_groups.drain(..) {
+            visited += 1;
+            ready_files.extend_from_slice(dag.outputs(group));
         }
     }
-    // search for unreachable execution / cycles
-    for (group_uuid, count) in num_dependencies.iter() {
-        if *count == 0 {
-            continue;
-        }
-        let group = &dag.execution_groups[group_uuid];
-        for dep in group.dependencies() {
-            if !known_files.contains(&dep) {
+    // the groups never visited either depend on a missing file or are in a cycle, or after one
+    if visited < dag.num_groups() {
+        let mut unvisited = dag
+            .groups()
+            .map(|(id, _)| id)
+            .filter(|id| missing_deps[id.index()] > 0);
+        let start = unvisited.next().expect("No group left to visit");
+        for id in std::iter::once(start).chain(unvisited) {
+            let inputs = dag.inputs(id);
+            if let Some(missing) = inputs
+                .iter()
+                .find(|f| sources[f.index()] == FileSource::Missing)
+            {
                 return Err(DAGError::MissingFile {
-                    uuid: dep,
-                    description: format!("Dependency of '{}'", group.description),
+                    uuid: dag.file_uuid(*missing),
+                    description: format!("Dependency of '{}'", dag.group(id).description),
                 });
             }
         }
+        // each unvisited group waits for another unvisited one: going back enough times from any
+        // of them ends inside a cycle
+        let mut group = start;
+        for _ in 0..dag.num_groups() {
+            group = dag
+                .inputs(group)
+                .iter()
+                .find_map(|file| match sources[file.index()] {
+                    FileSource::Group(producer) if missing_deps[producer.index()] > 0 => {
+                        Some(producer)
+                    }
+                    _ => None,
+                })
+                .expect("An unvisited group has all the inputs ready");
+        }
         return Err(DAGError::CycleDetected {
-            description: dag.execution_groups[group_uuid].description.clone(),
+            description: dag.group(group).description.clone(),
         });
     }
     // check the file callbacks
     for file in callbacks.files.iter() {
-        if !known_files.contains(file) {
-            return Err(DAGError::MissingFile {
-                uuid: *file,
-                description: "File required by a callback".to_owned(),
-            });
+        match dag.file_id(file) {
+            Some(id) if sources[id.index()] != FileSource::Missing => {}
+            _ => {
+                return Err(DAGError::MissingFile {
+                    uuid: *file,
+                    description: "File required by a callback".to_owned(),
+                })
+            }
         }
     }
     // check the execution callbacks
     for exec in callbacks.executions.iter() {
-        if !known_execs.contains(exec) {
+        if dag.group_id(exec).is_none() {
             return Err(DAGError::MissingExecution { uuid: *exec });
         }
     }
@@ -181,6 +201,34 @@ mod tests {
 
     use super::*;
 
+    fn check(dag: ExecutionDAG, callbacks: &ExecutionDAGWatchSet) -> Result<(), DAGError> {
+        check_dag(&CompactDAG::new(dag.data), callbacks)
+    }
+
+    #[test]
+    fn test_valid_dag() {
+        let mut dag = ExecutionDAG::new();
+        let input = File::new("input");
+        dag.provide_file(input.clone(), "/dev/null").unwrap();
+        let mut exec1 = Execution::new("exec1", ExecutionCommand::local("foo"));
+        exec1
+            .input(&input, "input", false)
+            .input(&input, "again", false);
+        let mut exec2 = Execution::new("exec2", ExecutionCommand::local("foo"));
+        exec2
+            .stdin(exec1.capture_stdout(None))
+            .input(&input, "input", false);
+        let output = exec2.capture_stdout(None);
+        let exec2 = dag.add_execution(exec2);
+        dag.add_execution(exec1);
+        let watch = ExecutionDAGWatchSet {
+            executions: [exec2].into_iter().collect(),
+            files: [output.uuid].into_iter().collect(),
+            urgent_files: Default::default(),
+        };
+        assert!(check(dag, &watch).is_ok());
+    }
+
     #[test]
     fn test_missing_file() {
         let mut dag = ExecutionDAG::new();
@@ -188,7 +236,7 @@ mod tests {
         let file = File::new("file");
         exec.stdin(file);
         dag.add_execution(exec);
-        assert!(check_dag(&dag.data, &ExecutionDAGWatchSet::default()).is_err());
+        assert!(check(dag, &ExecutionDAGWatchSet::default()).is_err());
     }
 
     #[test]
@@ -200,7 +248,7 @@ mod tests {
             files: [file.uuid].iter().cloned().collect(),
             urgent_files: Default::default(),
         };
-        assert!(check_dag(&dag.data, &watch).is_err());
+        assert!(check(dag, &watch).is_err());
     }
 
     #[test]
@@ -213,7 +261,7 @@ mod tests {
             files: Default::default(),
             urgent_files: Default::default(),
         };
-        assert!(check_dag(&dag.data, &watch).is_err());
+        assert!(check(dag, &watch).is_err());
     }
 
     #[test]
@@ -223,7 +271,7 @@ mod tests {
         let stdout = exec.capture_stdout(None);
         exec.stdin(stdout);
         dag.add_execution(exec);
-        assert!(check_dag(&dag.data, &ExecutionDAGWatchSet::default()).is_err());
+        assert!(check(dag, &ExecutionDAGWatchSet::default()).is_err());
     }
 
     #[test]
@@ -235,7 +283,31 @@ mod tests {
         exec2.stdin(exec1.capture_stdout(None));
         dag.add_execution(exec1);
         dag.add_execution(exec2);
-        assert!(check_dag(&dag.data, &ExecutionDAGWatchSet::default()).is_err());
+        assert!(check(dag, &ExecutionDAGWatchSet::default()).is_err());
+    }
+
+    #[test]
+    fn test_cycle_description() {
+        let mut dag = ExecutionDAG::new();
+        let mut exec1 = Execution::new("cycle", ExecutionCommand::local("foo"));
+        let mut exec2 = Execution::new("cycle", ExecutionCommand::local("foo"));
+        let mut after = Execution::new("after", ExecutionCommand::local("foo"));
+        exec1.stdin(exec2.capture_stdout(None));
+        let stdout = exec1.capture_stdout(None);
+        exec2.stdin(&stdout);
+        after.stdin(&stdout);
+        for _ in 0..5 {
+            let mut next = Execution::new("after", ExecutionCommand::local("foo"));
+            next.stdin(after.capture_stdout(None));
+            dag.add_execution(std::mem::replace(&mut after, next));
+        }
+        dag.add_execution(after);
+        dag.add_execution(exec1);
+        dag.add_execution(exec2);
+        match check(dag, &ExecutionDAGWatchSet::default()) {
+            Err(DAGError::CycleDetected { description }) => assert_eq!(description, "cycle"),
+            res => panic!("Expected a cycle, got {res:?}"),
+        }
     }
 
     #[test]
@@ -251,7 +323,7 @@ mod tests {
         exec2.stdout = behaviour;
         dag.add_execution(exec1);
         dag.add_execution(exec2);
-        assert!(check_dag(&dag.data, &ExecutionDAGWatchSet::default()).is_err());
+        assert!(check(dag, &ExecutionDAGWatchSet::default()).is_err());
     }
 
     #[test]
@@ -261,6 +333,6 @@ mod tests {
         let file = exec.capture_stdout(None);
         dag.add_execution(exec);
         dag.provide_file(file, "/dev/null").unwrap();
-        assert!(check_dag(&dag.data, &ExecutionDAGWatchSet::default()).is_err());
+        assert!(check(dag, &ExecutionDAGWatchSet::default()).is_err());
     }
 }
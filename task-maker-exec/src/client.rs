@@ -95,6 +95,7 @@ impl ExecutorClient {
                 .map_err(|e| anyhow!("Failed to join status poller: {:?}", e)).unwrap();
         }}
 
+        let skipper = dag.skipper();
         let mut missing_files = None;
         while missing_files.unwrap_or(1) > 0 {
             match receiver.recv() {
@@ -183,7 +184,7 @@ impl ExecutorClient {
                                 uuid,
                                 success,
                                 iterator,
-                                None,
+                                Some(handle.path()),
                             )
                             .with_context(|| {
                                 format!(
@@ -211,6 +212,14 @@ impl ExecutorClient {
                     break;
                 }
             }
+            // the callbacks may have asked to skip some executions
+            let skipped = skipper.take();
+            if !skipped.is_empty() {
+                info!("Asking to skip {} executions", skipped.len());
+                sender
+                    .send(ExecutorClientMessage::Skip(skipped))
+                    .context("Failed to send Skip message to the server")?;
+            }
         }
         Ok(())
     }
@@ -337,26 +346,30 @@ where
                 uuid: worker.uuid,
                 name: worker.name,
                 current_job: worker.current_job.map(|status| status.into_system_time()),
+                health: worker.health,
             })
             .collect(),
         ready_execs: status.ready_execs,
         waiting_execs: status.waiting_execs,
+        cost_estimate: status.cost_estimate,
     })
 }
 
 /// Process a file provided either by the client or by the server, calling the callback and writing
-/// it to the `write_to` path. This will consume the iterator even if the callback is not present.
+/// it to the `write_to` path.
 ///
-/// If the iterator is reading the same file this function writes to, the result is the file getting
-/// truncated, for this reason a best-effort approach is implemented: if the iterator reads a local
-/// file pass to this function also the path to the file. The file wont be truncated if write_to
-/// points to the same file as the hint.
+/// If the iterator reads a local file, like one in the local `FileStore`, `source_path` is the path
+/// to that file. The file is then copied to the `write_to` path with `copy_file`, which shares the
+/// content on disk when the filesystem supports reflinks, and the iterator is consumed only if a
+/// callback needs the content. Otherwise the iterator is always consumed, even if the callback is
+/// not present, since it may be reading from the channel. The file won't be written if `write_to`
+/// points to the source file itself.
 fn process_provided_file<I: IntoIterator<Item = Vec<u8>>>(
     file_callbacks: &mut HashMap<FileUuid, FileCallbacks>,
     uuid: FileUuid,
     success: bool,
     iterator: I,
-    source_path_hint: Option<&Path>,
+    source_path: Option<&Path>,
 ) -> Result<(), Error> {
     if let Some(callback) = file_callbacks.get_mut(&uuid) {
         let limit = callback
@@ -375,7 +388,7 @@ fn process_provided_file<I: IntoIterator<Item = Vec<u8>>>(
                     (None, None)
                 } else {
                     let mut skip = false;
-                    if let Some(source) = source_path_hint {
+                    if let Some(source) = source_path {
                         match (source.canonicalize(), dest.canonicalize()) {
                             (Ok(path), Ok(path2)) if path == path2 => {
                                 info!("Not writing {} from itself", path.display());
@@ -398,26 +411,37 @@ fn process_provided_file<I: IntoIterator<Item = Vec<u8>>>(
                                 dest.display()
                             )
                         })?;
-                        let file = std::fs::File::create(dest).with_context(|| {
-                            format!("Failed to create file: {}", dest.display())
-                        })?;
-                        (Some(file), Some(dest.clone()))
+                        match source_path {
+                            Some(source) => {
+                                copy_file(source, dest)?;
+                                (None, None)
+                            }
+                            None => {
+                                let file = std::fs::File::create(dest).with_context(|| {
+                                    format!("Failed to create file: {}", dest.display())
+                                })?;
+                                (Some(file), Some(dest.clone()))
+                            }
+                        }
                     }
                 }
             }
             _ => (None, None),
         };
-        for chunk in iterator {
-            if let (Some(file), Some(dest)) = (&mut file, &dest) {
-                file.write_all(&chunk)
-                    .with_context(|| format!("Failed to write chunk to {}", dest.display()))?;
-            }
-            for get_content_chunked in &mut callback.get_content_chunked {
-                get_content_chunked(&chunk).context("Get content chunked callback failed")?;
-            }
-            if buffer.len() < limit {
-                let len = std::cmp::min(chunk.len(), limit - buffer.len());
-                buffer.extend_from_slice(&chunk[..len]);
+        let needs_content = file.is_some() || limit > 0 || !callback.get_content_chunked.is_empty();
+        if needs_content || source_path.is_none() {
+            for chunk in iterator {
+                if let (Some(file), Some(dest)) = (&mut file, &dest) {
+                    file.write_all(&chunk)
+                        .with_context(|| format!("Failed to write chunk to {}", dest.display()))?;
+                }
+                for get_content_chunked in &mut callback.get_content_chunked {
+                    get_content_chunked(&chunk).context("Get content chunked callback failed")?;
+                }
+                if buffer.len() < limit {
+                    let len = std::cmp::min(chunk.len(), limit - buffer.len());
+                    buffer.extend_from_slice(&chunk[..len]);
+                }
             }
         }
         // Tell the callbacks the file has ended.
@@ -443,8 +467,40 @@ fn process_provided_file<I: IntoIterator<Item = Vec<u8>>>(
             get_content(buffer)
                 .with_context(|| format!("get_content callback for file {uuid} failed"))?;
         }
-    } else {
+    } else if source_path.is_none() {
         iterator.into_iter().last();
     }
     Ok(())
 }
+
+#[cfg(test)]
+mod tests {
+    use task_maker_dag::File;
+    use tempfile::TempDir;
+
+    use super::*;
+
+    #[test]
+    fn test_process_provided_file_from_source() {
+        let tmpdir = TempDir::new().unwrap();
+        let source = tmpdir.path().join("source");
+        std::fs::write(&source, "content").unwrap();
+        let dest = tmpdir.path().join("bin/dest");
+        let mut dag = ExecutionDAG::new();
+        let file = File::new("file");
+        dag.write_file_to(&file, &dest, true);
+        // the content is copied from the source, without reading it
+        let iterator = std::iter::from_fn(|| -> Option<Vec<u8>> { panic!("Content read") });
+        process_provided_file(
+            dag.file_callbacks(),
+            file.uuid,
+            true,
+            iterator,
+            Some(&source),
+        )
+        .unwrap();
+        assert_eq!(std::fs::read(&dest).unwrap(), b"content");
+        let mode = std::fs::metadata(&dest).unwrap().permissions().mode();
+        assert_eq!(mode & 0o777, 0o755);
+    }
+}
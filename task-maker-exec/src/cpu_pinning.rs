@@ -0,0 +1,169 @@
+//! Pinning of the sandboxes to the cores of the machine.
+//!
+//! Some cores can be reserved for the executions whose time is measured (the ones tagged as
+//! `evaluation`): each of them gets a reserved core for itself, while all the other executions
+//! (compilations, generations, checkers, ...) share the remaining cores. This way a heavy
+//! compilation cannot slow down a solution being timed.
+//!
+//! The sandbox configuration doesn't support the CPU affinity, so the thread that spawns the
+//! sandbox is pinned instead: the affinity is inherited by the processes it spawns.
+
+use std::sync::{Arc, Condvar, Mutex};
+
+use anyhow::{bail, Context, Error};
+use nix::sched::{sched_getaffinity, sched_setaffinity, CpuSet};
+use nix::unistd::Pid;
+use task_maker_dag::ExecutionGroup;
+
+/// Name of the tag of the executions that run on the reserved cores.
+pub(crate) const TIMING_TAG: &str = "evaluation";
+
+/// The split of the cores of the machine between the timed executions and the other ones, shared
+/// by all the workers of the machine.
+#[derive(Debug)]
+pub struct CpuPinning {
+    /// The reserved cores not used by any execution at the moment.
+    free_timing_cores: Mutex<Vec<usize>>,
+    /// Notified when some reserved cores are released.
+    released: Condvar,
+    /// The number of reserved cores.
+    num_timing_cores: usize,
+    /// The cores for the executions that are not timed.
+    other_cores: Vec<usize>,
+}
+
+/// The reserved cores assigned to an execution group, released when dropped.
+#[derive(Debug)]
+pub(crate) struct TimingCores {
+    /// Where to release the cores.
+    pinning: Arc<CpuPinning>,
+    /// The cores assigned to the group.
+    cores: Vec<usize>,
+}
+
+impl CpuPinning {
+    /// Reserve the last `num_timing_cores` cores among the ones this process is allowed to run on
+    /// for the timed executions. At least one core must remain for the other executions.
+    pub fn reserve(num_timing_cores: usize) -> Result<CpuPinning, Error> {
+        let cores = available_cores()?;
+        if num_timing_cores == 0 || num_timing_cores >= cores.len() {
+            bail!(
+                "Cannot reserve {} cores for the timed executions: {} cores are available",
+                num_timing_cores,
+                cores.len()
+            );
+        }
+        let (other_cores, timing_cores) = cores.split_at(cores.len() - num_timing_cores);
+        info!("Reserving cores {timing_cores:?} for the timed executions");
+        Ok(CpuPinning {
+            free_timing_cores: Mutex::new(timing_cores.to_vec()),
+            released: Condvar::new(),
+            num_timing_cores,
+            other_cores: other_cores.to_vec(),
+        })
+    }
+
+    /// The cores on which the executions of a group should run, waiting for the reserved cores to
+    /// be free if the group is timed. A core is reserved for each execution of the group, if
+    /// there are enough of them.
+    pub(crate) fn cores_for(self: &Arc<Self>, group: &ExecutionGroup) -> Option<TimingCores> {
+        let timed = group
+            .tag
+            .as_ref()
+            .map_or(false, |tag| tag.name == TIMING_TAG);
+        if !timed {
+            return None;
+        }
+        // all the executions of the group have to start together, so the cores are acquired all
+        // at once
+        let needed = group.executions.len().clamp(1, self.num_timing_cores);
+        let mut free = self.free_timing_cores.lock().unwrap();
+        while free.len() < needed {
+            free = self.released.wait(free).unwrap();
+        }
+        let at = free.len() - needed;
+        let cores = free.split_off(at);
+        Some(TimingCores {
+            pinning: self.clone(),
+            cores,
+        })
+    }
+
+    /// The cores for the execution with the given index inside its group.
+    pub(crate) fn cores(&self, timing: Option<&TimingCores>, index: usize) -> Vec<usize> {
+        match timing {
+            Some(timing) => vec![timing.cores[index % timing.cores.len()]],
+            None => self.other_cores.clone(),
+        }
+    }
+}
+
+impl Drop for TimingCores {
+    fn drop(&mut self) {
+        let mut free = self.pinning.free_timing_cores.lock().unwrap();
+        free.append(&mut self.cores);
+        self.pinning.released.notify_all();
+    }
+}
+
+/// The cores this process is allowed to run on.
+fn available_cores() -> Result<Vec<usize>, Error> {
+    let set = sched_getaffinity(Pid::from_raw(0)).context("Failed to get the CPU affinity")?;
+    Ok((0..CpuSet::count())
+        .filter(|core| set.is_set(*core).unwrap_or(false))
+        .collect())
+}
+
+/// Restrict the current thread, and the processes it will spawn, to the given cores.
+pub(crate) fn pin_current_thread(cores: &[usize]) -> Result<(), Error> {
+    let mut set = CpuSet::new();
+    for core in cores {
+        set.set(*core).context("Invalid core")?;
+    }
+    sched_setaffinity(Pid::from_raw(0), &set).context("Failed to set the CPU affinity")
+}
+
+#[cfg(test)]
+mod tests {
+    use task_maker_dag::{Execution, ExecutionCommand, ExecutionTag};
+
+    use super::*;
+
+    fn pinning(timing_cores: Vec<usize>) -> Arc<CpuPinning> {
+        Arc::new(CpuPinning {
+            num_timing_cores: timing_cores.len(),
+            free_timing_cores: Mutex::new(timing_cores),
+            released: Condvar::new(),
+            other_cores: vec![0, 1],
+        })
+    }
+
+    fn group(tag: &str, num_executions: usize) -> ExecutionGroup {
+        let mut group = ExecutionGroup::new("group");
+        for _ in 0..num_executions {
+            group.add_execution(Execution::new("exec", ExecutionCommand::local("x")));
+        }
+        group.tag = Some(ExecutionTag::from(tag));
+        group
+    }
+
+    #[test]
+    fn test_cores_for() {
+        let pinning = pinning(vec![2, 3, 4]);
+        assert!(pinning.cores_for(&group("compilation", 1)).is_none());
+        let first = pinning.cores_for(&group("evaluation", 2)).unwrap();
+        assert_eq!(first.cores.len(), 2);
+        let second = pinning.cores_for(&group("evaluation", 1)).unwrap();
+        assert_eq!(second.cores.len(), 1);
+        assert!(!first.cores.contains(&second.cores[0]));
+        assert!(pinning.free_timing_cores.lock().unwrap().is_empty());
+        drop(first);
+        assert_eq!(pinning.free_timing_cores.lock().unwrap().len(), 2);
+        drop(second);
+        // groups with more executions than reserved cores share them
+        let all = pinning.cores_for(&group("evaluation", 5)).unwrap();
+        assert_eq!(all.cores.len(), 3);
+        assert_eq!(pinning.cores(Some(&all), 4), vec![all.cores[1]]);
+        assert_eq!(pinning.cores(None, 4), vec![0, 1]);
+    }
+}
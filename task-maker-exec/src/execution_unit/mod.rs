@@ -2,10 +2,13 @@
 //! executions which are done by task-maker directly
 
 pub mod sandbox;
+pub mod sandbox_pool;
+mod token_diff;
 mod typst;
+mod white_diff;
 
 use std::collections::HashMap;
-use std::path::{Path, PathBuf};
+use std::path::Path;
 
 use anyhow::Error;
 use serde::{Deserialize, Serialize};
@@ -13,8 +16,11 @@ use tabox::result::SandboxExecutionResult;
 use task_maker_dag::*;
 use task_maker_store::*;
 
-use crate::execution_unit::sandbox::Sandbox;
+use crate::execution_unit::sandbox::{FifoDir, Sandbox};
+use crate::execution_unit::sandbox_pool::SandboxPool;
+use crate::execution_unit::token_diff::TokenDiff;
 use crate::execution_unit::typst::TypstCompiler;
+use crate::execution_unit::white_diff::WhiteDiff;
 use crate::sandbox_runner::SandboxRunner;
 use crate::worker::OutputFile;
 
@@ -54,8 +60,9 @@ impl Default for SandboxResult {
 /// Response of the internal implementation of the sandbox.
 #[derive(Debug, Serialize, Deserialize)]
 pub enum RawSandboxResult {
-    /// The sandbox has been executed successfully.
-    Success(SandboxExecutionResult),
+    /// The sandbox has been executed successfully, with the values of the hardware counters if
+    /// they were requested and available.
+    Success(SandboxExecutionResult, Option<HardwareCounters>),
     /// There was an error executing the sandbox.
     Error(String),
 }
@@ -69,28 +76,70 @@ impl From<Result<RawSandboxResult, anyhow::Error>> for RawSandboxResult {
     }
 }
 
-/// A singular execution, which can either be performed in a sandbox or be a Typst compilation
+/// A singular execution, which can either be performed in a sandbox, be a Typst compilation or be
+/// a comparison of two files
 #[derive(Debug, Clone)]
 pub enum ExecutionUnit {
     /// A sandboxed execution
     Sandbox(Sandbox),
     /// A Typst compilation
     TypstCompilation(Box<TypstCompiler>),
+    /// A whitespace-insensitive comparison of two files
+    WhiteDiff(WhiteDiff),
+    /// A token by token comparison of two files
+    TokenDiff(TokenDiff),
 }
 
 impl ExecutionUnit {
     /// Creates a new execution unit
     pub fn new(
-        sandboxes_dir: &Path,
+        sandbox_pool: &SandboxPool,
         execution: &Execution,
         dep_keys: &HashMap<FileUuid, FileStoreHandle>,
-        fifo_dir: Option<PathBuf>,
+        fifo_dir: Option<FifoDir>,
     ) -> Result<ExecutionUnit, Error> {
-        if matches!(execution.command, ExecutionCommand::TypstCompilation { .. }) {
-            TypstCompiler::new(Path::new("."), execution, dep_keys)
-                .map(|typst_compiler| ExecutionUnit::TypstCompilation(Box::new(typst_compiler)))
-        } else {
-            Sandbox::new(sandboxes_dir, execution, dep_keys, fifo_dir).map(ExecutionUnit::Sandbox)
+        match execution.command {
+            ExecutionCommand::TypstCompilation { .. } => {
+                TypstCompiler::new(Path::new("."), execution, dep_keys)
+                    .map(|typst_compiler| ExecutionUnit::TypstCompilation(Box::new(typst_compiler)))
+            }
+            ExecutionCommand::WhiteDiff { .. } => {
+                WhiteDiff::new(execution, dep_keys).map(ExecutionUnit::WhiteDiff)
+            }
+            ExecutionCommand::TokenDiff { .. } => {
+                TokenDiff::new(execution, dep_keys).map(ExecutionUnit::TokenDiff)
+            }
+            _ => Sandbox::new(sandbox_pool, execution, dep_keys, fifo_dir)
+                .map(ExecutionUnit::Sandbox),
+        }
+    }
+
+    /// Creates a new execution unit like `new`, whose sandbox is never put on the tmpfs.
+    pub fn new_on_disk(
+        sandbox_pool: &SandboxPool,
+        execution: &Execution,
+        dep_keys: &HashMap<FileUuid, FileStoreHandle>,
+        fifo_dir: Option<FifoDir>,
+    ) -> Result<ExecutionUnit, Error> {
+        match execution.command {
+            ExecutionCommand::TypstCompilation { .. }
+            | ExecutionCommand::WhiteDiff { .. }
+            | ExecutionCommand::TokenDiff { .. } => {
+                ExecutionUnit::new(sandbox_pool, execution, dep_keys, fifo_dir)
+            }
+            _ => Sandbox::new_on_disk(sandbox_pool, execution, dep_keys, fifo_dir)
+                .map(ExecutionUnit::Sandbox),
+        }
+    }
+
+    /// Whether the sandbox is on the tmpfs and uses more space than it reserved, see
+    /// `Sandbox::exceeded_tmpfs_reservation`.
+    pub fn exceeded_tmpfs_reservation(&self) -> bool {
+        match self {
+            ExecutionUnit::Sandbox(sandbox) => sandbox.exceeded_tmpfs_reservation(),
+            ExecutionUnit::TypstCompilation(_)
+            | ExecutionUnit::WhiteDiff(_)
+            | ExecutionUnit::TokenDiff(_) => false,
         }
     }
 
@@ -98,7 +147,9 @@ impl ExecutionUnit {
     pub fn kill(&self) {
         match self {
             ExecutionUnit::Sandbox(sandbox) => sandbox.kill(),
-            ExecutionUnit::TypstCompilation(_) => {}
+            ExecutionUnit::TypstCompilation(_)
+            | ExecutionUnit::WhiteDiff(_)
+            | ExecutionUnit::TokenDiff(_) => {}
         }
     }
 
@@ -106,7 +157,9 @@ impl ExecutionUnit {
     pub fn keep(&mut self) {
         match self {
             ExecutionUnit::Sandbox(sandbox) => sandbox.keep(),
-            ExecutionUnit::TypstCompilation(_) => (),
+            ExecutionUnit::TypstCompilation(_)
+            | ExecutionUnit::WhiteDiff(_)
+            | ExecutionUnit::TokenDiff(_) => (),
         }
     }
 
@@ -119,6 +172,8 @@ impl ExecutionUnit {
         match self {
             ExecutionUnit::Sandbox(sandbox) => sandbox.run(runner, dag_config),
             ExecutionUnit::TypstCompilation(typst_compiler) => typst_compiler.run(),
+            ExecutionUnit::WhiteDiff(white_diff) => white_diff.run(),
+            ExecutionUnit::TokenDiff(token_diff) => token_diff.run(),
         }
     }
 
@@ -126,7 +181,9 @@ impl ExecutionUnit {
     pub fn stdout_path(&self) -> OutputFile {
         match self {
             ExecutionUnit::Sandbox(sandbox) => OutputFile::OnDisk(sandbox.stdout_path()),
-            ExecutionUnit::TypstCompilation(_) => OutputFile::InMemory(Vec::new()),
+            ExecutionUnit::TypstCompilation(_)
+            | ExecutionUnit::WhiteDiff(_)
+            | ExecutionUnit::TokenDiff(_) => OutputFile::InMemory(Vec::new()),
         }
     }
 
@@ -134,7 +191,9 @@ impl ExecutionUnit {
     pub fn stderr_path(&self) -> OutputFile {
         match self {
             ExecutionUnit::Sandbox(sandbox) => OutputFile::OnDisk(sandbox.stderr_path()),
-            ExecutionUnit::TypstCompilation(_) => OutputFile::InMemory(Vec::new()),
+            ExecutionUnit::TypstCompilation(_)
+            | ExecutionUnit::WhiteDiff(_)
+            | ExecutionUnit::TokenDiff(_) => OutputFile::InMemory(Vec::new()),
         }
     }
 
@@ -145,6 +204,9 @@ impl ExecutionUnit {
             ExecutionUnit::TypstCompilation(typst_compiler) => {
                 OutputFile::InMemory(typst_compiler.output(output))
             }
+            ExecutionUnit::WhiteDiff(_) | ExecutionUnit::TokenDiff(_) => {
+                OutputFile::InMemory(Vec::new())
+            }
         }
     }
 }
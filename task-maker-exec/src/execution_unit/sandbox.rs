@@ -7,7 +7,7 @@ use std::os::unix::fs::PermissionsExt;
 use std::path::{Path, PathBuf};
 use std::sync::atomic::{AtomicU32, Ordering};
 use std::sync::{Arc, Mutex};
-use std::time::Duration;
+use std::time::{Duration, Instant};
 
 use anyhow::{bail, Context, Error};
 use nix::sys::signal::{self, Signal};
@@ -16,10 +16,11 @@ use tabox::configuration::SandboxConfiguration;
 use tabox::syscall_filter::SyscallFilter;
 use task_maker_dag::*;
 use task_maker_store::*;
-use tempfile::TempDir;
 
 use crate::detect_exe::detect_exe;
+use crate::execution_unit::sandbox_pool::{PooledDir, SandboxPool};
 use crate::execution_unit::{RawSandboxResult, SandboxResult};
+use crate::overhead::{OverheadPhase, OverheadRecorder};
 use crate::sandbox_runner::SandboxRunner;
 
 /// The list of all the system-wide readable directories inside the sandbox.
@@ -36,22 +37,38 @@ pub const READABLE_DIRS: &[&str] = &[
     "/var/lib/texmf/",
 ];
 
+/// The bytes reserved on the tmpfs for each output of a sandbox. The file size limit is much bigger
+/// than most outputs, 1 GiB by default, so it's not reserved whole: a sandbox that writes more than
+/// it reserved may have filled the tmpfs, and if it fails it is run again on disk.
+const TMPFS_OUTPUT_RESERVATION: u64 = 64 * 1024 * 1024;
+
+/// The directory with the FIFOs and the shared memory files of the group of an execution.
+#[derive(Debug, Clone)]
+pub struct FifoDir {
+    /// The path of the directory, in the host.
+    pub path: PathBuf,
+    /// Whether the group has shared memory files, so the directory is mounted writable.
+    pub shared_memory: bool,
+}
+
 /// Internals of the sandbox.
 #[derive(Debug)]
 struct SandboxData {
-    /// Handle to the temporary directory, will be deleted on drop. It's always Some(_) except
-    /// inside `Drop`.
-    boxdir: Option<TempDir>,
+    /// Handle to the sandbox directory, will be given back to the pool on drop. It's always
+    /// Some(_) except inside `Drop`.
+    boxdir: Option<PooledDir>,
     /// Execution to run.
     execution: Execution,
     /// Whether to keep the sandbox after exit.
     keep_sandbox: bool,
     /// Directory where the FIFO pipes are stored.
-    fifo_dir: Option<PathBuf>,
+    fifo_dir: Option<FifoDir>,
     /// The PID of the sandbox process, zero if not available or not spawned yet.
     box_pid: Arc<AtomicU32>,
     /// Whether we tried to kill the sandbox.
     tried_to_kill: bool,
+    /// Where to record the time spent running and dropping the sandbox.
+    overhead: Arc<OverheadRecorder>,
 }
 
 /// Wrapper around the sandbox. Cloning this struct will keep the reference of the same sandbox,
@@ -69,20 +86,39 @@ impl Sandbox {
     /// Make a new sandbox for the specified execution, copying all the required files. To start the
     /// sandbox call `run`.
     pub fn new(
-        sandboxes_dir: &Path,
+        sandbox_pool: &SandboxPool,
         execution: &Execution,
         dep_keys: &HashMap<FileUuid, FileStoreHandle>,
-        fifo_dir: Option<PathBuf>,
+        fifo_dir: Option<FifoDir>,
     ) -> Result<Sandbox, Error> {
-        std::fs::create_dir_all(sandboxes_dir).with_context(|| {
-            format!(
-                "Failed to create sandbox directory at {}",
-                sandboxes_dir.display()
-            )
-        })?;
-        let boxdir = TempDir::new_in(sandboxes_dir)
-            .context("Failed to create sandbox temporary directory")?;
+        let size = Sandbox::tmpfs_reservation(execution, dep_keys);
+        Sandbox::with_size(sandbox_pool, execution, dep_keys, fifo_dir, size)
+    }
+
+    /// Make a new sandbox like `new`, but never on the tmpfs. This is for the sandboxes that cannot
+    /// be run again alone if they fail after filling the tmpfs.
+    pub fn new_on_disk(
+        sandbox_pool: &SandboxPool,
+        execution: &Execution,
+        dep_keys: &HashMap<FileUuid, FileStoreHandle>,
+        fifo_dir: Option<FifoDir>,
+    ) -> Result<Sandbox, Error> {
+        Sandbox::with_size(sandbox_pool, execution, dep_keys, fifo_dir, None)
+    }
+
+    /// Make a new sandbox, on the tmpfs if `size` bytes fit in it.
+    fn with_size(
+        sandbox_pool: &SandboxPool,
+        execution: &Execution,
+        dep_keys: &HashMap<FileUuid, FileStoreHandle>,
+        fifo_dir: Option<FifoDir>,
+        size: Option<u64>,
+    ) -> Result<Sandbox, Error> {
+        let setup_start = Instant::now();
+        let boxdir = sandbox_pool.get(size)?;
         Sandbox::setup(boxdir.path(), execution, dep_keys).context("Sandbox setup failed")?;
+        let overhead = sandbox_pool.overhead().clone();
+        overhead.record(OverheadPhase::Setup, setup_start.elapsed());
 
         Ok(Sandbox {
             data: Arc::new(Mutex::new(SandboxData {
@@ -92,6 +128,7 @@ impl Sandbox {
                 fifo_dir,
                 box_pid: Arc::new(AtomicU32::new(0)),
                 tried_to_kill: false,
+                overhead,
             })),
         })
     }
@@ -102,13 +139,15 @@ impl Sandbox {
         runner: &dyn SandboxRunner,
         dag_config: &ExecutionDAGConfig,
     ) -> Result<SandboxResult, Error> {
+        let run_start = Instant::now();
         let mut config = SandboxConfiguration::default();
-        let (boxdir, pid, keep, cmd) = {
+        let (boxdir, pid, keep, overhead, cmd) = {
             let data = self.data.lock().unwrap();
             (
                 data.path().to_owned(),
                 data.box_pid.clone(),
                 data.keep_sandbox,
+                data.overhead.clone(),
                 self.build_command(
                     data.path(),
                     &data.execution,
@@ -147,24 +186,37 @@ impl Sandbox {
                 .context("Cannot write command info inside sandbox")?;
         }
 
-        let raw_result = runner.run(config.build(), pid);
+        let hardware_counters = {
+            let data = self.data.lock().unwrap();
+            dag_config.hardware_counters || data.execution.limits.instructions.is_some()
+        };
+        let raw_result = runner.run(config.build(), pid, hardware_counters);
+        overhead.record(OverheadPhase::Run, run_start.elapsed());
         if keep {
             let target = boxdir.join("result.txt");
             std::fs::write(&target, format!("{raw_result:#?}"))
                 .with_context(|| format!("Failed to write {}", target.display()))?;
         }
 
-        let res = match raw_result {
-            RawSandboxResult::Success(res) => res,
+        let (res, counters) = match raw_result {
+            RawSandboxResult::Success(res, counters) => (res, counters),
             RawSandboxResult::Error(e) => bail!("Sandbox failed: {}", e),
         };
+        if hardware_counters && counters.is_none() {
+            debug!("The hardware counters are not available for the sandbox at {boxdir:?}");
+        }
         trace!("Sandbox output: {res:?}");
+        overhead.record(
+            OverheadPhase::Program,
+            Duration::from_secs_f64(res.resource_usage.wall_time_usage.max(0.0)),
+        );
 
         let resources = ExecutionResourcesUsage {
             cpu_time: res.resource_usage.user_cpu_time,
             sys_time: res.resource_usage.system_cpu_time,
             wall_time: res.resource_usage.wall_time_usage,
             memory: res.resource_usage.memory_usage / 1024,
+            counters,
         };
 
         use tabox::result::ExitStatus::*;
@@ -305,7 +357,7 @@ impl Sandbox {
         execution: &Execution,
         config: &mut SandboxConfiguration,
         dag_config: &ExecutionDAGConfig,
-        fifo_dir: Option<PathBuf>,
+        fifo_dir: Option<FifoDir>,
     ) -> Result<(), Error> {
         let box_root = self.box_root(boxdir);
         config.working_directory(&box_root);
@@ -314,7 +366,11 @@ impl Sandbox {
         config.env("PATH", std::env::var("PATH").unwrap_or_default());
         match &execution.stdin {
             ExecutionInputBehaviour::Path(path) => {
-                config.stdin(self.sandbox_to_host_path(path, boxdir, fifo_dir.as_deref()));
+                config.stdin(self.sandbox_to_host_path(
+                    path,
+                    boxdir,
+                    fifo_dir.as_ref().map(|dir| dir.path.as_path()),
+                ));
             }
             ExecutionInputBehaviour::File(_) => {
                 config.stdin(boxdir.join("stdin"));
@@ -326,7 +382,11 @@ impl Sandbox {
         }
         match &execution.stdout {
             ExecutionOutputBehaviour::Path(path) => {
-                config.stdout(self.sandbox_to_host_path(path, boxdir, fifo_dir.as_deref()));
+                config.stdout(self.sandbox_to_host_path(
+                    path,
+                    boxdir,
+                    fifo_dir.as_ref().map(|dir| dir.path.as_path()),
+                ));
             }
             ExecutionOutputBehaviour::Capture { .. } => {
                 config.stdout(boxdir.join("stdout"));
@@ -338,7 +398,11 @@ impl Sandbox {
         }
         match &execution.stderr {
             ExecutionOutputBehaviour::Path(path) => {
-                config.stderr(self.sandbox_to_host_path(path, boxdir, fifo_dir.as_deref()));
+                config.stderr(self.sandbox_to_host_path(
+                    path,
+                    boxdir,
+                    fifo_dir.as_ref().map(|dir| dir.path.as_path()),
+                ));
             }
             ExecutionOutputBehaviour::Capture { .. } => {
                 config.stderr(boxdir.join("stderr"));
@@ -386,11 +450,17 @@ impl Sandbox {
         }
         // has to be writable for mounting stuff in it
         config.mount(boxdir.join("etc"), "/etc", true);
-        if let Some(path) = fifo_dir {
+        if let Some(FifoDir {
+            path,
+            shared_memory,
+        }) = fifo_dir
+        {
             // allow access knowing the path but prevent listing the dir content
             Sandbox::set_permissions(&path, 0o111)
                 .with_context(|| format!("Failed to chmod 111 {}", path.display()))?;
-            config.mount(path, box_root.join(FIFO_SANDBOX_DIR), false);
+            // writable only for mapping the shared memory files, new files still cannot be created
+            // since the directory is not writable
+            config.mount(path, box_root.join(FIFO_SANDBOX_DIR), shared_memory);
         }
         // The list of mounted system directories.
         let mut mounted_dirs = HashSet::new();
@@ -450,7 +520,47 @@ impl Sandbox {
         Ok(())
     }
 
-    /// Setup the sandbox directory with all the files required for the execution.
+    /// The number of bytes to reserve on the tmpfs for the sandbox of the execution: the size of
+    /// its inputs, plus the file size limit for each of its outputs, up to
+    /// `TMPFS_OUTPUT_RESERVATION`. `None` if the size of the inputs is not known.
+    fn tmpfs_reservation(
+        execution: &Execution,
+        dep_keys: &HashMap<FileUuid, FileStoreHandle>,
+    ) -> Option<u64> {
+        let per_output = execution
+            .limits
+            .fsize
+            .map_or(TMPFS_OUTPUT_RESERVATION, |fsize| {
+                fsize.min(TMPFS_OUTPUT_RESERVATION)
+            });
+        let mut size = 0u64;
+        let stdin = match execution.stdin {
+            ExecutionInputBehaviour::File(stdin) => Some(stdin),
+            _ => None,
+        };
+        let inputs = execution.input_files.values().map(|input| input.file);
+        for input in stdin.into_iter().chain(inputs) {
+            size = size.checked_add(dep_keys.get(&input)?.size())?;
+        }
+        let captured = [&execution.stdout, &execution.stderr]
+            .into_iter()
+            .filter(|stream| matches!(stream, ExecutionOutputBehaviour::Capture { .. }))
+            .count();
+        let outputs = (execution.output_files.len() + captured) as u64;
+        size.checked_add(per_output.checked_mul(outputs)?)
+    }
+
+    /// Whether the sandbox is on the tmpfs and it's using more than it reserved: the tmpfs may have
+    /// been full while it was running.
+    pub fn exceeded_tmpfs_reservation(&self) -> bool {
+        let data = self.data.lock().unwrap();
+        data.boxdir
+            .as_ref()
+            .map_or(false, PooledDir::exceeded_reservation)
+    }
+
+    /// Setup the sandbox directory with all the files required for the execution. The directory
+    /// already contains the skeleton made by the pool.
     fn setup<P: AsRef<Path>>(
         box_dir: P,
         execution: &Execution,
@@ -462,21 +572,6 @@ impl Sandbox {
             box_dir,
             execution.description
         );
-        Self::create_sandbox_dir(box_dir, "box")?;
-        // put /etc/passwd inside the sandbox
-        Self::create_sandbox_dir(box_dir, "etc")?;
-        std::fs::write(
-            box_dir.join("etc").join("passwd"),
-            "root::0:0::/:/bin/sh\n\
-            nobody::1000:1000::/:/bin/sh\n",
-        )
-        .with_context(|| {
-            format!(
-                "Failed to write /etc/passwd in the sandbox {}",
-                box_dir.display()
-            )
-        })?;
-
         if let ExecutionInputBehaviour::File(stdin) = execution.stdin {
             Sandbox::write_sandbox_file(
                 &box_dir.join("stdin"),
@@ -484,12 +579,6 @@ impl Sandbox {
                 false,
             )?;
         }
-        if matches!(execution.stdout, ExecutionOutputBehaviour::Capture { .. }) {
-            Sandbox::touch_file(&box_dir.join("stdout"), 0o600)?;
-        }
-        if matches!(execution.stderr, ExecutionOutputBehaviour::Capture { .. }) {
-            Sandbox::touch_file(&box_dir.join("stderr"), 0o600)?;
-        }
         for (path, input) in execution.input_files.iter() {
             Sandbox::write_sandbox_file(
                 &box_dir.join("box").join(path),
@@ -511,13 +600,6 @@ impl Sandbox {
         Ok(())
     }
 
-    /// Create a directory inside the sandbox.
-    fn create_sandbox_dir<P: AsRef<Path>>(box_dir: &Path, path: P) -> Result<(), Error> {
-        let target = box_dir.join(path.as_ref());
-        std::fs::create_dir_all(&target)
-            .with_context(|| format!("Failed to create sandbox directory: {}", target.display()))
-    }
-
     /// Put a file inside the sandbox, creating the directories if needed and making it executable
     /// if needed.
     ///
@@ -531,10 +613,10 @@ impl Sandbox {
         // conditions. If another thread forks while copying the executable (for example spawning a
         // sandbox of another worker) the file descriptor won't be closed while this sandbox tries
         // to exec the process, failing with "Text file busy".
+        // When the store is on another filesystem the file is copied, using a reflink when
+        // possible.
         if std::fs::hard_link(source, dest).is_err() {
-            std::fs::copy(source, dest).with_context(|| {
-                format!("Failed to copy {} -> {}", source.display(), dest.display())
-            })?;
+            copy_file(source, dest)?;
         }
         if executable {
             Sandbox::set_permissions(dest, 0o500)?;
@@ -587,12 +669,19 @@ impl SandboxData {
 
 impl Drop for SandboxData {
     fn drop(&mut self) {
+        let start = Instant::now();
         if self.keep_sandbox {
-            // this will unwrap the directory, dropping the `TempDir` without deleting the directory
-            self.boxdir.take().map(TempDir::keep);
+            // this will take the directory out of the pool without deleting it
+            if let Some(boxdir) = self.boxdir.take() {
+                boxdir.keep();
+            }
         } else if Sandbox::set_permissions(&self.path().join("box"), 0o700).is_err() {
             warn!("Cannot 'chmod 700' the sandbox directory");
         }
+        // give the directory back to the pool now, for measuring it
+        drop(self.boxdir.take());
+        self.overhead
+            .record(OverheadPhase::Teardown, start.elapsed());
     }
 }
 
@@ -600,6 +689,7 @@ impl Drop for SandboxData {
 mod tests {
     use std::collections::HashMap;
     use std::path::Path;
+    use std::time::{Duration, Instant};
 
     #[cfg(not(target_os = "macos"))]
     use tabox::configuration::{DirectoryMount, SandboxConfiguration};
@@ -607,16 +697,18 @@ mod tests {
     use tabox::syscall_filter::SyscallFilterAction;
     use task_maker_dag::{Execution, ExecutionCommand, ExecutionDAGConfig};
 
+    use crate::execution_unit::sandbox_pool::{PooledDir, SandboxPool};
     use crate::execution_unit::Sandbox;
     use crate::ErrorSandboxRunner;
 
     #[test]
-    fn test_remove_sandbox_on_drop() {
+    fn test_clean_sandbox_on_drop() {
         let tmpdir = tempfile::TempDir::new().unwrap();
+        let pool = SandboxPool::new(tmpdir.path()).unwrap();
         let mut exec = Execution::new("test", ExecutionCommand::system("true"));
         exec.output("fooo");
         exec.limits_mut().read_only(true);
-        let sandbox = Sandbox::new(tmpdir.path(), &exec, &HashMap::new(), None).unwrap();
+        let sandbox = Sandbox::new(&pool, &exec, &HashMap::new(), None).unwrap();
         let outfile = sandbox.output_path(Path::new("fooo"));
         if let Err(e) = sandbox.run(&ErrorSandboxRunner, &ExecutionDAGConfig::new()) {
             assert!(e.to_string().contains("Nope"));
@@ -624,9 +716,35 @@ mod tests {
             panic!("Sandbox not called");
         }
         drop(sandbox);
+        // the sandbox is either reset and put back in the pool, or deleted, in the background
+        let start = Instant::now();
+        while outfile.exists() && start.elapsed() < Duration::from_secs(5) {
+            std::thread::sleep(Duration::from_millis(10));
+        }
         assert!(!outfile.exists());
-        assert!(!outfile.parent().unwrap().exists()); // the box/ dir
-        assert!(!outfile.parent().unwrap().parent().unwrap().exists()); // the sandbox dir
+    }
+
+    #[test]
+    fn test_default_execution_on_tmpfs() {
+        let disk = tempfile::TempDir::new().unwrap();
+        let tmpfs = tempfile::TempDir::new().unwrap();
+        let mut pool = SandboxPool::new(disk.path()).unwrap();
+        // the default size of the tmpfs of the workers
+        pool.set_tmpfs(tmpfs.path(), 1024 * 1024 * 1024).unwrap();
+        let mut exec = Execution::new("test", ExecutionCommand::system("true"));
+        exec.output("output");
+        exec.capture_stdout(None);
+        exec.capture_stderr(None);
+
+        let sandbox = Sandbox::new(&pool, &exec, &HashMap::new(), None).unwrap();
+        assert!(sandbox
+            .output_path(Path::new("output"))
+            .starts_with(tmpfs.path()));
+        assert!(!sandbox.exceeded_tmpfs_reservation());
+        let sandbox = Sandbox::new_on_disk(&pool, &exec, &HashMap::new(), None).unwrap();
+        assert!(sandbox
+            .output_path(Path::new("output"))
+            .starts_with(disk.path()));
     }
 
     #[cfg(not(target_os = "macos"))]
@@ -646,7 +764,8 @@ mod tests {
             .allow_multiprocess()
             .memory(1234);
         exec.env("foo", "bar");
-        let sandbox = Sandbox::new(tmpdir.path(), &exec, &HashMap::new(), None).unwrap();
+        let pool = SandboxPool::new(tmpdir.path()).unwrap();
+        let sandbox = Sandbox::new(&pool, &exec, &HashMap::new(), None).unwrap();
         let mut config = SandboxConfiguration::default();
         let dag_config = ExecutionDAGConfig::new();
         sandbox
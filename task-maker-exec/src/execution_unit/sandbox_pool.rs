@@ -0,0 +1,357 @@
+//! A pool of sandbox directories ready to be used.
+//!
+//! Every sandbox needs the same skeleton: the `box/` and `etc/` directories, `/etc/passwd` and the
+//! files for the captured standard output and error. For the tiny executions (checkers,
+//! validators, ...) creating and removing them takes more than running the process, so each worker
+//! keeps some skeletons ready, and the used ones are cleaned up and put back in the pool by a
+//! background thread.
+//!
+//! The sandboxes can also be put on a tmpfs, away from the disk of the store: since the tmpfs is
+//! small, only the sandboxes whose inputs and expected outputs fit in what is left of its budget go
+//! there, the other ones stay on disk.
+
+use std::fs::Permissions;
+use std::os::unix::fs::PermissionsExt;
+use std::path::{Path, PathBuf};
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::sync::mpsc::{channel, Sender};
+use std::sync::{Arc, Mutex};
+
+use anyhow::{Context, Error};
+use tempfile::TempDir;
+
+use crate::overhead::OverheadRecorder;
+
+/// The number of sandbox skeletons kept ready by each pool.
+const POOL_SIZE: usize = 4;
+
+/// The content of `/etc/passwd` inside the sandbox.
+const PASSWD: &str = "root::0:0::/:/bin/sh\nnobody::1000:1000::/:/bin/sh\n";
+
+/// The pools of the sandbox directories of a worker.
+#[derive(Debug)]
+pub struct SandboxPool {
+    /// The sandboxes on disk.
+    disk: DirPool,
+    /// The sandboxes on tmpfs, if enabled.
+    tmpfs: Option<TmpfsPool>,
+    /// Where the sandboxes record the time spent preparing, running and dropping them.
+    overhead: Arc<OverheadRecorder>,
+}
+
+/// The sandboxes on tmpfs, with the bytes reserved by the ones in use.
+#[derive(Debug)]
+struct TmpfsPool {
+    /// The sandboxes on tmpfs.
+    pool: DirPool,
+    /// The number of bytes the sandboxes on tmpfs can use.
+    budget: u64,
+    /// The number of bytes reserved by the sandboxes in use.
+    used: Arc<AtomicU64>,
+}
+
+/// A pool of sandbox directories, all inside the same directory.
+#[derive(Debug)]
+struct DirPool {
+    /// The directory with all the sandboxes.
+    path: PathBuf,
+    /// The skeletons ready to be used.
+    ready: Arc<Mutex<Vec<TempDir>>>,
+    /// Channel for sending the used sandboxes to the thread that resets them.
+    recycler: Sender<TempDir>,
+}
+
+/// A sandbox directory taken from the pool. On drop the directory is given back to the pool.
+#[derive(Debug)]
+pub(crate) struct PooledDir {
+    /// The directory. It's always Some(_) except inside `Drop` and `keep`.
+    dir: Option<TempDir>,
+    /// Where to send the directory after the use.
+    recycler: Sender<TempDir>,
+    /// The bytes reserved on the tmpfs by this sandbox, released on drop.
+    reservation: Option<(Arc<AtomicU64>, u64)>,
+}
+
+impl SandboxPool {
+    /// Make a new pool of sandboxes inside the provided directory, spawning the thread that
+    /// prepares them.
+    pub fn new<P: Into<PathBuf>>(path: P) -> Result<SandboxPool, Error> {
+        Ok(SandboxPool {
+            disk: DirPool::new(path.into())?,
+            tmpfs: None,
+            overhead: Arc::new(OverheadRecorder::new()),
+        })
+    }
+
+    /// Put the sandboxes inside the provided directory, that should be on a tmpfs, as long as the
+    /// space they may use doesn't exceed `budget` bytes.
+    pub fn set_tmpfs<P: Into<PathBuf>>(&mut self, path: P, budget: u64) -> Result<(), Error> {
+        self.tmpfs = Some(TmpfsPool {
+            pool: DirPool::new(path.into())?,
+            budget,
+            used: Arc::new(AtomicU64::new(0)),
+        });
+        Ok(())
+    }
+
+    /// The directory with the sandboxes on disk.
+    pub fn path(&self) -> &Path {
+        &self.disk.path
+    }
+
+    /// The histograms of the time spent around the executions of the sandboxes of this pool.
+    pub(crate) fn overhead(&self) -> &Arc<OverheadRecorder> {
+        &self.overhead
+    }
+
+    /// Get a sandbox skeleton from the pool, making a new one if the pool is empty. `size` is the
+    /// maximum number of bytes the sandbox may use, if known: the sandbox is put on the tmpfs only
+    /// if this fits in what is left of the budget.
+    pub(crate) fn get(&self, size: Option<u64>) -> Result<PooledDir, Error> {
+        if let (Some(tmpfs), Some(size)) = (&self.tmpfs, size) {
+            let reserved = tmpfs
+                .used
+                .fetch_update(Ordering::SeqCst, Ordering::SeqCst, |used| {
+                    used.checked_add(size).filter(|&used| used <= tmpfs.budget)
+                })
+                .is_ok();
+            if reserved {
+                let reservation = Some((tmpfs.used.clone(), size));
+                return match tmpfs.pool.get() {
+                    Ok(dir) => Ok(PooledDir {
+                        dir: Some(dir),
+                        recycler: tmpfs.pool.recycler.clone(),
+                        reservation,
+                    }),
+                    Err(e) => {
+                        tmpfs.used.fetch_sub(size, Ordering::SeqCst);
+                        Err(e)
+                    }
+                };
+            }
+        }
+        Ok(PooledDir {
+            dir: Some(self.disk.get()?),
+            recycler: self.disk.recycler.clone(),
+            reservation: None,
+        })
+    }
+}
+
+impl DirPool {
+    /// Make a new pool of sandboxes inside the provided directory, spawning the thread that
+    /// prepares them.
+    fn new(path: PathBuf) -> Result<DirPool, Error> {
+        std::fs::create_dir_all(&path)
+            .with_context(|| format!("Failed to create sandbox directory at {}", path.display()))?;
+        let ready = Arc::new(Mutex::new(Vec::with_capacity(POOL_SIZE)));
+        let (recycler, receiver) = channel::<TempDir>();
+        {
+            let path = path.clone();
+            let ready = ready.clone();
+            std::thread::Builder::new()
+                .name("Sandbox pool".into())
+                .spawn(move || {
+                    for _ in 0..POOL_SIZE {
+                        match new_skeleton(&path) {
+                            Ok(dir) => ready.lock().unwrap().push(dir),
+                            Err(e) => {
+                                warn!("Failed to prepare a sandbox: {e:?}");
+                                break;
+                            }
+                        }
+                    }
+                    // the loop ends when the pool and all its sandboxes are gone
+                    for dir in receiver {
+                        if ready.lock().unwrap().len() >= POOL_SIZE {
+                            continue;
+                        }
+                        match reset(dir.path()) {
+                            Ok(()) => ready.lock().unwrap().push(dir),
+                            Err(e) => warn!("Failed to reset sandbox: {e:?}"),
+                        }
+                    }
+                })
+                .context("Failed to spawn the sandbox pool thread")?;
+        }
+        Ok(DirPool {
+            path,
+            ready,
+            recycler,
+        })
+    }
+
+    /// Get a sandbox skeleton from the pool, making a new one if the pool is empty.
+    fn get(&self) -> Result<TempDir, Error> {
+        let dir = self.ready.lock().unwrap().pop();
+        match dir {
+            Some(dir) => Ok(dir),
+            None => new_skeleton(&self.path),
+        }
+    }
+}
+
+impl PooledDir {
+    /// The path of the sandbox directory.
+    pub(crate) fn path(&self) -> &Path {
+        // this unwrap is safe since only `Drop` and `keep` remove the directory
+        self.dir.as_ref().expect("sandbox dir is gone").path()
+    }
+
+    /// Whether the directory is on the tmpfs and its content takes more than it reserved.
+    pub(crate) fn exceeded_reservation(&self) -> bool {
+        match &self.reservation {
+            Some((_, size)) => dir_size(self.path()) > *size,
+            None => false,
+        }
+    }
+
+    /// Keep the directory on disk, without giving it back to the pool.
+    pub(crate) fn keep(mut self) {
+        self.dir.take().map(TempDir::keep);
+    }
+}
+
+impl Drop for PooledDir {
+    fn drop(&mut self) {
+        if let Some((used, size)) = self.reservation.take() {
+            used.fetch_sub(size, Ordering::SeqCst);
+        }
+        if let Some(dir) = self.dir.take() {
+            // if the pool is gone the directory is deleted here
+            let _ = self.recycler.send(dir);
+        }
+    }
+}
+
+/// The total size of the files inside a directory, without following the symlinks.
+fn dir_size(path: &Path) -> u64 {
+    let Ok(entries) = std::fs::read_dir(path) else {
+        return 0;
+    };
+    entries
+        .flatten()
+        .map(|entry| match entry.metadata() {
+            Ok(metadata) if metadata.is_dir() => dir_size(&entry.path()),
+            Ok(metadata) => metadata.len(),
+            Err(_) => 0,
+        })
+        .sum()
+}
+
+/// Make a new sandbox directory with its skeleton.
+fn new_skeleton(sandboxes_dir: &Path) -> Result<TempDir, Error> {
+    let dir =
+        TempDir::new_in(sandboxes_dir).context("Failed to create sandbox temporary directory")?;
+    prepare(dir.path())?;
+    Ok(dir)
+}
+
+/// Remove everything from a used sandbox and make its skeleton again.
+fn reset(box_dir: &Path) -> Result<(), Error> {
+    let entries = std::fs::read_dir(box_dir)
+        .with_context(|| format!("Failed to list sandbox {}", box_dir.display()))?;
+    for entry in entries {
+        let entry = entry.context("Failed to list sandbox")?;
+        let path = entry.path();
+        // the symlinks made by the sandboxed process are not followed
+        if entry.file_type().map_or(false, |t| t.is_dir()) {
+            std::fs::remove_dir_all(&path)
+        } else {
+            std::fs::remove_file(&path)
+        }
+        .with_context(|| format!("Failed to remove {}", path.display()))?;
+    }
+    prepare(box_dir)
+}
+
+/// Make the skeleton of a sandbox inside an empty directory.
+fn prepare(box_dir: &Path) -> Result<(), Error> {
+    for dir in ["box", "etc"] {
+        let target = box_dir.join(dir);
+        std::fs::create_dir(&target)
+            .with_context(|| format!("Failed to create sandbox directory: {}", target.display()))?;
+    }
+    std::fs::write(box_dir.join("etc").join("passwd"), PASSWD).with_context(|| {
+        format!(
+            "Failed to write /etc/passwd in the sandbox {}",
+            box_dir.display()
+        )
+    })?;
+    for file in ["stdout", "stderr"] {
+        let target = box_dir.join(file);
+        std::fs::File::create(&target)
+            .with_context(|| format!("Failed to create {}", target.display()))?;
+        std::fs::set_permissions(&target, Permissions::from_mode(0o600))
+            .with_context(|| format!("Failed to chmod 600 {}", target.display()))?;
+    }
+    Ok(())
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_reset() {
+        let tmpdir = tempfile::TempDir::new().unwrap();
+        let box_dir = tmpdir.path();
+        prepare(box_dir).unwrap();
+        std::fs::write(box_dir.join("stdout"), "output").unwrap();
+        std::fs::create_dir_all(box_dir.join("box/sub/dir")).unwrap();
+        std::fs::write(box_dir.join("box/sub/dir/file"), "file").unwrap();
+        std::fs::write(box_dir.join("info.json"), "{}").unwrap();
+
+        reset(box_dir).unwrap();
+        let mut entries: Vec<_> = std::fs::read_dir(box_dir)
+            .unwrap()
+            .map(|e| e.unwrap().file_name().into_string().unwrap())
+            .collect();
+        entries.sort();
+        assert_eq!(entries, vec!["box", "etc", "stderr", "stdout"]);
+        assert_eq!(std::fs::read_dir(box_dir.join("box")).unwrap().count(), 0);
+        assert!(std::fs::read(box_dir.join("stdout")).unwrap().is_empty());
+        assert_eq!(
+            std::fs::read_to_string(box_dir.join("etc/passwd")).unwrap(),
+            PASSWD
+        );
+    }
+
+    #[test]
+    fn test_tmpfs_budget() {
+        let disk = tempfile::TempDir::new().unwrap();
+        let tmpfs = tempfile::TempDir::new().unwrap();
+        let mut pool = SandboxPool::new(disk.path()).unwrap();
+        pool.set_tmpfs(tmpfs.path(), 100).unwrap();
+
+        let first = pool.get(Some(60)).unwrap();
+        assert!(first.path().starts_with(tmpfs.path()));
+        // doesn't fit in what's left of the budget
+        let second = pool.get(Some(60)).unwrap();
+        assert!(second.path().starts_with(disk.path()));
+        // unknown size
+        let third = pool.get(None).unwrap();
+        assert!(third.path().starts_with(disk.path()));
+        drop(first);
+        let fourth = pool.get(Some(60)).unwrap();
+        assert!(fourth.path().starts_with(tmpfs.path()));
+    }
+
+    #[test]
+    fn test_exceeded_reservation() {
+        let disk = tempfile::TempDir::new().unwrap();
+        let tmpfs = tempfile::TempDir::new().unwrap();
+        let mut pool = SandboxPool::new(disk.path()).unwrap();
+        pool.set_tmpfs(tmpfs.path(), 1000).unwrap();
+
+        let dir = pool.get(Some(100)).unwrap();
+        std::fs::write(dir.path().join("box/output"), [0; 50]).unwrap();
+        assert!(!dir.exceeded_reservation());
+        std::fs::write(dir.path().join("box/output"), [0; 150]).unwrap();
+        assert!(dir.exceeded_reservation());
+        // the sandboxes on disk have no reservation
+        let dir = pool.get(None).unwrap();
+        std::fs::write(dir.path().join("box/output"), [0; 150]).unwrap();
+        assert!(!dir.exceeded_reservation());
+    }
+}
@@ -0,0 +1,189 @@
+use std::collections::HashMap;
+use std::path::PathBuf;
+use std::time::Instant;
+
+use anyhow::{bail, Error};
+use task_maker_dag::{
+    Execution, ExecutionCommand, ExecutionResourcesUsage, FileUuid, TokenDiffOptions,
+};
+use task_maker_store::FileStoreHandle;
+
+use crate::execution_unit::white_diff::{input_path, map_file};
+use crate::execution_unit::SandboxResult;
+
+/// Token by token comparison of two files, done by task-maker itself without spawning a sandbox.
+///
+/// The files are memory-mapped and compared in a single pass, without storing the tokens, so the
+/// memory used does not depend on the size of the files.
+#[derive(Debug, Clone)]
+pub struct TokenDiff {
+    /// Path to the correct file.
+    correct: PathBuf,
+    /// Path to the file to check.
+    test: PathBuf,
+    /// How the tokens are compared.
+    options: TokenDiffOptions,
+}
+
+impl TokenDiff {
+    /// Prepare the comparison of the files of an execution with the `TokenDiff` command.
+    pub fn new(
+        execution: &Execution,
+        dep_keys: &HashMap<FileUuid, FileStoreHandle>,
+    ) -> Result<TokenDiff, Error> {
+        let ExecutionCommand::TokenDiff {
+            correct,
+            test,
+            options,
+        } = &execution.command
+        else {
+            bail!("building a token diff for a non-token-diff execution");
+        };
+        Ok(TokenDiff {
+            correct: input_path(execution, dep_keys, correct)?,
+            test: input_path(execution, dep_keys, test)?,
+            options: *options,
+        })
+    }
+
+    /// Compare the files. Like `diff`, the exit status of the result is 0 if the files are equal
+    /// and 1 if they differ.
+    pub fn run(&mut self) -> Result<SandboxResult, Error> {
+        let start = Instant::now();
+        let correct = map_file(&self.correct)?;
+        let test = map_file(&self.test)?;
+        let equal = tokens_equal(
+            correct.as_deref().unwrap_or_default(),
+            test.as_deref().unwrap_or_default(),
+            &self.options,
+        );
+        Ok(SandboxResult::Success {
+            exit_status: if equal { 0 } else { 1 },
+            signal: None,
+            resources: ExecutionResourcesUsage {
+                wall_time: start.elapsed().as_secs_f64(),
+                ..Default::default()
+            },
+            was_killed: false,
+        })
+    }
+}
+
+/// Check whether the two files have the same tokens, compared with the rules in `options`. The
+/// comparison stops at the first token that differs.
+pub fn tokens_equal(correct: &[u8], test: &[u8], options: &TokenDiffOptions) -> bool {
+    if correct == test {
+        return true;
+    }
+    let mut correct = Tokens { data: correct };
+    let mut test = Tokens { data: test };
+    loop {
+        match (correct.next(), test.next()) {
+            (None, None) => return true,
+            (Some(x), Some(y)) if token_equal(x, y, options) => {}
+            _ => return false,
+        }
+    }
+}
+
+/// Check whether the token of the file to check matches the correct one.
+fn token_equal(correct: &[u8], test: &[u8], options: &TokenDiffOptions) -> bool {
+    if correct == test || (options.ignore_case && correct.eq_ignore_ascii_case(test)) {
+        return true;
+    }
+    if options.absolute_tolerance.is_none() && options.relative_tolerance.is_none() {
+        return false;
+    }
+    let (Some(correct), Some(test)) = (parse_number(correct), parse_number(test)) else {
+        return false;
+    };
+    let diff = (correct - test).abs();
+    // the comparisons are false for NaN, so a NaN never matches a different token
+    options
+        .absolute_tolerance
+        .is_some_and(|tolerance| diff <= tolerance)
+        || options
+            .relative_tolerance
+            .is_some_and(|tolerance| diff <= tolerance * correct.abs())
+}
+
+/// Parse a token as a finite number.
+fn parse_number(token: &[u8]) -> Option<f64> {
+    let number: f64 = std::str::from_utf8(token).ok()?.parse().ok()?;
+    number.is_finite().then_some(number)
+}
+
+/// Iterator over the tokens of a file, the sequences of non-whitespace characters.
+struct Tokens<'a> {
+    /// The part of the file not yet iterated.
+    data: &'a [u8],
+}
+
+impl<'a> Iterator for Tokens<'a> {
+    type Item = &'a [u8];
+
+    fn next(&mut self) -> Option<Self::Item> {
+        let start = self.data.iter().position(|c| !c.is_ascii_whitespace())?;
+        let data = &self.data[start..];
+        let end = data
+            .iter()
+            .position(|c| c.is_ascii_whitespace())
+            .unwrap_or(data.len());
+        self.data = &data[end..];
+        Some(&data[..end])
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn check(a: &str, b: &str, options: TokenDiffOptions, equal: bool) {
+        assert_eq!(
+            tokens_equal(a.as_bytes(), b.as_bytes(), &options),
+            equal,
+            "{a:?} {b:?} {options:?}"
+        );
+    }
+
+    #[test]
+    fn test_tokens_equal_exact() {
+        let exact = TokenDiffOptions::default();
+        check("", "\n \n", exact, true);
+        check("a b\nc\n", "a\n\nb c", exact, true);
+        check("a b", "ab", exact, false);
+        check("a b", "a b c", exact, false);
+        check("1.0", "1", exact, false);
+        check("Yes", "yes", exact, false);
+    }
+
+    #[test]
+    fn test_tokens_equal_ignore_case() {
+        let options = TokenDiffOptions {
+            ignore_case: true,
+            ..Default::default()
+        };
+        check("Yes NO", "yes no", options, true);
+        check("Yes", "yep", options, false);
+    }
+
+    #[test]
+    fn test_tokens_equal_tolerance() {
+        let absolute = TokenDiffOptions {
+            absolute_tolerance: Some(1e-6),
+            ..Default::default()
+        };
+        check("1.0 2", "1.0000001 2.0", absolute, true);
+        check("1.0", "1.001", absolute, false);
+        check("1.0", "nan", absolute, false);
+        check("inf", "inf", absolute, true);
+        check("1.0", "abc", absolute, false);
+        let relative = TokenDiffOptions {
+            relative_tolerance: Some(1e-3),
+            ..Default::default()
+        };
+        check("1000000", "1000500", relative, true);
+        check("1000000", "1002000", relative, false);
+        check("0", "0.0001", relative, false);
+    }
+}
@@ -0,0 +1,255 @@
+use std::collections::HashMap;
+use std::fs::File;
+use std::path::{Path, PathBuf};
+use std::time::Instant;
+
+use anyhow::{bail, Context, Error};
+use memmap2::Mmap;
+use task_maker_dag::{Execution, ExecutionCommand, ExecutionResourcesUsage, FileUuid};
+use task_maker_store::FileStoreHandle;
+
+use crate::execution_unit::SandboxResult;
+
+/// Size of the blocks compared at once while looking for the first difference between the files.
+const BLOCK_SIZE: usize = 64;
+
+/// Whitespace-insensitive comparison of two files, done by task-maker itself without spawning a
+/// sandbox.
+///
+/// The files are considered equal with the same rules as `diff --ignore-blank-lines
+/// --ignore-space-change`: the lines made only of whitespace are ignored, and inside a line any
+/// non-empty sequence of whitespace matches any other, while the trailing whitespace is ignored.
+#[derive(Debug, Clone)]
+pub struct WhiteDiff {
+    /// Path to the first file to compare.
+    correct: PathBuf,
+    /// Path to the second file to compare.
+    test: PathBuf,
+}
+
+impl WhiteDiff {
+    /// Prepare the comparison of the files of an execution with the `WhiteDiff` command.
+    pub fn new(
+        execution: &Execution,
+        dep_keys: &HashMap<FileUuid, FileStoreHandle>,
+    ) -> Result<WhiteDiff, Error> {
+        let ExecutionCommand::WhiteDiff { correct, test } = &execution.command else {
+            bail!("building a white diff for a non-white-diff execution");
+        };
+        Ok(WhiteDiff {
+            correct: input_path(execution, dep_keys, correct)?,
+            test: input_path(execution, dep_keys, test)?,
+        })
+    }
+
+    /// Compare the files. Like `diff`, the exit status of the result is 0 if the files are equal
+    /// and 1 if they differ.
+    pub fn run(&mut self) -> Result<SandboxResult, Error> {
+        let start = Instant::now();
+        let correct = map_file(&self.correct)?;
+        let test = map_file(&self.test)?;
+        let equal = white_equal(
+            correct.as_deref().unwrap_or_default(),
+            test.as_deref().unwrap_or_default(),
+        );
+        Ok(SandboxResult::Success {
+            exit_status: if equal { 0 } else { 1 },
+            signal: None,
+            resources: ExecutionResourcesUsage {
+                wall_time: start.elapsed().as_secs_f64(),
+                ..Default::default()
+            },
+            was_killed: false,
+        })
+    }
+}
+
+/// The path in the store of the input file of the execution at `path` inside the sandbox.
+pub(crate) fn input_path(
+    execution: &Execution,
+    dep_keys: &HashMap<FileUuid, FileStoreHandle>,
+    path: &Path,
+) -> Result<PathBuf, Error> {
+    let input = execution
+        .input_files
+        .get(path)
+        .with_context(|| format!("{} is not an input of the execution", path.display()))?;
+    Ok(dep_keys
+        .get(&input.file)
+        .context("file not provided")?
+        .path()
+        .to_owned())
+}
+
+/// Map a file in memory. Empty files cannot be mapped, for them `None` is returned.
+pub(crate) fn map_file(path: &Path) -> Result<Option<Mmap>, Error> {
+    let file = File::open(path).with_context(|| format!("Failed to open {}", path.display()))?;
+    let len = file
+        .metadata()
+        .with_context(|| format!("Failed to stat {}", path.display()))?
+        .len();
+    if len == 0 {
+        return Ok(None);
+    }
+    // Safety: the files in the store are never modified while they are in use.
+    let mmap =
+        unsafe { Mmap::map(&file) }.with_context(|| format!("Failed to map {}", path.display()))?;
+    let _ = mmap.advise(memmap2::Advice::Sequential);
+    Ok(Some(mmap))
+}
+
+/// Whether the character is considered whitespace inside a line.
+fn is_space(c: u8) -> bool {
+    matches!(c, b' ' | b'\t' | b'\r' | b'\x0b' | b'\x0c')
+}
+
+/// Find the position of the first byte that differs between the two slices, or the length of the
+/// shortest one if it is a prefix of the other.
+fn first_difference(a: &[u8], b: &[u8]) -> usize {
+    let len = a.len().min(b.len());
+    let (a, b) = (&a[..len], &b[..len]);
+    // Compare whole blocks first: the comparison of two slices is done with memcmp, which is much
+    // faster than checking byte by byte.
+    let block = a
+        .chunks_exact(BLOCK_SIZE)
+        .zip(b.chunks_exact(BLOCK_SIZE))
+        .position(|(x, y)| x != y)
+        .unwrap_or(len / BLOCK_SIZE);
+    let start = block * BLOCK_SIZE;
+    a[start..]
+        .iter()
+        .zip(&b[start..])
+        .position(|(x, y)| x != y)
+        .map_or(len, |pos| start + pos)
+}
+
+/// Check whether the two files are equal ignoring the whitespace differences. The comparison stops
+/// at the first line that differs.
+pub fn white_equal(a: &[u8], b: &[u8]) -> bool {
+    // Most outputs are byte-by-byte equal to the correct ones.
+    if a == b {
+        return true;
+    }
+    // The lines before the first difference are identical, so start from the line containing it.
+    let diff = first_difference(a, b);
+    let start = a[..diff]
+        .iter()
+        .rposition(|&c| c == b'\n')
+        .map_or(0, |pos| pos + 1);
+    let mut a = NonBlankLines::new(&a[start..]);
+    let mut b = NonBlankLines::new(&b[start..]);
+    loop {
+        match (a.next(), b.next()) {
+            (None, None) => return true,
+            (Some(x), Some(y)) if lines_equal(x, y) => {}
+            _ => return false,
+        }
+    }
+}
+
+/// Check whether two lines are equal ignoring the amount of whitespace.
+fn lines_equal(x: &[u8], y: &[u8]) -> bool {
+    if x == y {
+        return true;
+    }
+    let (mut i, mut j) = (0, 0);
+    loop {
+        let x_space = i < x.len() && is_space(x[i]);
+        let y_space = j < y.len() && is_space(y[j]);
+        if x_space {
+            while i < x.len() && is_space(x[i]) {
+                i += 1;
+            }
+        }
+        if y_space {
+            while j < y.len() && is_space(y[j]) {
+                j += 1;
+            }
+        }
+        // The trailing whitespace is ignored.
+        if i == x.len() || j == y.len() {
+            return i == x.len() && j == y.len();
+        }
+        if x_space != y_space || x[i] != y[j] {
+            return false;
+        }
+        i += 1;
+        j += 1;
+    }
+}
+
+/// Iterator over the lines of a file that contain something other than whitespace.
+struct NonBlankLines<'a> {
+    /// The part of the file not yet iterated.
+    data: &'a [u8],
+}
+
+impl<'a> NonBlankLines<'a> {
+    fn new(data: &'a [u8]) -> Self {
+        Self { data }
+    }
+}
+
+impl<'a> Iterator for NonBlankLines<'a> {
+    type Item = &'a [u8];
+
+    fn next(&mut self) -> Option<Self::Item> {
+        while !self.data.is_empty() {
+            let (line, rest) = match self.data.iter().position(|&c| c == b'\n') {
+                Some(end) => (&self.data[..end], &self.data[end + 1..]),
+                None => (self.data, &[][..]),
+            };
+            self.data = rest;
+            if !line.iter().all(|&c| is_space(c)) {
+                return Some(line);
+            }
+        }
+        None
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn check(a: &str, b: &str, equal: bool) {
+        assert_eq!(
+            white_equal(a.as_bytes(), b.as_bytes()),
+            equal,
+            "{a:?} {b:?}"
+        );
+        assert_eq!(
+            white_equal(b.as_bytes(), a.as_bytes()),
+            equal,
+            "{b:?} {a:?}"
+        );
+    }
+
+    #[test]
+    fn test_white_equal() {
+        check("", "", true);
+        check("", "\n \n", true);
+        check("a\n", "a", true);
+        check("a\n", "a \n", true);
+        check("a b\n", "a\tb\r\n", true);
+        check("a\x0bb\n", "a b\n", true);
+        check("a\n", "\n \na\n", true);
+        check("a\n\n\nb\n", "a\nb\n\n\n", true);
+        check("a", " a", false);
+        check("ab", "a b", false);
+        check("a\nb\n", "a\nc\n", false);
+        check("a\nb\n", "a\n", false);
+    }
+
+    #[test]
+    fn test_white_equal_long() {
+        let correct = (0..1000)
+            .map(|i| format!("{i} {}\n", i * i))
+            .collect::<String>();
+        let spaced = correct.replace(' ', "  ").replace('\n', " \r\n");
+        check(&correct, &spaced, true);
+        let wrong = correct.replace("500 250000", "500 250001");
+        check(&correct, &wrong, false);
+        check(&correct, &correct[..correct.len() - 10], false);
+    }
+}
@@ -1,4 +1,4 @@
-use std::collections::{HashMap, HashSet};
+use std::collections::{BTreeMap, HashMap, HashSet};
 use std::sync::mpsc::{channel, Receiver, Sender};
 use std::sync::{Arc, Mutex};
 use std::thread;
@@ -8,7 +8,9 @@ use anyhow::{anyhow, Context, Error};
 use ductile::{ChannelReceiver, ChannelSender};
 use serde::{Deserialize, Serialize};
 use task_maker_cache::Cache;
-use task_maker_dag::{ExecutionGroup, ExecutionGroupUuid, FileUuid, ProvidedFile, WorkerUuid};
+use task_maker_dag::{
+    CompactDAG, ExecutionGroup, ExecutionGroupUuid, FileUuid, ProvidedFile, WorkerUuid,
+};
 use task_maker_store::{FileStore, FileStoreHandle, FileStoreKey};
 
 use crate::check_dag::check_dag;
@@ -20,7 +22,7 @@ use crate::scheduler::{
     SchedulerInMessage,
 };
 use crate::worker_manager::{WorkerManager, WorkerManagerInMessage};
-use crate::WorkerConn;
+use crate::{OverheadHistograms, WorkerConn, WorkerHealth};
 
 /// List of the _interesting_ files and executions, only the callbacks listed here will be called by
 /// the server. Every other callback is not sent to the client for performance reasons.
@@ -40,8 +42,8 @@ pub struct ExecutionDAGWatchSet {
 /// start the evaluation.
 #[derive(Debug, Clone, Serialize, Deserialize)]
 pub struct WorkerJob {
-    /// What the worker should do.
-    pub group: ExecutionGroup,
+    /// What the worker should do, shared with the DAG of the scheduler.
+    pub group: Arc<ExecutionGroup>,
     /// The `FileStoreKey`s the worker has to know to start the evaluation.
     pub dep_keys: HashMap<FileUuid, FileStoreKey>,
 }
@@ -78,6 +80,8 @@ pub struct ExecutorWorkerStatus<T> {
     pub name: String,
     /// What the worker is currently working on.
     pub current_job: Option<WorkerCurrentJobStatus<T>>,
+    /// The last health the worker reported, if any.
+    pub health: Option<WorkerHealth>,
 }
 
 /// The current status of the `Executor`, this is sent to the user when the server status is asked.
@@ -92,6 +96,76 @@ pub struct ExecutorStatus<T> {
     pub ready_execs: usize,
     /// Number of executions waiting for dependencies.
     pub waiting_execs: usize,
+    /// The estimated cost of the DAG of the client, computed in estimate-only mode once all the
+    /// files provided by the client are ready.
+    pub cost_estimate: Option<CostEstimate>,
+}
+
+/// The estimated cost of evaluating a DAG, from the cache of the executor.
+///
+/// The execution groups are looked up in the cache in the order of their dependencies: the outputs
+/// of the cache hits are known, so the groups using them can be looked up too. The groups that miss
+/// the cache, and all the ones depending on them, are assumed to run, taking the average time of
+/// the cached executions with the same shape.
+#[derive(Debug, Clone, Default, Serialize, Deserialize, PartialEq, Eq)]
+pub struct CostEstimate {
+    /// The estimate of the groups by the name of their tag, `"untagged"` for the ones without.
+    pub tags: BTreeMap<String, TagCostEstimate>,
+    /// The estimated time of the longest chain of groups that will run.
+    pub critical_path: Duration,
+    /// The number of workers connected to the executor.
+    pub connected_workers: usize,
+}
+
+/// The estimated cost of the execution groups with the same tag.
+#[derive(Debug, Clone, Default, Serialize, Deserialize, PartialEq, Eq)]
+pub struct TagCostEstimate {
+    /// The number of groups that will be cache hits.
+    pub cache_hits: usize,
+    /// The number of groups that will run.
+    pub cache_misses: usize,
+    /// The number of groups that will run and that have never run before: their duration is just
+    /// a guess.
+    pub unknown: usize,
+    /// The estimated time a single worker would take to run the groups.
+    pub compute_time: Duration,
+}
+
+impl CostEstimate {
+    /// The estimated time a single worker would take to run all the groups.
+    pub fn compute_time(&self) -> Duration {
+        self.tags.values().map(|tag| tag.compute_time).sum()
+    }
+
+    /// The estimated time the evaluation will take with the connected workers: the groups cannot
+    /// finish before their longest chain, nor before the workers have run all of them. `None` if
+    /// there are no workers.
+    pub fn wall_time(&self) -> Option<Duration> {
+        if self.connected_workers == 0 {
+            return None;
+        }
+        let parallel = self.compute_time() / self.connected_workers as u32;
+        Some(parallel.max(self.critical_path))
+    }
+}
+
+/// The load of the `Executor`, periodically sent to the ones interested, for example for scaling the
+/// number of workers.
+#[derive(Debug, Clone, Default, Serialize, Deserialize, PartialEq)]
+pub struct ExecutorMetrics {
+    /// Number of connected workers.
+    pub connected_workers: usize,
+    /// Number of connected workers without a job.
+    pub idle_workers: usize,
+    /// Number of executions waiting for workers.
+    pub ready_execs: usize,
+    /// Number of executions waiting for dependencies.
+    pub waiting_execs: usize,
+    /// The estimated time a single worker would take to run all the executions waiting for
+    /// workers.
+    pub backlog: Duration,
+    /// The time spent by each worker in the phases of its executions, by the name of the worker.
+    pub worker_overhead: BTreeMap<String, OverheadHistograms>,
 }
 
 /// Message telling the executor that a new client connected or a new worker connected. The handling
@@ -113,6 +187,9 @@ pub enum ExecutorInMessage {
         /// The information and connection details of the worker.
         worker: WorkerConn,
     },
+    /// The executor should stop, even if it's long running, making the scheduler exit and store
+    /// the cache.
+    Stop,
 }
 
 /// The `Executor` is the main component of the server, this will listen for client and worker
@@ -132,6 +209,18 @@ pub(crate) struct Executor {
     /// flag is set to false, after the first client is done the Scheduler, the WorkerManager and
     /// this Executor will exit.
     long_running: bool,
+    /// The maximum number of jobs of the same client running at the same time, if any.
+    max_jobs_per_client: Option<usize>,
+    /// The maximum share of the workers a client can ask for, if any.
+    max_fair_share: Option<f64>,
+    /// The total memory limit, in KiB, of the jobs running at the same time, if any.
+    memory_budget: Option<u64>,
+    /// Whether the jobs stuck on a slow worker are started also on an idle one.
+    speculative_execution: bool,
+    /// Whether the clients run on the same machine, so their local files can be read directly.
+    local_clients: bool,
+    /// Where to send the metrics of the scheduler, if anywhere.
+    metrics: Option<Sender<ExecutorMetrics>>,
 }
 
 impl Executor {
@@ -150,9 +239,55 @@ impl Executor {
             cache,
             receiver,
             long_running,
+            max_jobs_per_client: None,
+            max_fair_share: None,
+            memory_budget: None,
+            speculative_execution: false,
+            local_clients: false,
+            metrics: None,
         }
     }
 
+    /// Keep running after the first client is done, accepting new clients until the scheduler is
+    /// stopped.
+    pub fn set_long_running(&mut self, long_running: bool) {
+        self.long_running = long_running;
+    }
+
+    /// Limit the number of jobs of the same client running at the same time, leaving the other
+    /// workers to the other clients.
+    pub fn set_max_jobs_per_client(&mut self, max_jobs_per_client: Option<usize>) {
+        self.max_jobs_per_client = max_jobs_per_client;
+    }
+
+    /// Cap the share of the workers that a client can ask for.
+    pub fn set_max_fair_share(&mut self, max_fair_share: Option<f64>) {
+        self.max_fair_share = max_fair_share;
+    }
+
+    /// Limit the sum of the memory limits, in KiB, of the jobs running at the same time. This
+    /// makes sense only when all the workers run on the same machine.
+    pub fn set_memory_budget(&mut self, memory_budget: Option<u64>) {
+        self.memory_budget = memory_budget;
+    }
+
+    /// Start a copy of the jobs running for much longer than expected on an idle worker, accepting
+    /// the first result.
+    pub fn set_speculative_execution(&mut self, speculative_execution: bool) {
+        self.speculative_execution = speculative_execution;
+    }
+
+    /// Send the metrics of the scheduler to this channel, every few seconds.
+    pub fn set_metrics_sender(&mut self, metrics: Sender<ExecutorMetrics>) {
+        self.metrics = Some(metrics);
+    }
+
+    /// Store the local files provided by the clients reading them from disk, instead of asking the
+    /// clients to send them. This makes sense only when the clients run on the same machine.
+    pub fn set_local_clients(&mut self, local_clients: bool) {
+        self.local_clients = local_clients;
+    }
+
     /// Run the `Executor`, listening for client and worker connections. This will block until the
     /// first client is done (if `long_running` is false) or until the scheduler is stopped.
     pub fn run(self) -> Result<(), Error> {
@@ -162,13 +297,20 @@ impl Executor {
 
         let clients = Arc::new(Mutex::new(HashMap::new()));
 
-        let scheduler = Scheduler::new(
+        let mut scheduler = Scheduler::new(
             self.file_store.clone(),
             self.cache,
             scheduler_rx,
             sched_executor_tx,
             worker_manager_tx.clone(),
         );
+        scheduler.set_max_jobs_per_client(self.max_jobs_per_client);
+        scheduler.set_max_fair_share(self.max_fair_share);
+        scheduler.set_memory_budget(self.memory_budget);
+        scheduler.set_speculative_execution(self.speculative_execution);
+        if let Some(metrics) = self.metrics {
+            scheduler.set_metrics_sender(metrics);
+        }
         let worker_manager = WorkerManager::new(
             self.file_store.clone(),
             scheduler_tx.clone(),
@@ -203,6 +345,7 @@ impl Executor {
                     let scheduler = scheduler_tx.clone();
                     let file_store = self.file_store.clone();
                     let long_running = self.long_running;
+                    let local_clients = self.local_clients;
                     // handle the new client in a new thread called "Client Manager"
                     // FIXME: this thread is leaked, maybe we can join it as well
                     thread::Builder::new()
@@ -213,6 +356,7 @@ impl Executor {
                         .spawn(move || -> Result<(), Error> {
                             Executor::handle_client_messages(
                                 file_store,
+                                local_clients,
                                 client,
                                 sender,
                                 receiver,
@@ -237,6 +381,12 @@ impl Executor {
                         .send(WorkerManagerInMessage::WorkerConnected { worker })
                         .map_err(|e| anyhow!("Cannot send WorkerConnected: {:?}", e))?;
                 }
+                ExecutorInMessage::Stop => {
+                    scheduler_tx
+                        .send(SchedulerInMessage::Exit)
+                        .map_err(|e| anyhow!("Cannot stop the scheduler: {:?}", e))?;
+                    break;
+                }
             }
         }
         debug!("Executor no longer waits for clients/workers");
@@ -328,6 +478,7 @@ impl Executor {
     /// Handle the messages from a client.
     fn handle_client_messages(
         file_store: Arc<FileStore>,
+        local_clients: bool,
         client: ClientInfo,
         sender: ChannelSender<ExecutorServerMessage>,
         receiver: ChannelReceiver<ExecutorClientMessage>,
@@ -337,6 +488,7 @@ impl Executor {
         while let Ok(message) = receiver.recv() {
             match message {
                 ExecutorClientMessage::Evaluate { dag, callbacks } => {
+                    let (dag, provided_files) = CompactDAG::with_provided_files(*dag);
                     if let Err(e) = check_dag(&dag, &callbacks) {
                         warn!("Invalid DAG: {e:?}");
                         sender
@@ -349,12 +501,26 @@ impl Executor {
                     // for each file marked as provided check if a local copy is present, otherwise
                     // ask the client to send it.
                     let mut ready_files = Vec::new();
-                    for (uuid, file) in dag.provided_files.iter() {
-                        let key = match file {
-                            ProvidedFile::Content { key, .. } => key,
-                            ProvidedFile::LocalFile { key, .. } => key,
+                    for (uuid, file) in provided_files.iter() {
+                        let (key, local_path) = match file {
+                            ProvidedFile::Content { key, .. } => (key, None),
+                            ProvidedFile::LocalFile {
+                                key, local_path, ..
+                            } => (key, Some(local_path)),
                         };
-                        let handle = file_store.get(key);
+                        let mut handle = file_store.get(key);
+                        match local_path {
+                            Some(local_path) if handle.is_none() && local_clients => {
+                                handle = match file_store.store_file(key, local_path) {
+                                    Ok(handle) => Some(handle),
+                                    Err(e) => {
+                                        warn!("Failed to store local file {uuid}: {e:?}");
+                                        None
+                                    }
+                                };
+                            }
+                            _ => {}
+                        }
                         if let Some(handle) = handle {
                             ready_files.push((*uuid, handle));
                         } else {
@@ -369,7 +535,7 @@ impl Executor {
                         .ok_or_else(|| anyhow!("Stopped execution"))?
                         .send(SchedulerInMessage::EvaluateDAG {
                             client: client.clone(),
-                            dag,
+                            dag: Box::new(dag),
                             callbacks,
                         })
                         .context("Failed to send EvaluateDAG to the scheduler")?;
@@ -434,6 +600,16 @@ impl Executor {
                         });
                     }
                 }
+                ExecutorClientMessage::Skip(groups) => {
+                    info!("Client asking to skip {} executions", groups.len());
+                    // This may fail is the scheduler is gone.
+                    if let Some(scheduler) = scheduler.as_ref() {
+                        let _ = scheduler.send(SchedulerInMessage::SkipExecutions {
+                            client: client.uuid,
+                            groups,
+                        });
+                    }
+                }
                 ExecutorClientMessage::Stop => {
                     info!("Client asking to stop");
                     if let Some(scheduler) = scheduler.take() {
@@ -1,14 +1,15 @@
 use std::path::PathBuf;
 use std::sync::mpsc::{channel, Sender};
-use std::sync::Arc;
+use std::sync::{Arc, Mutex};
 use std::thread::{self, JoinHandle};
 
 use anyhow::{anyhow, Context, Error};
-use ductile::{ChannelReceiver, ChannelSender};
+use ductile::{new_local_channel, ChannelReceiver, ChannelSender};
 use task_maker_cache::Cache;
 use task_maker_store::FileStore;
 use uuid::Uuid;
 
+use crate::cpu_pinning::CpuPinning;
 use crate::executor::{Executor, ExecutorInMessage};
 use crate::proto::{ExecutorClientMessage, ExecutorServerMessage};
 use crate::sandbox_runner::SandboxRunner;
@@ -27,6 +28,16 @@ pub struct LocalExecutor {
     workers: Vec<JoinHandle<Result<(), Error>>>,
 }
 
+/// A handle to a [`LocalExecutor`] started with [`LocalExecutor::serve`], for connecting new
+/// clients to it.
+#[derive(Clone)]
+pub struct LocalExecutorConnector {
+    /// Channel sending messages to the executor.
+    executor_tx: Sender<ExecutorInMessage>,
+    /// Join handle of the thread of the executor, taken by the first call to `stop`.
+    executor_thread: Arc<Mutex<Option<JoinHandle<()>>>>,
+}
+
 impl LocalExecutor {
     /// Make a new [`LocalExecutor`] based on a [`FileStore`] and ready to spawn that number of
     /// workers using a [`Cache`].
@@ -40,9 +51,35 @@ impl LocalExecutor {
     where
         R: SandboxRunner + 'static,
     {
+        LocalExecutor::with_cpu_pinning(
+            file_store,
+            cache,
+            num_workers,
+            sandbox_path,
+            sandbox_runner,
+            None,
+        )
+    }
+
+    /// Make a new [`LocalExecutor`] like [`LocalExecutor::new`], optionally pinning the sandboxes
+    /// of all the workers to the cores of the machine according to `cpu_pinning`.
+    pub fn with_cpu_pinning<P: Into<PathBuf>, R>(
+        file_store: Arc<FileStore>,
+        cache: Cache,
+        num_workers: usize,
+        sandbox_path: P,
+        sandbox_runner: R,
+        cpu_pinning: Option<CpuPinning>,
+    ) -> Result<LocalExecutor, Error>
+    where
+        R: SandboxRunner + 'static,
+    {
+        let cpu_pinning = cpu_pinning.map(Arc::new);
         let sandbox_path = sandbox_path.into();
         let (executor_tx, executor_rx) = channel();
-        let executor = Executor::new(file_store.clone(), cache, executor_rx, false);
+        let mut executor = Executor::new(file_store.clone(), cache, executor_rx, false);
+        // the client runs in this process, its files can be stored directly from disk
+        executor.set_local_clients(true);
 
         // share the runner for all the workers
         let sandbox_runner = Arc::new(sandbox_runner);
@@ -52,7 +89,7 @@ impl LocalExecutor {
         // spawn the workers and connect them to the executor
         for i in 0..num_workers {
             let runner = sandbox_runner.clone();
-            let (worker, conn) = Worker::new(
+            let (mut worker, conn) = Worker::new(
                 format!("Local worker {i}"),
                 file_store.clone(),
                 #[allow(clippy::needless_borrow)]
@@ -60,6 +97,11 @@ impl LocalExecutor {
                 runner,
             )
             .context("Failed to start local worker")?;
+            // the server runs in this process, the outputs can be stored directly
+            worker.set_local_server(true);
+            if let Some(cpu_pinning) = &cpu_pinning {
+                worker.set_cpu_pinning(cpu_pinning.clone());
+            }
             executor_tx
                 .send(ExecutorInMessage::WorkerConnected { worker: conn })
                 .map_err(|e| anyhow!("Failed to send WorkerConnected: {:?}", e))?;
@@ -82,6 +124,22 @@ impl LocalExecutor {
         })
     }
 
+    /// Limit the sum of the memory limits, in KiB, of the executions running at the same time,
+    /// so that the machine doesn't start swapping. The executions that don't fit wait, while the
+    /// free workers keep running the ones needing less memory.
+    pub fn set_memory_budget(&mut self, memory_budget: Option<u64>) {
+        self.executor.set_memory_budget(memory_budget);
+    }
+
+    /// The total memory of the machine, in KiB, if it is known.
+    pub fn machine_memory() -> Option<u64> {
+        let meminfo = std::fs::read_to_string("/proc/meminfo").ok()?;
+        meminfo
+            .lines()
+            .find_map(|line| line.strip_prefix("MemTotal:"))
+            .and_then(|value| value.trim().trim_end_matches("kB").trim().parse().ok())
+    }
+
     /// Starts the Executor spawning the workers on new threads and blocking on the `Executor`
     /// thread.
     ///
@@ -121,4 +179,75 @@ impl LocalExecutor {
         }
         Ok(())
     }
+    /// Start the Executor on a new thread, without blocking. Unlike [`LocalExecutor::evaluate`] the
+    /// executor is long running: any number of clients can connect with the returned handle, also
+    /// at the same time, sharing the workers, the file store and the cache. The executor and the
+    /// workers run until [`LocalExecutorConnector::stop`] is called or the process exits. The cache
+    /// is stored periodically in the meantime.
+    pub fn serve(self) -> Result<LocalExecutorConnector, Error> {
+        let LocalExecutor {
+            mut executor,
+            executor_tx,
+            workers,
+            ..
+        } = self;
+        executor.set_long_running(true);
+        let executor_thread = thread::Builder::new()
+            .name("Local executor".into())
+            .spawn(move || {
+                // the workers are never joined, the executor doesn't stop
+                let _workers = workers;
+                if let Err(e) = executor.run() {
+                    error!("Local executor failed: {e:?}");
+                }
+            })
+            .context("Failed to spawn the local executor thread")?;
+        Ok(LocalExecutorConnector {
+            executor_tx,
+            executor_thread: Arc::new(Mutex::new(Some(executor_thread))),
+        })
+    }
+}
+
+impl LocalExecutorConnector {
+    /// Connect a new client to the executor, returning the channels for sending messages to the
+    /// executor and for receiving its answers, as needed by `ExecutorClient::evaluate`.
+    pub fn connect(
+        &self,
+        name: &str,
+    ) -> Result<
+        (
+            ChannelSender<ExecutorClientMessage>,
+            ChannelReceiver<ExecutorServerMessage>,
+        ),
+        Error,
+    > {
+        let (tx, rx_remote) = new_local_channel();
+        let (tx_remote, rx) = new_local_channel();
+        self.executor_tx
+            .send(ExecutorInMessage::ClientConnected {
+                client: ClientInfo {
+                    uuid: Uuid::new_v4(),
+                    name: name.to_string(),
+                },
+                sender: tx_remote,
+                receiver: rx_remote,
+            })
+            .map_err(|e| anyhow!("Failed to send ClientConnected: {:?}", e))?;
+        Ok((tx, rx))
+    }
+
+    /// Stop the executor, blocking until it has stored the cache. The clients still connected are
+    /// abandoned, and the new ones are refused.
+    pub fn stop(&self) -> Result<(), Error> {
+        let Some(executor_thread) = self.executor_thread.lock().unwrap().take() else {
+            return Ok(());
+        };
+        self.executor_tx
+            .send(ExecutorInMessage::Stop)
+            .map_err(|e| anyhow!("Failed to send Stop: {:?}", e))?;
+        executor_thread
+            .join()
+            .map_err(|e| anyhow!("Local executor panicked: {:?}", e))
+    }
 }
@@ -1,26 +1,62 @@
-use std::sync::mpsc::{channel, Sender};
-use std::sync::Arc;
+use std::net::SocketAddr;
+use std::sync::mpsc::{channel, Receiver, RecvTimeoutError, Sender};
+use std::sync::{Arc, Condvar, Mutex};
+use std::time::{Duration, Instant};
 
 use anyhow::{anyhow, Context, Error};
-use ductile::{ChannelSender, ChannelServer};
+use ductile::{ChannelReceiver, ChannelSender, ChannelServer};
 use serde::{Deserialize, Serialize};
 use task_maker_cache::Cache;
 use task_maker_store::FileStore;
 use uuid::Uuid;
 
-use crate::executor::{Executor, ExecutorInMessage};
+use crate::executor::{Executor, ExecutorInMessage, ExecutorMetrics};
+use crate::proto::FileEncoding;
 use crate::scheduler::ClientInfo;
 use crate::{derive_key_from_password, WorkerConn};
 
 /// Version of task-maker
 const VERSION: &str = env!("CARGO_PKG_VERSION");
+/// The encodings of the files the server can use with the remote workers, by preference.
+const WORKER_FILE_ENCODINGS: &[FileEncoding] = &[FileEncoding::Zstd, FileEncoding::Plain];
+/// How long a new connection can take to send the messages of the handshake.
+const HANDSHAKE_TIMEOUT: Duration = Duration::from_secs(10);
+/// The maximum number of connections of clients, and separately of workers, doing the handshake at
+/// the same time. The next connections wait in the backlog of the socket until one of them ends.
+const MAX_PENDING_HANDSHAKES: usize = 64;
+
+/// The sender of a new connection, before the handshake.
+type HandshakeSender = ChannelSender<RemoteEntityMessageResponse>;
+/// The receiver of a new connection, before the handshake.
+type HandshakeReceiver = ChannelReceiver<RemoteEntityMessage>;
 
 /// An executor that accepts remote connections from clients and workers.
+///
+/// The listeners only accept the connections: the handshake of each connection is done in a
+/// thread of its own, so that a peer slow to send its welcome message doesn't delay the ones
+/// connecting after it. A peer that doesn't complete the handshake within `HANDSHAKE_TIMEOUT` is
+/// not accepted. At most `MAX_PENDING_HANDSHAKES` handshakes are pending at the same time: when
+/// they are all taken the listener stops accepting, and a burst of connections waits in the
+/// backlog of the socket instead of being refused.
+///
+/// The channels are blocking, so each connection still has its threads. An async connection layer
+/// would need the channels to support it.
 pub struct RemoteExecutor {
     file_store: Arc<FileStore>,
+    /// The maximum number of jobs of the same client running at the same time, if any.
+    max_jobs_per_client: Option<usize>,
+    /// The maximum share of the workers a client can ask for, if any.
+    max_fair_share: Option<f64>,
+    /// Whether the jobs stuck on a slow worker are started also on an idle one.
+    speculative_execution: bool,
+    /// Where to send the metrics of the scheduler, if anywhere.
+    metrics: Option<Sender<ExecutorMetrics>>,
 }
 
 /// Message sent only by remote clients and workers for connecting to the server.
+///
+/// The `Welcome` message must stay the first one and must not change, so that the server can
+/// reject, with a message they understand, the clients and the workers of other versions.
 #[derive(Debug, Serialize, Deserialize)]
 pub enum RemoteEntityMessage {
     /// Tell the remote executor the name of the client or of the worker.
@@ -30,21 +66,56 @@ pub enum RemoteEntityMessage {
         /// The required version of task-maker.
         version: String,
     },
+    /// Tell the remote executor the encodings of the files supported by the client or the worker.
+    /// Sent right after the `Welcome` message.
+    FileEncodings(Vec<FileEncoding>),
 }
 
 /// Message sent only by the server in response of a `RemoteEntityMessage`.
 #[derive(Debug, Serialize, Deserialize)]
 pub enum RemoteEntityMessageResponse {
-    /// The server accepted the connection of the client, the communication can continue.
-    Accepted,
-    /// The server rejected the connection of the client, the channel will be closed.
+    /// The server accepted the connection of the client, the communication can continue. The files
+    /// are sent with this encoding.
+    Accepted(FileEncoding),
+    /// The server rejected the connection of the client, the channel will be closed. This variant
+    /// must not change, since it's also sent to the clients and the workers of other versions.
     Rejected(String),
 }
 
 impl RemoteExecutor {
     /// Make a new `RemoteExecutor`.
     pub fn new(file_store: Arc<FileStore>) -> Self {
-        RemoteExecutor { file_store }
+        RemoteExecutor {
+            file_store,
+            max_jobs_per_client: None,
+            max_fair_share: None,
+            speculative_execution: false,
+            metrics: None,
+        }
+    }
+
+    /// Limit the number of jobs of the same client running at the same time, so that a big
+    /// evaluation doesn't take all the workers when the other clients need them.
+    pub fn set_max_jobs_per_client(&mut self, max_jobs_per_client: Option<usize>) {
+        self.max_jobs_per_client = max_jobs_per_client;
+    }
+
+    /// Cap the share of the workers that a client can ask for, since the share is chosen by the
+    /// client itself.
+    pub fn set_max_fair_share(&mut self, max_fair_share: f64) {
+        self.max_fair_share = Some(max_fair_share);
+    }
+
+    /// Start a copy of the jobs running for much longer than expected on an idle worker, since
+    /// their worker may be overloaded. The first result is accepted.
+    pub fn set_speculative_execution(&mut self, speculative_execution: bool) {
+        self.speculative_execution = speculative_execution;
+    }
+
+    /// Send the metrics of the scheduler to this channel every few seconds, for example for scaling
+    /// the number of workers with the load.
+    pub fn set_metrics_sender(&mut self, metrics: Sender<ExecutorMetrics>) {
+        self.metrics = Some(metrics);
     }
 
     /// Start the executor binding the TCP sockets and waiting for clients and workers connections.
@@ -61,7 +132,13 @@ impl RemoteExecutor {
         let bind_worker_addr = bind_worker_addr.into();
 
         let (executor_tx, executor_rx) = channel();
-        let executor = Executor::new(file_store, cache, executor_rx, true);
+        let mut executor = Executor::new(file_store, cache, executor_rx, true);
+        executor.set_max_jobs_per_client(self.max_jobs_per_client);
+        executor.set_max_fair_share(self.max_fair_share);
+        executor.set_speculative_execution(self.speculative_execution);
+        if let Some(metrics) = self.metrics {
+            executor.set_metrics_sender(metrics);
+        }
 
         let client_executor_tx = executor_tx.clone();
         let client_listener_thread = std::thread::Builder::new()
@@ -119,31 +196,71 @@ impl RemoteExecutor {
                 bind_client_addr
             }
         );
-        for (sender, receiver, addr) in server {
+        let handshakes = PendingHandshakes::default();
+        let mut connections = server.into_iter();
+        loop {
+            // accept the next connection only when it can start its handshake
+            let slot = handshakes.start();
+            let Some((sender, receiver, addr)) = connections.next() else {
+                break;
+            };
             let addr = addr
                 .map(|s| s.to_string())
                 .unwrap_or_else(|| "(local)".into());
             info!("Client connected from {addr}");
-            let uuid = Uuid::new_v4();
-            let name = if let Ok(RemoteEntityMessage::Welcome { name, version }) = receiver.recv() {
+            let executor_tx = client_executor_tx.clone();
+            let handshake = std::thread::Builder::new()
+                .name(format!("Client handshake {addr}"))
+                .spawn(move || {
+                    let reader = HandshakeReader::start(receiver, slot, HANDSHAKE_TIMEOUT);
+                    Self::client_handshake(sender, reader, addr, executor_tx)
+                });
+            if let Err(e) = handshake {
+                warn!("Cannot spawn the handshake thread of a client: {e:?}");
+            }
+        }
+        Ok(())
+    }
+
+    /// Wait for the welcome message of a new client, and give the client to the executor if it's
+    /// accepted.
+    fn client_handshake(
+        sender: HandshakeSender,
+        reader: HandshakeReader,
+        addr: String,
+        executor_tx: Sender<ExecutorInMessage>,
+    ) {
+        let uuid = Uuid::new_v4();
+        let name = match reader.recv() {
+            Ok(RemoteEntityMessage::Welcome { name, version }) => {
                 if !validate_welcome(&addr, &name, version, &sender, "Client") {
-                    continue;
+                    return;
                 }
                 name
-            } else {
-                warn!("Client at {addr} has not sent the correct welcome message!");
-                continue;
-            };
-            let client = ClientInfo { uuid, name };
-            client_executor_tx
-                .send(ExecutorInMessage::ClientConnected {
-                    client,
-                    sender: sender.change_type(),
-                    receiver: receiver.change_type(),
-                })
-                .map_err(|e| anyhow!("Executor is gone: {:?}", e))?;
+            }
+            other => {
+                warn!("Client at {addr} has not sent the correct welcome message: {other:?}");
+                return;
+            }
+        };
+        if recv_file_encodings(&reader, &addr, "Client").is_none() {
+            return;
+        }
+        let Some(receiver) = reader.into_receiver() else {
+            warn!("Client at {addr} disconnected during the handshake");
+            return;
+        };
+        // the files of the clients are always sent as they are
+        let _ = sender.send(RemoteEntityMessageResponse::Accepted(FileEncoding::Plain));
+        let client = ClientInfo { uuid, name };
+        let connected = executor_tx.send(ExecutorInMessage::ClientConnected {
+            client,
+            sender: sender.change_type(),
+            receiver: receiver.change_type(),
+        });
+        if connected.is_err() {
+            warn!("Executor is gone, dropping the client at {addr}");
         }
-        Ok(())
     }
 
     fn worker_listener(
@@ -176,35 +293,89 @@ impl RemoteExecutor {
                 bind_worker_addr
             }
         );
-        for (sender, receiver, addr) in server {
-            let addr = addr
+        let handshakes = PendingHandshakes::default();
+        let mut connections = server.into_iter();
+        loop {
+            // accept the next connection only when it can start its handshake
+            let slot = handshakes.start();
+            let Some((sender, receiver, socket_addr)) = connections.next() else {
+                break;
+            };
+            let addr = socket_addr
                 .map(|s| s.to_string())
                 .unwrap_or_else(|| "(local)".into());
             info!("Worker connected from {addr}");
-            let uuid = Uuid::new_v4();
-            let name = if let Ok(RemoteEntityMessage::Welcome { name, version }) = receiver.recv() {
+            let executor_tx = executor_tx.clone();
+            let handshake = std::thread::Builder::new()
+                .name(format!("Worker handshake {addr}"))
+                .spawn(move || {
+                    let reader = HandshakeReader::start(receiver, slot, HANDSHAKE_TIMEOUT);
+                    Self::worker_handshake(sender, reader, socket_addr, addr, executor_tx)
+                });
+            if let Err(e) = handshake {
+                warn!("Cannot spawn the handshake thread of a worker: {e:?}");
+            }
+        }
+        Ok(())
+    }
+
+    /// Wait for the welcome message of a new worker, and give the worker to the executor if it's
+    /// accepted.
+    fn worker_handshake(
+        sender: HandshakeSender,
+        reader: HandshakeReader,
+        socket_addr: Option<SocketAddr>,
+        addr: String,
+        executor_tx: Sender<ExecutorInMessage>,
+    ) {
+        let uuid = Uuid::new_v4();
+        let name = match reader.recv() {
+            Ok(RemoteEntityMessage::Welcome { name, version }) => {
                 if !validate_welcome(&addr, &name, version, &sender, "Worker") {
-                    continue;
+                    return;
                 }
                 name
-            } else {
-                warn!("Worker at {addr} has not sent the correct welcome message!");
-                continue;
-            };
-            let worker = WorkerConn {
-                uuid,
-                name,
-                sender: sender.change_type(),
-                receiver: receiver.change_type(),
-            };
-            executor_tx
-                .send(ExecutorInMessage::WorkerConnected { worker })
-                .map_err(|e| anyhow!("Executor is gone: {:?}", e))?;
+            }
+            other => {
+                warn!("Worker at {addr} has not sent the correct welcome message: {other:?}");
+                return;
+            }
+        };
+        let file_encodings = match recv_file_encodings(&reader, &addr, "Worker") {
+            Some(file_encodings) => file_encodings,
+            None => return,
+        };
+        let Some(receiver) = reader.into_receiver() else {
+            warn!("Worker at {addr} disconnected during the handshake");
+            return;
+        };
+        // on a unix socket the worker is on the same machine, compressing doesn't pay off
+        let file_encoding = WORKER_FILE_ENCODINGS
+            .iter()
+            .copied()
+            .find(|encoding| socket_addr.is_some() && file_encodings.contains(encoding))
+            .unwrap_or_default();
+        info!("Files of worker '{name}' at {addr} are sent with {file_encoding:?} encoding");
+        let _ = sender.send(RemoteEntityMessageResponse::Accepted(file_encoding));
+        let worker = WorkerConn {
+            uuid,
+            name,
+            sender: sender.change_type(),
+            receiver: receiver.change_type(),
+            file_encoding,
+            addr: socket_addr,
+        };
+        if executor_tx
+            .send(ExecutorInMessage::WorkerConnected { worker })
+            .is_err()
+        {
+            warn!("Executor is gone, dropping the worker at {addr}");
         }
-        Ok(())
     }
 }
 
+/// Check the version in the welcome message of a client or of a worker, rejecting the connection
+/// if it's not the one of the server.
 fn validate_welcome(
     addr: &str,
     name: &str,
@@ -221,7 +392,214 @@ fn validate_welcome(
         )));
         false
     } else {
-        let _ = sender.send(RemoteEntityMessageResponse::Accepted);
         true
     }
 }
+
+/// Receive the encodings of the files supported by a client or by a worker, sent after the welcome
+/// message.
+fn recv_file_encodings(
+    reader: &HandshakeReader,
+    addr: &str,
+    client: &str,
+) -> Option<Vec<FileEncoding>> {
+    match reader.recv() {
+        Ok(RemoteEntityMessage::FileEncodings(file_encodings)) => Some(file_encodings),
+        other => {
+            warn!("{client} at {addr} has not sent the encodings of the files: {other:?}");
+            None
+        }
+    }
+}
+
+/// The number of the handshakes in progress, shared by the connections of a listener, and the
+/// condition variable notified when one of them ends.
+#[derive(Debug, Default)]
+struct PendingHandshakes(Arc<(Mutex<usize>, Condvar)>);
+
+/// A handshake in progress, counted in `PendingHandshakes` until dropped.
+#[derive(Debug)]
+struct HandshakeSlot(Arc<(Mutex<usize>, Condvar)>);
+
+impl PendingHandshakes {
+    /// Start a new handshake, waiting for one to end if there are already
+    /// `MAX_PENDING_HANDSHAKES` in progress.
+    fn start(&self) -> HandshakeSlot {
+        let (pending, ended) = &*self.0;
+        let mut pending = pending.lock().unwrap();
+        if *pending >= MAX_PENDING_HANDSHAKES {
+            warn!("Too many connections doing the handshake, waiting for one of them to end");
+        }
+        while *pending >= MAX_PENDING_HANDSHAKES {
+            pending = ended.wait(pending).unwrap();
+        }
+        *pending += 1;
+        HandshakeSlot(self.0.clone())
+    }
+
+    /// The number of the handshakes in progress.
+    #[cfg(test)]
+    fn pending(&self) -> usize {
+        *self.0 .0.lock().unwrap()
+    }
+}
+
+impl Drop for HandshakeSlot {
+    fn drop(&mut self) {
+        let (pending, ended) = &*self.0;
+        *pending.lock().unwrap() -= 1;
+        ended.notify_one();
+    }
+}
+
+/// The messages of the handshake of a new connection, received by a thread of their own so that
+/// they can be waited for with a deadline.
+///
+/// The channels don't support a timeout on the receive: a peer that never sends keeps the thread
+/// alive until it disconnects. That thread holds the `HandshakeSlot` of the connection, so the
+/// number of threads stays bounded by `MAX_PENDING_HANDSHAKES`.
+struct HandshakeReader {
+    /// The messages received, until the first error.
+    messages: Receiver<Result<RemoteEntityMessage, Error>>,
+    /// The receiver of the connection, given back after the messages of the handshake.
+    receiver: Receiver<HandshakeReceiver>,
+    /// When the handshake must be completed.
+    deadline: Instant,
+}
+
+impl HandshakeReader {
+    /// The number of messages of the handshake: `Welcome` and `FileEncodings`.
+    const MESSAGES: usize = 2;
+
+    /// Start receiving the messages of the handshake from `receiver`, that must be completed
+    /// within `timeout`.
+    fn start(receiver: HandshakeReceiver, slot: HandshakeSlot, timeout: Duration) -> Self {
+        let (messages_tx, messages) = channel();
+        let (receiver_tx, receiver_rx) = channel();
+        let deadline = Instant::now() + timeout;
+        let reader = std::thread::Builder::new()
+            .name("Handshake reader".into())
+            .spawn(move || {
+                let _slot = slot;
+                for _ in 0..Self::MESSAGES {
+                    let message = receiver
+                        .recv()
+                        .map_err(|e| anyhow!("Failed to receive the message: {e:?}"));
+                    let failed = message.is_err();
+                    if messages_tx.send(message).is_err() || failed {
+                        return;
+                    }
+                }
+                let _ = receiver_tx.send(receiver);
+            });
+        if let Err(e) = reader {
+            warn!("Cannot spawn the handshake reader thread: {e:?}");
+        }
+        HandshakeReader {
+            messages,
+            receiver: receiver_rx,
+            deadline,
+        }
+    }
+
+    /// The next message of the handshake, waiting at most until the deadline.
+    fn recv(&self) -> Result<RemoteEntityMessage, Error> {
+        let timeout = self.deadline.saturating_duration_since(Instant::now());
+        match self.messages.recv_timeout(timeout) {
+            Ok(message) => message,
+            Err(RecvTimeoutError::Timeout) => Err(anyhow!("Handshake timed out")),
+            Err(RecvTimeoutError::Disconnected) => Err(anyhow!("Handshake reader is gone")),
+        }
+    }
+
+    /// The receiver of the connection, once all the messages of the handshake are received.
+    fn into_receiver(self) -> Option<HandshakeReceiver> {
+        let timeout = self.deadline.saturating_duration_since(Instant::now());
+        self.receiver.recv_timeout(timeout).ok()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use ductile::new_local_channel;
+
+    use super::*;
+
+    #[test]
+    fn test_pending_handshakes() {
+        let handshakes = Arc::new(PendingHandshakes::default());
+        let mut slots: Vec<_> = (0..MAX_PENDING_HANDSHAKES)
+            .map(|_| handshakes.start())
+            .collect();
+        let (started_tx, started) = channel();
+        let waiting = {
+            let handshakes = handshakes.clone();
+            std::thread::spawn(move || {
+                let slot = handshakes.start();
+                started_tx.send(()).unwrap();
+                slot
+            })
+        };
+        // all the slots are taken, the next handshake waits
+        assert!(started.recv_timeout(Duration::from_millis(100)).is_err());
+        slots.pop();
+        assert!(started.recv_timeout(Duration::from_secs(5)).is_ok());
+        let slot = waiting.join().unwrap();
+        assert_eq!(handshakes.pending(), MAX_PENDING_HANDSHAKES);
+        drop(slot);
+        drop(slots);
+        assert_eq!(handshakes.pending(), 0);
+    }
+
+    #[test]
+    fn test_handshake_timeout() {
+        let handshakes = PendingHandshakes::default();
+        let (sender, receiver) = new_local_channel();
+        let slot = handshakes.start();
+        let reader = HandshakeReader::start(receiver, slot, Duration::from_millis(100));
+        sender
+            .send(RemoteEntityMessage::Welcome {
+                name: "slow".into(),
+                version: VERSION.into(),
+            })
+            .unwrap();
+        assert!(matches!(
+            reader.recv(),
+            Ok(RemoteEntityMessage::Welcome { .. })
+        ));
+        // the peer never sends the encodings of the files
+        let start = Instant::now();
+        assert!(reader.recv().is_err());
+        assert!(start.elapsed() < Duration::from_secs(5));
+        assert!(reader.into_receiver().is_none());
+        // the slot is released when the peer disconnects
+        drop(sender);
+        let start = Instant::now();
+        while handshakes.pending() > 0 {
+            assert!(start.elapsed() < Duration::from_secs(5));
+            std::thread::sleep(Duration::from_millis(10));
+        }
+    }
+
+    #[test]
+    fn test_handshake_complete() {
+        let handshakes = PendingHandshakes::default();
+        let (sender, receiver) = new_local_channel();
+        let slot = handshakes.start();
+        let reader = HandshakeReader::start(receiver, slot, HANDSHAKE_TIMEOUT);
+        sender
+            .send(RemoteEntityMessage::FileEncodings(vec![
+                FileEncoding::Plain,
+            ]))
+            .unwrap();
+        sender
+            .send(RemoteEntityMessage::FileEncodings(vec![]))
+            .unwrap();
+        assert!(matches!(
+            reader.recv(),
+            Ok(RemoteEntityMessage::FileEncodings(_))
+        ));
+        assert!(reader.recv().is_ok());
+        assert!(reader.into_receiver().is_some());
+    }
+}
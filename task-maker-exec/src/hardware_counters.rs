@@ -0,0 +1,161 @@
+//! Measurement of the instructions and of the cycles of the sandboxed processes with the hardware
+//! performance counters of Linux (`perf_event_open`).
+//!
+//! The counters are opened by the process that spawns the sandbox, just before spawning it. They
+//! start disabled and they are inherited by the processes it spawns: the kernel enables them when
+//! one of those processes calls `exec`, so the setup of the sandbox is not counted, only the
+//! sandboxed program. When the inheriting processes exit their counts are added to the counters.
+//!
+//! Only the user space is counted: with the default `perf_event_paranoid` this doesn't need any
+//! privilege, and the kernel time depends on the host more than the program.
+
+use anyhow::Error;
+use task_maker_dag::HardwareCounters;
+
+/// The argument of `internal-sandbox` that enables the hardware counters.
+pub const HARDWARE_COUNTERS_ARG: &str = "--hardware-counters";
+
+/// The counters of the processes spawned after opening them.
+#[derive(Debug)]
+pub struct CounterSet {
+    /// The counter of the retired instructions.
+    #[cfg_attr(not(target_os = "linux"), allow(dead_code))]
+    instructions: std::fs::File,
+    /// The counter of the CPU cycles.
+    #[cfg_attr(not(target_os = "linux"), allow(dead_code))]
+    cycles: std::fs::File,
+}
+
+impl CounterSet {
+    /// Open the counters for the processes that will be spawned by this thread. Fails if the host
+    /// doesn't support them, or doesn't allow them to this process.
+    pub fn open() -> Result<CounterSet, Error> {
+        #[cfg(target_os = "linux")]
+        {
+            Ok(CounterSet {
+                instructions: linux::open_counter(linux::PERF_COUNT_HW_INSTRUCTIONS)?,
+                cycles: linux::open_counter(linux::PERF_COUNT_HW_CPU_CYCLES)?,
+            })
+        }
+        #[cfg(not(target_os = "linux"))]
+        {
+            anyhow::bail!("The hardware counters are supported only on Linux")
+        }
+    }
+
+    /// Read the values of the counters, after all the processes counted by them exited.
+    pub fn read(&self) -> Result<HardwareCounters, Error> {
+        #[cfg(target_os = "linux")]
+        {
+            Ok(HardwareCounters {
+                instructions: linux::read_counter(&self.instructions)?,
+                cycles: linux::read_counter(&self.cycles)?,
+            })
+        }
+        #[cfg(not(target_os = "linux"))]
+        {
+            anyhow::bail!("The hardware counters are supported only on Linux")
+        }
+    }
+}
+
+#[cfg(target_os = "linux")]
+mod linux {
+    use std::fs::File;
+    use std::io::Read;
+    use std::os::fd::FromRawFd;
+
+    use anyhow::{bail, Context, Error};
+    use nix::libc;
+
+    /// `PERF_TYPE_HARDWARE`: the generalized hardware events.
+    const PERF_TYPE_HARDWARE: u32 = 0;
+    /// `PERF_COUNT_HW_CPU_CYCLES`.
+    pub(super) const PERF_COUNT_HW_CPU_CYCLES: u64 = 0;
+    /// `PERF_COUNT_HW_INSTRUCTIONS`.
+    pub(super) const PERF_COUNT_HW_INSTRUCTIONS: u64 = 1;
+    /// `PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING`: read also for how long the
+    /// counter was enabled and for how long it actually counted.
+    const READ_FORMAT: u64 = 1 | 2;
+    /// The `disabled` bit of the flags of `perf_event_attr`.
+    const FLAG_DISABLED: u64 = 1 << 0;
+    /// The `inherit` bit: count also the processes spawned after opening the counter.
+    const FLAG_INHERIT: u64 = 1 << 1;
+    /// The `exclude_kernel` bit.
+    const FLAG_EXCLUDE_KERNEL: u64 = 1 << 5;
+    /// The `exclude_hv` bit.
+    const FLAG_EXCLUDE_HV: u64 = 1 << 6;
+    /// The `enable_on_exec` bit: start counting when the process calls `exec`.
+    const FLAG_ENABLE_ON_EXEC: u64 = 1 << 12;
+    /// `PERF_FLAG_FD_CLOEXEC`.
+    const PERF_FLAG_FD_CLOEXEC: libc::c_ulong = 1 << 3;
+
+    /// The first version of `struct perf_event_attr` (`PERF_ATTR_SIZE_VER0`), which has all the
+    /// fields needed here. The kernel accepts it as long as `size` is set accordingly.
+    #[repr(C)]
+    #[derive(Default)]
+    struct PerfEventAttr {
+        type_: u32,
+        size: u32,
+        config: u64,
+        sample_period: u64,
+        sample_type: u64,
+        read_format: u64,
+        flags: u64,
+        wakeup_events: u32,
+        bp_type: u32,
+        config1: u64,
+    }
+
+    /// Open a counter of a hardware event for this thread and for the processes it will spawn.
+    pub(super) fn open_counter(config: u64) -> Result<File, Error> {
+        let attr = PerfEventAttr {
+            type_: PERF_TYPE_HARDWARE,
+            size: std::mem::size_of::<PerfEventAttr>() as u32,
+            config,
+            read_format: READ_FORMAT,
+            flags: FLAG_DISABLED
+                | FLAG_INHERIT
+                | FLAG_EXCLUDE_KERNEL
+                | FLAG_EXCLUDE_HV
+                | FLAG_ENABLE_ON_EXEC,
+            ..Default::default()
+        };
+        // SAFETY: attr is a valid perf_event_attr of the declared size, and it's only read.
+        let fd = unsafe {
+            libc::syscall(
+                libc::SYS_perf_event_open,
+                &attr as *const PerfEventAttr,
+                0 as libc::pid_t,
+                -1 as libc::c_int,
+                -1 as libc::c_int,
+                PERF_FLAG_FD_CLOEXEC,
+            )
+        };
+        if fd < 0 {
+            return Err(std::io::Error::last_os_error())
+                .with_context(|| format!("Failed to open the hardware counter {config}"));
+        }
+        // SAFETY: the file descriptor has just been created and it's not owned by anything else.
+        Ok(unsafe { File::from_raw_fd(fd as libc::c_int) })
+    }
+
+    /// Read the value of a counter. If the counter was multiplexed with others on the same PMU it
+    /// counted only for part of the time, and the value is scaled accordingly.
+    pub(super) fn read_counter(mut counter: &File) -> Result<u64, Error> {
+        let mut buf = [0u8; 24];
+        counter
+            .read_exact(&mut buf)
+            .context("Failed to read the hardware counter")?;
+        let field =
+            |index: usize| u64::from_ne_bytes(buf[index * 8..(index + 1) * 8].try_into().unwrap());
+        let (value, enabled, running) = (field(0), field(1), field(2));
+        if running == 0 {
+            bail!("The hardware counter never counted");
+        }
+        if running >= enabled {
+            return Ok(value);
+        }
+        Ok((value as u128 * enabled as u128 / running as u128) as u64)
+    }
+}
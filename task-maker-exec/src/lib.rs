@@ -77,29 +77,39 @@ use std::sync::Arc;
 use std::thread;
 
 use anyhow::Error;
+pub use check_dag::{check_dag, DAGError};
 pub use client::ExecutorClient;
 /// Re-export `ductile` since it's sensible to any version change
 pub use ductile;
 use ductile::new_local_channel;
 pub use execution_unit::RawSandboxResult;
-pub use executor::{ExecutorStatus, ExecutorWorkerStatus, WorkerCurrentJobStatus};
+pub use executor::{
+    CostEstimate, ExecutionDAGWatchSet, ExecutorMetrics, ExecutorStatus, ExecutorWorkerStatus,
+    TagCostEstimate, WorkerCurrentJobStatus,
+};
+pub use overhead::{OverheadHistograms, PhaseHistogram};
 pub use sandbox_runner::{ErrorSandboxRunner, SandboxRunner, SuccessSandboxRunner};
 pub use scheduler::ClientInfo;
 use task_maker_cache::Cache;
 use task_maker_dag::ExecutionDAG;
 use task_maker_store::FileStore;
-pub use worker::{Worker, WorkerConn};
+pub use worker::{calibrate, HealthStatus, TimeNormalization, Worker, WorkerConn, WorkerHealth};
 
+pub mod cgroup;
 mod check_dag;
 mod client;
+pub mod cpu_pinning;
 mod detect_exe;
 pub mod execution_unit;
 mod executor;
 pub mod executors;
 pub mod find_tools;
+pub mod hardware_counters;
+mod overhead;
 pub mod proto;
 mod sandbox_runner;
 mod scheduler;
+pub mod trace;
 mod worker;
 mod worker_manager;
 
@@ -252,4 +262,43 @@ mod tests {
         assert!(!cwd.path().join("stdout2").exists());
         assert!(!cwd.path().join("output3").exists());
     }
+
+    #[test]
+    fn test_local_executor_serve() {
+        let cwd = TempDir::new().unwrap();
+        let file_store = Arc::new(FileStore::new(cwd.path(), 1000, 1000).unwrap());
+        let cache_dir = cwd.path().join("cache");
+        let cache = Cache::new(&cache_dir).unwrap();
+        let executor = executors::LocalExecutor::new(
+            file_store.clone(),
+            cache,
+            2,
+            cwd.path(),
+            UnsafeSandboxRunner,
+        )
+        .unwrap()
+        .serve()
+        .unwrap();
+
+        // the executor keeps running after the first client is done
+        for i in 0..2 {
+            let mut dag = ExecutionDAG::new();
+            let exec = Execution::new("An execution", ExecutionCommand::system("true"));
+            let done = Arc::new(AtomicBool::new(false));
+            let done2 = done.clone();
+            let exec = dag.add_execution(exec);
+            dag.on_execution_done(&exec, move |_res| {
+                done.store(true, Ordering::Relaxed);
+                Ok(())
+            });
+            let (tx, rx) = executor.connect(&format!("Client {i}")).unwrap();
+            ExecutorClient::evaluate(dag, tx, &rx, file_store.clone(), |_| Ok(())).unwrap();
+            assert!(done2.load(Ordering::Relaxed));
+        }
+
+        // the cache is stored when the executor stops, and new clients are refused
+        executor.stop().unwrap();
+        assert_ne!(std::fs::read_dir(&cache_dir).unwrap().count(), 0);
+        assert!(executor.connect("Late client").is_err());
+    }
 }
@@ -0,0 +1,196 @@
+//! Histograms of the time spent by the workers around the executions.
+//!
+//! For the tiny executions (checkers, validators, small testcases) preparing the sandbox, reading
+//! the results and cleaning up may take more than the program itself. Each worker measures these
+//! steps with a few atomic increments per execution, into histograms with exponential buckets, and
+//! reports them to the server with its health.
+
+use std::collections::BTreeMap;
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::time::{Duration, Instant};
+
+use serde::{Deserialize, Serialize};
+
+/// The number of buckets of each histogram: the last one ends after more than an hour.
+const NUM_BUCKETS: usize = 32;
+
+/// A step of an execution measured by the workers.
+#[derive(Debug, Clone, Copy, PartialEq, Eq, PartialOrd, Ord, Hash)]
+pub(crate) enum OverheadPhase {
+    /// Taking a sandbox directory from the pool and putting the input files inside.
+    Setup,
+    /// Running the sandbox, from its preparation to the exit of the process.
+    Run,
+    /// The wall time of the process itself, for comparing it with `Run`.
+    Program,
+    /// Reading the results of the sandbox, like the captured standard output and error.
+    Result,
+    /// Storing the output files.
+    Outputs,
+    /// Dropping the sandbox, giving its directory back to the pool.
+    Teardown,
+}
+
+/// All the phases, in the order of the execution.
+const PHASES: [OverheadPhase; 6] = [
+    OverheadPhase::Setup,
+    OverheadPhase::Run,
+    OverheadPhase::Program,
+    OverheadPhase::Result,
+    OverheadPhase::Outputs,
+    OverheadPhase::Teardown,
+];
+
+/// Collects the durations of the phases of the executions of a worker. It can be shared between
+/// threads, since recording is just a few atomic increments.
+#[derive(Debug)]
+pub(crate) struct OverheadRecorder {
+    /// The number of durations in each bucket, for each phase.
+    buckets: [[AtomicU64; NUM_BUCKETS]; PHASES.len()],
+    /// The sum of the durations of each phase, in microseconds.
+    total_us: [AtomicU64; PHASES.len()],
+}
+
+/// The durations of a phase of the executions, see `OverheadHistograms`.
+#[derive(Debug, Clone, Default, Serialize, Deserialize, PartialEq, Eq)]
+pub struct PhaseHistogram {
+    /// The number of durations recorded.
+    pub count: u64,
+    /// The sum of the durations, in microseconds.
+    pub total_us: u64,
+    /// The number of durations in each bucket. The bucket `i` has the durations from `2^i` to
+    /// `2^(i+1)` microseconds (the first one also the shorter ones). The empty buckets at the end
+    /// are omitted.
+    pub buckets: Vec<u64>,
+}
+
+/// The time spent by a worker in each phase of its executions.
+#[derive(Debug, Clone, Default, Serialize, Deserialize, PartialEq, Eq)]
+pub struct OverheadHistograms {
+    /// The histogram of each phase, by the name of the phase.
+    pub phases: BTreeMap<String, PhaseHistogram>,
+}
+
+impl OverheadPhase {
+    /// The name of the phase, as used in the reports.
+    pub(crate) fn name(&self) -> &'static str {
+        match self {
+            OverheadPhase::Setup => "setup",
+            OverheadPhase::Run => "run",
+            OverheadPhase::Program => "program",
+            OverheadPhase::Result => "result",
+            OverheadPhase::Outputs => "outputs",
+            OverheadPhase::Teardown => "teardown",
+        }
+    }
+}
+
+impl OverheadRecorder {
+    /// Make a recorder with all the histograms empty.
+    pub(crate) fn new() -> OverheadRecorder {
+        OverheadRecorder {
+            buckets: std::array::from_fn(|_| std::array::from_fn(|_| AtomicU64::new(0))),
+            total_us: std::array::from_fn(|_| AtomicU64::new(0)),
+        }
+    }
+
+    /// Record that a phase took `duration`.
+    pub(crate) fn record(&self, phase: OverheadPhase, duration: Duration) {
+        let micros = duration.as_micros().min(u64::MAX as u128) as u64;
+        let bucket = (micros.max(1).ilog2() as usize).min(NUM_BUCKETS - 1);
+        self.buckets[phase as usize][bucket].fetch_add(1, Ordering::Relaxed);
+        self.total_us[phase as usize].fetch_add(micros, Ordering::Relaxed);
+    }
+
+    /// Run `f`, recording how long it took as `phase`.
+    pub(crate) fn time<T, F: FnOnce() -> T>(&self, phase: OverheadPhase, f: F) -> T {
+        let start = Instant::now();
+        let result = f();
+        self.record(phase, start.elapsed());
+        result
+    }
+
+    /// The current content of the histograms. The phases without any duration are omitted.
+    pub(crate) fn snapshot(&self) -> OverheadHistograms {
+        let mut phases = BTreeMap::new();
+        for phase in PHASES {
+            let mut buckets: Vec<u64> = self.buckets[phase as usize]
+                .iter()
+                .map(|count| count.load(Ordering::Relaxed))
+                .collect();
+            while buckets.last() == Some(&0) {
+                buckets.pop();
+            }
+            if buckets.is_empty() {
+                continue;
+            }
+            let histogram = PhaseHistogram {
+                count: buckets.iter().sum(),
+                total_us: self.total_us[phase as usize].load(Ordering::Relaxed),
+                buckets,
+            };
+            phases.insert(phase.name().to_string(), histogram);
+        }
+        OverheadHistograms { phases }
+    }
+}
+
+impl Default for OverheadRecorder {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+impl PhaseHistogram {
+    /// The upper bound of the bucket `index`.
+    pub fn bucket_bound(index: usize) -> Duration {
+        Duration::from_micros(1 << (index + 1).min(63))
+    }
+
+    /// The average duration.
+    pub fn mean(&self) -> Duration {
+        Duration::from_micros(self.total_us.checked_div(self.count).unwrap_or(0))
+    }
+
+    /// An upper bound of the `quantile` (between 0 and 1) of the durations: the end of the bucket
+    /// where it falls.
+    pub fn quantile(&self, quantile: f64) -> Duration {
+        let target = (self.count as f64 * quantile).ceil().max(1.0) as u64;
+        let mut seen = 0;
+        for (index, count) in self.buckets.iter().enumerate() {
+            seen += count;
+            if seen >= target {
+                return PhaseHistogram::bucket_bound(index);
+            }
+        }
+        PhaseHistogram::bucket_bound(self.buckets.len().saturating_sub(1))
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_overhead_histograms() {
+        let recorder = OverheadRecorder::new();
+        assert_eq!(recorder.snapshot(), OverheadHistograms::default());
+        recorder.record(OverheadPhase::Setup, Duration::from_nanos(100));
+        recorder.record(OverheadPhase::Setup, Duration::from_micros(3));
+        recorder.record(OverheadPhase::Setup, Duration::from_micros(5));
+        recorder.record(OverheadPhase::Setup, Duration::from_millis(1));
+        recorder.time(OverheadPhase::Teardown, || ());
+
+        let snapshot = recorder.snapshot();
+        assert_eq!(snapshot.phases.len(), 2);
+        let setup = &snapshot.phases["setup"];
+        assert_eq!(setup.count, 4);
+        assert_eq!(setup.total_us, 1008);
+        // 1000us is in the bucket from 512 to 1024
+        assert_eq!(setup.buckets, vec![1, 1, 1, 0, 0, 0, 0, 0, 0, 1]);
+        assert_eq!(setup.mean(), Duration::from_micros(252));
+        assert_eq!(setup.quantile(0.5), Duration::from_micros(4));
+        assert_eq!(setup.quantile(1.0), Duration::from_micros(1024));
+        assert_eq!(snapshot.phases["teardown"].count, 1);
+    }
+}
@@ -30,8 +30,12 @@
 //! - `B` answers with `ProvideFile` which triggers a protocol switch for sending the file
 //! - `B` sends raw data (`send_raw`) zero or more times
 //! - `B` sends empty raw data which triggers a protocol switch, back into normal mode
+//!
+//! The raw data is the content of the file, unless the two ends agreed on a different
+//! [`FileEncoding`](enum.FileEncoding.html) when the connection was made.
 
 use std::collections::HashMap;
+use std::io::Write;
 use std::path::Path;
 use std::time::Duration;
 
@@ -67,6 +71,9 @@ pub enum ExecutorClientMessage {
     /// The client is asking for the server status. After this message the client should expect a
     /// [`Status`](enum.ExecutorServerMessage.html#variant.Status) message back.
     Status,
+    /// The client is asking to skip these executions, if they haven't started yet. The skipped
+    /// executions are notified with `NotifySkip`, like the ones whose dependencies failed.
+    Skip(Vec<ExecutionGroupUuid>),
 }
 
 /// Messages that the server sends to the client.
@@ -107,9 +114,19 @@ pub enum WorkerClientMessage {
     /// The worker is sending a file to the server. After this message there is a protocol switch
     /// for the file transmission.
     ProvideFile(FileUuid, FileStoreKey),
-    /// The worker needs a file from the server. The server should send back that file in order to
-    /// run the execution on the worker.
-    AskFile(FileStoreKey),
+    /// The worker needs these files from the server, all the ones of a job that it doesn't have.
+    /// The server should send back each of them, using `ProvideFile` or `FetchFiles`, in order to
+    /// run the job on the worker.
+    AskFiles(Vec<FileStoreKey>),
+    /// A piece of an output file sent while the execution is still running, to be appended to the
+    /// previous ones of the same file. The key of the file is known only after the execution: the
+    /// server checks it when `WorkerDone` arrives, and asks for the file only if it doesn't match.
+    FileChunk(FileUuid, Vec<u8>),
+    /// The worker serves its files to the other workers on this port, of the address it's
+    /// connected from.
+    ServeFiles(u16),
+    /// The current health of the worker, sent periodically.
+    Health(WorkerHealth),
 }
 
 /// Messages sent by the server to the worker.
@@ -122,6 +139,9 @@ pub enum WorkerServerMessage {
     /// The file the workers as asked. After this message there is a protocol switch for the file
     /// transmission.
     ProvideFile(FileStoreKey),
+    /// Some of the files the worker asked are on the worker serving them at this address: the
+    /// worker should fetch them from there, and ask the server again for the ones it didn't get.
+    FetchFiles(String, Vec<FileStoreKey>),
     /// The worker completed the execution and produced some files, the server asks the ones that
     /// are missing using this message.
     AskFiles(Vec<FileUuid>),
@@ -129,6 +149,23 @@ pub enum WorkerServerMessage {
     Exit,
 }
 
+/// The compression level of the files sent with `FileEncoding::Zstd`. The files are compressed
+/// while they are sent, so this is a fast level.
+const ZSTD_LEVEL: i32 = 3;
+/// The size of the compressed chunks after which they are sent with `FileEncoding::Zstd`.
+const ZSTD_CHUNK_SIZE: usize = 64 * 1024;
+
+/// How the raw data of the files is encoded on a connection. The encoding is chosen by the server
+/// when a remote client or worker connects, among the ones it supports.
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Default, Serialize, Deserialize)]
+pub enum FileEncoding {
+    /// The raw data is the content of the file.
+    #[default]
+    Plain,
+    /// The raw data is a zstd stream of the content of the file, split in chunks.
+    Zstd,
+}
+
 /// An iterator over the byte chunks sent during the file transfer mode in a channel.
 pub struct ChannelFileIterator<'a, T>
 where
@@ -136,6 +173,10 @@ where
 {
     /// Reference to the channel from where to read
     reader: &'a ChannelReceiver<T>,
+    /// The decoder of the chunks, if they are compressed.
+    decoder: Option<zstd::stream::write::Decoder<'static, Vec<u8>>>,
+    /// Whether the end of the file has been received.
+    finished: bool,
 }
 
 impl<'a, T> ChannelFileIterator<'a, T>
@@ -144,7 +185,25 @@ where
 {
     /// Create a new iterator over a receiver channel.
     pub fn new(reader: &'a ChannelReceiver<T>) -> ChannelFileIterator<'a, T> {
-        ChannelFileIterator { reader }
+        ChannelFileIterator::with_encoding(reader, FileEncoding::Plain)
+    }
+
+    /// Create a new iterator over a receiver channel, where the file is sent with that encoding.
+    pub fn with_encoding(
+        reader: &'a ChannelReceiver<T>,
+        encoding: FileEncoding,
+    ) -> ChannelFileIterator<'a, T> {
+        let decoder = match encoding {
+            FileEncoding::Plain => None,
+            FileEncoding::Zstd => {
+                Some(zstd::stream::write::Decoder::new(Vec::new()).expect("zstd decoder error"))
+            }
+        };
+        ChannelFileIterator {
+            reader,
+            decoder,
+            finished: false,
+        }
     }
 }
 
@@ -155,12 +214,24 @@ where
     type Item = Vec<u8>;
     fn next(&mut self) -> Option<Self::Item> {
         // errors cannot be handled in this iterator yet
-        let data = self.reader.recv_raw().expect("deserialize error");
-        if data.is_empty() {
-            None
-        } else {
-            Some(data)
+        while !self.finished {
+            let data = self.reader.recv_raw().expect("deserialize error");
+            self.finished = data.is_empty();
+            let Some(decoder) = &mut self.decoder else {
+                return (!data.is_empty()).then_some(data);
+            };
+            if self.finished {
+                decoder.flush().expect("invalid zstd stream");
+            } else {
+                decoder.write_all(&data).expect("invalid zstd stream");
+            }
+            // a compressed chunk may not be enough to decode anything
+            let decoded = std::mem::take(decoder.get_mut());
+            if !decoded.is_empty() {
+                return Some(decoded);
+            }
         }
+        None
     }
 }
 
@@ -170,19 +241,25 @@ pub struct ChannelFileSender;
 impl ChannelFileSender {
     /// Send a local file to a channel using `send_raw`.
     pub fn send<P: AsRef<Path>, T>(path: P, sender: &ChannelSender<T>) -> Result<(), Error>
+    where
+        T: 'static + Send + Sync + Serialize,
+    {
+        ChannelFileSender::send_with_encoding(path, sender, FileEncoding::Plain)
+    }
+
+    /// Send a local file to a channel using `send_raw`, with that encoding.
+    pub fn send_with_encoding<P: AsRef<Path>, T>(
+        path: P,
+        sender: &ChannelSender<T>,
+        encoding: FileEncoding,
+    ) -> Result<(), Error>
     where
         T: 'static + Send + Sync + Serialize,
     {
         let path = path.as_ref();
         let iterator = ReadFileIterator::new(path)
             .with_context(|| format!("Failed to read file to send: {}", path.display()))?;
-        for buf in iterator {
-            sender.send_raw(&buf).context("Failed to send file chunk")?;
-        }
-        sender
-            .send_raw(&[])
-            .context("Failed to send file terminator")?;
-        Ok(())
+        ChannelFileSender::send_chunks(iterator, sender, encoding)
     }
 
     /// Send the file content to a channel using `send_raw`.
@@ -190,16 +267,64 @@ impl ChannelFileSender {
     where
         T: 'static + Send + Sync + Serialize,
     {
-        sender
-            .send_raw(&data)
-            .context("Failed to send file chunk")?;
-        // Send the EOF chunk only if the buffer is not empty (otherwise we would send EOF twice
-        // breaking the protocol).
-        if !data.is_empty() {
-            sender
-                .send_raw(&[])
-                .context("Failed to send file terminator")?;
+        ChannelFileSender::send_data_with_encoding(data, sender, FileEncoding::Plain)
+    }
+
+    /// Send the file content to a channel using `send_raw`, with that encoding.
+    pub fn send_data_with_encoding<T>(
+        data: Vec<u8>,
+        sender: &ChannelSender<T>,
+        encoding: FileEncoding,
+    ) -> Result<(), Error>
+    where
+        T: 'static + Send + Sync + Serialize,
+    {
+        ChannelFileSender::send_chunks(std::iter::once(data), sender, encoding)
+    }
+
+    /// Send the chunks of a file followed by the terminator. The empty chunks are not sent, since
+    /// an empty chunk is the terminator.
+    fn send_chunks<I, T>(
+        chunks: I,
+        sender: &ChannelSender<T>,
+        encoding: FileEncoding,
+    ) -> Result<(), Error>
+    where
+        I: IntoIterator<Item = Vec<u8>>,
+        T: 'static + Send + Sync + Serialize,
+    {
+        match encoding {
+            FileEncoding::Plain => {
+                for chunk in chunks.into_iter().filter(|chunk| !chunk.is_empty()) {
+                    sender
+                        .send_raw(&chunk)
+                        .context("Failed to send file chunk")?;
+                }
+            }
+            FileEncoding::Zstd => {
+                let mut encoder = zstd::stream::write::Encoder::new(Vec::new(), ZSTD_LEVEL)
+                    .context("Failed to create zstd encoder")?;
+                for chunk in chunks {
+                    encoder
+                        .write_all(&chunk)
+                        .context("Failed to compress file chunk")?;
+                    if encoder.get_ref().len() >= ZSTD_CHUNK_SIZE {
+                        sender
+                            .send_raw(&std::mem::take(encoder.get_mut()))
+                            .context("Failed to send file chunk")?;
+                    }
+                }
+                let rest = encoder.finish().context("Failed to compress file")?;
+                if !rest.is_empty() {
+                    sender
+                        .send_raw(&rest)
+                        .context("Failed to send file chunk")?;
+                }
+            }
         }
+        sender
+            .send_raw(&[])
+            .context("Failed to send file terminator")?;
         Ok(())
     }
 }
@@ -228,4 +353,30 @@ mod tests {
         let data: Vec<u8> = receiver.flat_map(|d| d.into_iter()).collect();
         assert_eq!(String::from_utf8(data).unwrap(), "hello world");
     }
+
+    #[test]
+    fn test_send_zstd() {
+        let tmpdir = tempfile::TempDir::new().unwrap();
+        let content: Vec<u8> = (0..1_000_000u32)
+            .flat_map(|i| format!("{}\n", i % 1234).into_bytes())
+            .collect();
+        std::fs::write(tmpdir.path().join("file.txt"), &content).unwrap();
+
+        let (sender, receiver) = new_local_channel::<()>();
+        ChannelFileSender::send_with_encoding(
+            tmpdir.path().join("file.txt"),
+            &sender,
+            FileEncoding::Zstd,
+        )
+        .unwrap();
+        ChannelFileSender::send_data_with_encoding(vec![], &sender, FileEncoding::Zstd).unwrap();
+        let data: Vec<u8> = ChannelFileIterator::with_encoding(&receiver, FileEncoding::Zstd)
+            .flat_map(|d| d.into_iter())
+            .collect();
+        assert_eq!(data, content);
+        let empty: Vec<u8> = ChannelFileIterator::with_encoding(&receiver, FileEncoding::Zstd)
+            .flat_map(|d| d.into_iter())
+            .collect();
+        assert!(empty.is_empty());
+    }
 }
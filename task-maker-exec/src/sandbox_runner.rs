@@ -9,8 +9,14 @@ use crate::RawSandboxResult;
 /// Something able to spawn a sandbox, wait for it to exit and return the results.
 pub trait SandboxRunner: Send + Sync {
     /// Spawn a sandbox with the provided configuration, set the PID as soon as possible and wait
-    /// for it to exit. Parse the outcome of the sandbox and return it.
-    fn run(&self, config: SandboxConfiguration, pid: Arc<AtomicU32>) -> RawSandboxResult;
+    /// for it to exit. Parse the outcome of the sandbox and return it. With `hardware_counters` the
+    /// instructions and the cycles of the process are measured too, if the host supports it.
+    fn run(
+        &self,
+        config: SandboxConfiguration,
+        pid: Arc<AtomicU32>,
+        hardware_counters: bool,
+    ) -> RawSandboxResult;
 }
 
 /// A fake sandbox that don't actually spawn anything and always return an error.
@@ -18,7 +24,12 @@ pub trait SandboxRunner: Send + Sync {
 pub struct ErrorSandboxRunner;
 
 impl SandboxRunner for ErrorSandboxRunner {
-    fn run(&self, _config: SandboxConfiguration, _pid: Arc<AtomicU32>) -> RawSandboxResult {
+    fn run(
+        &self,
+        _config: SandboxConfiguration,
+        _pid: Arc<AtomicU32>,
+        _hardware_counters: bool,
+    ) -> RawSandboxResult {
         RawSandboxResult::Error("Nope".to_owned())
     }
 }
@@ -29,16 +40,24 @@ impl SandboxRunner for ErrorSandboxRunner {
 pub struct SuccessSandboxRunner;
 
 impl SandboxRunner for SuccessSandboxRunner {
-    fn run(&self, _config: SandboxConfiguration, _pid: Arc<AtomicU32>) -> RawSandboxResult {
-        RawSandboxResult::Success(SandboxExecutionResult {
-            status: ExitStatus::ExitCode(0),
-            resource_usage: ResourceUsage {
-                memory_usage: 0,
-                user_cpu_time: 0.0,
-                system_cpu_time: 0.0,
-                wall_time_usage: 0.0,
+    fn run(
+        &self,
+        _config: SandboxConfiguration,
+        _pid: Arc<AtomicU32>,
+        _hardware_counters: bool,
+    ) -> RawSandboxResult {
+        RawSandboxResult::Success(
+            SandboxExecutionResult {
+                status: ExitStatus::ExitCode(0),
+                resource_usage: ResourceUsage {
+                    memory_usage: 0,
+                    user_cpu_time: 0.0,
+                    system_cpu_time: 0.0,
+                    wall_time_usage: 0.0,
+                },
             },
-        })
+            None,
+        )
     }
 }
 
@@ -50,7 +69,12 @@ pub struct UnsafeSandboxRunner;
 
 #[cfg(test)]
 impl SandboxRunner for UnsafeSandboxRunner {
-    fn run(&self, config: SandboxConfiguration, _pid: Arc<AtomicU32>) -> RawSandboxResult {
+    fn run(
+        &self,
+        config: SandboxConfiguration,
+        _pid: Arc<AtomicU32>,
+        _hardware_counters: bool,
+    ) -> RawSandboxResult {
         use std::fs::{File, OpenOptions};
         use std::process::Stdio;
 
@@ -77,15 +101,23 @@ impl SandboxRunner for UnsafeSandboxRunner {
             system_cpu_time: 0.0,
             wall_time_usage: 0.0,
         };
-        RawSandboxResult::Success(SandboxExecutionResult {
-            status: ExitStatus::ExitCode(res.code().unwrap()),
-            resource_usage,
-        })
+        RawSandboxResult::Success(
+            SandboxExecutionResult {
+                status: ExitStatus::ExitCode(res.code().unwrap()),
+                resource_usage,
+            },
+            None,
+        )
     }
 }
 
 impl<S: SandboxRunner> SandboxRunner for Arc<S> {
-    fn run(&self, conf: SandboxConfiguration, pid: Arc<AtomicU32>) -> RawSandboxResult {
-        self.as_ref().run(conf, pid)
+    fn run(
+        &self,
+        conf: SandboxConfiguration,
+        pid: Arc<AtomicU32>,
+        hardware_counters: bool,
+    ) -> RawSandboxResult {
+        self.as_ref().run(conf, pid, hardware_counters)
     }
 }
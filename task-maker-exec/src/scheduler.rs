@@ -1,5 +1,6 @@
-use std::collections::{BinaryHeap, HashMap, HashSet};
-use std::sync::mpsc::{Receiver, Sender};
+use std::cmp::Ordering;
+use std::collections::{BinaryHeap, HashMap, HashSet, VecDeque};
+use std::sync::mpsc::{Receiver, RecvTimeoutError, Sender};
 use std::sync::Arc;
 use std::time::{Duration, Instant};
 
@@ -7,19 +8,59 @@ use anyhow::{anyhow, bail, Context, Error};
 use serde::{Deserialize, Serialize};
 use task_maker_cache::{Cache, CacheResult};
 use task_maker_dag::{
-    CacheMode, DagPriority, ExecutionDAGData, ExecutionGroup, ExecutionGroupUuid, ExecutionResult,
-    FileUuid, Priority, WorkerUuid, HIGH_PRIORITY,
+    CacheMode, CompactDAG, DagPriority, ExecutionGroup, ExecutionGroupUuid, ExecutionResult,
+    FileUuid, GroupId, Priority, WorkerUuid, HIGH_PRIORITY,
 };
 use task_maker_store::{FileStore, FileStoreHandle, FileStoreKey};
 use uuid::Uuid;
 
+use crate::cpu_pinning::TIMING_TAG;
 use crate::executor::{
-    ExecutionDAGWatchSet, ExecutorStatus, ExecutorWorkerStatus, WorkerCurrentJobStatus, WorkerJob,
+    CostEstimate, ExecutionDAGWatchSet, ExecutorMetrics, ExecutorStatus, ExecutorWorkerStatus,
+    WorkerCurrentJobStatus, WorkerJob,
 };
+use crate::trace;
 use crate::worker_manager::WorkerManagerInMessage;
+use crate::{HealthStatus, WorkerHealth};
 
 pub type ClientUuid = Uuid;
 
+/// The priority of a ready execution group inside a DAG: the estimated time in milliseconds for
+/// completing the longest chain of executions starting from it (zero if the critical path
+/// scheduling is disabled), followed by the priority of the group.
+type GroupPriority = (Priority, Priority);
+
+/// An execution group waiting for a worker, ordered by its priority.
+type ReadyExec = (DagPriority, GroupPriority, ExecutionGroupUuid, ClientUuid);
+
+/// The duration, in seconds, assumed for the executions that have never been run before.
+const DEFAULT_ESTIMATED_DURATION: f64 = 1.0;
+
+/// Maximum number of ready executions with a similar priority considered when choosing the next
+/// job of a worker based on the files it already has.
+const LOCALITY_CANDIDATES: usize = 16;
+
+/// Two ready executions of the same DAG priority have a similar priority if both the components of
+/// their `GroupPriority` differ by at most this amount.
+const LOCALITY_PRIORITY_WINDOW: Priority = 100;
+
+/// A job is considered stuck on a slow worker when it runs for this many times its estimated
+/// duration.
+const STRAGGLER_FACTOR: f64 = 4.0;
+
+/// The jobs running for less than this are never considered stuck.
+const STRAGGLER_MIN_DURATION: Duration = Duration::from_secs(10);
+
+/// How often the running jobs are checked for being stuck.
+const STRAGGLER_CHECK_INTERVAL: Duration = Duration::from_secs(1);
+
+/// How often the metrics are sent, if anyone is interested.
+const METRICS_INTERVAL: Duration = Duration::from_secs(5);
+
+/// How often the changes to the cache are written to disk, so that a long running scheduler that
+/// is killed loses at most this much work.
+const CACHE_STORE_INTERVAL: Duration = Duration::from_secs(60);
+
 /// Information about a client of the scheduler.
 #[derive(Debug, Clone, Serialize, Deserialize, PartialEq, Eq)]
 pub struct ClientInfo {
@@ -36,7 +77,7 @@ pub(crate) enum SchedulerInMessage {
         /// The information about the client issuing the request.
         client: ClientInfo,
         /// The DAG to evaluate.
-        dag: Box<ExecutionDAGData>,
+        dag: Box<CompactDAG>,
         /// The set of callbacks the client is interested in.
         callbacks: Box<ExecutionDAGWatchSet>,
     },
@@ -71,11 +112,25 @@ pub(crate) enum SchedulerInMessage {
         /// The name of the worker.
         name: String,
     },
+    /// A worker reported its health.
+    WorkerHealth {
+        /// The uuid of the worker.
+        uuid: WorkerUuid,
+        /// The health of the worker.
+        health: WorkerHealth,
+    },
     /// A previously ready worker is not ready anymore.
     WorkerDisconnected {
         /// The uuid of the worker that has disconnected.
         uuid: WorkerUuid,
     },
+    /// A client asked to skip some executions, if they haven't started yet.
+    SkipExecutions {
+        /// The identifier of the client that owns the executions.
+        client: ClientUuid,
+        /// The executions to skip.
+        groups: Vec<ExecutionGroupUuid>,
+    },
     /// The executor is asking for the status of the scheduler.
     Status { client: ClientUuid },
     /// The executor is asking to exit.
@@ -135,6 +190,39 @@ struct ConnectedWorker {
     name: String,
     /// The job the worker is currently working on, with the instant of the start.
     current_job: Option<(ClientUuid, ExecutionGroupUuid, Instant)>,
+    /// The jobs already sent to the worker that will run after the current one, in order. The
+    /// worker fetches their dependencies while the current job is running.
+    queued_jobs: VecDeque<(ClientUuid, ExecutionGroupUuid)>,
+    /// The number of jobs the worker asked for and that haven't been assigned yet.
+    free_slots: usize,
+    /// The files the worker is known to have: the dependencies of the jobs sent to it and the
+    /// outputs it produced. The worker may have flushed some of them away, so this is only an
+    /// estimate used to avoid sending the same files to many workers. The files that no client
+    /// uses anymore are forgotten when a client disconnects.
+    known_files: HashSet<FileStoreKey>,
+    /// The last health the worker reported, if any.
+    health: Option<WorkerHealth>,
+}
+
+impl ConnectedWorker {
+    /// The number of jobs assigned to the worker that are not completed yet.
+    fn num_jobs(&self) -> usize {
+        self.current_job.iter().len() + self.queued_jobs.len()
+    }
+
+    /// How the worker should be used, according to the last health it reported. The workers that
+    /// haven't reported it yet are assumed healthy.
+    fn health_status(&self) -> HealthStatus {
+        self.health
+            .as_ref()
+            .map_or(HealthStatus::Healthy, |health| health.status())
+    }
+
+    /// Whether the execution group has been assigned to the worker.
+    fn has_job(&self, group: ExecutionGroupUuid) -> bool {
+        self.current_job.map_or(false, |(_, job, _)| job == group)
+            || self.queued_jobs.iter().any(|(_, job)| *job == group)
+    }
 }
 
 /// The scheduling information about the DAG of a single client.
@@ -143,54 +231,128 @@ struct SchedulerClientData {
     /// The name of the client.
     name: String,
     /// The DAGs the scheduler is currently working on.
-    dag: ExecutionDAGData,
+    dag: CompactDAG,
     /// The set of callbacks the client is interested in.
     callbacks: ExecutionDAGWatchSet,
-    /// The set of executions that depends on a file, this is a lookup table for when the files
-    /// become ready.
-    input_of: HashMap<FileUuid, HashSet<ExecutionGroupUuid>>,
     /// The set of executions that are ready to be executed. Note that this is not the same as
-    /// `Scheduler::ready_execs`, it's just a fast lookup for known if there is still something to
-    /// do for this client.
+    /// `ready_execs`, it's just a fast lookup for known if there is still something to do for this
+    /// client, including the executions not yet looked up in the cache.
     ready_groups: HashSet<ExecutionGroupUuid>,
+    /// The priority queue of the ready executions of this client, waiting for the workers. The
+    /// executions in here have already been looked up in the cache.
+    ready_execs: BinaryHeap<ReadyExec>,
+    /// The virtual time of the client for the fair sharing of the workers between the clients: it
+    /// advances by the inverse of the share of the client for each job the client gets.
+    virtual_time: f64,
     /// The set of executions that are currently running in a worker.
     running_groups: HashSet<ExecutionGroupUuid>,
-    /// The list of tasks waiting for some dependencies, each with the list of missing files, when a
-    /// task is ready it's removed from the map.
-    missing_deps: HashMap<ExecutionGroupUuid, HashSet<FileUuid>>,
+    /// The number of dependencies of each execution group that are not ready yet, by the index of
+    /// the group. It's zero for the groups that are ready, and for the skipped ones.
+    missing_deps: Vec<u32>,
+    /// The number of execution groups waiting for some dependencies.
+    waiting_groups: usize,
+    /// Whether each file has already been marked as ready or failed, by the index of the file.
+    settled_files: Vec<bool>,
     /// The list of known [`FileStoreHandle`](../task_maker_store/struct.FileStoreHandle.html)s.
     /// Storing them here prevents the `FileStore` from flushing them away.
     file_handles: HashMap<FileUuid, FileStoreHandle>,
+    /// The estimated time in milliseconds for completing the longest chain of executions starting
+    /// from each execution group, by the index of the group. Empty if the critical path scheduling
+    /// is disabled.
+    critical_path: Vec<Priority>,
+    /// The instant each execution group in the queue of the ready executions entered it. Filled
+    /// only when recording the timeline of the evaluation.
+    queued_at: HashMap<ExecutionGroupUuid, Instant>,
+    /// The files provided by the client that are not ready yet, before estimating the cost of the
+    /// DAG in estimate-only mode. Empty otherwise.
+    pending_provided: HashSet<FileUuid>,
+    /// The estimated cost of the DAG, computed in estimate-only mode.
+    cost_estimate: Option<CostEstimate>,
 }
 
 impl SchedulerClientData {
     /// Make a new `SchedulerClientData` based on the DAG the client sent.
-    fn new(
-        name: String,
-        dag: ExecutionDAGData,
-        callbacks: ExecutionDAGWatchSet,
-    ) -> SchedulerClientData {
+    fn new(name: String, dag: CompactDAG, callbacks: ExecutionDAGWatchSet) -> SchedulerClientData {
         SchedulerClientData {
             name,
+            missing_deps: vec![0; dag.num_groups()],
+            waiting_groups: 0,
+            settled_files: vec![false; dag.num_files()],
             dag,
             callbacks,
-            input_of: HashMap::new(),
             ready_groups: HashSet::new(),
+            ready_execs: BinaryHeap::new(),
+            virtual_time: 0.0,
             running_groups: HashSet::new(),
-            missing_deps: HashMap::new(),
             file_handles: HashMap::new(),
+            critical_path: Vec::new(),
+            queued_at: HashMap::new(),
+            pending_provided: HashSet::new(),
+            cost_estimate: None,
+        }
+    }
+
+    /// The priority of an execution group of this client in the queue of the ready executions.
+    fn group_priority(&self, group: &ExecutionGroupUuid) -> GroupPriority {
+        let critical_path = self
+            .dag
+            .group_id(group)
+            .and_then(|id| self.critical_path.get(id.index()))
+            .copied()
+            .unwrap_or(0);
+        (critical_path, self.dag[group].priority)
+    }
+
+    /// Remember when an execution group entered the queue of the ready executions, if the timeline
+    /// of the evaluation is being recorded.
+    fn mark_queued(&mut self, group: ExecutionGroupUuid) {
+        if trace::is_enabled() {
+            self.queued_at.insert(group, Instant::now());
         }
     }
 
     /// True if the client has completed all the executions and there are no more ready nor running
     /// ones.
     fn is_done(&self) -> bool {
-        self.ready_groups.is_empty()
-            && self.running_groups.is_empty()
-            && self.missing_deps.is_empty()
+        self.ready_groups.is_empty() && self.running_groups.is_empty() && self.waiting_groups == 0
+    }
+}
+
+/// A client waiting for its turn in `Scheduler::clients_by_turn`: the greatest one gets the next
+/// job.
+#[derive(Debug)]
+struct ClientTurn {
+    /// The priority of the DAG of the client.
+    priority: DagPriority,
+    /// The virtual time the next job of the client would start at.
+    start: f64,
+    /// The identifier of the client.
+    uuid: ClientUuid,
+}
+
+impl Ord for ClientTurn {
+    fn cmp(&self, other: &Self) -> Ordering {
+        self.priority
+            .cmp(&other.priority)
+            .then_with(|| other.start.total_cmp(&self.start))
+            .then_with(|| other.uuid.cmp(&self.uuid))
+    }
+}
+
+impl PartialOrd for ClientTurn {
+    fn partial_cmp(&self, other: &Self) -> Option<Ordering> {
+        Some(self.cmp(other))
     }
 }
 
+impl PartialEq for ClientTurn {
+    fn eq(&self, other: &Self) -> bool {
+        self.cmp(other) == Ordering::Equal
+    }
+}
+
+impl Eq for ClientTurn {}
+
 /// A `Scheduler` is a service that is able to orchestrate the execution of the DAGs, sending the
 /// jobs to the workers, listening for events and managing the cache of the executions.
 ///
@@ -211,10 +373,27 @@ pub(crate) struct Scheduler {
     /// Sender of the messages to the WorkerManager, aka the messages to the workers.
     worker_manager: Sender<WorkerManagerInMessage>,
 
-    /// The priority queue of the ready tasks, waiting for the workers.
-    ready_execs: BinaryHeap<(DagPriority, Priority, ExecutionGroupUuid, ClientUuid)>,
+    /// The tasks that just became ready and still have to be looked up in the cache, see
+    /// `Scheduler::schedule_cached`.
+    new_ready_execs: Vec<ReadyExec>,
     /// The data about the clients currently working.
     clients: HashMap<ClientUuid, SchedulerClientData>,
+    /// The virtual time of the last job assigned: the clients that had nothing to run don't
+    /// accumulate credit, they restart from this time.
+    virtual_time: f64,
+    /// The maximum number of jobs of the same client running at the same time, if any.
+    max_jobs_per_client: Option<usize>,
+    /// The maximum share of the workers a client can ask for, if any.
+    max_fair_share: Option<f64>,
+    /// The total memory limit, in KiB, of the jobs assigned to the workers at the same time, if
+    /// any.
+    memory_budget: Option<u64>,
+    /// Whether a copy of the jobs stuck on a slow worker is started on an idle one.
+    speculative_execution: bool,
+    /// The jobs that have been started on a second worker, the first result wins.
+    speculated: HashSet<ExecutionGroupUuid>,
+    /// Where to send the metrics periodically, if anywhere.
+    metrics: Option<Sender<ExecutorMetrics>>,
 
     /// The list of the workers that are either ready for some work or already working on a job.
     connected_workers: HashMap<WorkerUuid, ConnectedWorker>,
@@ -239,63 +418,137 @@ impl Scheduler {
             executor,
             worker_manager,
 
-            ready_execs: BinaryHeap::new(),
+            new_ready_execs: Vec::new(),
             clients: HashMap::new(),
+            virtual_time: 0.0,
+            max_jobs_per_client: None,
+            max_fair_share: None,
+            memory_budget: None,
+            speculative_execution: false,
+            speculated: HashSet::new(),
+            metrics: None,
 
             connected_workers: HashMap::new(),
         }
     }
 
+    /// Limit the number of jobs of the same client running at the same time.
+    pub fn set_max_jobs_per_client(&mut self, max_jobs_per_client: Option<usize>) {
+        self.max_jobs_per_client = max_jobs_per_client;
+    }
+
+    /// Cap the share of the workers that a client can ask for: the clients asking for more get
+    /// this share.
+    pub fn set_max_fair_share(&mut self, max_fair_share: Option<f64>) {
+        self.max_fair_share = max_fair_share;
+    }
+
+    /// Limit the sum of the memory limits, in KiB, of the jobs assigned to the workers at the
+    /// same time. The jobs that don't fit wait, while the other ones can still be assigned.
+    pub fn set_memory_budget(&mut self, memory_budget: Option<u64>) {
+        self.memory_budget = memory_budget;
+    }
+
+    /// Start a copy of the jobs running for much longer than expected on an idle worker, accepting
+    /// the first result. The timed jobs are never copied, since their timing would depend on which
+    /// copy wins.
+    pub fn set_speculative_execution(&mut self, speculative_execution: bool) {
+        self.speculative_execution = speculative_execution;
+    }
+
+    /// Send the metrics of the scheduler to this channel every `METRICS_INTERVAL`.
+    pub fn set_metrics_sender(&mut self, metrics: Sender<ExecutorMetrics>) {
+        self.metrics = Some(metrics);
+    }
+
     /// Run the `Scheduler` listening for incoming messages and blocking util the scheduler is
     /// asked to exit. When the scheduler exits it will turn down the worker manager too.
     pub fn run(mut self) -> Result<(), Error> {
-        while let Ok(message) = self.receiver.recv() {
+        let mut last_check = Instant::now();
+        let mut last_metrics = Instant::now();
+        let mut last_store = Instant::now();
+        loop {
+            let message = match self.receiver.recv_timeout(STRAGGLER_CHECK_INTERVAL) {
+                Ok(message) => Some(message),
+                Err(RecvTimeoutError::Timeout) => None,
+                Err(RecvTimeoutError::Disconnected) => break,
+            };
             match message {
-                SchedulerInMessage::Exit => {
+                None => {}
+                Some(SchedulerInMessage::Exit) => {
                     debug!("Scheduler asked to exit");
                     break;
                 }
-                SchedulerInMessage::EvaluateDAG {
+                Some(SchedulerInMessage::EvaluateDAG {
                     client,
                     dag,
                     callbacks,
-                } => {
+                }) => {
                     self.handle_evaluate_dag(client, *dag, *callbacks)
                         .context("Failed to handle EvaluateDAG")?;
                 }
-                SchedulerInMessage::FileReady {
+                Some(SchedulerInMessage::FileReady {
                     client,
                     uuid,
                     handle,
-                } => {
+                }) => {
                     self.handle_file_ready(client, uuid, handle)
                         .context("Failed to handle FileReady")?;
                 }
-                SchedulerInMessage::WorkerResult {
+                Some(SchedulerInMessage::WorkerResult {
                     worker,
                     result,
                     outputs,
-                } => {
+                }) => {
                     self.handle_worker_result(worker, result, outputs)
                         .context("Failed to handle WorkerResult")?;
                 }
-                SchedulerInMessage::WorkerConnected { uuid, name } => {
+                Some(SchedulerInMessage::WorkerConnected { uuid, name }) => {
                     self.handle_worker_connected(uuid, name)
                         .context("Failed to handle WorkerConnected")?;
                 }
-                SchedulerInMessage::WorkerDisconnected { uuid } => {
+                Some(SchedulerInMessage::WorkerHealth { uuid, health }) => {
+                    self.handle_worker_health(uuid, health)
+                        .context("Failed to handle WorkerHealth")?;
+                }
+                Some(SchedulerInMessage::WorkerDisconnected { uuid }) => {
                     self.handle_worker_disconnected(uuid)
                         .context("Failed to handle WorkerDisconnected")?;
                 }
-                SchedulerInMessage::ClientDisconnected { client } => {
+                Some(SchedulerInMessage::ClientDisconnected { client }) => {
                     self.handle_client_disconnected(client)
                         .context("Failed to handle ClientDisconnected")?;
                 }
-                SchedulerInMessage::Status { client } => {
+                Some(SchedulerInMessage::SkipExecutions { client, groups }) => {
+                    self.handle_skip_executions(client, groups)
+                        .context("Failed to handle SkipExecutions")?;
+                }
+                Some(SchedulerInMessage::Status { client }) => {
                     self.handle_status_request(client)
                         .context("Failed to handle Status")?;
                 }
             }
+            if last_check.elapsed() >= STRAGGLER_CHECK_INTERVAL {
+                self.check_stragglers()
+                    .context("Failed to check the running jobs")?;
+                last_check = Instant::now();
+            }
+            if self.metrics.is_some() && last_metrics.elapsed() >= METRICS_INTERVAL {
+                let metrics = self.metrics();
+                if let Some(sender) = &self.metrics {
+                    if sender.send(metrics).is_err() {
+                        debug!("Nobody is listening for the metrics anymore");
+                        self.metrics = None;
+                    }
+                }
+                last_metrics = Instant::now();
+            }
+            if last_store.elapsed() >= CACHE_STORE_INTERVAL {
+                if let Err(e) = self.cache.store() {
+                    warn!("Failed to store cache file: {e:?}");
+                }
+                last_store = Instant::now();
+            }
         }
         debug!("Scheduler exiting");
         self.worker_manager
@@ -308,7 +561,7 @@ impl Scheduler {
     fn handle_evaluate_dag(
         &mut self,
         client: ClientInfo,
-        dag: ExecutionDAGData,
+        dag: CompactDAG,
         callbacks: ExecutionDAGWatchSet,
     ) -> Result<(), Error> {
         info!("Client '{}' asked to evaluate a new DAG", client.name);
@@ -316,21 +569,42 @@ impl Scheduler {
         // clients and schedule all the already cached executions.
         let dag_priority = dag.config.priority;
         let mut client_data = SchedulerClientData::new(client.name, dag, callbacks);
-        for group in client_data.dag.execution_groups.values() {
-            let missing_dep = client_data.missing_deps.entry(group.uuid).or_default();
-            for input in group.dependencies() {
-                let entry = client_data.input_of.entry(input).or_default();
-                entry.insert(group.uuid);
-                missing_dep.insert(input);
-            }
+        for (id, group) in client_data.dag.groups() {
+            let missing_deps = client_data.dag.inputs(id).len() as u32;
+            client_data.missing_deps[id.index()] = missing_deps;
             // if this execution does not have any dependency, schedule it immediately
-            if missing_dep.is_empty() {
-                client_data.missing_deps.remove(&group.uuid);
+            if missing_deps == 0 {
                 client_data.ready_groups.insert(group.uuid);
-                self.ready_execs
-                    .push((dag_priority, group.priority, group.uuid, client.uuid));
+            } else {
+                client_data.waiting_groups += 1;
             }
         }
+        if client_data.dag.config.critical_path {
+            client_data.critical_path = critical_path_lengths(&client_data.dag, &self.cache);
+        }
+        if client_data.dag.config.estimate_only {
+            // nothing is run, the DAG is only looked up in the cache once its files are known
+            let dag = &client_data.dag;
+            client_data.pending_provided = dag
+                .provided_files()
+                .iter()
+                .map(|file| dag.file_uuid(*file))
+                .collect();
+            let estimate_now = client_data.pending_provided.is_empty();
+            self.clients.insert(client.uuid, client_data);
+            if estimate_now {
+                self.estimate_cost(client.uuid)?;
+            }
+            return Ok(());
+        }
+        for group in &client_data.ready_groups {
+            self.new_ready_execs.push((
+                dag_priority,
+                client_data.group_priority(group),
+                *group,
+                client.uuid,
+            ));
+        }
         self.clients.insert(client.uuid, client_data);
         // the client may have sent and empty DAG
         self.check_completion(client.uuid)?;
@@ -349,6 +623,12 @@ impl Scheduler {
     ) -> Result<(), Error> {
         if let Some(client) = self.clients.get_mut(&client_uuid) {
             client.file_handles.insert(uuid, handle);
+            if client.dag.config.estimate_only {
+                if client.pending_provided.remove(&uuid) && client.pending_provided.is_empty() {
+                    self.estimate_cost(client_uuid)?;
+                }
+                return Ok(());
+            }
             self.file_success(client_uuid, uuid)?;
             self.check_completion(client_uuid)?;
         } else {
@@ -360,19 +640,20 @@ impl Scheduler {
     /// Handle the completion of an execution on a worker.
     fn handle_worker_result(
         &mut self,
-        worker: WorkerUuid,
+        worker_uuid: WorkerUuid,
         result: Vec<ExecutionResult>,
         outputs: HashMap<FileUuid, FileStoreHandle>,
     ) -> Result<(), Error> {
-        let worker = match self.connected_workers.remove(&worker) {
+        let worker = match self.connected_workers.get_mut(&worker_uuid) {
             Some(worker) => worker,
             None => {
-                warn!("Unknown worker {worker} completed a job");
+                warn!("Unknown worker {worker_uuid} completed a job");
                 return Ok(());
             }
         };
-        let (client_uuid, group_uuid) = match worker.current_job {
-            Some((client, exec, _)) => (client, exec),
+        // the worker runs the jobs in the order they have been sent
+        let (client_uuid, group_uuid, started) = match worker.current_job.take() {
+            Some(job) => job,
             None => {
                 warn!(
                     "Worker {} ({}) completed a job that wasn't doing",
@@ -381,6 +662,13 @@ impl Scheduler {
                 return Ok(());
             }
         };
+        worker
+            .known_files
+            .extend(outputs.values().map(|handle| handle.key().clone()));
+        if let Some((next_client, next_group)) = worker.queued_jobs.pop_front() {
+            worker.current_job = Some((next_client, next_group, Instant::now()));
+            self.notify_started(next_client, next_group, worker_uuid);
+        }
         let client = if let Some(client) = self.clients.get_mut(&client_uuid) {
             client
         } else {
@@ -389,11 +677,31 @@ impl Scheduler {
             self.check_completion(client_uuid)?;
             return Ok(());
         };
-        let group = client.dag.execution_groups[&group_uuid].clone();
+        if !client.running_groups.contains(&group_uuid) {
+            debug!("Ignoring the result of {group_uuid} from worker {worker_uuid}, already done");
+            self.assign_jobs()?;
+            return Ok(());
+        }
+        let group = client.dag[&group_uuid].clone();
         info!(
-            "Worker {:?} completed execution group {}",
-            worker, group.uuid
+            "Worker {} completed execution group {} in {:.3}s",
+            worker_uuid,
+            group.uuid,
+            started.elapsed().as_secs_f64()
         );
+        if self.speculated.remove(&group_uuid) {
+            // the other copy is not needed anymore
+            for worker in self.connected_workers.values() {
+                if worker.has_job(group_uuid) {
+                    self.worker_manager
+                        .send(WorkerManagerInMessage::StopWorkerJob {
+                            worker: worker.uuid,
+                            job: group_uuid,
+                        })
+                        .map_err(|e| anyhow!("Failed to send StopWorkerJob to worker: {:?}", e))?;
+                }
+            }
+        }
         if group.executions.len() != result.len() {
             // FIXME: this is a pretty bad way to handle this error, it should never happen but if
             //        the workers are not trusted it can cause a DoS of the server. Maybe just
@@ -407,17 +715,42 @@ impl Scheduler {
         Ok(())
     }
 
-    /// Handle the connection of a worker.
+    /// Handle the connection of a worker, or a worker asking for one more job.
     fn handle_worker_connected(&mut self, uuid: WorkerUuid, name: String) -> Result<(), Error> {
         info!("Worker {name} ({uuid}) connected");
-        self.connected_workers.insert(
-            uuid,
-            ConnectedWorker {
+        let worker = self
+            .connected_workers
+            .entry(uuid)
+            .or_insert_with(|| ConnectedWorker {
                 uuid,
                 name,
                 current_job: None,
-            },
-        );
+                queued_jobs: VecDeque::new(),
+                free_slots: 0,
+                known_files: HashSet::new(),
+                health: None,
+            });
+        worker.free_slots += 1;
+        self.assign_jobs()?;
+        Ok(())
+    }
+
+    /// Handle the health reported by a worker. The worker may have become usable again, and get
+    /// the jobs it was skipped for.
+    fn handle_worker_health(
+        &mut self,
+        uuid: WorkerUuid,
+        health: WorkerHealth,
+    ) -> Result<(), Error> {
+        let Some(worker) = self.connected_workers.get_mut(&uuid) else {
+            // the worker reports its health before asking for work
+            return Ok(());
+        };
+        let status = health.status();
+        if status != worker.health_status() {
+            info!("Worker {} is now {status}: {health:?}", worker.name);
+        }
+        worker.health = Some(health);
         self.assign_jobs()?;
         Ok(())
     }
@@ -426,19 +759,35 @@ impl Scheduler {
     fn handle_worker_disconnected(&mut self, uuid: WorkerUuid) -> Result<(), Error> {
         info!("Worker {uuid} disconnected");
         if let Some(worker) = self.connected_workers.remove(&uuid) {
-            // reschedule the job if the worker failed
-            if let Some((client_uuid, job, _)) = worker.current_job {
+            // reschedule the jobs if the worker failed
+            let jobs = worker
+                .current_job
+                .map(|(client_uuid, job, _)| (client_uuid, job))
+                .into_iter()
+                .chain(worker.queued_jobs);
+            for (client_uuid, job) in jobs {
                 let client = if let Some(client) = self.clients.get_mut(&client_uuid) {
                     client
                 } else {
                     warn!("Worker was doing something for a gone client");
-                    return Ok(());
+                    continue;
                 };
-                let priority = client.dag.execution_groups[&job].priority;
-                self.ready_execs
+                // the job may have been completed, or still be running, on another worker
+                let elsewhere = self
+                    .connected_workers
+                    .values()
+                    .any(|worker| worker.has_job(job));
+                if !client.running_groups.contains(&job) || elsewhere {
+                    continue;
+                }
+                let priority = client.group_priority(&job);
+                client
+                    .ready_execs
                     .push((HIGH_PRIORITY, priority, job, client_uuid));
+                client.mark_queued(job);
                 client.ready_groups.insert(job);
                 client.running_groups.remove(&job);
+                self.speculated.remove(&job);
             }
         }
         Ok(())
@@ -448,6 +797,9 @@ impl Scheduler {
     fn handle_client_disconnected(&mut self, client_uuid: ClientUuid) -> Result<(), Error> {
         info!("Client {client_uuid} disconnected");
         if let Some(client) = self.clients.get(&client_uuid) {
+            for group in &client.running_groups {
+                self.speculated.remove(group);
+            }
             if !client.is_done() {
                 warn!("The client's evaluation wasn't completed yet");
                 // Even if the computation has not been completed, send the EvaluationDone so that
@@ -458,16 +810,16 @@ impl Scheduler {
             }
         }
         self.clients.remove(&client_uuid);
-        let mut remaining = BinaryHeap::new();
-        while let Some((dag_priority, priority, exec, client)) = self.ready_execs.pop() {
-            if self.clients.contains_key(&client) {
-                remaining.push((dag_priority, priority, exec, client));
-            }
-        }
-        self.ready_execs = remaining;
-        // stop the jobs that are still running in the workers
+        self.prune_known_files();
+        // stop the jobs that are still running in the workers. The queued ones are stopped too in
+        // case the worker starts them before receiving the message.
         for (uuid, worker) in self.connected_workers.iter() {
-            if let Some((owner, exec, _)) = worker.current_job {
+            let jobs = worker
+                .current_job
+                .map(|(owner, exec, _)| (owner, exec))
+                .into_iter()
+                .chain(worker.queued_jobs.iter().copied());
+            for (owner, exec) in jobs {
                 if owner == client_uuid {
                     warn!("Worker {uuid} is doing {exec} owned by disconnected client, killing",);
                     self.worker_manager
@@ -482,13 +834,70 @@ impl Scheduler {
         Ok(())
     }
 
+    /// Handle the request of a client to skip some executions. Only the executions not started yet
+    /// are skipped, and with them all the executions that depend on them.
+    fn handle_skip_executions(
+        &mut self,
+        client_uuid: ClientUuid,
+        groups: Vec<ExecutionGroupUuid>,
+    ) -> Result<(), Error> {
+        let client = if let Some(client) = self.clients.get_mut(&client_uuid) {
+            client
+        } else {
+            warn!("Client is gone");
+            return Ok(());
+        };
+        let mut skipped = HashSet::new();
+        let mut failed_files = Vec::new();
+        for uuid in groups {
+            let id = match client.dag.group_id(&uuid) {
+                Some(id) => id,
+                None => {
+                    warn!("Client asked to skip the unknown execution {uuid}");
+                    continue;
+                }
+            };
+            let missing_deps = &mut client.missing_deps[id.index()];
+            if *missing_deps > 0 {
+                *missing_deps = 0;
+                client.waiting_groups -= 1;
+            } else if !client.ready_groups.remove(&uuid) {
+                // already started, completed or skipped
+                continue;
+            }
+            skipped.insert(uuid);
+            if client.callbacks.executions.contains(&uuid) {
+                if let Err(e) = self.executor.send((
+                    client_uuid,
+                    SchedulerExecutorMessageData::ExecutionSkipped { execution: uuid },
+                )) {
+                    warn!("Cannot tell the client the execution was skipped: {e:?}");
+                }
+            }
+            for output in client.dag.outputs(id) {
+                failed_files.push(client.dag.file_uuid(*output));
+            }
+        }
+        if skipped.is_empty() {
+            return Ok(());
+        }
+        info!("Skipped {} executions of {}", skipped.len(), client.name);
+        client.ready_execs.retain(|exec| !skipped.contains(&exec.2));
+        client.queued_at.retain(|group, _| !skipped.contains(group));
+        for file in failed_files {
+            self.file_failed(client_uuid, file)?;
+        }
+        self.check_completion(client_uuid)?;
+        Ok(())
+    }
+
     /// Handle the status request of a client.
     fn handle_status_request(&mut self, client_uuid: ClientUuid) -> Result<(), Error> {
         let mut ready_execs = 0;
         let mut waiting_execs = 0;
         for client in self.clients.values() {
             ready_execs += client.ready_groups.len();
-            waiting_execs += client.missing_deps.len();
+            waiting_execs += client.waiting_groups;
         }
         let status = ExecutorStatus {
             connected_workers: self
@@ -497,10 +906,11 @@ impl Scheduler {
                 .map(|worker| ExecutorWorkerStatus {
                     uuid: worker.uuid,
                     name: worker.name.clone(),
+                    health: worker.health.clone(),
                     current_job: worker.current_job.as_ref().and_then(
                         |(client_uuid, exec_uuid, start)| {
                             let client = self.clients.get(client_uuid)?;
-                            let exec = &client.dag.execution_groups[exec_uuid];
+                            let exec = &client.dag[exec_uuid];
                             Some(WorkerCurrentJobStatus {
                                 job: exec.description.clone(),
                                 client: ClientInfo {
@@ -515,6 +925,14 @@ impl Scheduler {
                 .collect(),
             ready_execs,
             waiting_execs,
+            cost_estimate: self
+                .clients
+                .get(&client_uuid)
+                .and_then(|client| client.cost_estimate.clone())
+                .map(|mut estimate| {
+                    estimate.connected_workers = self.connected_workers.len();
+                    estimate
+                }),
         };
 
         if let Err(e) = self
@@ -526,6 +944,79 @@ impl Scheduler {
         Ok(())
     }
 
+    /// Estimate the cost of the DAG of the client, once the files it provided are ready, and send
+    /// it to the client with the status. Then the evaluation of the client ends, without running
+    /// any of its executions.
+    fn estimate_cost(&mut self, client_uuid: ClientUuid) -> Result<(), Error> {
+        let client = match self.clients.get_mut(&client_uuid) {
+            Some(client) => client,
+            None => return Ok(()),
+        };
+        let estimate = estimate_cost(
+            &client.dag,
+            &client.file_handles,
+            &mut self.cache,
+            self.file_store.as_ref(),
+        );
+        let (hits, misses) = estimate.tags.values().fold((0, 0), |(hits, misses), tag| {
+            (hits + tag.cache_hits, misses + tag.cache_misses)
+        });
+        info!(
+            "Estimated cost of the DAG of '{}': {} cache hits, {} executions taking {:.1}s, \
+             critical path of {:.1}s",
+            client.name,
+            hits,
+            misses,
+            estimate.compute_time().as_secs_f64(),
+            estimate.critical_path.as_secs_f64()
+        );
+        client.cost_estimate = Some(estimate);
+        self.handle_status_request(client_uuid)?;
+        // the status is sent before the end of the evaluation, on the same channel
+        self.clients.remove(&client_uuid);
+        self.prune_known_files();
+        self.executor
+            .send((client_uuid, SchedulerExecutorMessageData::EvaluationDone))
+            .context("Failed to send EvaluationDone to the executor")
+    }
+
+    /// The current load of the scheduler. The backlog is estimated from the cached durations of the
+    /// executions with the same shape.
+    fn metrics(&self) -> ExecutorMetrics {
+        let mut metrics = ExecutorMetrics {
+            connected_workers: self.connected_workers.len(),
+            idle_workers: self
+                .connected_workers
+                .values()
+                .filter(|worker| worker.current_job.is_none())
+                .count(),
+            ..Default::default()
+        };
+        let mut backlog = 0.0;
+        for client in self.clients.values() {
+            metrics.ready_execs += client.ready_groups.len();
+            metrics.waiting_execs += client.waiting_groups;
+            backlog += client
+                .ready_groups
+                .iter()
+                .map(|group| {
+                    self.cache
+                        .estimated_duration(&client.dag[group])
+                        .unwrap_or(DEFAULT_ESTIMATED_DURATION)
+                })
+                .sum::<f64>();
+        }
+        metrics.backlog = Duration::from_secs_f64(backlog);
+        for worker in self.connected_workers.values() {
+            if let Some(health) = &worker.health {
+                metrics
+                    .worker_overhead
+                    .insert(worker.name.clone(), health.overhead.clone());
+            }
+        }
+        metrics
+    }
+
     /// Check if the client has completed the evaluation, if so tell the client we are done.
     fn check_completion(&self, client_uuid: ClientUuid) -> Result<(), Error> {
         let client = if let Some(client) = self.clients.get(&client_uuid) {
@@ -544,6 +1035,7 @@ impl Scheduler {
     }
 
     /// Mark a file as failed, skipping all the executions that depends on it (even transitively).
+    /// The executions that use it only as an optional input get an empty file in its place.
     /// This will also send the file to the client, if needed.
     fn file_failed(&mut self, client_uuid: ClientUuid, file: FileUuid) -> Result<(), Error> {
         self.send_file(client_uuid, file, false).with_context(|| {
@@ -555,18 +1047,48 @@ impl Scheduler {
             // client is gone, dont worry to much about it
             return Ok(());
         };
-        if !client.input_of.contains_key(&file) {
-            return Ok(());
-        }
+        let file_uuid = file;
+        let file = match client.dag.file_id(&file) {
+            Some(file) if !client.settled_files[file.index()] => file,
+            _ => return Ok(()),
+        };
+        client.settled_files[file.index()] = true;
         let mut failed_files = Vec::new();
-        for group_uuid in client.input_of[&file].clone() {
+        let mut new_ready = false;
+        for group_id in client.dag.consumers(file) {
             // do not skip the same execution twice
-            if client.missing_deps.contains_key(&group_uuid) {
-                client.missing_deps.remove(&group_uuid);
-            } else {
+            let missing_deps = &mut client.missing_deps[group_id.index()];
+            if *missing_deps == 0 {
+                continue;
+            }
+            let group = client.dag.group(*group_id);
+            if group.is_optional_dependency(file_uuid) {
+                // the failed file may be missing or partially written, replace it
+                let key = FileStoreKey::from_content(&[]);
+                if client.file_handles.get(&file_uuid).map(|h| h.key()) != Some(&key) {
+                    let handle = self
+                        .file_store
+                        .store(&key, std::iter::empty())
+                        .context("Failed to store the empty file of a failed optional input")?;
+                    client.file_handles.insert(file_uuid, handle);
+                }
+                *missing_deps -= 1;
+                if *missing_deps == 0 {
+                    client.waiting_groups -= 1;
+                    let group_uuid = group.uuid;
+                    self.new_ready_execs.push((
+                        HIGH_PRIORITY,
+                        client.group_priority(&group_uuid),
+                        group_uuid,
+                        client_uuid,
+                    ));
+                    client.ready_groups.insert(group_uuid);
+                    new_ready = true;
+                }
                 continue;
             }
-            let group = &client.dag.execution_groups[&group_uuid];
+            *missing_deps = 0;
+            client.waiting_groups -= 1;
             if client.callbacks.executions.contains(&group.uuid) {
                 if let Err(e) = self.executor.send((
                     client_uuid,
@@ -577,13 +1099,17 @@ impl Scheduler {
                     warn!("Cannot tell the client the execution was skipped: {e:?}");
                 }
             }
-            for output in group.outputs() {
-                failed_files.push((client_uuid, output));
+            for output in client.dag.outputs(*group_id) {
+                failed_files.push((client_uuid, client.dag.file_uuid(*output)));
             }
         }
         for (client_uuid, output) in failed_files {
             self.file_failed(client_uuid, output)?;
         }
+        if new_ready {
+            self.schedule_cached()?;
+            self.assign_jobs()?;
+        }
         Ok(())
     }
 
@@ -599,23 +1125,28 @@ impl Scheduler {
             // client is gone, dont worry to much about it
             return Ok(());
         };
-        if !client.input_of.contains_key(&file) {
-            return Ok(());
-        }
-        for group_uuid in &client.input_of[&file] {
-            let group = &client.dag.execution_groups[group_uuid];
-            if let Some(files) = client.missing_deps.get_mut(group_uuid) {
-                files.remove(&file);
-                if files.is_empty() {
-                    client.missing_deps.remove(group_uuid);
-                    self.ready_execs.push((
-                        HIGH_PRIORITY,
-                        group.priority,
-                        *group_uuid,
-                        client_uuid,
-                    ));
-                    client.ready_groups.insert(*group_uuid);
-                }
+        let file = match client.dag.file_id(&file) {
+            Some(file) if !client.settled_files[file.index()] => file,
+            _ => return Ok(()),
+        };
+        client.settled_files[file.index()] = true;
+        for group_id in client.dag.consumers(file) {
+            let missing_deps = &mut client.missing_deps[group_id.index()];
+            // the skipped executions stay skipped
+            if *missing_deps == 0 {
+                continue;
+            }
+            *missing_deps -= 1;
+            if *missing_deps == 0 {
+                client.waiting_groups -= 1;
+                let group_uuid = client.dag.group(*group_id).uuid;
+                self.new_ready_execs.push((
+                    HIGH_PRIORITY,
+                    client.group_priority(&group_uuid),
+                    group_uuid,
+                    client_uuid,
+                ));
+                client.ready_groups.insert(group_uuid);
             }
         }
         self.schedule_cached()?;
@@ -731,51 +1262,63 @@ impl Scheduler {
         self.cache.insert(group, &client.file_handles, result);
     }
 
-    /// Look at all the ready executions and mark as completed all the ones that are inside the
-    /// cache.
+    /// Look up in the cache the executions that just became ready, marking as completed the ones
+    /// that are inside the cache and moving the others to the queue of the executions waiting for
+    /// a worker. Each execution is looked up only once: the ones that missed are not looked up
+    /// again, even if the cache changes after.
     fn schedule_cached(&mut self) -> Result<(), Error> {
-        let mut not_cached = BinaryHeap::new();
-        let mut cached = Vec::new();
-
-        for (dag_priority, priority, group_uuid, client_uuid) in self.ready_execs.iter() {
-            let client = if let Some(client) = self.clients.get_mut(client_uuid) {
-                client
-            } else {
-                // client is gone, dont worry to much about it
-                continue;
-            };
-            let dag = &client.dag;
-            let cache_mode = &dag.config.cache_mode;
-            // disable the cache for the execution
-            if let CacheMode::Nothing = cache_mode {
-                not_cached.push((*dag_priority, *priority, *group_uuid, *client_uuid));
-                continue;
-            }
-            let group = dag.execution_groups[group_uuid].clone();
-            if !Scheduler::is_cacheable(&group, cache_mode) {
-                not_cached.push((*dag_priority, *priority, group.uuid, *client_uuid));
-                continue;
-            }
-            let result = self
-                .cache
-                .get(&group, &client.file_handles, self.file_store.as_ref());
-            match result {
-                CacheResult::Hit { result, outputs } => {
-                    info!("Execution {} is a cache hit!", group.uuid);
-                    client.ready_groups.remove(&group.uuid);
-                    cached.push((*client_uuid, group, result, outputs));
+        // completing a cached execution may make other executions ready, which are looked up
+        // in the next iterations
+        while !self.new_ready_execs.is_empty() {
+            let mut cached = Vec::new();
+            for exec in std::mem::take(&mut self.new_ready_execs) {
+                let (_, _, group_uuid, client_uuid) = exec;
+                let client = if let Some(client) = self.clients.get_mut(&client_uuid) {
+                    client
+                } else {
+                    // client is gone, dont worry to much about it
+                    continue;
+                };
+                let dag = &client.dag;
+                let cache_mode = &dag.config.cache_mode;
+                let group = &dag[&group_uuid];
+                // disable the cache for the execution
+                if let CacheMode::Nothing = cache_mode {
+                    client.ready_execs.push(exec);
+                    client.mark_queued(group_uuid);
+                    continue;
+                }
+                if !Scheduler::is_cacheable(group, cache_mode) {
+                    client.ready_execs.push(exec);
+                    client.mark_queued(group_uuid);
+                    continue;
                 }
-                CacheResult::Miss => {
-                    not_cached.push((*dag_priority, *priority, group.uuid, *client_uuid));
+                let result = self
+                    .cache
+                    .get(group, &client.file_handles, self.file_store.as_ref());
+                match result {
+                    // the cached time is close to the limit, and it was not measured enough times
+                    CacheResult::Hit { result, .. }
+                        if dag.config.needs_timing_reruns(group, &result) =>
+                    {
+                        client.ready_execs.push(exec);
+                        client.mark_queued(group_uuid);
+                    }
+                    CacheResult::Hit { result, outputs } => {
+                        info!("Execution {} is a cache hit!", group.uuid);
+                        cached.push((client_uuid, group.clone(), result, outputs));
+                        client.ready_groups.remove(&group_uuid);
+                    }
+                    CacheResult::Miss => {
+                        client.ready_execs.push(exec);
+                        client.mark_queued(group_uuid);
+                    }
                 }
             }
+            for (client, exec, result, outputs) in cached.into_iter() {
+                self.exec_completed(client, &exec, result, outputs, true)?;
+            }
         }
-
-        self.ready_execs = not_cached;
-        for (client, exec, result, outputs) in cached.into_iter() {
-            self.exec_completed(client, &exec, result, outputs, true)?;
-        }
-
         Ok(())
     }
 
@@ -789,59 +1332,1054 @@ impl Scheduler {
         true
     }
 
-    /// Give to each free worker a job from the ready executions.
+    /// Give to each free worker a job from the ready executions. The workers with more than one
+    /// slot get their next job in advance, but only after all the idle workers got one.
+    ///
+    /// Among the ready executions with a similar priority, the one whose dependencies the worker
+    /// already has is preferred, reducing the amount of data sent to the workers.
+    ///
+    /// The healthy workers are preferred over the overloaded ones, and the unusable workers get no
+    /// jobs, unless all the workers are unusable.
     fn assign_jobs(&mut self) -> Result<(), Error> {
-        for (worker_uuid, worker) in self.connected_workers.iter_mut() {
-            if worker.current_job.is_some() {
-                continue;
-            }
-            let (_, _, group_uuid, client_uuid) = match self.ready_execs.pop() {
+        let all_unusable = self
+            .connected_workers
+            .values()
+            .all(|worker| worker.health_status() == HealthStatus::Unusable);
+        loop {
+            let worker_uuid = self
+                .connected_workers
+                .values()
+                .filter(|worker| worker.free_slots > 0)
+                .map(|worker| (worker.health_status(), worker))
+                .filter(|(status, _)| all_unusable || *status != HealthStatus::Unusable)
+                .min_by_key(|(status, worker)| (*status, worker.num_jobs()))
+                .map(|(_, worker)| worker.uuid);
+            let worker_uuid = match worker_uuid {
+                Some(worker) => worker,
+                None => break,
+            };
+            let (_, _, group_uuid, client_uuid) = match self.pick_job(worker_uuid) {
                 Some(exec) => exec,
                 None => break,
             };
             trace!("Assigning {group_uuid} to worker {worker_uuid}");
-            worker.current_job = Some((client_uuid, group_uuid, Instant::now()));
-            let client = if let Some(client) = self.clients.get_mut(&client_uuid) {
-                client
-            } else {
-                // client is gone, dont worry to much about it
+            if self.send_job(worker_uuid, client_uuid, group_uuid)? {
+                self.notify_started(client_uuid, group_uuid, worker_uuid);
+            }
+        }
+        Ok(())
+    }
+
+    /// Look for the jobs running for much longer than their estimated duration, probably because
+    /// their worker is overloaded, and start a copy of them on the idle workers. Whichever copy
+    /// completes first is accepted, the other one is stopped.
+    fn check_stragglers(&mut self) -> Result<(), Error> {
+        if !self.speculative_execution {
+            return Ok(());
+        }
+        let mut stragglers = vec![];
+        for worker in self.connected_workers.values() {
+            let (client_uuid, group_uuid, start) = match worker.current_job {
+                Some(job) => job,
+                None => continue,
+            };
+            if self.speculated.contains(&group_uuid) {
                 continue;
+            }
+            let group = match self.clients.get(&client_uuid) {
+                Some(client) => &client.dag[&group_uuid],
+                None => continue,
             };
-            client.ready_groups.remove(&group_uuid);
-            client.running_groups.insert(group_uuid);
-            let group = &client.dag.execution_groups[&group_uuid];
-            let mut dep_keys: HashMap<FileUuid, FileStoreKey> = HashMap::new();
-            for file in group.dependencies() {
-                let handle = client
-                    .file_handles
-                    .get(&file)
-                    .unwrap_or_else(|| panic!("Unknown file key of {file}"))
-                    .key()
-                    .clone();
-                dep_keys.insert(file, handle);
-            }
-            let job = WorkerJob {
-                group: group.clone(),
-                dep_keys,
+            if group
+                .tag
+                .as_ref()
+                .map_or(false, |tag| tag.name == TIMING_TAG)
+            {
+                continue;
+            }
+            let estimated = match self.cache.estimated_duration(group) {
+                Some(estimated) => estimated,
+                None => continue,
             };
-            self.worker_manager
-                .send(WorkerManagerInMessage::WorkerJob {
-                    worker: *worker_uuid,
-                    job,
+            let elapsed = start.elapsed();
+            if elapsed >= STRAGGLER_MIN_DURATION
+                && elapsed.as_secs_f64() >= estimated * STRAGGLER_FACTOR
+            {
+                stragglers.push((client_uuid, group_uuid, worker.uuid, elapsed, estimated));
+            }
+        }
+        for (client_uuid, group_uuid, slow_worker, elapsed, estimated) in stragglers {
+            let idle_worker = self
+                .connected_workers
+                .values()
+                .find(|worker| {
+                    worker.uuid != slow_worker && worker.free_slots > 0 && worker.num_jobs() == 0
                 })
-                .map_err(|e| anyhow!("Failed to send WorkerJob to worker: {:?}", e))?;
-            if client.callbacks.executions.contains(&group.uuid) {
-                if let Err(e) = self.executor.send((
-                    client_uuid,
-                    SchedulerExecutorMessageData::ExecutionStarted {
-                        execution: group.uuid,
-                        worker: *worker_uuid,
-                    },
-                )) {
-                    warn!("Cannot tell the client the execution started: {e:?}");
+                .map(|worker| worker.uuid);
+            let idle_worker = match idle_worker {
+                Some(worker) => worker,
+                None => break,
+            };
+            info!(
+                "Execution group {} is running on worker {} for {:.1}s (estimated {:.1}s), \
+                 starting a copy on worker {}",
+                group_uuid,
+                slow_worker,
+                elapsed.as_secs_f64(),
+                estimated,
+                idle_worker
+            );
+            self.speculated.insert(group_uuid);
+            self.send_job(idle_worker, client_uuid, group_uuid)?;
+        }
+        Ok(())
+    }
+
+    /// Send a job to a worker, returning whether the worker started it immediately.
+    fn send_job(
+        &mut self,
+        worker_uuid: WorkerUuid,
+        client_uuid: ClientUuid,
+        group_uuid: ExecutionGroupUuid,
+    ) -> Result<bool, Error> {
+        let worker = self
+            .connected_workers
+            .get_mut(&worker_uuid)
+            .expect("The worker is gone");
+        worker.free_slots -= 1;
+        let started = worker.current_job.is_none();
+        if started {
+            worker.current_job = Some((client_uuid, group_uuid, Instant::now()));
+        } else {
+            worker.queued_jobs.push_back((client_uuid, group_uuid));
+        }
+        let client = if let Some(client) = self.clients.get_mut(&client_uuid) {
+            client
+        } else {
+            // client is gone, dont worry to much about it
+            return Ok(false);
+        };
+        client.ready_groups.remove(&group_uuid);
+        client.running_groups.insert(group_uuid);
+        let group = &client.dag[&group_uuid];
+        if let Some(queued_at) = client.queued_at.remove(&group_uuid) {
+            trace::async_span(
+                "Scheduler queue",
+                "queued",
+                (group_uuid, &group.description),
+                queued_at,
+                Instant::now(),
+            );
+        }
+        let mut dep_keys: HashMap<FileUuid, FileStoreKey> = HashMap::new();
+        for file in group.dependencies() {
+            let handle = client
+                .file_handles
+                .get(&file)
+                .unwrap_or_else(|| panic!("Unknown file key of {file}"))
+                .key()
+                .clone();
+            dep_keys.insert(file, handle);
+        }
+        worker.known_files.extend(dep_keys.values().cloned());
+        let job = WorkerJob {
+            group: group.clone(),
+            dep_keys,
+        };
+        self.worker_manager
+            .send(WorkerManagerInMessage::WorkerJob {
+                worker: worker_uuid,
+                job,
+            })
+            .map_err(|e| anyhow!("Failed to send WorkerJob to worker: {:?}", e))?;
+        Ok(started)
+    }
+
+    /// Remove from the ready executions the next job for a worker. The job is taken from the first
+    /// client, in the order of `clients_by_turn`, with a job that fits in the memory budget: among
+    /// its executions with a priority similar to the first one that fits, the one that needs the
+    /// fewest bytes to be sent to the worker.
+    fn pick_job(&mut self, worker_uuid: WorkerUuid) -> Option<ReadyExec> {
+        let available_memory = self.available_memory();
+        let mut turns = self.clients_by_turn();
+        while let Some(ClientTurn {
+            uuid: client_uuid, ..
+        }) = turns.pop()
+        {
+            let exec = match self.pick_client_job(client_uuid, worker_uuid, available_memory) {
+                Some(exec) => exec,
+                None => continue,
+            };
+            let client = self.clients.get_mut(&client_uuid)?;
+            // the clients that had nothing to do restart from the current virtual time
+            let start = client.virtual_time.max(self.virtual_time);
+            let share = match self.max_fair_share {
+                Some(max) => client.dag.config.fair_share.min(max),
+                None => client.dag.config.fair_share,
+            };
+            client.virtual_time = start + 1.0 / share;
+            self.virtual_time = start;
+            return Some(exec);
+        }
+        None
+    }
+
+    /// Remove from the ready executions of a client the best job for a worker among the ones
+    /// needing at most `available_memory` KiB, if there is a limit.
+    fn pick_client_job(
+        &mut self,
+        client_uuid: ClientUuid,
+        worker_uuid: WorkerUuid,
+        available_memory: Option<u64>,
+    ) -> Option<ReadyExec> {
+        let client = self.clients.get_mut(&client_uuid)?;
+        let dag = &client.dag;
+        let ready_execs = &mut client.ready_execs;
+        let fits = |exec: &ReadyExec| {
+            available_memory.map_or(true, |available| group_memory(&dag[&exec.2]) <= available)
+        };
+        // the executions that don't fit, to put back in the queue
+        let mut skipped = vec![];
+        let first = loop {
+            match ready_execs.pop() {
+                Some(exec) if fits(&exec) => break Some(exec),
+                Some(exec) => skipped.push(exec),
+                None => break None,
+            }
+        };
+        let first = match first {
+            Some(first) => first,
+            None => {
+                ready_execs.extend(skipped);
+                return None;
+            }
+        };
+        let mut candidates = vec![first];
+        while candidates.len() < LOCALITY_CANDIDATES {
+            match ready_execs.peek() {
+                Some(exec) if similar_priority(&first, exec) => {
+                    let exec = ready_execs.pop().unwrap();
+                    if fits(&exec) {
+                        candidates.push(exec);
+                    } else {
+                        skipped.push(exec);
+                    }
                 }
+                _ => break,
             }
         }
-        Ok(())
+        ready_execs.extend(skipped);
+        if candidates.len() == 1 {
+            return Some(first);
+        }
+        let worker = &self.connected_workers[&worker_uuid];
+        // min_by_key returns the first of the minimum, i.e. the one with the highest priority
+        let (best, _) = candidates
+            .iter()
+            .enumerate()
+            .min_by_key(|(_, (_, _, group, client))| self.missing_bytes(worker, *client, *group))
+            .unwrap();
+        let exec = candidates.swap_remove(best);
+        self.clients
+            .get_mut(&client_uuid)?
+            .ready_execs
+            .extend(candidates);
+        Some(exec)
+    }
+
+    /// The clients in the order they should get the next job, among the ones with ready executions
+    /// and below the limit of running jobs. The priority of the DAGs is respected, while the
+    /// clients with the same priority share the workers in proportion to their `fair_share`: the
+    /// one with the lowest virtual time, i.e. that got the fewest jobs relative to its share, goes
+    /// first.
+    ///
+    /// The clients are not sorted: usually the first one has a job, so they are popped from the
+    /// heap only as long as needed.
+    fn clients_by_turn(&self) -> BinaryHeap<ClientTurn> {
+        self.clients
+            .iter()
+            .filter(|(_, client)| !client.ready_execs.is_empty())
+            .filter(|(_, client)| {
+                self.max_jobs_per_client
+                    .map_or(true, |max| client.running_groups.len() < max)
+            })
+            .map(|(uuid, client)| ClientTurn {
+                priority: client.dag.config.priority,
+                start: client.virtual_time.max(self.virtual_time),
+                uuid: *uuid,
+            })
+            .collect()
+    }
+
+    /// The memory, in KiB, that the next job can use without exceeding the memory budget, if
+    /// there is one. When no job with a memory limit is assigned, any job fits: a job that needs
+    /// more than the whole budget would never run otherwise.
+    fn available_memory(&self) -> Option<u64> {
+        let budget = self.memory_budget?;
+        let memory_of = |client: &ClientUuid, group: &ExecutionGroupUuid| {
+            self.clients
+                .get(client)
+                .and_then(|client| client.dag.get(group))
+                .map_or(0, |group| group_memory(group))
+        };
+        let used: u64 = self
+            .connected_workers
+            .values()
+            .flat_map(|worker| {
+                let current = worker
+                    .current_job
+                    .iter()
+                    .map(|(client, group, _)| (client, group));
+                let queued = worker
+                    .queued_jobs
+                    .iter()
+                    .map(|(client, group)| (client, group));
+                current.chain(queued)
+            })
+            .map(|(client, group)| memory_of(client, group))
+            .sum();
+        if used == 0 {
+            Some(u64::MAX)
+        } else {
+            Some(budget.saturating_sub(used))
+        }
+    }
+
+    /// Forget the files the workers are known to have that no connected client uses anymore, so
+    /// that `known_files` doesn't grow for the whole life of the server.
+    fn prune_known_files(&mut self) {
+        let used: HashSet<&FileStoreKey> = self
+            .clients
+            .values()
+            .flat_map(|client| client.file_handles.values().map(FileStoreHandle::key))
+            .collect();
+        for worker in self.connected_workers.values_mut() {
+            worker.known_files.retain(|key| used.contains(key));
+        }
+    }
+
+    /// The total size of the dependencies of an execution that the worker doesn't have yet.
+    fn missing_bytes(
+        &self,
+        worker: &ConnectedWorker,
+        client_uuid: ClientUuid,
+        group_uuid: ExecutionGroupUuid,
+    ) -> u64 {
+        let client = if let Some(client) = self.clients.get(&client_uuid) {
+            client
+        } else {
+            return 0;
+        };
+        let dag = &client.dag;
+        let group = match dag.group_id(&group_uuid) {
+            Some(group) => group,
+            None => return 0,
+        };
+        dag.inputs(group)
+            .iter()
+            .filter_map(|file| client.file_handles.get(&dag.file_uuid(*file)))
+            .filter(|handle| !worker.known_files.contains(handle.key()))
+            .map(FileStoreHandle::size)
+            .sum()
+    }
+
+    /// Tell the client that an execution started on a worker, if it is interested.
+    fn notify_started(
+        &self,
+        client_uuid: ClientUuid,
+        group_uuid: ExecutionGroupUuid,
+        worker_uuid: WorkerUuid,
+    ) {
+        let client = if let Some(client) = self.clients.get(&client_uuid) {
+            client
+        } else {
+            return;
+        };
+        if client.callbacks.executions.contains(&group_uuid) {
+            if let Err(e) = self.executor.send((
+                client_uuid,
+                SchedulerExecutorMessageData::ExecutionStarted {
+                    execution: group_uuid,
+                    worker: worker_uuid,
+                },
+            )) {
+                warn!("Cannot tell the client the execution started: {e:?}");
+            }
+        }
+    }
+}
+
+/// The memory, in KiB, the executions of a group are allowed to use together, including the extra
+/// memory the sandbox gives them. The executions without a memory limit are not counted.
+fn group_memory(group: &ExecutionGroup) -> u64 {
+    group
+        .executions
+        .iter()
+        .filter_map(|exec| exec.limits.memory)
+        .map(|memory| memory + group.config.extra_memory)
+        .sum()
+}
+
+/// Whether two ready executions have a similar priority, so that they can be run in any order.
+fn similar_priority(a: &ReadyExec, b: &ReadyExec) -> bool {
+    let similar = |x: Priority, y: Priority| x.abs_diff(y) <= LOCALITY_PRIORITY_WINDOW as _;
+    a.0 == b.0 && similar(a.1 .0, b.1 .0) && similar(a.1 .1, b.1 .1)
+}
+
+/// Compute, for each execution group of the DAG, the estimated time in milliseconds from its start
+/// to the completion of the longest chain of groups that depend on it, by the index of the group.
+/// The duration of each group is estimated from the cached executions with the same shape.
+fn critical_path_lengths(dag: &CompactDAG, cache: &Cache) -> Vec<Priority> {
+    let lengths = longest_chains(dag, |group| {
+        cache
+            .estimated_duration(dag.group(group))
+            .unwrap_or(DEFAULT_ESTIMATED_DURATION)
+    });
+    if let Some(longest) = lengths.iter().copied().reduce(f64::max) {
+        debug!("Estimated critical path of the DAG: {longest:.3}s");
+    }
+    lengths
+        .into_iter()
+        .map(|length| (length * 1000.0) as Priority)
+        .collect()
+}
+
+/// Compute, for each execution group of the DAG, the time in seconds from its start to the
+/// completion of the longest chain of groups that depend on it, by the index of the group, given
+/// the duration of each group.
+fn longest_chains<F: Fn(GroupId) -> f64>(dag: &CompactDAG, duration: F) -> Vec<f64> {
+    let mut lengths: Vec<Option<f64>> = vec![None; dag.num_groups()];
+    // visit the groups in post order, so that the successors of a group are done before it
+    for (start, _) in dag.groups() {
+        let mut stack = vec![(start, false)];
+        while let Some((group, visited)) = stack.pop() {
+            if lengths[group.index()].is_some() {
+                continue;
+            }
+            if visited {
+                let duration = duration(group);
+                let longest = dag
+                    .successors(group)
+                    .filter_map(|g| lengths[g.index()])
+                    .fold(0.0, f64::max);
+                lengths[group.index()] = Some(duration + longest);
+            } else {
+                stack.push((group, true));
+                stack.extend(
+                    dag.successors(group)
+                        .filter(|g| lengths[g.index()].is_none())
+                        .map(|g| (g, false)),
+                );
+            }
+        }
+    }
+    lengths
+        .into_iter()
+        .map(|length| length.unwrap_or(0.0))
+        .collect()
+}
+
+/// Estimate the cost of evaluating the DAG, see `CostEstimate`. `file_handles` are the files
+/// already known, like the ones provided by the client. The number of connected workers is not
+/// filled.
+fn estimate_cost(
+    dag: &CompactDAG,
+    file_handles: &HashMap<FileUuid, FileStoreHandle>,
+    cache: &mut Cache,
+    file_store: &FileStore,
+) -> CostEstimate {
+    let mut known = file_handles.clone();
+    // the number of inputs of each group that are not known yet, by the index of the group
+    let mut missing = vec![0; dag.num_groups()];
+    let mut ready = Vec::new();
+    for (id, _) in dag.groups() {
+        missing[id.index()] = dag
+            .inputs(id)
+            .iter()
+            .filter(|file| !known.contains_key(&dag.file_uuid(**file)))
+            .count();
+        if missing[id.index()] == 0 {
+            ready.push(id);
+        }
+    }
+    // look up the groups whose inputs are known, learning the outputs of the cache hits
+    let cache_mode = &dag.config.cache_mode;
+    let mut hits = vec![false; dag.num_groups()];
+    while let Some(id) = ready.pop() {
+        let group = dag.group(id);
+        if let CacheMode::Nothing = cache_mode {
+            break;
+        }
+        if !Scheduler::is_cacheable(group, cache_mode) {
+            continue;
+        }
+        let outputs = match cache.get(group, &known, file_store) {
+            CacheResult::Hit { result, .. } if dag.config.needs_timing_reruns(group, &result) => {
+                continue
+            }
+            CacheResult::Hit { outputs, .. } => outputs,
+            CacheResult::Miss => continue,
+        };
+        debug!("Execution {} would be a cache hit", group.description);
+        hits[id.index()] = true;
+        for (uuid, handle) in outputs {
+            if known.insert(uuid, handle).is_some() {
+                continue;
+            }
+            let Some(file) = dag.file_id(&uuid) else {
+                continue;
+            };
+            for consumer in dag.consumers(file) {
+                missing[consumer.index()] -= 1;
+                if missing[consumer.index()] == 0 {
+                    ready.push(*consumer);
+                }
+            }
+        }
+    }
+
+    let mut estimate = CostEstimate::default();
+    let mut durations = vec![0.0; dag.num_groups()];
+    for (id, group) in dag.groups() {
+        let tag = group
+            .tag
+            .as_ref()
+            .map_or("untagged", |tag| tag.name.as_str());
+        let tag_estimate = estimate.tags.entry(tag.to_string()).or_default();
+        if hits[id.index()] {
+            tag_estimate.cache_hits += 1;
+            continue;
+        }
+        tag_estimate.cache_misses += 1;
+        let duration = cache.estimated_duration(group).unwrap_or_else(|| {
+            tag_estimate.unknown += 1;
+            DEFAULT_ESTIMATED_DURATION
+        });
+        tag_estimate.compute_time += Duration::from_secs_f64(duration);
+        durations[id.index()] = duration;
+    }
+    let longest = longest_chains(dag, |id| durations[id.index()]);
+    estimate.critical_path = Duration::from_secs_f64(longest.into_iter().fold(0.0, f64::max));
+    estimate
+}
+
+#[cfg(test)]
+mod tests {
+    use std::path::Path;
+
+    use task_maker_dag::{Execution, ExecutionCommand, ExecutionDAG, ExecutionResourcesUsage};
+
+    use super::*;
+
+    #[test]
+    fn test_critical_path_lengths() {
+        let mut dag = ExecutionDAG::new();
+        let mut gen = Execution::new("gen", ExecutionCommand::local("gen"));
+        let input = gen.output("input.txt");
+        let mut sol = Execution::new("sol", ExecutionCommand::local("sol"));
+        sol.input(&input, "input.txt", false);
+        let output = sol.output("output.txt");
+        let mut check = Execution::new("check", ExecutionCommand::local("check"));
+        check.input(&output, "output.txt", false);
+        let other = Execution::new("other", ExecutionCommand::local("other"));
+        let gen = dag.add_execution(gen);
+        let sol = dag.add_execution(sol);
+        let check = dag.add_execution(check);
+        let other = dag.add_execution(other);
+
+        let tmpdir = tempfile::TempDir::new().unwrap();
+        let cache = Cache::new(tmpdir.path()).unwrap();
+        let dag = CompactDAG::new(dag.data);
+        let lengths = critical_path_lengths(&dag, &cache);
+        let length = |group| lengths[dag.group_id(&group).unwrap().index()];
+        assert_eq!(length(gen), 3000);
+        assert_eq!(length(sol), 2000);
+        assert_eq!(length(check), 1000);
+        assert_eq!(length(other), 1000);
+    }
+
+    #[test]
+    fn test_estimate_cost() {
+        let mut dag = ExecutionDAG::new();
+        let mut gen = Execution::new("gen", ExecutionCommand::local("gen"));
+        let input = gen.output("input.txt");
+        let mut gen = gen.into_group();
+        gen.tag = Some("generation".into());
+        let mut sol = Execution::new("sol", ExecutionCommand::local("sol"));
+        sol.input(&input, "input.txt", false);
+        dag.add_execution_group(gen);
+        dag.add_execution(sol);
+        dag.add_execution(Execution::new("other", ExecutionCommand::local("other")));
+
+        let tmpdir = tempfile::TempDir::new().unwrap();
+        let mut cache = Cache::new(tmpdir.path().join("cache")).unwrap();
+        let store = FileStore::new(tmpdir.path().join("store"), 1000, 1000).unwrap();
+        let dag = CompactDAG::new(dag.data);
+        let mut estimate = estimate_cost(&dag, &HashMap::new(), &mut cache, &store);
+        assert_eq!(estimate.tags["generation"].cache_misses, 1);
+        assert_eq!(estimate.tags["untagged"].cache_misses, 2);
+        assert_eq!(estimate.tags["untagged"].unknown, 2);
+        assert_eq!(estimate.compute_time(), Duration::from_secs(3));
+        assert_eq!(estimate.critical_path, Duration::from_secs(2));
+        assert_eq!(estimate.wall_time(), None);
+        estimate.connected_workers = 3;
+        assert_eq!(estimate.wall_time(), Some(Duration::from_secs(2)));
+        estimate.connected_workers = 1;
+        assert_eq!(estimate.wall_time(), Some(Duration::from_secs(3)));
+    }
+
+    #[test]
+    fn test_estimate_only() {
+        let tmpdir = tempfile::TempDir::new().unwrap();
+        let (mut scheduler, worker, _) = fair_share_scheduler(tmpdir.path(), &[], 0);
+        let (executor, executor_rx) = std::sync::mpsc::channel();
+        scheduler.executor = executor;
+
+        let mut dag = ExecutionDAG::new();
+        dag.config_mut().estimate_only(true);
+        dag.add_execution(Execution::new("exec", ExecutionCommand::local("x")));
+        let client = ClientInfo {
+            uuid: Uuid::new_v4(),
+            name: "client".into(),
+        };
+        scheduler
+            .handle_evaluate_dag(
+                client.clone(),
+                CompactDAG::new(dag.data),
+                Default::default(),
+            )
+            .unwrap();
+
+        let messages: Vec<_> = executor_rx.try_iter().map(|(_, message)| message).collect();
+        assert_eq!(messages.len(), 2);
+        match &messages[0] {
+            SchedulerExecutorMessageData::Status { status } => {
+                let estimate = status.cost_estimate.as_ref().unwrap();
+                assert_eq!(estimate.tags["untagged"].cache_misses, 1);
+            }
+            _ => panic!("The status must be sent before the end of the evaluation"),
+        }
+        assert!(matches!(
+            messages[1],
+            SchedulerExecutorMessageData::EvaluationDone
+        ));
+        // nothing is run
+        assert!(scheduler.clients.is_empty());
+        assert!(scheduler.pick_job(worker).is_none());
+    }
+
+    #[test]
+    fn test_similar_priority() {
+        let uuid = Uuid::new_v4();
+        let exec = |dag, critical, group| (dag, (critical, group), uuid, uuid);
+        assert!(similar_priority(&exec(0, 0, 1000), &exec(0, 0, 990)));
+        assert!(similar_priority(&exec(0, 5000, 1000), &exec(0, 4950, 1000)));
+        assert!(!similar_priority(&exec(0, 0, 1000), &exec(1, 0, 1000)));
+        assert!(!similar_priority(&exec(0, 0, 1_000_000), &exec(0, 0, 1000)));
+        assert!(!similar_priority(
+            &exec(0, 5000, 1000),
+            &exec(0, 3000, 1000)
+        ));
+    }
+
+    /// Make a scheduler with a worker and a client for each of the shares, each with `num_execs`
+    /// ready executions.
+    fn fair_share_scheduler(
+        tmpdir: &Path,
+        shares: &[f64],
+        num_execs: usize,
+    ) -> (Scheduler, WorkerUuid, Vec<ClientUuid>) {
+        let file_store = Arc::new(FileStore::new(tmpdir.join("store"), 1 << 30, 1 << 29).unwrap());
+        let cache = Cache::new(tmpdir.join("cache")).unwrap();
+        let (_, receiver) = std::sync::mpsc::channel();
+        let (executor, _) = std::sync::mpsc::channel();
+        let (worker_manager, _) = std::sync::mpsc::channel();
+        let mut scheduler = Scheduler::new(file_store, cache, receiver, executor, worker_manager);
+        let worker = Uuid::new_v4();
+        scheduler.connected_workers.insert(
+            worker,
+            ConnectedWorker {
+                uuid: worker,
+                name: "worker".into(),
+                current_job: None,
+                queued_jobs: VecDeque::new(),
+                free_slots: 0,
+                known_files: HashSet::new(),
+                health: None,
+            },
+        );
+        let mut clients = vec![];
+        for share in shares {
+            let mut dag = ExecutionDAG::new();
+            dag.config_mut().fair_share(*share);
+            for i in 0..num_execs {
+                dag.add_execution(Execution::new(
+                    format!("exec {i}"),
+                    ExecutionCommand::local("x"),
+                ));
+            }
+            let uuid = Uuid::new_v4();
+            let dag = CompactDAG::new(dag.data);
+            let mut client = SchedulerClientData::new("client".into(), dag, Default::default());
+            for (_, group) in client.dag.groups() {
+                client.ready_execs.push((0, (0, 0), group.uuid, uuid));
+            }
+            scheduler.clients.insert(uuid, client);
+            clients.push(uuid);
+        }
+        (scheduler, worker, clients)
+    }
+
+    #[test]
+    fn test_fair_share() {
+        let tmpdir = tempfile::TempDir::new().unwrap();
+        let (mut scheduler, worker, clients) = fair_share_scheduler(tmpdir.path(), &[1.0, 2.0], 20);
+        let mut jobs = HashMap::new();
+        for _ in 0..9 {
+            let (_, _, _, client) = scheduler.pick_job(worker).unwrap();
+            *jobs.entry(client).or_insert(0) += 1;
+        }
+        assert_eq!(jobs[&clients[0]], 3);
+        assert_eq!(jobs[&clients[1]], 6);
+    }
+
+    #[test]
+    fn test_max_fair_share() {
+        let tmpdir = tempfile::TempDir::new().unwrap();
+        let (mut scheduler, worker, clients) = fair_share_scheduler(tmpdir.path(), &[1.0, 4.0], 20);
+        scheduler.set_max_fair_share(Some(1.0));
+        let mut jobs = HashMap::new();
+        for _ in 0..8 {
+            let (_, _, _, client) = scheduler.pick_job(worker).unwrap();
+            *jobs.entry(client).or_insert(0) += 1;
+        }
+        // the client asking for more than the maximum gets the same share as the other
+        assert_eq!(jobs[&clients[0]], 4);
+        assert_eq!(jobs[&clients[1]], 4);
+    }
+
+    #[test]
+    fn test_max_jobs_per_client() {
+        let tmpdir = tempfile::TempDir::new().unwrap();
+        let (mut scheduler, _, clients) = fair_share_scheduler(tmpdir.path(), &[1.0, 1.0], 2);
+        scheduler.set_max_jobs_per_client(Some(1));
+        let running = Uuid::new_v4();
+        scheduler
+            .clients
+            .get_mut(&clients[0])
+            .unwrap()
+            .running_groups
+            .insert(running);
+        let turns: Vec<_> = scheduler
+            .clients_by_turn()
+            .into_iter()
+            .map(|turn| turn.uuid)
+            .collect();
+        assert_eq!(turns, vec![clients[1]]);
+        scheduler
+            .clients
+            .get_mut(&clients[1])
+            .unwrap()
+            .running_groups
+            .insert(running);
+        assert!(scheduler.clients_by_turn().is_empty());
+    }
+
+    #[test]
+    fn test_memory_budget() {
+        let tmpdir = tempfile::TempDir::new().unwrap();
+        let (mut scheduler, worker, clients) = fair_share_scheduler(tmpdir.path(), &[1.0], 4);
+        scheduler.set_memory_budget(Some(1500));
+        let client = scheduler.clients.get_mut(&clients[0]).unwrap();
+        let mut groups: Vec<_> = client.dag.groups().map(|(_, group)| group.uuid).collect();
+        groups.sort();
+        // two big jobs with the highest priority, then two small ones
+        for (i, group) in groups.iter().enumerate() {
+            let memory = if i < 2 { 1000 } else { 100 };
+            let group = client.dag.get_mut(group).unwrap();
+            group.config.extra_memory = 0;
+            group.executions[0].limits.memory(memory);
+        }
+        client.ready_execs = groups
+            .iter()
+            .enumerate()
+            .map(|(i, group)| (0, (0, 10000 - 1000 * i as Priority), *group, clients[0]))
+            .collect();
+
+        let mut assign = |scheduler: &mut Scheduler| {
+            let exec = scheduler.pick_job(worker)?;
+            let worker = scheduler.connected_workers.get_mut(&worker).unwrap();
+            worker.queued_jobs.push_back((exec.3, exec.2));
+            Some(exec.2)
+        };
+        // the first big job always fits, then only the small ones
+        assert_eq!(assign(&mut scheduler), Some(groups[0]));
+        assert_eq!(assign(&mut scheduler), Some(groups[2]));
+        assert_eq!(assign(&mut scheduler), Some(groups[3]));
+        assert_eq!(assign(&mut scheduler), None);
+        // when the big job is done the other one can start
+        let worker_data = scheduler.connected_workers.get_mut(&worker).unwrap();
+        worker_data.queued_jobs.pop_front();
+        assert_eq!(assign(&mut scheduler), Some(groups[1]));
+    }
+
+    #[test]
+    fn test_skip_executions() {
+        let tmpdir = tempfile::TempDir::new().unwrap();
+        let (mut scheduler, _, _) = fair_share_scheduler(tmpdir.path(), &[], 0);
+        let (executor, executor_rx) = std::sync::mpsc::channel();
+        scheduler.executor = executor;
+
+        let mut dag = ExecutionDAG::new();
+        let mut first = Execution::new("first", ExecutionCommand::local("x"));
+        let output = first.output("output");
+        let mut second = Execution::new("second", ExecutionCommand::local("x"));
+        second.input(&output, "input", false);
+        let other = dag.add_execution(Execution::new("other", ExecutionCommand::local("x")));
+        let first = dag.add_execution(first);
+        let second = dag.add_execution(second);
+        let mut callbacks = ExecutionDAGWatchSet::default();
+        callbacks.executions.extend([first, second, other]);
+        let client = ClientInfo {
+            uuid: Uuid::new_v4(),
+            name: "client".into(),
+        };
+        scheduler
+            .handle_evaluate_dag(client.clone(), CompactDAG::new(dag.data), callbacks)
+            .unwrap();
+        // as if the timeline was being recorded
+        scheduler
+            .clients
+            .get_mut(&client.uuid)
+            .unwrap()
+            .queued_at
+            .insert(first, Instant::now());
+        scheduler
+            .handle_skip_executions(client.uuid, vec![first, first])
+            .unwrap();
+
+        let skipped: Vec<_> = executor_rx
+            .try_iter()
+            .filter_map(|(_, message)| match message {
+                SchedulerExecutorMessageData::ExecutionSkipped { execution } => Some(execution),
+                _ => None,
+            })
+            .collect();
+        // the executions depending on the skipped ones are skipped too
+        assert_eq!(skipped, vec![first, second]);
+        let client = &scheduler.clients[&client.uuid];
+        assert_eq!(client.waiting_groups, 0);
+        assert_eq!(client.ready_groups, HashSet::from([other]));
+        assert_eq!(client.ready_execs.len(), 1);
+        assert!(client.queued_at.is_empty());
+        assert!(!client.is_done());
+    }
+
+    #[test]
+    fn test_optional_input() {
+        let tmpdir = tempfile::TempDir::new().unwrap();
+        let (mut scheduler, _, _) = fair_share_scheduler(tmpdir.path(), &[], 0);
+        let (executor, executor_rx) = std::sync::mpsc::channel();
+        scheduler.executor = executor;
+
+        let mut dag = ExecutionDAG::new();
+        let mut first = Execution::new("first", ExecutionCommand::local("x"));
+        let output = first.output("output");
+        let mut second = Execution::new("second", ExecutionCommand::local("x"));
+        second.optional_input(&output, "input", false);
+        let first = dag.add_execution(first);
+        let second = dag.add_execution(second);
+        let mut callbacks = ExecutionDAGWatchSet::default();
+        callbacks.executions.extend([first, second]);
+        let client = ClientInfo {
+            uuid: Uuid::new_v4(),
+            name: "client".into(),
+        };
+        scheduler
+            .handle_evaluate_dag(client.clone(), CompactDAG::new(dag.data), callbacks)
+            .unwrap();
+        scheduler
+            .handle_skip_executions(client.uuid, vec![first])
+            .unwrap();
+
+        let skipped: Vec<_> = executor_rx
+            .try_iter()
+            .filter_map(|(_, message)| match message {
+                SchedulerExecutorMessageData::ExecutionSkipped { execution } => Some(execution),
+                _ => None,
+            })
+            .collect();
+        // the execution with the optional input runs anyway, with an empty file
+        assert_eq!(skipped, vec![first]);
+        let client = &scheduler.clients[&client.uuid];
+        assert_eq!(client.waiting_groups, 0);
+        assert_eq!(client.ready_groups, HashSet::from([second]));
+        assert_eq!(
+            client.file_handles[&output.uuid].key(),
+            &FileStoreKey::from_content(&[])
+        );
+    }
+
+    /// A scheduler with a job running for much longer than expected on the `slow` worker, and an
+    /// `idle` worker for its copy.
+    fn straggler_scheduler(
+        tmpdir: &Path,
+    ) -> (
+        Scheduler,
+        WorkerUuid,
+        WorkerUuid,
+        ClientUuid,
+        ExecutionGroup,
+        Receiver<WorkerManagerInMessage>,
+    ) {
+        let (mut scheduler, slow, clients) = fair_share_scheduler(tmpdir, &[1.0], 1);
+        let (worker_manager, worker_manager_rx) = std::sync::mpsc::channel();
+        scheduler.worker_manager = worker_manager;
+        scheduler.set_speculative_execution(true);
+
+        let client = scheduler.clients.get_mut(&clients[0]).unwrap();
+        client.ready_execs.clear();
+        let group = client.dag.groups().next().unwrap().1.clone();
+        client.running_groups.insert(group.uuid);
+        scheduler
+            .cache
+            .insert(&group, &HashMap::new(), vec![wall_time_result(1.0)]);
+        let started = Instant::now().checked_sub(Duration::from_secs(60)).unwrap();
+        scheduler
+            .connected_workers
+            .get_mut(&slow)
+            .unwrap()
+            .current_job = Some((clients[0], group.uuid, started));
+        let idle = Uuid::new_v4();
+        scheduler.connected_workers.insert(
+            idle,
+            ConnectedWorker {
+                uuid: idle,
+                name: "idle".into(),
+                current_job: None,
+                queued_jobs: VecDeque::new(),
+                free_slots: 1,
+                known_files: HashSet::new(),
+                health: None,
+            },
+        );
+
+        (scheduler, slow, idle, clients[0], group, worker_manager_rx)
+    }
+
+    /// The result of an execution that took `wall_time` seconds.
+    fn wall_time_result(wall_time: f64) -> ExecutionResult {
+        ExecutionResult {
+            resources: ExecutionResourcesUsage {
+                wall_time,
+                ..Default::default()
+            },
+            ..Default::default()
+        }
+    }
+
+    #[test]
+    fn test_speculative_execution() {
+        let tmpdir = tempfile::TempDir::new().unwrap();
+        let (mut scheduler, slow, idle, client, group, worker_manager_rx) =
+            straggler_scheduler(tmpdir.path());
+        let (executor, _executor_rx) = std::sync::mpsc::channel();
+        scheduler.executor = executor;
+        let result = wall_time_result;
+
+        scheduler.check_stragglers().unwrap();
+        assert!(scheduler.connected_workers[&idle].has_job(group.uuid));
+        assert!(matches!(
+            worker_manager_rx.try_recv(),
+            Ok(WorkerManagerInMessage::WorkerJob { worker, .. }) if worker == idle
+        ));
+        // only one copy is started
+        scheduler.check_stragglers().unwrap();
+        assert!(worker_manager_rx.try_recv().is_err());
+
+        // the copy completes first: the slow worker is stopped and its result ignored
+        scheduler
+            .handle_worker_result(idle, vec![result(1.0)], HashMap::new())
+            .unwrap();
+        assert!(matches!(
+            worker_manager_rx.try_recv(),
+            Ok(WorkerManagerInMessage::StopWorkerJob { worker, job })
+                if worker == slow && job == group.uuid
+        ));
+        assert!(!scheduler.clients[&client]
+            .running_groups
+            .contains(&group.uuid));
+        scheduler
+            .handle_worker_result(slow, vec![result(0.0)], HashMap::new())
+            .unwrap();
+        assert!(scheduler.connected_workers[&slow].current_job.is_none());
+    }
+
+    #[test]
+    fn test_speculative_execution_client_gone() {
+        let tmpdir = tempfile::TempDir::new().unwrap();
+        let (mut scheduler, _, _, client, group, _worker_manager_rx) =
+            straggler_scheduler(tmpdir.path());
+        let (executor, _executor_rx) = std::sync::mpsc::channel();
+        scheduler.executor = executor;
+        scheduler.check_stragglers().unwrap();
+        assert!(scheduler.speculated.contains(&group.uuid));
+        scheduler.handle_client_disconnected(client).unwrap();
+        assert!(scheduler.speculated.is_empty());
+    }
+
+    #[test]
+    fn test_unhealthy_workers() {
+        let tmpdir = tempfile::TempDir::new().unwrap();
+        let (mut scheduler, full, _) = fair_share_scheduler(tmpdir.path(), &[1.0], 3);
+        let (worker_manager, _worker_manager_rx) = std::sync::mpsc::channel();
+        scheduler.worker_manager = worker_manager;
+        let (executor, _executor_rx) = std::sync::mpsc::channel();
+        scheduler.executor = executor;
+        let health = |load_percent, free_space| WorkerHealth {
+            load_percent,
+            free_memory: 8 << 30,
+            store_free_space: free_space,
+            sandbox_free_space: free_space,
+            sandbox_setup: None,
+            overhead: Default::default(),
+        };
+        let full_worker = scheduler.connected_workers.get_mut(&full).unwrap();
+        full_worker.free_slots = 1;
+        full_worker.health = Some(health(10, 0));
+        let mut add_worker = |health| {
+            let uuid = Uuid::new_v4();
+            scheduler.connected_workers.insert(
+                uuid,
+                ConnectedWorker {
+                    uuid,
+                    name: "worker".into(),
+                    current_job: None,
+                    queued_jobs: VecDeque::new(),
+                    free_slots: 2,
+                    known_files: HashSet::new(),
+                    health: Some(health),
+                },
+            );
+            uuid
+        };
+        let loaded = add_worker(health(400, 100 << 30));
+        let healthy = add_worker(health(10, 100 << 30));
+
+        scheduler.assign_jobs().unwrap();
+        let num_jobs =
+            |scheduler: &Scheduler, worker| scheduler.connected_workers[&worker].num_jobs();
+        // the healthy worker gets its jobs first, the worker with the full disk gets none
+        assert_eq!(num_jobs(&scheduler, healthy), 2);
+        assert_eq!(num_jobs(&scheduler, loaded), 1);
+        assert_eq!(num_jobs(&scheduler, full), 0);
+
+        // when it's the only one left, the unusable worker still gets the jobs
+        let jobs = scheduler.connected_workers[&loaded].current_job.unwrap();
+        scheduler.handle_worker_disconnected(loaded).unwrap();
+        scheduler.handle_worker_disconnected(healthy).unwrap();
+        assert!(scheduler.clients[&jobs.0].ready_groups.contains(&jobs.1));
+        scheduler.assign_jobs().unwrap();
+        assert_eq!(num_jobs(&scheduler, full), 1);
     }
 }
@@ -0,0 +1,235 @@
+//! Recording of a timeline of the evaluation, in the
+//! [Chrome trace-event format](https://docs.google.com/document/d/1CvAClvFfyA5R-PhYUmn5OOQtYMH4h6I0nSsKchNAySU).
+//!
+//! The recording is global to the process and disabled by default: after calling `enable` the
+//! scheduler, the workers and the worker manager record the phases of each execution group
+//! (waiting for a worker, receiving the files, setting up the sandboxes, running them and sending
+//! back the outputs). The timeline can then be written with `write` and opened in Perfetto or in
+//! `chrome://tracing`.
+//!
+//! Each component records its phases in a separate lane (a "thread" of the trace): the phases
+//! recorded in the same lane never overlap, the ones that may overlap (like the executions waiting
+//! in the queue of the scheduler) are recorded as asynchronous events.
+
+use std::collections::HashMap;
+use std::path::Path;
+use std::sync::atomic::{AtomicBool, Ordering};
+use std::sync::Mutex;
+use std::time::Instant;
+
+use anyhow::{Context, Error};
+use serde::Serialize;
+use task_maker_dag::ExecutionGroupUuid;
+
+/// Whether the events are being recorded. Checked before taking the lock of `TRACER`, so that the
+/// recording costs nothing when disabled.
+static ENABLED: AtomicBool = AtomicBool::new(false);
+/// The events recorded so far.
+static TRACER: Mutex<Option<Tracer>> = Mutex::new(None);
+
+/// The state of the recording.
+struct Tracer {
+    /// The instant of the start of the recording, from which the timestamps are measured.
+    start: Instant,
+    /// The identifier of each lane, by name.
+    lanes: HashMap<String, usize>,
+    /// The recorded events.
+    events: Vec<TraceEvent>,
+}
+
+/// A single event of the trace, as defined by the trace-event format.
+#[derive(Debug, Serialize)]
+struct TraceEvent {
+    /// The name of the event.
+    name: String,
+    /// The category of the event.
+    cat: &'static str,
+    /// The type of the event: `X` complete event, `b`/`e` begin and end of an asynchronous event,
+    /// `M` metadata.
+    ph: &'static str,
+    /// The timestamp of the event, in microseconds.
+    ts: f64,
+    /// The duration of the complete events, in microseconds.
+    #[serde(skip_serializing_if = "Option::is_none")]
+    dur: Option<f64>,
+    /// The process of the event, always the same since the lanes are the threads of the trace.
+    pid: u32,
+    /// The lane of the event.
+    tid: usize,
+    /// The identifier that matches the begin and the end of an asynchronous event.
+    #[serde(skip_serializing_if = "Option::is_none")]
+    id: Option<String>,
+    /// Additional information shown with the event.
+    args: serde_json::Value,
+}
+
+impl Tracer {
+    /// The identifier of a lane, allocating a new one if needed.
+    fn lane(&mut self, lane: &str) -> usize {
+        if let Some(tid) = self.lanes.get(lane) {
+            return *tid;
+        }
+        let tid = self.lanes.len() + 1;
+        self.lanes.insert(lane.to_string(), tid);
+        tid
+    }
+
+    /// The number of microseconds from the start of the recording to `instant`.
+    fn timestamp(&self, instant: Instant) -> f64 {
+        instant.saturating_duration_since(self.start).as_secs_f64() * 1_000_000.0
+    }
+}
+
+/// Start recording the events. Calling it again discards the events recorded so far.
+pub fn enable() {
+    *TRACER.lock().unwrap() = Some(Tracer {
+        start: Instant::now(),
+        lanes: HashMap::new(),
+        events: Vec::new(),
+    });
+    ENABLED.store(true, Ordering::SeqCst);
+}
+
+/// Whether the events are being recorded.
+pub fn is_enabled() -> bool {
+    ENABLED.load(Ordering::Relaxed)
+}
+
+/// Record a phase of an execution group that happened in a lane. The phases of the same lane must
+/// not overlap.
+pub(crate) fn span(
+    lane: &str,
+    name: &str,
+    group: Option<(ExecutionGroupUuid, &str)>,
+    start: Instant,
+    end: Instant,
+) {
+    if !is_enabled() {
+        return;
+    }
+    let mut tracer = TRACER.lock().unwrap();
+    let Some(tracer) = tracer.as_mut() else {
+        return;
+    };
+    let event = TraceEvent {
+        name: name.to_string(),
+        cat: "phase",
+        ph: "X",
+        ts: tracer.timestamp(start),
+        dur: Some(tracer.timestamp(end) - tracer.timestamp(start)),
+        pid: 1,
+        tid: tracer.lane(lane),
+        id: None,
+        args: group_args(group),
+    };
+    tracer.events.push(event);
+}
+
+/// Record a phase of an execution group that may overlap with the ones of the other groups in the
+/// same lane.
+pub(crate) fn async_span(
+    lane: &str,
+    name: &str,
+    group: (ExecutionGroupUuid, &str),
+    start: Instant,
+    end: Instant,
+) {
+    if !is_enabled() {
+        return;
+    }
+    let mut tracer = TRACER.lock().unwrap();
+    let Some(tracer) = tracer.as_mut() else {
+        return;
+    };
+    let tid = tracer.lane(lane);
+    for (ph, instant) in [("b", start), ("e", end)] {
+        let event = TraceEvent {
+            name: name.to_string(),
+            cat: "queue",
+            ph,
+            ts: tracer.timestamp(instant),
+            dur: None,
+            pid: 1,
+            tid,
+            id: Some(group.0.to_string()),
+            args: group_args(Some(group)),
+        };
+        tracer.events.push(event);
+    }
+}
+
+/// The arguments of an event about an execution group.
+fn group_args(group: Option<(ExecutionGroupUuid, &str)>) -> serde_json::Value {
+    match group {
+        Some((uuid, description)) => serde_json::json!({
+            "group": uuid.to_string(),
+            "description": description,
+        }),
+        None => serde_json::json!({}),
+    }
+}
+
+/// Write the events recorded so far to a file, as a JSON trace. Nothing is written if the
+/// recording is not enabled.
+pub fn write<P: AsRef<Path>>(path: P) -> Result<(), Error> {
+    let path = path.as_ref();
+    let tracer = TRACER.lock().unwrap();
+    let Some(tracer) = tracer.as_ref() else {
+        return Ok(());
+    };
+    let names: Vec<_> = tracer
+        .lanes
+        .iter()
+        .map(|(name, tid)| TraceEvent {
+            name: "thread_name".into(),
+            cat: "__metadata",
+            ph: "M",
+            ts: 0.0,
+            dur: None,
+            pid: 1,
+            tid: *tid,
+            id: None,
+            args: serde_json::json!({ "name": name }),
+        })
+        .collect();
+    let events: Vec<&TraceEvent> = names.iter().chain(&tracer.events).collect();
+    let trace = serde_json::json!({
+        "traceEvents": events,
+        "displayTimeUnit": "ms",
+    });
+    let file = std::fs::File::create(path)
+        .with_context(|| format!("Failed to create trace file at {}", path.display()))?;
+    serde_json::to_writer(std::io::BufWriter::new(file), &trace)
+        .with_context(|| format!("Failed to write trace file at {}", path.display()))?;
+    Ok(())
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_trace() {
+        enable();
+        let start = Instant::now();
+        let end = start + std::time::Duration::from_millis(5);
+        let uuid = ExecutionGroupUuid::new_v4();
+        span("worker", "run", Some((uuid, "sol.cpp")), start, end);
+        async_span("scheduler", "queued", (uuid, "sol.cpp"), start, end);
+
+        let tmpdir = tempfile::TempDir::new().unwrap();
+        let path = tmpdir.path().join("trace.json");
+        write(&path).unwrap();
+        let trace: serde_json::Value =
+            serde_json::from_str(&std::fs::read_to_string(&path).unwrap()).unwrap();
+        let events = trace["traceEvents"].as_array().unwrap();
+        assert_eq!(events.iter().filter(|e| e["ph"] == "M").count(), 2);
+        let run = events.iter().find(|e| e["name"] == "run").unwrap();
+        assert_eq!(run["ph"], "X");
+        assert!((run["dur"].as_f64().unwrap() - 5000.0).abs() < 1.0);
+        assert_eq!(run["args"]["description"], "sol.cpp");
+        let queued: Vec<_> = events.iter().filter(|e| e["name"] == "queued").collect();
+        assert_eq!(queued.len(), 2);
+        assert_eq!(queued[0]["id"], queued[1]["id"]);
+    }
+}
@@ -0,0 +1,222 @@
+//! Calibration of the speed of a worker, for making the times measured on different machines
+//! comparable.
+//!
+//! When the workers have CPUs of different generations the same solution may be within the time
+//! limit on some of them and exceed it on the others, depending on where the scheduler put it. Each
+//! worker runs a small CPU-bound benchmark when it starts, and compares its time with the one of a
+//! reference machine. The times of the executions are then multiplied by the speed of the worker,
+//! as if they were measured on the reference machine, and optionally the limits given to the
+//! sandboxes are divided by it, so that a slower worker lets the processes run for longer.
+
+use std::time::{Duration, Instant};
+
+use task_maker_dag::{Execution, ExecutionResourcesUsage, ExecutionStatus};
+
+/// The calibration computes the primes up to this number with a sieve of Eratosthenes.
+const CALIBRATION_SIEVE_SIZE: usize = 1 << 22;
+/// The calibration is repeated this many times, and the fastest run is taken.
+const CALIBRATION_RUNS: usize = 5;
+
+/// How the times measured by a worker are normalized to the ones of the reference machine.
+#[derive(Debug, Clone, Copy, PartialEq)]
+pub struct TimeNormalization {
+    /// How fast the worker is compared to the reference machine: 2.0 means twice as fast.
+    pub speed: f64,
+    /// Whether the time limits of the sandboxes are also scaled by the speed.
+    pub scale_limits: bool,
+}
+
+impl TimeNormalization {
+    /// The normalization for a worker that ran the calibration in `calibration`, when the reference
+    /// machine runs it in `reference`.
+    pub fn new(calibration: Duration, reference: Duration, scale_limits: bool) -> Self {
+        TimeNormalization {
+            speed: reference.as_secs_f64() / calibration.as_secs_f64().max(1e-6),
+            scale_limits,
+        }
+    }
+
+    /// Scale the time limits of the execution, if they have to be, so that a slower worker lets
+    /// the process run for longer.
+    pub(crate) fn scale_limits(&self, execution: &mut Execution) {
+        if !self.scale_limits {
+            return;
+        }
+        let limits = &mut execution.limits;
+        for limit in [
+            &mut limits.cpu_time,
+            &mut limits.sys_time,
+            &mut limits.wall_time,
+        ]
+        .into_iter()
+        .flatten()
+        {
+            *limit /= self.speed;
+        }
+    }
+
+    /// The verdict of a process killed by the sandbox for exceeding the time limits it was given,
+    /// with the times `measured` on this worker. Without scaling the limits, a process killed on a
+    /// slower worker has a normalized time within the original limits: it still exceeded them.
+    /// `None` if the process wasn't killed for the time.
+    pub(crate) fn sandbox_time_verdict(
+        &self,
+        execution: &Execution,
+        status: &ExecutionStatus,
+        measured: &ExecutionResourcesUsage,
+    ) -> Option<ExecutionStatus> {
+        if !matches!(status, ExecutionStatus::Signal(..)) {
+            return None;
+        }
+        let exceeded = |limit: Option<f64>, time: f64| {
+            let limit = if self.scale_limits {
+                limit.map(|limit| limit / self.speed)
+            } else {
+                limit
+            };
+            limit.is_some_and(|limit| time > limit)
+        };
+        let limits = &execution.limits;
+        if exceeded(limits.cpu_time, measured.cpu_time) {
+            Some(ExecutionStatus::TimeLimitExceeded)
+        } else if exceeded(limits.sys_time, measured.sys_time) {
+            Some(ExecutionStatus::SysTimeLimitExceeded)
+        } else if exceeded(limits.wall_time, measured.wall_time) {
+            Some(ExecutionStatus::WallTimeLimitExceeded)
+        } else {
+            None
+        }
+    }
+
+    /// Convert the times measured on this worker to the ones of the reference machine.
+    pub(crate) fn normalize(&self, resources: &mut ExecutionResourcesUsage) {
+        resources.cpu_time *= self.speed;
+        resources.sys_time *= self.speed;
+        resources.wall_time *= self.speed;
+    }
+}
+
+/// Run the calibration benchmark, returning the time of the fastest run.
+pub fn calibrate() -> Duration {
+    (0..CALIBRATION_RUNS)
+        .map(|_| {
+            let start = Instant::now();
+            std::hint::black_box(count_primes(std::hint::black_box(CALIBRATION_SIEVE_SIZE)));
+            start.elapsed()
+        })
+        .min()
+        .unwrap_or_default()
+}
+
+/// Count the primes smaller than `n`.
+fn count_primes(n: usize) -> usize {
+    let mut composite = vec![false; n];
+    let mut count = 0;
+    for i in 2..n {
+        if composite[i] {
+            continue;
+        }
+        count += 1;
+        for multiple in (i.saturating_mul(i)..n).step_by(i) {
+            composite[multiple] = true;
+        }
+    }
+    count
+}
+
+#[cfg(test)]
+mod tests {
+    use task_maker_dag::ExecutionCommand;
+
+    use super::*;
+
+    #[test]
+    fn test_count_primes() {
+        assert_eq!(count_primes(10), 4);
+        assert_eq!(count_primes(100), 25);
+        assert_eq!(count_primes(2), 0);
+    }
+
+    #[test]
+    fn test_normalization() {
+        // a worker twice as slow as the reference
+        let normalization =
+            TimeNormalization::new(Duration::from_secs(2), Duration::from_secs(1), true);
+        assert_eq!(normalization.speed, 0.5);
+
+        let mut resources = ExecutionResourcesUsage {
+            cpu_time: 3.0,
+            sys_time: 0.5,
+            wall_time: 4.0,
+            memory: 1000,
+            counters: None,
+        };
+        normalization.normalize(&mut resources);
+        assert_eq!(resources.cpu_time, 1.5);
+        assert_eq!(resources.sys_time, 0.25);
+        assert_eq!(resources.wall_time, 2.0);
+        assert_eq!(resources.memory, 1000);
+
+        let mut execution = Execution::new("exec", ExecutionCommand::system("true"));
+        execution.limits_mut().cpu_time(1.0).wall_time(2.0);
+        normalization.scale_limits(&mut execution);
+        assert_eq!(execution.limits.cpu_time, Some(2.0));
+        assert_eq!(execution.limits.wall_time, Some(4.0));
+        assert_eq!(execution.limits.sys_time, None);
+
+        let mut execution = Execution::new("exec", ExecutionCommand::system("true"));
+        execution.limits_mut().cpu_time(1.0);
+        TimeNormalization {
+            scale_limits: false,
+            ..normalization
+        }
+        .scale_limits(&mut execution);
+        assert_eq!(execution.limits.cpu_time, Some(1.0));
+    }
+
+    #[test]
+    fn test_sandbox_time_verdict() {
+        let killed = ExecutionStatus::Signal(9, "Killed".into());
+        let mut execution = Execution::new("exec", ExecutionCommand::system("true"));
+        execution.limits_mut().cpu_time(1.0).wall_time(3.0);
+        let measured = |cpu_time, wall_time| ExecutionResourcesUsage {
+            cpu_time,
+            wall_time,
+            ..Default::default()
+        };
+
+        // a worker twice as slow as the reference, killed at the original limits: the normalized
+        // times are within the limits
+        for scale_limits in [false, true] {
+            let normalization = TimeNormalization {
+                speed: 0.5,
+                scale_limits,
+            };
+            // how much the sandbox limits are longer than the original ones
+            let scale = if scale_limits { 2.0 } else { 1.0 };
+            let verdict = normalization.sandbox_time_verdict(
+                &execution,
+                &killed,
+                &measured(1.0 * scale + 0.1, 0.5),
+            );
+            assert_eq!(verdict, Some(ExecutionStatus::TimeLimitExceeded));
+            let verdict = normalization.sandbox_time_verdict(
+                &execution,
+                &killed,
+                &measured(0.1, 3.0 * scale + 0.1),
+            );
+            assert_eq!(verdict, Some(ExecutionStatus::WallTimeLimitExceeded));
+            // killed by something else
+            let verdict =
+                normalization.sandbox_time_verdict(&execution, &killed, &measured(0.5, 0.5));
+            assert_eq!(verdict, None);
+            // exited by itself
+            let verdict = normalization.sandbox_time_verdict(
+                &execution,
+                &ExecutionStatus::Success,
+                &measured(1.0 * scale + 0.1, 0.5),
+            );
+            assert_eq!(verdict, None);
+        }
+    }
+}
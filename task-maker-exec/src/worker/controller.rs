@@ -4,10 +4,10 @@ use std::{
     io::{stdin, stdout, BufRead, BufReader, Write},
     os::fd::{AsRawFd, OwnedFd},
     path::{Path, PathBuf},
-    process::{Child, ChildStdin, Command, Stdio},
+    process::{Child, ChildStdin, Command, ExitStatus, Stdio},
     sync::{
         atomic::{AtomicBool, AtomicU32, Ordering},
-        mpsc::{channel, Sender, TryRecvError},
+        mpsc::{channel, Sender},
         Arc, Condvar, Mutex,
     },
     thread::{self, sleep, JoinHandle},
@@ -30,10 +30,13 @@ use tempfile::TempDir;
 use uuid::Uuid;
 
 use crate::{
-    execution_unit::{sandbox::Sandbox, ExecutionUnit, SandboxResult},
+    execution_unit::{sandbox::Sandbox, sandbox_pool::SandboxPool, ExecutionUnit, SandboxResult},
     find_tools::find_tools_path,
+    hardware_counters::HARDWARE_COUNTERS_ARG,
     proto::WorkerClientMessage,
-    worker::{compute_execution_result, get_result_outputs, OutputFile, WorkerCurrentJob},
+    worker::{
+        compute_execution_result, get_result_outputs, OutputFile, OutputSettings, WorkerCurrentJob,
+    },
     RawSandboxResult, SandboxRunner,
 };
 
@@ -73,15 +76,36 @@ fn controller_keeper_inner(process_limit: usize, result_dir: &Path) -> Result<()
         })
         .collect::<Result<Vec<_>>>()?;
 
+    /// The events handled by the keeper, in the order they happen.
+    enum Event {
+        /// A line from stdin with the configuration of a sandbox, `None` when stdin is closed.
+        Command(Option<std::io::Result<String>>),
+        /// A sandbox process exited: its index, the path of its result and its exit status.
+        Exited(usize, PathBuf, std::io::Result<ExitStatus>),
+    }
+
+    // Both the commands and the exits of the sandboxes are sent to the same channel, so that the
+    // loop simply blocks until something happens.
     let (send, recv) = channel();
-    let stdin_thread = thread::spawn(move || {
-        let stdin = stdin().lines();
-        for line in stdin {
-            if send.send(line).is_err() {
-                break;
+    let stdin_thread = {
+        let send = send.clone();
+        thread::spawn(move || {
+            for line in stdin().lines() {
+                if send.send(Event::Command(Some(line))).is_err() {
+                    return;
+                }
             }
-        }
-    });
+            let _ = send.send(Event::Command(None));
+        })
+    };
+    // Wait for the sandbox process in a separate thread, that reports when it exits.
+    let wait_box = |num: usize, mut child: Child, output_path: PathBuf| {
+        let send = send.clone();
+        thread::spawn(move || {
+            let status = child.wait();
+            let _ = send.send(Event::Exited(num, output_path, status));
+        });
+    };
 
     let fds_to_send: Vec<_> = pipes
         .iter()
@@ -93,54 +117,43 @@ fn controller_keeper_inner(process_limit: usize, result_dir: &Path) -> Result<()
         })
         .collect();
 
-    let mut running_boxes: Vec<(usize, Child, PathBuf)> = vec![];
-
+    let mut running_boxes = 0;
+    let mut stdin_closed = false;
     let mut num_started_processes = 0;
-    'event: loop {
-        for i in 0..running_boxes.len() {
-            if let Some(s) = running_boxes[i].1.try_wait()? {
-                if !s.success() {
+    while !stdin_closed || running_boxes > 0 {
+        // this never fails since `send` is still alive
+        let Ok(event) = recv.recv() else {
+            break;
+        };
+        let line = match event {
+            Event::Exited(num, output_path, status) => {
+                let status = status?;
+                if !status.success() {
                     std::fs::write(
-                        &running_boxes[i].2,
+                        &output_path,
                         serde_json::to_string(&RawSandboxResult::Error(format!(
                             "Sandbox process failed: {}",
-                            s
+                            status
                         )))?,
                     )?;
                 }
-                println!(
-                    "DONE {}: {}",
-                    running_boxes[i].0,
-                    running_boxes[i].2.to_string_lossy()
-                );
+                println!("DONE {}: {}", num, output_path.to_string_lossy());
                 stdout().flush().unwrap();
-                running_boxes.swap_remove(i);
-                continue 'event;
+                running_boxes -= 1;
+                continue;
             }
-        }
-
-        // Read sandbox configurations from stdin.
-        let line = match recv.try_recv() {
-            Err(TryRecvError::Empty) => None,
-            Err(TryRecvError::Disconnected) => {
-                if running_boxes.is_empty() {
-                    break;
-                } else {
-                    None
-                }
+            Event::Command(None) => {
+                stdin_closed = true;
+                continue;
             }
-            Ok(line) => Some(line?),
+            // Read sandbox configurations from stdin.
+            Event::Command(Some(line)) => line?,
         };
 
-        let Some(line) = line else {
-            // Sleep a bit before trying to read new events.
-            std::thread::sleep(Duration::from_millis(1));
-            continue;
-        };
-
-        let config: SandboxConfiguration =
+        let (config, hardware_counters): (SandboxConfiguration, bool) =
             serde_json::from_str(&line).context("while parsing sandbox configuration")?;
         let config = serde_json::to_string(&config).context("Failed to serialize config")?;
+        let counters_arg = hardware_counters.then_some(HARDWARE_COUNTERS_ARG);
         let output_path = if num_started_processes == 0 {
             result_dir.join("controller")
         } else {
@@ -171,12 +184,14 @@ fn controller_keeper_inner(process_limit: usize, result_dir: &Path) -> Result<()
                 .arg("internal-sandbox")
                 .arg(config)
                 .arg(output_path.as_os_str())
+                .args(counters_arg)
                 .spawn()
                 .context("Cannot spawn the sandbox")?;
             let pid = cmd.id();
             println!("0: {pid}");
-            running_boxes.push((0, cmd, output_path));
             stdout().flush().unwrap();
+            wait_box(0, cmd, output_path);
+            running_boxes += 1;
 
             // Close the FDs passed to the controller.
             for p in pipes.iter_mut() {
@@ -190,6 +205,7 @@ fn controller_keeper_inner(process_limit: usize, result_dir: &Path) -> Result<()
             cmd.arg("internal-sandbox")
                 .arg(config)
                 .arg(output_path.as_os_str())
+                .args(counters_arg)
                 .stdin(pipes.read_controller_to_sol.take().unwrap())
                 .stdout(pipes.write_sol_to_controller.take().unwrap());
 
@@ -201,8 +217,9 @@ fn controller_keeper_inner(process_limit: usize, result_dir: &Path) -> Result<()
             let child = cmd.spawn().context("Cannot spawn the sandbox")?;
             let pid = child.id();
             println!("{}: {pid} {} {}", num_started_processes, fds.0, fds.1);
-            running_boxes.push((num_started_processes, child, output_path));
             stdout().flush().unwrap();
+            wait_box(num_started_processes, child, output_path);
+            running_boxes += 1;
         }
         num_started_processes += 1;
     }
@@ -330,16 +347,25 @@ impl ControllerKeeper {
 }
 
 impl SandboxRunner for ControllerKeeper {
-    fn run(&self, config: SandboxConfiguration, pid: Arc<AtomicU32>) -> RawSandboxResult {
+    fn run(
+        &self,
+        config: SandboxConfiguration,
+        pid: Arc<AtomicU32>,
+        hardware_counters: bool,
+    ) -> RawSandboxResult {
         // try blocks at home
         let result = (|| -> Result<_> {
             let (sender, receiver) = channel();
-            self.senders_and_pids.lock().unwrap().push((sender, pid));
+            // Keep the lock until the configuration is sent: the keeper numbers the sandboxes in
+            // the order it receives them, and many solutions may be starting at the same time.
+            let mut senders_and_pids = self.senders_and_pids.lock().unwrap();
+            senders_and_pids.push((sender, pid));
             writeln!(
                 self.child_stdin.lock().unwrap().as_ref().unwrap(),
                 "{}",
-                serde_json::to_string(&config)?
+                serde_json::to_string(&(config, hardware_counters))?
             )?;
+            drop(senders_and_pids);
             Ok(receiver.recv()?)
         })();
         match result {
@@ -370,21 +396,22 @@ pub(super) fn execute_controlled_job(
     controller_settings: ControllerSettings,
     current_job: Arc<Mutex<WorkerCurrentJob>>,
     sender: &ChannelSender<WorkerClientMessage>,
-    sandbox_path: &Path,
+    sandbox_pool: &Arc<SandboxPool>,
     runner: Arc<dyn SandboxRunner>,
+    output_settings: OutputSettings,
 ) -> Result<JoinHandle<()>, Error> {
     // We don't use the runner, but rather unconditionally use internal-sandbox.
     drop(runner);
-    let fifo_dir = TempDir::new_in(sandbox_path).with_context(|| {
+    let fifo_dir = TempDir::new_in(sandbox_pool.path()).with_context(|| {
         format!(
             "Failed to create temporary directory in {}",
-            sandbox_path.display()
+            sandbox_pool.path().display()
         )
     })?;
-    let result_dir = TempDir::new_in(sandbox_path).with_context(|| {
+    let result_dir = TempDir::new_in(sandbox_pool.path()).with_context(|| {
         format!(
             "Failed to create temporary directory in {}",
-            sandbox_path.display()
+            sandbox_pool.path().display()
         )
     })?;
 
@@ -429,6 +456,7 @@ pub(super) fn execute_controlled_job(
     let dag_config = group.config.clone();
     let description = group.description.clone();
     let sol_execution = group.executions[1].clone();
+    let time_normalization = output_settings.time_normalization;
 
     let controller_keeper = Arc::new(ControllerKeeper::new(
         controller_settings.process_limit,
@@ -456,8 +484,10 @@ pub(super) fn execute_controlled_job(
 
     debug!("Controller execution: {controller_execution:?}");
 
-    let controller_sandbox = ExecutionUnit::Sandbox(Sandbox::new(
-        sandbox_path,
+    // the sandboxes of a controlled execution are never put on the tmpfs: one of them cannot be
+    // run again alone if it fails after filling it
+    let controller_sandbox = ExecutionUnit::Sandbox(Sandbox::new_on_disk(
+        sandbox_pool,
         &controller_execution,
         &deps,
         Some(fifo_dir.path().to_owned()),
@@ -493,7 +523,8 @@ pub(super) fn execute_controlled_job(
                 }
             };
 
-            let mut result = compute_execution_result(&execution, result, &sandbox);
+            let mut result =
+                compute_execution_result(&execution, result, &sandbox, time_normalization.as_ref());
             let is_success = result.status.is_success();
 
             {
@@ -525,6 +556,11 @@ pub(super) fn execute_controlled_job(
                     }
                     sr.resources.cpu_time += result.resources.cpu_time;
                     sr.resources.sys_time += result.resources.sys_time;
+                    if let Some(counters) = result.resources.counters {
+                        let total = sr.resources.counters.get_or_insert_with(Default::default);
+                        total.instructions += counters.instructions;
+                        total.cycles += counters.cycles;
+                    }
                     if controller_settings.concurrent {
                         sr.resources.memory += result.resources.memory;
                     } else {
@@ -563,7 +599,7 @@ pub(super) fn execute_controlled_job(
 
     let sandbox_manager = {
         let sender = sender.clone();
-        let sandbox_path = sandbox_path.to_owned();
+        let sandbox_pool = sandbox_pool.clone();
         let description = description.clone();
         let current_job = current_job.clone();
         move || -> Result<()> {
@@ -604,72 +640,93 @@ pub(super) fn execute_controlled_job(
             let mut last_start = Instant::now();
 
             // Handle requests from the controller.
-            for line in read_from_controller.lines() {
+            'requests: for line in read_from_controller.lines() {
                 let line = line?;
-                match line.as_str() {
-                    "START_SOLUTION" => {
-                        // Create a new sandbox.
-                        let index = next_process_index;
-                        next_process_index += 1;
-
-                        debug!("Execution group `{description}` starting a new solution {index} as requested by controller");
-
-                        ensure_controller!(
-                            index < controller_settings.process_limit,
-                            "controller started too many solutions!"
-                        );
+                // START_SOLUTION starts a single solution, START_SOLUTIONS <n> starts n solutions
+                // at once.
+                let num_solutions = match line.as_str() {
+                    "START_SOLUTION" => Some(1),
+                    _ => line
+                        .strip_prefix("START_SOLUTIONS ")
+                        .and_then(|num| num.trim().parse::<usize>().ok()),
+                };
+                ensure_controller!(num_solutions.is_some(), "Unknown command {line}");
+                let num_solutions = num_solutions.unwrap();
+                ensure_controller!(
+                    next_process_index + num_solutions <= controller_settings.process_limit,
+                    "controller started too many solutions!"
+                );
 
-                        let sol_execution = sol_execution.clone();
+                // Start all the sandboxes before waiting for any of them, so that they start in
+                // parallel.
+                let first_process_index = next_process_index;
+                for _ in 0..num_solutions {
+                    // Create a new sandbox.
+                    let index = next_process_index;
+                    next_process_index += 1;
 
-                        let sol_sandbox =
-                            ExecutionUnit::new(&sandbox_path, &sol_execution, &deps, None)?;
+                    debug!("Execution group `{description}` starting a new solution {index} as requested by controller");
 
-                        {
-                            let mut job = current_job.lock().unwrap();
-                            let controller_state = job.controller_state.as_mut().unwrap();
+                    let sol_execution = sol_execution.clone();
 
-                            if job_should_terminate.load(Ordering::Relaxed) {
-                                // Exit the loop without starting a solution.
-                                break;
-                            }
+                    // the limits are checked on the normalized times against the original ones
+                    let mut sandboxed_execution = sol_execution.clone();
+                    if let Some(normalization) = &time_normalization {
+                        normalization.scale_limits(&mut sandboxed_execution);
+                    }
+                    let sol_sandbox = ExecutionUnit::new_on_disk(
+                        &sandbox_pool,
+                        &sandboxed_execution,
+                        &deps,
+                        None,
+                    )?;
 
-                            controller_state.exited.push(false);
+                    {
+                        let mut job = current_job.lock().unwrap();
+                        let controller_state = job.controller_state.as_mut().unwrap();
 
-                            job.current_sandboxes
-                                .as_mut()
-                                .unwrap()
-                                .push(sol_sandbox.clone());
+                        if job_should_terminate.load(Ordering::Relaxed) {
+                            // Exit the loop without starting a solution.
+                            break 'requests;
                         }
 
-                        {
-                            let run_sandbox = run_sandbox.clone();
-                            solution_threads.push(
-                                std::thread::Builder::new()
-                                    .name(format!("Sandbox for solution {index} for {description}"))
-                                    .spawn(move || {
-                                        run_sandbox(sol_sandbox, sol_execution, next_process_index)
-                                    })?,
-                            );
-                        }
+                        controller_state.exited.push(false);
 
-                        let pipes = controller_keeper
-                            .wait_for_pipes(next_process_index)
-                            .unwrap();
+                        job.current_sandboxes
+                            .as_mut()
+                            .unwrap()
+                            .push(sol_sandbox.clone());
+                    }
 
-                        last_start = Instant::now();
+                    {
+                        let run_sandbox = run_sandbox.clone();
+                        let process_index = next_process_index;
+                        solution_threads.push(
+                            std::thread::Builder::new()
+                                .name(format!("Sandbox for solution {index} for {description}"))
+                                .spawn(move || {
+                                    run_sandbox(sol_sandbox, sol_execution, process_index)
+                                })?,
+                        );
+                    }
+                }
 
-                        if let Err(e) = writeln!(write_to_controller, "{} {}", pipes.0, pipes.1) {
-                            if e.kind() == std::io::ErrorKind::BrokenPipe {
-                                warn!(
-                                    "Controller disappeared while writing START_SOLUTION response"
-                                );
-                                return Ok(());
-                            }
-                            return Err(e).context("Writing START_SOLUTION response to controller");
+                // Reply with all the pipes at once, so that the controller receives them with a
+                // single read.
+                let mut reply = String::new();
+                for process_index in first_process_index + 1..=next_process_index {
+                    let pipes = controller_keeper.wait_for_pipes(process_index).unwrap();
+                    reply += &format!("{} {}\n", pipes.0, pipes.1);
+                }
+                if num_solutions > 0 {
+                    last_start = Instant::now();
+
+                    if let Err(e) = write_to_controller.write_all(reply.as_bytes()) {
+                        if e.kind() == std::io::ErrorKind::BrokenPipe {
+                            warn!("Controller disappeared while writing START_SOLUTION response");
+                            return Ok(());
                         }
-                    }
-                    _ => {
-                        ensure_controller!(false, "Unknown command {line}");
+                        return Err(e).context("Writing START_SOLUTION response to controller");
                     }
                 }
             }
@@ -722,6 +779,10 @@ pub(super) fn execute_controlled_job(
             } = std::mem::take(&mut current_job.lock().unwrap().controller_state).unwrap();
             let controller_result = controller_result.unwrap();
 
+            let stored_outputs = output_settings
+                .shared_store
+                .as_ref()
+                .map(|store| super::store_outputs(store, &outputs, &output_paths));
             sender
                 .send(WorkerClientMessage::WorkerDone(
                     vec![controller_result, solution_result],
@@ -735,8 +796,11 @@ pub(super) fn execute_controlled_job(
                 outputs,
                 output_paths,
                 &sender,
+                &output_settings,
                 Some(fifo_dir),
-            )
+            )?;
+            drop(stored_outputs);
+            Ok(())
         }
     };
 
@@ -0,0 +1,282 @@
+//! The health of the machine of a worker, periodically reported to the server.
+//!
+//! The server knows the workers only from the jobs they ask for, so a worker whose disk is nearly
+//! full, or whose machine is loaded by something else, would keep getting jobs and slowing down (or
+//! failing) the whole evaluation. Instead each worker sends a `WorkerHealth` every
+//! `HEARTBEAT_INTERVAL`, and the scheduler gives the jobs to the healthy workers first, skipping
+//! the ones that cannot run them.
+
+use std::path::{Path, PathBuf};
+use std::sync::mpsc::{channel, RecvTimeoutError, Sender};
+use std::sync::{Arc, Mutex};
+use std::time::Duration;
+
+use anyhow::{Context, Error};
+use ductile::ChannelSender;
+use serde::{Deserialize, Serialize};
+
+use crate::overhead::{OverheadHistograms, OverheadRecorder};
+use crate::proto::WorkerClientMessage;
+
+/// How often the workers report their health.
+const HEARTBEAT_INTERVAL: Duration = Duration::from_secs(10);
+/// Below this free space in the store or in the sandboxes the worker cannot run the jobs.
+const MIN_FREE_DISK_SPACE: u64 = 1 << 30;
+/// Above this load, in percent of the cores, the worker is overloaded.
+const MAX_LOAD_PERCENT: u32 = 150;
+/// Below this available memory the worker is overloaded.
+const MIN_FREE_MEMORY: u64 = 512 << 20;
+/// Above this time for preparing the sandboxes of a job the worker is overloaded.
+const MAX_SANDBOX_SETUP: Duration = Duration::from_secs(1);
+/// The weight of the older sandbox setups in the average reported, relative to the last one.
+const SETUP_HISTORY_WEIGHT: u32 = 3;
+
+/// The health of the machine of a worker.
+#[derive(Debug, Clone, Serialize, Deserialize, PartialEq, Eq)]
+pub struct WorkerHealth {
+    /// The load average of the last minute, in percent of the cores of the machine.
+    pub load_percent: u32,
+    /// The memory available for new processes, in bytes.
+    pub free_memory: u64,
+    /// The free space in the directory of the store, in bytes.
+    pub store_free_space: u64,
+    /// The free space in the directory of the sandboxes, in bytes.
+    pub sandbox_free_space: u64,
+    /// The recent average time for preparing the sandboxes of a job, if the worker ran some.
+    pub sandbox_setup: Option<Duration>,
+    /// The time spent in each phase of the executions, since the worker started.
+    pub overhead: OverheadHistograms,
+}
+
+/// How a worker should be used by the scheduler, from the best to the worst.
+#[derive(Debug, Clone, Copy, PartialEq, Eq, PartialOrd, Ord, Hash)]
+pub enum HealthStatus {
+    /// The worker can run the jobs normally.
+    Healthy,
+    /// The worker is slow: it gets the jobs only when the healthy workers are busy.
+    Overloaded,
+    /// The worker is not able to run the jobs, for example because its disk is full: it gets the
+    /// jobs only if all the workers are in this state.
+    Unusable,
+}
+
+/// Measures the health of the worker, keeping track of the time spent preparing the sandboxes.
+#[derive(Debug)]
+pub(crate) struct HealthMonitor {
+    /// The directory of the store of the worker.
+    store_path: PathBuf,
+    /// The directory of the sandboxes of the worker.
+    sandbox_path: PathBuf,
+    /// The moving average of the time for preparing the sandboxes of a job.
+    sandbox_setup: Mutex<Option<Duration>>,
+    /// The durations of the phases of the executions of the worker.
+    overhead: Arc<OverheadRecorder>,
+}
+
+impl WorkerHealth {
+    /// How the scheduler should use the worker with this health.
+    pub fn status(&self) -> HealthStatus {
+        if self.store_free_space < MIN_FREE_DISK_SPACE
+            || self.sandbox_free_space < MIN_FREE_DISK_SPACE
+        {
+            HealthStatus::Unusable
+        } else if self.load_percent > MAX_LOAD_PERCENT
+            || self.free_memory < MIN_FREE_MEMORY
+            || self
+                .sandbox_setup
+                .is_some_and(|setup| setup > MAX_SANDBOX_SETUP)
+        {
+            HealthStatus::Overloaded
+        } else {
+            HealthStatus::Healthy
+        }
+    }
+}
+
+impl std::fmt::Display for HealthStatus {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        match self {
+            HealthStatus::Healthy => write!(f, "healthy"),
+            HealthStatus::Overloaded => write!(f, "overloaded"),
+            HealthStatus::Unusable => write!(f, "unusable"),
+        }
+    }
+}
+
+impl HealthMonitor {
+    /// Make a monitor for the worker with the store and the sandboxes in these directories, that
+    /// reports the durations recorded by `overhead`.
+    pub(crate) fn new<P: Into<PathBuf>, Q: Into<PathBuf>>(
+        store_path: P,
+        sandbox_path: Q,
+        overhead: Arc<OverheadRecorder>,
+    ) -> HealthMonitor {
+        HealthMonitor {
+            store_path: store_path.into(),
+            sandbox_path: sandbox_path.into(),
+            sandbox_setup: Mutex::new(None),
+            overhead,
+        }
+    }
+
+    /// Record the time it took to prepare the sandboxes of a job.
+    pub(crate) fn record_sandbox_setup(&self, setup: Duration) {
+        let mut average = self.sandbox_setup.lock().unwrap();
+        *average = Some(match *average {
+            Some(average) => (average * SETUP_HISTORY_WEIGHT + setup) / (SETUP_HISTORY_WEIGHT + 1),
+            None => setup,
+        });
+    }
+
+    /// Measure the current health of the worker. What cannot be measured is reported as fine.
+    pub(crate) fn health(&self) -> WorkerHealth {
+        let cores = std::thread::available_parallelism().map_or(1, |cores| cores.get());
+        WorkerHealth {
+            load_percent: std::fs::read_to_string("/proc/loadavg")
+                .ok()
+                .and_then(|loadavg| parse_load_percent(&loadavg, cores))
+                .unwrap_or(0),
+            free_memory: std::fs::read_to_string("/proc/meminfo")
+                .ok()
+                .and_then(|meminfo| parse_free_memory(&meminfo))
+                .unwrap_or(u64::MAX),
+            store_free_space: free_space(&self.store_path),
+            sandbox_free_space: free_space(&self.sandbox_path),
+            sandbox_setup: *self.sandbox_setup.lock().unwrap(),
+            overhead: self.overhead.snapshot(),
+        }
+    }
+
+    /// Send the health of the worker to the server now, and then every `HEARTBEAT_INTERVAL` from
+    /// a new thread, until the returned sender is dropped.
+    ///
+    /// `send_lock` is held while sending, since the files are sent with many raw messages that
+    /// cannot be interleaved with other ones.
+    pub(crate) fn start_heartbeat(
+        self: Arc<Self>,
+        sender: ChannelSender<WorkerClientMessage>,
+        send_lock: Arc<Mutex<()>>,
+    ) -> Result<Sender<()>, Error> {
+        let send = move || {
+            let health = self.health();
+            let _lock = send_lock.lock().unwrap();
+            sender.send(WorkerClientMessage::Health(health))
+        };
+        send().context("Failed to send Health")?;
+        let (stop, stopped) = channel();
+        std::thread::Builder::new()
+            .name("Heartbeat".into())
+            .spawn(move || loop {
+                match stopped.recv_timeout(HEARTBEAT_INTERVAL) {
+                    Err(RecvTimeoutError::Timeout) => {
+                        if let Err(e) = send() {
+                            debug!("Failed to send the heartbeat, stopping: {e:?}");
+                            break;
+                        }
+                    }
+                    _ => break,
+                }
+            })
+            .context("Failed to spawn the heartbeat thread")?;
+        Ok(stop)
+    }
+}
+
+/// The free space in the filesystem of `path`, or `u64::MAX` if it cannot be measured.
+fn free_space(path: &Path) -> u64 {
+    match nix::sys::statvfs::statvfs(path) {
+        Ok(stat) => (stat.blocks_available() as u64).saturating_mul(stat.fragment_size() as u64),
+        Err(e) => {
+            debug!("Cannot measure the free space in {}: {e}", path.display());
+            u64::MAX
+        }
+    }
+}
+
+/// Parse the load of the last minute from the content of `/proc/loadavg`, in percent of `cores`.
+fn parse_load_percent(loadavg: &str, cores: usize) -> Option<u32> {
+    let load: f64 = loadavg.split_whitespace().next()?.parse().ok()?;
+    Some((load * 100.0 / cores.max(1) as f64).round() as u32)
+}
+
+/// Parse the available memory, in bytes, from the content of `/proc/meminfo`.
+fn parse_free_memory(meminfo: &str) -> Option<u64> {
+    let kib: u64 = meminfo
+        .lines()
+        .find_map(|line| line.strip_prefix("MemAvailable:"))?
+        .trim()
+        .trim_end_matches("kB")
+        .trim()
+        .parse()
+        .ok()?;
+    Some(kib * 1024)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn healthy() -> WorkerHealth {
+        WorkerHealth {
+            load_percent: 50,
+            free_memory: 8 << 30,
+            store_free_space: 100 << 30,
+            sandbox_free_space: 100 << 30,
+            sandbox_setup: Some(Duration::from_millis(10)),
+            overhead: Default::default(),
+        }
+    }
+
+    #[test]
+    fn test_health_status() {
+        assert_eq!(healthy().status(), HealthStatus::Healthy);
+        let loaded = WorkerHealth {
+            load_percent: 400,
+            ..healthy()
+        };
+        assert_eq!(loaded.status(), HealthStatus::Overloaded);
+        let slow = WorkerHealth {
+            sandbox_setup: Some(Duration::from_secs(5)),
+            ..healthy()
+        };
+        assert_eq!(slow.status(), HealthStatus::Overloaded);
+        // the full disk is worse than the load
+        let full = WorkerHealth {
+            sandbox_free_space: 10 << 20,
+            ..loaded
+        };
+        assert_eq!(full.status(), HealthStatus::Unusable);
+        assert!(HealthStatus::Healthy < HealthStatus::Overloaded);
+        assert!(HealthStatus::Overloaded < HealthStatus::Unusable);
+    }
+
+    #[test]
+    fn test_parse_proc() {
+        assert_eq!(
+            parse_load_percent("3.00 2.50 1.00 3/456 7890\n", 4),
+            Some(75)
+        );
+        assert_eq!(parse_load_percent("", 4), None);
+        let meminfo = "MemTotal:       16303420 kB\nMemFree:         1000000 kB\nMemAvailable:    2000000 kB\n";
+        assert_eq!(parse_free_memory(meminfo), Some(2000000 * 1024));
+        assert_eq!(parse_free_memory("MemTotal: 1 kB\n"), None);
+    }
+
+    #[test]
+    fn test_sandbox_setup_average() {
+        let tmpdir = tempfile::TempDir::new().unwrap();
+        let monitor = HealthMonitor::new(tmpdir.path(), tmpdir.path(), Default::default());
+        assert_eq!(monitor.health().sandbox_setup, None);
+        monitor.record_sandbox_setup(Duration::from_millis(100));
+        assert_eq!(
+            monitor.health().sandbox_setup,
+            Some(Duration::from_millis(100))
+        );
+        monitor.record_sandbox_setup(Duration::from_millis(500));
+        assert_eq!(
+            monitor.health().sandbox_setup,
+            Some(Duration::from_millis(200))
+        );
+        assert!(monitor.health().store_free_space > 0);
+    }
+}
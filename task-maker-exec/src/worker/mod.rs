@@ -1,11 +1,14 @@
-use std::collections::HashMap;
+use std::collections::{HashMap, HashSet, VecDeque};
 use std::fs::Permissions;
 use std::io::Read;
+use std::iter::once;
+use std::net::SocketAddr;
 use std::os::unix::fs::PermissionsExt;
-use std::path::{Path, PathBuf};
+use std::path::PathBuf;
 use std::sync::mpsc::{channel, Receiver, Sender};
 use std::sync::{Arc, Mutex};
 use std::thread::JoinHandle;
+use std::time::Instant;
 use std::{cmp, thread};
 
 use anyhow::{anyhow, bail, Context, Error};
@@ -15,12 +18,26 @@ use task_maker_store::*;
 use tempfile::TempDir;
 use uuid::Uuid;
 
+use crate::cpu_pinning::{pin_current_thread, CpuPinning};
+use crate::execution_unit::sandbox::FifoDir;
+use crate::execution_unit::sandbox_pool::SandboxPool;
 use crate::execution_unit::{ExecutionUnit, SandboxResult};
 use crate::executor::WorkerJob;
+use crate::overhead::OverheadPhase;
 use crate::proto::*;
 use crate::sandbox_runner::SandboxRunner;
+use crate::trace;
+use crate::worker::health::HealthMonitor;
+use crate::worker::output_stream::OutputStreamer;
 
+mod calibration;
 pub mod controller;
+mod health;
+mod output_stream;
+mod peer;
+
+pub use calibration::{calibrate, TimeNormalization};
+pub use health::{HealthStatus, WorkerHealth};
 
 /// The information about the current job the worker is doing.
 struct WorkerCurrentJob {
@@ -34,6 +51,26 @@ struct WorkerCurrentJob {
     server_asked_files: Option<Sender<Vec<FileUuid>>>,
     /// State of the controller if this is a controlled execution.
     controller_state: Option<controller::State>,
+    /// Jobs that will run after the current one, in order.
+    queued_jobs: VecDeque<QueuedJob>,
+    /// Whether the current job has been killed before it started. It is reported as killed
+    /// without running it.
+    current_killed: bool,
+    /// The files asked to the server for jobs that have been killed, that are still coming.
+    discarded_deps: HashSet<FileStoreKey>,
+}
+
+/// A job received while another one is still running. Its dependencies are fetched from the
+/// server while it waits.
+struct QueuedJob {
+    /// The job to run.
+    job: Box<WorkerJob>,
+    /// The dependencies already available.
+    handles: HashMap<FileUuid, FileStoreHandle>,
+    /// The dependencies that are still missing.
+    missing_deps: HashMap<FileStoreKey, Vec<FileUuid>>,
+    /// Whether the server killed this job before it started.
+    killed: bool,
 }
 
 /// The worker is the component that receives the work from the server and sends the results back.
@@ -52,12 +89,68 @@ pub struct Worker {
     file_store: Arc<FileStore>,
     /// Job the worker is currently working on.
     current_job: Arc<Mutex<WorkerCurrentJob>>,
-    /// Where to put the sandboxes.
-    sandbox_path: PathBuf,
+    /// The pool of the sandbox directories.
+    sandbox_pool: Arc<SandboxPool>,
+    /// The function that spawns an actual sandbox.
+    sandbox_runner: Arc<dyn SandboxRunner>,
+    /// The join handle of the currently running sandbox, if any. Shared with the threads that
+    /// fetch the files from the other workers, since they may start the job.
+    current_sandbox_thread: Arc<Mutex<Option<JoinHandle<()>>>>,
+    /// The number of jobs the worker asks for: the jobs after the first one wait for the current
+    /// one to complete, while their dependencies are fetched.
+    job_slots: usize,
+    /// The cores the sandboxes of this worker are pinned to, if any.
+    cpu_pinning: Option<Arc<CpuPinning>>,
+    /// How the outputs of the jobs are sent to the server.
+    output_settings: OutputSettings,
+    /// The port on which this worker serves its files to the other workers, if it does.
+    file_server_port: Option<u16>,
+    /// The key for the encrypted connections to the other workers, if they are encrypted.
+    peer_key: Option<[u8; 32]>,
+    /// Measures the health of the worker, reported to the server.
+    health: Arc<HealthMonitor>,
+}
+
+/// What is needed for starting the sandbox thread of the current job, also outside the main thread
+/// of the worker.
+#[derive(Clone)]
+struct JobStarter {
+    /// The job the worker is currently working on.
+    current_job: Arc<Mutex<WorkerCurrentJob>>,
+    /// The name of the worker.
+    name: String,
+    /// The channel that sends messages to the server.
+    sender: ChannelSender<WorkerClientMessage>,
+    /// The pool of the sandbox directories.
+    sandbox_pool: Arc<SandboxPool>,
     /// The function that spawns an actual sandbox.
     sandbox_runner: Arc<dyn SandboxRunner>,
+    /// The cores the sandboxes are pinned to, if any.
+    cpu_pinning: Option<Arc<CpuPinning>>,
+    /// How the outputs of the jobs are sent to the server.
+    output_settings: OutputSettings,
+    /// Measures the health of the worker.
+    health: Arc<HealthMonitor>,
     /// The join handle of the currently running sandbox, if any.
-    current_sandbox_thread: Option<JoinHandle<()>>,
+    sandbox_thread: Arc<Mutex<Option<JoinHandle<()>>>>,
+}
+
+/// How the worker reports the results and sends the outputs of its jobs to the server.
+#[derive(Debug, Clone, Default)]
+struct OutputSettings {
+    /// The encoding of the files exchanged with the server.
+    file_encoding: FileEncoding,
+    /// The outputs bigger than this number of bytes are sent while the execution is running.
+    stream_threshold: Option<u64>,
+    /// The file store, shared with the server, where to put the outputs directly instead of
+    /// sending them.
+    shared_store: Option<Arc<FileStore>>,
+    /// Held while a file is sent to the server, so that the messages sent by the other threads
+    /// (e.g. the heartbeats) don't end up in the middle of it.
+    send_lock: Arc<Mutex<()>>,
+    /// How the times measured by this worker are converted to the ones of the reference machine,
+    /// if they are.
+    time_normalization: Option<TimeNormalization>,
 }
 
 /// An handle of the connection to the worker.
@@ -70,6 +163,10 @@ pub struct WorkerConn {
     pub sender: ChannelSender<WorkerServerMessage>,
     /// The channel that receives messages from the server.
     pub receiver: ChannelReceiver<WorkerClientMessage>,
+    /// The encoding of the files sent to and from the worker.
+    pub file_encoding: FileEncoding,
+    /// The address the worker is connected from, if it's connected through the network.
+    pub addr: Option<SocketAddr>,
 }
 
 pub enum OutputFile {
@@ -94,6 +191,66 @@ impl WorkerCurrentJob {
             missing_deps: HashMap::new(),
             server_asked_files: None,
             controller_state: None,
+            queued_jobs: VecDeque::new(),
+            current_killed: false,
+            discarded_deps: HashSet::new(),
+        }
+    }
+
+    /// Whether a file has already been asked to the server for the current or a queued job.
+    fn is_file_asked(&self, key: &FileStoreKey) -> bool {
+        self.missing_deps.contains_key(key)
+            || self.discarded_deps.contains(key)
+            || self
+                .queued_jobs
+                .iter()
+                .any(|job| job.missing_deps.contains_key(key))
+    }
+
+    /// Give a file sent by the server to all the jobs waiting for it. Returns whether the current
+    /// job has now all its dependencies.
+    fn provide_file(
+        &mut self,
+        key: &FileStoreKey,
+        handle: &FileStoreHandle,
+    ) -> Result<bool, Error> {
+        let mut required = self.discarded_deps.remove(key);
+        let mut current_ready = false;
+        if let Some(uuids) = self.missing_deps.remove(key) {
+            required = true;
+            let handles = &mut self
+                .current_job
+                .as_mut()
+                .ok_or_else(|| anyhow!("Received file while doing nothing"))?
+                .1;
+            for uuid in uuids {
+                handles.insert(uuid, handle.clone());
+            }
+            current_ready = self.missing_deps.is_empty();
+        }
+        for job in &mut self.queued_jobs {
+            if let Some(uuids) = job.missing_deps.remove(key) {
+                required = true;
+                for uuid in uuids {
+                    job.handles.insert(uuid, handle.clone());
+                }
+            }
+        }
+        if !required {
+            bail!("Server sent a not required dependency");
+        }
+        Ok(current_ready)
+    }
+
+    /// Mark as killed the queued jobs of the group `uuid`. They still have to be reported to the
+    /// server in order, but they are not run and their missing dependencies are not waited for.
+    fn kill_queued_job(&mut self, uuid: ExecutionGroupUuid) {
+        for job in &mut self.queued_jobs {
+            if job.job.group.uuid == uuid && !job.killed {
+                job.killed = true;
+                self.discarded_deps
+                    .extend(job.missing_deps.drain().map(|(key, _)| key));
+            }
         }
     }
 }
@@ -131,6 +288,8 @@ impl Worker {
                 name,
                 sender: tx,
                 receiver: rx,
+                file_encoding: FileEncoding::Plain,
+                addr: None,
             },
         ))
     }
@@ -144,10 +303,15 @@ impl Worker {
         receiver: ChannelReceiver<WorkerServerMessage>,
         sandbox_runner: Arc<dyn SandboxRunner>,
     ) -> Result<Worker, Error> {
-        let sandbox_path = sandbox_path.into();
-        check_sandbox_is_supported(&sandbox_path, sandbox_runner.clone())?;
+        let sandbox_pool = Arc::new(SandboxPool::new(sandbox_path)?);
+        check_sandbox_is_supported(&sandbox_pool, sandbox_runner.clone())?;
         let uuid = Uuid::new_v4();
         let name = name.into();
+        let health = Arc::new(HealthMonitor::new(
+            file_store.base_path(),
+            sandbox_pool.path(),
+            sandbox_pool.overhead().clone(),
+        ));
         Ok(Worker {
             uuid,
             name,
@@ -155,30 +319,163 @@ impl Worker {
             receiver,
             file_store,
             current_job: Arc::new(Mutex::new(WorkerCurrentJob::new())),
-            sandbox_path,
+            sandbox_pool,
             sandbox_runner,
-            current_sandbox_thread: None,
+            current_sandbox_thread: Default::default(),
+            job_slots: 1,
+            cpu_pinning: None,
+            output_settings: OutputSettings::default(),
+            file_server_port: None,
+            peer_key: None,
+            health,
         })
     }
 
+    /// Set the number of jobs the worker asks for at the same time. With more than one slot, the
+    /// worker receives its next jobs while the current one is running, and fetches their
+    /// dependencies in the meantime.
+    pub fn set_job_slots(&mut self, job_slots: usize) {
+        self.job_slots = job_slots.max(1);
+    }
+
+    /// Pin the sandboxes of this worker to the cores of the machine, running the timed executions
+    /// on the reserved cores.
+    pub fn set_cpu_pinning(&mut self, cpu_pinning: Arc<CpuPinning>) {
+        self.cpu_pinning = Some(cpu_pinning);
+    }
+
+    /// Put the sandboxes of this worker inside `path`, that should be on a tmpfs, as long as the
+    /// sum of their inputs and declared outputs doesn't exceed `budget` bytes. The other sandboxes
+    /// stay on disk.
+    pub fn set_sandbox_tmpfs<P: Into<PathBuf>>(
+        &mut self,
+        path: P,
+        budget: u64,
+    ) -> Result<(), Error> {
+        Arc::get_mut(&mut self.sandbox_pool)
+            .context("The sandboxes of the worker are already in use")?
+            .set_tmpfs(path, budget)
+    }
+
+    /// Send the output files bigger than `threshold` bytes while the execution is still running,
+    /// instead of after it. This is useful when the server is remote, since the executions that
+    /// depend on big outputs don't have to wait for the whole transfer after the execution.
+    pub fn set_stream_outputs(&mut self, threshold: u64) {
+        self.output_settings.stream_threshold = Some(threshold);
+    }
+
+    /// Normalize the times measured by this worker to the ones of the reference machine, see
+    /// [`TimeNormalization`].
+    pub fn set_time_normalization(&mut self, time_normalization: TimeNormalization) {
+        self.output_settings.time_normalization = Some(time_normalization);
+    }
+
+    /// Set the encoding of the files exchanged with the server, as agreed when connecting to it.
+    pub fn set_file_encoding(&mut self, file_encoding: FileEncoding) {
+        self.output_settings.file_encoding = file_encoding;
+    }
+
+    /// Set the key of the connections with the other workers, that fetch the files from each
+    /// other, if they are encrypted. This should be called before `serve_files`.
+    pub fn set_peer_key(&mut self, enc_key: Option<[u8; 32]>) {
+        self.peer_key = enc_key;
+    }
+
+    /// Serve the files of the store of this worker to the other workers, listening at `bind_addr`.
+    /// The server then tells the other workers to fetch from this worker the files it has, instead
+    /// of sending them itself.
+    pub fn serve_files(&mut self, bind_addr: String) -> Result<(), Error> {
+        let port = peer::serve_files(bind_addr, self.peer_key, self.file_store.clone())?;
+        info!("Serving the files to the other workers on port {port}");
+        self.file_server_port = Some(port);
+        Ok(())
+    }
+
+    /// Tell the worker that the server runs in the same process, and uses the same file store of
+    /// the worker. The outputs are then stored directly in the store, without sending their
+    /// content through the channel.
+    pub fn set_local_server(&mut self, local_server: bool) {
+        self.output_settings.shared_store = local_server.then(|| self.file_store.clone());
+    }
+
+    /// What is needed for starting the current job from another thread.
+    fn job_starter(&self) -> JobStarter {
+        JobStarter {
+            current_job: self.current_job.clone(),
+            name: self.name.clone(),
+            sender: self.sender.clone(),
+            sandbox_pool: self.sandbox_pool.clone(),
+            sandbox_runner: self.sandbox_runner.clone(),
+            cpu_pinning: self.cpu_pinning.clone(),
+            output_settings: self.output_settings.clone(),
+            health: self.health.clone(),
+            sandbox_thread: self.current_sandbox_thread.clone(),
+        }
+    }
+
     /// Start the sandbox thread for the current job.
     fn start_job(&mut self) -> Result<(), Error> {
-        self.current_sandbox_thread = Some(execute_job(
-            self.current_job.clone(),
-            &self.sender,
-            &self.sandbox_path,
-            self.sandbox_runner.clone(),
-        )?);
-        Ok(())
+        self.job_starter().start_job()
     }
 
     /// Wait for the sandbox thread to exit.
     fn wait_sandbox(&mut self) -> Result<(), Error> {
-        if let Some(join_handle) = self.current_sandbox_thread.take() {
-            join_handle
-                .join()
-                .map_err(|e| anyhow!("Sandbox thread panicked: {:?}", e))
-                .context("Sandbox thread failed")?;
+        let join_handle = self.current_sandbox_thread.lock().unwrap().take();
+        wait_sandbox_thread(join_handle)
+    }
+
+    /// Fetch in a thread the files from the worker at `addr`, giving them to the jobs waiting for
+    /// them, and asking the server for the ones that are not received. The main thread keeps
+    /// receiving the messages of the server meanwhile.
+    fn spawn_fetch_files(&self, addr: String, keys: Vec<FileStoreKey>) -> Result<(), Error> {
+        let starter = self.job_starter();
+        let peer_key = self.peer_key;
+        let file_store = self.file_store.clone();
+        thread::Builder::new()
+            .name(format!("Fetch files from {addr}"))
+            .spawn(move || {
+                let start = Instant::now();
+                let (received, missing) = peer::fetch_files(
+                    &addr,
+                    peer_key,
+                    keys,
+                    starter.output_settings.file_encoding,
+                    &file_store,
+                );
+                trace::span(
+                    &format!("{} (files)", starter.name),
+                    "fetch files",
+                    None,
+                    start,
+                    Instant::now(),
+                );
+                if let Err(e) = starter.provide_fetched_files(received, missing) {
+                    error!("Failed to use the files fetched from {addr}: {e:?}");
+                }
+            })
+            .context("Failed to spawn the thread fetching the files")?;
+        Ok(())
+    }
+
+    /// Make the first queued job the current one, starting it if all its dependencies are ready.
+    /// Nothing is done if the worker is still busy.
+    fn start_queued_job(&mut self) -> Result<(), Error> {
+        let job_ready = {
+            let mut current_job = self.current_job.lock().unwrap();
+            if current_job.current_job.is_some() {
+                return Ok(());
+            }
+            let next = match current_job.queued_jobs.pop_front() {
+                Some(next) => next,
+                None => return Ok(()),
+            };
+            current_job.missing_deps = next.missing_deps;
+            current_job.current_job = Some((next.job, next.handles));
+            current_job.current_killed = next.killed;
+            current_job.missing_deps.is_empty()
+        };
+        if job_ready {
+            self.start_job()?;
         }
         Ok(())
     }
@@ -187,18 +484,30 @@ impl Worker {
     #[allow(clippy::cognitive_complexity)]
     pub fn work(mut self) -> Result<(), Error> {
         trace!("Worker {self} ready, asking for work");
-        self.sender
-            .send(WorkerClientMessage::GetWork)
-            .context("Failed to send GetWork")?;
+        if let Some(port) = self.file_server_port {
+            self.sender
+                .send(WorkerClientMessage::ServeFiles(port))
+                .context("Failed to send ServeFiles")?;
+        }
+        for _ in 0..self.job_slots {
+            self.sender
+                .send(WorkerClientMessage::GetWork)
+                .context("Failed to send GetWork")?;
+        }
+        // stops the heartbeats when the worker exits
+        let _heartbeat = self
+            .health
+            .clone()
+            .start_heartbeat(self.sender.clone(), self.output_settings.send_lock.clone())?;
 
         loop {
             match self.receiver.recv() {
                 Ok(WorkerServerMessage::Work(job)) => {
                     trace!("Worker {self} got job: {job:?}");
-                    assert!(self.current_job.lock().unwrap().current_job.is_none());
-                    self.wait_sandbox()?;
+                    let mut current_job = self.current_job.lock().unwrap();
                     let mut missing_deps: HashMap<FileStoreKey, Vec<FileUuid>> = HashMap::new();
                     let mut handles = HashMap::new();
+                    let mut asked_files = Vec::new();
                     for input in &job.group.dependencies() {
                         let key = job
                             .dep_keys
@@ -207,10 +516,10 @@ impl Worker {
                         match self.file_store.get(key) {
                             None => {
                                 // ask the file only once
-                                if !missing_deps.contains_key(key) {
-                                    self.sender
-                                        .send(WorkerClientMessage::AskFile(key.clone()))
-                                        .context("Failed to send AskFile to server")?;
+                                if !missing_deps.contains_key(key)
+                                    && !current_job.is_file_asked(key)
+                                {
+                                    asked_files.push(key.clone());
                                 }
                                 missing_deps.entry(key.clone()).or_default().push(*input);
                             }
@@ -219,48 +528,72 @@ impl Worker {
                             }
                         }
                     }
-                    let job_ready = missing_deps.is_empty();
-                    {
-                        let mut current_job = self.current_job.lock().unwrap();
-                        current_job.missing_deps = missing_deps;
-                        current_job.current_job = Some((job, handles));
+                    // a single message for all the files, so that the server sends them one after
+                    // the other
+                    if !asked_files.is_empty() {
+                        let _lock = self.output_settings.send_lock.lock().unwrap();
+                        self.sender
+                            .send(WorkerClientMessage::AskFiles(asked_files))
+                            .context("Failed to send AskFiles to server")?;
+                    }
+                    if current_job.current_job.is_some() {
+                        // the job will start after the current one, meanwhile its dependencies
+                        // are being fetched
+                        trace!("Worker {} queued job {}", self.uuid, job.group.uuid);
+                        current_job.queued_jobs.push_back(QueuedJob {
+                            job,
+                            handles,
+                            missing_deps,
+                            killed: false,
+                        });
+                        continue;
                     }
+                    let job_ready = missing_deps.is_empty();
+                    current_job.missing_deps = missing_deps;
+                    current_job.current_job = Some((job, handles));
+                    drop(current_job);
                     if job_ready {
                         self.start_job()?;
                     }
                 }
                 Ok(WorkerServerMessage::ProvideFile(key)) => {
                     info!("Server sent file {key:?}");
-                    let reader = ChannelFileIterator::new(&self.receiver);
+                    let start = Instant::now();
+                    let reader = ChannelFileIterator::with_encoding(
+                        &self.receiver,
+                        self.output_settings.file_encoding,
+                    );
                     let handle = self
                         .file_store
                         .store(&key, reader)
                         .with_context(|| format!("Failed to store server-provided file {key}"))?;
-                    let should_start = {
-                        let mut job = self.current_job.lock().unwrap();
-                        let uuids = job
-                            .missing_deps
-                            .remove(&key)
-                            .ok_or_else(|| anyhow!("Server sent a not required dependency"))?;
-                        for uuid in uuids {
-                            job.current_job
-                                .as_mut()
-                                .ok_or_else(|| anyhow!("Received file while doing nothing"))?
-                                .1
-                                .insert(uuid, handle.clone());
-                        }
-                        job.missing_deps.is_empty()
-                    };
+                    trace::span(
+                        &format!("{} (files)", self.name),
+                        "receive file",
+                        None,
+                        start,
+                        Instant::now(),
+                    );
+                    let should_start = self
+                        .current_job
+                        .lock()
+                        .unwrap()
+                        .provide_file(&key, &handle)?;
                     if should_start {
                         self.start_job()?;
                     }
                 }
+                Ok(WorkerServerMessage::FetchFiles(addr, keys)) => {
+                    info!("Fetching {} files from the worker at {addr}", keys.len());
+                    self.spawn_fetch_files(addr, keys)?;
+                }
                 Ok(WorkerServerMessage::Exit) => {
                     info!("Worker {} ({}) is asked to exit", self.name, self.uuid);
                     break;
                 }
                 Ok(WorkerServerMessage::KillJob(job)) => {
-                    let current_job = self.current_job.lock().unwrap();
+                    let mut current_job = self.current_job.lock().unwrap();
+                    current_job.kill_queued_job(job);
                     if let Some((worker_job, _)) = current_job.current_job.as_ref() {
                         // check that the job is the same
                         if worker_job.group.uuid == job {
@@ -274,11 +607,14 @@ impl Worker {
                     }
                 }
                 Ok(WorkerServerMessage::AskFiles(files)) => {
-                    let mut current_job = self.current_job.lock().unwrap();
-                    if let Some(sender) = current_job.server_asked_files.take() {
+                    let sender = self.current_job.lock().unwrap().server_asked_files.take();
+                    if let Some(sender) = sender {
                         if let Err(e) = sender.send(files) {
                             error!("Cannot send the list of files from the server to the worker manager: {e:?}");
                         }
+                        // the current job is completing, after that the next one can start
+                        self.wait_sandbox()?;
+                        self.start_queued_job()?;
                     } else {
                         error!("Unexpected WorkerServerMessage::AskFiles");
                     }
@@ -311,30 +647,95 @@ impl Worker {
     }
 }
 
+impl JobStarter {
+    /// Start the sandbox thread for the current job, after the previous one exited.
+    fn start_job(&self) -> Result<(), Error> {
+        // held until the new thread is spawned, so that two jobs don't start at the same time
+        let mut sandbox_thread = self.sandbox_thread.lock().unwrap();
+        wait_sandbox_thread(sandbox_thread.take())?;
+        *sandbox_thread = Some(execute_job(
+            self.current_job.clone(),
+            &self.name,
+            &self.sender,
+            &self.sandbox_pool,
+            self.sandbox_runner.clone(),
+            self.cpu_pinning.clone(),
+            self.output_settings.clone(),
+            &self.health,
+        )?);
+        Ok(())
+    }
+
+    /// Give the files fetched from another worker to the jobs waiting for them, starting the
+    /// current job if it was waiting only for them. The server is asked for the missing ones: it
+    /// sends them itself the second time.
+    fn provide_fetched_files(
+        &self,
+        received: Vec<(FileStoreKey, FileStoreHandle)>,
+        missing: Vec<FileStoreKey>,
+    ) -> Result<(), Error> {
+        if !missing.is_empty() {
+            let _lock = self.output_settings.send_lock.lock().unwrap();
+            self.sender
+                .send(WorkerClientMessage::AskFiles(missing))
+                .context("Failed to send AskFiles to server")?;
+        }
+        for (key, handle) in received {
+            let should_start = self
+                .current_job
+                .lock()
+                .unwrap()
+                .provide_file(&key, &handle)?;
+            if should_start {
+                self.start_job()?;
+            }
+        }
+        Ok(())
+    }
+}
+
+/// Wait for the sandbox thread to exit, if there is one.
+fn wait_sandbox_thread(join_handle: Option<JoinHandle<()>>) -> Result<(), Error> {
+    if let Some(join_handle) = join_handle {
+        join_handle
+            .join()
+            .map_err(|e| anyhow!("Sandbox thread panicked: {:?}", e))
+            .context("Sandbox thread failed")?;
+    }
+    Ok(())
+}
+
 fn finalize_job(
     current_job: Arc<Mutex<WorkerCurrentJob>>,
     server_asked_files_receiver: Receiver<Vec<FileUuid>>,
     outputs: HashMap<FileUuid, FileStoreKey>,
     output_paths: HashMap<FileUuid, OutputFile>,
     sender: &ChannelSender<WorkerClientMessage>,
+    output_settings: &OutputSettings,
     fifo_dir: Option<TempDir>,
 ) -> Result<(), Error> {
+    let file_encoding = output_settings.file_encoding;
     // wait for the list of files to send
     match server_asked_files_receiver.recv() {
         Ok(missing_files) => {
             for uuid in missing_files {
                 if let Some(key) = outputs.get(&uuid) {
+                    let _lock = output_settings.send_lock.lock().unwrap();
                     sender
                         .send(WorkerClientMessage::ProvideFile(uuid, key.clone()))
                         .context("Failed to send ProvideFile")?;
                     match &output_paths[&uuid] {
                         OutputFile::OnDisk(path) => {
-                            ChannelFileSender::send(path, sender)
+                            ChannelFileSender::send_with_encoding(path, sender, file_encoding)
                                 .context("Failed to send missing file")?;
                         }
                         OutputFile::InMemory(content) => {
-                            ChannelFileSender::send_data(content.clone(), sender)
-                                .context("Failed to sent in-memory file")?;
+                            ChannelFileSender::send_data_with_encoding(
+                                content.clone(),
+                                sender,
+                                file_encoding,
+                            )
+                            .context("Failed to sent in-memory file")?;
                         }
                     }
                 } else {
@@ -369,9 +770,13 @@ fn finalize_job(
 /// Spawn a new thread that will start the sandbox and will send the results back to the server.
 fn execute_job(
     current_job: Arc<Mutex<WorkerCurrentJob>>,
+    worker_name: &str,
     sender: &ChannelSender<WorkerClientMessage>,
-    sandbox_path: &Path,
+    sandbox_pool: &Arc<SandboxPool>,
     runner: Arc<dyn SandboxRunner>,
+    cpu_pinning: Option<Arc<CpuPinning>>,
+    output_settings: OutputSettings,
+    health: &HealthMonitor,
 ) -> Result<JoinHandle<()>, Error> {
     let controller_settings = current_job
         .lock()
@@ -382,16 +787,21 @@ fn execute_job(
         .0
         .group
         .controller_settings;
+    if current_job.lock().unwrap().current_killed {
+        return skip_killed_job(current_job, sender, output_settings);
+    }
     if let Some(settings) = controller_settings {
         return controller::execute_controlled_job(
             settings,
             current_job,
             sender,
-            sandbox_path,
+            sandbox_pool,
             runner,
+            output_settings,
         );
     }
 
+    let setup_start = Instant::now();
     let (job, sandboxes, fifo_dir, server_asked_files) = {
         let mut current_job = current_job.lock().unwrap();
         let job = current_job
@@ -400,13 +810,13 @@ fn execute_job(
             .ok_or_else(|| anyhow!("Worker job is gone"))?;
         let mut boxes = Vec::new();
         let group = &job.0.group;
-        let fifo_dir = if group.fifo.is_empty() {
+        let fifo_dir = if group.fifo.is_empty() && group.shared_memory.is_empty() {
             None
         } else {
-            let fifo_dir = TempDir::new_in(sandbox_path).with_context(|| {
+            let fifo_dir = TempDir::new_in(sandbox_pool.path()).with_context(|| {
                 format!(
                     "Failed to create temporary directory in {}",
-                    sandbox_path.display()
+                    sandbox_pool.path().display()
                 )
             })?;
             for fifo in &group.fifo {
@@ -416,16 +826,36 @@ fn execute_job(
                 nix::unistd::mkfifo(&path, nix::sys::stat::Mode::S_IRWXU)
                     .with_context(|| format!("Failed to create FIFO at {}", path.display()))?;
             }
+            for shm in &group.shared_memory {
+                let path = fifo_dir
+                    .path()
+                    .join(shm.sandbox_path().file_name().unwrap());
+                std::fs::File::create(&path)
+                    .and_then(|file| file.set_len(shm.size))
+                    .with_context(|| {
+                        format!("Failed to create shared memory at {}", path.display())
+                    })?;
+            }
             Some(fifo_dir)
         };
         let keep_sandboxes = group.config.keep_sandboxes;
+        // the executions of a group run together: one of them cannot be run again alone on disk
+        // if it fails after filling the tmpfs
+        let new_unit = if group.executions.len() == 1 {
+            ExecutionUnit::new
+        } else {
+            ExecutionUnit::new_on_disk
+        };
         for exec in &group.executions {
-            let mut sandbox = ExecutionUnit::new(
-                sandbox_path,
-                exec,
-                &job.1,
-                fifo_dir.as_ref().map(|d| d.path().to_owned()),
-            )?;
+            let mut exec = exec.clone();
+            if let Some(normalization) = &output_settings.time_normalization {
+                normalization.scale_limits(&mut exec);
+            }
+            let fifo_dir = fifo_dir.as_ref().map(|dir| FifoDir {
+                path: dir.path().to_owned(),
+                shared_memory: !group.shared_memory.is_empty(),
+            });
+            let mut sandbox = new_unit(sandbox_pool, &exec, &job.1, fifo_dir)?;
             if keep_sandboxes {
                 sandbox.keep();
             }
@@ -437,18 +867,32 @@ fn execute_job(
         current_job.server_asked_files = Some(sender);
         (job, boxes, fifo_dir, receiver)
     };
+    trace::span(
+        worker_name,
+        "setup",
+        Some((job.group.uuid, &job.group.description)),
+        setup_start,
+        Instant::now(),
+    );
+    health.record_sandbox_setup(setup_start.elapsed());
     let sender = sender.clone();
     let description = job.group.description.clone();
+    let worker_name = worker_name.to_string();
+    let sandbox_pool = sandbox_pool.clone();
     let join_handle = std::thread::Builder::new()
         .name(format!("Sandbox group manager for {description}"))
         .spawn(move || {
             sandbox_group_manager(
                 current_job,
+                &worker_name,
                 *job,
                 sender,
                 server_asked_files,
                 sandboxes,
+                &sandbox_pool,
                 runner,
+                cpu_pinning,
+                output_settings,
                 fifo_dir,
             )
             .with_context(|| format!("Sandbox group for {description} failed"))
@@ -458,6 +902,71 @@ fn execute_job(
     Ok(join_handle)
 }
 
+/// Spawn a new thread that reports the current job, killed before it started, to the server
+/// without running it. The server still expects its results, in the order of the jobs.
+fn skip_killed_job(
+    current_job: Arc<Mutex<WorkerCurrentJob>>,
+    sender: &ChannelSender<WorkerClientMessage>,
+    output_settings: OutputSettings,
+) -> Result<JoinHandle<()>, Error> {
+    let (group, server_asked_files) = {
+        let mut current_job = current_job.lock().unwrap();
+        current_job.current_killed = false;
+        let group = current_job
+            .current_job
+            .as_ref()
+            .ok_or_else(|| anyhow!("Worker job is gone"))?
+            .0
+            .group
+            .clone();
+        let (sender, receiver) = channel();
+        current_job.server_asked_files = Some(sender);
+        (group, receiver)
+    };
+    let sender = sender.clone();
+    let join_handle = std::thread::Builder::new()
+        .name(format!("Skip killed job {}", group.description))
+        .spawn(move || {
+            let results = group
+                .executions
+                .iter()
+                .map(|_| ExecutionResult {
+                    status: ExecutionStatus::Signal(9, "Killed before starting".into()),
+                    was_killed: true,
+                    was_cached: false,
+                    resources: ExecutionResourcesUsage::default(),
+                    stdout: None,
+                    stderr: None,
+                    timing: None,
+                })
+                .collect();
+            // the job has no outputs: if the server cannot be told, just forget the job like
+            // finalize_job does when the server goes away
+            if let Err(e) = sender.send(WorkerClientMessage::WorkerDone(results, HashMap::new())) {
+                error!(
+                    "Cannot send the results of the killed job {}: {e:?}",
+                    group.description
+                );
+                let mut job = current_job.lock().unwrap();
+                job.current_job = None;
+                job.current_sandboxes = None;
+                return;
+            }
+            if let Err(e) = finalize_job(
+                current_job,
+                server_asked_files,
+                HashMap::new(),
+                HashMap::new(),
+                &sender,
+                &output_settings,
+                None,
+            ) {
+                error!("Skipping killed job {} failed: {e:?}", group.description);
+            }
+        })?;
+    Ok(join_handle)
+}
+
 /// The sandbox group manager spawns the threads of the sandbox of all the executions in the group.
 /// Then waits for their outcome and eventually stops the sandboxes if a process fails. When all the
 /// sandboxes complete, this manager collects their results and send them back to the server.
@@ -466,14 +975,37 @@ fn execute_job(
 /// be dropped before all the sandboxes end.
 fn sandbox_group_manager(
     current_job: Arc<Mutex<WorkerCurrentJob>>,
+    worker_name: &str,
     job: WorkerJob,
     sender: ChannelSender<WorkerClientMessage>,
     server_asked_files_receiver: Receiver<Vec<FileUuid>>,
     mut sandboxes: Vec<ExecutionUnit>,
+    sandbox_pool: &SandboxPool,
     runner: Arc<dyn SandboxRunner>,
+    cpu_pinning: Option<Arc<CpuPinning>>,
+    output_settings: OutputSettings,
     fifo_dir: Option<TempDir>,
 ) -> Result<(), Error> {
     assert_eq!(sandboxes.len(), job.group.executions.len());
+    let run_start = Instant::now();
+    let streamer = match output_settings.stream_threshold {
+        Some(threshold) => Some(OutputStreamer::start(
+            streamed_outputs(&job.group.executions, &sandboxes),
+            threshold,
+            sender.clone(),
+        )?),
+        None => None,
+    };
+    // this may wait for the reserved cores to be free
+    let timing_cores = cpu_pinning
+        .as_ref()
+        .and_then(|pinning| pinning.cores_for(&job.group));
+    let cores_of = |index: usize| {
+        cpu_pinning
+            .as_ref()
+            .map(|pinning| pinning.cores(timing_cores.as_ref(), index))
+    };
+    let overhead = sandbox_pool.overhead();
     let mut results = vec![None; job.group.executions.len()];
     let mut outputs = HashMap::new();
     let mut output_paths = HashMap::new();
@@ -482,6 +1014,7 @@ fn sandbox_group_manager(
     // then join from here
     if job.group.executions.len() == 1 {
         let mut sandbox = sandboxes.pop().unwrap();
+        pin_sandbox_thread(cores_of(0));
         let result = match sandbox.run(runner.as_ref(), &job.group.config) {
             Ok(res) => res,
             Err(e) => SandboxResult::Failed {
@@ -489,14 +1022,49 @@ fn sandbox_group_manager(
             },
         };
         let exec = &job.group.executions[0];
-        let mut result = compute_execution_result(exec, result, &sandbox);
-        get_result_outputs(
-            exec,
-            &sandbox,
-            &mut outputs,
-            &mut output_paths,
-            &mut result.status,
-        );
+        let mut result = overhead.time(OverheadPhase::Result, || {
+            compute_execution_result(
+                exec,
+                result,
+                &sandbox,
+                output_settings.time_normalization.as_ref(),
+            )
+        });
+        if !result.status.is_success() && sandbox.exceeded_tmpfs_reservation() {
+            // the failure may be caused by the tmpfs being full
+            (result, sandbox) = rerun_on_disk(
+                &current_job,
+                exec,
+                &job.group.config,
+                sandbox_pool,
+                runner.as_ref(),
+                output_settings.time_normalization.as_ref(),
+            )?;
+        }
+        if job
+            .group
+            .config
+            .needs_timing_reruns(&job.group, std::slice::from_ref(&result))
+        {
+            (result, sandbox) = rerun_near_time_limit(
+                &current_job,
+                exec,
+                (result, sandbox),
+                &job.group.config,
+                sandbox_pool,
+                runner.as_ref(),
+                output_settings.time_normalization.as_ref(),
+            )?;
+        }
+        overhead.time(OverheadPhase::Outputs, || {
+            get_result_outputs(
+                exec,
+                &sandbox,
+                &mut outputs,
+                &mut output_paths,
+                &mut result.status,
+            )
+        });
 
         results[0] = Some(result);
     // this is the complex case: more than an execution (therefore more than a sandbox)
@@ -516,6 +1084,7 @@ fn sandbox_group_manager(
                     index,
                     group_sender.clone(),
                     job.group.config.clone(),
+                    cores_of(index),
                 )
                 .context("Failed to spawn sandbox thread")?,
             );
@@ -529,7 +1098,14 @@ fn sandbox_group_manager(
                     let exec = &job.group.executions[index];
                     let sandbox = &sandboxes[index];
 
-                    let mut result = compute_execution_result(exec, result, sandbox);
+                    let mut result = overhead.time(OverheadPhase::Result, || {
+                        compute_execution_result(
+                            exec,
+                            result,
+                            sandbox,
+                            output_settings.time_normalization.as_ref(),
+                        )
+                    });
                     // if the process didn't exit successfully, kill the remaining sandboxes
                     if !result.status.is_success() {
                         for (i, (res, sandbox)) in results.iter().zip(sandboxes.iter()).enumerate()
@@ -541,13 +1117,15 @@ fn sandbox_group_manager(
                         }
                     }
 
-                    get_result_outputs(
-                        exec,
-                        sandbox,
-                        &mut outputs,
-                        &mut output_paths,
-                        &mut result.status,
-                    );
+                    overhead.time(OverheadPhase::Outputs, || {
+                        get_result_outputs(
+                            exec,
+                            sandbox,
+                            &mut outputs,
+                            &mut output_paths,
+                            &mut result.status,
+                        )
+                    });
 
                     results[index] = Some(result);
                     missing -= 1;
@@ -562,6 +1140,20 @@ fn sandbox_group_manager(
                 .context("Sandbox thread failed")?;
         }
     }
+    // the executions are done, the other groups can use the reserved cores
+    drop(timing_cores);
+    // the chunks must be sent before WorkerDone
+    if let Some(streamer) = streamer {
+        streamer.finish()?;
+    }
+    let group = Some((job.group.uuid, job.group.description.as_str()));
+    let finalize_start = Instant::now();
+    trace::span(worker_name, "run", group, run_start, finalize_start);
+    // the handles keep the files in the store until the server has seen them
+    let stored_outputs = output_settings
+        .shared_store
+        .as_ref()
+        .map(|store| store_outputs(store, &outputs, &output_paths));
     // tell the server the results and the list of produced files
     sender
         .send(WorkerClientMessage::WorkerDone(
@@ -576,8 +1168,166 @@ fn sandbox_group_manager(
         outputs,
         output_paths,
         &sender,
+        &output_settings,
         fifo_dir,
-    )
+    )?;
+    drop(stored_outputs);
+    trace::span(
+        worker_name,
+        "send outputs",
+        group,
+        finalize_start,
+        Instant::now(),
+    );
+    Ok(())
+}
+
+/// Run again on disk the execution that failed in a sandbox on the tmpfs, after writing more than
+/// the sandbox reserved on it.
+fn rerun_on_disk(
+    current_job: &Mutex<WorkerCurrentJob>,
+    execution: &Execution,
+    config: &ExecutionDAGConfig,
+    sandbox_pool: &SandboxPool,
+    runner: &dyn SandboxRunner,
+    time_normalization: Option<&TimeNormalization>,
+) -> Result<(ExecutionResult, ExecutionUnit), Error> {
+    let dep_handles = current_job
+        .lock()
+        .unwrap()
+        .current_job
+        .as_ref()
+        .map(|job| job.1.clone())
+        .ok_or_else(|| anyhow!("Worker job is gone"))?;
+    debug!(
+        "Execution {} failed after filling its tmpfs reservation, running it on disk",
+        execution.description
+    );
+    let mut sandboxed = execution.clone();
+    if let Some(normalization) = time_normalization {
+        normalization.scale_limits(&mut sandboxed);
+    }
+    let mut sandbox = ExecutionUnit::new_on_disk(sandbox_pool, &sandboxed, &dep_handles, None)?;
+    if config.keep_sandboxes {
+        sandbox.keep();
+    }
+    let result = match sandbox.run(runner, config) {
+        Ok(res) => res,
+        Err(e) => SandboxResult::Failed {
+            error: e.to_string(),
+        },
+    };
+    let result = sandbox_pool.overhead().time(OverheadPhase::Result, || {
+        compute_execution_result(execution, result, &sandbox, time_normalization)
+    });
+    Ok((result, sandbox))
+}
+
+/// Run again the execution, whose CPU time in the `first` run was close to its limit, for
+/// `config.timing_reruns` more times, each in a new sandbox. Returns the run with the median CPU
+/// time, with the statistics of all the runs in its result.
+fn rerun_near_time_limit(
+    current_job: &Mutex<WorkerCurrentJob>,
+    execution: &Execution,
+    first: (ExecutionResult, ExecutionUnit),
+    config: &ExecutionDAGConfig,
+    sandbox_pool: &SandboxPool,
+    runner: &dyn SandboxRunner,
+    time_normalization: Option<&TimeNormalization>,
+) -> Result<(ExecutionResult, ExecutionUnit), Error> {
+    let dep_handles = current_job
+        .lock()
+        .unwrap()
+        .current_job
+        .as_ref()
+        .map(|job| job.1.clone())
+        .ok_or_else(|| anyhow!("Worker job is gone"))?;
+    let mut sandboxed = execution.clone();
+    if let Some(normalization) = time_normalization {
+        normalization.scale_limits(&mut sandboxed);
+    }
+    let mut runs = vec![first];
+    for _ in 0..config.timing_reruns {
+        let mut sandbox = ExecutionUnit::new(sandbox_pool, &sandboxed, &dep_handles, None)?;
+        if config.keep_sandboxes {
+            sandbox.keep();
+        }
+        let result = match sandbox.run(runner, config) {
+            Ok(res) => res,
+            Err(e) => SandboxResult::Failed {
+                error: e.to_string(),
+            },
+        };
+        let result = sandbox_pool.overhead().time(OverheadPhase::Result, || {
+            compute_execution_result(execution, result, &sandbox, time_normalization)
+        });
+        runs.push((result, sandbox));
+    }
+    runs.sort_by(|(a, _), (b, _)| a.resources.cpu_time.total_cmp(&b.resources.cpu_time));
+    let cpu_time = |index: usize| runs[index].0.resources.cpu_time;
+    // with an even number of runs the slower of the two in the middle is taken
+    let median = runs.len() / 2;
+    let timing = TimingStats {
+        runs: runs.len(),
+        min: cpu_time(0),
+        median: cpu_time(median),
+        max: cpu_time(runs.len() - 1),
+    };
+    debug!(
+        "Execution {} run {} times: {:?}",
+        execution.description, timing.runs, timing
+    );
+    let (mut result, sandbox) = runs.swap_remove(median);
+    result.timing = Some(timing);
+    Ok((result, sandbox))
+}
+
+/// Put the outputs in the file store shared with the server, so that the server finds them there
+/// instead of asking for them. The outputs on disk are copied with `FileStore::store_file`, that
+/// tries a reflink before copying the content in the kernel. The outputs that cannot be stored are
+/// skipped: the server will ask for them.
+fn store_outputs(
+    file_store: &FileStore,
+    outputs: &HashMap<FileUuid, FileStoreKey>,
+    output_paths: &HashMap<FileUuid, OutputFile>,
+) -> Vec<FileStoreHandle> {
+    let mut handles = Vec::with_capacity(outputs.len());
+    for (uuid, key) in outputs {
+        let handle = match &output_paths[uuid] {
+            OutputFile::OnDisk(path) => file_store.store_file(key, path),
+            OutputFile::InMemory(content) => file_store.store(key, once(content.clone())),
+        };
+        match handle {
+            Ok(handle) => handles.push(handle),
+            Err(e) => warn!("Failed to store output {uuid} in the shared store: {e:?}"),
+        }
+    }
+    handles
+}
+
+/// The output files of the executions, written on disk, that can be streamed while they run.
+fn streamed_outputs(
+    executions: &[Execution],
+    sandboxes: &[ExecutionUnit],
+) -> Vec<(FileUuid, PathBuf)> {
+    let mut files = vec![];
+    let mut add_file = |file: FileUuid, path: OutputFile| {
+        if let OutputFile::OnDisk(path) = path {
+            files.push((file, path));
+        }
+    };
+    for (exec, sandbox) in executions.iter().zip(sandboxes) {
+        if let ExecutionOutputBehaviour::Capture { file: stdout, .. } = &exec.stdout {
+            add_file(stdout.uuid, sandbox.stdout_path());
+        }
+        if let ExecutionOutputBehaviour::Capture { file: stderr, .. } = &exec.stderr {
+            add_file(stderr.uuid, sandbox.stderr_path());
+        }
+        for (path, file) in exec.output_files.iter() {
+            add_file(file.uuid, sandbox.output_path(path));
+        }
+    }
+    files
 }
 
 /// Spawn the sandbox of an execution in a different thread and send to the group manager the
@@ -589,10 +1339,12 @@ fn spawn_sandbox(
     index: usize,
     group_sender: Sender<(usize, SandboxResult)>,
     dag_config: ExecutionDAGConfig,
+    cores: Option<Vec<usize>>,
 ) -> Result<JoinHandle<Result<(), Error>>, Error> {
     Ok(thread::Builder::new()
         .name(format!("Sandbox of {description}"))
         .spawn(move || {
+            pin_sandbox_thread(cores);
             let res = match sandbox.run(runner.as_ref(), &dag_config) {
                 Ok(res) => res,
                 Err(e) => SandboxResult::Failed {
@@ -604,20 +1356,36 @@ fn spawn_sandbox(
         })?)
 }
 
+/// Pin the current thread, and therefore the sandbox it will spawn, to the given cores. A failure
+/// only makes the timings less stable, so it's not fatal.
+fn pin_sandbox_thread(cores: Option<Vec<usize>>) {
+    if let Some(cores) = cores {
+        if let Err(e) = pin_current_thread(&cores) {
+            warn!("Cannot pin the sandbox to the cores {:?}: {:?}", cores, e);
+        }
+    }
+}
+
 /// Compute the [`ExecutionResult`](../task_maker_dag/struct.ExecutionResult.html) based on the
-/// result of the sandbox.
+/// result of the sandbox. The times used are normalized with `time_normalization`, if any, and a
+/// process killed for exceeding the time limits of its sandbox gets a time limit verdict.
 fn compute_execution_result(
     execution: &Execution,
     result: SandboxResult,
     sandbox: &ExecutionUnit,
+    time_normalization: Option<&TimeNormalization>,
 ) -> ExecutionResult {
     match result {
         SandboxResult::Success {
             exit_status,
             signal,
-            resources,
+            mut resources,
             was_killed,
         } => {
+            let measured = resources.clone();
+            if let Some(normalization) = time_normalization {
+                normalization.normalize(&mut resources);
+            }
             let stdout = capture_stream(&sandbox.stdout_path(), &execution.stdout);
             let stderr = capture_stream(&sandbox.stderr_path(), &execution.stderr);
             let execution_status = if exit_status != 0 {
@@ -628,7 +1396,11 @@ fn compute_execution_result(
                 ExecutionStatus::Success
             };
             let status = match (&stdout, &stderr) {
-                (Ok(_), Ok(_)) => execution.status(&execution_status, &resources),
+                (Ok(_), Ok(_)) => time_normalization
+                    .and_then(|normalization| {
+                        normalization.sandbox_time_verdict(execution, &execution_status, &measured)
+                    })
+                    .unwrap_or_else(|| execution.status(&execution_status, &resources)),
                 (Err(err), _) => {
                     ExecutionStatus::internal_error(format!("Failed to read stdout file: {err:?}"))
                 }
@@ -643,6 +1415,7 @@ fn compute_execution_result(
                 was_killed,
                 was_cached: false,
                 stderr: stderr.ok().unwrap_or_default(),
+                timing: None,
             }
         }
         SandboxResult::Failed { error } => {
@@ -660,6 +1433,7 @@ fn compute_execution_result(
                 was_cached: false,
                 stdout: None,
                 stderr: None,
+                timing: None,
             }
         }
     }
@@ -719,30 +1493,18 @@ fn capture_stream(
     behaviour: &ExecutionOutputBehaviour,
 ) -> Result<Option<Vec<u8>>, Error> {
     match behaviour {
-        ExecutionOutputBehaviour::Capture { size_limit, .. } => {
-            match file {
-                OutputFile::OnDisk(path) => {
-                    let mut file = std::fs::File::open(path)?;
-                    let mut result = Vec::new();
-                    let mut buffer = vec![0; 1024];
-                    let mut read = 0;
-                    while read < size_limit.unwrap_or(usize::MAX) {
-                        let n = file.read(&mut buffer)?;
-                        // EOF
-                        if n == 0 {
-                            break;
-                        } else {
-                            result.extend_from_slice(&buffer[0..n]);
-                            read += n;
-                        }
-                    }
-                    Ok(Some(result))
-                }
-                OutputFile::InMemory(content) => Ok(Some(
-                    content[..cmp::min(size_limit.unwrap_or(usize::MAX), content.len())].to_owned(),
-                )),
+        ExecutionOutputBehaviour::Capture { size_limit, .. } => match file {
+            OutputFile::OnDisk(path) => {
+                let file = std::fs::File::open(path)?;
+                let mut result = Vec::new();
+                file.take(size_limit.map_or(u64::MAX, |limit| limit as u64))
+                    .read_to_end(&mut result)?;
+                Ok(Some(result))
             }
-        }
+            OutputFile::InMemory(content) => Ok(Some(
+                content[..cmp::min(size_limit.unwrap_or(usize::MAX), content.len())].to_owned(),
+            )),
+        },
         _ => Ok(None),
     }
 }
@@ -760,14 +1522,14 @@ impl std::fmt::Display for Worker {
 }
 
 fn check_sandbox_is_supported(
-    sandbox_path: &Path,
+    sandbox_pool: &SandboxPool,
     runner: Arc<dyn SandboxRunner>,
 ) -> Result<(), Error> {
     let execution = Execution::new(
         "Execution to check if sandbox is supported",
         ExecutionCommand::system("true"),
     );
-    let mut sandbox = ExecutionUnit::new(sandbox_path, &execution, &Default::default(), None)?;
+    let mut sandbox = ExecutionUnit::new(sandbox_pool, &execution, &Default::default(), None)?;
     let result = sandbox.run(runner.as_ref(), &ExecutionDAGConfig::new())?;
     match result {
         SandboxResult::Failed { error } => bail!("Sandbox failed: {}", error),
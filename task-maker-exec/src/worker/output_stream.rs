@@ -0,0 +1,173 @@
+//! Send the big output files to the server while the execution that writes them is still running.
+//!
+//! Normally the outputs are sent only after the execution, when the server asks for the ones it
+//! doesn't have. For a generator writing hundreds of MiB this delays the executions that depend on
+//! it by the whole transfer time. Instead the outputs that grow past a threshold are tailed, and
+//! their content is sent in `FileChunk` messages as soon as it's written. After the execution the
+//! server checks the hash of what it received against the key in `WorkerDone`, and asks for the
+//! file again only if they differ (e.g. because the process rewrote it).
+
+use std::fs::File;
+use std::io::Read;
+use std::path::PathBuf;
+use std::sync::atomic::{AtomicBool, Ordering};
+use std::sync::Arc;
+use std::thread::JoinHandle;
+use std::time::Duration;
+
+use anyhow::{anyhow, Context, Error};
+use ductile::ChannelSender;
+use task_maker_dag::FileUuid;
+
+use crate::proto::WorkerClientMessage;
+
+/// How often the sizes of the files are checked.
+const POLL_INTERVAL: Duration = Duration::from_millis(50);
+/// The maximum size of a chunk sent to the server.
+const CHUNK_SIZE: usize = 1 << 20;
+
+/// The thread that streams the outputs of a job.
+pub(crate) struct OutputStreamer {
+    /// Tells the thread that the executions are done.
+    done: Arc<AtomicBool>,
+    /// The thread tailing the files.
+    handle: JoinHandle<Result<(), Error>>,
+}
+
+/// An output file that may be streamed.
+struct TailedFile {
+    /// The file produced by the execution.
+    uuid: FileUuid,
+    /// The path of the file in the sandbox.
+    path: PathBuf,
+    /// The file, opened when it gets bigger than the threshold.
+    file: Option<File>,
+}
+
+impl OutputStreamer {
+    /// Start streaming the files that get bigger than `threshold` bytes.
+    pub(crate) fn start(
+        files: Vec<(FileUuid, PathBuf)>,
+        threshold: u64,
+        sender: ChannelSender<WorkerClientMessage>,
+    ) -> Result<OutputStreamer, Error> {
+        let done = Arc::new(AtomicBool::new(false));
+        let mut files: Vec<_> = files
+            .into_iter()
+            .map(|(uuid, path)| TailedFile {
+                uuid,
+                path,
+                file: None,
+            })
+            .collect();
+        let handle = {
+            let done = done.clone();
+            std::thread::Builder::new()
+                .name("Output streamer".into())
+                .spawn(move || -> Result<(), Error> {
+                    let mut buffer = vec![0; CHUNK_SIZE];
+                    loop {
+                        // after the executions are done, a last pass sends what is left
+                        let last = done.load(Ordering::SeqCst);
+                        for file in &mut files {
+                            file.send_new_data(threshold, &mut buffer, &sender)?;
+                        }
+                        if last {
+                            return Ok(());
+                        }
+                        std::thread::sleep(POLL_INTERVAL);
+                    }
+                })
+                .context("Failed to spawn the output streamer")?
+        };
+        Ok(OutputStreamer { done, handle })
+    }
+
+    /// Send the rest of the streamed files, now that the executions are done.
+    pub(crate) fn finish(self) -> Result<(), Error> {
+        self.done.store(true, Ordering::SeqCst);
+        self.handle
+            .join()
+            .map_err(|e| anyhow!("Output streamer panicked: {:?}", e))?
+    }
+}
+
+impl TailedFile {
+    /// Send what was written to the file since the last call, if it's being streamed.
+    fn send_new_data(
+        &mut self,
+        threshold: u64,
+        buffer: &mut [u8],
+        sender: &ChannelSender<WorkerClientMessage>,
+    ) -> Result<(), Error> {
+        if self.file.is_none() {
+            match std::fs::metadata(&self.path) {
+                Ok(metadata) if metadata.len() >= threshold => {
+                    self.file = File::open(&self.path).ok();
+                }
+                _ => return Ok(()),
+            }
+        }
+        let Some(file) = &mut self.file else {
+            return Ok(());
+        };
+        loop {
+            let read = file
+                .read(buffer)
+                .with_context(|| format!("Failed to read {}", self.path.display()))?;
+            if read == 0 {
+                return Ok(());
+            }
+            sender
+                .send(WorkerClientMessage::FileChunk(
+                    self.uuid,
+                    buffer[..read].to_vec(),
+                ))
+                .context("Failed to send FileChunk")?;
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use std::io::Write;
+
+    use ductile::new_local_channel;
+
+    use super::*;
+
+    #[test]
+    fn test_stream_outputs() {
+        let tmpdir = tempfile::TempDir::new().unwrap();
+        let big = tmpdir.path().join("big");
+        let small = tmpdir.path().join("small");
+        let big_uuid = FileUuid::new_v4();
+        let (sender, receiver) = new_local_channel();
+
+        let mut output = File::create(&big).unwrap();
+        std::fs::write(&small, "small").unwrap();
+        let streamer = OutputStreamer::start(
+            vec![(big_uuid, big.clone()), (FileUuid::new_v4(), small)],
+            10,
+            sender,
+        )
+        .unwrap();
+        output.write_all(b"0123456789").unwrap();
+        std::thread::sleep(POLL_INTERVAL * 3);
+        // written after the file started being streamed
+        output.write_all(b"abc").unwrap();
+        streamer.finish().unwrap();
+
+        let mut received = Vec::new();
+        while let Ok(message) = receiver.recv() {
+            match message {
+                WorkerClientMessage::FileChunk(uuid, data) => {
+                    assert_eq!(uuid, big_uuid);
+                    received.extend(data);
+                }
+                _ => panic!("Unexpected message: {message:?}"),
+            }
+        }
+        assert_eq!(received, b"0123456789abc");
+    }
+}
@@ -0,0 +1,219 @@
+//! Exchange of the files between the workers, without passing through the server.
+//!
+//! A worker can serve the files of its store to the other workers. The server knows which workers
+//! have each file in their store (the files it sent them), and when a worker asks for
+//! a file another worker has, the server tells it to fetch the file from that worker, so that the
+//! same file is not sent many times by the server. If the fetch fails (the other worker is gone, or
+//! removed the file from its store), the worker asks the server for the files it didn't get.
+
+use std::sync::mpsc::{channel, RecvTimeoutError, Sender};
+use std::sync::Arc;
+use std::time::Duration;
+
+use anyhow::{anyhow, bail, Context, Error};
+use ductile::{
+    connect_channel, connect_channel_with_enc, ChannelReceiver, ChannelSender, ChannelServer,
+};
+use serde::{Deserialize, Serialize};
+use task_maker_store::{FileStore, FileStoreHandle, FileStoreKey};
+
+use crate::proto::{ChannelFileIterator, ChannelFileSender, FileEncoding};
+
+/// How long a worker waits for each of the files it fetches from another worker. After that the
+/// other worker is considered stuck, and the files not received yet are asked to the server.
+const FETCH_TIMEOUT: Duration = Duration::from_secs(30);
+
+/// Messages sent by a worker to the worker that serves the files.
+#[derive(Debug, Clone, Serialize, Deserialize)]
+pub enum PeerClientMessage {
+    /// The worker needs these files, that should be sent with that encoding.
+    AskFiles(Vec<FileStoreKey>, FileEncoding),
+}
+
+/// Messages sent by the worker serving the files, one for each of the files asked.
+#[derive(Debug, Clone, Serialize, Deserialize)]
+pub enum PeerServerMessage {
+    /// The worker is sending the file. After this message there is a protocol switch for the
+    /// file transmission.
+    ProvideFile(FileStoreKey),
+    /// The worker doesn't have the file.
+    MissingFile(FileStoreKey),
+}
+
+/// Spawn the thread that serves the files of the store to the workers connecting to `bind_addr`,
+/// returning the port it listens on.
+pub(crate) fn serve_files(
+    bind_addr: String,
+    enc_key: Option<[u8; 32]>,
+    file_store: Arc<FileStore>,
+) -> Result<u16, Error> {
+    let (port_sender, port_receiver) = channel();
+    std::thread::Builder::new()
+        .name("File server".into())
+        .spawn(move || {
+            let server = match enc_key {
+                Some(enc_key) => ChannelServer::bind_with_enc(&bind_addr, enc_key),
+                None => ChannelServer::bind(&bind_addr),
+            };
+            let server = match server.and_then(|server| Ok((server.local_addr()?, server))) {
+                Ok((Some(local_addr), server)) => {
+                    let _ = port_sender.send(Ok(local_addr.port()));
+                    server
+                }
+                Ok((None, _)) => {
+                    let _ = port_sender.send(Err(anyhow!("The file server is not on TCP")));
+                    return;
+                }
+                Err(e) => {
+                    let _ = port_sender.send(Err(e));
+                    return;
+                }
+            };
+            for (sender, receiver, addr) in server {
+                let addr = addr.map_or_else(|| "(local)".into(), |addr| addr.to_string());
+                debug!("Worker connected from {addr} for fetching files");
+                let file_store = file_store.clone();
+                let spawned = std::thread::Builder::new()
+                    .name(format!("File server for {addr}"))
+                    .spawn(move || serve_connection(&sender, &receiver, &file_store, &addr));
+                if let Err(e) = spawned {
+                    warn!("Failed to spawn the file server thread: {e:?}");
+                }
+            }
+        })
+        .context("Failed to spawn the file server")?;
+    port_receiver
+        .recv()
+        .context("The file server is gone")?
+        .context("Failed to bind the file server")
+}
+
+/// Send the files asked by the worker connected to this channel, until it disconnects.
+fn serve_connection(
+    sender: &ChannelSender<PeerServerMessage>,
+    receiver: &ChannelReceiver<PeerClientMessage>,
+    file_store: &FileStore,
+    addr: &str,
+) {
+    while let Ok(PeerClientMessage::AskFiles(keys, encoding)) = receiver.recv() {
+        for key in keys {
+            let sent = match file_store.get(&key) {
+                Some(handle) => sender
+                    .send(PeerServerMessage::ProvideFile(key))
+                    .context("Failed to send ProvideFile")
+                    .and_then(|_| {
+                        ChannelFileSender::send_with_encoding(handle.path(), sender, encoding)
+                    }),
+                None => sender
+                    .send(PeerServerMessage::MissingFile(key))
+                    .context("Failed to send MissingFile"),
+            };
+            if let Err(e) = sent {
+                warn!("Failed to send file to the worker at {addr}: {e:?}");
+                return;
+            }
+        }
+    }
+}
+
+/// Fetch the files from the worker serving them at `addr`, storing them in the store. Returns the
+/// files received, and the keys of the ones that were not.
+///
+/// The files are received in a thread of their own: the iterator over the file chunks panics if
+/// the channel breaks, and the other worker may stop sending without closing the connection. If
+/// a file doesn't arrive within `FETCH_TIMEOUT` the thread is abandoned, and the files it didn't
+/// receive yet are reported as missing.
+pub(crate) fn fetch_files(
+    addr: &str,
+    enc_key: Option<[u8; 32]>,
+    keys: Vec<FileStoreKey>,
+    encoding: FileEncoding,
+    file_store: &Arc<FileStore>,
+) -> (Vec<(FileStoreKey, FileStoreHandle)>, Vec<FileStoreKey>) {
+    let mut received = Vec::new();
+    let (file_sender, file_receiver) = channel();
+    let fetch_addr = addr.to_string();
+    let fetch_keys = keys.clone();
+    let file_store = file_store.clone();
+    let spawned = std::thread::Builder::new()
+        .name(format!("Receive files from {addr}"))
+        .spawn(move || {
+            let result = fetch_files_from(
+                &fetch_addr,
+                enc_key.as_ref(),
+                &fetch_keys,
+                encoding,
+                &file_store,
+                &file_sender,
+            );
+            if let Err(e) = result {
+                warn!("Failed to fetch files from the worker at {fetch_addr}: {e:?}");
+            }
+        });
+    match spawned {
+        Ok(_) => {
+            for _ in &keys {
+                match file_receiver.recv_timeout(FETCH_TIMEOUT) {
+                    Ok(Some(file)) => received.push(file),
+                    Ok(None) => {}
+                    Err(RecvTimeoutError::Timeout) => {
+                        warn!("The worker at {addr} didn't send the files in time");
+                        break;
+                    }
+                    // the thread failed, or panicked
+                    Err(RecvTimeoutError::Disconnected) => break,
+                }
+            }
+        }
+        Err(e) => warn!("Failed to spawn the thread fetching the files: {e:?}"),
+    }
+    let missing = keys
+        .into_iter()
+        .filter(|key| !received.iter().any(|(received, _)| received == key))
+        .collect();
+    (received, missing)
+}
+
+/// Ask the files to the worker at `addr`, sending to `received` each of the files it sends, or
+/// `None` for the ones it doesn't have. Stops when `received` is closed.
+fn fetch_files_from(
+    addr: &str,
+    enc_key: Option<&[u8; 32]>,
+    keys: &[FileStoreKey],
+    encoding: FileEncoding,
+    file_store: &FileStore,
+    received: &Sender<Option<(FileStoreKey, FileStoreHandle)>>,
+) -> Result<(), Error> {
+    let (sender, receiver) = match enc_key {
+        Some(enc_key) => connect_channel_with_enc(addr, enc_key),
+        None => connect_channel(addr),
+    }
+    .context("Failed to connect")?;
+    sender
+        .send(PeerClientMessage::AskFiles(keys.to_vec(), encoding))
+        .context("Failed to send AskFiles")?;
+    for _ in keys {
+        let file = match receiver.recv().context("Failed to receive file")? {
+            PeerServerMessage::ProvideFile(key) => {
+                if !keys.contains(&key) {
+                    bail!("The worker sent the file {key}, that was not asked");
+                }
+                let handle = file_store
+                    .store(
+                        &key,
+                        ChannelFileIterator::with_encoding(&receiver, encoding),
+                    )
+                    .with_context(|| format!("Failed to store file {key}"))?;
+                Some((key, handle))
+            }
+            PeerServerMessage::MissingFile(key) => {
+                debug!("The worker at {addr} doesn't have file {key}");
+                None
+            }
+        };
+        if received.send(file).is_err() {
+            bail!("Gave up waiting for the files");
+        }
+    }
+    Ok(())
+}
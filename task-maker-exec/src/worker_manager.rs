@@ -1,18 +1,24 @@
-use std::collections::HashMap;
+use std::collections::hash_map::Entry;
+use std::collections::{HashMap, HashSet, VecDeque};
+use std::io::Write;
+use std::net::SocketAddr;
 use std::sync::mpsc::{Receiver, Sender};
-use std::sync::Arc;
+use std::sync::{Arc, Mutex};
 use std::thread;
+use std::time::Instant;
 
 use anyhow::{bail, Context, Error};
 use ductile::ChannelSender;
-use task_maker_dag::{ExecutionGroupUuid, WorkerUuid};
-use task_maker_store::FileStore;
+use task_maker_dag::{ExecutionGroupUuid, FileUuid, WorkerUuid};
+use task_maker_store::{FileStore, FileStoreHandle, FileStoreKey};
+use tempfile::NamedTempFile;
 
 use crate::executor::WorkerJob;
 use crate::proto::{
-    ChannelFileIterator, ChannelFileSender, WorkerClientMessage, WorkerServerMessage,
+    ChannelFileIterator, ChannelFileSender, FileEncoding, WorkerClientMessage, WorkerServerMessage,
 };
 use crate::scheduler::SchedulerInMessage;
+use crate::trace;
 use crate::WorkerConn;
 
 /// Message coming from the Scheduler or the Executor for the WorkerManager
@@ -36,6 +42,11 @@ pub(crate) enum WorkerManagerInMessage {
     Exit,
 }
 
+/// The channel that sends messages to a worker, shared between the worker manager and the thread
+/// managing the connection. The lock is held while a file is being sent, so that the other
+/// messages don't end up in the middle of it.
+type WorkerSender = Arc<Mutex<ChannelSender<WorkerServerMessage>>>;
+
 /// The entity that manages the connections with the workers, eventually writing files to disk and
 /// telling to the `Scheduler` the connection and disconnection of the workers.
 pub(crate) struct WorkerManager {
@@ -48,6 +59,17 @@ pub(crate) struct WorkerManager {
     sender: Sender<WorkerManagerInMessage>,
     /// The receiver of the messages for the worker manager.
     receiver: Receiver<WorkerManagerInMessage>,
+    /// The workers that serve their files to the other ones, and the files they have.
+    locations: Arc<Mutex<FileLocations>>,
+}
+
+/// Which files have the workers that serve them to the other workers.
+#[derive(Debug, Default)]
+struct FileLocations {
+    /// The address at which each worker serves its files.
+    peers: HashMap<WorkerUuid, SocketAddr>,
+    /// The workers that have each file, the one that served it least recently first.
+    files: HashMap<FileStoreKey, VecDeque<WorkerUuid>>,
 }
 
 impl WorkerManager {
@@ -65,14 +87,14 @@ impl WorkerManager {
             scheduler,
             sender,
             receiver,
+            locations: Default::default(),
         }
     }
 
     /// Run the worker manager blocking until an exit message is received. On exiting the connected
     /// workers will stop.
     pub fn run(self) -> Result<(), Error> {
-        let mut connected_workers: HashMap<WorkerUuid, ChannelSender<WorkerServerMessage>> =
-            HashMap::new();
+        let mut connected_workers: HashMap<WorkerUuid, WorkerSender> = HashMap::new();
         while let Ok(message) = self.receiver.recv() {
             match message {
                 WorkerManagerInMessage::WorkerConnected { worker } => {
@@ -80,10 +102,12 @@ impl WorkerManager {
                         warn!("Duplicate worker uuid");
                         continue;
                     }
-                    connected_workers.insert(worker.uuid, worker.sender.clone());
+                    let worker_sender = Arc::new(Mutex::new(worker.sender.clone()));
+                    connected_workers.insert(worker.uuid, worker_sender.clone());
                     info!("Worker {} ({}) connected", worker.name, worker.uuid);
                     let scheduler = self.scheduler.clone();
                     let file_store = self.file_store.clone();
+                    let locations = self.locations.clone();
                     let sender = self.sender.clone();
                     thread::Builder::new()
                         .name(format!(
@@ -91,9 +115,14 @@ impl WorkerManager {
                             worker.name, worker.uuid
                         ))
                         .spawn(move || {
-                            if let Err(e) =
-                                WorkerManager::worker_thread(worker, scheduler, sender, file_store)
-                            {
+                            if let Err(e) = WorkerManager::worker_thread(
+                                worker,
+                                worker_sender,
+                                scheduler,
+                                sender,
+                                file_store,
+                                locations,
+                            ) {
                                 warn!("The manager of a worker failed: {e:?}");
                             }
                         })
@@ -109,6 +138,8 @@ impl WorkerManager {
                     // scheduler should be already informed and should have resheduled the job.
                     if let Some(sender) = connected_workers.get(&worker) {
                         sender
+                            .lock()
+                            .unwrap()
                             .send(WorkerServerMessage::Work(Box::new(job)))
                             .context("Failed to send Work to worker")?;
                     }
@@ -120,6 +151,8 @@ impl WorkerManager {
                 WorkerManagerInMessage::StopWorkerJob { worker, job } => {
                     if let Some(sender) = connected_workers.get(&worker) {
                         sender
+                            .lock()
+                            .unwrap()
                             .send(WorkerServerMessage::KillJob(job))
                             .context("Failed to send KillJob to worker")?;
                     }
@@ -128,7 +161,12 @@ impl WorkerManager {
         }
         debug!("Worker manager exiting");
         for (worker, sender) in connected_workers.iter() {
-            if sender.send(WorkerServerMessage::Exit).is_err() {
+            if sender
+                .lock()
+                .unwrap()
+                .send(WorkerServerMessage::Exit)
+                .is_err()
+            {
                 warn!("Cannot tell worker {worker} to exit");
             }
         }
@@ -137,13 +175,20 @@ impl WorkerManager {
 
     /// Thread body that manages the actual connection with a worker. `worker_manager` will send
     /// messages back to the `WorkerManager` main thread for the notification about the
-    /// disconnection of this worker.
+    /// disconnection of this worker. All the messages to the worker are sent using `sender`.
     fn worker_thread(
         worker: WorkerConn,
+        sender: WorkerSender,
         scheduler: Sender<SchedulerInMessage>,
         worker_manager: Sender<WorkerManagerInMessage>,
         file_store: Arc<FileStore>,
+        locations: Arc<Mutex<FileLocations>>,
     ) -> Result<(), Error> {
+        let lane = format!("Server side of {}", worker.name);
+        // the outputs the worker is sending while the job is still running
+        let mut streamed_files: HashMap<FileUuid, NamedTempFile> = HashMap::new();
+        // the files the worker was told to fetch from another worker
+        let mut redirected: HashSet<FileStoreKey> = HashSet::new();
         while let Ok(message) = worker.receiver.recv() {
             match message {
                 WorkerClientMessage::GetWork => {
@@ -157,57 +202,132 @@ impl WorkerManager {
                         break;
                     }
                 }
-                WorkerClientMessage::AskFile(key) => {
-                    // the worker is asking for a file it doesn't have locally stored
-                    let handle = file_store
-                        .get(&key)
-                        .context("Worker is asking for an unknown file")?;
-                    worker
-                        .sender
-                        .send(WorkerServerMessage::ProvideFile(key))
-                        .context("Failed to send ProvideFile to worker")?;
-                    ChannelFileSender::send(handle.path(), &worker.sender)
-                        .context("Failed to send file to worker")?;
+                WorkerClientMessage::AskFiles(keys) => {
+                    // the worker is asking for the files of a job it doesn't have locally stored
+                    let start = Instant::now();
+                    WorkerManager::send_files(
+                        &worker,
+                        &sender,
+                        &file_store,
+                        &locations,
+                        &mut redirected,
+                        keys,
+                    )?;
+                    trace::span(&lane, "send files", None, start, Instant::now());
+                }
+                WorkerClientMessage::ServeFiles(port) => match worker.addr {
+                    Some(addr) => {
+                        let addr = SocketAddr::new(addr.ip(), port);
+                        info!("Worker {} serves its files at {addr}", worker.name);
+                        locations.lock().unwrap().add_peer(worker.uuid, addr);
+                    }
+                    None => warn!(
+                        "Worker {} serves its files, but it's not connected through the network",
+                        worker.name
+                    ),
+                },
+                WorkerClientMessage::Health(health) => {
+                    let res = scheduler.send(SchedulerInMessage::WorkerHealth {
+                        uuid: worker.uuid,
+                        health,
+                    });
+                    if res.is_err() {
+                        break;
+                    }
                 }
                 WorkerClientMessage::ProvideFile(_, _) => {
                     // the worker should not provide files unless just after a WorkerDone message is
                     // received
                     unreachable!("Unexpected ProvideFile from worker");
                 }
+                WorkerClientMessage::FileChunk(uuid, data) => {
+                    let file = match streamed_files.entry(uuid) {
+                        Entry::Occupied(entry) => entry.into_mut(),
+                        Entry::Vacant(entry) => entry.insert(
+                            NamedTempFile::new().context("Failed to create temporary file")?,
+                        ),
+                    };
+                    file.write_all(&data)
+                        .context("Failed to write streamed file")?;
+                }
                 WorkerClientMessage::WorkerDone(result, outputs) => {
                     // the worker completed its job and will send the produced files
+                    let start = Instant::now();
                     let mut output_handlers = HashMap::new();
                     let mut missing_files = Vec::new();
                     for (uuid, key) in &outputs {
                         if let Some(handle) = file_store.get(key) {
                             output_handlers.insert(*uuid, handle);
+                        } else if let Some(handle) = WorkerManager::store_streamed_file(
+                            &file_store,
+                            &mut streamed_files,
+                            *uuid,
+                            key,
+                        ) {
+                            output_handlers.insert(*uuid, handle);
                         } else {
                             missing_files.push(*uuid);
                         }
                     }
+                    // the outputs are not recorded in the locations: the worker doesn't keep them
+                    // in its store, they are removed with the sandbox
+                    streamed_files.clear();
                     let num_missing = missing_files.len();
                     info!(
                         "Asking worker {} for {} missing files",
                         worker.uuid, num_missing
                     );
-                    worker
-                        .sender
+                    sender
+                        .lock()
+                        .unwrap()
                         .send(WorkerServerMessage::AskFiles(missing_files))
                         .context("Failed to send AskFiles to worker")?;
-                    for _ in 0..num_missing {
+                    // while sending the outputs, the worker may ask for the dependencies of the
+                    // next job it got in advance: they are sent after receiving all the outputs.
+                    let mut asked_files = Vec::new();
+                    let mut received = 0;
+                    while received < num_missing {
                         let message = worker
                             .receiver
                             .recv()
                             .context("Failed to receive file from worker")?;
-                        if let WorkerClientMessage::ProvideFile(uuid, key) = message {
-                            let handle = file_store
-                                .store(&key, ChannelFileIterator::new(&worker.receiver))
-                                .context("Failed to store worker-provided file")?;
-                            output_handlers.insert(uuid, handle);
-                        } else {
-                            bail!("Unexpected message from worker: {:?}", message);
+                        match message {
+                            WorkerClientMessage::ProvideFile(uuid, key) => {
+                                let handle = file_store
+                                    .store(
+                                        &key,
+                                        ChannelFileIterator::with_encoding(
+                                            &worker.receiver,
+                                            worker.file_encoding,
+                                        ),
+                                    )
+                                    .context("Failed to store worker-provided file")?;
+                                output_handlers.insert(uuid, handle);
+                                received += 1;
+                            }
+                            WorkerClientMessage::AskFiles(keys) => asked_files.extend(keys),
+                            WorkerClientMessage::Health(health) => {
+                                let _ = scheduler.send(SchedulerInMessage::WorkerHealth {
+                                    uuid: worker.uuid,
+                                    health,
+                                });
+                            }
+                            _ => bail!("Unexpected message from worker: {:?}", message),
                         }
                     }
+                    trace::span(&lane, "receive outputs", None, start, Instant::now());
+                    if !asked_files.is_empty() {
+                        let start = Instant::now();
+                        WorkerManager::send_files(
+                            &worker,
+                            &sender,
+                            &file_store,
+                            &locations,
+                            &mut redirected,
+                            asked_files,
+                        )?;
+                        trace::span(&lane, "send files", None, start, Instant::now());
+                    }
                     let mex = SchedulerInMessage::WorkerResult {
                         worker: worker.uuid,
                         result,
@@ -220,6 +340,7 @@ impl WorkerManager {
                 }
             }
         }
+        locations.lock().unwrap().remove_peer(worker.uuid);
         // when the worker disconnects, tell the scheduler that the worker is no longer alive (thus
         // rescheduling the job if needed).
         if scheduler
@@ -240,4 +361,170 @@ impl WorkerManager {
         }
         Ok(())
     }
+
+    /// Store the file the worker has sent while the job was running, if its content matches the key
+    /// of the output.
+    fn store_streamed_file(
+        file_store: &FileStore,
+        streamed_files: &mut HashMap<FileUuid, NamedTempFile>,
+        uuid: FileUuid,
+        key: &FileStoreKey,
+    ) -> Option<FileStoreHandle> {
+        let file = streamed_files.remove(&uuid)?;
+        match FileStoreKey::from_file(file.path()) {
+            Ok(streamed_key) if &streamed_key == key => {}
+            Ok(_) => {
+                debug!("Streamed file {uuid} changed after being sent, asking it again");
+                return None;
+            }
+            Err(e) => {
+                warn!("Failed to hash streamed file {uuid}: {e:?}");
+                return None;
+            }
+        }
+        match file_store.store_file(key, file.path()) {
+            Ok(handle) => Some(handle),
+            Err(e) => {
+                warn!("Failed to store streamed file {uuid}: {e:?}");
+                None
+            }
+        }
+    }
+
+    /// Send to the worker the files it asked for. The files that another worker has are fetched
+    /// from that worker, except the ones this worker already failed to fetch: their keys are in
+    /// `redirected`.
+    fn send_files(
+        worker: &WorkerConn,
+        sender: &WorkerSender,
+        file_store: &FileStore,
+        locations: &Mutex<FileLocations>,
+        redirected: &mut HashSet<FileStoreKey>,
+        keys: Vec<FileStoreKey>,
+    ) -> Result<(), Error> {
+        let mut from_peers: HashMap<SocketAddr, Vec<FileStoreKey>> = HashMap::new();
+        let mut from_server = Vec::new();
+        {
+            let mut locations = locations.lock().unwrap();
+            for key in keys {
+                let peer = if redirected.remove(&key) {
+                    None
+                } else {
+                    locations.find_peer(&key, worker.uuid)
+                };
+                match peer {
+                    Some(peer) => {
+                        redirected.insert(key.clone());
+                        from_peers.entry(peer).or_default().push(key);
+                    }
+                    None => from_server.push(key),
+                }
+            }
+        }
+        for (peer, keys) in from_peers {
+            sender
+                .lock()
+                .unwrap()
+                .send(WorkerServerMessage::FetchFiles(peer.to_string(), keys))
+                .context("Failed to send FetchFiles to worker")?;
+        }
+        for key in from_server {
+            WorkerManager::provide_file(sender, file_store, key.clone(), worker.file_encoding)?;
+            locations.lock().unwrap().add_file(&key, worker.uuid);
+        }
+        Ok(())
+    }
+
+    /// Send to the worker a file it asked for.
+    fn provide_file(
+        sender: &WorkerSender,
+        file_store: &FileStore,
+        key: FileStoreKey,
+        file_encoding: FileEncoding,
+    ) -> Result<(), Error> {
+        let handle = file_store
+            .get(&key)
+            .context("Worker is asking for an unknown file")?;
+        let sender = sender.lock().unwrap();
+        sender
+            .send(WorkerServerMessage::ProvideFile(key))
+            .context("Failed to send ProvideFile to worker")?;
+        ChannelFileSender::send_with_encoding(handle.path(), &*sender, file_encoding)
+            .context("Failed to send file to worker")?;
+        Ok(())
+    }
+}
+
+impl FileLocations {
+    /// Register a worker that serves its files at that address.
+    fn add_peer(&mut self, worker: WorkerUuid, addr: SocketAddr) {
+        self.peers.insert(worker, addr);
+    }
+
+    /// Forget a worker that is gone.
+    fn remove_peer(&mut self, worker: WorkerUuid) {
+        if self.peers.remove(&worker).is_none() {
+            return;
+        }
+        self.files.retain(|_, workers| {
+            workers.retain(|w| *w != worker);
+            !workers.is_empty()
+        });
+    }
+
+    /// Register that the worker has the file, if it serves its files.
+    fn add_file(&mut self, key: &FileStoreKey, worker: WorkerUuid) {
+        if !self.peers.contains_key(&worker) {
+            return;
+        }
+        let workers = self.files.entry(key.clone()).or_default();
+        if !workers.contains(&worker) {
+            // it hasn't served the file yet, so it's the first to be chosen
+            workers.push_front(worker);
+        }
+    }
+
+    /// The address of a worker, other than `worker`, from which `worker` can fetch the file. The
+    /// workers with the file are chosen in turn, so that they share the transfers.
+    fn find_peer(&mut self, key: &FileStoreKey, worker: WorkerUuid) -> Option<SocketAddr> {
+        let workers = self.files.get_mut(key)?;
+        // the worker asking for the file doesn't have it anymore
+        workers.retain(|w| *w != worker);
+        let peer = workers.pop_front()?;
+        workers.push_back(peer);
+        self.peers.get(&peer).copied()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_file_locations() {
+        let mut locations = FileLocations::default();
+        let [first, second, third] = [(); 3].map(|_| WorkerUuid::new_v4());
+        let first_addr: SocketAddr = "10.0.0.1:27184".parse().unwrap();
+        let second_addr: SocketAddr = "10.0.0.2:27184".parse().unwrap();
+        let key = FileStoreKey::from_content(b"input");
+        locations.add_peer(first, first_addr);
+        locations.add_peer(second, second_addr);
+
+        // a worker that doesn't serve its files is not tracked
+        locations.add_file(&key, third);
+        assert_eq!(locations.find_peer(&key, first), None);
+
+        locations.add_file(&key, first);
+        assert_eq!(locations.find_peer(&key, third), Some(first_addr));
+        locations.add_file(&key, second);
+        // the workers take turns
+        assert_eq!(locations.find_peer(&key, third), Some(second_addr));
+        assert_eq!(locations.find_peer(&key, third), Some(first_addr));
+        // the worker asking for the file doesn't have it
+        assert_eq!(locations.find_peer(&key, first), Some(second_addr));
+        assert_eq!(locations.find_peer(&key, third), Some(second_addr));
+
+        locations.remove_peer(second);
+        assert_eq!(locations.find_peer(&key, third), None);
+    }
 }
@@ -1,4 +1,5 @@
-use std::path::Path;
+use std::collections::HashMap;
+use std::path::{Path, PathBuf};
 
 use itertools::Itertools;
 use ratatui::layout::{Constraint, Direction, Layout, Rect};
@@ -24,16 +25,38 @@ use crate::ScoreStatus;
 pub(crate) type CursesUI = GenericCursesUI<UIState, Drawer, FinishUI>;
 
 /// The drawer of the IOI CursesUI.
-pub(crate) struct Drawer;
+#[derive(Default)]
+pub(crate) struct Drawer {
+    /// The evaluation rows of the solutions drawn in the previous frames.
+    rows: HashMap<PathBuf, EvaluationRow>,
+}
+
+/// The evaluation row of a solution, with the score and the status of all its testcases, as drawn
+/// in a previous frame. With many solutions and testcases building this row is most of the cost of
+/// a frame, and only the rows of the solutions that changed have to be built again.
+struct EvaluationRow {
+    /// The version of the state of the solution the row was built from.
+    version: u64,
+    /// The loading character used in the row, if the solution is still being evaluated.
+    loading: Option<char>,
+    /// The content of the row.
+    spans: Vec<Span<'static>>,
+}
 
 impl CursesDrawer<UIState> for Drawer {
-    fn draw(state: &UIState, frame: &mut Frame, loading: char, frame_index: usize) {
-        draw_frame(state, frame, loading, frame_index);
+    fn draw(&mut self, state: &UIState, frame: &mut Frame, loading: char, frame_index: usize) {
+        draw_frame(state, frame, loading, frame_index, &mut self.rows);
     }
 }
 
 /// Draw a frame of interface to the provided `Frame`.
-fn draw_frame(state: &UIState, f: &mut Frame, loading: char, frame_index: usize) {
+fn draw_frame(
+    state: &UIState,
+    f: &mut Frame,
+    loading: char,
+    frame_index: usize,
+    rows: &mut HashMap<PathBuf, EvaluationRow>,
+) {
     let size = f.area();
     if size.width < 16 || size.height < 16 {
         let error = Span::styled("Too small", Style::default().add_modifier(Modifier::BOLD));
@@ -129,7 +152,7 @@ fn draw_frame(state: &UIState, f: &mut Frame, loading: char, frame_index: usize)
     }
     if !state.evaluations.is_empty() {
         render_block(f, chunks[4], " Evaluations ");
-        draw_evaluations(f, inner_block(chunks[4]), state, loading);
+        draw_evaluations(f, inner_block(chunks[4]), state, loading, rows);
     }
     render_server_status(
         f,
@@ -231,8 +254,14 @@ fn generation_status_text(status: &TestcaseGenerationStatus, loading: char) -> S
     }
 }
 
-/// Draw the content of the evaluation box.
-fn draw_evaluations(frame: &mut Frame, rect: Rect, state: &UIState, loading: char) {
+/// Draw the content of the evaluation box, reusing the rows of the solutions that did not change.
+fn draw_evaluations(
+    frame: &mut Frame,
+    rect: Rect,
+    state: &UIState,
+    loading: char,
+    rows: &mut HashMap<PathBuf, EvaluationRow>,
+) {
     let max_len = state
         .evaluations
         .keys()
@@ -259,8 +288,23 @@ fn draw_evaluations(frame: &mut Frame, rect: Rect, state: &UIState, loading: cha
                 spans.push(Span::raw("    "));
             }
             spans.push(Span::raw(" "));
-            spans.push(evaluation_score(state, solution, loading));
-            spans.append(&mut evaluation_line(state, solution, loading));
+            let eval = &state.evaluations[solution];
+            // the finished solutions don't show the loading character
+            let row_loading = eval.score.is_none().then_some(loading);
+            let row = rows
+                .get(solution)
+                .filter(|row| row.version == eval.version && row.loading == row_loading);
+            if row.is_none() {
+                let mut row_spans = vec![evaluation_score(state, solution, loading)];
+                row_spans.append(&mut evaluation_line(state, solution, loading));
+                let row = EvaluationRow {
+                    version: eval.version,
+                    loading: row_loading,
+                    spans: row_spans,
+                };
+                rows.insert(solution.clone(), row);
+            }
+            spans.extend(rows[solution].spans.iter().cloned());
             spans.into()
         })
         .collect();
@@ -269,7 +313,7 @@ fn draw_evaluations(frame: &mut Frame, rect: Rect, state: &UIState, loading: cha
 }
 
 /// Get the colored score of a solution.
-fn evaluation_score<'a>(state: &'a UIState, solution: &Path, loading: char) -> Span<'a> {
+fn evaluation_score(state: &UIState, solution: &Path, loading: char) -> Span<'static> {
     let sol_state = if let Some(state) = state.evaluations.get(solution) {
         state
     } else {
@@ -295,7 +339,7 @@ fn evaluation_score<'a>(state: &'a UIState, solution: &Path, loading: char) -> S
 }
 
 /// Get the line at the right of the score of a solution.
-fn evaluation_line<'a>(state: &'a UIState, solution: &Path, loading: char) -> Vec<Span<'a>> {
+fn evaluation_line(state: &UIState, solution: &Path, loading: char) -> Vec<Span<'static>> {
     state
         .task
         .subtasks
@@ -307,12 +351,12 @@ fn evaluation_line<'a>(state: &'a UIState, solution: &Path, loading: char) -> Ve
 
 /// Get the status of a subtask, like `[AATTR]` where each letter corresponds to
 /// the status of a single testcase.
-fn subtask_evaluation_status_text<'a>(
-    state: &'a UIState,
+fn subtask_evaluation_status_text(
+    state: &UIState,
     solution: &Path,
     subtask_id: SubtaskId,
     loading: char,
-) -> Vec<Span<'a>> {
+) -> Vec<Span<'static>> {
     let mut texts = vec![];
     let solution = &state.evaluations[solution];
     if !solution.subtasks.contains_key(&subtask_id) {
@@ -338,11 +382,11 @@ fn subtask_evaluation_status_text<'a>(
 }
 
 /// Get the colored character corresponding to the status of the evaluation of a testcase.
-fn testcase_evaluation_status_text<'a>(
-    testcase: &'a SolutionTestcaseEvaluationState,
+fn testcase_evaluation_status_text(
+    testcase: &SolutionTestcaseEvaluationState,
     loading: char,
-    state: &'a UIState,
-) -> Span<'a> {
+    state: &UIState,
+) -> Span<'static> {
     let time_limit = state.task.time_limit;
     let memory_limit = state.task.memory_limit;
     let extra_time = state.config.extra_time;
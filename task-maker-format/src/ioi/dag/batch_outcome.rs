@@ -0,0 +1,105 @@
+use std::sync::{Arc, Mutex};
+
+use anyhow::Error;
+use task_maker_dag::{Execution, ExecutionCommand, File, FileUuid, Priority};
+use task_maker_diagnostics::Diagnostic;
+
+use crate::ioi::{TestcaseId, GENERATION_PRIORITY, STDERR_CONTENT_LENGTH};
+use crate::ui::{UIExecutionStatus, UIMessage};
+use crate::{EvaluationData, Tag, UISender};
+
+/// The outcome written by an execution with a batch protocol for an input file that it handled
+/// successfully.
+pub(crate) const BATCH_OK_OUTCOME: &str = "ok";
+
+/// The checks of the outcomes written by an execution that generates or validates many input files
+/// with a batch protocol. For each input file the execution writes `ok`, or the reason of the
+/// failure. The outcome is compared with `ok` by the worker itself, without spawning a sandbox, so
+/// that a failure blocks only the testcase of that input file. The sandbox creates the outputs
+/// before starting the execution, so an outcome that is not written is empty, and it's a failure.
+pub(crate) struct OutcomeChecks {
+    /// The file with the outcome of a successful input file.
+    ok: File,
+}
+
+impl OutcomeChecks {
+    /// Make the checks of the outcomes of a new batch execution.
+    pub(crate) fn new() -> OutcomeChecks {
+        OutcomeChecks {
+            ok: File::new("Outcome of a successful input file"),
+        }
+    }
+
+    /// Add to the DAG the check of the outcome of an input file, returning a handle that is
+    /// produced only if the outcome is `ok`. The check also waits for `wait_for`, if any.
+    ///
+    /// The UI messages of the input file are made by `message`, and `diagnostic` is emitted when
+    /// the check fails, with the outcome attached. The execution itself sends only when it starts,
+    /// since its result is shared by all the input files.
+    #[allow(clippy::too_many_arguments)]
+    pub(crate) fn check_and_bind<F>(
+        &self,
+        eval: &mut EvaluationData,
+        description: String,
+        testcase_id: TestcaseId,
+        outcome: &File,
+        wait_for: Option<FileUuid>,
+        message: F,
+        diagnostic: Diagnostic,
+    ) -> Result<FileUuid, Error>
+    where
+        F: Fn(UIExecutionStatus) -> UIMessage + Copy + Send + 'static,
+    {
+        // the outcome is needed as soon as it's written, for the result of the check
+        let reason = Arc::new(Mutex::new(Vec::new()));
+        eval.dag.urgent_file(outcome);
+        let content = reason.clone();
+        eval.dag
+            .get_file_content(outcome, STDERR_CONTENT_LENGTH, move |outcome| {
+                *content.lock().unwrap() = outcome;
+                Ok(())
+            });
+
+        let (correct, test) = ("correct".into(), "test".into());
+        let mut check = Execution::new(description, ExecutionCommand::WhiteDiff { correct, test });
+        check
+            .input(&self.ok, "correct", false)
+            .input(outcome, "test", false);
+        if let Some(wait_for) = wait_for {
+            check.input(wait_for, "wait_for", false);
+        }
+        let handle = check.capture_stdout(None);
+        let mut group = check.into_group();
+        group.tag = Some(Tag::Generation.into());
+        group.priority = GENERATION_PRIORITY - testcase_id as Priority;
+
+        eval.sender.send(message(UIExecutionStatus::Pending))?;
+        let sender = eval.sender.clone();
+        eval.dag.on_execution_skip(&group.uuid, move || {
+            sender.send(message(UIExecutionStatus::Skipped))
+        });
+        let sender = eval.sender.clone();
+        eval.dag.on_execution_done(&group.uuid, move |results| {
+            let mut result = results[0].clone();
+            if !result.status.is_success() {
+                let mut reason = std::mem::take(&mut *reason.lock().unwrap());
+                if reason.trim_ascii().is_empty() {
+                    reason = b"The outcome was not written".to_vec();
+                }
+                result.stderr = Some(reason.clone());
+                sender.add_diagnostic(diagnostic.with_help_attachment(reason))?;
+            }
+            sender.send(message(UIExecutionStatus::Done {
+                result: vec![result],
+            }))
+        });
+        eval.dag.add_execution_group(group);
+        Ok(handle.uuid)
+    }
+
+    /// Provide to the DAG the file compared with the outcomes.
+    pub(crate) fn bind(self, eval: &mut EvaluationData) {
+        let ok = BATCH_OK_OUTCOME.as_bytes().to_vec();
+        eval.dag.provide_content(self.ok, ok);
+    }
+}
@@ -1,15 +1,95 @@
 use std::path::PathBuf;
+use std::sync::atomic::{AtomicBool, Ordering};
 use std::sync::Arc;
 
-use anyhow::{anyhow, Context, Error};
+use anyhow::{anyhow, bail, Context, Error};
 use serde::{Deserialize, Serialize};
-use task_maker_dag::{Execution, ExecutionCommand, ExecutionStatus, FileUuid, Priority};
+use task_maker_dag::{
+    Execution, ExecutionCommand, ExecutionGroupUuid, ExecutionStatus, File, FileUuid, Priority,
+    TokenDiffOptions,
+};
 use task_maker_diagnostics::Diagnostic;
 
 use crate::ioi::{SubtaskId, TestcaseId, EVALUATION_PRIORITY, STDERR_CONTENT_LENGTH};
-use crate::ui::UIMessage;
+use crate::ui::{UIExecutionStatus, UIMessage};
 use crate::{bind_exec_callbacks, EvaluationData, SourceFile, Tag, UISender};
 
+/// Name of the header with the I/O helpers that is made available to the compilation of the
+/// custom checkers.
+pub const CHECKER_LIB_NAME: &str = "checker_lib.h";
+/// Content of the header with the I/O helpers for the custom checkers.
+const CHECKER_LIB: &[u8] = include_bytes!("checker/checker_lib.h");
+
+/// Maximum length of the line with the score printed by the checker, excluding the message.
+const SCORE_LINE_LENGTH: usize = 128;
+
+/// Callback called with the score and the message of the checker on a testcase.
+type CheckerCallback = Box<dyn FnOnce(f64, String) -> Result<(), Error> + Send + Sync + 'static>;
+
+/// A check of an output file of a solution, delayed until all the outputs of the solution are
+/// known so that they can be checked by a single execution of the checker.
+struct BatchedCheck {
+    /// The subtask of the testcase.
+    subtask_id: SubtaskId,
+    /// The testcase to check.
+    testcase_id: TestcaseId,
+    /// The input file of the testcase.
+    input: FileUuid,
+    /// The correct output file of the testcase.
+    correct_output: FileUuid,
+    /// The output file of the solution.
+    test_output: FileUuid,
+    /// The evaluation of the solution that produces the output file.
+    evaluation: ExecutionGroupUuid,
+    /// The callback to call with the outcome of the checker.
+    callback: CheckerCallback,
+}
+
+/// The checks of the outputs of a solution, done by a single execution of a checker that supports
+/// the batch protocol. See [`Checker::check_batch_and_bind`].
+pub(crate) struct CheckerBatch {
+    /// The solution whose outputs are checked.
+    solution: PathBuf,
+    /// The checks to do.
+    checks: Vec<BatchedCheck>,
+}
+
+impl CheckerBatch {
+    /// Make a new empty batch of checks for the outputs of a solution.
+    pub(crate) fn new<S: Into<PathBuf>>(solution: S) -> CheckerBatch {
+        CheckerBatch {
+            solution: solution.into(),
+            checks: Vec::new(),
+        }
+    }
+
+    /// Add to the batch the check of an output file, produced by the `evaluation` of the solution.
+    /// `callback` will be called with the outcome of the checker, only if the evaluation succeeded.
+    #[allow(clippy::too_many_arguments)]
+    pub(crate) fn push<F>(
+        &mut self,
+        subtask_id: SubtaskId,
+        testcase_id: TestcaseId,
+        input: FileUuid,
+        correct_output: FileUuid,
+        test_output: FileUuid,
+        evaluation: ExecutionGroupUuid,
+        callback: F,
+    ) where
+        F: FnOnce(f64, String) -> Result<(), Error> + Send + Sync + 'static,
+    {
+        self.checks.push(BatchedCheck {
+            subtask_id,
+            testcase_id,
+            input,
+            correct_output,
+            test_output,
+            evaluation,
+            callback: Box::new(callback),
+        });
+    }
+}
+
 /// Which tool to use to compute the score on a testcase given the input file, the _correct_ output
 /// file and the output file to evaluate.
 #[derive(Debug, Clone, Serialize, Deserialize)]
@@ -17,6 +97,10 @@ pub enum Checker {
     /// Use a built-in white diff checker that scores 1.0 if the two output files are identical
     /// except for white spaces. It internally uses `diff --ignore-all-spaces`
     WhiteDiff,
+    /// Use a built-in checker that scores 1.0 if the two output files have the same tokens,
+    /// compared with the specified rules (ignoring the case, or with a tolerance on the numbers).
+    /// Like `WhiteDiff`, it's done by the worker itself without spawning a process.
+    TokenDiff(TokenDiffOptions),
     /// Use a custom checker based on an executable that can output a score (from 0.0 to 1.0) to
     /// stdout as well as a custom message on stderr.
     ///
@@ -44,18 +128,20 @@ impl Checker {
         F: FnOnce(f64, String) -> Result<(), Error> + Send + Sync + 'static,
     {
         match self {
-            Checker::WhiteDiff => {
-                let mut exec = Execution::new(description, ExecutionCommand::system("diff"));
-                exec.args(vec![
-                    "--brief",
-                    "--speed-large-files",
-                    "--ignore-blank-lines",
-                    "--ignore-space-change",
-                    "correct",
-                    "test",
-                ])
-                .input(correct_output, "correct", false)
-                .input(test_output, "test", false);
+            Checker::WhiteDiff | Checker::TokenDiff(_) => {
+                // The comparison is done by the worker itself, without spawning a sandbox.
+                let (correct, test) = ("correct".into(), "test".into());
+                let command = match self {
+                    Checker::TokenDiff(options) => ExecutionCommand::TokenDiff {
+                        correct,
+                        test,
+                        options: *options,
+                    },
+                    _ => ExecutionCommand::WhiteDiff { correct, test },
+                };
+                let mut exec = Execution::new(description, command);
+                exec.input(correct_output, "correct", false)
+                    .input(test_output, "test", false);
                 let mut group = exec.into_group();
                 group.tag = Some(Tag::Checking.into());
                 group.priority = EVALUATION_PRIORITY - testcase_id.unwrap_or_default() as Priority;
@@ -63,7 +149,7 @@ impl Checker {
                 eval.dag.on_execution_done(&group.uuid, move |results| {
                     let result = &results[0];
                     match result.status {
-                        // diff exits with 0 if the files are equal
+                        // the comparison succeeds if the files are equal
                         ExecutionStatus::Success => callback(1.0, "Output is correct".into())
                             .context("Checker callback failed")?,
                         // return code 1 means the files are different
@@ -71,7 +157,7 @@ impl Checker {
                             callback(0.0, "Output is incorrect".into())
                                 .context("Checker callback failed")?
                         }
-                        _ => unreachable!("diff died badly? {:?}", result),
+                        _ => unreachable!("built-in diff died badly? {:?}", result),
                     };
                     Ok(())
                 });
@@ -224,6 +310,204 @@ impl Checker {
         Ok(())
     }
 
+    /// Add to the DAG a single execution of the checker that checks all the outputs in the batch,
+    /// binding the callbacks for sending to the UI the messages of every testcase as well as
+    /// calling their callbacks with the outcome of the checker.
+    ///
+    /// The checker is run with the only argument `--batch`, and reads from stdin one line for each
+    /// testcase with the paths of the input file, of the correct output and of the output to
+    /// check, separated by a space. For each line, in order, it prints to stdout a line with the
+    /// score, followed by a space and by the message for the user.
+    ///
+    /// The evaluations that failed don't stop the checker: it gets an empty output in their place,
+    /// and its outcome on them is ignored since those testcases are scored by the evaluation.
+    pub(crate) fn check_batch_and_bind(
+        &self,
+        eval: &mut EvaluationData,
+        batch: CheckerBatch,
+    ) -> Result<(), Error> {
+        if batch.checks.is_empty() {
+            return Ok(());
+        }
+        let Checker::Custom(source_file) = self else {
+            bail!("Only the custom checkers support the batch protocol");
+        };
+        let solution = batch.solution;
+        let solution_name = solution.file_name().unwrap().to_owned();
+        let description = format!(
+            "Checking the outputs of {:?} of {} testcases",
+            solution_name,
+            batch.checks.len()
+        );
+        let mut exec = source_file
+            .execute(eval, &description, vec!["--batch"])
+            .context("Failed to execute checker source file")?;
+        let mut list = String::new();
+        for (i, check) in batch.checks.iter().enumerate() {
+            let input = format!("input_{i}");
+            let correct_output = format!("correct_output_{i}");
+            let test_output = format!("test_output_{i}");
+            exec.input(check.input, &input, false)
+                .input(check.correct_output, &correct_output, false)
+                .optional_input(check.test_output, &test_output, false);
+            list += &format!("{input} {correct_output} {test_output}\n");
+        }
+        let list_file = File::new(format!("List of the outputs of {solution_name:?} to check"));
+        exec.stdin(&list_file);
+        eval.dag.provide_content(list_file, list.into_bytes());
+        exec.capture_stdout(Some(
+            (SCORE_LINE_LENGTH + STDERR_CONTENT_LENGTH) * batch.checks.len(),
+        ));
+        exec.capture_stderr(Some(STDERR_CONTENT_LENGTH));
+        exec.limits_mut().allow_multiprocess();
+        let mut group = exec.into_group();
+        group.tag = Some(Tag::Checking.into());
+        // The checker is ready only after all the evaluations of the solution are done.
+        group.priority = EVALUATION_PRIORITY;
+
+        // The checker starts only after all the evaluations are done, so at that point it's known
+        // which outputs it has to check. The others are reported to the UI as skipped, like the
+        // checkers of the failed evaluations when they are checked one by one.
+        let mut checks = Vec::with_capacity(batch.checks.len());
+        let mut callbacks = Vec::with_capacity(batch.checks.len());
+        for check in batch.checks {
+            let succeeded = Arc::new(AtomicBool::new(false));
+            let evaluation_succeeded = succeeded.clone();
+            eval.dag
+                .on_execution_done(&check.evaluation, move |results| {
+                    let success = results.iter().all(|r| r.status.is_success());
+                    evaluation_succeeded.store(success, Ordering::SeqCst);
+                    Ok(())
+                });
+            eval.sender.send(UIMessage::IOIChecker {
+                subtask: check.subtask_id,
+                testcase: check.testcase_id,
+                solution: solution.clone(),
+                status: UIExecutionStatus::Pending,
+            })?;
+            checks.push((check.subtask_id, check.testcase_id, succeeded.clone()));
+            callbacks.push((check.testcase_id, succeeded, check.callback));
+        }
+        let checks = Arc::new(checks);
+        let send_status = {
+            let sender = eval.sender.clone();
+            let solution = solution.clone();
+            let checks = checks.clone();
+            move |status: UIExecutionStatus| -> Result<(), Error> {
+                for (subtask_id, testcase_id, succeeded) in checks.iter() {
+                    let status = if succeeded.load(Ordering::SeqCst) {
+                        status.clone()
+                    } else {
+                        UIExecutionStatus::Skipped
+                    };
+                    sender.send(UIMessage::IOIChecker {
+                        subtask: *subtask_id,
+                        testcase: *testcase_id,
+                        solution: solution.clone(),
+                        status,
+                    })?;
+                }
+                Ok(())
+            }
+        };
+        let send_start = send_status.clone();
+        eval.dag.on_execution_start(&group.uuid, move |worker| {
+            send_start(UIExecutionStatus::Started { worker })
+        });
+        let send_done = send_status.clone();
+        eval.dag.on_execution_done(&group.uuid, move |result| {
+            send_done(UIExecutionStatus::Done {
+                result: result.to_vec(),
+            })
+        });
+        eval.dag
+            .on_execution_skip(&group.uuid, move || send_status(UIExecutionStatus::Skipped));
+        let sender = eval.sender.clone();
+        eval.dag.on_execution_done(&group.uuid, move |results| {
+            let res = &results[0];
+            let stdout = res
+                .stdout
+                .as_ref()
+                .ok_or_else(|| anyhow!("Checker stdout not captured"))?;
+            let stderr = res
+                .stderr
+                .as_ref()
+                .ok_or_else(|| anyhow!("Checker stderr not captured"))?;
+            if !res.status.is_success() {
+                let diagnostic = Diagnostic::error(format!(
+                    "Checker failed while computing the scores of {solution_name:?}"
+                ))
+                .with_note(description)
+                .with_help(format!("The checker crashed with: {:?}", res.status))
+                .with_help_attachment(stderr.clone());
+                sender.add_diagnostic(diagnostic)?;
+                return Ok(());
+            }
+            let Ok(stdout) = str::from_utf8(stdout) else {
+                let diagnostic = Diagnostic::error("The checker returned a non UTF-8 output")
+                    .with_note(description)
+                    .with_help_attachment(stdout.clone());
+                sender.add_diagnostic(diagnostic)?;
+                return Ok(());
+            };
+            let mut lines = stdout.lines();
+            for (testcase_id, succeeded, callback) in callbacks {
+                let line = lines.next();
+                if !succeeded.load(Ordering::SeqCst) {
+                    continue;
+                }
+                let Some(line) = line else {
+                    let diagnostic = Diagnostic::error(format!(
+                        "Checker did not print the score for testcase {testcase_id}"
+                    ))
+                    .with_note(description.clone())
+                    .with_help_attachment(stderr.clone());
+                    sender.add_diagnostic(diagnostic)?;
+                    continue;
+                };
+                let (score, message) = line.split_once(' ').unwrap_or((line, ""));
+                let score = match score.trim().parse::<f64>() {
+                    Ok(score) => score,
+                    Err(e) => {
+                        let diagnostic = Diagnostic::error(format!(
+                            "Checker returned an invalid score ({score:?}) for testcase {testcase_id}"
+                        ))
+                        .with_note(description.clone())
+                        .with_help(format!("The parse error is: {e:?}"));
+                        sender.add_diagnostic(diagnostic)?;
+                        continue;
+                    }
+                };
+                let message = Self::translate_checker_message(message.trim().to_string());
+                if !Self::is_unicode_printable(&message) {
+                    let diagnostic = Diagnostic::error(format!(
+                        "The checker returned a non printable message ({message}) for testcase {testcase_id}"
+                    ))
+                    .with_note(description.clone());
+                    sender.add_diagnostic(diagnostic)?;
+                    continue;
+                }
+                callback(score, message)?;
+            }
+            Ok(())
+        });
+        eval.dag.add_execution_group(group);
+        Ok(())
+    }
+
+    /// Make `checker_lib.h` available to the compilation of a custom checker, unless the task
+    /// already has a file with that name next to the checker.
+    pub(crate) fn add_checker_lib(source: &mut SourceFile) {
+        if source.path.with_file_name(CHECKER_LIB_NAME).exists() {
+            debug!(
+                "Not providing {CHECKER_LIB_NAME} to {}, the task has its own",
+                source.name()
+            );
+            return;
+        }
+        source.add_compilation_file(CHECKER_LIB_NAME, CHECKER_LIB);
+    }
+
     /// Checks that a string is a printable message without control characters.
     fn is_unicode_printable(s: &str) -> bool {
         s.chars().all(|c| !c.is_control() || c.is_whitespace())
@@ -0,0 +1,268 @@
+// Fast I/O helpers for the checkers, made available by task-maker to all the
+// C and C++ checkers: just #include "checker_lib.h".
+//
+// The files are mapped in memory and parsed in place, which is much faster than
+// reading them with iostreams or scanf when they have millions of tokens.
+//
+// Example:
+//
+//   tm_file out;
+//   tm_open(&out, argv[3]);
+//   long long answer;
+//   if (!tm_read_int(&out, &answer)) tm_wrong("Invalid answer");
+//   if (!tm_eof(&out)) tm_wrong("Too much output");
+//   tm_accept();
+
+#ifndef TM_CHECKER_LIB_H
+#define TM_CHECKER_LIB_H
+
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// A file opened for reading with tm_open.
+typedef struct {
+  // The content of the file.
+  const char *data;
+  // The size of the file.
+  size_t size;
+  // The position of the next character to read.
+  size_t pos;
+  // Whether data has been mapped in memory (otherwise it has been malloc-ed).
+  int mapped;
+} tm_file;
+
+#ifdef __GNUC__
+#define TM_NORETURN __attribute__((noreturn))
+#define TM_FORMAT(a, b) __attribute__((format(printf, a, b)))
+#else
+#define TM_NORETURN
+#define TM_FORMAT(a, b)
+#endif
+
+// Print the score to stdout and the message to stderr and exit. The message is
+// a printf-like format string.
+static inline TM_NORETURN TM_FORMAT(2, 3) void
+tm_score(double score, const char *message, ...) {
+  va_list args;
+  va_start(args, message);
+  vfprintf(stderr, message, args);
+  va_end(args);
+  fprintf(stderr, "\n");
+  printf("%f\n", score);
+  fflush(stdout);
+  fflush(stderr);
+  exit(0);
+}
+
+// Give full score with the standard message.
+static inline TM_NORETURN void tm_accept(void) {
+  tm_score(1.0, "translate:success");
+}
+
+// Give a partial score with the standard message.
+static inline TM_NORETURN void tm_partial(double score) {
+  tm_score(score, "translate:partial");
+}
+
+// Give zero points. Without a message the standard one is used.
+static inline TM_NORETURN TM_FORMAT(1, 2) void
+tm_wrong(const char *message, ...) {
+  if (!message || !*message)
+    tm_score(0.0, "translate:wrong");
+  va_list args;
+  va_start(args, message);
+  vfprintf(stderr, message, args);
+  va_end(args);
+  fprintf(stderr, "\n");
+  printf("%f\n", 0.0);
+  fflush(stdout);
+  fflush(stderr);
+  exit(0);
+}
+
+// Print a message to stderr and exit with a failure: to be used when the
+// official files are broken, not for wrong contestant outputs.
+static inline TM_NORETURN TM_FORMAT(1, 2) void
+tm_fail(const char *message, ...) {
+  va_list args;
+  va_start(args, message);
+  fprintf(stderr, "Checker failure: ");
+  vfprintf(stderr, message, args);
+  va_end(args);
+  fprintf(stderr, "\n");
+  exit(1);
+}
+
+// Open the file at path, exiting with tm_fail if it cannot be read. Regular
+// files are mapped in memory, the others (e.g. pipes) are read completely.
+static inline void tm_open(tm_file *file, const char *path) {
+  file->data = NULL;
+  file->size = 0;
+  file->pos = 0;
+  file->mapped = 0;
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    tm_fail("cannot open %s", path);
+  struct stat st;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+    file->size = st.st_size;
+    if (file->size == 0) {
+      close(fd);
+      file->data = "";
+      return;
+    }
+    void *data = mmap(NULL, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data != MAP_FAILED) {
+#ifdef MADV_SEQUENTIAL
+      madvise(data, file->size, MADV_SEQUENTIAL);
+#endif
+      close(fd);
+      file->data = (const char *)data;
+      file->mapped = 1;
+      return;
+    }
+  }
+  size_t capacity = 1 << 16;
+  char *buffer = (char *)malloc(capacity);
+  for (;;) {
+    if (!buffer)
+      tm_fail("out of memory reading %s", path);
+    ssize_t len = read(fd, buffer + file->size, capacity - file->size);
+    if (len < 0)
+      tm_fail("cannot read %s", path);
+    if (len == 0)
+      break;
+    file->size += len;
+    if (file->size == capacity) {
+      capacity *= 2;
+      buffer = (char *)realloc(buffer, capacity);
+    }
+  }
+  close(fd);
+  file->data = buffer;
+}
+
+// Release the memory of a file.
+static inline void tm_close(tm_file *file) {
+  if (file->mapped)
+    munmap((void *)file->data, file->size);
+  else if (file->size > 0)
+    free((void *)file->data);
+  file->data = NULL;
+  file->size = file->pos = 0;
+}
+
+static inline int tm_is_space(char c) {
+  return c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == '\v' ||
+         c == '\f';
+}
+
+// Skip the whitespaces, returning zero if the end of the file is reached.
+static inline int tm_skip_spaces(tm_file *file) {
+  while (file->pos < file->size && tm_is_space(file->data[file->pos]))
+    file->pos++;
+  return file->pos < file->size;
+}
+
+// Whether only whitespaces are left in the file.
+static inline int tm_eof(tm_file *file) { return !tm_skip_spaces(file); }
+
+// Read the next whitespace-separated token. The token is not NUL-terminated,
+// its length is stored in len. Returns zero at the end of the file.
+static inline int tm_read_token(tm_file *file, const char **token,
+                                size_t *len) {
+  if (!tm_skip_spaces(file))
+    return 0;
+  size_t start = file->pos;
+  while (file->pos < file->size && !tm_is_space(file->data[file->pos]))
+    file->pos++;
+  *token = file->data + start;
+  *len = file->pos - start;
+  return 1;
+}
+
+// Read the next token as a signed 64-bit integer. Returns zero if the token is
+// missing, is not an integer or does not fit.
+static inline int tm_read_int(tm_file *file, long long *value) {
+  const char *token;
+  size_t len;
+  if (!tm_read_token(file, &token, &len))
+    return 0;
+  size_t i = 0;
+  int negative = 0;
+  if (token[0] == '-' || token[0] == '+') {
+    negative = token[0] == '-';
+    i++;
+  }
+  if (i == len)
+    return 0;
+  unsigned long long result = 0;
+  const unsigned long long max = (unsigned long long)1 << 63;
+  const unsigned long long limit = negative ? max : max - 1;
+  for (; i < len; i++) {
+    unsigned digit = (unsigned)(token[i] - '0');
+    if (digit > 9)
+      return 0;
+    if (result > (limit - digit) / 10)
+      return 0;
+    result = result * 10 + digit;
+  }
+  *value = negative ? (long long)(0 - result) : (long long)result;
+  return 1;
+}
+
+// Read the next token as a floating point number. Returns zero if the token is
+// missing or it is not a number. Simple decimals are parsed directly, the
+// others (exponents, many digits, nan, inf...) with strtod.
+static inline int tm_read_double(tm_file *file, double *value) {
+  static const double powers[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,
+                                  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                                  1e12, 1e13, 1e14, 1e15, 1e16, 1e17,
+                                  1e18, 1e19, 1e20, 1e21, 1e22};
+  const char *token;
+  size_t len;
+  if (!tm_read_token(file, &token, &len))
+    return 0;
+  size_t i = 0;
+  int negative = 0;
+  if (token[0] == '-' || token[0] == '+') {
+    negative = token[0] == '-';
+    i++;
+  }
+  unsigned long long mantissa = 0;
+  int digits = 0, decimals = 0, dot = 0, simple = i < len;
+  for (; i < len && simple; i++) {
+    if (token[i] == '.' && !dot) {
+      dot = 1;
+    } else if (token[i] >= '0' && token[i] <= '9') {
+      mantissa = mantissa * 10 + (token[i] - '0');
+      digits++;
+      decimals += dot;
+    } else {
+      simple = 0;
+    }
+  }
+  // The mantissa and the power of ten are represented exactly, so a single
+  // division gives the correctly rounded result.
+  if (simple && digits > 0 && digits <= 15 && decimals <= 22) {
+    double result = (double)mantissa / powers[decimals];
+    *value = negative ? -result : result;
+    return 1;
+  }
+  char buffer[512];
+  if (len >= sizeof(buffer))
+    return 0;
+  memcpy(buffer, token, len);
+  buffer[len] = 0;
+  char *end;
+  *value = strtod(buffer, &end);
+  return end == buffer + len;
+}
+
+#endif
@@ -1,3 +1,4 @@
+use std::collections::HashMap;
 use std::path::{Path, PathBuf};
 use std::sync::Arc;
 
@@ -6,10 +7,16 @@ use serde::{Deserialize, Serialize};
 use task_maker_dag::{Execution, File, FileUuid, Priority};
 use task_maker_diagnostics::Diagnostic;
 
+use crate::ioi::dag::batch_outcome::OutcomeChecks;
 use crate::ioi::{SubtaskId, TestcaseId, GENERATION_PRIORITY, STDERR_CONTENT_LENGTH};
-use crate::ui::UIMessage;
+use crate::ui::{UIExecutionStatus, UIMessage};
 use crate::{bind_exec_callbacks, EvaluationData, SourceFile, Tag, UISender};
 
+/// The maximum number of input files generated by a single execution of a `GeneratorBatch`. The
+/// batches are limited so that the generation can still be split between the workers, and so that
+/// changing a testcase does not generate again all the others.
+const GENERATOR_BATCH_SIZE: usize = 64;
+
 /// The source of the input files. It can either be a statically provided input file or a custom
 /// command that will generate an input file.
 #[derive(Debug, Clone, Serialize, Deserialize)]
@@ -51,25 +58,8 @@ impl InputGenerator {
                 Ok((uuid, None))
             }
             InputGenerator::Custom(source_file, args) => {
-                let mut exec = source_file
-                    .execute(eval, description, args.clone())
-                    .context("Failed to execute generator source file")?;
-
-                exec.limits_mut().allow_multiprocess();
-
-                // Add limiti.yaml and constraints.yaml file to the sandbox of the generator
-                for filename in &["limiti.yaml", "constraints.yaml"] {
-                    let path = task_path.join("gen").join(filename);
-
-                    if !path.is_file() {
-                        continue;
-                    }
-
-                    let file = File::new(format!("Constraints file at {}", path.display()));
-                    exec.input(&file, filename, false);
-                    eval.dag.provide_file(file, path)?;
-                }
-
+                let mut exec =
+                    generator_execution(eval, task_path, source_file, description, args.clone())?;
                 let stdout = exec.capture_stdout(None);
                 Ok((stdout.uuid, Some(exec)))
             }
@@ -92,13 +82,7 @@ impl InputGenerator {
             subtask_id,
             testcase_id,
         )?;
-        eval.dag.write_file_to(
-            input,
-            eval.task_root
-                .join("input")
-                .join(format!("input{testcase_id}.txt")),
-            false,
-        );
+        write_input_file(eval, input, testcase_id);
         // If there is an execution, bind its callbacks and store the input file.
         if let Some(mut gen) = gen {
             gen.capture_stderr(Some(STDERR_CONTENT_LENGTH));
@@ -130,3 +114,234 @@ impl InputGenerator {
         Ok(input)
     }
 }
+
+/// Store the generated input file of the testcase inside the `input/` folder of the task.
+fn write_input_file(eval: &mut EvaluationData, input: FileUuid, testcase_id: TestcaseId) {
+    eval.dag.write_file_to(
+        input,
+        eval.task_root
+            .join("input")
+            .join(format!("input{testcase_id}.txt")),
+        false,
+    );
+}
+
+/// Build an execution of the generator with the specified arguments, with the constraint files of
+/// the task in its sandbox.
+fn generator_execution(
+    eval: &mut EvaluationData,
+    task_path: &Path,
+    source_file: &SourceFile,
+    description: String,
+    args: Vec<String>,
+) -> Result<Execution, Error> {
+    let mut exec = source_file
+        .execute(eval, description, args)
+        .context("Failed to execute generator source file")?;
+
+    exec.limits_mut().allow_multiprocess();
+
+    // Add limiti.yaml and constraints.yaml file to the sandbox of the generator
+    for filename in &["limiti.yaml", "constraints.yaml"] {
+        let path = task_path.join("gen").join(filename);
+
+        if !path.is_file() {
+            continue;
+        }
+
+        let file = File::new(format!("Constraints file at {}", path.display()));
+        exec.input(&file, filename, false);
+        eval.dag.provide_file(file, path)?;
+    }
+    Ok(exec)
+}
+
+/// A generation of an input file done by an execution of a `GeneratorBatch`.
+struct BatchedGeneration {
+    /// The subtask of the testcase.
+    subtask_id: SubtaskId,
+    /// The testcase to generate.
+    testcase_id: TestcaseId,
+}
+
+/// An execution of a generator that generates many input files.
+struct GeneratorExecution {
+    /// The execution of the generator.
+    exec: Execution,
+    /// The checks of the outcomes of the input files.
+    checks: OutcomeChecks,
+    /// The arguments of the generator for each input file, one per line.
+    list: String,
+    /// The input files generated by the execution, in the order of the lines of `list`.
+    generations: Vec<BatchedGeneration>,
+}
+
+/// The generation of many input files with few executions of the generators that support the
+/// batch protocol.
+///
+/// The generator is run with the single argument `--batch`, and reads from stdin one line for each
+/// input file, with the arguments it would receive for generating only that file, quoted like in a
+/// shell. Instead of printing the input file to stdout, it writes the file of the `i`-th line
+/// (starting from zero) to `input_i`, and then `ok` to `outcome_i`, or only the reason of the
+/// failure if it cannot generate that file. It exits with a non-zero code only if it cannot
+/// generate any file. The outcomes are checked by `OutcomeChecks`, so a failure blocks only its own
+/// testcase.
+///
+/// Each input file is still a separate file of the DAG, and each execution generates at most
+/// `GENERATOR_BATCH_SIZE` of them. The executions are split after the files whose arguments have
+/// a hash with some value, so that adding or changing a line of `cases.gen` changes only the
+/// executions around that line, and the others are still in the cache.
+pub(crate) struct GeneratorBatch {
+    /// The executions that are still accepting new input files, by the path of the generator.
+    pending: HashMap<PathBuf, GeneratorExecution>,
+    /// The executions that are full, ready to be added to the DAG.
+    full: Vec<GeneratorExecution>,
+}
+
+impl GeneratorBatch {
+    /// Make a new empty batch of generations.
+    pub(crate) fn new() -> GeneratorBatch {
+        GeneratorBatch {
+            pending: HashMap::new(),
+            full: Vec::new(),
+        }
+    }
+
+    /// Add to the batch the generation of the input file with `generator`, returning the handle to
+    /// the input file, like `InputGenerator::generate_and_bind`, and the handle that is produced
+    /// only if the generation succeeds, which has to be waited for before using the input. The
+    /// static input files are just provided to the DAG.
+    pub(crate) fn generate_and_bind(
+        &mut self,
+        generator: &InputGenerator,
+        eval: &mut EvaluationData,
+        task_path: &Path,
+        subtask_id: SubtaskId,
+        testcase_id: TestcaseId,
+    ) -> Result<(FileUuid, Option<FileUuid>), Error> {
+        let InputGenerator::Custom(source_file, args) = generator else {
+            let input = generator.generate_and_bind(eval, task_path, subtask_id, testcase_id)?;
+            return Ok((input, None));
+        };
+        if !self.pending.contains_key(&source_file.path) {
+            let exec = generator_execution(
+                eval,
+                task_path,
+                source_file,
+                format!(
+                    "Generation of input files with {}",
+                    source_file.path.display()
+                ),
+                vec!["--batch".to_string()],
+            )?;
+            let execution = GeneratorExecution {
+                exec,
+                checks: OutcomeChecks::new(),
+                list: String::new(),
+                generations: Vec::new(),
+            };
+            self.pending.insert(source_file.path.clone(), execution);
+        }
+        let execution = self.pending.get_mut(&source_file.path).unwrap();
+        let index = execution.generations.len();
+        let input = execution.exec.output(format!("input_{index}"));
+        let outcome = execution.exec.output(format!("outcome_{index}"));
+        let args = shell_words::join(args);
+        execution.list += &args;
+        execution.list.push('\n');
+        execution.generations.push(BatchedGeneration {
+            subtask_id,
+            testcase_id,
+        });
+        let handle = execution.checks.check_and_bind(
+            eval,
+            format!("Outcome of the generation of testcase {testcase_id}, subtask {subtask_id}"),
+            testcase_id,
+            &outcome,
+            None,
+            move |status| UIMessage::IOIGeneration {
+                subtask: subtask_id,
+                testcase: testcase_id,
+                status,
+            },
+            Diagnostic::error(format!("Failed to generate input {testcase_id}"))
+                .with_note(format!("Generator arguments are: {args}")),
+        )?;
+        if execution.generations.len() >= GENERATOR_BATCH_SIZE || is_batch_boundary(&args) {
+            let execution = self.pending.remove(&source_file.path).unwrap();
+            self.full.push(execution);
+        }
+        write_input_file(eval, input.uuid, testcase_id);
+        Ok((input.uuid, Some(handle)))
+    }
+
+    /// Add to the DAG the executions of the generators, binding the callbacks for telling the UI
+    /// when they start and for the diagnostics of their failures.
+    pub(crate) fn bind(mut self, eval: &mut EvaluationData) -> Result<(), Error> {
+        self.full.extend(self.pending.into_values());
+        for execution in self.full {
+            GeneratorBatch::bind_execution(eval, execution)?;
+        }
+        Ok(())
+    }
+
+    /// Add to the DAG a single execution of a generator, with its callbacks.
+    fn bind_execution(
+        eval: &mut EvaluationData,
+        execution: GeneratorExecution,
+    ) -> Result<(), Error> {
+        let GeneratorExecution {
+            mut exec,
+            checks,
+            list,
+            generations,
+        } = execution;
+        let list_file = File::new("List of the input files to generate");
+        exec.stdin(&list_file);
+        eval.dag.provide_content(list_file, list.into_bytes());
+        checks.bind(eval);
+        exec.capture_stderr(Some(STDERR_CONTENT_LENGTH));
+        let mut group = exec.into_group();
+        group.tag = Some(Tag::Generation.into());
+        let first_testcase = generations.iter().map(|gen| gen.testcase_id).min();
+        group.priority = GENERATION_PRIORITY - first_testcase.unwrap_or(0) as Priority;
+
+        let sender = eval.sender.clone();
+        eval.dag.on_execution_start(&group.uuid, move |worker| {
+            for gen in &generations {
+                sender.send(UIMessage::IOIGeneration {
+                    subtask: gen.subtask_id,
+                    testcase: gen.testcase_id,
+                    status: UIExecutionStatus::Started { worker },
+                })?;
+            }
+            Ok(())
+        });
+        let sender = eval.sender.clone();
+        eval.dag.on_execution_done(&group.uuid, move |results| {
+            let result = &results[0];
+            if !result.status.is_success() {
+                let mut diagnostic = Diagnostic::error(format!(
+                    "The generator of the input files failed with {:?}",
+                    result.status
+                ));
+                if let Some(stderr) = &result.stderr {
+                    diagnostic = diagnostic.with_help_attachment(stderr.clone());
+                }
+                sender.add_diagnostic(diagnostic)?;
+            }
+            Ok(())
+        });
+        eval.dag.add_execution_group(group);
+        Ok(())
+    }
+}
+
+/// Whether an execution of a `GeneratorBatch` ends after the input file with these arguments. The
+/// boundaries depend only on the arguments, so they don't move when the lines around them change,
+/// and they are on average every half `GENERATOR_BATCH_SIZE` lines.
+fn is_batch_boundary(args: &str) -> bool {
+    let hash = blake3::hash(args.as_bytes());
+    let value = u64::from_le_bytes(hash.as_bytes()[..8].try_into().unwrap());
+    value % (GENERATOR_BATCH_SIZE as u64 / 2) == 0
+}
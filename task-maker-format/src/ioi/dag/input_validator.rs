@@ -6,14 +6,37 @@ use serde::{Deserialize, Serialize};
 use task_maker_dag::{Execution, File, FileUuid, Priority};
 use task_maker_diagnostics::Diagnostic;
 
+use crate::ioi::dag::batch_outcome::OutcomeChecks;
 use crate::ioi::{SubtaskId, TestcaseId, GENERATION_PRIORITY, STDERR_CONTENT_LENGTH};
-use crate::ui::UIMessage;
+use crate::ui::{UIExecutionStatus, UIMessage};
 use crate::{bind_exec_callbacks, EvaluationData, SourceFile, Tag, UISender};
 
 /// The file name of the input file that the `InputValidator` has to validate. This file will be
 /// placed in the current working directory of the validation sandbox.
 pub const TM_VALIDATION_FILE_NAME: &str = "tm_validation_file";
 
+/// The validation of many input files with a single execution of a validator that supports the
+/// batch protocol.
+///
+/// The validator is run with the single argument `--batch`, and reads from stdin one line for each
+/// input file, with the arguments it would receive for validating only that file, quoted like in
+/// a shell. The input files are named `input_0`, `input_1`, ... For each of them it writes to
+/// `outcome_0`, `outcome_1`, ... `ok` if the file is valid, or the reason why it's not. It exits
+/// with a non-zero code only if it cannot validate the files, since then none of them is used.
+/// The `TM_SUBTASK`, `TM_TESTCASE` and `TM_SUBTASK_NAME` variables are not set. The outcomes are
+/// checked by `OutcomeChecks`, so an invalid file blocks only its own testcase.
+pub(crate) struct ValidatorBatch {
+    /// The execution of the validator, with its source file. It's made when the first input file
+    /// is added.
+    exec: Option<(Arc<SourceFile>, Execution)>,
+    /// The checks of the outcomes of the input files.
+    checks: OutcomeChecks,
+    /// The arguments of the validator for each input file, one per line.
+    list: String,
+    /// The testcases of the input files validated by the execution, in the order of `list`.
+    testcases: Vec<(SubtaskId, TestcaseId)>,
+}
+
 /// An input file validator is responsible for checking that the input file follows the format and
 /// constraints defined by the task.
 #[derive(Debug, Clone, Serialize, Deserialize, Default)]
@@ -44,30 +67,14 @@ impl InputValidator {
         match self {
             InputValidator::AssumeValid => Ok((None, None)),
             InputValidator::Custom(source_file, args) => {
-                let mut exec = source_file
-                    .execute(eval, description, args.clone())
-                    .context("Failed to execute validator source file")?;
+                let mut exec =
+                    validator_execution(eval, task_path, source_file, description, args.clone())?;
                 exec.input(input, TM_VALIDATION_FILE_NAME, false)
                     .env("TM_SUBTASK", subtask_id.to_string())
                     .env("TM_TESTCASE", testcase_id.to_string());
                 if let Some(name) = subtask_name {
                     exec.env("TM_SUBTASK_NAME", name);
                 }
-                exec.limits_mut().allow_multiprocess();
-
-                // Add limiti.yaml, constraints.yaml and gen.toml to the sandbox of the validator
-                for filename in &["limiti.yaml", "constraints.yaml", "gen.toml"] {
-                    let path = task_path.join("gen").join(filename);
-
-                    if !path.is_file() {
-                        continue;
-                    }
-
-                    let file = File::new(format!("Constraints file at {}", path.display()));
-                    exec.input(&file, filename, false);
-                    eval.dag.provide_file(file, path)?;
-                }
-
                 let stdout = exec.capture_stdout(None);
 
                 Ok((Some(stdout.uuid), Some(exec)))
@@ -77,7 +84,9 @@ impl InputValidator {
 
     /// Add the validation of the input file to the DAG and the callbacks to the UI, optionally
     /// returning a fake file that blocks the usage of the actual input until the validation
-    /// succeeds. If the validation is ignored, `None` is returned.
+    /// succeeds. The validation waits for `generation`, the handle of a generation that may fail
+    /// after producing the input file, and if the validation is ignored that handle is returned.
+    #[allow(clippy::too_many_arguments)]
     pub(crate) fn validate_and_bind(
         &self,
         eval: &mut EvaluationData,
@@ -86,6 +95,7 @@ impl InputValidator {
         subtask_name: Option<&str>,
         testcase_id: TestcaseId,
         input: FileUuid,
+        generation: Option<FileUuid>,
     ) -> Result<Option<FileUuid>, Error> {
         let (handle, val) = self.validate(
             eval,
@@ -97,6 +107,9 @@ impl InputValidator {
             input,
         )?;
         if let Some(mut val) = val {
+            if let Some(generation) = generation {
+                val.input(generation, "wait_for_generation", false);
+            }
             val.capture_stderr(Some(STDERR_CONTENT_LENGTH));
             let mut group = val.into_group();
             group.tag = Some(Tag::Generation.into());
@@ -122,6 +135,305 @@ impl InputValidator {
             });
             eval.dag.add_execution_group(group);
         }
-        Ok(handle)
+        Ok(handle.or(generation))
+    }
+}
+
+/// Build an execution of the validator with the specified arguments, with the constraint files of
+/// the task in its sandbox.
+fn validator_execution(
+    eval: &mut EvaluationData,
+    task_path: &Path,
+    source_file: &SourceFile,
+    description: String,
+    args: Vec<String>,
+) -> Result<Execution, Error> {
+    let mut exec = source_file
+        .execute(eval, description, args)
+        .context("Failed to execute validator source file")?;
+    exec.limits_mut().allow_multiprocess();
+
+    // Add limiti.yaml, constraints.yaml and gen.toml to the sandbox of the validator
+    for filename in &["limiti.yaml", "constraints.yaml", "gen.toml"] {
+        let path = task_path.join("gen").join(filename);
+
+        if !path.is_file() {
+            continue;
+        }
+
+        let file = File::new(format!("Constraints file at {}", path.display()));
+        exec.input(&file, filename, false);
+        eval.dag.provide_file(file, path)?;
+    }
+    Ok(exec)
+}
+
+impl ValidatorBatch {
+    /// Make a new empty batch of validations.
+    pub(crate) fn new() -> ValidatorBatch {
+        ValidatorBatch {
+            exec: None,
+            checks: OutcomeChecks::new(),
+            list: String::new(),
+            testcases: Vec::new(),
+        }
+    }
+
+    /// Add to the batch the validation of the input file with `validator`, returning the handle
+    /// that blocks the usage of the input until the validation succeeds, like
+    /// `InputValidator::validate_and_bind`. The validators other than the one of the first input
+    /// file (for example when the subtasks use different validators) are run as usual.
+    #[allow(clippy::too_many_arguments)]
+    pub(crate) fn validate_and_bind(
+        &mut self,
+        validator: &InputValidator,
+        eval: &mut EvaluationData,
+        task_path: &Path,
+        subtask_id: SubtaskId,
+        subtask_name: Option<&str>,
+        testcase_id: TestcaseId,
+        input: FileUuid,
+        generation: Option<FileUuid>,
+    ) -> Result<Option<FileUuid>, Error> {
+        let InputValidator::Custom(source_file, args) = validator else {
+            return Ok(generation);
+        };
+        if self.exec.is_none() {
+            let exec = validator_execution(
+                eval,
+                task_path,
+                source_file,
+                "Validation of the input files".to_string(),
+                vec!["--batch".to_string()],
+            )?;
+            self.exec = Some((source_file.clone(), exec));
+        }
+        let (batch_source, exec) = self.exec.as_mut().unwrap();
+        if batch_source.path != source_file.path {
+            return validator.validate_and_bind(
+                eval,
+                task_path,
+                subtask_id,
+                subtask_name,
+                testcase_id,
+                input,
+                generation,
+            );
+        }
+        let index = self.testcases.len();
+        let name = format!("input_{index}");
+        exec.input(input, &name, false);
+        let outcome = exec.output(format!("outcome_{index}"));
+        let args = args.iter().map(|arg| {
+            if arg == TM_VALIDATION_FILE_NAME {
+                name.as_str()
+            } else {
+                arg.as_str()
+            }
+        });
+        self.list += &shell_words::join(args);
+        self.list.push('\n');
+        self.testcases.push((subtask_id, testcase_id));
+
+        // the validation of an input whose generation failed is ignored
+        let handle = self.checks.check_and_bind(
+            eval,
+            format!("Outcome of the validation of testcase {testcase_id}, subtask {subtask_id}"),
+            testcase_id,
+            &outcome,
+            generation,
+            move |status| UIMessage::IOIValidation {
+                subtask: subtask_id,
+                testcase: testcase_id,
+                status,
+            },
+            Diagnostic::error(format!(
+                "Failed to validate input {testcase_id} for subtask {subtask_id}"
+            )),
+        )?;
+        Ok(Some(handle))
+    }
+
+    /// Add to the DAG the execution of the validator, binding the callbacks for telling the UI
+    /// when it starts and for the diagnostic of its failure. The outcomes of the input files are
+    /// checked by the executions added by `validate_and_bind`.
+    pub(crate) fn bind(self, eval: &mut EvaluationData) -> Result<(), Error> {
+        let Some((_, mut exec)) = self.exec else {
+            return Ok(());
+        };
+        let list_file = File::new("List of the input files to validate");
+        exec.stdin(&list_file);
+        eval.dag.provide_content(list_file, self.list.into_bytes());
+        self.checks.bind(eval);
+        exec.capture_stderr(Some(STDERR_CONTENT_LENGTH));
+        let mut group = exec.into_group();
+        group.tag = Some(Tag::Generation.into());
+        group.priority = GENERATION_PRIORITY;
+
+        let sender = eval.sender.clone();
+        let testcases = self.testcases;
+        eval.dag.on_execution_start(&group.uuid, move |worker| {
+            for (subtask_id, testcase_id) in testcases {
+                sender.send(UIMessage::IOIValidation {
+                    subtask: subtask_id,
+                    testcase: testcase_id,
+                    status: UIExecutionStatus::Started { worker },
+                })?;
+            }
+            Ok(())
+        });
+        let sender = eval.sender.clone();
+        eval.dag.on_execution_done(&group.uuid, move |results| {
+            let result = &results[0];
+            if !result.status.is_success() {
+                let mut diagnostic = Diagnostic::error(format!(
+                    "The validator of the input files failed with {:?}",
+                    result.status
+                ));
+                if let Some(stderr) = &result.stderr {
+                    diagnostic = diagnostic.with_help_attachment(stderr.clone());
+                }
+                sender.add_diagnostic(diagnostic)?;
+            }
+            Ok(())
+        });
+        eval.dag.add_execution_group(group);
+        Ok(())
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use std::collections::HashSet;
+    use std::path::PathBuf;
+
+    use task_maker_dag::{ExecutionResult, ExecutionStatus, ProvidedFile};
+
+    use super::*;
+
+    /// The result of an execution that exited with `status`.
+    fn result(status: ExecutionStatus) -> ExecutionResult {
+        ExecutionResult {
+            status,
+            was_killed: false,
+            was_cached: false,
+            resources: Default::default(),
+            stdout: None,
+            stderr: None,
+            timing: None,
+        }
+    }
+
+    #[test]
+    fn test_validator_batch_one_invalid() {
+        let tmpdir = tempfile::TempDir::new().unwrap();
+        let path = tmpdir.path().join("val.py");
+        std::fs::write(&path, "x").unwrap();
+        let source = Arc::new(SourceFile::new(&path, "", "", None, None::<PathBuf>).unwrap());
+        let validator =
+            InputValidator::Custom(source, vec![TM_VALIDATION_FILE_NAME.into(), "a b".into()]);
+        let (mut eval, recv) = EvaluationData::new(tmpdir.path());
+        let mut batch = ValidatorBatch::new();
+        let handles = (0..3)
+            .map(|testcase| {
+                let input = File::new("input").uuid;
+                batch
+                    .validate_and_bind(
+                        &validator,
+                        &mut eval,
+                        tmpdir.path(),
+                        0,
+                        None,
+                        testcase,
+                        input,
+                        None,
+                    )
+                    .unwrap()
+                    .unwrap()
+            })
+            .collect::<Vec<_>>();
+        batch.bind(&mut eval).unwrap();
+
+        let list = eval
+            .dag
+            .data
+            .provided_files
+            .values()
+            .find_map(|file| match file {
+                ProvidedFile::Content { content, .. } if content != b"ok" => Some(content.clone()),
+                _ => None,
+            })
+            .unwrap();
+        assert_eq!(list, b"input_0 'a b'\ninput_1 'a b'\ninput_2 'a b'\n");
+
+        let groups = &eval.dag.data.execution_groups;
+        let validation = groups
+            .values()
+            .find(|group| group.executions[0].args == ["--batch"])
+            .unwrap();
+        // each testcase is blocked only by the check of its own outcome
+        let checks = handles
+            .iter()
+            .map(|handle| {
+                groups
+                    .values()
+                    .find(|group| group.outputs().contains(handle))
+                    .unwrap()
+            })
+            .collect::<Vec<_>>();
+        let uuids = checks
+            .iter()
+            .map(|group| group.uuid)
+            .collect::<HashSet<_>>();
+        assert_eq!(uuids.len(), 3);
+        for (i, check) in checks.iter().enumerate() {
+            let outcome =
+                &validation.executions[0].output_files[Path::new(&format!("outcome_{i}"))];
+            assert!(check.dependencies().contains(&outcome.uuid));
+        }
+
+        // the validator succeeds, the testcase 1 is not valid
+        let (validation, outcomes) = (
+            validation.uuid,
+            (0..3)
+                .map(|i| {
+                    let path = format!("outcome_{i}");
+                    validation.executions[0].output_files[Path::new(&path)].uuid
+                })
+                .collect::<Vec<_>>(),
+        );
+        let checks = checks.iter().map(|group| group.uuid).collect::<Vec<_>>();
+        let callbacks = eval.dag.execution_callbacks();
+        callbacks
+            .get_mut(&validation)
+            .unwrap()
+            .on_done
+            .pop()
+            .unwrap()(&[result(ExecutionStatus::Success)])
+        .unwrap();
+        for (i, outcome) in outcomes.iter().enumerate() {
+            let content = if i == 1 { "too big\n" } else { "ok\n" };
+            let callbacks = eval.dag.file_callbacks().get_mut(outcome).unwrap();
+            callbacks.get_content.take().unwrap().1(content.into()).unwrap();
+            let status = if i == 1 {
+                ExecutionStatus::ReturnCode(1)
+            } else {
+                ExecutionStatus::Success
+            };
+            let callbacks = eval.dag.execution_callbacks().get_mut(&checks[i]).unwrap();
+            for on_done in callbacks.on_done.drain(..) {
+                on_done(&[result(status.clone())]).unwrap();
+            }
+        }
+        drop(eval);
+        let diagnostics = recv
+            .try_iter()
+            .filter_map(|message| match message {
+                UIMessage::Diagnostic { diagnostic } => Some(diagnostic),
+                _ => None,
+            })
+            .collect::<Vec<_>>();
+        assert_eq!(diagnostics.len(), 1);
+        assert!(diagnostics[0].message().contains("input 1"));
     }
 }
@@ -1,15 +1,22 @@
 pub use checker::Checker;
+pub(crate) use checker::CheckerBatch;
+pub(crate) use input_generator::GeneratorBatch;
 pub use input_generator::InputGenerator;
+pub(crate) use input_validator::ValidatorBatch;
 pub use input_validator::{InputValidator, TM_VALIDATION_FILE_NAME};
 pub use output_generator::OutputGenerator;
+pub(crate) use profiler::profile_and_bind;
+pub use profiler::Profile;
 use serde::{Deserialize, Serialize};
 use task_maker_dag::Priority;
 pub use task_type::{BatchTypeData, CommunicationTypeData, InteractiveTypeData, TaskType, UserIo};
 
+mod batch_outcome;
 mod checker;
 mod input_generator;
 mod input_validator;
 mod output_generator;
+mod profiler;
 mod task_type;
 
 /// Base priority for the generation executions.
@@ -89,13 +96,15 @@ impl TestcaseScoreAggregator {
 
 #[cfg(test)]
 mod tests {
-    use std::path::PathBuf;
+    use std::collections::HashSet;
+    use std::path::{Path, PathBuf};
     use std::sync::atomic::{AtomicBool, Ordering};
-    use std::sync::Arc;
+    use std::sync::{Arc, Mutex};
 
     use itertools::Itertools;
     use task_maker_dag::{
-        ExecutionOutputBehaviour, ExecutionResourcesUsage, ExecutionResult, ExecutionStatus, File,
+        ExecutionCommand, ExecutionGroupUuid, ExecutionOutputBehaviour, ExecutionResourcesUsage,
+        ExecutionResult, ExecutionStatus, File, ProvidedFile, TokenDiffOptions,
     };
     use task_maker_lang::GraderMap;
 
@@ -110,11 +119,13 @@ mod tests {
             task_type: TaskType::Batch(BatchTypeData {
                 output_generator: None,
                 checker: Checker::WhiteDiff,
+                batch_checker: false,
             }),
             name: "".to_string(),
             title: "".to_string(),
             time_limit: None,
             memory_limit: None,
+            instruction_limit: None,
             infile: None,
             outfile: None,
             subtasks: Default::default(),
@@ -126,7 +137,10 @@ mod tests {
             booklets: vec![],
             difficulty: None,
             syllabus_level: None,
+            batch_validator: false,
+            batch_generator: false,
             sanity_checks: Default::default(),
+            evaluation_cache: None,
         }
     }
 
@@ -225,7 +239,7 @@ mod tests {
         let file = File::new("input");
         let (mut eval, _recv) = EvaluationData::new("");
         let out = validator
-            .validate_and_bind(&mut eval, &PathBuf::from("."), 0, None, 0, file.uuid)
+            .validate_and_bind(&mut eval, &PathBuf::from("."), 0, None, 0, file.uuid, None)
             .unwrap();
         assert_eq!(eval.dag.data.provided_files.len(), 0);
         assert_eq!(eval.dag.data.execution_groups.len(), 0);
@@ -242,7 +256,7 @@ mod tests {
         let file = File::new("input");
         let (mut eval, _recv) = EvaluationData::new(tmpdir.path());
         let out = validator
-            .validate_and_bind(&mut eval, &PathBuf::from("."), 0, None, 0, file.uuid)
+            .validate_and_bind(&mut eval, &PathBuf::from("."), 0, None, 0, file.uuid, None)
             .unwrap();
         assert_eq!(eval.dag.data.provided_files.len(), 1);
         assert_eq!(eval.dag.data.execution_groups.len(), 1);
@@ -273,6 +287,7 @@ mod tests {
                 Some("name"),
                 0,
                 file.uuid,
+                None,
             )
             .unwrap();
         assert_eq!(eval.dag.data.provided_files.len(), 1);
@@ -376,12 +391,38 @@ mod tests {
         assert_eq!(eval.dag.data.execution_groups.len(), 1);
         let group = eval.dag.data.execution_groups.values().next().unwrap();
         assert_eq!(group.tag.as_ref().unwrap(), &Tag::Checking.into());
-        assert!(group.executions[0]
-            .args
-            .contains(&"--ignore-blank-lines".into()));
-        assert!(group.executions[0]
-            .args
-            .contains(&"--ignore-space-change".into()));
+        assert!(matches!(
+            group.executions[0].command,
+            ExecutionCommand::WhiteDiff { .. }
+        ));
+        assert!(group.dependencies().contains(&output));
+        assert!(group.dependencies().contains(&test));
+    }
+
+    #[test]
+    fn test_checker_tokendiff() {
+        let options = TokenDiffOptions {
+            ignore_case: true,
+            absolute_tolerance: Some(1e-6),
+            relative_tolerance: None,
+        };
+        let checker = Checker::TokenDiff(options);
+        let (mut eval, _recv) = EvaluationData::new("");
+        let input = File::new("input").uuid;
+        let output = File::new("output").uuid;
+        let test = File::new("test").uuid;
+        checker
+            .check_and_bind(&mut eval, 0, 0, "sol", input, output, test, |_, _| {
+                panic!("the callback should not be called here")
+            })
+            .unwrap();
+        assert_eq!(eval.dag.data.provided_files.len(), 0);
+        assert_eq!(eval.dag.data.execution_groups.len(), 1);
+        let group = eval.dag.data.execution_groups.values().next().unwrap();
+        match &group.executions[0].command {
+            ExecutionCommand::TokenDiff { options: opts, .. } => assert_eq!(opts, &options),
+            command => panic!("Unexpected command {command:?}"),
+        }
         assert!(group.dependencies().contains(&output));
         assert!(group.dependencies().contains(&test));
     }
@@ -415,9 +456,11 @@ mod tests {
                     sys_time: 0.0,
                     wall_time: 0.0,
                     memory: 0,
+                    counters: None,
                 },
                 stdout: None,
                 stderr: None,
+                timing: None,
             }])
             .unwrap();
         });
@@ -453,9 +496,11 @@ mod tests {
                     sys_time: 0.0,
                     wall_time: 0.0,
                     memory: 0,
+                    counters: None,
                 },
                 stdout: None,
                 stderr: None,
+                timing: None,
             }])
             .unwrap();
         });
@@ -487,6 +532,188 @@ mod tests {
         assert!(group.dependencies().contains(&test));
     }
 
+    #[test]
+    fn test_checker_custom_batch() {
+        let tmpdir = tempfile::TempDir::new().unwrap();
+        let path = tmpdir.path().join("check.py");
+        std::fs::write(&path, "x").unwrap();
+        let source = SourceFile::new(&path, "", "", None, None::<PathBuf>).unwrap();
+        let checker = Checker::Custom(Arc::new(source));
+        let (mut eval, _recv) = EvaluationData::new(tmpdir.path());
+        let mut batch = CheckerBatch::new("sol");
+        let called = Arc::new(Mutex::new(Vec::new()));
+        let mut evaluations = Vec::new();
+        let mut tests = Vec::new();
+        for testcase in 0..4 {
+            let called = called.clone();
+            let input = File::new("input").uuid;
+            let output = File::new("output").uuid;
+            let test = File::new("test").uuid;
+            let evaluation = ExecutionGroupUuid::new_v4();
+            batch.push(
+                0,
+                testcase,
+                input,
+                output,
+                test,
+                evaluation,
+                move |score, mex| {
+                    called.lock().unwrap().push((testcase, score, mex));
+                    Ok(())
+                },
+            );
+            evaluations.push(evaluation);
+            tests.push(test);
+        }
+        checker.check_batch_and_bind(&mut eval, batch).unwrap();
+        // The checker and the list of the files to check.
+        assert_eq!(eval.dag.data.provided_files.len(), 2);
+        assert_eq!(eval.dag.data.execution_groups.len(), 1);
+        let group = eval.dag.data.execution_groups.values().next().unwrap();
+        assert_eq!(group.tag.as_ref().unwrap(), &Tag::Checking.into());
+        assert!(group.executions[0].args.contains(&"--batch".into()));
+        // the checker runs even if some evaluations fail
+        for test in &tests {
+            assert!(group.is_optional_dependency(*test));
+        }
+        let exec = group.uuid;
+        // the evaluation of the testcase 1 crashes, the one of the testcase 3 is skipped
+        for (testcase, evaluation) in evaluations.iter().enumerate().take(3) {
+            let status = if testcase == 1 {
+                ExecutionStatus::ReturnCode(1)
+            } else {
+                ExecutionStatus::Success
+            };
+            let callbacks = eval.dag.execution_callbacks().get_mut(evaluation).unwrap();
+            callbacks.on_done.pop().unwrap()(&[ExecutionResult {
+                status,
+                was_killed: false,
+                was_cached: false,
+                resources: Default::default(),
+                stdout: None,
+                stderr: None,
+                timing: None,
+            }])
+            .unwrap();
+        }
+        let on_done = eval.dag.execution_callbacks().get_mut(&exec).unwrap();
+        on_done.on_done.pop().unwrap()(&[ExecutionResult {
+            status: ExecutionStatus::Success,
+            was_killed: false,
+            was_cached: false,
+            resources: Default::default(),
+            stdout: Some("1.0 translate:success\n0.0 Empty output\n0.5 Almost\n0\n".into()),
+            stderr: Some("".into()),
+            timing: None,
+        }])
+        .unwrap();
+
+        // the failed testcases are scored by their evaluation
+        let called = called.lock().unwrap();
+        assert_eq!(
+            *called,
+            vec![
+                (0, 1.0, "Output is correct".to_string()),
+                (2, 0.5, "Almost".to_string()),
+            ]
+        );
+    }
+
+    #[test]
+    fn test_generator_batch() {
+        let tmpdir = tempfile::TempDir::new().unwrap();
+        let path = tmpdir.path().join("gen.py");
+        std::fs::write(&path, "x").unwrap();
+        let source = Arc::new(SourceFile::new(&path, "", "", None, None::<PathBuf>).unwrap());
+        let (mut eval, _recv) = EvaluationData::new(tmpdir.path());
+        let mut batch = GeneratorBatch::new();
+        let inputs = (0..3)
+            .map(|testcase| {
+                let generator = InputGenerator::Custom(
+                    source.clone(),
+                    vec!["4 2".into(), testcase.to_string()],
+                );
+                batch
+                    .generate_and_bind(&generator, &mut eval, tmpdir.path(), 0, testcase)
+                    .unwrap()
+            })
+            .collect_vec();
+        batch.bind(&mut eval).unwrap();
+        assert_eq!(inputs.iter().map(|(input, _)| input).unique().count(), 3);
+        let groups = &eval.dag.data.execution_groups;
+        let group = groups
+            .values()
+            .find(|group| group.executions[0].args == ["--batch"])
+            .unwrap();
+        assert_eq!(group.tag.as_ref().unwrap(), &Tag::Generation.into());
+        let outputs = group.outputs();
+        assert!(inputs.iter().all(|(input, _)| outputs.contains(input)));
+        // each testcase waits only for the check of its own outcome
+        for (i, (_, handle)) in inputs.iter().enumerate() {
+            let check = groups
+                .values()
+                .find(|group| group.outputs().contains(&handle.unwrap()))
+                .unwrap();
+            let outcome = &group.executions[0].output_files[Path::new(&format!("outcome_{i}"))];
+            assert_eq!(check.dependencies().len(), 2);
+            assert!(check.dependencies().contains(&outcome.uuid));
+        }
+        let list = eval
+            .dag
+            .data
+            .provided_files
+            .values()
+            .find_map(|file| match file {
+                ProvidedFile::Content { content, .. } if content != b"ok" => Some(content.clone()),
+                _ => None,
+            })
+            .unwrap();
+        assert_eq!(list, b"'4 2' 0\n'4 2' 1\n'4 2' 2\n");
+    }
+
+    #[test]
+    fn test_generator_batch_chunks() {
+        let tmpdir = tempfile::TempDir::new().unwrap();
+        let path = tmpdir.path().join("gen.py");
+        std::fs::write(&path, "x").unwrap();
+        let source = Arc::new(SourceFile::new(&path, "", "", None, None::<PathBuf>).unwrap());
+        // the lists of the executions generating the testcases
+        let lists = |testcases: &[usize]| {
+            let (mut eval, _recv) = EvaluationData::new(tmpdir.path());
+            let mut batch = GeneratorBatch::new();
+            for &testcase in testcases {
+                let generator = InputGenerator::Custom(source.clone(), vec![testcase.to_string()]);
+                batch
+                    .generate_and_bind(&generator, &mut eval, tmpdir.path(), 0, testcase as u32)
+                    .unwrap();
+            }
+            batch.bind(&mut eval).unwrap();
+            eval.dag
+                .data
+                .provided_files
+                .values()
+                .filter_map(|file| match file {
+                    ProvidedFile::Content { content, .. } if content != b"ok" => {
+                        Some(content.clone())
+                    }
+                    _ => None,
+                })
+                .collect::<HashSet<_>>()
+        };
+        let testcases = (0..500).collect_vec();
+        let before = lists(&testcases);
+        assert!(before.len() > 500 / 64);
+        assert!(before
+            .iter()
+            .all(|list| list.iter().filter(|&&c| c == b'\n').count() <= 64));
+        // adding a testcase changes only the executions around it: the one that generates it,
+        // and the following ones until a boundary that is not given by the size limit
+        let mut testcases = testcases;
+        testcases.insert(250, 1000);
+        let after = lists(&testcases);
+        assert!(before.difference(&after).count() <= 3);
+    }
+
     #[test]
     fn test_checker_custom_correct() {
         let tmpdir = tempfile::TempDir::new().unwrap();
@@ -519,6 +746,7 @@ mod tests {
             resources: Default::default(),
             stdout: Some("1.0\n\n".into()),
             stderr: Some("Ok!\n\n".into()),
+            timing: None,
         }])
         .unwrap();
 
@@ -557,6 +785,7 @@ mod tests {
             resources: Default::default(),
             stdout: Some("0.0\n\n".into()),
             stderr: Some("Ko!\n\n".into()),
+            timing: None,
         }])
         .unwrap();
 
@@ -588,6 +817,7 @@ mod tests {
             resources: Default::default(),
             stdout: Some(":<\n\n".into()),
             stderr: Some("Ko!\n\n".into()),
+            timing: None,
         }])
         .unwrap();
         drop(eval);
@@ -0,0 +1,198 @@
+//! Profiling of the solutions with `perf`, for finding where the slow solutions spend their time.
+//!
+//! The profiled evaluations are run again in a separate execution, so the verdicts and the times
+//! of the evaluations are not affected. The execution runs the solution under `perf record` with
+//! the same input, then folds the sampled stacks with `awk` in the format used by the flame graph
+//! tools (`flamegraph.pl`, `inferno`, speedscope): one line per distinct stack, with the frames
+//! from the outermost separated by `;`, followed by the number of samples.
+//!
+//! `perf` must be installed on the workers, and `perf_event_paranoid` must allow to profile the
+//! user space (the default). By default the stacks are walked with the frame pointers, so the
+//! solutions should be compiled with `-fno-omit-frame-pointer` for getting their full stacks.
+
+use std::path::PathBuf;
+
+use anyhow::{bail, Context, Error};
+use itertools::Itertools;
+use serde::{Deserialize, Serialize};
+use task_maker_dag::{ExecutionCommand, ExecutionStatus, FileUuid};
+
+use crate::ioi::{IOITask, SubtaskId, TestcaseId, STDERR_CONTENT_LENGTH};
+use crate::ui::UIMessage;
+use crate::{EvaluationData, SourceFile, Tag, UISender};
+
+/// Maximum number of bytes of the folded stacks sent to the UI.
+const PROFILE_CONTENT_LENGTH: usize = 1024 * 1024;
+/// The sampling frequency of `perf`, in Hz. Not a multiple of the timer frequencies, for not
+/// sampling always at the same point of periodic code.
+const SAMPLING_FREQUENCY: u32 = 997;
+/// The script that runs the command in its arguments under `perf`, printing the folded stacks.
+/// `$0` is the awk program that folds the stacks.
+const PROFILE_SCRIPT: &str = "perf record -q -N -g -F \"$PERF_FREQUENCY\" -o perf.data -- \"$@\" \
+    > /dev/null; [ -s perf.data ] || exit 1; perf script -i perf.data -F comm,ip,sym | awk \"$0\"";
+/// The awk program that folds the stacks printed by `perf script`: each sample is a line with the
+/// name of the process followed by a line for each frame, from the innermost, with the address and
+/// the symbol.
+const FOLD_STACKS: &str = r#"
+/^[^ \t]/ { if (stack != "") count[comm stack]++; comm = $1; stack = ""; next }
+NF >= 2 { sub(/^[ \t]*[0-9a-f]+ /, ""); stack = ";" $0 stack }
+END { if (stack != "") count[comm stack]++; for (s in count) print s, count[s] }
+"#;
+
+/// The stacks sampled while profiling a solution on a testcase.
+#[derive(Debug, Clone, Default, PartialEq, Eq, Serialize, Deserialize)]
+pub struct Profile {
+    /// The distinct sampled stacks, with the frames from the outermost separated by `;`, and the
+    /// number of samples with that stack.
+    pub stacks: Vec<(String, u64)>,
+}
+
+impl Profile {
+    /// Parse the folded stacks, ignoring the malformed lines (like the last one if the content was
+    /// truncated). The stacks are sorted by the number of samples, from the most sampled.
+    pub fn parse(content: &[u8]) -> Profile {
+        let stacks = String::from_utf8_lossy(content)
+            .lines()
+            .filter_map(|line| {
+                let (stack, count) = line.rsplit_once(' ')?;
+                Some((stack.to_string(), count.parse().ok()?))
+            })
+            .sorted_by(|(s1, c1), (s2, c2)| c2.cmp(c1).then(s1.cmp(s2)))
+            .collect();
+        Profile { stacks }
+    }
+
+    /// The total number of samples.
+    pub fn samples(&self) -> u64 {
+        self.stacks.iter().map(|(_, count)| count).sum()
+    }
+
+    /// The `n` functions where the most samples were taken, with their number of samples. Only the
+    /// innermost frame of each stack is counted, not the functions that called it.
+    pub fn hot_spots(&self, n: usize) -> Vec<(&str, u64)> {
+        let mut samples: Vec<(&str, u64)> = Vec::new();
+        for (stack, count) in &self.stacks {
+            let function = stack.rsplit(';').next().unwrap_or_default();
+            match samples.iter_mut().find(|(f, _)| *f == function) {
+                Some((_, c)) => *c += count,
+                None => samples.push((function, *count)),
+            }
+        }
+        samples.sort_by(|(f1, c1), (f2, c2)| c2.cmp(c1).then(f1.cmp(f2)));
+        samples.truncate(n);
+        samples
+    }
+}
+
+/// Add to the DAG the profiling of a solution on a testcase, sending to the UI the profile. If the
+/// profiling succeeds the folded stacks are also written to `bin/profiles/`, unless the DAG is in
+/// dry-run mode, which makes `write_file_to` a no-op.
+#[allow(clippy::too_many_arguments)]
+pub(crate) fn profile_and_bind(
+    task: &IOITask,
+    eval: &mut EvaluationData,
+    subtask_id: SubtaskId,
+    testcase_id: TestcaseId,
+    source_file: &SourceFile,
+    input: FileUuid,
+    validation_handle: Option<FileUuid>,
+) -> Result<(), Error> {
+    let mut exec = source_file
+        .execute(
+            eval,
+            format!(
+                "Profiling of {} on testcase {}, subtask {}",
+                source_file.name(),
+                testcase_id,
+                subtask_id
+            ),
+            Vec::<String>::new(),
+        )
+        .context("Failed to execute solution source file")?;
+    let command = match &exec.command {
+        // the script runs inside the sandbox directory
+        ExecutionCommand::Local(path) => PathBuf::from(".").join(path),
+        ExecutionCommand::System(path) => path.clone(),
+        _ => bail!("Cannot profile {}", source_file.name()),
+    };
+    let mut args = vec![
+        "-c".to_string(),
+        PROFILE_SCRIPT.to_string(),
+        FOLD_STACKS.to_string(),
+    ];
+    if let Some(time_limit) = task.time_limit {
+        // with a margin for reaching the slow part of the solutions that exceed the limit
+        args.extend(["timeout", "-s", "KILL"].map(String::from));
+        args.push((time_limit * 2.0).to_string());
+    }
+    args.push(command.to_string_lossy().to_string());
+    args.append(&mut exec.args);
+    exec.command = ExecutionCommand::system("sh");
+    exec.args = args;
+    exec.env("PERF_FREQUENCY", SAMPLING_FREQUENCY.to_string());
+    match &task.infile {
+        None => exec.stdin(input),
+        Some(infile) => exec.input(input, infile, false),
+    };
+    if let Some(validation_handle) = validation_handle {
+        exec.input(validation_handle, "wait_for_validation", false);
+    }
+    let stacks = exec.capture_stdout(Some(PROFILE_CONTENT_LENGTH));
+    exec.capture_stderr(Some(STDERR_CONTENT_LENGTH));
+    let limits = exec.limits_mut();
+    if let Some(time_limit) = task.time_limit {
+        limits.wall_time(time_limit * 4.0 + 30.0);
+    }
+    // perf needs to spawn the solution and to open the counters
+    limits.permissive = true;
+    limits.mount_tmpfs(true);
+    limits.mount_proc(true);
+    let mut group = exec.into_group();
+    // not an evaluation: it's not timed, so it must not get the exclusive cores of the evaluations
+    group.tag = Some(Tag::Profiling.into());
+
+    let solution = source_file.path.clone();
+    let sender = eval.sender.clone();
+    eval.dag.on_execution_done(&group.uuid, move |results| {
+        let result = &results[0];
+        let profile = match &result.status {
+            ExecutionStatus::Success => Ok(Profile::parse(result.stdout.as_deref().unwrap_or(&[]))),
+            status => {
+                let stderr = String::from_utf8_lossy(result.stderr.as_deref().unwrap_or(&[]));
+                Err(format!("{status:?}: {}", stderr.trim()))
+            }
+        };
+        sender.send(UIMessage::IOIProfile {
+            subtask: subtask_id,
+            testcase: testcase_id,
+            solution,
+            profile,
+        })
+    });
+    eval.dag.write_file_to(
+        stacks,
+        task.path.join("bin/profiles").join(format!(
+            "{}-{}.folded",
+            source_file.name(),
+            testcase_id
+        )),
+        false,
+    );
+    eval.dag.add_execution_group(group);
+    Ok(())
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_profile_parse() {
+        let content = b"sol;main;solve;dfs 10\nsol;main;solve 5\nsol;main;read 3\nsol;main;solve;dfs 2\nsol;ma";
+        let profile = Profile::parse(content);
+        assert_eq!(profile.stacks.len(), 4);
+        assert_eq!(profile.stacks[0], ("sol;main;solve;dfs".to_string(), 10));
+        assert_eq!(profile.samples(), 20);
+        assert_eq!(profile.hot_spots(2), vec![("dfs", 12), ("solve", 5)]);
+    }
+}
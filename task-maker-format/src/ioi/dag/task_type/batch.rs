@@ -5,7 +5,8 @@ use serde::{Deserialize, Serialize};
 use task_maker_dag::{ExecutionStatus, FileUuid, Priority};
 
 use crate::ioi::{
-    Checker, IOITask, OutputGenerator, ScoreManager, SubtaskId, TestcaseId, EVALUATION_PRIORITY,
+    Checker, CheckerBatch, IOITask, OutputGenerator, ScoreManager, SubtaskId, TestcaseId,
+    EVALUATION_PRIORITY,
 };
 use crate::ui::UIMessage;
 use crate::{bind_exec_callbacks, bind_exec_io, EvaluationData, SourceFile, Tag};
@@ -18,6 +19,10 @@ pub struct BatchTypeData {
     pub output_generator: Option<OutputGenerator>,
     /// The checker to use for this task.
     pub checker: Checker,
+    /// Whether the custom checker supports the batch protocol, checking all the outputs of a
+    /// solution with a single execution.
+    #[serde(default)]
+    pub batch_checker: bool,
 }
 
 /// Evaluate a solution in a task of Batch type.
@@ -32,6 +37,7 @@ pub fn evaluate(
     validation_handle: Option<FileUuid>,
     correct_output: Option<FileUuid>,
     score_manager: Arc<Mutex<ScoreManager>>,
+    checker_batch: &mut CheckerBatch,
     data: &BatchTypeData,
 ) -> Result<(), Error> {
     let correct_output = correct_output.ok_or_else(|| anyhow!("Missing official solution"))?;
@@ -57,6 +63,9 @@ pub fn evaluate(
     if let Some(memory_limit) = task.memory_limit {
         limits.memory(memory_limit * 1024); // MiB -> KiB
     }
+    if let Some(instruction_limit) = task.instruction_limit {
+        limits.instructions(instruction_limit);
+    }
     let mut group = exec.into_group();
     group.tag = Some(Tag::Evaluation.into());
     group.priority = EVALUATION_PRIORITY - testcase_id as Priority;
@@ -88,9 +97,30 @@ pub fn evaluate(
             ),
         }
     });
+    ScoreManager::bind_evaluation(&score_manager, eval, subtask_id, testcase_id, group.uuid);
+    let evaluation = group.uuid;
     eval.dag.add_execution_group(group);
 
     let sender = eval.sender.clone();
+    let callback = move |score, message| {
+        score_manager
+            .lock()
+            .unwrap()
+            .score(subtask_id, testcase_id, score, message, sender)
+    };
+    if data.batch_checker {
+        // The output is checked together with the other outputs of the solution.
+        checker_batch.push(
+            subtask_id,
+            testcase_id,
+            input,
+            correct_output,
+            output.uuid,
+            evaluation,
+            callback,
+        );
+        return Ok(());
+    }
     data.checker.check_and_bind(
         eval,
         subtask_id,
@@ -99,12 +129,7 @@ pub fn evaluate(
         input,
         correct_output,
         output.uuid,
-        move |score, message| {
-            score_manager
-                .lock()
-                .unwrap()
-                .score(subtask_id, testcase_id, score, message, sender)
-        },
+        callback,
     )?;
     Ok(())
 }
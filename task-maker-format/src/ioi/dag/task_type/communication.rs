@@ -8,6 +8,15 @@ use crate::ioi::{Checker, IOITask, ScoreManager, SubtaskId, TestcaseId, EVALUATI
 use crate::ui::UIMessage;
 use crate::{bind_exec_callbacks, bind_exec_io, EvaluationData, SourceFile, Tag};
 
+/// Name of the header with the shared memory channels that is made available to the compilation
+/// of the manager and of the solutions, when they communicate with shared memory.
+pub const SHM_LIB_NAME: &str = "shm_lib.h";
+/// Content of the header with the shared memory channels.
+const SHM_LIB: &[u8] = include_bytes!("communication/shm_lib.h");
+/// Size of the shared memory file of each solution process: the header with the control blocks
+/// and a ring buffer of 1MiB for each direction.
+const SHARED_MEMORY_SIZE: u64 = 4096 + 2 * 1024 * 1024;
+
 /// The type of communication for the solution in a communication task.
 #[derive(Debug, Clone, Copy, Serialize, Deserialize, Eq, PartialEq)]
 #[serde(rename_all = "snake_case")]
@@ -16,6 +25,9 @@ pub enum UserIo {
     StdIo,
     /// Communication is achieved by using the pipes passed in argv.
     FifoIo,
+    /// Communication is achieved by using a shared memory file passed in argv, with the ring
+    /// buffers of `shm_lib.h`.
+    SharedMemory,
 }
 
 impl UserIo {
@@ -43,6 +55,25 @@ pub struct CommunicationTypeData {
     pub user_io: UserIo,
 }
 
+impl CommunicationTypeData {
+    /// Make `shm_lib.h` available to the compilation of the manager or of a solution, if they
+    /// communicate with shared memory, unless the task already has a file with that name next to
+    /// the source file.
+    pub(crate) fn add_shm_lib(user_io: UserIo, source: &mut SourceFile) {
+        if user_io != UserIo::SharedMemory {
+            return;
+        }
+        if source.path.with_file_name(SHM_LIB_NAME).exists() {
+            debug!(
+                "Not providing {SHM_LIB_NAME} to {}, the task has its own",
+                source.name()
+            );
+            return;
+        }
+        source.add_compilation_file(SHM_LIB_NAME, SHM_LIB);
+    }
+}
+
 /// Evaluate a solution in a task of Batch type.
 #[allow(clippy::too_many_arguments)]
 pub fn evaluate(
@@ -66,7 +97,17 @@ pub fn evaluate(
 
     let mut fifo_man2sol = Vec::new();
     let mut fifo_sol2man = Vec::new();
+    let mut shared_memory = Vec::new();
     for _ in 0..data.num_processes {
+        if data.user_io == UserIo::SharedMemory {
+            let shm = group.new_shared_memory(SHARED_MEMORY_SIZE).sandbox_path();
+            shared_memory.push(
+                shm.to_str()
+                    .ok_or_else(|| anyhow!("Non-UTF8 shared memory path"))?
+                    .to_string(),
+            );
+            continue;
+        }
         let fifo1 = group.new_fifo().sandbox_path();
         fifo_man2sol.push(
             fifo1
@@ -92,6 +133,7 @@ pub fn evaluate(
                 fifo_sol2man[process_index].clone(),
             ],
             UserIo::StdIo => vec![],
+            UserIo::SharedMemory => vec![shared_memory[process_index].clone()],
         };
         if num_processes > 1 {
             args.push(process_index.to_string());
@@ -126,13 +168,20 @@ pub fn evaluate(
         if let Some(memory_limit) = task.memory_limit {
             limits.memory(memory_limit * 1024); // MiB -> KiB
         }
+        if let Some(instruction_limit) = task.instruction_limit {
+            limits.instructions(instruction_limit);
+        }
         group.add_execution(sol_exec);
     }
 
     let mut args = Vec::new();
     for process_index in 0..num_processes {
-        args.push(&fifo_sol2man[process_index]);
-        args.push(&fifo_man2sol[process_index]);
+        if data.user_io == UserIo::SharedMemory {
+            args.push(&shared_memory[process_index]);
+        } else {
+            args.push(&fifo_sol2man[process_index]);
+            args.push(&fifo_man2sol[process_index]);
+        }
     }
     let mut manager_exec = data
         .manager
@@ -172,6 +221,7 @@ pub fn evaluate(
         },
         path
     )?;
+    ScoreManager::bind_evaluation(&score_manager, eval, subtask_id, testcase_id, group.uuid);
     let sender = eval.sender.clone();
     eval.dag.on_execution_done(&group.uuid, move |results| {
         let send_score = |score, message: String| {
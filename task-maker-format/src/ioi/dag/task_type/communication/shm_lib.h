@@ -0,0 +1,342 @@
+// Shared memory channels for the communication tasks with
+// `user_io: shared_memory`, made available by task-maker to the C and C++
+// managers and stubs: just #include "shm_lib.h".
+//
+// Each solution process receives the path of its channel as the first
+// argument, and the manager receives the paths of the channels of all the
+// processes, in order. A channel is a file mapped in memory by both sides with
+// two ring buffers, one for each direction: sending a message is a memcpy, and
+// a system call is made only when a side has to sleep waiting for the other.
+//
+// Example (stub):
+//
+//   tm_channel ch;
+//   tm_channel_open(&ch, argv[1], TM_SOLUTION);
+//   int n;
+//   while (tm_read_int(&ch, &n)) tm_write_int(&ch, solve(n));
+//   tm_channel_close(&ch);
+//
+// The manager opens the same path with TM_MANAGER. Reading returns less data
+// than asked only after the other side closed the channel, and writing fails
+// after the other side closed it. A side whose process exits, or crashes, with
+// the channel open is found out by the other one while it waits, and the
+// channel is closed on its behalf. The positions written by the other side are
+// checked: a side that finds them out of range treats the channel as closed.
+
+#ifndef TM_SHM_LIB_H
+#define TM_SHM_LIB_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef __cplusplus
+// Not declared with -std=c11.
+long syscall(long number, ...);
+#endif
+
+// The side of the channel, passed to tm_channel_open.
+#define TM_MANAGER 0
+#define TM_SOLUTION 1
+
+// Size of the part of the file with the control blocks of the rings.
+#define TM_SHM_HEADER_SIZE 4096
+// Offset of the control block of the second ring.
+#define TM_SHM_RING_OFFSET 256
+// Number of times the ring is checked before sleeping, when the other side can
+// run at the same time on another CPU.
+#define TM_SHM_SPIN 512
+// Offset of the byte of the file locked by the manager, the one of the solution
+// follows. Each side locks its byte while it has the channel open, the kernel
+// releases the lock when the process exits, even if it's killed.
+#define TM_SHM_LOCK_OFFSET 1024
+// How often a side sleeping on the other one checks that its process is still
+// alive, in nanoseconds.
+#define TM_SHM_ALIVE_CHECK_NS 20000000
+
+// The control block of a ring. Each half is written by only one side, and it's
+// in its own cache line. The positions grow forever, modulo 2^32.
+typedef struct {
+  // Bytes written by the producer.
+  uint32_t head;
+  // Set when the producer closes the channel.
+  uint32_t closed;
+  // Set while the producer sleeps waiting for space.
+  uint32_t producer_waiting;
+  // Changed by the producer to wake the consumer.
+  uint32_t data_seq;
+  // Set when the producer has locked its byte of the file.
+  uint32_t opened;
+  char producer_pad[44];
+  // Bytes read by the consumer.
+  uint32_t tail;
+  // Set when the consumer closes the channel.
+  uint32_t reader_closed;
+  // Set while the consumer sleeps waiting for data.
+  uint32_t consumer_waiting;
+  // Changed by the consumer to wake the producer.
+  uint32_t space_seq;
+  char consumer_pad[48];
+} tm_ring;
+
+// A channel opened with tm_channel_open.
+typedef struct {
+  // The mapped file.
+  char *base;
+  // The size of the file.
+  size_t size;
+  // The file, kept open for keeping the lock of this side.
+  int fd;
+  // The side of the channel, TM_MANAGER or TM_SOLUTION.
+  int side;
+  // The size of the data of each ring, a power of two.
+  uint32_t capacity;
+  // Number of times the ring is checked before sleeping.
+  int spin;
+  // The ring this side reads from, its data, and the bytes read from it. The
+  // position is kept here, the one in the ring is only for the other side.
+  tm_ring *in;
+  char *in_data;
+  uint32_t in_tail;
+  // The ring this side writes to, its data, and the bytes written to it.
+  tm_ring *out;
+  char *out_data;
+  uint32_t out_head;
+} tm_channel;
+
+static inline void tm_shm__pause(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  __asm__ __volatile__("yield");
+#endif
+}
+
+// Lock, unlock or check (with F_GETLK) the byte of the file of a side.
+static inline int tm_shm__lock(int fd, int side, int cmd, short type) {
+  struct flock lock;
+  memset(&lock, 0, sizeof(lock));
+  lock.l_type = type;
+  lock.l_whence = SEEK_SET;
+  lock.l_start = TM_SHM_LOCK_OFFSET + side;
+  lock.l_len = 1;
+  if (fcntl(fd, cmd, &lock) < 0)
+    return -1;
+  return cmd == F_GETLK ? lock.l_type : 0;
+}
+
+// Whether the process of the other side exited with the channel open. In that
+// case the channel is closed on its behalf, in both directions.
+static inline int tm_shm__peer_gone(tm_channel *ch) {
+  // the other side may not have opened the channel yet
+  if (!__atomic_load_n(&ch->in->opened, __ATOMIC_ACQUIRE))
+    return 0;
+  // the locks of this process never conflict with the check
+  if (tm_shm__lock(ch->fd, 1 - ch->side, F_GETLK, F_WRLCK) != F_UNLCK)
+    return 0;
+  __atomic_store_n(&ch->in->closed, 1, __ATOMIC_SEQ_CST);
+  __atomic_store_n(&ch->out->reader_closed, 1, __ATOMIC_SEQ_CST);
+  return 1;
+}
+
+// Wait until *word is not old anymore, or *closed is set. After checking spin
+// times the side sleeps on *seq, telling the other side with *waiting. While
+// sleeping it checks that the other side is still alive.
+static inline void tm_shm__wait(tm_channel *ch, uint32_t *word, uint32_t old,
+                                uint32_t *closed, uint32_t *seq,
+                                uint32_t *waiting) {
+  for (int i = 0; i < ch->spin; i++) {
+    if (__atomic_load_n(word, __ATOMIC_ACQUIRE) != old ||
+        __atomic_load_n(closed, __ATOMIC_ACQUIRE))
+      return;
+    tm_shm__pause();
+  }
+  __atomic_store_n(waiting, 1, __ATOMIC_SEQ_CST);
+  for (;;) {
+    uint32_t current = __atomic_load_n(seq, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(word, __ATOMIC_SEQ_CST) != old ||
+        __atomic_load_n(closed, __ATOMIC_SEQ_CST))
+      break;
+    // returns at once if seq changed after it was read
+    struct timespec timeout = {0, TM_SHM_ALIVE_CHECK_NS};
+    if (syscall(SYS_futex, seq, FUTEX_WAIT, current, &timeout, NULL, 0) < 0 &&
+        errno == ETIMEDOUT && tm_shm__peer_gone(ch))
+      break;
+  }
+  __atomic_store_n(waiting, 0, __ATOMIC_SEQ_CST);
+}
+
+// Wake the other side if it's sleeping in tm_shm__wait, after a change to the
+// word it waits on.
+static inline void tm_shm__wake(uint32_t *seq, uint32_t *waiting) {
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(waiting, __ATOMIC_SEQ_CST)) {
+    __atomic_fetch_add(seq, 1, __ATOMIC_SEQ_CST);
+    syscall(SYS_futex, seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+  }
+}
+
+// Open the channel at path from the specified side (TM_MANAGER or
+// TM_SOLUTION), exiting with an error if it cannot be opened.
+static inline void tm_channel_open(tm_channel *ch, const char *path, int side) {
+  int fd = open(path, O_RDWR);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) < 0 ||
+      (size_t)st.st_size < TM_SHM_HEADER_SIZE + 2) {
+    fprintf(stderr, "Cannot open the channel %s\n", path);
+    exit(1);
+  }
+  ch->size = st.st_size;
+  void *base =
+      mmap(NULL, ch->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (base == MAP_FAILED) {
+    fprintf(stderr, "Cannot map the channel %s\n", path);
+    exit(1);
+  }
+  ch->base = (char *)base;
+  uint64_t capacity = 1;
+  while (capacity * 2 <= (ch->size - TM_SHM_HEADER_SIZE) / 2 &&
+         capacity < (1u << 31))
+    capacity *= 2;
+  ch->capacity = (uint32_t)capacity;
+  // with a single CPU the other side cannot make progress while this one spins
+  ch->spin = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? TM_SHM_SPIN : 0;
+  tm_ring *rings[2] = {(tm_ring *)ch->base,
+                       (tm_ring *)(ch->base + TM_SHM_RING_OFFSET)};
+  char *data[2] = {ch->base + TM_SHM_HEADER_SIZE,
+                   ch->base + TM_SHM_HEADER_SIZE + capacity};
+  // the manager writes to the first ring, the solution to the second one
+  int out = side == TM_MANAGER ? 0 : 1;
+  ch->out = rings[out];
+  ch->out_data = data[out];
+  ch->out_head = ch->out->head;
+  ch->in = rings[1 - out];
+  ch->in_data = data[1 - out];
+  ch->in_tail = ch->in->tail;
+  ch->fd = fd;
+  ch->side = out;
+  if (tm_shm__lock(fd, out, F_SETLK, F_WRLCK) < 0) {
+    fprintf(stderr, "Cannot lock the channel %s\n", path);
+    exit(1);
+  }
+  __atomic_store_n(&ch->out->opened, 1, __ATOMIC_RELEASE);
+}
+
+// Write len bytes to the channel. Returns 0 if the other side closed it.
+static inline int tm_write(tm_channel *ch, const void *buf, size_t len) {
+  tm_ring *ring = ch->out;
+  const char *src = (const char *)buf;
+  uint32_t head = ch->out_head;
+  while (len > 0) {
+    if (__atomic_load_n(&ring->reader_closed, __ATOMIC_ACQUIRE))
+      return 0;
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    // the reader cannot be past the written data
+    if (head - tail > ch->capacity) {
+      __atomic_store_n(&ring->reader_closed, 1, __ATOMIC_RELEASE);
+      return 0;
+    }
+    uint32_t space = ch->capacity - (head - tail);
+    if (space == 0) {
+      tm_shm__wait(ch, &ring->tail, tail, &ring->reader_closed,
+                   &ring->space_seq, &ring->producer_waiting);
+      continue;
+    }
+    uint32_t n = len < space ? (uint32_t)len : space;
+    uint32_t pos = head & (ch->capacity - 1);
+    uint32_t first = ch->capacity - pos < n ? ch->capacity - pos : n;
+    memcpy(ch->out_data + pos, src, first);
+    memcpy(ch->out_data, src + first, n - first);
+    head += n;
+    src += n;
+    len -= n;
+    ch->out_head = head;
+    __atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+    tm_shm__wake(&ring->data_seq, &ring->consumer_waiting);
+  }
+  return 1;
+}
+
+// Read len bytes from the channel, waiting for them. Returns the number of
+// bytes read, which is less than len only if the other side closed it.
+static inline size_t tm_read(tm_channel *ch, void *buf, size_t len) {
+  tm_ring *ring = ch->in;
+  char *dst = (char *)buf;
+  size_t done = 0;
+  uint32_t tail = ch->in_tail;
+  while (done < len) {
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    if (head == tail) {
+      if (__atomic_load_n(&ring->closed, __ATOMIC_ACQUIRE)) {
+        // the data written before closing is still read
+        if (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == tail)
+          break;
+        continue;
+      }
+      tm_shm__wait(ch, &ring->head, tail, &ring->closed, &ring->data_seq,
+                   &ring->consumer_waiting);
+      continue;
+    }
+    uint32_t avail = head - tail;
+    // the writer cannot be more than a ring ahead
+    if (avail > ch->capacity) {
+      __atomic_store_n(&ring->closed, 1, __ATOMIC_RELEASE);
+      break;
+    }
+    uint32_t n = len - done < avail ? (uint32_t)(len - done) : avail;
+    uint32_t pos = tail & (ch->capacity - 1);
+    uint32_t first = ch->capacity - pos < n ? ch->capacity - pos : n;
+    memcpy(dst + done, ch->in_data + pos, first);
+    memcpy(dst + done + first, ch->in_data, n - first);
+    tail += n;
+    done += n;
+    ch->in_tail = tail;
+    __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    tm_shm__wake(&ring->space_seq, &ring->producer_waiting);
+  }
+  return done;
+}
+
+// Write an int to the channel. Returns 0 if the other side closed it.
+static inline int tm_write_int(tm_channel *ch, int value) {
+  return tm_write(ch, &value, sizeof(value));
+}
+
+// Read an int from the channel. Returns 0 if the other side closed it.
+static inline int tm_read_int(tm_channel *ch, int *value) {
+  return tm_read(ch, value, sizeof(*value)) == sizeof(*value);
+}
+
+// Write a long long to the channel. Returns 0 if the other side closed it.
+static inline int tm_write_ll(tm_channel *ch, long long value) {
+  return tm_write(ch, &value, sizeof(value));
+}
+
+// Read a long long from the channel. Returns 0 if the other side closed it.
+static inline int tm_read_ll(tm_channel *ch, long long *value) {
+  return tm_read(ch, value, sizeof(*value)) == sizeof(*value);
+}
+
+// Close the channel: the other side reads what was already written, and then
+// the end of the data.
+static inline void tm_channel_close(tm_channel *ch) {
+  __atomic_store_n(&ch->out->closed, 1, __ATOMIC_RELEASE);
+  tm_shm__wake(&ch->out->data_seq, &ch->out->consumer_waiting);
+  __atomic_store_n(&ch->in->reader_closed, 1, __ATOMIC_RELEASE);
+  tm_shm__wake(&ch->in->space_seq, &ch->in->producer_waiting);
+  munmap(ch->base, ch->size);
+  // releases the lock, after the flags are set
+  close(ch->fd);
+}
+
+#endif
@@ -123,6 +123,9 @@ pub fn evaluate(
     if let Some(memory_limit) = task.memory_limit {
         sol_limits.memory(memory_limit * 1024); // MiB -> KiB
     }
+    if let Some(instruction_limit) = task.instruction_limit {
+        sol_limits.instructions(instruction_limit);
+    }
     group.add_execution(sol_exec);
 
     let path = source_file.path.clone();
@@ -139,6 +142,7 @@ pub fn evaluate(
         path
     )?;
 
+    ScoreManager::bind_evaluation(&score_manager, eval, subtask_id, testcase_id, group.uuid);
     let sender = eval.sender.clone();
     eval.dag.on_execution_done(&group.uuid, move |results| {
         let send_score = |score, message: String| {
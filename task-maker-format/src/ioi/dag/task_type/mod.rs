@@ -7,7 +7,7 @@ pub use interactive::InteractiveTypeData;
 use serde::{Deserialize, Serialize};
 use task_maker_dag::FileUuid;
 
-use crate::ioi::{Checker, IOITask, ScoreManager, SubtaskId, TestcaseId};
+use crate::ioi::{Checker, CheckerBatch, IOITask, ScoreManager, SubtaskId, TestcaseId};
 use crate::{EvaluationData, SourceFile};
 
 mod batch;
@@ -32,7 +32,8 @@ pub enum TaskType {
 
 impl TaskType {
     /// Evaluate a solution on a testcase, eventually adding to the `ScoreManager` the result of the
-    /// evaluation. This will add both the execution as well as the checking to the DAG.
+    /// evaluation. This will add both the execution as well as the checking to the DAG, unless the
+    /// checking is delayed to the `checker_batch` of the solution.
     #[allow(clippy::too_many_arguments)]
     pub(crate) fn evaluate(
         &self,
@@ -45,6 +46,7 @@ impl TaskType {
         validation_handle: Option<FileUuid>,
         correct_output: Option<FileUuid>,
         score_manager: Arc<Mutex<ScoreManager>>,
+        checker_batch: &mut CheckerBatch,
     ) -> Result<(), Error> {
         match self {
             TaskType::Batch(data) => batch::evaluate(
@@ -57,6 +59,7 @@ impl TaskType {
                 validation_handle,
                 correct_output,
                 score_manager,
+                checker_batch,
                 data,
             ),
             TaskType::Communication(data) => communication::evaluate(
@@ -87,6 +90,18 @@ impl TaskType {
         }
     }
 
+    /// Add to the DAG the checking of the outputs of a solution that were delayed by `evaluate`.
+    pub(crate) fn check_batch(
+        &self,
+        eval: &mut EvaluationData,
+        checker_batch: CheckerBatch,
+    ) -> Result<(), Error> {
+        match self {
+            TaskType::Batch(data) => data.checker.check_batch_and_bind(eval, checker_batch),
+            _ => Ok(()),
+        }
+    }
+
     /// Add to the DAG more executions based on the current task type.
     ///
     /// For example this will force the compilation of the checker in a batch task.
@@ -96,7 +111,7 @@ impl TaskType {
                 Checker::Custom(checker) => {
                     checker.prepare(eval)?;
                 }
-                Checker::WhiteDiff => {}
+                Checker::WhiteDiff | Checker::TokenDiff(_) => {}
             },
             TaskType::Communication(communication) => {
                 communication.manager.prepare(eval)?;
@@ -0,0 +1,457 @@
+//! Results of the previous evaluations of the solutions, for evaluating only what changed.
+//!
+//! Even when all the executions are in the cache of the executor, evaluating a task with many
+//! solutions sends all of them through the scheduler, and the files are fetched again. With the
+//! incremental mode the messages to the UI about the evaluation of each solution on each testcase
+//! are stored inside `bin/`, keyed by the hash of the solution, of the files that produce the
+//! testcase and of the checker. When none of them changed the evaluation is not added to the DAG:
+//! the stored messages are sent to the UI again, and the score is given to the `ScoreManager`.
+//!
+//! The compiled binaries are not available before building the DAG, so the solutions are hashed
+//! by their source and the graders, and by their toolchain: the compilation commands with their
+//! flags, and the compilers and interpreters found in `$PATH`. The same compiler with the same
+//! flags is assumed to always produce the same binary.
+
+use std::collections::{HashMap, HashSet};
+use std::fs;
+use std::path::{Path, PathBuf};
+use std::sync::{Arc, Mutex};
+
+use anyhow::{Context, Error};
+use serde::{Deserialize, Serialize};
+
+use crate::ioi::{IOITask, InputGenerator, OutputGenerator, TestcaseId};
+use crate::ui::{UIChannelReceiver, UIExecutionStatus, UIMessage, UIMessageSender};
+use crate::EvaluationData;
+
+/// Where the cache is stored, relative to the task directory.
+const EVALUATION_CACHE_PATH: &str = "bin/evaluations.cache.json";
+/// The directories with the files that may change the results of all the evaluations.
+const TASK_DIRECTORIES: [&str; 3] = ["gen", "check", "cor"];
+
+/// The content of the cache file.
+#[derive(Debug, Default, Serialize, Deserialize)]
+struct CacheContent {
+    /// The last message of the compilation of each solution, by the key of the solution.
+    compilations: HashMap<String, UIMessage>,
+    /// The evaluations of the solutions on the testcases, by the keys of the solution and of the
+    /// testcase.
+    evaluations: HashMap<String, CachedEvaluation>,
+}
+
+/// The stored evaluation of a solution on a testcase.
+#[derive(Debug, Clone, Serialize, Deserialize)]
+pub(crate) struct CachedEvaluation {
+    /// The messages with the results of the evaluation and of the checker, in the order they were
+    /// sent.
+    messages: Vec<UIMessage>,
+    /// The score of the solution on the testcase.
+    pub score: f64,
+    /// The message associated with the score.
+    pub message: String,
+}
+
+/// The evaluations of the previous run of a task, and the recording of the current one.
+#[derive(Debug)]
+pub struct EvaluationCache {
+    /// The root directory of the task.
+    task_dir: PathBuf,
+    /// The content of the cache from the previous run.
+    previous: CacheContent,
+    /// The key of each solution to evaluate.
+    solution_keys: HashMap<PathBuf, String>,
+    /// The key of each testcase.
+    testcase_keys: HashMap<TestcaseId, String>,
+    /// The solutions with at least an evaluation not found in the cache.
+    evaluated: HashSet<PathBuf>,
+    /// The number of evaluations taken from the cache.
+    hits: usize,
+    /// A copy of the messages sent to the UI, see `is_recorded`.
+    receiver: Mutex<UIChannelReceiver>,
+}
+
+impl CachedEvaluation {
+    /// Send again to the UI the results of the evaluation.
+    pub(crate) fn replay(&self, sender: &Arc<Mutex<UIMessageSender>>) -> Result<(), Error> {
+        let sender = sender.lock().unwrap();
+        for message in &self.messages {
+            sender.send(message.clone())?;
+        }
+        Ok(())
+    }
+}
+
+impl EvaluationCache {
+    /// Load the cache of the task, computing the keys of its testcases and of the solutions of
+    /// `eval`. From now on the results sent to the UI are recorded, for storing them at the end.
+    pub fn new(task: &IOITask, eval: &mut EvaluationData) -> Result<EvaluationCache, Error> {
+        let mut hasher = FileHasher::default();
+        let task_key = task_key(task, eval, &mut hasher)?;
+        let mut testcase_keys = HashMap::new();
+        for subtask in task.subtasks.values() {
+            for &testcase_id in &subtask.testcases_owned {
+                let testcase = &task.testcases[&testcase_id];
+                let mut key = blake3::Hasher::new();
+                key.update(task_key.as_bytes());
+                key.update(&subtask.id.to_le_bytes());
+                key.update(&testcase_id.to_le_bytes());
+                match &testcase.input_generator {
+                    InputGenerator::StaticFile(path) => hasher.hash(&mut key, path)?,
+                    InputGenerator::Custom(source, args) => {
+                        hasher.hash(&mut key, &source.path)?;
+                        hash_args(&mut key, args);
+                    }
+                }
+                match &testcase.output_generator {
+                    OutputGenerator::NotAvailable => {}
+                    OutputGenerator::StaticFile(path) => hasher.hash(&mut key, path)?,
+                    OutputGenerator::Custom(source, args) => {
+                        hasher.hash(&mut key, &source.path)?;
+                        hash_args(&mut key, args);
+                    }
+                }
+                testcase_keys.insert(testcase_id, key.finalize().to_hex().to_string());
+            }
+        }
+        let mut solution_keys = HashMap::new();
+        for solution in &eval.solutions {
+            let path = &solution.source_file.path;
+            let mut key = blake3::Hasher::new();
+            key.update(path.to_string_lossy().as_bytes());
+            hasher.hash(&mut key, path)?;
+            let toolchain = solution
+                .source_file
+                .toolchain()
+                .with_context(|| format!("Failed to get the toolchain of {}", path.display()))?;
+            key.update(toolchain.as_bytes());
+            solution_keys.insert(path.clone(), key.finalize().to_hex().to_string());
+        }
+        let receiver = eval.sender.lock().unwrap().mirror(is_recorded);
+        Ok(EvaluationCache {
+            previous: load(&task.path),
+            task_dir: task.path.clone(),
+            solution_keys,
+            testcase_keys,
+            evaluated: HashSet::new(),
+            hits: 0,
+            receiver: Mutex::new(receiver),
+        })
+    }
+
+    /// The stored evaluation of the solution on the testcase, if none of their files changed. If
+    /// there is none the solution will be compiled and evaluated, so its compilation is not
+    /// replayed.
+    pub(crate) fn get(
+        &mut self,
+        solution: &Path,
+        testcase_id: TestcaseId,
+    ) -> Option<CachedEvaluation> {
+        let cached = self
+            .evaluation_key(solution, testcase_id)
+            .and_then(|key| self.previous.evaluations.get(&key))
+            .cloned();
+        match cached {
+            Some(_) => self.hits += 1,
+            None => {
+                self.evaluated.insert(solution.to_owned());
+            }
+        }
+        cached
+    }
+
+    /// Send again to the UI the compilation of the solutions whose evaluations all come from the
+    /// cache, since they are not compiled.
+    pub(crate) fn replay_compilations(
+        &self,
+        sender: &Arc<Mutex<UIMessageSender>>,
+    ) -> Result<(), Error> {
+        info!("{} evaluations taken from the cache", self.hits);
+        let sender = sender.lock().unwrap();
+        for (solution, key) in &self.solution_keys {
+            if self.evaluated.contains(solution) {
+                continue;
+            }
+            if let Some(message) = self.previous.compilations.get(key) {
+                sender.send(message.clone())?;
+            }
+        }
+        Ok(())
+    }
+
+    /// Store the evaluations recorded in this run, including the ones taken from the cache. The
+    /// evaluations of the solutions and the testcases that are not present anymore are dropped.
+    pub fn store(&self) -> Result<(), Error> {
+        let mut content = CacheContent::default();
+        let mut messages: HashMap<(PathBuf, TestcaseId), Vec<UIMessage>> = HashMap::new();
+        for message in self.receiver.lock().unwrap().try_iter() {
+            match &message {
+                UIMessage::Compilation { file, .. } => {
+                    if let Some(key) = self.solution_keys.get(file) {
+                        content.compilations.insert(key.clone(), message);
+                    }
+                }
+                UIMessage::IOIEvaluation {
+                    solution, testcase, ..
+                }
+                | UIMessage::IOIChecker {
+                    solution, testcase, ..
+                } => {
+                    let key = (solution.clone(), *testcase);
+                    messages.entry(key).or_default().push(message);
+                }
+                UIMessage::IOITestcaseScore {
+                    solution,
+                    testcase,
+                    score,
+                    message,
+                    ..
+                } => {
+                    let Some(key) = self.evaluation_key(solution, *testcase) else {
+                        continue;
+                    };
+                    let evaluation = CachedEvaluation {
+                        messages: messages
+                            .remove(&(solution.clone(), *testcase))
+                            .unwrap_or_default(),
+                        score: *score,
+                        message: message.clone(),
+                    };
+                    content.evaluations.insert(key, evaluation);
+                }
+                _ => {}
+            }
+        }
+        let path = self.task_dir.join(EVALUATION_CACHE_PATH);
+        if let Some(parent) = path.parent() {
+            fs::create_dir_all(parent)
+                .with_context(|| format!("Failed to create {}", parent.display()))?;
+        }
+        let serialized = serde_json::to_vec(&content).context("Failed to serialize the cache")?;
+        fs::write(&path, serialized).with_context(|| format!("Failed to write {}", path.display()))
+    }
+
+    /// The key of the evaluation of the solution on the testcase.
+    fn evaluation_key(&self, solution: &Path, testcase_id: TestcaseId) -> Option<String> {
+        let solution = self.solution_keys.get(solution)?;
+        let testcase = self.testcase_keys.get(&testcase_id)?;
+        Some(format!("{solution}-{testcase}"))
+    }
+}
+
+/// Whether the message has to be stored with the evaluation it's about.
+fn is_recorded(message: &UIMessage) -> bool {
+    matches!(
+        message,
+        UIMessage::Compilation {
+            status: UIExecutionStatus::Done { .. },
+            ..
+        } | UIMessage::IOIEvaluation {
+            status: UIExecutionStatus::Done { .. },
+            ..
+        } | UIMessage::IOIChecker {
+            status: UIExecutionStatus::Done { .. },
+            ..
+        } | UIMessage::IOITestcaseScore { .. }
+    )
+}
+
+/// The hash of what may change the results of all the evaluations: the limits and the type of the
+/// task, the configuration of the sandboxes, the graders and the files of the generators and of
+/// the checker.
+fn task_key(
+    task: &IOITask,
+    eval: &EvaluationData,
+    hasher: &mut FileHasher,
+) -> Result<String, Error> {
+    let mut key = blake3::Hasher::new();
+    key.update(env!("CARGO_PKG_VERSION").as_bytes());
+    let config = &eval.dag.data.config;
+    let settings = serde_json::to_vec(&(
+        task.time_limit,
+        task.memory_limit,
+        task.instruction_limit,
+        &task.infile,
+        &task.outfile,
+        &task.task_type,
+        config.extra_time,
+        config.extra_memory,
+        config.timing_reruns,
+        config.timing_margin,
+        config.hardware_counters,
+    ))
+    .context("Failed to serialize the task")?;
+    key.update(&settings);
+    let mut files: Vec<PathBuf> = task.grader_map.all_paths().map(Path::to_path_buf).collect();
+    for dir in TASK_DIRECTORIES {
+        let dir = task.path.join(dir);
+        if !dir.is_dir() {
+            continue;
+        }
+        for entry in
+            fs::read_dir(&dir).with_context(|| format!("Failed to list {}", dir.display()))?
+        {
+            let entry = entry.with_context(|| format!("Failed to list {}", dir.display()))?;
+            // gen/GEN is generated from gen/cases.gen
+            if entry.file_name() != "GEN" && entry.path().is_file() {
+                files.push(entry.path());
+            }
+        }
+    }
+    files.sort();
+    for file in files {
+        key.update(file.to_string_lossy().as_bytes());
+        hasher.hash(&mut key, &file)?;
+    }
+    Ok(key.finalize().to_hex().to_string())
+}
+
+/// Add the arguments of a generator to the hash.
+fn hash_args(key: &mut blake3::Hasher, args: &[String]) {
+    for arg in args {
+        key.update(&(arg.len() as u64).to_le_bytes());
+        key.update(arg.as_bytes());
+    }
+}
+
+/// Hashes the files, each one only once: the same generator is used by many testcases.
+#[derive(Debug, Default)]
+struct FileHasher {
+    /// The hash of the files already read.
+    hashes: HashMap<PathBuf, blake3::Hash>,
+}
+
+impl FileHasher {
+    /// Add the content of the file to the hash.
+    fn hash(&mut self, key: &mut blake3::Hasher, path: &Path) -> Result<(), Error> {
+        if !self.hashes.contains_key(path) {
+            let content =
+                fs::read(path).with_context(|| format!("Failed to read {}", path.display()))?;
+            self.hashes.insert(path.to_owned(), blake3::hash(&content));
+        }
+        key.update(self.hashes[path].as_bytes());
+        Ok(())
+    }
+}
+
+/// Load the cache of the task, empty if it's missing or corrupted.
+fn load(task_dir: &Path) -> CacheContent {
+    let path = task_dir.join(EVALUATION_CACHE_PATH);
+    let Ok(content) = fs::read(&path) else {
+        return CacheContent::default();
+    };
+    serde_json::from_slice(&content).unwrap_or_else(|e| {
+        debug!("Ignoring corrupted cache at {}: {e}", path.display());
+        CacheContent::default()
+    })
+}
+
+#[cfg(test)]
+mod tests {
+    use task_maker_dag::{ExecutionResourcesUsage, ExecutionResult, ExecutionStatus};
+    use tempfile::TempDir;
+
+    use super::*;
+    use crate::ioi::{SubtaskInfo, TestcaseInfo};
+
+    /// A task with a single testcase, from a static input file.
+    fn make_task(dir: &Path) -> IOITask {
+        fs::create_dir_all(dir.join("sol")).unwrap();
+        fs::write(dir.join("input.txt"), "1 2").unwrap();
+        fs::write(dir.join("sol/sol.py"), "print(3)").unwrap();
+        let mut task = IOITask::fake();
+        task.path = dir.to_owned();
+        task.testcases.insert(
+            0,
+            TestcaseInfo::new(
+                0,
+                InputGenerator::StaticFile(dir.join("input.txt")),
+                OutputGenerator::NotAvailable,
+            ),
+        );
+        task.subtasks.insert(
+            0,
+            SubtaskInfo {
+                id: 0,
+                max_score: 100.0,
+                testcases: vec![0],
+                testcases_owned: vec![0],
+                ..Default::default()
+            },
+        );
+        task
+    }
+
+    /// Prepare the evaluation of the task, with the cache.
+    fn make_cache(task: &IOITask) -> (EvaluationData, UIChannelReceiver, EvaluationCache) {
+        let (mut eval, receiver) = EvaluationData::new(&task.path);
+        eval.solutions = crate::EvaluationConfig::default().find_solutions(
+            &task.path,
+            vec!["sol/*"],
+            None,
+            &mut eval,
+        );
+        let cache = EvaluationCache::new(task, &mut eval).unwrap();
+        (eval, receiver, cache)
+    }
+
+    #[test]
+    fn test_evaluation_cache() {
+        let dir = TempDir::new().unwrap();
+        let task = make_task(dir.path());
+        let solution = dir.path().join("sol/sol.py");
+
+        let (eval, _receiver, mut cache) = make_cache(&task);
+        assert!(cache.get(&solution, 0).is_none());
+        let result = ExecutionResult {
+            status: ExecutionStatus::Success,
+            was_killed: false,
+            was_cached: false,
+            resources: ExecutionResourcesUsage {
+                cpu_time: 0.5,
+                sys_time: 0.0,
+                wall_time: 0.6,
+                memory: 1000,
+                counters: None,
+            },
+            stdout: None,
+            stderr: None,
+            timing: None,
+        };
+        let sender = eval.sender.lock().unwrap();
+        sender
+            .send(UIMessage::IOIEvaluation {
+                subtask: 0,
+                testcase: 0,
+                solution: solution.clone(),
+                status: UIExecutionStatus::Done {
+                    result: vec![result],
+                },
+                manager_index: None,
+            })
+            .unwrap();
+        sender
+            .send(UIMessage::IOITestcaseScore {
+                subtask: 0,
+                testcase: 0,
+                solution: solution.clone(),
+                score: 1.0,
+                message: "Output is correct".into(),
+            })
+            .unwrap();
+        drop(sender);
+        cache.store().unwrap();
+
+        let (_eval, _receiver, mut cache) = make_cache(&task);
+        let cached = cache.get(&solution, 0).unwrap();
+        assert_eq!(cached.score, 1.0);
+        assert_eq!(cached.message, "Output is correct");
+        assert_eq!(cached.messages.len(), 1);
+        assert!(cache.evaluated.is_empty());
+
+        // changing the input invalidates the evaluation
+        fs::write(dir.path().join("input.txt"), "2 3").unwrap();
+        let (_eval, _receiver, mut cache) = make_cache(&task);
+        assert!(cache.get(&solution, 0).is_none());
+        assert!(cache.evaluated.contains(&solution));
+    }
+}
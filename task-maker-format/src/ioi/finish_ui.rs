@@ -7,7 +7,7 @@ use termcolor::{Color, ColorChoice, ColorSpec, StandardStream};
 
 use crate::ioi::ui_state::{SolutionEvaluationState, TestcaseEvaluationStatus, UIState};
 use crate::ioi::{
-    IOITask, SolutionCheckOutcome, SolutionTestcaseEvaluationState, SubtaskId, TestcaseId,
+    IOITask, Profile, SolutionCheckOutcome, SolutionTestcaseEvaluationState, SubtaskId, TestcaseId,
 };
 use crate::ui::{
     FinishUI as FinishUITrait, FinishUIUtils, UIExecutionStatus, BLUE, BOLD, GREEN, ORANGE, RED,
@@ -23,6 +23,8 @@ pub const BOLD_RESOURCE_THRESHOLD: f64 = 0.9;
 /// a solution is >= time limit of the task * YELLOW_RESOURCE_THRESHOLD, it is shown in yellow. Same
 /// for the memory usage.
 pub const YELLOW_RESOURCE_THRESHOLD: f64 = 0.6;
+/// Number of functions shown for the profiled testcases.
+pub const PROFILE_HOT_SPOTS: usize = 5;
 
 /// UI that prints to `stdout` the ending result of the evaluation of a IOI task.
 pub struct FinishUI {
@@ -36,6 +38,14 @@ impl FinishUITrait<UIState> for FinishUI {
             stream: StandardStream::stdout(ColorChoice::Auto),
         };
         ui.print_task_info(state);
+        // only the estimate is computed in estimate-only mode, nothing has run
+        let status = state.executor_status.as_ref();
+        if let Some(estimate) = status.and_then(|status| status.cost_estimate.as_ref()) {
+            println!();
+            FinishUIUtils::new(&mut ui.stream).print_cost_estimate(estimate);
+            FinishUIUtils::new(&mut ui.stream).print_diagnostic_messages(&state.diagnostics);
+            return;
+        }
         if !state.compilations.is_empty() {
             println!();
             FinishUIUtils::new(&mut ui.stream).print_compilations(&state.compilations);
@@ -284,6 +294,13 @@ impl FinishUI {
                         * YELLOW_RESOURCE_THRESHOLD,
                 );
                 cwrite!(self, time_color, "{:2.3}s", result.resources.cpu_time);
+                // the time shown is the median of the runs
+                if let Some(timing) = &result.timing {
+                    print!(" ({:.3}-{:.3}s)", timing.min, timing.max);
+                }
+                if let Some(counters) = &result.resources.counters {
+                    print!(" ({:.1}M instr)", counters.instructions as f64 / 1e6);
+                }
                 print!(" | ");
                 cwrite!(
                     self,
@@ -321,6 +338,33 @@ impl FinishUI {
             self.print_right(format!("[{name}]"));
         }
         println!();
+        if let Some(profile) = &testcase.profile {
+            self.print_profile(profile);
+        }
+    }
+
+    /// Print the functions where a solution spent most of its time on a testcase.
+    fn print_profile(&mut self, profile: &Result<Profile, String>) {
+        print!("     ");
+        cwrite!(self, BOLD, "Profile:");
+        match profile {
+            Ok(profile) if profile.samples() == 0 => println!(" no samples"),
+            Ok(profile) => {
+                let samples = profile.samples();
+                let hot_spots = profile
+                    .hot_spots(PROFILE_HOT_SPOTS)
+                    .into_iter()
+                    .map(|(function, count)| {
+                        format!("{function} {:.1}%", count as f64 * 100.0 / samples as f64)
+                    })
+                    .join(", ");
+                println!(" {samples} samples, {hot_spots}");
+            }
+            Err(e) => {
+                print!(" ");
+                cwriteln!(self, RED, "{}", e);
+            }
+        }
     }
 
     /// The number of significant digits to use for printing a score.
@@ -321,6 +321,7 @@ pub(super) fn parse(
                     output_generator: output_generator.clone(),
                     input_file: None,
                     official_output_file: None,
+                    same_as: None,
                 },
             );
         }
@@ -353,6 +354,7 @@ pub(super) fn parse(
                     output_generator: output_generator.clone(),
                     input_file: None,
                     official_output_file: None,
+                    same_as: None,
                 },
             );
         }
@@ -382,6 +384,7 @@ pub(super) fn parse(
                     output_generator: output_generator.clone(),
                     input_file: None,
                     official_output_file: None,
+                    same_as: None,
                 },
             );
             Ok(())
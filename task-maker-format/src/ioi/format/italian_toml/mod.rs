@@ -65,7 +65,7 @@ pub fn parse_task<P: AsRef<Path>>(
     } else if let Some(comm) = communication {
         comm
     } else {
-        parse_batch_task_data(task_dir, grader_map.clone())?
+        parse_batch_task_data(task_dir, grader_map.clone(), &config)?
     };
 
     let (subtasks, testcases) = gen_toml::parse(task_dir, &config, &task_type, grader_map.clone())?;
@@ -118,6 +118,7 @@ pub fn parse_task<P: AsRef<Path>>(
         title: config.title,
         time_limit: config.time_limit,
         memory_limit: config.memory_limit,
+        instruction_limit: config.instruction_limit,
         infile,
         outfile,
         testcase_score_aggregator,
@@ -128,6 +129,8 @@ pub fn parse_task<P: AsRef<Path>>(
         booklets: Vec::new(),
         difficulty: config.difficulty,
         syllabus_level: config.syllabuslevel,
+        batch_validator: config.batch_validator.unwrap_or(false),
+        batch_generator: config.batch_generator.unwrap_or(false),
         sanity_checks: Arc::new(get_sanity_checks(
             &eval_config
                 .disabled_sanity_checks
@@ -135,6 +138,7 @@ pub fn parse_task<P: AsRef<Path>>(
                 .map(String::as_str)
                 .collect::<Vec<_>>(),
         )),
+        evaluation_cache: None,
         input_validator_generator: Default::default(),
     };
     // split the creation of the task because make_booklets need an instance of Task
@@ -171,7 +175,11 @@ fn detect_output_generator(task_dir: &Path, grader_map: Arc<GraderMap>) -> Resul
 }
 
 /// Parse the task components relative to the batch task type.
-fn parse_batch_task_data(task_dir: &Path, grader_map: Arc<GraderMap>) -> Result<TaskType, Error> {
+fn parse_batch_task_data(
+    task_dir: &Path,
+    grader_map: Arc<GraderMap>,
+    yaml: &TaskYAML,
+) -> Result<TaskType, Error> {
     let mut checkers = find_source_file(
         task_dir,
         vec!["check/checker.*"],
@@ -193,14 +201,28 @@ fn parse_batch_task_data(task_dir: &Path, grader_map: Arc<GraderMap>) -> Result<
             // Link the checker statically. This makes sure that it will work also outside this machine.
             c.link_static();
 
+            // Provide the fast I/O helpers to the checker.
+            Checker::add_checker_lib(&mut c);
+
             Checker::Custom(Arc::new(c))
         })
-        .unwrap_or(Checker::WhiteDiff);
+        .unwrap_or_else(|| {
+            yaml.builtin_checker
+                .map_or(Checker::WhiteDiff, Checker::TokenDiff)
+        });
+    if yaml.builtin_checker.is_some() && matches!(checker, Checker::Custom(_)) {
+        warn!("builtin_checker is set but the task has a custom checker, ignoring it");
+    }
+    let batch_checker = yaml.batch_checker.unwrap_or(false);
+    if batch_checker && !matches!(checker, Checker::Custom(_)) {
+        warn!("batch_checker is set but the task has no custom checker, ignoring it");
+    }
 
     let official_solution = detect_output_generator(task_dir, grader_map)
         .context("Failed to detect output generator")?;
     Ok(TaskType::Batch(BatchTypeData {
         output_generator: Some(official_solution),
+        batch_checker: batch_checker && matches!(checker, Checker::Custom(_)),
         checker,
     }))
 }
@@ -273,6 +295,9 @@ fn parse_communication_task_data(
     // Link the manager statically. This makes sure that it will work also outside this machine.
     manager.link_static();
 
+    // Provide the shared memory channels to the manager, if it uses them.
+    CommunicationTypeData::add_shm_lib(yaml.user_io, &mut manager);
+
     Ok(Some(TaskType::Communication(CommunicationTypeData {
         manager: Arc::new(manager),
         num_processes: yaml.num_processes.unwrap_or(1),
@@ -28,6 +28,18 @@ mod parser {
 /// Helper type for lightening the types.
 type Pair<'a> = pest::iterators::Pair<'a, parser::Rule>;
 
+/// Write `content` to the gen/GEN file inside the task directory, unless the file is not managed by
+/// task-maker.
+pub(crate) fn write_gen_gen(task_dir: &Path, content: &str) -> Result<(), Error> {
+    let dest = task_dir.join("gen/GEN");
+    if dest.exists() && !is_tm_deletable(&dest)? {
+        warn!("The gen/GEN file does not contain {TM_ALLOW_DELETE_COOKIE}. Won't overwrite",);
+        return Ok(());
+    }
+    fs::write(dest, content).context("Failed to write gen/GEN")?;
+    Ok(())
+}
+
 /// A manager is either a generator or a validator, since they have the same internal structure they
 /// are abstracted as a `Manager`.
 #[derive(Debug)]
@@ -223,13 +235,8 @@ where
         self.result.clone()
     }
 
-    /// Write an auto-generated version of the gen/GEN file inside the task directory.
-    pub(crate) fn write_gen_gen(&self) -> Result<(), Error> {
-        let dest = self.task_dir.join("gen/GEN");
-        if dest.exists() && !is_tm_deletable(&dest)? {
-            warn!("The gen/GEN file does not contain {TM_ALLOW_DELETE_COOKIE}. Won't overwrite",);
-            return Ok(());
-        }
+    /// The content of the auto-generated version of the gen/GEN file.
+    pub(crate) fn gen_gen_content(&self) -> String {
         let mut gen = "# Generated by task-maker. Do not edit!\n".to_string();
         let _ = writeln!(gen, "# {TM_ALLOW_DELETE_COOKIE}");
         gen += "# Removing or changing the line above will prevent task-maker from touching this file again.\n\n";
@@ -270,8 +277,7 @@ where
                 }
             }
         }
-        fs::write(self.task_dir.join("gen/GEN"), gen).context("Failed to write gen/GEN")?;
-        Ok(())
+        gen
     }
 
     /// Parse a line with a command: one of the `:` prefixed actions.
@@ -781,7 +787,7 @@ mod tests {
     use tempfile::TempDir;
 
     use crate::ioi::format::italian_yaml::cases_gen::{
-        CasesGen, ConstraintOperand, ConstraintOperator,
+        write_gen_gen, CasesGen, ConstraintOperand, ConstraintOperator,
     };
     use crate::ioi::format::italian_yaml::TaskInputEntry;
     use crate::ioi::{
@@ -837,7 +843,7 @@ mod tests {
             .add_file("gen/generator.py")
             .cases_gen(":GEN gen gen/generator.py\n:SUBTASK 42 lol\n12 34\n:SUBTASK 24\n21 21")
             .unwrap();
-        gen.write_gen_gen().unwrap();
+        write_gen_gen(&gen.task_dir, &gen.gen_gen_content()).unwrap();
         let path = gen.task_dir.join("gen/GEN");
         let data = std::fs::read_to_string(path).unwrap();
         let res: Vec<_> = data
@@ -264,6 +264,7 @@ use std::sync::Arc;
 use anyhow::{anyhow, bail, Context, Error};
 use itertools::Itertools;
 use serde::{Deserialize, Serialize, Serializer};
+use task_maker_dag::TokenDiffOptions;
 use task_maker_lang::GraderMap;
 use unic::normal::StrNormalForm;
 use unic::ucd::category::GeneralCategory;
@@ -278,6 +279,7 @@ use crate::{find_source_file, list_files, EvaluationConfig, WriteBinTo};
 
 mod cases_gen;
 mod gen_gen;
+mod parse_cache;
 mod static_inputs;
 
 /// String placed in the auto-generated files marking them as safely deletable.
@@ -371,6 +373,10 @@ pub(super) struct TaskYAML {
     /// The memory limit in MiB of the execution of the solution, if not set it's unlimited.
     #[serde(alias = "memlimit")]
     pub memory_limit: Option<u64>,
+    /// The limit on the instructions retired by the solution, used instead of the time limit when
+    /// the hardware counters are available.
+    #[serde(skip_serializing_if = "Option::is_none")]
+    pub instruction_limit: Option<u64>,
 
     /// Whether this is an output only task. Defaults to false.
     #[serde(default)]
@@ -408,6 +414,22 @@ pub(super) struct TaskYAML {
     /// Whether the solution processes are assumed to be concurrent (wall time max-ed, memory summed)
     /// or sequential (wall time sum-ed, memory max-ed).
     pub interactive_concurrent: Option<bool>,
+    /// Whether the custom checker supports the batch protocol, checking all the outputs of a
+    /// solution with a single execution.
+    #[serde(skip_serializing)]
+    pub batch_checker: Option<bool>,
+    /// Whether the validator supports the batch protocol, validating all the input files with a
+    /// single execution.
+    #[serde(skip_serializing)]
+    pub batch_validator: Option<bool>,
+    /// Whether the generators support the batch protocol, generating many input files with a
+    /// single execution.
+    #[serde(skip_serializing)]
+    pub batch_generator: Option<bool>,
+    /// The rules of the built-in checker used when the task has no custom checker, comparing the
+    /// tokens of the outputs. When it's not set the outputs are compared ignoring the whitespace.
+    #[serde(skip_serializing)]
+    pub builtin_checker: Option<TokenDiffOptions>,
 
     /// Compatibility with cms, unused.
     pub score_mode: Option<String>,
@@ -439,6 +461,9 @@ pub(super) struct TaskYAMLOrig {
     pub time_limit: f64,
     /// The memory limit in MiB of the execution of the solution.
     pub memory_limit: u64,
+    /// The limit on the instructions retired by the solution, if any.
+    #[serde(default)]
+    pub instruction_limit: Option<u64>,
 
     /// Whether this is an output only task. Defaults to false.
     #[serde(default)]
@@ -476,6 +501,22 @@ pub(super) struct TaskYAMLOrig {
     /// Whether the solution processes are assumed to be concurrent (wall time max-ed, memory summed)
     /// or sequential (wall time sum-ed, memory max-ed).
     pub interactive_concurrent: Option<bool>,
+    /// Whether the custom checker supports the batch protocol, checking all the outputs of a
+    /// solution with a single execution.
+    #[serde(skip_serializing)]
+    pub batch_checker: Option<bool>,
+    /// Whether the validator supports the batch protocol, validating all the input files with a
+    /// single execution.
+    #[serde(skip_serializing)]
+    pub batch_validator: Option<bool>,
+    /// Whether the generators support the batch protocol, generating many input files with a
+    /// single execution.
+    #[serde(skip_serializing)]
+    pub batch_generator: Option<bool>,
+    /// The rules of the built-in checker used when the task has no custom checker, comparing the
+    /// tokens of the outputs. When it's not set the outputs are compared ignoring the whitespace.
+    #[serde(skip_serializing)]
+    pub builtin_checker: Option<TokenDiffOptions>,
 
     /// Compatibility with cms, not directly used.
     pub feedback_level: Option<String>,
@@ -493,6 +534,7 @@ impl TaskYAMLOrig {
             primary_language: Some(self.primary_language.unwrap_or_else(|| "en".into())),
             time_limit: Some(self.time_limit),
             memory_limit: Some(self.memory_limit),
+            instruction_limit: self.instruction_limit,
             output_only: self.output_only,
             infile: self.infile,
             outfile: self.outfile,
@@ -512,6 +554,10 @@ impl TaskYAMLOrig {
             ),
             controller_process_limit: Some(self.controller_process_limit.unwrap_or(200)),
             interactive_concurrent: Some(self.interactive_concurrent.unwrap_or(true)),
+            batch_checker: self.batch_checker,
+            batch_validator: self.batch_validator,
+            batch_generator: self.batch_generator,
+            builtin_checker: self.builtin_checker,
             score_mode: Some("max_subtask".into()),
             token_mode: Some("disabled".into()),
             public_testcases: Some("all".into()),
@@ -521,7 +567,7 @@ impl TaskYAMLOrig {
 }
 
 /// The iterator item type when following the task input testcases.
-#[derive(Debug, Clone)]
+#[derive(Debug, Clone, Serialize, Deserialize)]
 pub(crate) enum TaskInputEntry {
     /// Create a new subtask given its information.
     Subtask(SubtaskInfo),
@@ -606,7 +652,7 @@ pub fn parse_task<P: AsRef<Path>>(
     } else if let Some(comm) = communication {
         comm
     } else {
-        parse_batch_task_data(task_dir, grader_map.clone())?
+        parse_batch_task_data(task_dir, grader_map.clone(), &yaml)?
     };
 
     let gen_gen = task_dir.join("gen").join("GEN");
@@ -622,12 +668,7 @@ pub fn parse_task<P: AsRef<Path>>(
         };
 
     let inputs = if cases_gen.exists() {
-        debug!("Parsing testcases from gen/cases.gen");
-        let gen = cases_gen::CasesGen::new(&cases_gen, output_generator)?;
-        if !eval_config.dry_run {
-            gen.write_gen_gen().context("Failed to write gen/GEN")?;
-        }
-        gen.get_task_entries()
+        parse_cache::cases_gen_entries(task_dir, &cases_gen, output_generator, eval_config)?
     } else if gen_gen.exists() {
         debug!("Parsing testcases from gen/GEN");
         gen_gen::parse_gen_gen(
@@ -746,6 +787,7 @@ pub fn parse_task<P: AsRef<Path>>(
         title: yaml.title,
         time_limit: yaml.time_limit,
         memory_limit: yaml.memory_limit,
+        instruction_limit: yaml.instruction_limit,
         infile,
         outfile,
         testcase_score_aggregator,
@@ -756,6 +798,8 @@ pub fn parse_task<P: AsRef<Path>>(
         booklets: Vec::new(),
         difficulty: yaml.difficulty,
         syllabus_level: yaml.syllabuslevel,
+        batch_validator: yaml.batch_validator.unwrap_or(false),
+        batch_generator: yaml.batch_generator.unwrap_or(false),
         sanity_checks: Arc::new(get_sanity_checks(
             &eval_config
                 .disabled_sanity_checks
@@ -763,6 +807,7 @@ pub fn parse_task<P: AsRef<Path>>(
                 .map(String::as_str)
                 .collect::<Vec<_>>(),
         )),
+        evaluation_cache: None,
         input_validator_generator: InputValidatorGenerator::new(
             detect_validator(task_dir.to_path_buf()).context("Failed to detect validator")?,
         ),
@@ -864,7 +909,11 @@ fn detect_output_generator(
 }
 
 /// Parse the task components relative to the batch task type.
-fn parse_batch_task_data(task_dir: &Path, grader_map: Arc<GraderMap>) -> Result<TaskType, Error> {
+fn parse_batch_task_data(
+    task_dir: &Path,
+    grader_map: Arc<GraderMap>,
+    yaml: &TaskYAML,
+) -> Result<TaskType, Error> {
     let mut checkers = find_source_file(
         task_dir,
         vec!["check/checker.*", "cor/correttore.*"],
@@ -886,9 +935,22 @@ fn parse_batch_task_data(task_dir: &Path, grader_map: Arc<GraderMap>) -> Result<
             // Link the checker statically. This makes sure that it will work also outside this machine.
             c.link_static();
 
+            // Provide the fast I/O helpers to the checker.
+            Checker::add_checker_lib(&mut c);
+
             Checker::Custom(Arc::new(c))
         })
-        .unwrap_or(Checker::WhiteDiff);
+        .unwrap_or_else(|| {
+            yaml.builtin_checker
+                .map_or(Checker::WhiteDiff, Checker::TokenDiff)
+        });
+    if yaml.builtin_checker.is_some() && matches!(checker, Checker::Custom(_)) {
+        warn!("builtin_checker is set but the task has a custom checker, ignoring it");
+    }
+    let batch_checker = yaml.batch_checker.unwrap_or(false);
+    if batch_checker && !matches!(checker, Checker::Custom(_)) {
+        warn!("batch_checker is set but the task has no custom checker, ignoring it");
+    }
 
     let official_solution = detect_output_generator(task_dir.to_path_buf(), grader_map)
         .context("Failed to detect output generator")?;
@@ -898,6 +960,7 @@ fn parse_batch_task_data(task_dir: &Path, grader_map: Arc<GraderMap>) -> Result<
     };
     Ok(TaskType::Batch(BatchTypeData {
         output_generator: official_solution,
+        batch_checker: batch_checker && matches!(checker, Checker::Custom(_)),
         checker,
     }))
 }
@@ -970,6 +1033,9 @@ fn parse_communication_task_data(
     // Link the manager statically. This makes sure that it will work also outside this machine.
     manager.link_static();
 
+    // Provide the shared memory channels to the manager, if it uses them.
+    CommunicationTypeData::add_shm_lib(yaml.user_io, &mut manager);
+
     Ok(Some(TaskType::Communication(CommunicationTypeData {
         manager: Arc::new(manager),
         num_processes: yaml.num_processes.unwrap_or(1),
@@ -0,0 +1,282 @@
+//! Cache of the parsing of `gen/cases.gen`, stored inside `bin/`.
+//!
+//! The `cases.gen` files made by scripts may have thousands of lines, and parsing them and checking
+//! all the constraints is a visible part of each evaluation. The parsed testcases are stored
+//! together with the content of the `gen/GEN` produced from them, keyed by the hash of the files
+//! that may change them: `cases.gen`, the `task.yaml` and the files inside `gen/`, recursively.
+//! When none of them changed the parsing is skipped.
+//!
+//! The key depends only on the content of the files and on their path relative to the task, but
+//! the parsed testcases contain the absolute paths of the generators and of the validators: the
+//! cache is used only if the task is still in the directory where it was parsed.
+//!
+//! The output generators are not cached, since they depend on the solutions: they are computed
+//! again for each testcase.
+
+use std::collections::HashMap;
+use std::fs;
+use std::path::{Path, PathBuf};
+use std::sync::Arc;
+
+use anyhow::{Context, Error};
+use serde::{Deserialize, Serialize};
+
+use crate::ioi::format::italian_yaml::cases_gen::{write_gen_gen, CasesGen};
+use crate::ioi::format::italian_yaml::TaskInputEntry;
+use crate::ioi::{InputGenerator, InputValidator, OutputGenerator, TestcaseId};
+use crate::{list_files, EvaluationConfig, SourceFile};
+
+/// Where the cache is stored, relative to the task directory.
+const PARSE_CACHE_PATH: &str = "bin/cases.gen.cache.json";
+
+/// The content of the cache file.
+#[derive(Debug, Serialize, Deserialize)]
+struct ParseCache {
+    /// The hash of the files the parsing depends on, see `cache_key`.
+    key: String,
+    /// The directory of the task when it was parsed, the one of the paths in `entries`.
+    task_dir: PathBuf,
+    /// The entries produced by the parsing of `cases.gen`.
+    entries: Vec<TaskInputEntry>,
+    /// The content of the `gen/GEN` file produced from `cases.gen`.
+    gen_gen: String,
+}
+
+/// Get the entries of the `cases.gen` file at `path`, from the cache if it's still valid, otherwise
+/// parsing the file and updating the cache. Unless it's a dry-run the `gen/GEN` file is written.
+pub(crate) fn cases_gen_entries<O>(
+    task_dir: &Path,
+    path: &Path,
+    output_generator: O,
+    eval_config: &EvaluationConfig,
+) -> Result<Vec<TaskInputEntry>, Error>
+where
+    O: Fn(TestcaseId) -> OutputGenerator,
+{
+    let key = match cache_key(task_dir) {
+        Ok(key) => Some(key),
+        Err(e) => {
+            debug!("Cannot compute the key of the cases.gen cache: {e:?}");
+            None
+        }
+    };
+    if let Some(cache) = key.as_ref().and_then(|key| load(task_dir, key)) {
+        debug!("Using the cached parsing of gen/cases.gen");
+        if !eval_config.dry_run {
+            write_gen_gen(task_dir, &cache.gen_gen)?;
+        }
+        return Ok(relink_entries(cache.entries, output_generator));
+    }
+
+    debug!("Parsing testcases from gen/cases.gen");
+    let gen = CasesGen::new(path, output_generator)?;
+    let entries = gen.get_task_entries();
+    if !eval_config.dry_run {
+        let gen_gen = gen.gen_gen_content();
+        write_gen_gen(task_dir, &gen_gen)?;
+        if let Some(key) = key {
+            let cache = ParseCache {
+                key,
+                task_dir: task_dir.to_owned(),
+                entries,
+                gen_gen,
+            };
+            if let Err(e) = store(task_dir, &cache) {
+                warn!("Cannot store the cache of gen/cases.gen: {e:?}");
+            }
+            return Ok(cache.entries);
+        }
+    }
+    Ok(entries)
+}
+
+/// The hash of everything the parsing of `cases.gen` depends on, with the paths relative to the
+/// task directory. `task.yaml` is hashed only if there is no `task.yaml.orig`, since otherwise
+/// it's generated by task-maker.
+fn cache_key(task_dir: &Path) -> Result<String, Error> {
+    let mut hasher = blake3::Hasher::new();
+    hasher.update(env!("CARGO_PKG_VERSION").as_bytes());
+    let task_yaml = if task_dir.join("task.yaml.orig").exists() {
+        "task.yaml.orig"
+    } else {
+        "task.yaml"
+    };
+    let mut files = vec![PathBuf::from(task_yaml)];
+    let mut gen_files: Vec<_> = list_files(task_dir, vec!["gen/**/*"])
+        .into_iter()
+        .filter(|path| path.is_file())
+        .filter_map(|path| path.strip_prefix(task_dir).ok().map(Path::to_owned))
+        // gen/GEN is written from the cache
+        .filter(|path| path != Path::new("gen/GEN"))
+        .collect();
+    gen_files.sort();
+    files.extend(gen_files);
+    for file in files {
+        let path = task_dir.join(&file);
+        let content =
+            fs::read(&path).with_context(|| format!("Failed to read {}", path.display()))?;
+        hasher.update(file.to_string_lossy().as_bytes());
+        hasher.update(&(content.len() as u64).to_le_bytes());
+        hasher.update(&content);
+    }
+    Ok(hasher.finalize().to_hex().to_string())
+}
+
+/// Load the cache of the task, if it's present and it has the specified key.
+fn load(task_dir: &Path, key: &str) -> Option<ParseCache> {
+    let path = task_dir.join(PARSE_CACHE_PATH);
+    let content = fs::read(&path).ok()?;
+    match serde_json::from_slice::<ParseCache>(&content) {
+        Ok(cache) if cache.key == key && cache.task_dir == task_dir => Some(cache),
+        Ok(_) => None,
+        Err(e) => {
+            debug!("Ignoring corrupted cache at {}: {e}", path.display());
+            None
+        }
+    }
+}
+
+/// Write the cache of the task.
+fn store(task_dir: &Path, cache: &ParseCache) -> Result<(), Error> {
+    let path = task_dir.join(PARSE_CACHE_PATH);
+    if let Some(parent) = path.parent() {
+        fs::create_dir_all(parent)
+            .with_context(|| format!("Failed to create {}", parent.display()))?;
+    }
+    let content = serde_json::to_vec(cache).context("Failed to serialize the cache")?;
+    fs::write(&path, content).with_context(|| format!("Failed to write {}", path.display()))
+}
+
+/// Prepare the entries loaded from the cache: the same source file is used by many testcases, and
+/// after the deserialization each of them has its own copy, which would be compiled separately.
+/// Also the output generators are computed again.
+fn relink_entries<O>(mut entries: Vec<TaskInputEntry>, output_generator: O) -> Vec<TaskInputEntry>
+where
+    O: Fn(TestcaseId) -> OutputGenerator,
+{
+    let mut sources: HashMap<PathBuf, Arc<SourceFile>> = HashMap::new();
+    let mut relink = |source: &mut Arc<SourceFile>| {
+        *source = sources
+            .entry(source.path.clone())
+            .or_insert_with(|| source.clone())
+            .clone();
+    };
+    for entry in &mut entries {
+        match entry {
+            TaskInputEntry::Subtask(subtask) => {
+                if let InputValidator::Custom(source, _) = &mut subtask.input_validator {
+                    relink(source);
+                }
+            }
+            TaskInputEntry::Testcase(testcase) => {
+                if let InputGenerator::Custom(source, _) = &mut testcase.input_generator {
+                    relink(source);
+                }
+                testcase.output_generator = output_generator(testcase.id);
+            }
+        }
+    }
+    entries
+}
+
+#[cfg(test)]
+mod tests {
+    use tempfile::TempDir;
+
+    use super::*;
+
+    /// Write the files of a task with a `cases.gen`.
+    fn make_task(cases_gen: &str) -> TempDir {
+        let dir = TempDir::new().unwrap();
+        fs::create_dir_all(dir.path().join("gen")).unwrap();
+        fs::write(dir.path().join("task.yaml"), "name: task").unwrap();
+        fs::write(dir.path().join("gen/generator.py"), "").unwrap();
+        fs::write(dir.path().join("gen/validator.py"), "").unwrap();
+        fs::write(dir.path().join("gen/cases.gen"), cases_gen).unwrap();
+        dir
+    }
+
+    /// Get the entries of the task, using `output` as the output file of all the testcases.
+    fn entries(dir: &Path, output: &str) -> Vec<TaskInputEntry> {
+        let output = PathBuf::from(output);
+        cases_gen_entries(
+            dir,
+            &dir.join("gen/cases.gen"),
+            move |_| OutputGenerator::StaticFile(output.clone()),
+            &EvaluationConfig::default(),
+        )
+        .unwrap()
+    }
+
+    /// The source files of the input generators of the testcases.
+    fn generators(entries: &[TaskInputEntry]) -> Vec<Arc<SourceFile>> {
+        entries
+            .iter()
+            .filter_map(|entry| match entry {
+                TaskInputEntry::Testcase(testcase) => match &testcase.input_generator {
+                    InputGenerator::Custom(source, _) => Some(source.clone()),
+                    _ => None,
+                },
+                _ => None,
+            })
+            .collect()
+    }
+
+    #[test]
+    fn test_parse_cache() {
+        let cases_gen = ":GEN gen gen/generator.py\n:VAL val gen/validator.py\n:SUBTASK 10\n1\n2\n";
+        let dir = make_task(cases_gen);
+        let parsed = entries(dir.path(), "out1");
+        let key = cache_key(dir.path()).unwrap();
+        assert!(load(dir.path(), &key).is_some());
+        let gen_gen = fs::read_to_string(dir.path().join("gen/GEN")).unwrap();
+        fs::remove_file(dir.path().join("gen/GEN")).unwrap();
+
+        let cached = entries(dir.path(), "out2");
+        assert_eq!(cached.len(), parsed.len());
+        let gens = generators(&cached);
+        assert_eq!(gens.len(), 2);
+        assert!(Arc::ptr_eq(&gens[0], &gens[1]));
+        assert_eq!(
+            fs::read_to_string(dir.path().join("gen/GEN")).unwrap(),
+            gen_gen
+        );
+        match &cached[1] {
+            TaskInputEntry::Testcase(testcase) => match &testcase.output_generator {
+                OutputGenerator::StaticFile(path) => assert_eq!(path, Path::new("out2")),
+                _ => panic!("Wrong output generator"),
+            },
+            _ => panic!("Expecting a testcase"),
+        }
+
+        // changing a generator invalidates the cache
+        fs::write(dir.path().join("gen/generator.py"), "# changed").unwrap();
+        assert_ne!(cache_key(dir.path()).unwrap(), key);
+        // gen/GEN is not part of the key
+        let key = cache_key(dir.path()).unwrap();
+        fs::write(dir.path().join("gen/GEN"), "").unwrap();
+        assert_eq!(cache_key(dir.path()).unwrap(), key);
+        // the files in the subdirectories of gen/ are part of the key
+        fs::create_dir_all(dir.path().join("gen/lib")).unwrap();
+        fs::write(dir.path().join("gen/lib/common.py"), "").unwrap();
+        assert_ne!(cache_key(dir.path()).unwrap(), key);
+    }
+
+    #[test]
+    fn test_parse_cache_moved_task() {
+        let cases_gen = ":GEN gen gen/generator.py\n:SUBTASK 10\n1\n";
+        let dir = make_task(cases_gen);
+        entries(dir.path(), "out");
+        let key = cache_key(dir.path()).unwrap();
+
+        // the key doesn't depend on where the task is, but the paths in the cache do
+        let new_dir = TempDir::new().unwrap();
+        let moved = new_dir.path().join("task");
+        fs::rename(dir.path(), &moved).unwrap();
+        assert_eq!(cache_key(&moved).unwrap(), key);
+        assert!(load(&moved, &key).is_none());
+        let gens = generators(&entries(&moved, "out"));
+        assert!(gens[0].path.starts_with(&moved));
+        assert!(load(&moved, &key).is_some());
+    }
+}
@@ -15,7 +15,7 @@
 //! a `Checker`, a program that computes the score of the testcase given the input file, the output
 //! file and the _correct_ output file (the one produced by the jury).
 
-use std::collections::HashMap;
+use std::collections::{HashMap, HashSet};
 use std::fmt::Debug;
 use std::path::{Path, PathBuf};
 use std::sync::{Arc, Mutex};
@@ -23,12 +23,13 @@ use std::sync::{Arc, Mutex};
 use anyhow::{Context, Error};
 use curses_ui::CursesUI;
 pub use dag::*;
+pub use evaluation_cache::EvaluationCache;
 pub use format::italian_yaml;
 use itertools::Itertools;
 use serde::{Deserialize, Serialize};
 pub use statement::*;
 pub use task_info::*;
-use task_maker_dag::{ExecutionDAGConfig, FileUuid};
+use task_maker_dag::{ExecutionDAGConfig, ExecutionGroupUuid, ExecutionSkipper, FileUuid};
 use task_maker_diagnostics::CodeSpan;
 use task_maker_lang::GraderMap;
 pub use ui_state::*;
@@ -44,6 +45,7 @@ use crate::{EvaluationConfig, EvaluationData, TaskInfo, UISender};
 
 mod curses_ui;
 mod dag;
+mod evaluation_cache;
 pub(crate) mod finish_ui;
 mod format;
 pub mod sanity_checks;
@@ -74,6 +76,17 @@ pub struct ScoreManager {
     subtask_testcases: HashMap<SubtaskId, Vec<TestcaseId>>,
     /// The aggregator to use for computing the subtask scores.
     aggregator: TestcaseScoreAggregator,
+    /// Where to ask to skip the evaluations that cannot change the score anymore, if they should be
+    /// skipped.
+    skipper: Option<ExecutionSkipper>,
+    /// The executions that evaluate the solution on each testcase, that can be skipped since they
+    /// haven't started yet.
+    evaluations: HashMap<TestcaseId, Vec<ExecutionGroupUuid>>,
+    /// The testcases whose evaluations have been asked to be skipped. They are scored zero when
+    /// the skip is confirmed, or normally if they started meanwhile.
+    skipping: HashSet<TestcaseId>,
+    /// The testcases that get the score of each testcase, see `TestcaseInfo::same_as`.
+    copies: HashMap<TestcaseId, Vec<(SubtaskId, TestcaseId)>>,
 }
 
 /// A simple struct that generates input validators for a given subtask.
@@ -119,6 +132,10 @@ pub struct IOITask {
     pub time_limit: Option<f64>,
     /// The memory limit in MiB of the execution of the solution, if `None` it's unlimited.
     pub memory_limit: Option<u64>,
+    /// The limit on the instructions retired by the solution, checked instead of the time limit
+    /// when the hardware counters are available.
+    #[serde(default)]
+    pub instruction_limit: Option<u64>,
     /// The input file for the solutions, usually `Some("input.txt")` or `None` (stdin).
     pub infile: Option<PathBuf>,
     /// The output file for the solutions, usually `Some("output.txt")` or `None` (stdout).
@@ -145,11 +162,23 @@ pub struct IOITask {
     /// An integer that defines the level inside a _syllabus_ (for example for the Olympiads in
     /// Teams). Used only in booklet compilations.
     pub syllabus_level: Option<u8>,
+    /// Whether the validator supports the batch protocol, validating all the input files with a
+    /// single execution. See `ValidatorBatch`.
+    #[serde(default)]
+    pub batch_validator: bool,
+    /// Whether the generators support the batch protocol, generating many input files with a
+    /// single execution. See `GeneratorBatch`.
+    #[serde(default)]
+    pub batch_generator: bool,
     /// The sanity checks attached to this task. Wrapped in Arc since `SanityChecks` is not Clone.
     /// It's also not `Serialize` nor `Deserialize`, all the sanity checks will be lost on
     /// serialization.
     #[serde(skip_serializing, skip_deserializing)]
     pub sanity_checks: Arc<SanityChecks<IOITask>>,
+    /// The results of the previous evaluations, set by `build_dag` in the incremental mode and
+    /// stored after the evaluation.
+    #[serde(skip_serializing, skip_deserializing)]
+    pub evaluation_cache: Option<Arc<Mutex<EvaluationCache>>>,
 }
 
 /// A subtask of a IOI task.
@@ -198,6 +227,10 @@ pub struct TestcaseInfo {
     pub input_file: Option<FileUuid>,
     /// The generated official output file UUID. This is set only after the DAG is built.
     pub official_output_file: Option<FileUuid>,
+    /// The testcase with the same input and official output of this one, whose evaluations are
+    /// used also for this testcase. This is set only after the DAG is built.
+    #[serde(default)]
+    pub same_as: Option<TestcaseId>,
 }
 
 impl IOITask {
@@ -223,6 +256,7 @@ impl IOITask {
             title: "".to_string(),
             time_limit: None,
             memory_limit: None,
+            instruction_limit: None,
             infile: None,
             outfile: None,
             subtasks: Default::default(),
@@ -234,7 +268,10 @@ impl IOITask {
             booklets: vec![],
             difficulty: None,
             syllabus_level: None,
+            batch_validator: false,
+            batch_generator: false,
             sanity_checks: Arc::new(Default::default()),
+            evaluation_cache: None,
         }
     }
 
@@ -264,6 +301,7 @@ impl IOITask {
                 CursesUI::new(UIState::new(self, config)).context("Cannot build curses UI")?,
             )),
             UIType::Json => Ok(Box::new(JsonUI::new())),
+            UIType::JsonBatch(options) => Ok(Box::new(JsonBatchUI::new(options.clone())?)),
             UIType::Silent => Ok(Box::new(SilentUI::new())),
         }
     }
@@ -274,6 +312,7 @@ impl IOITask {
         eval: &mut EvaluationData,
         config: &EvaluationConfig,
     ) -> Result<(), Error> {
+        self.find_same_testcases();
         eval.sender.send(UIMessage::IOITask {
             task: Box::new(self.clone()),
         })?;
@@ -283,6 +322,14 @@ impl IOITask {
             Some(self.grader_map.clone()),
             eval,
         );
+        if let TaskType::Communication(data) = &self.task_type {
+            for solution in &mut eval.solutions {
+                CommunicationTypeData::add_shm_lib(
+                    data.user_io,
+                    Arc::make_mut(&mut solution.source_file),
+                );
+            }
+        }
 
         let solutions: Vec<_> = eval
             .solutions
@@ -290,14 +337,11 @@ impl IOITask {
             .into_iter()
             .map(|source| {
                 let path = source.source_file.path.clone();
-                Ok((
-                    source,
-                    Arc::new(Mutex::new(ScoreManager::new(
-                        self,
-                        path,
-                        eval.sender.clone(),
-                    )?)),
-                ))
+                let mut score_manager = ScoreManager::new(self, path, eval.sender.clone())?;
+                if config.skip_failed_subtasks {
+                    score_manager.skip_failed_subtasks(eval.dag.skipper());
+                }
+                Ok((source, Arc::new(Mutex::new(score_manager))))
             })
             .collect::<Result<_, Error>>()?;
 
@@ -308,12 +352,35 @@ impl IOITask {
         eval.sender.send(UIMessage::Solutions {
             solutions: solution_info,
         })?;
+        let mut evaluation_cache = if config.incremental && !config.dry_run {
+            match EvaluationCache::new(self, eval) {
+                Ok(cache) => Some(cache),
+                Err(e) => {
+                    warn!("Cannot use the results of the previous evaluations: {e:?}");
+                    None
+                }
+            }
+        } else {
+            None
+        };
 
         self.task_type
             .prepare_dag(eval)
             .context("Failed to prepare DAG")?;
+        let mut profile = !config.profile.is_empty();
+        if profile && !matches!(self.task_type, TaskType::Batch(_)) {
+            warn!("Only the Batch tasks can be profiled, --profile is ignored");
+            profile = false;
+        }
 
         let mut generated_io: HashMap<_, _> = HashMap::new();
+        let mut gen_handles: HashMap<_, _> = HashMap::new();
+        let mut checker_batches = solutions
+            .iter()
+            .map(|(solution, _)| CheckerBatch::new(solution.source_file.path.clone()))
+            .collect_vec();
+        let mut validator_batch = self.batch_validator.then(ValidatorBatch::new);
+        let mut generator_batch = self.batch_generator.then(GeneratorBatch::new);
 
         for subtask in self.subtasks.values() {
             trace!("Executing the generation of subtask {}", subtask.id);
@@ -329,21 +396,42 @@ impl IOITask {
                     .testcases
                     .get(&testcase_id)
                     .expect("Testcase not found in the task");
-                let input = testcase
-                    .input_generator
-                    .generate_and_bind(eval, &self.path, subtask.id, testcase.id)
-                    .context("Failed to bind input generator")?;
-                let val_handle = subtask
-                    .input_validator
-                    .validate_and_bind(
+                let (input, gen_handle) = match &mut generator_batch {
+                    Some(batch) => batch.generate_and_bind(
+                        &testcase.input_generator,
+                        eval,
+                        &self.path,
+                        subtask.id,
+                        testcase.id,
+                    ),
+                    None => testcase
+                        .input_generator
+                        .generate_and_bind(eval, &self.path, subtask.id, testcase.id)
+                        .map(|input| (input, None)),
+                }
+                .context("Failed to bind input generator")?;
+                let val_handle = match &mut validator_batch {
+                    Some(batch) => batch.validate_and_bind(
+                        &subtask.input_validator,
                         eval,
                         &self.path,
                         subtask.id,
                         subtask.name.as_deref(),
                         testcase.id,
                         input,
-                    )
-                    .context("Failed to bind validator")?;
+                        gen_handle,
+                    ),
+                    None => subtask.input_validator.validate_and_bind(
+                        eval,
+                        &self.path,
+                        subtask.id,
+                        subtask.name.as_deref(),
+                        testcase.id,
+                        input,
+                        gen_handle,
+                    ),
+                }
+                .context("Failed to bind validator")?;
                 let output = testcase
                     .output_generator
                     .generate_and_bind(self, eval, subtask.id, testcase.id, input, val_handle)
@@ -351,14 +439,47 @@ impl IOITask {
                 // Store the generated input and output files for setting them into the task
                 // outside the loop.
                 generated_io.insert(testcase.id, (input, output));
+                gen_handles.insert(testcase.id, gen_handle);
+                if testcase.same_as.is_some() {
+                    // the score managers give to this testcase the score of the other one
+                    continue;
+                }
 
-                for (solution, score_manager) in solutions.iter() {
+                for ((solution, score_manager), checker_batch) in
+                    solutions.iter().zip(checker_batches.iter_mut())
+                {
                     trace!(
                         "Evaluation of the solution {:?} against subtask {} / testcase {}",
                         solution.source_file.name(),
                         subtask.id,
                         testcase.id
                     );
+                    if profile && config.profile.contains(&testcase.id) {
+                        profile_and_bind(
+                            self,
+                            eval,
+                            subtask.id,
+                            testcase.id,
+                            &solution.source_file,
+                            input,
+                            val_handle,
+                        )
+                        .context("Failed to bind profiling")?;
+                    }
+                    let cached = evaluation_cache
+                        .as_mut()
+                        .and_then(|cache| cache.get(&solution.source_file.path, testcase.id));
+                    if let Some(cached) = cached {
+                        cached.replay(&eval.sender)?;
+                        score_manager.lock().unwrap().score(
+                            subtask.id,
+                            testcase.id,
+                            cached.score,
+                            cached.message,
+                            eval.sender.clone(),
+                        )?;
+                        continue;
+                    }
 
                     self.task_type
                         .evaluate(
@@ -371,11 +492,24 @@ impl IOITask {
                             val_handle,
                             output,
                             score_manager.clone(),
+                            checker_batch,
                         )
                         .context("Failed to bind evaluation")?;
                 }
             }
         }
+        if let Some(batch) = generator_batch {
+            batch.bind(eval).context("Failed to bind input generator")?;
+        }
+        for checker_batch in checker_batches {
+            self.task_type
+                .check_batch(eval, checker_batch)
+                .context("Failed to bind checker")?;
+        }
+        if let Some(cache) = evaluation_cache {
+            cache.replay_compilations(&eval.sender)?;
+            self.evaluation_cache = Some(Arc::new(Mutex::new(cache)));
+        }
         // Store inside the task the FileUuid of the input and official output files. This cannot
         // be done while generating because task cannot be borrowed mutably in the loop.
         for (testcase_id, (input, output)) in generated_io {
@@ -392,20 +526,36 @@ impl IOITask {
                         .get(&testcase_id)
                         .expect("Testcase not found in the task");
 
-                    let _val_handle = subtask
-                        .input_validator
-                        .validate_and_bind(
+                    let input = testcase.input_file.unwrap();
+                    let gen_handle = gen_handles.get(&testcase.id).copied().flatten();
+                    let _val_handle = match &mut validator_batch {
+                        Some(batch) => batch.validate_and_bind(
+                            &subtask.input_validator,
                             eval,
                             &self.path,
                             subtask.id,
                             subtask.name.as_deref(),
                             testcase.id,
-                            testcase.input_file.unwrap(),
-                        )
-                        .context("Failed to bind validator")?;
+                            input,
+                            gen_handle,
+                        ),
+                        None => subtask.input_validator.validate_and_bind(
+                            eval,
+                            &self.path,
+                            subtask.id,
+                            subtask.name.as_deref(),
+                            testcase.id,
+                            input,
+                            gen_handle,
+                        ),
+                    }
+                    .context("Failed to bind validator")?;
                 }
             }
         }
+        if let Some(batch) = validator_batch {
+            batch.bind(eval).context("Failed to bind validator")?;
+        }
         for booklet in self.booklets.iter() {
             booklet
                 .build(eval)
@@ -417,9 +567,54 @@ impl IOITask {
         Ok(())
     }
 
+    /// Set `same_as` of the testcases with the same generators of a testcase with a smaller id, for
+    /// example the ones copied in many subtasks. Their inputs are still generated and validated,
+    /// but the solutions are evaluated only on the first one.
+    fn find_same_testcases(&mut self) {
+        let mut first: HashMap<String, TestcaseId> = HashMap::new();
+        for testcase_id in self.testcases.keys().copied().sorted() {
+            let testcase = self.testcases.get_mut(&testcase_id).unwrap();
+            testcase.same_as = None;
+            let Some(key) = testcase.generation_key() else {
+                continue;
+            };
+            match first.get(&key) {
+                Some(&same_as) => {
+                    debug!("Testcase {testcase_id} is the same as testcase {same_as}");
+                    testcase.same_as = Some(same_as);
+                }
+                None => {
+                    first.insert(key, testcase_id);
+                }
+            }
+        }
+    }
+
+    /// The testcases that have the same input and official output of each testcase, with the
+    /// subtask that owns them. See `TestcaseInfo::same_as`.
+    pub fn testcase_copies(&self) -> HashMap<TestcaseId, Vec<(SubtaskId, TestcaseId)>> {
+        let mut copies: HashMap<_, Vec<_>> = HashMap::new();
+        for subtask in self.subtasks.values() {
+            for testcase_id in &subtask.testcases_owned {
+                if let Some(same_as) = self.testcases[testcase_id].same_as {
+                    copies
+                        .entry(same_as)
+                        .or_default()
+                        .push((subtask.id, *testcase_id));
+                }
+            }
+        }
+        copies
+    }
+
     /// Hook called after the execution completed, useful for sending messages to the UI about the
     /// results of the sanity checks with data available only after the evaluation.
     pub fn sanity_check_post_hook(&self, eval: &mut EvaluationData) -> Result<(), Error> {
+        if let Some(cache) = &self.evaluation_cache {
+            if let Err(e) = cache.lock().unwrap().store() {
+                warn!("Cannot store the results of the evaluations: {e:?}");
+            }
+        }
         self.sanity_checks.post_hook(self, eval)
     }
 
@@ -563,8 +758,35 @@ impl TestcaseInfo {
             output_generator,
             input_file: None,
             official_output_file: None,
+            same_as: None,
         }
     }
+
+    /// A string identifying the input and the official output of the testcase: the testcases with
+    /// the same key have the same files. `None` if the files cannot be identified.
+    fn generation_key(&self) -> Option<String> {
+        let file_key = |path: &Path| match std::fs::read(path) {
+            Ok(content) => Some(blake3::hash(&content).to_hex().to_string()),
+            Err(e) => {
+                debug!("Cannot read {}: {e}", path.display());
+                None
+            }
+        };
+        let input = match &self.input_generator {
+            InputGenerator::StaticFile(path) => format!("file {}", file_key(path)?),
+            InputGenerator::Custom(source, args) => {
+                format!("generator {} {:?}", source.path.display(), args)
+            }
+        };
+        let output = match &self.output_generator {
+            OutputGenerator::NotAvailable => "none".to_string(),
+            OutputGenerator::StaticFile(path) => format!("file {}", file_key(path)?),
+            OutputGenerator::Custom(source, args) => {
+                format!("solution {} {:?}", source.path.display(), args)
+            }
+        };
+        Some(format!("{input} / {output}"))
+    }
 }
 
 impl ScoreManager {
@@ -589,6 +811,10 @@ impl ScoreManager {
                 .map(|(st_num, st)| (*st_num, st.testcases.clone()))
                 .collect(),
             aggregator: task.testcase_score_aggregator,
+            skipper: None,
+            evaluations: HashMap::new(),
+            skipping: HashSet::new(),
+            copies: task.testcase_copies(),
         };
 
         for (st_num, st) in &task.subtasks {
@@ -599,6 +825,81 @@ impl ScoreManager {
         Ok(ret)
     }
 
+    /// Skip the evaluations of the solution that cannot change its score anymore: with the `Min`
+    /// aggregator, the ones on the testcases whose subtasks all have a testcase with zero score.
+    /// With the other aggregators nothing is skipped.
+    pub fn skip_failed_subtasks(&mut self, skipper: ExecutionSkipper) {
+        if let TestcaseScoreAggregator::Min = self.aggregator {
+            self.skipper = Some(skipper);
+        }
+    }
+
+    /// Register an execution that evaluates the solution on the testcase, which can be skipped if
+    /// its result is not needed, and bind the callbacks that track whether it started or it was
+    /// skipped. Its other callbacks must not rely on the other executions of the testcase being
+    /// run.
+    pub fn bind_evaluation(
+        score_manager: &Arc<Mutex<ScoreManager>>,
+        eval: &mut EvaluationData,
+        subtask_id: SubtaskId,
+        testcase_id: TestcaseId,
+        execution: ExecutionGroupUuid,
+    ) {
+        score_manager
+            .lock()
+            .unwrap()
+            .add_evaluation(testcase_id, execution);
+        let started = score_manager.clone();
+        eval.dag.on_execution_start(&execution, move |_| {
+            started.lock().unwrap().evaluation_started(testcase_id);
+            Ok(())
+        });
+        let skipped = score_manager.clone();
+        let sender = eval.sender.clone();
+        eval.dag.on_execution_skip(&execution, move || {
+            skipped
+                .lock()
+                .unwrap()
+                .evaluation_skipped(subtask_id, testcase_id, sender)
+        });
+    }
+
+    /// Register an execution that evaluates the solution on the testcase, which can be skipped if
+    /// its result is not needed. See `bind_evaluation`.
+    pub fn add_evaluation(&mut self, testcase_id: TestcaseId, execution: ExecutionGroupUuid) {
+        self.evaluations
+            .entry(testcase_id)
+            .or_default()
+            .push(execution);
+    }
+
+    /// An evaluation of the solution on the testcase started: the testcase will be scored by its
+    /// result, so it's not skipped anymore.
+    pub fn evaluation_started(&mut self, testcase_id: TestcaseId) {
+        self.evaluations.remove(&testcase_id);
+    }
+
+    /// An evaluation of the solution on the testcase has been skipped. If it was asked to be
+    /// skipped by `skip_failed_subtasks`, the testcase is scored zero, which doesn't change the
+    /// score of its subtasks.
+    pub fn evaluation_skipped(
+        &mut self,
+        subtask_id: SubtaskId,
+        testcase_id: TestcaseId,
+        sender: Arc<Mutex<UIMessageSender>>,
+    ) -> Result<(), Error> {
+        if !self.skipping.remove(&testcase_id) {
+            return Ok(());
+        }
+        self.score(
+            subtask_id,
+            testcase_id,
+            0.0,
+            "Skipped, the subtask already failed".into(),
+            sender,
+        )
+    }
+
     /// Store the score of the testcase and eventually compute the score of the subtask and of the
     /// task.
     pub fn score(
@@ -610,6 +911,19 @@ impl ScoreManager {
         sender: Arc<Mutex<UIMessageSender>>,
     ) -> Result<(), Error> {
         self.testcase_scores.insert(testcase_id, Some(score));
+        self.evaluations.remove(&testcase_id);
+        self.skipping.remove(&testcase_id);
+        let copies = self.copies.get(&testcase_id).cloned().unwrap_or_default();
+        for (copy_subtask, copy_testcase) in copies {
+            self.testcase_scores.insert(copy_testcase, Some(score));
+            sender.send(UIMessage::IOITestcaseScore {
+                subtask: copy_subtask,
+                testcase: copy_testcase,
+                solution: self.solution.clone(),
+                score,
+                message: message.clone(),
+            })?;
+        }
         sender.send(UIMessage::IOITestcaseScore {
             subtask: subtask_id,
             testcase: testcase_id,
@@ -617,6 +931,9 @@ impl ScoreManager {
             score,
             message,
         })?;
+        if score <= 0.0 {
+            self.skip_useless_evaluations();
+        }
 
         for (subtask_id, subtask) in self
             .subtask_scores
@@ -631,6 +948,52 @@ impl ScoreManager {
         Ok(())
     }
 
+    /// Ask to skip the evaluations that haven't started yet on the testcases whose subtasks already
+    /// have a testcase with zero score, if enabled. When the skip is confirmed those testcases are
+    /// scored zero, which doesn't change the score of their subtasks, so that the subtasks get
+    /// their score without waiting for them to run.
+    fn skip_useless_evaluations(&mut self) {
+        let skipper = match &self.skipper {
+            Some(skipper) => skipper,
+            None => return,
+        };
+        let is_zero = |score: &Option<f64>| matches!(score, Some(score) if *score <= 0.0);
+        let failed: HashSet<SubtaskId> = self
+            .subtask_testcases
+            .iter()
+            .filter(|(_, testcases)| {
+                testcases
+                    .iter()
+                    .any(|tc| is_zero(&self.testcase_scores[tc]))
+            })
+            .map(|(subtask_id, _)| *subtask_id)
+            .collect();
+        let useless = self
+            .evaluations
+            .keys()
+            .copied()
+            .filter(|tc| self.testcase_scores[tc].is_none() && !self.skipping.contains(tc))
+            .filter(|tc| {
+                // the score is also given to the copies of the testcase
+                let copies = self.copies.get(tc).into_iter().flatten();
+                std::iter::once(*tc)
+                    .chain(copies.map(|(_, copy)| *copy))
+                    .all(|tc| {
+                        self.subtask_testcases
+                            .iter()
+                            .filter(|(_, testcases)| testcases.contains(&tc))
+                            .all(|(subtask_id, _)| failed.contains(subtask_id))
+                    })
+            })
+            .collect_vec();
+        for testcase_id in useless {
+            for execution in self.evaluations.remove(&testcase_id).unwrap_or_default() {
+                skipper.skip(execution);
+            }
+            self.skipping.insert(testcase_id);
+        }
+    }
+
     fn score_subtask(
         &mut self,
         subtask_id: SubtaskId,
@@ -33,6 +33,10 @@ impl SanityCheck for AttGraders {
         SanityCheckCategory::Attachments
     }
 
+    fn read_only(&self) -> bool {
+        true
+    }
+
     fn pre_hook(&self, task: &IOITask, eval: &mut EvaluationData) -> Result<(), Error> {
         check_missing_graders(task, eval, "att")
     }
@@ -54,6 +58,10 @@ impl SanityCheck for AttTemplates {
         SanityCheckCategory::Attachments
     }
 
+    fn read_only(&self) -> bool {
+        true
+    }
+
     fn pre_hook(&self, task: &IOITask, eval: &mut EvaluationData) -> Result<(), Error> {
         for grader in task.grader_map.all_paths() {
             let ext = grader
@@ -114,6 +122,10 @@ impl SanityCheck for AttSampleFiles {
         SanityCheckCategory::Attachments
     }
 
+    fn read_only(&self) -> bool {
+        true
+    }
+
     fn post_hook(&self, task: &IOITask, eval: &mut EvaluationData) -> Result<(), Error> {
         let mut no_sample = true;
         let samples_from_task = Self::extract_sample_files_from_task(task);
@@ -425,6 +437,10 @@ impl SanityCheck for AttWithNoCheck {
         SanityCheckCategory::Attachments
     }
 
+    fn read_only(&self) -> bool {
+        true
+    }
+
     fn pre_hook(&self, task: &IOITask, eval: &mut EvaluationData) -> Result<(), Error> {
         for att in list_files(&task.path, vec!["att/*"]) {
             let path = task.path_of(&att);
@@ -459,6 +475,10 @@ impl SanityCheck for AttEndWithNewLine {
         SanityCheckCategory::Attachments
     }
 
+    fn read_only(&self) -> bool {
+        true
+    }
+
     fn pre_hook(&self, task: &IOITask, eval: &mut EvaluationData) -> Result<(), Error> {
         let list = Arc::new(Mutex::new(Vec::new()));
         for att in list_files(&task.path, vec!["att/*"]) {
@@ -508,6 +528,10 @@ impl SanityCheck for AttNoDirectory {
         SanityCheckCategory::Attachments
     }
 
+    fn read_only(&self) -> bool {
+        true
+    }
+
     fn pre_hook(&self, task: &IOITask, eval: &mut EvaluationData) -> Result<(), Error> {
         let dir =
             std::fs::read_dir(task.path.join("att")).context("Failed to open att/ directory")?;
@@ -22,6 +22,10 @@ impl SanityCheck for SolGraders {
         SanityCheckCategory::Solutions
     }
 
+    fn read_only(&self) -> bool {
+        true
+    }
+
     fn pre_hook(&self, task: &IOITask, eval: &mut EvaluationData) -> Result<(), Error> {
         check_missing_graders(task, eval, "sol")
     }
@@ -43,6 +47,10 @@ impl SanityCheck for SolTemplateSymlink {
         SanityCheckCategory::Solutions
     }
 
+    fn read_only(&self) -> bool {
+        true
+    }
+
     fn pre_hook(&self, task: &IOITask, eval: &mut EvaluationData) -> Result<(), Error> {
         for template in list_files(&task.path, vec!["sol/template.*"]) {
             let ext = template
@@ -80,6 +88,10 @@ impl SanityCheck for SolutionsWithNoChecks {
         SanityCheckCategory::Solutions
     }
 
+    fn read_only(&self) -> bool {
+        true
+    }
+
     fn pre_hook(&self, task: &IOITask, eval: &mut EvaluationData) -> Result<(), Error> {
         // If not all the subtasks have a name, do not bother with the solutions, it's much
         // more important to give everything a name before.
@@ -129,6 +141,10 @@ impl SanityCheck for SolutionsWithSamplesCheck {
         SanityCheckCategory::Solutions
     }
 
+    fn read_only(&self) -> bool {
+        true
+    }
+
     fn pre_hook(&self, task: &IOITask, eval: &mut EvaluationData) -> Result<(), Error> {
         // If no first subtask exists, or it has no name, skip this check.
         let Some(Some(samples)) = task.subtasks.get(&0).map(|st| st.name.clone()) else {
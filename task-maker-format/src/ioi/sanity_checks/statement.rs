@@ -28,6 +28,10 @@ impl SanityCheck for StatementSubtasks {
         SanityCheckCategory::Statement
     }
 
+    fn read_only(&self) -> bool {
+        true
+    }
+
     fn pre_hook(&self, task: &IOITask, eval: &mut EvaluationData) -> Result<(), Error> {
         let expected_subtasks = task
             .subtasks
@@ -130,6 +134,10 @@ impl SanityCheck for StatementValid {
         SanityCheckCategory::Statement
     }
 
+    fn read_only(&self) -> bool {
+        true
+    }
+
     fn post_hook(&self, task: &IOITask, eval: &mut EvaluationData) -> Result<(), Error> {
         let mut found_valid_statement = false;
 
@@ -203,6 +211,10 @@ impl SanityCheck for StatementCompiledOrGit {
         SanityCheckCategory::Statement
     }
 
+    fn read_only(&self) -> bool {
+        true
+    }
+
     fn post_hook(&self, task: &IOITask, eval: &mut EvaluationData) -> Result<(), Error> {
         // the statements compiled by us
         let booklet_dest = task
@@ -534,6 +546,10 @@ impl SanityCheck for StatementFonts {
         SanityCheckCategory::Statement
     }
 
+    fn read_only(&self) -> bool {
+        true
+    }
+
     fn pre_hook(&self, task: &IOITask, eval: &mut EvaluationData) -> Result<(), Error> {
         let is_cjk_lang = |lang: &str| {
             lang == "chinese"
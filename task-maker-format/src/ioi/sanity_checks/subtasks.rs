@@ -27,6 +27,10 @@ impl SanityCheck for MissingSubtaskNames {
         SanityCheckCategory::Io
     }
 
+    fn read_only(&self) -> bool {
+        true
+    }
+
     fn pre_hook(&self, task: &IOITask, eval: &mut EvaluationData) -> Result<(), Error> {
         // Ignore the default subtask if it's missing the name.
         if task.subtasks.values().all(|st| st.is_default) {
@@ -249,6 +253,10 @@ impl SanityCheck for DeprecatedDescriptionInSubtask {
         SanityCheckCategory::Task
     }
 
+    fn read_only(&self) -> bool {
+        true
+    }
+
     fn pre_hook(&self, task: &IOITask, eval: &mut EvaluationData) -> Result<(), Error> {
         for subtask in task.subtasks.values() {
             #[allow(deprecated)]
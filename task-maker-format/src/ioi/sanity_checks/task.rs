@@ -27,6 +27,10 @@ impl SanityCheck for TaskMaxScore {
         SanityCheckCategory::Task
     }
 
+    fn read_only(&self) -> bool {
+        true
+    }
+
     fn pre_hook(&self, task: &IOITask, eval: &mut EvaluationData) -> Result<(), Error> {
         let task_score: f64 = task.subtasks.values().map(|st| st.max_score).sum();
         if approx::abs_diff_ne!(task_score, DEFAULT_TASK_MAX_SCORE) {
@@ -54,6 +58,10 @@ impl SanityCheck for BrokenSymlinks {
         SanityCheckCategory::Task
     }
 
+    fn read_only(&self) -> bool {
+        true
+    }
+
     fn post_hook(&self, task: &IOITask, eval: &mut EvaluationData) -> Result<(), Error> {
         for file in list_files(&task.path, vec!["**/*"]) {
             if !file.exists() {
@@ -90,6 +98,10 @@ impl SanityCheck for NoBitsStdCpp {
         SanityCheckCategory::Task
     }
 
+    fn read_only(&self) -> bool {
+        true
+    }
+
     fn pre_hook(&self, task: &IOITask, eval: &mut EvaluationData) -> Result<(), Error> {
         lazy_static! {
             static ref RE: Regex =
@@ -144,6 +156,10 @@ impl SanityCheck for EmptyTitle {
         SanityCheckCategory::Task
     }
 
+    fn read_only(&self) -> bool {
+        true
+    }
+
     fn pre_hook(&self, task: &IOITask, eval: &mut EvaluationData) -> Result<(), Error> {
         if task.title.is_empty() {
             eval.add_diagnostic(Diagnostic::error("Missing task title"))?;
@@ -1,7 +1,7 @@
 use std::path::{Path, PathBuf};
 
 use anyhow::{anyhow, Context, Error};
-use task_maker_dag::{Execution, ExecutionCommand, File};
+use task_maker_dag::{Execution, ExecutionCommand, ExecutionStatus, File};
 use task_maker_diagnostics::Diagnostic;
 
 use crate::ui::UIMessage;
@@ -9,6 +9,19 @@ use crate::{bind_exec_callbacks, EvaluationData, Tag, UISender};
 
 pub struct AsyFile;
 
+/// One of the executions rendering an asy file.
+#[derive(Debug, Clone, Copy)]
+struct AsyStep {
+    /// The format of the rendered file.
+    format: &'static str,
+    /// The shell script that renders the file.
+    script: &'static str,
+    /// The path of the rendered file inside the sandbox.
+    output: &'static str,
+    /// The index of the step, for the UI.
+    step: usize,
+}
+
 #[derive(Debug, Clone, Eq, PartialEq)]
 pub struct AsyDependency {
     pub sandbox_path: PathBuf,
@@ -16,41 +29,29 @@ pub struct AsyDependency {
 }
 
 impl AsyFile {
-    /// Compile the asy file and return the handle to the compiled and cropped pdf file.
+    /// Compile the asy file and return the handles to the compiled and cropped pdf file and to the
+    /// svg file.
+    ///
+    /// The pdf and the svg are rendered by two executions running in parallel. The crop of the pdf
+    /// runs in the same sandbox of its compilation. Since the executions depend only on the
+    /// content of the source and of its dependencies, the figures that didn't change are taken
+    /// from the cache.
     pub fn compile<P: Into<PathBuf>>(
         source: P,
         eval: &mut EvaluationData,
         booklet_name: &str,
     ) -> Result<(File, File), Error> {
         let source_path = source.into();
-        let booklet = booklet_name.to_string();
         let name = source_path
             .file_name()
             .ok_or_else(|| anyhow!("Invalid path of asy file: {:?}", source_path))?
             .to_string_lossy()
             .to_string();
         let source_file = File::new(format!("Source of {name}"));
-
-        let mut comp_pdf_svg = Execution::new(
-            format!("Compilation of {name}"),
-            ExecutionCommand::system("sh"),
-        );
-        comp_pdf_svg.args(vec![
-            "-c",
-            "asy -f pdf -localhistory tm-compilation.asy && asy -f svg -localhistory tm-compilation.asy",
-        ]);
-        comp_pdf_svg
-            .limits_mut()
-            .read_only(false)
-            .wall_time(10.0) // asy tends to deadlock on failure
-            .allow_multiprocess()
-            .add_extra_readable_dir("/etc")
-            .mount_tmpfs(true)
-            .mount_proc(true);
-        comp_pdf_svg.input(&source_file, "tm-compilation.asy", false);
         eval.dag
-            .provide_file(source_file, &source_path)
+            .provide_file(source_file.clone(), &source_path)
             .context("Failed to provide any source file")?;
+        let mut inputs = vec![(source_file, PathBuf::from("tm-compilation.asy"))];
         let deps = AsyFile::find_asy_deps(&source_path).with_context(|| {
             format!(
                 "Failed to find asy dependencies of {}",
@@ -63,107 +64,112 @@ impl AsyFile {
                 dep.sandbox_path.display(),
                 name
             ));
-            comp_pdf_svg.input(&file, &dep.sandbox_path, false);
             eval.dag
-                .provide_file(file, &dep.local_path)
+                .provide_file(file.clone(), &dep.local_path)
                 .context("Failed to provide asy dependency")?;
-        }
-        let compiled = comp_pdf_svg.output("tm-compilation.pdf");
-        let vector = comp_pdf_svg.output("tm-compilation.svg");
-        if eval.dag.data.config.copy_logs {
-            let log_dir = eval.task_root.join("bin/logs/asy");
-            let stderr_dest = log_dir.join(format!("{name}.stderr.log"));
-            let stdout_dest = log_dir.join(format!("{name}.stdout.log"));
-            eval.dag.write_file_to_allow_fail(
-                comp_pdf_svg.capture_stderr(None),
-                stderr_dest,
-                false,
-            );
-            eval.dag.write_file_to_allow_fail(
-                comp_pdf_svg.capture_stdout(None),
-                stdout_dest,
-                false,
-            );
+            inputs.push((file, dep.sandbox_path));
         }
 
-        comp_pdf_svg.capture_stderr(Some(1024));
-
-        let mut comp_pdf_svg_group = comp_pdf_svg.into_group();
-        comp_pdf_svg_group.tag = Some(Tag::Booklet.into());
-
-        bind_exec_callbacks!(
+        // exit with 2 if the crop fails, to tell it apart from the failures of asy
+        let pdf = AsyFile::render(
             eval,
-            comp_pdf_svg_group.uuid,
-            |status, booklet, name| UIMessage::IOIBookletDependency {
-                booklet,
-                name,
+            &inputs,
+            booklet_name,
+            &name,
+            AsyStep {
+                format: "pdf",
+                script: "asy -f pdf -localhistory tm-compilation.asy || exit 1\n\
+                         pdfcrop tm-compilation.pdf tm-compilation-crop.pdf || exit 2",
+                output: "tm-compilation-crop.pdf",
                 step: 0,
-                num_steps: 2,
-                status
             },
-            booklet,
-            name
         )?;
+        let svg = AsyFile::render(
+            eval,
+            &inputs,
+            booklet_name,
+            &name,
+            AsyStep {
+                format: "svg",
+                script: "asy -f svg -localhistory tm-compilation.asy",
+                output: "tm-compilation.svg",
+                step: 1,
+            },
+        )?;
+        Ok((pdf, svg))
+    }
 
-        eval.dag.on_execution_done(&comp_pdf_svg_group.uuid, {
-            let sender = eval.sender.clone();
-            let name = name.clone();
-            move |results| {
-                let result = &results[0];
-                if !result.status.is_success() {
-                    let mut diagnostic = Diagnostic::error(format!("Failed to compile {name}"));
-                    if result.status.is_internal_error() {
-                        diagnostic = diagnostic.with_help("Is 'asymptote' installed?");
-                    }
-                    if let Some(stderr) = result.stderr.as_ref() {
-                        diagnostic = diagnostic.with_help_attachment(stderr.clone());
-                    }
-                    sender.add_diagnostic(diagnostic)?;
-                }
-                Ok(())
-            }
-        });
-        eval.dag.add_execution_group(comp_pdf_svg_group);
-
-        let mut crop = Execution::new(
-            format!("Crop of {name}"),
-            ExecutionCommand::system("pdfcrop"),
+    /// Add to the DAG the execution that renders the asy file in a format, returning the handle
+    /// to the rendered file.
+    fn render(
+        eval: &mut EvaluationData,
+        inputs: &[(File, PathBuf)],
+        booklet_name: &str,
+        name: &str,
+        step: AsyStep,
+    ) -> Result<File, Error> {
+        let booklet = booklet_name.to_string();
+        let name = name.to_string();
+        let mut comp = Execution::new(
+            format!("Compilation of {name} to {}", step.format),
+            ExecutionCommand::system("sh"),
         );
-        crop.limits_mut()
+        comp.args(vec!["-c", step.script]);
+        comp.limits_mut()
             .read_only(false)
             .wall_time(10.0) // asy tends to deadlock on failure
             .allow_multiprocess()
             .add_extra_readable_dir("/etc")
-            .mount_tmpfs(true);
-        crop.args(vec!["source.pdf"]);
-        crop.input(compiled, "source.pdf", false);
-        let cropped = crop.output("source-crop.pdf");
-        crop.capture_stderr(Some(1024));
+            .mount_tmpfs(true)
+            .mount_proc(true);
+        for (file, sandbox_path) in inputs {
+            comp.input(file, sandbox_path, false);
+        }
+        let rendered = comp.output(step.output);
+        if eval.dag.data.config.copy_logs {
+            let log_dir = eval.task_root.join("bin/logs/asy");
+            let stderr_dest = log_dir.join(format!("{name}.{}.stderr.log", step.format));
+            let stdout_dest = log_dir.join(format!("{name}.{}.stdout.log", step.format));
+            eval.dag
+                .write_file_to_allow_fail(comp.capture_stderr(None), stderr_dest, false);
+            eval.dag
+                .write_file_to_allow_fail(comp.capture_stdout(None), stdout_dest, false);
+        }
 
-        let mut crop_group = crop.into_group();
-        crop_group.tag = Some(Tag::Booklet.into());
+        comp.capture_stderr(Some(1024));
 
+        let mut comp_group = comp.into_group();
+        comp_group.tag = Some(Tag::Booklet.into());
+
+        let step_index = step.step;
         bind_exec_callbacks!(
             eval,
-            crop_group.uuid,
+            comp_group.uuid,
             |status, booklet, name| UIMessage::IOIBookletDependency {
                 booklet,
                 name,
-                step: 1,
+                step: step_index,
                 num_steps: 2,
                 status
             },
             booklet,
             name
         )?;
-        eval.dag.on_execution_done(&crop_group.uuid, {
+
+        eval.dag.on_execution_done(&comp_group.uuid, {
             let sender = eval.sender.clone();
             move |results| {
                 let result = &results[0];
                 if !result.status.is_success() {
-                    let mut diagnostic = Diagnostic::error(format!("Failed to crop pdf of {name}"));
-                    if result.status.is_internal_error() {
-                        diagnostic = diagnostic.with_help("Is 'pdfcrop' installed?");
+                    let cropping = result.status == ExecutionStatus::ReturnCode(2);
+                    let mut diagnostic = if cropping {
+                        Diagnostic::error(format!("Failed to crop pdf of {name}"))
+                            .with_help("Is 'pdfcrop' installed?")
+                    } else {
+                        Diagnostic::error(format!("Failed to compile {name} to {}", step.format))
+                    };
+                    if !cropping && result.status.is_internal_error() {
+                        diagnostic = diagnostic.with_help("Is 'asymptote' installed?");
                     }
                     if let Some(stderr) = result.stderr.as_ref() {
                         diagnostic = diagnostic.with_help_attachment(stderr.clone());
@@ -173,9 +179,8 @@ impl AsyFile {
                 Ok(())
             }
         });
-        eval.dag.add_execution_group(crop_group);
-
-        Ok((cropped, vector))
+        eval.dag.add_execution_group(comp_group);
+        Ok(rendered)
     }
 
     /// Search for all the dependencies of an Asymptote source file.
@@ -112,6 +112,8 @@ pub struct SolutionTestcaseEvaluationState {
     pub results: Vec<Option<ExecutionResult>>,
     /// The result of the checker.
     pub checker: Option<ExecutionResult>,
+    /// The profile of the solution, if the testcase was profiled. `Err` if the profiling failed.
+    pub profile: Option<Result<Profile, String>>,
 }
 
 impl SolutionTestcaseEvaluationState {
@@ -173,6 +175,8 @@ pub struct SolutionEvaluationState {
     pub subtasks: HashMap<SubtaskId, SolutionSubtaskEvaluationState>,
     /// The state of the evaluation of the testcases.
     pub testcases: HashMap<TestcaseId, SolutionTestcaseEvaluationState>,
+    /// Incremented at every change of this state, for redrawing only the solutions that changed.
+    pub version: u64,
 }
 
 impl SolutionEvaluationState {
@@ -204,10 +208,12 @@ impl SolutionEvaluationState {
                             status: TestcaseEvaluationStatus::Pending,
                             results: Vec::new(),
                             checker: None,
+                            profile: None,
                         },
                     )
                 })
                 .collect(),
+            version: 0,
         }
     }
 }
@@ -251,6 +257,9 @@ pub struct UIState {
     pub booklets: HashMap<String, BookletState>,
     /// Diagnostic context.
     pub diagnostics: DiagnosticContext,
+    /// The testcases that are not evaluated since they are the same as another testcase, see
+    /// `IOITask::testcase_copies`.
+    pub testcase_copies: HashMap<TestcaseId, Vec<(SubtaskId, TestcaseId)>>,
 }
 
 impl TestcaseEvaluationStatus {
@@ -367,6 +376,7 @@ impl UIState {
             executor_status: None,
             booklets: HashMap::new(),
             diagnostics: Default::default(),
+            testcase_copies: task.testcase_copies(),
         }
     }
 
@@ -412,11 +422,46 @@ impl UIState {
         }
         result
     }
+
+    /// The state of the evaluation of the solution, marked as changed.
+    fn evaluation_mut(&mut self, solution: PathBuf) -> &mut SolutionEvaluationState {
+        let task = &self.task;
+        let eval = self
+            .evaluations
+            .entry(solution)
+            .or_insert_with(|| SolutionEvaluationState::new(task));
+        eval.version += 1;
+        eval
+    }
 }
 
 impl UIStateT for UIState {
     /// Apply a `UIMessage` to this state.
     fn apply(&mut self, message: UIMessage) {
+        // the results of the evaluation of a testcase are also the ones of its copies
+        if let UIMessage::IOIEvaluation { testcase, .. } | UIMessage::IOIChecker { testcase, .. } =
+            &message
+        {
+            for (copy_subtask, copy_testcase) in self
+                .testcase_copies
+                .get(testcase)
+                .cloned()
+                .unwrap_or_default()
+            {
+                let mut copy = message.clone();
+                if let UIMessage::IOIEvaluation {
+                    subtask, testcase, ..
+                }
+                | UIMessage::IOIChecker {
+                    subtask, testcase, ..
+                } = &mut copy
+                {
+                    *subtask = copy_subtask;
+                    *testcase = copy_testcase;
+                }
+                self.apply(copy);
+            }
+        }
         match message {
             UIMessage::StopUI => {}
             UIMessage::ServerStatus { status } => self.executor_status = Some(status),
@@ -539,11 +584,7 @@ impl UIStateT for UIState {
                 status,
                 ..
             } => {
-                let task = &self.task;
-                let eval = self
-                    .evaluations
-                    .entry(solution)
-                    .or_insert_with(|| SolutionEvaluationState::new(task));
+                let eval = self.evaluation_mut(solution);
                 let testcase = eval.testcases.get_mut(&testcase).expect("Missing testcase");
                 match status {
                     UIExecutionStatus::Pending => {}
@@ -599,11 +640,7 @@ impl UIStateT for UIState {
                 status,
                 ..
             } => {
-                let task = &self.task;
-                let eval = self
-                    .evaluations
-                    .entry(solution)
-                    .or_insert_with(|| SolutionEvaluationState::new(task));
+                let eval = self.evaluation_mut(solution);
                 let testcase = eval.testcases.get_mut(&testcase).expect("Missing testcase");
                 match status {
                     UIExecutionStatus::Started { .. } => {
@@ -615,6 +652,16 @@ impl UIStateT for UIState {
                     _ => {}
                 }
             }
+            UIMessage::IOIProfile {
+                testcase,
+                solution,
+                profile,
+                ..
+            } => {
+                let eval = self.evaluation_mut(solution);
+                let testcase = eval.testcases.get_mut(&testcase).expect("Missing testcase");
+                testcase.profile = Some(profile);
+            }
             UIMessage::IOITestcaseScore {
                 testcase,
                 solution,
@@ -622,11 +669,7 @@ impl UIStateT for UIState {
                 message,
                 ..
             } => {
-                let task = &self.task;
-                let eval = self
-                    .evaluations
-                    .entry(solution)
-                    .or_insert_with(|| SolutionEvaluationState::new(task));
+                let eval = self.evaluation_mut(solution);
                 let testcase = eval.testcases.get_mut(&testcase).expect("Missing testcase");
                 testcase.score = Some(score);
                 if !testcase.status.has_completed() {
@@ -655,21 +698,13 @@ impl UIStateT for UIState {
                 score,
                 normalized_score,
             } => {
-                let task = &self.task;
-                let eval = self
-                    .evaluations
-                    .entry(solution)
-                    .or_insert_with(|| SolutionEvaluationState::new(task));
+                let eval = self.evaluation_mut(solution);
                 let subtask = eval.subtasks.get_mut(&subtask).expect("Missing subtask");
                 subtask.score = Some(score);
                 subtask.normalized_score = Some(normalized_score);
             }
             UIMessage::IOITaskScore { solution, score } => {
-                let task = &self.task;
-                let eval = self
-                    .evaluations
-                    .entry(solution)
-                    .or_insert_with(|| SolutionEvaluationState::new(task));
+                let eval = self.evaluation_mut(solution);
                 eval.score = Some(score);
             }
             UIMessage::IOIBooklet { name, status } => {
@@ -97,6 +97,17 @@ pub struct EvaluationConfig {
     pub seed: Option<Seed>,
     /// Do not write any file inside the task directory.
     pub dry_run: bool,
+    /// Skip the evaluations of a solution that cannot change its score anymore, since the subtasks
+    /// of the testcase already have a testcase with zero score.
+    pub skip_failed_subtasks: bool,
+    /// Reuse the results of the previous evaluations of the solutions on the testcases, when none
+    /// of the files they depend on changed.
+    pub incremental: bool,
+    /// In terry evaluations run each solution together with the checker, sending the output to the
+    /// checker through a FIFO instead of storing it.
+    pub terry_fused: bool,
+    /// In IOI evaluations profile the solutions on these testcases, with a separate execution.
+    pub profile: Vec<ioi::TestcaseId>,
 }
 
 /// The data for an evaluation, including the DAG and the UI channel.
@@ -2,10 +2,10 @@
 
 use std::sync::Mutex;
 
-use anyhow::Error;
+use anyhow::{anyhow, Error};
 use task_maker_diagnostics::Diagnostic;
 
-use crate::EvaluationData;
+use crate::{EvaluationData, UISender};
 
 /// Category of a sanity check.
 #[derive(Debug, Clone, Copy, PartialEq, Eq, PartialOrd, Ord, Hash)]
@@ -61,6 +61,13 @@ pub trait SanityCheck: Send + Sync + std::fmt::Debug {
     /// The category of the sanity check.
     fn category(&self) -> SanityCheckCategory;
 
+    /// Whether the hooks of this check only read the task and send diagnostics, without adding
+    /// anything to the DAG. These checks run in parallel, each with a private `EvaluationData`
+    /// whose DAG is discarded.
+    fn read_only(&self) -> bool {
+        false
+    }
+
     /// This function will be called before the actual execution of the DAG. It can add new
     /// executions to the DAG.
     fn pre_hook(&self, _task: &Self::Task, _eval: &mut EvaluationData) -> Result<(), Error> {
@@ -129,7 +136,11 @@ pub struct SanityChecks<Task: 'static> {
     state: Mutex<SanityChecksState<Task>>,
 }
 
-impl<Task> SanityChecks<Task> {
+/// A hook of a sanity check.
+type Hook<Task> =
+    fn(&dyn SanityCheck<Task = Task>, &Task, &mut EvaluationData) -> Result<(), Error>;
+
+impl<Task: Sync> SanityChecks<Task> {
     pub fn new(checks: Vec<Box<dyn SanityCheck<Task = Task>>>) -> SanityChecks<Task> {
         SanityChecks {
             state: Mutex::new(SanityChecksState {
@@ -144,25 +155,57 @@ impl<Task> SanityChecks<Task> {
     ///
     /// This is executed after the DAG of the task is built.
     pub fn pre_hook(&self, task: &Task, eval: &mut EvaluationData) -> Result<(), Error> {
-        let mut state = self.state.lock().unwrap();
-        for check in state.sanity_checks.iter_mut() {
-            if let Err(e) = check.pre_hook(task, eval) {
-                eval.add_diagnostic(Diagnostic::warning(format!(
-                    "Sanity check {} failed: {}",
-                    check.name(),
-                    e
-                )))?;
-            }
-        }
-        Ok(())
+        let state = self.state.lock().unwrap();
+        run_hooks(&state.sanity_checks, task, eval, |check, task, eval| {
+            check.pre_hook(task, eval)
+        })
     }
 
     /// Function called after the evaluation completes. This will check that the produced assets are
     /// valid and the executions added by the pre_hook produced the correct results.
     pub fn post_hook(&self, task: &Task, eval: &mut EvaluationData) -> Result<(), Error> {
-        let mut state = self.state.lock().unwrap();
-        for check in state.sanity_checks.iter_mut() {
-            if let Err(e) = check.post_hook(task, eval) {
+        let state = self.state.lock().unwrap();
+        run_hooks(&state.sanity_checks, task, eval, |check, task, eval| {
+            check.post_hook(task, eval)
+        })
+    }
+}
+
+/// Run a hook of all the checks. The read-only checks are started at once on other threads, and
+/// the messages they send are forwarded to the UI in the order of the checks, so the diagnostics
+/// don't depend on the scheduling. The other checks run on this thread, in the same order.
+fn run_hooks<Task: Sync>(
+    checks: &[Box<dyn SanityCheck<Task = Task>>],
+    task: &Task,
+    eval: &mut EvaluationData,
+    hook: Hook<Task>,
+) -> Result<(), Error> {
+    std::thread::scope(|scope| {
+        let parallel: Vec<_> = checks
+            .iter()
+            .map(|check| {
+                check.read_only().then(|| {
+                    let (mut local, receiver) = EvaluationData::new(eval.task_root.clone());
+                    local.dag.data.config = eval.dag.data.config.clone();
+                    local.solutions.clone_from(&eval.solutions);
+                    scope.spawn(move || (hook(check.as_ref(), task, &mut local), receiver))
+                })
+            })
+            .collect();
+        for (check, handle) in checks.iter().zip(parallel) {
+            let result = match handle {
+                Some(handle) => {
+                    let (result, receiver) = handle
+                        .join()
+                        .map_err(|e| anyhow!("Sanity check {} panicked: {:?}", check.name(), e))?;
+                    for message in receiver.try_iter() {
+                        eval.sender.send(message)?;
+                    }
+                    result
+                }
+                None => hook(check.as_ref(), task, eval),
+            };
+            if let Err(e) = result {
                 eval.add_diagnostic(Diagnostic::warning(format!(
                     "Sanity check {} failed: {}",
                     check.name(),
@@ -171,7 +214,7 @@ impl<Task> SanityChecks<Task> {
             }
         }
         Ok(())
-    }
+    })
 }
 
 impl<Task> Default for SanityChecks<Task> {
@@ -194,3 +237,57 @@ pub fn get_sanity_check_list() -> Vec<(&'static str, SanityCheckCategory)> {
         .map(|check| (check.name(), check.category()));
     ioi.chain(terry).collect()
 }
+
+#[cfg(test)]
+mod tests {
+    use crate::ui::UIMessage;
+
+    use super::*;
+
+    /// A check sending a diagnostic with its name.
+    #[derive(Debug)]
+    struct Check(&'static str, bool);
+
+    impl SanityCheck for Check {
+        type Task = ();
+
+        fn name(&self) -> &'static str {
+            self.0
+        }
+
+        fn category(&self) -> SanityCheckCategory {
+            SanityCheckCategory::Task
+        }
+
+        fn read_only(&self) -> bool {
+            self.1
+        }
+
+        fn pre_hook(&self, _task: &(), eval: &mut EvaluationData) -> Result<(), Error> {
+            eval.add_diagnostic(Diagnostic::warning(self.0))
+        }
+    }
+
+    #[test]
+    fn test_sanity_checks_order() {
+        let names = ["a", "b", "c", "d", "e"];
+        let checks = SanityChecks::new(
+            names
+                .iter()
+                .enumerate()
+                .map(|(i, name)| Box::new(Check(*name, i != 2)) as Box<dyn SanityCheck<Task = ()>>)
+                .collect(),
+        );
+        let (mut eval, receiver) = EvaluationData::new("");
+        checks.pre_hook(&(), &mut eval).unwrap();
+        drop(eval);
+        let messages: Vec<_> = receiver
+            .into_iter()
+            .filter_map(|message| match message {
+                UIMessage::Diagnostic { diagnostic } => Some(diagnostic.message().to_string()),
+                _ => None,
+            })
+            .collect();
+        assert_eq!(messages, names);
+    }
+}
@@ -7,7 +7,8 @@ lazy_static! {
         "generation",
         "evaluation",
         "checking",
-        "booklet"
+        "booklet",
+        "profiling"
     ]
     .iter()
     .map(|s| String::from(*s))
@@ -24,6 +25,8 @@ pub enum Tag {
     Checking,
     /// Compilation of the booklet.
     Booklet,
+    /// Profiling of a solution, run again outside of its evaluation.
+    Profiling,
 }
 
 impl From<Tag> for ExecutionTag {
@@ -33,6 +36,7 @@ impl From<Tag> for ExecutionTag {
             Tag::Evaluation => ExecutionTag::from("evaluation"),
             Tag::Checking => ExecutionTag::from("checking"),
             Tag::Booklet => ExecutionTag::from("booklet"),
+            Tag::Profiling => ExecutionTag::from("profiling"),
         }
     }
 }
@@ -18,10 +18,11 @@ use crate::ui::FinishUIUtils;
 pub(crate) type CursesUI = GenericCursesUI<UIState, Drawer, FinishUI>;
 
 /// The drawer of the Terry CursesUI.
+#[derive(Default)]
 pub(crate) struct Drawer;
 
 impl CursesDrawer<UIState> for Drawer {
-    fn draw(state: &UIState, frame: &mut Frame, loading: char, frame_index: usize) {
+    fn draw(&mut self, state: &UIState, frame: &mut Frame, loading: char, frame_index: usize) {
         draw_frame(state, frame, loading, frame_index);
     }
 }
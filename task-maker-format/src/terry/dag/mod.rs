@@ -1,12 +1,15 @@
 use std::sync::Arc;
 
-use anyhow::{anyhow, Context, Error};
+use anyhow::{anyhow, bail, Context, Error};
+use nix::sys::signal::Signal;
 use serde::{Deserialize, Serialize};
-use task_maker_dag::{Execution, ExecutionLimits, FileUuid};
+use task_maker_dag::{
+    Execution, ExecutionGroup, ExecutionLimits, ExecutionResult, ExecutionStatus, FileUuid,
+};
 
 use crate::terry::{Seed, SolutionOutcome};
-use crate::ui::UIMessage;
-use crate::{bind_exec_callbacks, EvaluationData, SourceFile, Tag};
+use crate::ui::{UIExecutionStatus, UIMessage};
+use crate::{bind_exec_callbacks, EvaluationData, SourceFile, Tag, UISender};
 
 /// Maximum number of bytes of the checker's standard output.
 const OUTCOME_SIZE_LIMIT: usize = 1024 * 1024; // 1MiB
@@ -172,6 +175,20 @@ impl Solution {
         input: FileUuid,
         validation_handle: Option<FileUuid>,
     ) -> Result<(FileUuid, task_maker_dag::ExecutionGroup), Error> {
+        let mut exec = Solution::execution(eval, solution, input, validation_handle)?;
+        let output = exec.capture_stdout(None);
+        let mut group = exec.into_group();
+        group.tag = Some(Tag::Evaluation.into());
+        Ok((output.uuid, group))
+    }
+
+    /// Build the execution of the solution, without deciding where its output goes.
+    fn execution(
+        eval: &mut EvaluationData,
+        solution: &SourceFile,
+        input: FileUuid,
+        validation_handle: Option<FileUuid>,
+    ) -> Result<Execution, Error> {
         let mut exec = solution.execute(
             eval,
             format!("Evaluation of solution {}", solution.name()),
@@ -181,14 +198,11 @@ impl Solution {
         if let Some(validation) = validation_handle {
             exec.input(validation, "wait_for_validation", false);
         }
-        let output = exec.capture_stdout(None);
         exec.capture_stderr(Some(STDERR_SIZE_LIMIT));
         exec.limits_mut()
             .cpu_time(SOLUTION_TIME_LIMIT)
             .wall_time(SOLUTION_TIME_LIMIT * 1.25);
-        let mut group = exec.into_group();
-        group.tag = Some(Tag::Evaluation.into());
-        Ok((output.uuid, group))
+        Ok(exec)
     }
 
     /// Same as `Solution::solve` but also binding the execution callbacks.
@@ -238,25 +252,34 @@ impl Checker {
     where
         F: FnOnce(Result<SolutionOutcome, Error>) -> Result<(), Error> + Send + 'static,
     {
+        let mut exec = self.execution(eval, description, input, "output.txt", official_solution)?;
+        exec.input(output, "output.txt", false);
+        let group = exec.into_group();
+        eval.dag.on_execution_done(&group.uuid, move |results| {
+            parse_outcome(&results[0], callback)
+        });
+        Ok(group)
+    }
+
+    /// Build the execution of the checker, reading the output file of the solution from
+    /// `output_path`.
+    fn execution(
+        &self,
+        eval: &mut EvaluationData,
+        description: String,
+        input: FileUuid,
+        output_path: &str,
+        official_solution: Option<Arc<SourceFile>>,
+    ) -> Result<Execution, Error> {
         let mut exec = self
             .source
-            .execute(eval, &description, vec!["input.txt", "output.txt"])?;
+            .execute(eval, &description, vec!["input.txt", output_path])?;
         include_official_solution(eval, &mut exec, official_solution)?;
         *exec.limits_mut() = ExecutionLimits::unrestricted();
         exec.input(input, "input.txt", false)
-            .input(output, "output.txt", false)
             .capture_stdout(Some(OUTCOME_SIZE_LIMIT));
         exec.capture_stderr(Some(STDERR_SIZE_LIMIT));
-        let group = exec.into_group();
-        eval.dag.on_execution_done(&group.uuid, move |results| {
-            let res = &results[0];
-            let stdout = res
-                .stdout
-                .as_ref()
-                .ok_or_else(|| anyhow!("Checker stdout not captured"))?;
-            callback(serde_json::from_slice(stdout).map_err(|e| e.into()))
-        });
-        Ok(group)
+        Ok(exec)
     }
 
     /// Build the execution for the checking of the output file, and bind the execution callbacks.
@@ -290,6 +313,145 @@ impl Checker {
         eval.dag.add_execution_group(exec);
         Ok(())
     }
+
+    /// Evaluate the solution and check its output in a single execution group, and bind the
+    /// execution callbacks. The output of the solution is sent to the checker through a FIFO, so
+    /// it's never stored. If the solution fails the checker is killed with it, and it's reported
+    /// as skipped, like when they are in separate groups. A solution that fails only because the
+    /// checker stopped reading its output is not a failure, see `split_fused_results`.
+    pub(crate) fn solve_and_check_and_bind<F>(
+        &self,
+        eval: &mut EvaluationData,
+        solution: &SourceFile,
+        input: FileUuid,
+        validation_handle: Option<FileUuid>,
+        official_solution: Option<Arc<SourceFile>>,
+        callback: F,
+    ) -> Result<(), Error>
+    where
+        F: FnOnce(Result<SolutionOutcome, Error>) -> Result<(), Error> + Send + 'static,
+    {
+        let mut group = ExecutionGroup::new(format!(
+            "Evaluation and checking of solution {}",
+            solution.name()
+        ));
+        group.tag = Some(Tag::Evaluation.into());
+        let fifo = group.new_fifo().sandbox_path();
+        let fifo = fifo.to_str().ok_or_else(|| anyhow!("Non-UTF8 fifo path"))?;
+        let mut sol = Solution::execution(eval, solution, input, validation_handle)?;
+        sol.stdout_redirect_path(fifo);
+        let chk = self.execution(
+            eval,
+            format!("Checking output of {}", solution.name()),
+            input,
+            fifo,
+            official_solution,
+        )?;
+        group.add_execution(sol).add_execution(chk);
+
+        let path = solution.path.clone();
+        eval.sender.send(UIMessage::TerrySolution {
+            solution: path.clone(),
+            status: UIExecutionStatus::Pending,
+        })?;
+        eval.sender.send(UIMessage::TerryChecker {
+            solution: path.clone(),
+            status: UIExecutionStatus::Pending,
+        })?;
+        let sender = eval.sender.clone();
+        let solution_path = path.clone();
+        eval.dag.on_execution_start(&group.uuid, move |worker| {
+            sender.send(UIMessage::TerrySolution {
+                solution: solution_path,
+                status: UIExecutionStatus::Started { worker },
+            })
+        });
+        let sender = eval.sender.clone();
+        let solution_path = path.clone();
+        eval.dag.on_execution_done(&group.uuid, move |results| {
+            let [sol, chk] = results else {
+                bail!("Expecting the results of the solution and of the checker");
+            };
+            let (sol, chk) = split_fused_results(sol, chk);
+            sender.send(UIMessage::TerrySolution {
+                solution: solution_path.clone(),
+                status: UIExecutionStatus::Done { result: vec![sol] },
+            })?;
+            let Some(chk) = chk else {
+                return sender.send(UIMessage::TerryChecker {
+                    solution: solution_path,
+                    status: UIExecutionStatus::Skipped,
+                });
+            };
+            sender.send(UIMessage::TerryChecker {
+                solution: solution_path,
+                status: UIExecutionStatus::Done {
+                    result: vec![chk.clone()],
+                },
+            })?;
+            parse_outcome(&chk, callback)
+        });
+        let sender = eval.sender.clone();
+        eval.dag.on_execution_skip(&group.uuid, move || {
+            sender.send(UIMessage::TerrySolution {
+                solution: path.clone(),
+                status: UIExecutionStatus::Skipped,
+            })?;
+            sender.send(UIMessage::TerryChecker {
+                solution: path,
+                status: UIExecutionStatus::Skipped,
+            })
+        });
+        eval.dag.add_execution_group(group);
+        Ok(())
+    }
+}
+
+/// Split the results of a solution and of its checker evaluated in the same group into the ones
+/// reported for the two steps. The checker is `None`, and reported as skipped, when the solution
+/// failed.
+///
+/// When the checker exits, the solution writing more output is killed by `SIGPIPE`, or its write
+/// fails with `EPIPE`. That is not a failure of the solution: the checker either gave its verdict
+/// early or crashed, and in both cases its result is the one that counts.
+fn split_fused_results(
+    sol: &ExecutionResult,
+    chk: &ExecutionResult,
+) -> (ExecutionResult, Option<ExecutionResult>) {
+    let mut sol = sol.clone();
+    if is_broken_pipe(&sol) {
+        sol.status = ExecutionStatus::Success;
+    }
+    if !matches!(sol.status, ExecutionStatus::Success) {
+        return (sol, None);
+    }
+    (sol, Some(chk.clone()))
+}
+
+/// Whether the execution failed because the reader of its output exited: it was killed by
+/// `SIGPIPE`, or it exited after a write failed with `EPIPE`.
+fn is_broken_pipe(result: &ExecutionResult) -> bool {
+    match result.status {
+        ExecutionStatus::Signal(signal, _) => signal == Signal::SIGPIPE as u32,
+        ExecutionStatus::ReturnCode(_) => result
+            .stderr
+            .as_ref()
+            .is_some_and(|stderr| String::from_utf8_lossy(stderr).contains("Broken pipe")),
+        _ => false,
+    }
+}
+
+/// Parse the outcome of the solution from the standard output of the checker, and pass it to the
+/// callback.
+fn parse_outcome<F>(result: &ExecutionResult, callback: F) -> Result<(), Error>
+where
+    F: FnOnce(Result<SolutionOutcome, Error>) -> Result<(), Error>,
+{
+    let stdout = result
+        .stdout
+        .as_ref()
+        .ok_or_else(|| anyhow!("Checker stdout not captured"))?;
+    callback(serde_json::from_slice(stdout).map_err(|e| e.into()))
 }
 
 /// Include the compiled official solution to the sandbox of the provided execution.
@@ -311,3 +473,61 @@ fn include_official_solution(
     }
     Ok(())
 }
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    /// A result with that status, and that standard error.
+    fn result(status: ExecutionStatus, stderr: &str) -> ExecutionResult {
+        ExecutionResult {
+            status,
+            stderr: Some(stderr.as_bytes().to_vec()),
+            ..Default::default()
+        }
+    }
+
+    #[test]
+    fn test_split_fused_results() {
+        let sol = result(ExecutionStatus::Success, "");
+        let chk = result(ExecutionStatus::Success, "");
+        let (sol, chk) = split_fused_results(&sol, &chk);
+        assert_eq!(sol.status, ExecutionStatus::Success);
+        assert_eq!(chk.unwrap().status, ExecutionStatus::Success);
+    }
+
+    #[test]
+    fn test_split_fused_results_checker_exits_early() {
+        let chk = result(ExecutionStatus::Success, "");
+        let killed = result(ExecutionStatus::Signal(13, "Broken pipe".into()), "");
+        let epipe = result(
+            ExecutionStatus::ReturnCode(1),
+            "BrokenPipeError: Broken pipe",
+        );
+        for sol in [killed, epipe] {
+            let (sol, chk) = split_fused_results(&sol, &chk);
+            assert_eq!(sol.status, ExecutionStatus::Success);
+            assert_eq!(chk.unwrap().status, ExecutionStatus::Success);
+        }
+    }
+
+    #[test]
+    fn test_split_fused_results_checker_crashes() {
+        let sol = result(ExecutionStatus::Signal(13, "Broken pipe".into()), "");
+        let crash = ExecutionStatus::Signal(11, "Segmentation fault".into());
+        let chk = result(crash.clone(), "");
+        let (sol, chk) = split_fused_results(&sol, &chk);
+        assert_eq!(sol.status, ExecutionStatus::Success);
+        assert_eq!(chk.unwrap().status, crash);
+    }
+
+    #[test]
+    fn test_split_fused_results_solution_crashes() {
+        let crash = ExecutionStatus::Signal(11, "Segmentation fault".into());
+        let sol = result(crash.clone(), "");
+        let chk = result(ExecutionStatus::Success, "");
+        let (sol, chk) = split_fused_results(&sol, &chk);
+        assert_eq!(sol.status, crash);
+        assert!(chk.is_none());
+    }
+}
@@ -23,6 +23,14 @@ impl FinishUITrait<UIState> for FinishUI {
 
         ui.print_task_info(state);
         println!();
+        // only the estimate is computed in estimate-only mode, nothing has run
+        let status = state.executor_status.as_ref();
+        if let Some(estimate) = status.and_then(|status| status.cost_estimate.as_ref()) {
+            FinishUIUtils::new(&mut ui.stream).print_cost_estimate(estimate);
+            println!();
+            FinishUIUtils::new(&mut ui.stream).print_diagnostic_messages(&state.diagnostics);
+            return;
+        }
         FinishUIUtils::new(&mut ui.stream).print_compilations(&state.compilations);
         println!();
         ui.print_evaluations(state);
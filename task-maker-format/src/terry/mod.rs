@@ -16,7 +16,7 @@ use crate::terry::dag::{Checker, InputGenerator, InputValidator, Solution};
 use crate::terry::format::parse_task;
 use crate::terry::statement::Statement;
 use crate::terry::ui_state::UIState;
-use crate::ui::{JsonUI, PrintUI, RawUI, SilentUI, UIMessage, UIType, UI};
+use crate::ui::{JsonBatchUI, JsonUI, PrintUI, RawUI, SilentUI, UIMessage, UIType, UI};
 use crate::{list_files, EvaluationConfig, EvaluationData, SourceFile, TaskInfo, UISender};
 
 mod curses_ui;
@@ -169,6 +169,7 @@ impl TerryTask {
         match ui_type {
             UIType::Raw => Ok(Box::new(RawUI::new())),
             UIType::Json => Ok(Box::new(JsonUI::new())),
+            UIType::JsonBatch(options) => Ok(Box::new(JsonBatchUI::new(options.clone())?)),
             UIType::Silent => Ok(Box::new(SilentUI::new())),
             UIType::Print => Ok(Box::new(PrintUI::new(UIState::new(self)))),
             UIType::Curses => Ok(Box::new(CursesUI::new(UIState::new(self))?)),
@@ -214,23 +215,40 @@ impl TerryTask {
             } else {
                 None
             };
-            let output_file =
-                Solution::solve_and_bind(eval, &solution.source_file, input_file, validation_file)?;
             let sender = eval.sender.clone();
             let solution_path = solution.source_file.path.clone();
-            self.checker.check_and_bind(
-                eval,
-                &solution.source_file,
-                input_file,
-                output_file,
-                self.official_solution.clone(),
-                move |outcome| {
-                    sender.send(UIMessage::TerrySolutionOutcome {
-                        solution: solution_path,
-                        outcome: outcome.map_err(|e| format!("Invalid checker outcome: {e}")),
-                    })
-                },
-            )?;
+            let callback = move |outcome: Result<SolutionOutcome, Error>| {
+                sender.send(UIMessage::TerrySolutionOutcome {
+                    solution: solution_path,
+                    outcome: outcome.map_err(|e| format!("Invalid checker outcome: {e}")),
+                })
+            };
+            // with copy_exe the output files are needed, so they have to be stored
+            if config.terry_fused && !eval.dag.config_mut().copy_exe {
+                self.checker.solve_and_check_and_bind(
+                    eval,
+                    &solution.source_file,
+                    input_file,
+                    validation_file,
+                    self.official_solution.clone(),
+                    callback,
+                )?;
+            } else {
+                let output_file = Solution::solve_and_bind(
+                    eval,
+                    &solution.source_file,
+                    input_file,
+                    validation_file,
+                )?;
+                self.checker.check_and_bind(
+                    eval,
+                    &solution.source_file,
+                    input_file,
+                    output_file,
+                    self.official_solution.clone(),
+                    callback,
+                )?;
+            }
         }
 
         if let Some(statement) = &self.statement {
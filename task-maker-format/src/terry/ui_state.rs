@@ -211,6 +211,7 @@ impl UIStateT for UIState {
             | UIMessage::IOISolution { .. }
             | UIMessage::IOIEvaluation { .. }
             | UIMessage::IOIChecker { .. }
+            | UIMessage::IOIProfile { .. }
             | UIMessage::IOITestcaseScore { .. }
             | UIMessage::IOISubtaskScore { .. }
             | UIMessage::IOITaskScore { .. }
@@ -4,9 +4,9 @@ use std::io;
 use std::marker::PhantomData;
 use std::path::PathBuf;
 use std::sync::atomic::{AtomicBool, Ordering};
-use std::sync::{Arc, RwLock};
+use std::sync::{Arc, Mutex, RwLock};
 use std::thread::JoinHandle;
-use std::time::SystemTime;
+use std::time::{Duration, Instant, SystemTime};
 
 use anyhow::{Context, Error};
 use itertools::Itertools;
@@ -18,7 +18,7 @@ use ratatui::style::{Color, Modifier, Style};
 use ratatui::text::{Line, Span};
 use ratatui::widgets::{Block, Borders, Paragraph};
 use ratatui::{Frame, Terminal};
-use task_maker_exec::{ExecutorStatus, ExecutorWorkerStatus};
+use task_maker_exec::{ExecutorStatus, ExecutorWorkerStatus, HealthStatus};
 use termion::event::{Event, Key};
 use termion::input::{MouseTerminal, TermRead};
 use termion::raw::IntoRawMode;
@@ -30,6 +30,9 @@ use crate::ui::{CompilationStatus, FinishUI, UIMessage, UIStateT, UI};
 pub(crate) const FPS: u64 = 30;
 /// After how many seconds rotate the list of workers if they don't fit on the screen.
 pub(crate) const ROTATION_DELAY: u64 = 1;
+/// For how many frames the loading character stays the same. When no message arrives the screen
+/// is redrawn only when it changes.
+const LOADING_FRAMES: usize = 4;
 
 macro_rules! define_color_inner {
     ($color:expr,) => {
@@ -85,6 +88,9 @@ where
     ui_thread: Option<JoinHandle<()>>,
     /// The state of the task for the UI.
     state: Arc<RwLock<State>>,
+    /// The messages received since the last frame, applied to the state by the UI thread all
+    /// together, so that the sender never waits for a frame to be drawn.
+    pending: Arc<Mutex<Vec<UIMessage>>>,
     /// When it becomes true the UI will stop.
     stop: Arc<AtomicBool>,
 
@@ -92,11 +98,12 @@ where
     finish_ui: PhantomData<Finish>,
 }
 
-/// A drawer for the frames of the UI.
-pub trait CursesDrawer<State> {
+/// A drawer for the frames of the UI. The same drawer draws all the frames, so it can keep what
+/// did not change since the previous one.
+pub trait CursesDrawer<State>: Default {
     /// Draw a frame of the UI using the provided state, onto the frame, using the loading
     /// character. Frame index is a counter of the number of frames encountered so far.
-    fn draw(state: &State, frame: &mut Frame, loading: char, frame_index: usize);
+    fn draw(&mut self, state: &State, frame: &mut Frame, loading: char, frame_index: usize);
 }
 
 impl<State, Drawer, Finish> CursesUI<State, Drawer, Finish>
@@ -108,23 +115,30 @@ where
     /// Make a new generic `CursesUI`.
     pub fn new(state: State) -> Result<CursesUI<State, Drawer, Finish>, Error> {
         let state = Arc::new(RwLock::new(state));
+        let pending = Arc::new(Mutex::new(Vec::new()));
         let stop = Arc::new(AtomicBool::new(false));
         let mut ui = CursesUI {
             ui_thread: None,
             state: state.clone(),
+            pending: pending.clone(),
             stop: stop.clone(),
             drawer: Default::default(),
             finish_ui: Default::default(),
         };
-        let handle = ui.start(state, stop)?;
+        let handle = ui.start(state, pending, stop)?;
         ui.ui_thread = Some(handle);
         Ok(ui)
     }
 
     /// Start the drawing thread of the UI, returning the `JoinHandle` of it.
+    ///
+    /// At each frame the thread applies the pending messages, and draws the frame only if something
+    /// changed. If drawing takes longer than a frame, the next frame is delayed by the same time,
+    /// so that the UI thread never spends more than half of the time drawing.
     fn start(
         &mut self,
         state: Arc<RwLock<State>>,
+        pending: Arc<Mutex<Vec<UIMessage>>>,
         stop: Arc<AtomicBool>,
     ) -> Result<JoinHandle<()>, Error> {
         let stdout = io::stdout().into_raw_mode()?;
@@ -139,6 +153,8 @@ where
             .spawn(move || {
                 let loading = ['◐', '◓', '◑', '◒'];
                 let mut loading_index = 0;
+                let mut drawer = Drawer::default();
+                let mut messages = Vec::new();
                 let stdin = termion::async_stdin();
                 let mut events = stdin.events();
                 while !stop.load(Ordering::Relaxed) {
@@ -149,15 +165,31 @@ where
                         send_ctrl_c();
                         return;
                     }
-                    let loading = loading[loading_index % loading.len()];
-                    terminal
-                        .draw(|f| {
-                            let state = state.read().expect("UI state lock is poisoned");
-                            Drawer::draw(&state, f, loading, loading_index);
-                        })
-                        .expect("Failed to draw to the screen");
+                    let start = Instant::now();
+                    std::mem::swap(
+                        &mut messages,
+                        &mut *pending.lock().expect("UI message queue is poisoned"),
+                    );
+                    let changed = !messages.is_empty();
+                    if changed {
+                        let mut state = state.write().expect("UI state lock is poisoned");
+                        for message in messages.drain(..) {
+                            state.apply(message);
+                        }
+                    }
+                    if changed || loading_index % LOADING_FRAMES == 0 {
+                        let loading = loading[(loading_index / LOADING_FRAMES) % loading.len()];
+                        terminal
+                            .draw(|f| {
+                                let state = state.read().expect("UI state lock is poisoned");
+                                drawer.draw(&state, f, loading, loading_index);
+                            })
+                            .expect("Failed to draw to the screen");
+                    }
                     // reduce the framerate to at most `FPS`
-                    std::thread::sleep(std::time::Duration::from_micros(1_000_000 / FPS));
+                    let frame = Duration::from_micros(1_000_000 / FPS);
+                    let elapsed = start.elapsed();
+                    std::thread::sleep(frame.saturating_sub(elapsed).max(elapsed));
                     loading_index += 1;
                 }
             })?)
@@ -171,10 +203,10 @@ where
     Finish: FinishUI<State> + Send + Sync + 'static,
 {
     fn on_message(&mut self, message: UIMessage) {
-        self.state
-            .write()
-            .expect("UI state lock is poisoned")
-            .apply(message);
+        self.pending
+            .lock()
+            .expect("UI message queue is poisoned")
+            .push(message);
     }
 
     fn finish(&mut self) {
@@ -185,7 +217,11 @@ where
             .join()
             .expect("UI thread failed");
         // at this point the terminal should be restored
-        let state = self.state.read().expect("State lock is poisoned");
+        let mut state = self.state.write().expect("State lock is poisoned");
+        let pending = std::mem::take(&mut *self.pending.lock().expect("UI queue is poisoned"));
+        for message in pending {
+            state.apply(message);
+        }
         Finish::print(&state);
     }
 }
@@ -388,7 +424,13 @@ fn draw_workers_chunk(
         .map(|worker| {
             let worker_name = format!("- {:<max_len$} ", worker.name, max_len = max_len);
             let worker_name_len = worker_name.chars().count();
-            let mut spans = vec![Span::raw(worker_name)];
+            // the unhealthy workers get fewer jobs, or none
+            let style = match worker.health.as_ref().map(|health| health.status()) {
+                Some(HealthStatus::Overloaded) => *YELLOW,
+                Some(HealthStatus::Unusable) => *RED,
+                _ => Style::default(),
+            };
+            let mut spans = vec![Span::styled(worker_name, style)];
 
             if let Some(job) = &worker.current_job {
                 let duration = job.duration.elapsed().unwrap_or_default().as_secs_f32();
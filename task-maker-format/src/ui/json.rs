@@ -1,5 +1,15 @@
+use std::io::Write;
+use std::sync::mpsc::{channel, RecvTimeoutError, Sender};
+use std::thread::JoinHandle;
+use std::time::{Duration, Instant};
+
+use anyhow::{Context, Error};
+
 use crate::ui::*;
 
+/// The default interval between the batches of the `JsonBatchUI`.
+pub const DEFAULT_JSON_BATCH_INTERVAL: Duration = Duration::from_millis(100);
+
 /// This UI will print to stdout the UI messages as json.
 #[derive(Default)]
 pub struct JsonUI;
@@ -19,3 +29,143 @@ impl UI for JsonUI {
 
     fn finish(&mut self) {}
 }
+
+/// The configuration of a `JsonBatchUI`.
+#[derive(Debug, Clone, PartialEq, Eq)]
+pub struct JsonBatchOptions {
+    /// How long the messages are collected before writing them.
+    pub interval: Duration,
+    /// Whether each batch is prefixed by its length as a 4 bytes big-endian integer, instead of
+    /// being terminated by a new line.
+    pub binary: bool,
+}
+
+/// This UI will print to stdout the UI messages as json, collecting the messages received in an
+/// interval in a single json array.
+///
+/// The messages are serialized and written by a separate thread, so a slow reader of stdout never
+/// blocks the thread that receives the messages.
+pub struct JsonBatchUI {
+    /// The channel to the writer thread, closed when the UI finishes.
+    sender: Option<Sender<UIMessage>>,
+    /// The thread that writes the batches.
+    writer: Option<JoinHandle<()>>,
+}
+
+impl JsonBatchUI {
+    /// Make a new `JsonBatchUI`, starting its writer thread.
+    pub fn new(options: JsonBatchOptions) -> Result<JsonBatchUI, Error> {
+        let (sender, receiver) = channel::<UIMessage>();
+        let writer = std::thread::Builder::new()
+            .name("JSON UI writer".to_owned())
+            .spawn(move || {
+                let mut stdout = std::io::stdout().lock();
+                let mut broken = false;
+                let mut batch = Vec::new();
+                // wait for the first message of a batch, then collect the others for an interval
+                while let Ok(message) = receiver.recv() {
+                    batch.push(message);
+                    let deadline = Instant::now() + options.interval;
+                    let mut closed = false;
+                    while let Some(timeout) = deadline.checked_duration_since(Instant::now()) {
+                        match receiver.recv_timeout(timeout) {
+                            Ok(message) => batch.push(message),
+                            Err(RecvTimeoutError::Timeout) => break,
+                            Err(RecvTimeoutError::Disconnected) => {
+                                closed = true;
+                                break;
+                            }
+                        }
+                    }
+                    if !broken {
+                        if let Err(e) = write_batch(&mut stdout, &batch, options.binary) {
+                            // keep receiving the messages, so that the UI does not stall
+                            warn!("Cannot write the UI messages: {e:?}");
+                            broken = true;
+                        }
+                    }
+                    batch.clear();
+                    if closed {
+                        break;
+                    }
+                }
+            })
+            .context("Failed to spawn the JSON UI writer thread")?;
+        Ok(JsonBatchUI {
+            sender: Some(sender),
+            writer: Some(writer),
+        })
+    }
+}
+
+/// Write a batch of messages as a json array, framed as specified.
+fn write_batch<W: Write>(writer: &mut W, batch: &[UIMessage], binary: bool) -> Result<(), Error> {
+    let content = serde_json::to_vec(batch).context("Failed to serialize the messages")?;
+    if binary {
+        let len = u32::try_from(content.len()).context("The batch is too big")?;
+        writer.write_all(&len.to_be_bytes())?;
+        writer.write_all(&content)?;
+    } else {
+        writer.write_all(&content)?;
+        writer.write_all(b"\n")?;
+    }
+    writer.flush()?;
+    Ok(())
+}
+
+impl UI for JsonBatchUI {
+    fn on_message(&mut self, message: UIMessage) {
+        if let Some(sender) = &self.sender {
+            // if the writer is gone there is no one to send the message to
+            let _ = sender.send(message);
+        }
+    }
+
+    fn finish(&mut self) {
+        // closing the channel makes the writer write the last batch and exit
+        self.sender.take();
+        if let Some(writer) = self.writer.take() {
+            writer.join().expect("JSON UI writer thread failed");
+        }
+    }
+}
+
+impl Drop for JsonBatchUI {
+    fn drop(&mut self) {
+        self.finish();
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_write_batch() {
+        let batch = vec![UIMessage::StopUI, UIMessage::StopUI];
+        let mut lines = Vec::new();
+        write_batch(&mut lines, &batch, false).unwrap();
+        assert_eq!(lines, b"[\"StopUI\",\"StopUI\"]\n");
+
+        let mut frames = Vec::new();
+        write_batch(&mut frames, &batch, true).unwrap();
+        assert_eq!(&frames[..4], &[0, 0, 0, 19]);
+        assert_eq!(&frames[4..], b"[\"StopUI\",\"StopUI\"]");
+    }
+
+    #[test]
+    fn test_parse_json_batch_ui() {
+        let parse = |s: &str| match s.parse::<UIType>() {
+            Ok(UIType::JsonBatch(options)) => Some(options),
+            _ => None,
+        };
+        let options = parse("json-batch").unwrap();
+        assert_eq!(options.interval, DEFAULT_JSON_BATCH_INTERVAL);
+        assert!(!options.binary);
+        let options = parse("json-binary=250").unwrap();
+        assert_eq!(options.interval, Duration::from_millis(250));
+        assert!(options.binary);
+        assert!("json=250".parse::<UIType>().is_err());
+        assert!("json-batch=abc".parse::<UIType>().is_err());
+    }
+}
@@ -3,17 +3,19 @@
 use std::collections::HashMap;
 use std::path::PathBuf;
 use std::sync::mpsc::{channel, Receiver, Sender};
+use std::time::Duration;
 
 use anyhow::Error;
 pub use curses::{inner_block, render_block, render_server_status, CursesDrawer, CursesUI};
 use itertools::Itertools;
-pub use json::JsonUI;
+pub use json::{JsonBatchOptions, JsonBatchUI, JsonUI, DEFAULT_JSON_BATCH_INTERVAL};
 pub use print::PrintUI;
 pub use raw::RawUI;
 use serde::{Deserialize, Serialize};
 pub use silent::SilentUI;
 use task_maker_dag::{ExecutionResourcesUsage, ExecutionResult, ExecutionStatus, WorkerUuid};
 use task_maker_diagnostics::DiagnosticContext;
+use task_maker_exec::CostEstimate;
 pub use termcolor::WriteColor;
 use termcolor::{Color, ColorChoice, ColorSpec, StandardStream};
 pub use ui_message::UIMessage;
@@ -305,6 +307,38 @@ impl<'a> FinishUIUtils<'a> {
             .unwrap_or(0)
     }
 
+    /// Print the estimated cost of the evaluation, computed in estimate-only mode.
+    pub fn print_cost_estimate(&mut self, estimate: &CostEstimate) {
+        cwriteln!(self, BLUE, "Estimated cost");
+        let max_len = estimate.tags.keys().map(|tag| tag.len()).max().unwrap_or(0);
+        for (tag, cost) in &estimate.tags {
+            cwrite!(self, BOLD, "{:width$}  ", tag, width = max_len);
+            print!(
+                "{:>5} cached  {:>5} to run  {:>8.1}s",
+                cost.cache_hits,
+                cost.cache_misses,
+                cost.compute_time.as_secs_f64()
+            );
+            if cost.unknown > 0 {
+                cwrite!(self, YELLOW, "  ({} never run before)", cost.unknown);
+            }
+            println!();
+        }
+        cwrite!(self, BOLD, "Compute time:  ");
+        println!("{:.1}s", estimate.compute_time().as_secs_f64());
+        cwrite!(self, BOLD, "Critical path: ");
+        println!("{:.1}s", estimate.critical_path.as_secs_f64());
+        cwrite!(self, BOLD, "Wall time:     ");
+        match estimate.wall_time() {
+            Some(wall_time) => println!(
+                "{:.1}s with {} workers",
+                wall_time.as_secs_f64(),
+                estimate.connected_workers
+            ),
+            None => println!("unknown, no workers connected"),
+        }
+    }
+
     /// Print the diagnostics.
     pub fn print_diagnostic_messages(&mut self, diagnostics: &DiagnosticContext) {
         let diagnostics = diagnostics.diagnostics();
@@ -320,19 +354,41 @@ impl<'a> FinishUIUtils<'a> {
 #[derive(Debug)]
 pub struct UIMessageSender {
     sender: UIChannelSender,
+    /// The channels that receive a copy of the messages accepted by their filter.
+    mirrors: Vec<(fn(&UIMessage) -> bool, UIChannelSender)>,
 }
 
 impl UIMessageSender {
     /// Make a new pair of UIMessageSender and ChannelReceiver.
     pub fn new() -> (UIMessageSender, UIChannelReceiver) {
         let (sender, receiver) = channel();
-        (UIMessageSender { sender }, receiver)
+        (
+            UIMessageSender {
+                sender,
+                mirrors: vec![],
+            },
+            receiver,
+        )
     }
 
     /// Send a message to the channel.
     pub fn send(&self, message: UIMessage) -> Result<(), Error> {
+        for (filter, mirror) in &self.mirrors {
+            if filter(&message) {
+                // the receiver may be gone, but the UI still wants the message
+                let _ = mirror.send(message.clone());
+            }
+        }
         self.sender.send(message).map_err(|e| e.into())
     }
+
+    /// Make a new channel that receives a copy of the messages sent from now on for which `filter`
+    /// returns true.
+    pub fn mirror(&mut self, filter: fn(&UIMessage) -> bool) -> UIChannelReceiver {
+        let (sender, receiver) = channel();
+        self.mirrors.push((filter, sender));
+        receiver
+    }
 }
 
 /// The trait that describes the UI functionalities.
@@ -354,6 +410,8 @@ pub enum UIType {
     Curses,
     /// The `JsonUI`.
     Json,
+    /// The `JsonBatchUI`.
+    JsonBatch(JsonBatchOptions),
     /// The `SilentUI`.
     Silent,
 }
@@ -361,12 +419,32 @@ pub enum UIType {
 impl std::str::FromStr for UIType {
     type Err = String;
 
+    /// Parse the name of the UI. The `JsonBatchUI` is `json-batch` or `json-binary` (for the
+    /// binary framing), optionally followed by `=` and the interval between the batches in
+    /// milliseconds, like `json-batch=250`.
     fn from_str(s: &str) -> Result<UIType, Self::Err> {
-        match s.to_ascii_lowercase().as_str() {
+        let s = s.to_ascii_lowercase();
+        let (name, interval) = match s.split_once('=') {
+            Some((name, interval)) => {
+                let interval = interval
+                    .parse()
+                    .map_err(|e| format!("Invalid interval of the ui {s}: {e}"))?;
+                (name, Some(Duration::from_millis(interval)))
+            }
+            None => (s.as_str(), None),
+        };
+        if interval.is_some() && !matches!(name, "json-batch" | "json-binary") {
+            return Err(format!("The ui {name} does not have an interval"));
+        }
+        match name {
             "print" => Ok(UIType::Print),
             "raw" => Ok(UIType::Raw),
             "curses" => Ok(UIType::Curses),
             "json" => Ok(UIType::Json),
+            "json-batch" | "json-binary" => Ok(UIType::JsonBatch(JsonBatchOptions {
+                interval: interval.unwrap_or(DEFAULT_JSON_BATCH_INTERVAL),
+                binary: name == "json-binary",
+            })),
             "silent" => Ok(UIType::Silent),
             _ => Err(format!("Unknown ui: {s}")),
         }
@@ -1,5 +1,6 @@
 use itertools::Itertools;
 use task_maker_dag::ExecutionStatus;
+use task_maker_exec::HealthStatus;
 use termcolor::{ColorChoice, ColorSpec, StandardStream};
 
 use crate::cwrite;
@@ -87,10 +88,24 @@ impl<State: UIStateT + Send> UI for PrintUI<State> {
                     status.ready_execs, status.waiting_execs
                 );
                 for worker in status.connected_workers {
+                    let health = match worker.health.as_ref().map(|health| health.status()) {
+                        Some(status) if status != HealthStatus::Healthy => format!(" [{status}]"),
+                        _ => String::new(),
+                    };
                     if let Some(job) = &worker.current_job {
-                        println!(" - {} ({}): {}", worker.name, worker.uuid, job.job);
+                        println!(" - {} ({}){health}: {}", worker.name, worker.uuid, job.job);
                     } else {
-                        println!(" - {} ({})", worker.name, worker.uuid);
+                        println!(" - {} ({}){health}", worker.name, worker.uuid);
+                    }
+                    let overhead = worker
+                        .health
+                        .iter()
+                        .flat_map(|health| &health.overhead.phases);
+                    let means: Vec<_> = overhead
+                        .map(|(phase, histogram)| format!("{phase} {:?}", histogram.mean()))
+                        .collect();
+                    if !means.is_empty() {
+                        println!("     average {}", means.join(", "));
                     }
                 }
             }
@@ -206,6 +221,21 @@ impl<State: UIStateT + Send> UI for PrintUI<State> {
                     "Checking output of {solution:?} of testcase {testcase} of subtask {subtask} "
                 ));
             }
+            UIMessage::IOIProfile {
+                subtask,
+                testcase,
+                solution,
+                profile,
+            } => {
+                print!("[PROFILE] ");
+                let outcome = match profile {
+                    Ok(profile) => format!("{} samples", profile.samples()),
+                    Err(e) => format!("failed: {e}"),
+                };
+                self.write_message(format!(
+                    "Profile of {solution:?} on testcase {testcase} of subtask {subtask}: {outcome}"
+                ));
+            }
             UIMessage::IOITestcaseScore {
                 subtask,
                 testcase,
@@ -101,6 +101,18 @@ pub enum UIMessage {
         status: UIExecutionStatus,
     },
 
+    /// The profile of a solution on a testcase in a IOI task, computed with a separate execution.
+    IOIProfile {
+        /// The id of the subtask.
+        subtask: SubtaskId,
+        /// The id of the testcase.
+        testcase: TestcaseId,
+        /// The path of the solution.
+        solution: PathBuf,
+        /// The sampled stacks. `Err` with the reason if the profiling failed.
+        profile: Result<ioi::Profile, String>,
+    },
+
     /// The score of a testcase is ready.
     IOITestcaseScore {
         /// The id of the subtask.
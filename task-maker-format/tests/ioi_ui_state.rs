@@ -15,6 +15,7 @@ fn test_ui_state_server_status() {
         connected_workers: vec![],
         ready_execs: 1,
         waiting_execs: 123,
+        cost_estimate: None,
     };
     assert_eq!(ui.executor_status, None);
     ui.apply(UIMessage::ServerStatus {
@@ -343,6 +344,54 @@ fn test_ui_state_evaluation_skipped() {
     );
 }
 
+#[test]
+fn test_ui_state_evaluation_copies() {
+    let mut task = utils::new_task();
+    task.testcases.get_mut(&2).unwrap().same_as = Some(0);
+    let mut ui = UIState::new(&task, Default::default());
+    let file = PathBuf::from("file");
+    ui.apply(UIMessage::IOIEvaluation {
+        subtask: 0,
+        testcase: 0,
+        solution: file.clone(),
+        status: UIExecutionStatus::Done {
+            result: vec![utils::good_result()],
+        },
+        manager_index: None,
+    });
+    let testcases = &ui.evaluations[&file].testcases;
+    assert_eq!(testcases[&2].status, TestcaseEvaluationStatus::Solved);
+    assert_eq!(testcases[&2].results, testcases[&0].results);
+    assert_eq!(testcases[&1].status, TestcaseEvaluationStatus::Pending);
+}
+
+#[test]
+fn test_ui_state_evaluation_version() {
+    let task = utils::new_task();
+    let mut ui = UIState::new(&task, Default::default());
+    let file = PathBuf::from("file");
+    ui.apply(UIMessage::IOIEvaluation {
+        subtask: 0,
+        testcase: 0,
+        solution: file.clone(),
+        status: UIExecutionStatus::Pending,
+        manager_index: None,
+    });
+    let version = ui.evaluations[&file].version;
+    ui.apply(UIMessage::IOITaskScore {
+        solution: file.clone(),
+        score: 10.0,
+    });
+    assert!(ui.evaluations[&file].version > version);
+    let version = ui.evaluations[&file].version;
+    ui.apply(UIMessage::IOIGeneration {
+        subtask: 0,
+        testcase: 0,
+        status: UIExecutionStatus::Pending,
+    });
+    assert_eq!(ui.evaluations[&file].version, version);
+}
+
 #[test]
 fn test_ui_state_evaluation_started() {
     let task = utils::new_task();
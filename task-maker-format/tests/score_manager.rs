@@ -4,6 +4,7 @@ extern crate approx;
 use std::path::PathBuf;
 use std::sync::{Arc, Mutex};
 
+use task_maker_dag::{Execution, ExecutionCommand, ExecutionDAG};
 use task_maker_format::ioi::*;
 use task_maker_format::ui::{UIMessage, UIMessageSender};
 
@@ -223,3 +224,124 @@ fn test_score_manager_empty_subtask() {
     }
     assert!(receiver.try_recv().is_err());
 }
+
+#[test]
+fn test_score_manager_skip_failed_subtasks() {
+    let mut task = utils::new_task();
+    // testcase 3 is also in subtask 1
+    let mut testcase = task.testcases[&2].clone();
+    testcase.id = 3;
+    task.testcases.insert(3, testcase);
+    task.subtasks.get_mut(&1).unwrap().testcases.push(3);
+    let (sender, receiver) = UIMessageSender::new();
+    let sender = Arc::new(Mutex::new(sender));
+    let mut manager = ScoreManager::new(&task, "sol".into(), sender.clone()).unwrap();
+    let dag = ExecutionDAG::new();
+    manager.skip_failed_subtasks(dag.skipper());
+    let evaluations: Vec<_> = (0..4)
+        .map(|tc| {
+            let group = Execution::new("eval", ExecutionCommand::local("sol")).into_group();
+            manager.add_evaluation(tc, group.uuid);
+            group.uuid
+        })
+        .collect();
+    // the evaluation on testcase 3 is already running
+    manager.evaluation_started(3);
+
+    // testcase 2 is only in subtask 1, which cannot get any point anymore
+    manager
+        .score(1, 1, 0.0, "foo".into(), sender.clone())
+        .unwrap();
+    assert_eq!(dag.skipper().take(), vec![evaluations[2]]);
+    match receiver.try_recv() {
+        Ok(UIMessage::IOITestcaseScore { testcase, .. }) => assert_eq!(testcase, 1),
+        mex => panic!("Expecting UIMessage::IOITestcaseScore but was {mex:?}"),
+    }
+    // the subtask waits for the skip to be confirmed, and for the running evaluation
+    assert!(receiver.try_recv().is_err());
+
+    manager.evaluation_skipped(1, 2, sender.clone()).unwrap();
+    match receiver.try_recv() {
+        Ok(UIMessage::IOITestcaseScore {
+            testcase, score, ..
+        }) => {
+            assert_eq!(testcase, 2);
+            assert_abs_diff_eq!(score, 0.0);
+        }
+        mex => panic!("Expecting UIMessage::IOITestcaseScore but was {mex:?}"),
+    }
+    assert!(receiver.try_recv().is_err());
+
+    manager
+        .score(1, 3, 1.0, "foo".into(), sender.clone())
+        .unwrap();
+    match receiver.try_recv() {
+        Ok(UIMessage::IOITestcaseScore { testcase, .. }) => assert_eq!(testcase, 3),
+        mex => panic!("Expecting UIMessage::IOITestcaseScore but was {mex:?}"),
+    }
+    match receiver.try_recv() {
+        Ok(UIMessage::IOISubtaskScore { subtask, score, .. }) => {
+            assert_eq!(subtask, 1);
+            assert_abs_diff_eq!(score, 0.0);
+        }
+        mex => panic!("Expecting UIMessage::IOISubtaskScore but was {mex:?}"),
+    }
+    assert!(receiver.try_recv().is_err());
+    // a skip that was not asked doesn't score the testcase
+    manager.evaluation_skipped(0, 0, sender.clone()).unwrap();
+    assert!(receiver.try_recv().is_err());
+
+    manager.score(0, 0, 1.0, "foo".into(), sender).unwrap();
+    assert!(dag.skipper().take().is_empty());
+    let messages: Vec<_> = receiver.try_iter().collect();
+    match messages.last() {
+        Some(UIMessage::IOITaskScore { score, .. }) => assert_abs_diff_eq!(*score, 10.0),
+        mex => panic!("Expecting UIMessage::IOITaskScore but was {mex:?}"),
+    }
+}
+
+#[test]
+fn test_score_manager_copies() {
+    let mut task = utils::new_task();
+    task.testcases.get_mut(&2).unwrap().same_as = Some(0);
+    let (sender, receiver) = UIMessageSender::new();
+    let sender = Arc::new(Mutex::new(sender));
+    let mut manager = ScoreManager::new(&task, "sol".into(), sender.clone()).unwrap();
+
+    manager
+        .score(0, 0, 1.0, "foo".into(), sender.clone())
+        .unwrap();
+    match receiver.try_recv() {
+        Ok(UIMessage::IOITestcaseScore {
+            subtask,
+            testcase,
+            score,
+            ..
+        }) => {
+            assert_eq!(subtask, 1);
+            assert_eq!(testcase, 2);
+            assert_abs_diff_eq!(score, 1.0);
+        }
+        mex => panic!("Expecting UIMessage::IOITestcaseScore but was {mex:?}"),
+    }
+    match receiver.try_recv() {
+        Ok(UIMessage::IOITestcaseScore { testcase, .. }) => assert_eq!(testcase, 0),
+        mex => panic!("Expecting UIMessage::IOITestcaseScore but was {mex:?}"),
+    }
+    match receiver.try_recv() {
+        Ok(UIMessage::IOISubtaskScore { subtask, score, .. }) => {
+            assert_eq!(subtask, 0);
+            assert_abs_diff_eq!(score, 10.0);
+        }
+        mex => panic!("Expecting UIMessage::IOISubtaskScore but was {mex:?}"),
+    }
+    assert!(receiver.try_recv().is_err());
+
+    // testcase 2 already has its score
+    manager.score(1, 1, 1.0, "foo".into(), sender).unwrap();
+    let messages: Vec<_> = receiver.try_iter().collect();
+    match messages.last() {
+        Some(UIMessage::IOITaskScore { score, .. }) => assert_abs_diff_eq!(*score, 100.0),
+        mex => panic!("Expecting UIMessage::IOITaskScore but was {mex:?}"),
+    }
+}
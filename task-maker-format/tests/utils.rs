@@ -23,11 +23,13 @@ pub fn new_task_with_context(path: &Path) -> IOITask {
         task_type: TaskType::Batch(BatchTypeData {
             output_generator: None,
             checker: Checker::WhiteDiff,
+            batch_checker: false,
         }),
         name: "task".to_string(),
         title: "The Task".to_string(),
         time_limit: None,
         memory_limit: None,
+        instruction_limit: None,
         infile: None,
         outfile: None,
         subtasks: HashMap::new(),
@@ -39,7 +41,10 @@ pub fn new_task_with_context(path: &Path) -> IOITask {
         booklets: vec![],
         difficulty: None,
         syllabus_level: None,
+        batch_validator: false,
+        batch_generator: false,
         sanity_checks: Arc::new(get_sanity_checks(&[])),
+        evaluation_cache: None,
     };
     task.testcases.entry(0).or_insert(TestcaseInfo::new(
         0,
@@ -85,9 +90,11 @@ pub fn good_result() -> ExecutionResult {
             sys_time: 0.0,
             wall_time: 0.0,
             memory: 0,
+            counters: None,
         },
         stdout: None,
         stderr: None,
+        timing: None,
     }
 }
 
@@ -101,8 +108,10 @@ pub fn bad_result() -> ExecutionResult {
             sys_time: 0.0,
             wall_time: 0.0,
             memory: 0,
+            counters: None,
         },
         stdout: None,
         stderr: None,
+        timing: None,
     }
 }
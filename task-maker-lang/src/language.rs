@@ -2,7 +2,7 @@ use std::path::{Path, PathBuf};
 
 use anyhow::{Context, Error};
 use task_maker_dag::{
-    Execution, ExecutionCommand, ExecutionDAG, ExecutionGroup, ExecutionLimits, File,
+    Execution, ExecutionCommand, ExecutionDAG, ExecutionGroup, ExecutionLimits, File, FileUuid,
 };
 
 use crate::{Dependency, GraderMap};
@@ -77,6 +77,12 @@ pub trait Language: std::fmt::Debug + Send + Sync {
         vec![]
     }
 
+    /// The files produced by the compilation, besides the executable, that have to be in the sandbox
+    /// of the executions, with their path inside the sandbox.
+    fn runtime_outputs(&self, _path: &Path) -> Vec<PathBuf> {
+        vec![]
+    }
+
     /// Update the limits for some language-specific requirements. For example the executable may
     /// need to fork (hence use more processes).
     fn custom_limits(&self, _limits: &mut ExecutionLimits) {}
@@ -102,6 +108,11 @@ pub struct CompilationSettings {
     pub copy_exe: bool,
     /// Whether to try to link statically the binary.
     pub list_static: bool,
+    /// Extra files to put in the sandbox of the compiler, with their path inside the sandbox.
+    pub compilation_files: Vec<(PathBuf, FileUuid)>,
+    /// The files the compilation has to produce for the executions, besides the binary, with their
+    /// path inside the sandbox. See `Language::runtime_outputs`.
+    pub runtime_outputs: Vec<(PathBuf, File)>,
 }
 
 /// This trait describes the API of a "compiled language builder", a component that builds the DAG
@@ -241,6 +252,10 @@ impl CompiledLanguageBuilder for SimpleCompiledLanguageBuilder<'_, '_> {
                 .context("Failed to provide compilation dependency")?;
         }
 
+        for (path, file) in &self.settings.compilation_files {
+            comp.input(*file, path, false);
+        }
+
         // main source file
         let source = File::new(format!("Source file of {:?}", self.source_path));
         comp.input(&source, &self.source_name, false);
@@ -264,6 +279,9 @@ impl CompiledLanguageBuilder for SimpleCompiledLanguageBuilder<'_, '_> {
 
         // compiled binary
         let exec = comp.output(&self.binary_name);
+        for (path, file) in &self.settings.runtime_outputs {
+            comp.output_files.insert(path.clone(), file.clone());
+        }
         if self.settings.copy_exe {
             if let Some(write_to) = &self.settings.write_to {
                 dag.write_file_to(&exec, write_to, true);
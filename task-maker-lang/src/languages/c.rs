@@ -6,6 +6,8 @@ use crate::language::{
     CompilationSettings, CompiledLanguageBuilder, SimpleCompiledLanguageBuilder,
 };
 use crate::languages::cpp::find_cpp_deps;
+use crate::languages::env_flag;
+use crate::languages::gcc::{GccCompilationBuilder, SharedCompilations};
 use crate::Language;
 
 /// Configuration of the C language to use.
@@ -17,18 +19,30 @@ pub struct LanguageCConfiguration {
     pub std_version: String,
     /// Extra flags to pass to the compiler.
     pub extra_flags: Vec<String>,
+    /// Whether to preprocess the sources before compiling them, so that the compilation is cached
+    /// as long as the preprocessed sources don't change.
+    pub preprocess: bool,
+    /// Whether to compile the grader only once, linking it with each solution.
+    pub split_grader: bool,
+    /// The linker to use instead of the default one of the compiler (e.g. `lld` or `mold`).
+    pub linker: Option<String>,
 }
 
 /// The C language.
 #[derive(Debug)]
 pub struct LanguageC {
     pub config: LanguageCConfiguration,
+    /// The executions shared by the compilations.
+    shared: SharedCompilations,
 }
 
 impl LanguageC {
     /// Make a new LanguageC using the specified version.
     pub fn new(config: LanguageCConfiguration) -> LanguageC {
-        LanguageC { config }
+        LanguageC {
+            config,
+            shared: SharedCompilations::default(),
+        }
     }
 }
 
@@ -47,6 +61,11 @@ impl LanguageCConfiguration {
             compiler: ExecutionCommand::System(compiler.into()),
             std_version,
             extra_flags,
+            preprocess: env_flag("TM_CC_PREPROCESS"),
+            split_grader: env_flag("TM_CC_SPLIT_GRADER"),
+            linker: std::env::var("TM_CC_LINKER")
+                .ok()
+                .filter(|linker| !linker.is_empty()),
         }
     }
 }
@@ -97,10 +116,17 @@ impl Language for LanguageC {
             metadata.add_arg("-static");
         }
 
+        if let Some(linker) = &self.config.linker {
+            metadata.add_arg(format!("-fuse-ld={linker}"));
+        }
+
         find_cpp_deps(source)
             .into_iter()
             .for_each(|d| metadata.add_dependency(d));
-        Some(Box::new(metadata))
+        let mut builder = GccCompilationBuilder::new(metadata, &self.shared);
+        builder.split_grader = self.config.split_grader;
+        builder.preprocess = self.config.preprocess.then_some("i");
+        Some(Box::new(builder))
     }
 }
 
@@ -127,6 +153,9 @@ mod tests {
             compiler: ExecutionCommand::System("gcc".into()),
             std_version: "c11".to_string(),
             extra_flags: vec!["-lfoobar".into()],
+            preprocess: false,
+            split_grader: false,
+            linker: None,
         });
         let mut builder = lang
             .compilation_builder(&tmp.path().join("foo.c"), CompilationSettings::default())
@@ -148,6 +177,9 @@ mod tests {
             compiler: ExecutionCommand::System("gcc".into()),
             std_version: "c11".to_string(),
             extra_flags: vec!["-lfoobar".into()],
+            preprocess: false,
+            split_grader: false,
+            linker: None,
         });
         let settings = CompilationSettings {
             list_static: true,
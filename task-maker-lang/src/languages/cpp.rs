@@ -6,7 +6,8 @@ use task_maker_dag::*;
 use crate::language::{
     CompilationSettings, CompiledLanguageBuilder, Language, SimpleCompiledLanguageBuilder,
 };
-use crate::languages::find_dependencies;
+use crate::languages::gcc::{includes_pch_header, GccCompilationBuilder, SharedCompilations};
+use crate::languages::{env_flag, find_dependencies};
 use crate::Dependency;
 
 /// Configuration of the C++ language to use.
@@ -18,12 +19,24 @@ pub struct LanguageCppConfiguration {
     pub std_version: String,
     /// Extra flags to pass to the compiler.
     pub extra_flags: Vec<String>,
+    /// Whether to precompile `bits/stdc++.h` once, and use it in the compilations of the sources
+    /// that include it. This works only with GCC.
+    pub pch: bool,
+    /// Whether to preprocess the sources before compiling them, so that the compilation is cached
+    /// as long as the preprocessed sources don't change.
+    pub preprocess: bool,
+    /// Whether to compile the grader only once, linking it with each solution.
+    pub split_grader: bool,
+    /// The linker to use instead of the default one of the compiler (e.g. `lld` or `mold`).
+    pub linker: Option<String>,
 }
 
 /// The C++ language.
 #[derive(Debug)]
 pub struct LanguageCpp {
     pub config: LanguageCppConfiguration,
+    /// The executions shared by the compilations.
+    shared: SharedCompilations,
 }
 
 impl LanguageCppConfiguration {
@@ -41,6 +54,12 @@ impl LanguageCppConfiguration {
             compiler: ExecutionCommand::System(compiler.into()),
             std_version,
             extra_flags,
+            pch: env_flag("TM_CXX_PCH"),
+            preprocess: env_flag("TM_CXX_PREPROCESS"),
+            split_grader: env_flag("TM_CXX_SPLIT_GRADER"),
+            linker: std::env::var("TM_CXX_LINKER")
+                .ok()
+                .filter(|linker| !linker.is_empty()),
         }
     }
 }
@@ -48,7 +67,10 @@ impl LanguageCppConfiguration {
 impl LanguageCpp {
     /// Make a new LanguageCpp using the specified version.
     pub fn new(config: LanguageCppConfiguration) -> LanguageCpp {
-        LanguageCpp { config }
+        LanguageCpp {
+            config,
+            shared: SharedCompilations::default(),
+        }
     }
 }
 
@@ -93,14 +115,27 @@ impl Language for LanguageCpp {
         for arg in &self.config.extra_flags {
             metadata.add_arg(arg);
         }
+        // the header must be compiled with the same flags of the source, except the output
+        let pch_flags = (self.config.pch && includes_pch_header(source)).then(|| {
+            let mut flags = metadata.args.clone();
+            flags.retain(|arg| arg != "-o" && *arg != metadata.binary_name);
+            flags
+        });
         if metadata.settings.list_static {
             metadata.add_arg("-static");
         }
+        if let Some(linker) = &self.config.linker {
+            metadata.add_arg(format!("-fuse-ld={linker}"));
+        }
 
         find_cpp_deps(source)
             .into_iter()
             .for_each(|d| metadata.add_dependency(d));
-        Some(Box::new(metadata))
+        let mut builder = GccCompilationBuilder::new(metadata, &self.shared);
+        builder.pch_flags = pch_flags;
+        builder.split_grader = self.config.split_grader;
+        builder.preprocess = self.config.preprocess.then_some("ii");
+        Some(Box::new(builder))
     }
 }
 
@@ -117,7 +152,7 @@ pub(crate) fn find_cpp_deps(path: &Path) -> Vec<Dependency> {
 ///
 /// The returned values are in the form (local_path, sandbox_path). Those paths are equal, and are
 /// just the include itself.
-fn extract_includes(path: &Path) -> Vec<(PathBuf, PathBuf)> {
+pub(crate) fn extract_includes(path: &Path) -> Vec<(PathBuf, PathBuf)> {
     lazy_static! {
         static ref RE: Regex = Regex::new(r#"#include\s*[<"]([^">]+)[>"]"#).expect("Invalid regex");
     }
@@ -145,6 +180,8 @@ mod tests {
     use speculoos::prelude::*;
     use tempfile::TempDir;
 
+    use crate::GraderMap;
+
     use super::*;
 
     fn setup() -> TempDir {
@@ -162,6 +199,10 @@ mod tests {
             compiler: ExecutionCommand::System("g++".into()),
             std_version: "c++14".to_string(),
             extra_flags: vec!["-lfoobar".into()],
+            pch: false,
+            preprocess: false,
+            split_grader: false,
+            linker: None,
         });
         let mut builder = lang
             .compilation_builder(&tmp.path().join("foo.cpp"), CompilationSettings::default())
@@ -184,6 +225,10 @@ mod tests {
             compiler: ExecutionCommand::System("g++".into()),
             std_version: "c++14".to_string(),
             extra_flags: vec!["-lfoobar".into()],
+            pch: false,
+            preprocess: false,
+            split_grader: false,
+            linker: None,
         });
         let mut builder = lang
             .compilation_builder(&tmp.path().join("-foo.cpp"), CompilationSettings::default())
@@ -205,6 +250,10 @@ mod tests {
             compiler: ExecutionCommand::System("g++".into()),
             std_version: "c++14".to_string(),
             extra_flags: vec!["-lfoobar".into()],
+            pch: false,
+            preprocess: false,
+            split_grader: false,
+            linker: None,
         });
         let settings = CompilationSettings {
             list_static: true,
@@ -222,6 +271,108 @@ mod tests {
         assert_that(args).contains("-static".to_string());
     }
 
+    #[test]
+    fn test_compilation_pch() {
+        let tmp = setup();
+        write(tmp.path().join("bar.cpp"), "#include <bits/stdc++.h>").unwrap();
+        write(tmp.path().join("baz.cpp"), "#include <bits/stdc++.h>").unwrap();
+
+        let lang = LanguageCpp::new(LanguageCppConfiguration {
+            compiler: ExecutionCommand::System("g++".into()),
+            std_version: "c++14".to_string(),
+            extra_flags: vec![],
+            pch: true,
+            preprocess: false,
+            split_grader: false,
+            linker: None,
+        });
+        let mut dag = ExecutionDAG::new();
+        let mut compile = |name: &str| {
+            let mut builder = lang
+                .compilation_builder(&tmp.path().join(name), CompilationSettings::default())
+                .unwrap();
+            builder.finalize(&mut dag).unwrap().0.executions.remove(0)
+        };
+        let foo = compile("foo.cpp");
+        let bar = compile("bar.cpp");
+        let baz = compile("baz.cpp");
+
+        // foo.cpp doesn't include the header
+        assert_that(&foo.args).does_not_contain("-Ipch".to_string());
+        assert_that(&foo.input_files).has_length(1);
+        // the header is precompiled only once
+        assert_that(&dag.data.execution_groups).has_length(1);
+        let pch = &dag
+            .data
+            .execution_groups
+            .values()
+            .next()
+            .unwrap()
+            .executions[0];
+        assert_that(&pch.args).contains("-std=c++14".to_string());
+        assert_that(&pch.args).does_not_contain("__compiled".to_string());
+        let pch_file = pch.output_files[Path::new("stdc++.h.gch")].uuid;
+        for comp in [bar, baz] {
+            assert_that(&comp.args).contains("-Ipch".to_string());
+            let input = &comp.input_files[Path::new("pch/bits/stdc++.h.gch")];
+            assert_eq!(input.file, pch_file);
+        }
+    }
+
+    #[test]
+    fn test_compilation_split_grader() {
+        let tmp = setup();
+        write(tmp.path().join("bar.cpp"), "int main() {}").unwrap();
+        write(tmp.path().join("grader.cpp"), "#include \"lib.h\"").unwrap();
+        write(tmp.path().join("lib.h"), "").unwrap();
+        let grader_map = GraderMap::new(vec![tmp.path().join("grader.cpp")]);
+
+        let lang = LanguageCpp::new(LanguageCppConfiguration {
+            compiler: ExecutionCommand::System("g++".into()),
+            std_version: "c++14".to_string(),
+            extra_flags: vec![],
+            pch: false,
+            preprocess: false,
+            split_grader: true,
+            linker: Some("mold".into()),
+        });
+        let mut dag = ExecutionDAG::new();
+        let mut compile = |name: &str| {
+            let mut builder = lang
+                .compilation_builder(&tmp.path().join(name), CompilationSettings::default())
+                .unwrap();
+            builder.use_grader(&grader_map);
+            builder.finalize(&mut dag).unwrap().0.executions.remove(0)
+        };
+        let foo = compile("foo.cpp");
+        let bar = compile("bar.cpp");
+
+        // the grader is compiled only once, with its header
+        assert_that(&dag.data.execution_groups).has_length(1);
+        let grader = &dag
+            .data
+            .execution_groups
+            .values()
+            .next()
+            .unwrap()
+            .executions[0];
+        assert_that(&grader.args).contains("-c".to_string());
+        assert_that(&grader.args).contains("-std=c++14".to_string());
+        assert_that(&grader.args).does_not_contain("-fuse-ld=mold".to_string());
+        assert!(grader.input_files.contains_key(Path::new("lib.h")));
+        let object = grader.output_files[Path::new("grader.cpp.o")].uuid;
+        for comp in [foo, bar] {
+            // the compilation checks the outcome of the grader compilation
+            assert_eq!(comp.command, ExecutionCommand::system("sh"));
+            assert_that(&comp.args).contains("grader.cpp.o".to_string());
+            assert_that(&comp.args).does_not_contain("grader.cpp".to_string());
+            assert_that(&comp.args).contains("-fuse-ld=mold".to_string());
+            assert_eq!(comp.input_files[Path::new("grader.cpp.o")].file, object);
+            assert!(comp.input_files.contains_key(Path::new("grader.status")));
+            assert!(!comp.input_files.contains_key(Path::new("grader.cpp")));
+        }
+    }
+
     #[test]
     fn test_extract_imports() {
         let tmpdir = setup();
@@ -0,0 +1,129 @@
+//! Executions whose failures are reported by the compilations that use their outputs.
+//!
+//! Some compilations are split in more executions, some of them shared by many sources (the
+//! preprocessing, the compilation of the grader, ...). If one of them simply failed, the
+//! compilations depending on it would be skipped, without showing the errors of the compiler.
+//! Instead these executions always succeed, writing their errors to `<name>.log` and their outcome
+//! to `<name>.status`: the compilation prints the logs and fails if any of them failed, so that the
+//! errors are reported like they were produced by the compilation itself.
+
+use std::path::{Path, PathBuf};
+
+use task_maker_dag::{Execution, ExecutionCommand, File};
+
+/// The extension of the file with the outcome of a gate.
+const STATUS_EXTENSION: &str = "status";
+
+/// Make an execution that runs the `script` with `sh`, passing it `args`, and that always succeeds.
+/// The standard error and the outcome of the script are written to the files of the gate `name`.
+pub(crate) fn gated_execution<S, I>(description: S, name: &str, script: &str, args: I) -> Execution
+where
+    S: Into<String>,
+    I: IntoIterator<Item = String>,
+{
+    let mut exec = Execution::new(description, ExecutionCommand::system("sh"));
+    exec.args(
+        [
+            "-c".to_string(),
+            format!(
+                "( {script}\n) 2>{name}.log && status=ok || status=failed\n\
+                 echo $status > {name}.{STATUS_EXTENSION}\n"
+            ),
+            "sh".into(),
+        ]
+        .into_iter()
+        .chain(args),
+    );
+    exec.limits
+        .allow_multiprocess()
+        .read_only(false)
+        .mount_tmpfs(true)
+        .mount_proc(true);
+    exec
+}
+
+/// Declare the files of the gate `name` as outputs of `producer`, returning them with the paths
+/// they should have in the sandbox of the compilation. The gate is checked only after
+/// `apply_gates` is called on the compilation.
+pub(crate) fn gate_files(producer: &mut Execution, name: &str) -> Vec<(PathBuf, File)> {
+    ["log", STATUS_EXTENSION]
+        .iter()
+        .map(|extension| {
+            let path = PathBuf::from(format!("{name}.{extension}"));
+            let file = producer.output(&path);
+            (path, file)
+        })
+        .collect()
+}
+
+/// Make the compilation print the logs of all its gates, and fail if any of them failed. This
+/// should be called once, after all the gates have been added.
+pub(crate) fn apply_gates(comp: &mut Execution) {
+    let ExecutionCommand::System(compiler) = &comp.command else {
+        return;
+    };
+    let mut gates: Vec<String> = comp
+        .input_files
+        .keys()
+        .filter(|path| path.parent() == Some(Path::new("")))
+        .filter(|path| path.extension().is_some_and(|ext| ext == STATUS_EXTENSION))
+        .filter_map(|path| path.file_stem())
+        .map(|name| name.to_string_lossy().to_string())
+        .collect();
+    if gates.is_empty() {
+        return;
+    }
+    gates.sort();
+    let script = format!(
+        "failed=\n\
+         for gate in {}; do\n\
+         cat \"$gate.log\" >&2\n\
+         read status < \"$gate.{STATUS_EXTENSION}\"\n\
+         [ \"$status\" = ok ] || failed=1\n\
+         done\n\
+         [ -z \"$failed\" ] || exit 1\n\
+         exec \"$@\"\n",
+        shell_words::join(&gates)
+    );
+    let compiler = compiler.to_string_lossy().to_string();
+    let args = ["-c".to_string(), script, "sh".into(), compiler]
+        .into_iter()
+        .chain(comp.args.drain(..))
+        .collect();
+    comp.command = ExecutionCommand::system("sh");
+    comp.args = args;
+}
+
+#[cfg(test)]
+mod tests {
+    use speculoos::prelude::*;
+
+    use super::*;
+
+    #[test]
+    fn test_apply_gates() {
+        let mut comp = Execution::new("Compilation of sol.cpp", ExecutionCommand::system("g++"));
+        comp.args(vec!["-O2", "sol.cpp"]);
+        // without gates the compilation is unchanged
+        apply_gates(&mut comp);
+        assert_eq!(comp.command, ExecutionCommand::system("g++"));
+
+        let mut first = gated_execution("first", "first", "\"$@\"", vec!["true".to_string()]);
+        let mut second = gated_execution("second", "second", "\"$@\"", vec!["true".to_string()]);
+        let files = gate_files(&mut first, "first")
+            .into_iter()
+            .chain(gate_files(&mut second, "second"));
+        for (path, file) in files {
+            comp.input(&file, path, false);
+        }
+        assert!(comp.input_files.contains_key(&PathBuf::from("first.log")));
+        assert!(comp
+            .input_files
+            .contains_key(&PathBuf::from("second.status")));
+
+        apply_gates(&mut comp);
+        assert_eq!(comp.command, ExecutionCommand::system("sh"));
+        assert_that(&comp.args[1]).contains("for gate in first second;");
+        assert_eq!(&comp.args[3..], ["g++", "-O2", "sol.cpp"]);
+    }
+}
@@ -0,0 +1,251 @@
+//! The compilation of C and C++ with a GCC-like compiler, optionally split in more executions.
+//!
+//! Some of these executions are shared by all the compilations of a DAG with the same flags: the
+//! precompilation of `bits/stdc++.h`, and the compilation of the grader to an object file, that is
+//! then linked to each solution.
+
+use std::collections::HashMap;
+use std::path::{Path, PathBuf};
+use std::sync::Mutex;
+
+use anyhow::{Context, Error};
+use task_maker_dag::*;
+
+use crate::language::{CompiledLanguageBuilder, SimpleCompiledLanguageBuilder};
+use crate::languages::cpp::{extract_includes, find_cpp_deps};
+use crate::languages::gate::{apply_gates, gate_files, gated_execution};
+use crate::languages::preprocess::{is_link_flag, split_preprocessing};
+use crate::source_file::COMPILATION_PRIORITY;
+use crate::{Dependency, GraderMap};
+
+/// The header that is precompiled in the PCH mode.
+const PCH_HEADER: &str = "bits/stdc++.h";
+/// The directory inside the sandbox with the precompiled header. It's added to the include path,
+/// so that the compiler finds the `.gch` before the system header.
+const PCH_DIR: &str = "pch";
+/// The name of the gate of the compilation of the grader, see `gate`.
+const GRADER_GATE: &str = "grader";
+
+/// The executions shared by the compilations of a language, with the files they produce and the
+/// paths these files have in the sandboxes of the compilations.
+#[derive(Debug, Default)]
+pub(crate) struct SharedCompilations {
+    /// The executions for each key. An execution is reused only by the compilations of the DAG it
+    /// belongs to.
+    executions: Mutex<HashMap<Vec<String>, (ExecutionGroupUuid, Vec<(PathBuf, File)>)>>,
+}
+
+/// Builder of the compilation of a C/C++ source file, that also adds to the DAG the executions the
+/// compilation depends on.
+pub(crate) struct GccCompilationBuilder<'l, 'c> {
+    /// The builder of the compilation of the source.
+    pub(crate) inner: SimpleCompiledLanguageBuilder<'l, 'c>,
+    /// The executions shared with the other compilations of the language.
+    shared: &'l SharedCompilations,
+    /// The flags to use for precompiling the header, if the source should use it.
+    pub(crate) pch_flags: Option<Vec<String>>,
+    /// Whether to compile the grader alone, and only link it with the source.
+    pub(crate) split_grader: bool,
+    /// The extension of the preprocessed files, if the sources should be preprocessed in a
+    /// separate execution.
+    pub(crate) preprocess: Option<&'static str>,
+}
+
+impl SharedCompilations {
+    /// The files produced by the execution with the provided key, adding it to the DAG with `make`
+    /// if the DAG doesn't have one already.
+    fn get_or_add<F>(
+        &self,
+        dag: &mut ExecutionDAG,
+        key: Vec<String>,
+        make: F,
+    ) -> Result<Vec<(PathBuf, File)>, Error>
+    where
+        F: FnOnce(&mut ExecutionDAG) -> Result<(Execution, Vec<(PathBuf, File)>), Error>,
+    {
+        let mut executions = self.executions.lock().unwrap();
+        if let Some((group, files)) = executions.get(&key) {
+            if dag.data.execution_groups.contains_key(group) {
+                return Ok(files.clone());
+            }
+        }
+        let (execution, files) = make(dag)?;
+        let uuid = add_compilation_step(dag, execution);
+        executions.insert(key, (uuid, files.clone()));
+        Ok(files)
+    }
+}
+
+impl<'l, 'c> GccCompilationBuilder<'l, 'c> {
+    /// Make a new builder that compiles what `inner` compiles in a single execution, with nothing
+    /// split.
+    pub(crate) fn new(
+        inner: SimpleCompiledLanguageBuilder<'l, 'c>,
+        shared: &'l SharedCompilations,
+    ) -> GccCompilationBuilder<'l, 'c> {
+        GccCompilationBuilder {
+            inner,
+            shared,
+            pch_flags: None,
+            split_grader: false,
+            preprocess: None,
+        }
+    }
+}
+
+impl CompiledLanguageBuilder for GccCompilationBuilder<'_, '_> {
+    fn use_grader(&mut self, grader_map: &GraderMap) {
+        self.inner.use_grader(grader_map);
+    }
+
+    fn finalize(&mut self, dag: &mut ExecutionDAG) -> Result<(ExecutionGroup, File), Error> {
+        let ExecutionCommand::System(compiler) = &self.inner.compiler else {
+            return self.inner.finalize(dag);
+        };
+        let compiler = compiler.to_string_lossy().to_string();
+        let mut inputs = vec![];
+        if self.split_grader {
+            if let Some(grader) = self.inner.grader.take() {
+                // the object doesn't depend on the output and on the libraries to link
+                let mut flags = vec![];
+                let mut args = self.inner.args.iter();
+                while let Some(arg) = args.next() {
+                    if arg == "-o" {
+                        args.next();
+                    } else if !is_link_flag(arg) {
+                        flags.push(arg.clone());
+                    }
+                }
+                let key = [
+                    "grader".to_string(),
+                    grader.local_path.display().to_string(),
+                ]
+                .into_iter()
+                .chain(flags.iter().cloned())
+                .collect();
+                let files = self.shared.get_or_add(dag, key, |dag| {
+                    grader_object(dag, &compiler, flags, &grader)
+                })?;
+                self.inner
+                    .args
+                    .push(files[0].0.to_string_lossy().to_string());
+                inputs.extend(files);
+            }
+        }
+        if let Some(flags) = self.pch_flags.take() {
+            let key = std::iter::once("pch".to_string())
+                .chain(flags.iter().cloned())
+                .collect();
+            let files = self.shared.get_or_add(dag, key, |dag| {
+                Ok(precompiled_header(dag, &compiler, flags))
+            })?;
+            self.inner.args.insert(0, format!("-I{PCH_DIR}"));
+            inputs.extend(files);
+        }
+        if !inputs.is_empty() {
+            self.inner.callback(move |comp| {
+                for (path, file) in inputs {
+                    comp.input(&file, path, false);
+                }
+            });
+        }
+
+        let (mut comp, exec) = self.inner.finalize(dag)?;
+        if let [execution] = comp.executions.as_mut_slice() {
+            if let Some(extension) = self.preprocess {
+                if let Some(preprocess) = split_preprocessing(&dag.data, execution, extension) {
+                    add_compilation_step(dag, preprocess);
+                }
+            }
+            apply_gates(execution);
+        }
+        Ok((comp, exec))
+    }
+}
+
+/// Whether the source file includes the header that is precompiled.
+pub(crate) fn includes_pch_header(path: &Path) -> bool {
+    extract_includes(path)
+        .iter()
+        .any(|(_, include)| include == Path::new(PCH_HEADER))
+}
+
+/// Add to the DAG an execution that some compilations depend on.
+fn add_compilation_step(dag: &mut ExecutionDAG, execution: Execution) -> ExecutionGroupUuid {
+    let mut group = ExecutionGroup::from(execution);
+    // the compilations of the task wait for this
+    group.priority = COMPILATION_PRIORITY + 1;
+    group.tag = Some(ExecutionTag::from("compilation"));
+    dag.add_execution_group(group)
+}
+
+/// The execution that precompiles the header with these flags.
+///
+/// If the precompilation fails, an empty file is produced instead: the compiler ignores the
+/// invalid header and falls back to the system one, instead of failing all the compilations.
+fn precompiled_header(
+    dag: &mut ExecutionDAG,
+    compiler: &str,
+    flags: Vec<String>,
+) -> (Execution, Vec<(PathBuf, File)>) {
+    let header = File::new(format!("Wrapper of {PCH_HEADER}"));
+    dag.provide_content(
+        header.clone(),
+        format!("#include <{PCH_HEADER}>\n").into_bytes(),
+    );
+    let mut pch = Execution::new(
+        format!("Precompilation of {PCH_HEADER}"),
+        ExecutionCommand::system("sh"),
+    );
+    let mut args = vec![
+        "-c".to_string(),
+        "\"$@\" || true".into(),
+        "sh".into(),
+        compiler.to_string(),
+    ];
+    args.extend(flags);
+    args.extend(["-x", "c++-header", "stdc++.h", "-o", "stdc++.h.gch"].map(String::from));
+    pch.args(args);
+    pch.input(&header, "stdc++.h", false);
+    pch.limits
+        .allow_multiprocess()
+        .read_only(false)
+        .mount_tmpfs(true)
+        .mount_proc(true);
+    let file = pch.output("stdc++.h.gch");
+    let path = Path::new(PCH_DIR).join(format!("{PCH_HEADER}.gch"));
+    (pch, vec![(path, file)])
+}
+
+/// The execution that compiles the grader to an object file, with these flags. The object is the
+/// first of the returned files, the other ones are the files of the gate.
+fn grader_object(
+    dag: &mut ExecutionDAG,
+    compiler: &str,
+    flags: Vec<String>,
+    grader: &Dependency,
+) -> Result<(Execution, Vec<(PathBuf, File)>), Error> {
+    let source = grader.sandbox_path.to_string_lossy().to_string();
+    let object = format!("{source}.o");
+    let args = std::iter::once(compiler.to_string())
+        .chain(flags)
+        .chain(["-c", &source, "-o", &object].map(String::from));
+    let mut comp = gated_execution(
+        format!("Compilation of {source}"),
+        GRADER_GATE,
+        "\"$@\"",
+        args,
+    );
+    comp.input(&grader.file, &grader.sandbox_path, false);
+    dag.provide_file(grader.file.clone(), &grader.local_path)
+        .context("Failed to provide grader dependency")?;
+    for dep in find_cpp_deps(&grader.local_path) {
+        comp.input(&dep.file, &dep.sandbox_path, dep.executable);
+        dag.provide_file(dep.file, &dep.local_path)
+            .context("Failed to provide grader dependency")?;
+    }
+    let file = comp.output(&object);
+    let mut files = vec![(PathBuf::from(object), file)];
+    files.extend(gate_files(&mut comp, GRADER_GATE));
+    Ok((comp, files))
+}
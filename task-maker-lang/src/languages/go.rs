@@ -1,4 +1,4 @@
-use std::path::Path;
+use std::path::{Path, PathBuf};
 
 use task_maker_dag::*;
 
@@ -6,14 +6,69 @@ use crate::language::{
     CompilationSettings, CompiledLanguageBuilder, Language, SimpleCompiledLanguageBuilder,
 };
 
+/// The build cache of the compilations, inside the sandbox.
+const GO_CACHE: &str = "/tmp/go-build";
+/// The maximum size of the seed of the build cache, in KiB. The seed is copied by every
+/// compilation, so a larger one is not used.
+const MAX_SEED_SIZE_KIB: u64 = 64 * 1024;
+
+/// The script that fills the build cache with the content of the seed in `$1`, then runs `go` with
+/// the rest of the arguments. The compilation doesn't fail if the seed is too large or cannot be
+/// copied, it's just slower: the reason is printed, and a partial copy is removed.
+fn seeded_build_script() -> String {
+    format!(
+        "mkdir -p \"$GOCACHE\" || exit 1; size=$(du -sk \"$1\" | cut -f1); \
+         if [ \"${{size:-0}}\" -gt {MAX_SEED_SIZE_KIB} ]; then \
+         echo \"Not using the Go build cache $1: $size KiB, more than {MAX_SEED_SIZE_KIB} KiB\" >&2; \
+         elif ! cp -R \"$1\"/. \"$GOCACHE\"; then \
+         echo \"Not using the Go build cache $1: the copy failed\" >&2; \
+         rm -rf \"$GOCACHE\" && mkdir -p \"$GOCACHE\"; \
+         fi; shift; exec go \"$@\""
+    )
+}
+
+/// Configuration of the Go language to use.
+#[derive(Clone, Debug)]
+pub struct LanguageGoConfiguration {
+    /// A Go build cache, in the workers, with the standard packages already compiled. Each
+    /// compilation starts from a copy of it instead of an empty build cache, so the packages used
+    /// by the solutions are not compiled every time.
+    ///
+    /// The entries of the build cache are addressed by the hash of the toolchain, of the flags and
+    /// of the sources: the ones made by another toolchain or with other flags are just not used. It
+    /// must be made with the same environment of the compilations, and since it's copied by every
+    /// compilation it should contain only the packages the solutions use: the whole standard
+    /// library is a few hundred MiB. For example, building a program that imports them (on x86_64):
+    /// `GOCACHE=/path GOARCH=386 GO111MODULE=off CGO_ENABLED=0 go build -o /dev/null seed.go`,
+    /// where `seed.go` imports `bufio`, `fmt`, `math`, `os`, `sort`, `strconv` and `strings`.
+    /// A seed larger than `MAX_SEED_SIZE_KIB` is not used.
+    ///
+    /// If this is `None`, each compilation starts with an empty build cache.
+    pub build_cache_seed: Option<PathBuf>,
+}
+
+impl LanguageGoConfiguration {
+    /// Get the configuration of Go from the environment variables.
+    pub fn from_env() -> LanguageGoConfiguration {
+        LanguageGoConfiguration {
+            build_cache_seed: std::env::var_os("TM_GO_BUILD_CACHE").map(Into::into),
+        }
+    }
+}
+
 /// The Go language.
 #[derive(Debug)]
-pub struct LanguageGo;
+pub struct LanguageGo {
+    /// The configuration of Go.
+    pub config: LanguageGoConfiguration,
+}
 
 impl LanguageGo {
     /// Make a new LanguageGo
     pub fn new() -> LanguageGo {
-        LanguageGo
+        LanguageGo {
+            config: LanguageGoConfiguration::from_env(),
+        }
     }
 }
 
@@ -39,17 +94,27 @@ impl Language for LanguageGo {
         source: &Path,
         settings: CompilationSettings,
     ) -> Option<Box<dyn CompiledLanguageBuilder + '_>> {
-        let mut metadata = SimpleCompiledLanguageBuilder::new(
-            self,
-            source,
-            settings,
-            ExecutionCommand::system("go"),
-        );
+        let seed = self.config.build_cache_seed.clone();
+        let command = match seed {
+            Some(_) => ExecutionCommand::system("sh"),
+            None => ExecutionCommand::system("go"),
+        };
+        let mut metadata = SimpleCompiledLanguageBuilder::new(self, source, settings, command);
+        if let Some(seed) = &seed {
+            metadata
+                .add_arg("-c")
+                .add_arg(seeded_build_script())
+                .add_arg("go")
+                .add_arg(seed.to_string_lossy());
+        }
         let binary_name = metadata.binary_name.clone();
         metadata.add_arg("build").add_arg("-o").add_arg(binary_name);
 
-        metadata.callback(|comp| {
-            comp.env("GOCACHE", "/tmp");
+        metadata.callback(move |comp| {
+            comp.env("GOCACHE", GO_CACHE);
+            if let Some(seed) = &seed {
+                comp.limits_mut().add_extra_readable_dir(seed);
+            }
             comp.env("GO111MODULE", "off");
             comp.env("CGO_ENABLED", "0");
             #[cfg(target_os = "linux")]
@@ -71,3 +136,36 @@ impl Language for LanguageGo {
         limits.permissive = true;
     }
 }
+
+#[cfg(test)]
+mod tests {
+    use tempfile::TempDir;
+
+    use super::*;
+
+    #[test]
+    fn test_build_cache_seed() {
+        let tmp = TempDir::new().unwrap();
+        let source = tmp.path().join("foo.go");
+        std::fs::write(&source, "package main\nfunc main() {}").unwrap();
+        let lang = LanguageGo {
+            config: LanguageGoConfiguration {
+                build_cache_seed: Some("/opt/go-cache".into()),
+            },
+        };
+        let mut builder = lang
+            .compilation_builder(&source, CompilationSettings::default())
+            .unwrap();
+        let (comp, _) = builder.finalize(&mut ExecutionDAG::new()).unwrap();
+        let comp = &comp.executions[0];
+        assert_eq!(comp.command, ExecutionCommand::system("sh"));
+        assert_eq!(comp.args[1], seeded_build_script());
+        assert_eq!(comp.args[2..5], ["go", "/opt/go-cache", "build"]);
+        assert!(comp.args.contains(&"foo.go".to_string()));
+        assert_eq!(comp.env["GOCACHE"], GO_CACHE);
+        assert!(comp
+            .limits
+            .extra_readable_dirs
+            .contains(&PathBuf::from("/opt/go-cache")));
+    }
+}
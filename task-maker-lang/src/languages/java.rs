@@ -1,19 +1,110 @@
-use std::path::Path;
+use std::path::{Path, PathBuf};
 
 use task_maker_dag::*;
 
 use crate::language::{
     CompilationSettings, CompiledLanguageBuilder, Language, SimpleCompiledLanguageBuilder,
 };
+use crate::languages::env_flag;
+
+/// The class-data sharing archive made by the compilation, if enabled.
+const CDS_ARCHIVE: &str = "classes.jsa";
+/// The time limit, in seconds, of the run of the training program during the compilation, that
+/// finds the classes to put in the archive.
+const CDS_TRAINING_TIMEOUT: u32 = 10;
+/// The program run during the compilation to find the classes of the JDK to put in the archive. It
+/// uses the classes most solutions use for the I/O and the data structures, so that the archive
+/// doesn't depend on the solution and the code of the contestant is never run outside the
+/// evaluation. It must not contain single quotes, since the compilation script writes it with a
+/// quoted `printf`.
+const CDS_TRAINING_SOURCE: &str = r#"import java.io.*;
+import java.util.*;
+import java.util.stream.*;
+
+public class CdsTraining {
+    public static void main(String[] args) throws IOException {
+        String input = "3\n1 2 3\nabc def\n";
+        BufferedReader reader = new BufferedReader(new InputStreamReader(
+                new ByteArrayInputStream(input.getBytes()), "UTF-8"));
+        int n = Integer.parseInt(reader.readLine().trim());
+        StringTokenizer tokens = new StringTokenizer(reader.readLine());
+        long[] values = new long[n];
+        for (int i = 0; i < n; i++) values[i] = Long.parseLong(tokens.nextToken());
+        String[] words = reader.readLine().split(" ");
+        Scanner scanner = new Scanner(new ByteArrayInputStream(input.getBytes()));
+        int m = scanner.nextInt();
+        StreamTokenizer stream = new StreamTokenizer(new BufferedReader(new StringReader(input)));
+        stream.nextToken();
+
+        List<Integer> list = new ArrayList<>();
+        for (int i = 0; i < n + m; i++) list.add(i * 7 % 5);
+        Collections.sort(list);
+        Integer[] boxed = list.toArray(new Integer[0]);
+        Arrays.sort(boxed, (a, b) -> b - a);
+        Arrays.sort(values);
+        Map<String, Integer> hash = new HashMap<>();
+        Map<Integer, Long> tree = new TreeMap<>();
+        Set<Integer> set = new HashSet<>(list);
+        TreeSet<Integer> sorted = new TreeSet<>(list);
+        Deque<Integer> deque = new ArrayDeque<>();
+        PriorityQueue<long[]> queue = new PriorityQueue<>(Comparator.comparingLong(x -> x[0]));
+        for (String word : words) hash.merge(word, 1, Integer::sum);
+        for (int i = 0; i < n; i++) {
+            tree.put(i, values[i]);
+            deque.addLast(i);
+            queue.add(new long[] {values[i], i});
+        }
+        List<Integer> evens = list.stream().filter(x -> x % 2 == 0).collect(Collectors.toList());
+        long sum = IntStream.range(0, n).mapToLong(i -> values[i]).sum();
+
+        StringBuilder builder = new StringBuilder();
+        builder.append(sum).append(" ").append(Math.max(set.size(), sorted.first()));
+        PrintWriter out = new PrintWriter(new BufferedWriter(new OutputStreamWriter(System.out)));
+        out.println(builder);
+        out.printf("%d %.3f %s%n", deque.pollFirst(), (double) queue.poll()[0], evens);
+        out.println(String.join(",", hash.keySet()) + tree + String.valueOf(stream.nval));
+        out.flush();
+    }
+}
+"#;
+/// The options of the JVM used by the executions.
+const JVM_OPTIONS: &[&str] = &[
+    "-Xmx512M",
+    "-Xss64M",
+    "-XX:+UseSerialGC",
+    "-Dfile.encoding=UTF-8",
+];
+
+/// Configuration of the Java language to use.
+#[derive(Clone, Debug)]
+pub struct LanguageJavaConfiguration {
+    /// Whether to make, at compile time, a class-data sharing archive with the classes of the JDK
+    /// used by the program, to reduce the startup time of the JVM.
+    pub cds: bool,
+}
 
 /// The Java language.
 #[derive(Debug)]
-pub struct LanguageJava;
+pub struct LanguageJava {
+    /// The configuration of Java.
+    pub config: LanguageJavaConfiguration,
+}
+
+impl LanguageJavaConfiguration {
+    /// Get the configuration of Java from the environment variables.
+    pub fn from_env() -> LanguageJavaConfiguration {
+        LanguageJavaConfiguration {
+            cds: env_flag("TM_JAVA_CDS"),
+        }
+    }
+}
 
 impl LanguageJava {
     /// Make a new LanguageJava
     pub fn new() -> LanguageJava {
-        LanguageJava
+        LanguageJava {
+            config: LanguageJavaConfiguration::from_env(),
+        }
     }
 }
 
@@ -52,9 +143,25 @@ impl Language for LanguageJava {
             .to_string_lossy()
             .to_string();
 
-        metadata.add_arg("-c").add_arg(format!(
+        let mut script = format!(
             "javac -encoding UTF-8 -d . *.java && jar cfe {binary_name} {main_class} *.class"
-        ));
+        );
+        if self.config.cds {
+            // The archive contains only the classes of the JDK: the classes of the jar would be
+            // rejected at runtime, since the archive checks the modification time of the jar. The
+            // classes are found by running a fixed training program, never the solution, and if
+            // anything fails the archive is empty and the JVM ignores it.
+            script += &format!(
+                " && {{ mkdir cds && printf '%s' '{CDS_TRAINING_SOURCE}' > cds/CdsTraining.java \
+                 && javac -encoding UTF-8 -d cds cds/CdsTraining.java \
+                 && timeout {CDS_TRAINING_TIMEOUT} java -XX:DumpLoadedClassList=classes.lst {} \
+                 -cp cds CdsTraining </dev/null >/dev/null 2>&1; \
+                 java -Xshare:dump -XX:SharedClassListFile=classes.lst \
+                 -XX:SharedArchiveFile={CDS_ARCHIVE} -XX:+UseSerialGC >/dev/null 2>&1; true; }}",
+                JVM_OPTIONS.join(" ")
+            );
+        }
+        metadata.add_arg("-c").add_arg(script);
 
         metadata.grader_only();
 
@@ -71,20 +178,31 @@ impl Language for LanguageJava {
         write_to: Option<&Path>,
         mut args: Vec<String>,
     ) -> Vec<String> {
-        let mut new_args = vec![
-            "-Xmx512M".to_string(),
-            "-Xss64M".to_string(),
-            "-XX:+UseSerialGC".to_string(),
-            "-Dfile.encoding=UTF-8".to_string(),
-            "-jar".to_string(),
+        let mut new_args: Vec<String> = JVM_OPTIONS.iter().map(|opt| opt.to_string()).collect();
+        if self.config.cds {
+            new_args.push(format!("-XX:SharedArchiveFile={CDS_ARCHIVE}"));
+            // the warnings of the JVM (e.g. about an unusable archive) would go to stdout
+            new_args.push("-Xlog:disable".into());
+            new_args.push("-Xlog:all=warning:stderr".into());
+        }
+        new_args.push("-jar".into());
+        new_args.push(
             self.executable_name(path, write_to)
                 .to_string_lossy()
                 .to_string(),
-        ];
+        );
         new_args.append(&mut args);
         new_args
     }
 
+    fn runtime_outputs(&self, _path: &Path) -> Vec<PathBuf> {
+        if self.config.cds {
+            vec![CDS_ARCHIVE.into()]
+        } else {
+            vec![]
+        }
+    }
+
     fn custom_limits(&self, limits: &mut ExecutionLimits) {
         limits
             .mount_proc(true)
@@ -92,3 +210,41 @@ impl Language for LanguageJava {
             .add_extra_readable_dir("/etc");
     }
 }
+
+#[cfg(test)]
+mod tests {
+    use speculoos::prelude::*;
+    use tempfile::TempDir;
+
+    use super::*;
+
+    #[test]
+    fn test_cds_archive() {
+        let tmp = TempDir::new().unwrap();
+        let source = tmp.path().join("Sol.java");
+        std::fs::write(&source, "class Sol {}").unwrap();
+        let lang = LanguageJava {
+            config: LanguageJavaConfiguration { cds: true },
+        };
+
+        let archive = File::new("archive");
+        let settings = CompilationSettings {
+            runtime_outputs: vec![(CDS_ARCHIVE.into(), archive.clone())],
+            ..Default::default()
+        };
+        let mut builder = lang.compilation_builder(&source, settings).unwrap();
+        let (comp, _exec) = builder.finalize(&mut ExecutionDAG::new()).unwrap();
+        let comp = &comp.executions[0];
+        assert_that(&comp.args[1]).contains("-Xshare:dump");
+        assert_that(&comp.args[1]).contains("-cp cds CdsTraining");
+        assert!(!comp.args[1].contains(" -jar "));
+        assert_eq!(comp.output_files[Path::new(CDS_ARCHIVE)].uuid, archive.uuid);
+
+        assert_eq!(
+            lang.runtime_outputs(&source),
+            vec![PathBuf::from(CDS_ARCHIVE)]
+        );
+        let args = lang.runtime_args(&source, None, vec![]);
+        assert_that(&args).contains(format!("-XX:SharedArchiveFile={CDS_ARCHIVE}"));
+    }
+}
@@ -8,14 +8,23 @@ use crate::Dependency;
 pub(crate) mod c;
 pub(crate) mod cpp;
 pub(crate) mod csharp;
+pub(crate) mod gate;
+pub(crate) mod gcc;
 pub(crate) mod go;
 pub(crate) mod java;
 pub(crate) mod javascript;
 pub(crate) mod pascal;
+pub(crate) mod preprocess;
 pub(crate) mod python;
 pub(crate) mod rust;
 pub(crate) mod shell;
 
+/// Whether the environment variable is set to a value that enables an option: anything except
+/// empty and `0`.
+pub(crate) fn env_flag(name: &str) -> bool {
+    std::env::var(name).is_ok_and(|value| !value.is_empty() && value != "0")
+}
+
 /// Extract all the dependencies of a source file recursively. The file can include/import many
 /// other files, even cyclically. Each import is included only once in the result.
 ///
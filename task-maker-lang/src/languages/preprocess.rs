@@ -0,0 +1,171 @@
+//! Compilation of C/C++ in two steps: the sources are preprocessed first, and then the preprocessed
+//! files are compiled.
+//!
+//! The cache key of an execution depends on all its input files, so a single compilation would be
+//! invalidated by any change to any header, even one that doesn't change the preprocessed code.
+//! The second step depends only on the preprocessed files, so when they don't change its result,
+//! hence the binary, comes from the cache.
+
+use std::path::Path;
+
+use task_maker_dag::{Execution, ExecutionCommand, ExecutionDAGData};
+
+use crate::languages::gate::{gate_files, gated_execution};
+
+/// The name of the gate of the preprocessor, see `gate`.
+const GATE: &str = "preprocess";
+
+/// Make `comp` compile the preprocessed sources, returning the execution that preprocesses them.
+///
+/// The sources and the headers are the inputs of the compilation that are provided to the DAG, the
+/// other inputs (the precompiled header, the object of the grader, ...) are kept by the
+/// compilation. The errors of the preprocessor are reported by the compilation, using a gate.
+pub(crate) fn split_preprocessing(
+    dag: &ExecutionDAGData,
+    comp: &mut Execution,
+    extension: &str,
+) -> Option<Execution> {
+    let ExecutionCommand::System(compiler) = &comp.command else {
+        return None;
+    };
+    let compiler = compiler.to_string_lossy().to_string();
+    let is_provided = |path: &Path| {
+        comp.input_files
+            .get(path)
+            .is_some_and(|input| dag.provided_files.contains_key(&input.file))
+    };
+    // the translation units are the arguments that are source files
+    let units: Vec<String> = comp
+        .args
+        .iter()
+        .filter(|arg| is_provided(Path::new(arg.as_str())))
+        .cloned()
+        .collect();
+    if units.is_empty() {
+        return None;
+    }
+    let pch = comp
+        .input_files
+        .keys()
+        .any(|path| path.extension().is_some_and(|ext| ext == "gch"));
+    let preprocessed = |unit: &str| format!("{unit}.{extension}");
+
+    let mut flags = vec![];
+    let mut args = comp.args.iter();
+    while let Some(arg) = args.next() {
+        if arg == "-o" {
+            args.next();
+        } else if !units.contains(arg)
+            && !is_link_flag(arg)
+            && !comp.input_files.contains_key(Path::new(arg.as_str()))
+        {
+            flags.push(arg.clone());
+        }
+    }
+    if pch {
+        // keep a reference to the precompiled header instead of expanding it
+        flags.push("-fpch-preprocess".into());
+    }
+    let script = format!(
+        "status=0\n\
+         for unit in {}; do\n\
+         \"$@\" -E \"$unit\" -o \"$unit.{extension}\" || status=1\n\
+         done\n\
+         exit $status",
+        shell_words::join(&units)
+    );
+    let description = comp.description.replacen("Compilation", "Preprocessing", 1);
+    let mut preprocess = gated_execution(
+        description,
+        GATE,
+        &script,
+        std::iter::once(compiler).chain(flags),
+    );
+    preprocess.input_files = comp
+        .input_files
+        .iter()
+        .filter(|(path, _)| is_provided(path) || path.extension().is_some_and(|ext| ext == "gch"))
+        .map(|(path, input)| (path.clone(), input.clone()))
+        .collect();
+    preprocess.env = comp.env.clone();
+    preprocess.copy_env = comp.copy_env.clone();
+
+    // the compilation depends only on the preprocessed files, and on the files produced by the
+    // other executions
+    comp.input_files
+        .retain(|_, input| !dag.provided_files.contains_key(&input.file));
+    for unit in &units {
+        let file = preprocess.output(preprocessed(unit));
+        comp.input(&file, preprocessed(unit), false);
+    }
+    for (path, file) in gate_files(&mut preprocess, GATE) {
+        comp.input(&file, path, false);
+    }
+    for arg in comp.args.iter_mut() {
+        if units.contains(arg) {
+            *arg = preprocessed(arg);
+        }
+    }
+    if pch {
+        comp.args.push("-fpch-preprocess".into());
+    }
+    Some(preprocess)
+}
+
+/// Whether the compiler flag is used only when linking: the preprocessor would warn about it.
+pub(crate) fn is_link_flag(arg: &str) -> bool {
+    arg.starts_with("-l")
+        || arg.starts_with("-L")
+        || arg.starts_with("-fuse-ld=")
+        || arg == "-static"
+}
+
+#[cfg(test)]
+mod tests {
+    use std::collections::HashSet;
+    use std::path::PathBuf;
+
+    use speculoos::prelude::*;
+    use task_maker_dag::{ExecutionDAG, File};
+
+    use super::*;
+
+    #[test]
+    fn test_split_preprocessing() {
+        let mut dag = ExecutionDAG::new();
+        let mut comp = Execution::new("Compilation of sol.cpp", ExecutionCommand::system("g++"));
+        comp.args(vec![
+            "-O2",
+            "-o",
+            "__compiled",
+            "-lm",
+            "grader.cpp",
+            "sol.cpp",
+        ]);
+        for path in ["grader.cpp", "sol.cpp", "sol.h"] {
+            let file = File::new(path);
+            comp.input(&file, path, false);
+            dag.provide_content(file, vec![]);
+        }
+        // produced by another execution
+        comp.input(&File::new("lib.o"), "lib.o", false);
+
+        let preprocess = split_preprocessing(&dag.data, &mut comp, "ii").unwrap();
+        assert_that(&preprocess.args).contains("g++".to_string());
+        assert_that(&preprocess.args).contains("-O2".to_string());
+        assert_that(&preprocess.args).does_not_contain("-lm".to_string());
+        assert_that(&preprocess.args).does_not_contain("__compiled".to_string());
+        assert_that(&preprocess.input_files).has_length(3);
+        let outputs: HashSet<_> = preprocess.output_files.keys().cloned().collect();
+        let mut inputs: HashSet<_> = comp.input_files.keys().cloned().collect();
+        assert!(inputs.remove(&PathBuf::from("lib.o")));
+        assert_eq!(outputs, inputs);
+        assert!(inputs.contains(&PathBuf::from("sol.cpp.ii")));
+        assert!(inputs.contains(&PathBuf::from("preprocess.log")));
+
+        assert_that(&comp.args).contains("grader.cpp.ii".to_string());
+        assert_that(&comp.args).contains("sol.cpp.ii".to_string());
+        assert_that(&comp.args).does_not_contain("sol.cpp".to_string());
+        assert_that(&comp.args).contains("__compiled".to_string());
+    }
+}
@@ -3,18 +3,64 @@ use std::path::{Path, PathBuf};
 use regex::Regex;
 use task_maker_dag::ExecutionCommand;
 
-use crate::language::Language;
-use crate::languages::find_dependencies;
+use crate::language::{
+    CompilationSettings, CompiledLanguageBuilder, Language, SimpleCompiledLanguageBuilder,
+};
+use crate::languages::{env_flag, find_dependencies};
 use crate::Dependency;
 
+/// The script that compiles the sources to bytecode. The arguments are the path of the compiled
+/// program, the local modules it imports and the program itself. The modules are compiled next to
+/// their source, with the `.pyc` extension: without the source in the sandbox Python imports them
+/// from there.
+const COMPILE_SCRIPT: &str = "\
+import py_compile, sys
+out, *modules, main = sys.argv[1:]
+try:
+    for module in modules:
+        py_compile.compile(module, cfile=module[:-3] + '.pyc', doraise=True)
+    py_compile.compile(main, cfile=out, doraise=True)
+except py_compile.PyCompileError as e:
+    sys.exit(e.msg)
+";
+
+/// Configuration of the Python language to use.
+#[derive(Clone, Debug)]
+pub struct LanguagePythonConfiguration {
+    /// The interpreter to use (e.g. `ExecutionCommand::system("pypy3")`).
+    pub interpreter: ExecutionCommand,
+    /// Whether to compile the program and its local modules to bytecode once, instead of letting
+    /// the interpreter compile them at the start of every execution. The bytecode is specific to
+    /// the version of the interpreter, and the graders are not supported.
+    pub precompile: bool,
+}
+
 /// The Python language
 #[derive(Debug)]
-pub struct LanguagePython;
+pub struct LanguagePython {
+    /// The configuration of Python.
+    pub config: LanguagePythonConfiguration,
+}
+
+impl LanguagePythonConfiguration {
+    /// Get the configuration of Python from the environment variables.
+    pub fn from_env() -> LanguagePythonConfiguration {
+        let interpreter = std::env::var_os("TM_PYTHON")
+            .filter(|interpreter| !interpreter.is_empty())
+            .unwrap_or_else(|| "python3".into());
+        LanguagePythonConfiguration {
+            interpreter: ExecutionCommand::System(interpreter.into()),
+            precompile: env_flag("TM_PYTHON_PRECOMPILE"),
+        }
+    }
+}
 
 impl LanguagePython {
-    /// Make a new LanguagePython using the specified version.
+    /// Make a new LanguagePython using the configuration from the environment.
     pub fn new() -> LanguagePython {
-        LanguagePython
+        LanguagePython {
+            config: LanguagePythonConfiguration::from_env(),
+        }
     }
 }
 
@@ -28,15 +74,41 @@ impl Language for LanguagePython {
     }
 
     fn need_compilation(&self) -> bool {
-        false
+        self.config.precompile
     }
 
     fn inline_comment_prefix(&self) -> Option<&'static str> {
         Some("#")
     }
 
+    fn compilation_builder(
+        &self,
+        source: &Path,
+        settings: CompilationSettings,
+    ) -> Option<Box<dyn CompiledLanguageBuilder + '_>> {
+        if !self.config.precompile {
+            return None;
+        }
+        let mut metadata = SimpleCompiledLanguageBuilder::new(
+            self,
+            source,
+            settings,
+            self.config.interpreter.clone(),
+        );
+        let binary_name = metadata.binary_name.clone();
+        metadata
+            .add_arg("-c")
+            .add_arg(COMPILE_SCRIPT)
+            .add_arg(binary_name);
+        for dep in find_python_deps(source) {
+            metadata.add_arg(dep.sandbox_path.to_string_lossy());
+            metadata.add_dependency(dep);
+        }
+        Some(Box::new(metadata))
+    }
+
     fn runtime_command(&self, _path: &Path, _write_to: Option<&Path>) -> ExecutionCommand {
-        ExecutionCommand::system("python3")
+        self.config.interpreter.clone()
     }
 
     fn runtime_args(
@@ -56,8 +128,22 @@ impl Language for LanguagePython {
     }
 
     fn runtime_dependencies(&self, path: &Path) -> Vec<Dependency> {
+        if self.config.precompile {
+            // the compiled modules are used instead
+            return vec![];
+        }
         find_python_deps(path)
     }
+
+    fn runtime_outputs(&self, path: &Path) -> Vec<PathBuf> {
+        if !self.config.precompile {
+            return vec![];
+        }
+        find_python_deps(path)
+            .into_iter()
+            .map(|dep| dep.sandbox_path.with_extension("pyc"))
+            .collect()
+    }
 }
 
 /// Extract all the dependencies of a python file recursively.
@@ -103,12 +189,18 @@ mod tests {
     use std::fs::write;
 
     use speculoos::prelude::*;
+    use task_maker_dag::ExecutionDAG;
 
     use super::*;
 
     #[test]
     fn test_runtime_args() {
-        let lang = LanguagePython::new();
+        let lang = LanguagePython {
+            config: LanguagePythonConfiguration {
+                interpreter: ExecutionCommand::system("python3"),
+                precompile: false,
+            },
+        };
         let path = Path::new("script.py");
         let write_to = Path::new("script.boh");
         assert_that(&lang.runtime_command(path, Some(write_to)))
@@ -163,4 +255,30 @@ mod tests {
         assert_that(&deps[0].local_path).is_equal_to(foo_path);
         assert_that(&deps[0].sandbox_path).is_equal_to(PathBuf::from("foo.py"));
     }
+
+    #[test]
+    fn test_precompile() {
+        let tmpdir = tempfile::TempDir::new().unwrap();
+        let path = tmpdir.path().join("script.py");
+        write(&path, "import foo").unwrap();
+        write(tmpdir.path().join("foo.py"), "x = 1").unwrap();
+        let lang = LanguagePython {
+            config: LanguagePythonConfiguration {
+                interpreter: ExecutionCommand::system("pypy3"),
+                precompile: true,
+            },
+        };
+        assert!(lang.need_compilation());
+        assert!(lang.runtime_dependencies(&path).is_empty());
+        assert_that(&lang.runtime_outputs(&path)).is_equal_to(vec![PathBuf::from("foo.pyc")]);
+
+        let mut builder = lang
+            .compilation_builder(&path, CompilationSettings::default())
+            .unwrap();
+        let (comp, _exe) = builder.finalize(&mut ExecutionDAG::new()).unwrap();
+        let comp = &comp.executions[0];
+        assert_that(&comp.command).is_equal_to(ExecutionCommand::system("pypy3"));
+        assert_eq!(comp.args[2..], ["__compiled", "foo.py", "script.py"]);
+        assert!(comp.input_files.contains_key(Path::new("foo.py")));
+    }
 }
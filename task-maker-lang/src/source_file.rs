@@ -1,10 +1,12 @@
+use std::fmt::Write;
 use std::path::{Path, PathBuf};
 use std::sync::{Arc, Mutex};
 
 use anyhow::{Context, Error};
 use serde::{Deserialize, Deserializer, Serialize, Serializer};
 use task_maker_dag::{
-    Execution, ExecutionDAG, ExecutionGroupUuid, ExecutionTag, File, FileUuid, Priority,
+    Execution, ExecutionCommand, ExecutionDAG, ExecutionGroupUuid, ExecutionTag, File, FileUuid,
+    Priority,
 };
 
 use crate::language::{CompilationSettings, Language};
@@ -12,7 +14,7 @@ use crate::{GraderMap, LanguageManager};
 
 /// Length of the stdout/stderr of the compilers to capture.
 const COMPILATION_CONTENT_LENGTH: usize = 10 * 1024;
-const COMPILATION_PRIORITY: Priority = 1_000_000_000;
+pub(crate) const COMPILATION_PRIORITY: Priority = 1_000_000_000;
 
 /// A source file that will be able to be executed (with an optional compilation step).
 ///
@@ -31,6 +33,9 @@ pub struct SourceFile {
     pub language: Arc<dyn Language + Send + Sync>,
     /// Handle to the executable after the compilation/provided file.
     pub executable: Arc<Mutex<Option<File>>>,
+    /// The files produced by the compilation for the executions, besides the executable, with their
+    /// path inside the sandbox.
+    pub runtime_outputs: Arc<Mutex<Vec<(PathBuf, File)>>>,
     /// An optional handler to the map of the graders.
     pub grader_map: Option<Arc<GraderMap>>,
     /// Whether to force the copy-exe option of the DAG for this source file.
@@ -39,6 +44,10 @@ pub struct SourceFile {
     pub write_bin_to: Option<PathBuf>,
     /// Whether this source file should be statically linked.
     pub link_static: bool,
+    /// Additional files embedded in task-maker to make available to the compiler, as pairs
+    /// (sandbox path, content).
+    #[serde(skip)]
+    pub compilation_files: Vec<(PathBuf, &'static [u8])>,
 }
 
 impl SourceFile {
@@ -64,10 +73,12 @@ impl SourceFile {
             base_path,
             language: lang?,
             executable: Arc::new(Mutex::new(None)),
+            runtime_outputs: Arc::new(Mutex::new(Vec::new())),
             grader_map,
             write_bin_to: write_bin_to.map(|p| p.into()),
             copy_exe: false,
             link_static: false,
+            compilation_files: Vec::new(),
         })
     }
 
@@ -165,6 +176,9 @@ impl SourceFile {
             self.language.executable_name(&self.path, write_to),
             true,
         );
+        for (path, file) in self.runtime_outputs.lock().unwrap().iter() {
+            exec.input(file, path, false);
+        }
         for dep in self.language.runtime_dependencies(&self.path) {
             exec.input(&dep.file, &dep.sandbox_path, dep.executable);
             dag.provide_file(dep.file, &dep.local_path)
@@ -198,6 +212,12 @@ impl SourceFile {
         }
     }
 
+    /// Make a file available to the compiler of this source file, at the specified path inside the
+    /// sandbox. It has no effect on the languages that are not compiled.
+    pub fn add_compilation_file<P: Into<PathBuf>>(&mut self, path: P, content: &'static [u8]) {
+        self.compilation_files.push((path.into(), content));
+    }
+
     /// Prepare the source file if needed and return the executable file. If the compilation step
     /// was not executed yet the handle to the compilation execution is also returned.
     pub fn executable(
@@ -256,11 +276,25 @@ impl SourceFile {
             return Ok(None);
         }
         let write_to = self.write_bin_to.as_deref();
-        let settings = CompilationSettings {
+        let mut settings = CompilationSettings {
             write_to: write_to.map(Into::into),
             list_static: self.link_static,
             copy_exe: dag.config_mut().copy_exe || self.copy_exe,
+            compilation_files: Vec::new(),
+            runtime_outputs: Vec::new(),
         };
+        if self.language.need_compilation() {
+            for (path, content) in &self.compilation_files {
+                let file = File::new(format!("Compilation file {path:?} of {:?}", self.path));
+                settings.compilation_files.push((path.clone(), file.uuid));
+                dag.provide_content(file, content.to_vec());
+            }
+            for path in self.language.runtime_outputs(&self.path) {
+                let file = File::new(format!("Compilation output {path:?} of {:?}", self.path));
+                settings.runtime_outputs.push((path, file));
+            }
+        }
+        let runtime_outputs = settings.runtime_outputs.clone();
         if let Some(mut metadata) = self.language.compilation_builder(&self.path, settings) {
             if let Some(grader_map) = self.grader_map.as_ref() {
                 metadata.use_grader(grader_map.as_ref());
@@ -283,6 +317,7 @@ impl SourceFile {
             let comp_uuid = comp.uuid;
             dag.add_execution_group(comp);
             *self.executable.lock().unwrap() = Some(exec);
+            *self.runtime_outputs.lock().unwrap() = runtime_outputs;
             Ok(Some(comp_uuid))
         } else {
             let executable = File::new(format!("Source file of {:?}", self.path));
@@ -302,6 +337,50 @@ impl SourceFile {
     pub fn language(&self) -> &dyn Language {
         self.language.as_ref()
     }
+
+    /// A description of the commands that compile and run the source file, for telling whether
+    /// the toolchain changed: the commands with their arguments, which include the compilation
+    /// flags, and the size and the modification time of the executables they find in `$PATH`. The
+    /// compilation is built in a scratch DAG.
+    pub fn toolchain(&self) -> Result<String, Error> {
+        let mut commands = Vec::new();
+        let settings = CompilationSettings {
+            list_static: self.link_static,
+            ..Default::default()
+        };
+        if let Some(mut metadata) = self.language.compilation_builder(&self.path, settings) {
+            if let Some(grader_map) = self.grader_map.as_ref() {
+                metadata.use_grader(grader_map.as_ref());
+            }
+            let (comp, _) = metadata.finalize(&mut ExecutionDAG::new())?;
+            for exec in comp.executions {
+                commands.push((exec.command, exec.args));
+            }
+        }
+        commands.push((
+            self.language.runtime_command(&self.path, None),
+            self.language.runtime_args(&self.path, None, vec![]),
+        ));
+        let mut toolchain = String::new();
+        for (command, args) in commands {
+            let _ = writeln!(toolchain, "{command:?} {args:?}");
+            let ExecutionCommand::System(program) = &command else {
+                continue;
+            };
+            if let Ok(path) = which::which(program) {
+                let metadata = std::fs::metadata(&path)
+                    .with_context(|| format!("Failed to stat {}", path.display()))?;
+                let _ = writeln!(
+                    toolchain,
+                    "{} {} {:?}",
+                    path.display(),
+                    metadata.len(),
+                    metadata.modified().ok()
+                );
+            }
+        }
+        Ok(toolchain)
+    }
 }
 
 /// Serializer for `Arc<dyn Language>`. It serializes just the name of the language, expecting the
@@ -388,4 +467,33 @@ mod tests {
         assert!(!exec_skipped.load(Ordering::Relaxed));
         assert!(cwd.path().join("bin").exists());
     }
+
+    #[test]
+    fn test_source_file_compilation_files() {
+        let cwd = TempDir::new().unwrap();
+
+        let mut dag = ExecutionDAG::new();
+        let source_path = cwd.path().join("source.cpp");
+        std::fs::write(&source_path, "#include \"lib.h\"\nint main() {}").unwrap();
+        let mut source = SourceFile::new(&source_path, "", None, None::<PathBuf>).unwrap();
+        source.add_compilation_file("lib.h", b"int x;");
+        let comp = source.prepare(&mut dag).unwrap().unwrap();
+
+        let comp = &dag.data.execution_groups[&comp].executions[0];
+        let input = comp.input_files.get(Path::new("lib.h")).unwrap();
+        assert!(dag.data.provided_files.contains_key(&input.file));
+    }
+
+    #[test]
+    fn test_toolchain() {
+        let cwd = TempDir::new().unwrap();
+        let source_path = cwd.path().join("source.cpp");
+        std::fs::write(&source_path, "int main() {}").unwrap();
+        let mut source = SourceFile::new(&source_path, "", None, None::<PathBuf>).unwrap();
+        let toolchain = source.toolchain().unwrap();
+        assert_eq!(source.toolchain().unwrap(), toolchain);
+        // the compilation flags are part of the toolchain
+        source.link_static = true;
+        assert_ne!(source.toolchain().unwrap(), toolchain);
+    }
 }
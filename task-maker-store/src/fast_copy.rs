@@ -0,0 +1,67 @@
+//! Copy of files that shares the content with the original when the filesystem allows it.
+//!
+//! On copy-on-write filesystems (btrfs, XFS, ...) the copy is a reflink: the new file points to the
+//! same blocks on disk of the original one, so copying takes a constant time regardless of its
+//! size. Otherwise the content is copied with `std::io::copy`, that on Linux already uses
+//! `copy_file_range` (copying inside the kernel) where supported.
+
+use std::fs::File;
+use std::os::unix::io::AsRawFd;
+use std::path::Path;
+
+use anyhow::{Context, Error};
+
+// FICLONE from linux/fs.h
+nix::ioctl_write_int!(ficlone, 0x94, 9);
+
+/// Copy the content of `source` to `dest`, replacing it if already present. The permissions of
+/// `source` are not copied.
+pub fn copy_file<P: AsRef<Path>, Q: AsRef<Path>>(source: P, dest: Q) -> Result<(), Error> {
+    let source = source.as_ref();
+    let dest = dest.as_ref();
+    let mut input =
+        File::open(source).with_context(|| format!("Failed to open {}", source.display()))?;
+    let mut output =
+        File::create(dest).with_context(|| format!("Failed to create {}", dest.display()))?;
+    // SAFETY: FICLONE only reads the file descriptor passed as argument, which is kept open by
+    // `input` for the whole call.
+    let cloned = unsafe { ficlone(output.as_raw_fd(), input.as_raw_fd() as _) };
+    match cloned {
+        Ok(_) => return Ok(()),
+        // not supported by the filesystem, or the files are on different filesystems
+        Err(e) => trace!("Cannot reflink {source:?} -> {dest:?}: {e}"),
+    }
+    std::io::copy(&mut input, &mut output)
+        .with_context(|| format!("Failed to copy {} -> {}", source.display(), dest.display()))?;
+    Ok(())
+}
+
+#[cfg(test)]
+mod tests {
+    use tempfile::TempDir;
+
+    use super::*;
+
+    #[test]
+    fn test_copy_file() {
+        let tmpdir = TempDir::new().unwrap();
+        let source = tmpdir.path().join("source");
+        let dest = tmpdir.path().join("dest");
+        let content: Vec<u8> = (0..100_000u32).map(|i| (i % 251) as u8).collect();
+        std::fs::write(&source, &content).unwrap();
+        std::fs::write(&dest, "previous content, longer than nothing").unwrap();
+        copy_file(&source, &dest).unwrap();
+        assert_eq!(std::fs::read(&dest).unwrap(), content);
+
+        std::fs::write(&source, "").unwrap();
+        copy_file(&source, &dest).unwrap();
+        assert_eq!(std::fs::read(&dest).unwrap(), b"");
+    }
+
+    #[test]
+    fn test_copy_file_missing() {
+        let tmpdir = TempDir::new().unwrap();
+        assert!(copy_file(tmpdir.path().join("nope"), tmpdir.path().join("dest")).is_err());
+        assert!(!tmpdir.path().join("dest").exists());
+    }
+}
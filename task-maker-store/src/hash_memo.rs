@@ -0,0 +1,204 @@
+//! Memo of the keys of the files on disk, for not hashing again the files that didn't change since
+//! the previous run.
+//!
+//! A file is identified by its device, inode, size, modification and change time: while none of
+//! them changes, the content of the file is assumed to be the same. The memo is global to the
+//! process and disabled by default: after calling `enable` it's used by
+//! `FileStoreKey::from_file_memo`, and `save` writes it back to disk.
+
+use std::collections::{HashMap, HashSet};
+use std::fs::{File, Metadata};
+use std::io::{BufReader, BufWriter, Read, Write};
+use std::os::unix::fs::MetadataExt;
+use std::path::{Path, PathBuf};
+use std::sync::Mutex;
+use std::time::{SystemTime, UNIX_EPOCH};
+
+use anyhow::{Context, Error};
+use const_format::formatcp;
+use serde::{Deserialize, Serialize};
+
+use crate::FileStoreKey;
+
+/// Magic string that is prepended to the memo file to avoid accidental loading of invalid memo
+/// files.
+///
+/// The newline at the end of the string is required. For example, let's say there are 2 versions:
+/// v0.1 and v0.11; running v0.11 first, and then v0.1, without the newline the magic of the old
+/// version is a prefix of the magic of the new version.
+const MAGIC: &[u8] = formatcp!("task-maker-hashes v{}\n", env!("CARGO_PKG_VERSION")).as_bytes();
+/// The files changed less than this many nanoseconds ago are not memoized: they may change again
+/// without a visible change of their modification time.
+const RECENT_CHANGE_NS: i128 = 2_000_000_000;
+/// When the memo has more entries than this, only the ones used in this run are saved.
+const MAX_ENTRIES: usize = 1 << 16;
+
+/// The memo, if enabled.
+static MEMO: Mutex<Option<HashMemo>> = Mutex::new(None);
+
+/// What identifies a version of a file on disk.
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash, Serialize, Deserialize)]
+struct FileIdentity {
+    /// The device of the file.
+    device: u64,
+    /// The inode of the file.
+    inode: u64,
+    /// The size of the file.
+    size: u64,
+    /// The last modification time, in nanoseconds from the epoch.
+    mtime_ns: i128,
+    /// The last change of the inode, in nanoseconds from the epoch.
+    ctime_ns: i128,
+}
+
+/// The state of the memo.
+#[derive(Debug)]
+struct HashMemo {
+    /// Where the memo is stored.
+    path: PathBuf,
+    /// The known keys of the files.
+    keys: HashMap<FileIdentity, FileStoreKey>,
+    /// The files whose key has been asked or added in this run.
+    used: HashSet<FileIdentity>,
+    /// Whether some keys have been added since the memo was loaded.
+    changed: bool,
+}
+
+impl FileIdentity {
+    /// The identity of a file from its metadata.
+    fn new(metadata: &Metadata) -> FileIdentity {
+        FileIdentity {
+            device: metadata.dev(),
+            inode: metadata.ino(),
+            size: metadata.size(),
+            mtime_ns: metadata.mtime() as i128 * 1_000_000_000 + metadata.mtime_nsec() as i128,
+            ctime_ns: metadata.ctime() as i128 * 1_000_000_000 + metadata.ctime_nsec() as i128,
+        }
+    }
+}
+
+/// Start using the memo stored at the provided path, loading it if it exists.
+pub fn enable<P: Into<PathBuf>>(path: P) -> Result<(), Error> {
+    let path = path.into();
+    let keys = load(&path)?;
+    debug!("Loaded {} file hashes from {}", keys.len(), path.display());
+    *MEMO.lock().unwrap() = Some(HashMemo {
+        path,
+        keys,
+        used: HashSet::new(),
+        changed: false,
+    });
+    Ok(())
+}
+
+/// Read the memo from disk. A missing memo, or one of another version, is empty.
+fn load(path: &Path) -> Result<HashMap<FileIdentity, FileStoreKey>, Error> {
+    if !path.exists() {
+        return Ok(HashMap::new());
+    }
+    let file = File::open(path)
+        .with_context(|| format!("Failed to open hash memo at {}", path.display()))?;
+    let mut reader = BufReader::new(file);
+    let mut magic = [0u8; MAGIC.len()];
+    if reader.read_exact(&mut magic).is_err() || magic != MAGIC {
+        info!("Hash memo version mismatch, ignoring it");
+        return Ok(HashMap::new());
+    }
+    bincode::deserialize_from(reader).context("Failed to deserialize hash memo")
+}
+
+/// Write the memo to disk, if it's enabled and it changed.
+pub fn save() -> Result<(), Error> {
+    let mut memo = MEMO.lock().unwrap();
+    let Some(memo) = memo.as_mut() else {
+        return Ok(());
+    };
+    if !memo.changed {
+        return Ok(());
+    }
+    if memo.keys.len() > MAX_ENTRIES {
+        let used = &memo.used;
+        memo.keys.retain(|identity, _| used.contains(identity));
+    }
+    let dir = memo.path.parent().context("Invalid hash memo path")?;
+    std::fs::create_dir_all(dir)
+        .with_context(|| format!("Failed to create directory {}", dir.display()))?;
+    // other processes may be saving their memo at the same time
+    let tmp = tempfile::NamedTempFile::new_in(dir).context("Failed to create hash memo")?;
+    let mut writer = BufWriter::new(tmp.as_file());
+    writer
+        .write_all(MAGIC)
+        .context("Failed to write hash memo magic number")?;
+    bincode::serialize_into(&mut writer, &memo.keys).context("Failed to write hash memo")?;
+    writer.flush().context("Failed to write hash memo")?;
+    drop(writer);
+    tmp.persist(&memo.path)
+        .with_context(|| format!("Failed to move hash memo to {}", memo.path.display()))?;
+    memo.changed = false;
+    Ok(())
+}
+
+/// The memoized key of a file, if the memo is enabled and the file didn't change.
+pub(crate) fn get(metadata: &Metadata) -> Option<FileStoreKey> {
+    let mut memo = MEMO.lock().unwrap();
+    let memo = memo.as_mut()?;
+    let identity = FileIdentity::new(metadata);
+    let key = memo.keys.get(&identity)?.clone();
+    memo.used.insert(identity);
+    Some(key)
+}
+
+/// Remember the key of a file, if the memo is enabled.
+pub(crate) fn insert(metadata: &Metadata, key: &FileStoreKey) {
+    let mut memo = MEMO.lock().unwrap();
+    let Some(memo) = memo.as_mut() else {
+        return;
+    };
+    let identity = FileIdentity::new(metadata);
+    let now = SystemTime::now()
+        .duration_since(UNIX_EPOCH)
+        .map_or(0, |now| now.as_nanos() as i128);
+    if now - identity.ctime_ns.max(identity.mtime_ns) < RECENT_CHANGE_NS {
+        return;
+    }
+    memo.keys.insert(identity, key.clone());
+    memo.used.insert(identity);
+    memo.changed = true;
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_hash_memo() {
+        let tmpdir = tempfile::TempDir::new().unwrap();
+        let path = tmpdir.path().join("file");
+        let memo_path = tmpdir.path().join("hashes.bin");
+        std::fs::write(&path, "hello").unwrap();
+        let metadata = std::fs::metadata(&path).unwrap();
+        let key = FileStoreKey::from_content(b"hello");
+
+        // the memo is global, so the whole test is in a single function
+        enable(&memo_path).unwrap();
+        assert!(get(&metadata).is_none());
+        // the file has just been written, it's not memoized
+        insert(&metadata, &key);
+        assert!(get(&metadata).is_none());
+
+        // pretend that the file was written a while ago
+        {
+            let mut memo = MEMO.lock().unwrap();
+            let memo = memo.as_mut().unwrap();
+            memo.keys.insert(FileIdentity::new(&metadata), key.clone());
+            memo.changed = true;
+        }
+        assert_eq!(get(&metadata), Some(key.clone()));
+        save().unwrap();
+
+        enable(&memo_path).unwrap();
+        assert_eq!(get(&metadata), Some(key));
+        std::fs::write(&path, "hello!").unwrap();
+        assert!(get(&std::fs::metadata(&path).unwrap()).is_none());
+    }
+}
@@ -3,14 +3,14 @@ use std::collections::hash_map::Entry;
 use std::collections::{BinaryHeap, HashMap};
 use std::fs::{create_dir_all, remove_dir, File};
 use std::io::{BufReader, BufWriter, Read, Write};
-use std::path::Path;
+use std::path::{Path, PathBuf};
 use std::time::SystemTime;
 
 use anyhow::{Context, Error};
 use const_format::formatcp;
 use serde::{Deserialize, Serialize};
 
-use crate::{FileStore, FileStoreKey, LockedFiles};
+use crate::{FileStore, FileStoreKey};
 
 /// Magic string that is prepended to the index file to avoid accidental loading of invalid index
 /// files.
@@ -20,6 +20,10 @@ use crate::{FileStore, FileStoreKey, LockedFiles};
 /// version is a prefix of the magic of the new version.
 const MAGIC: &[u8] = formatcp!("task-maker-store v{}\n", env!("CARGO_PKG_VERSION")).as_bytes();
 
+/// The journal is compacted into the index file when it has at least this many entries, and at
+/// least as many as the files in the index.
+const MIN_COMPACTION_ENTRIES: usize = 1024;
+
 /// An entry of a file inside the file store.
 #[derive(Clone, Debug, Serialize, Deserialize, Eq, PartialEq)]
 struct FileStoreIndexItem {
@@ -29,9 +33,11 @@ struct FileStoreIndexItem {
     last_access: SystemTime,
 }
 
+/// The least recently used items are the greatest, so that they are popped first from a
+/// `BinaryHeap`.
 impl Ord for FileStoreIndexItem {
     fn cmp(&self, other: &Self) -> Ordering {
-        self.last_access.cmp(&other.last_access)
+        other.last_access.cmp(&self.last_access)
     }
 }
 impl PartialOrd for FileStoreIndexItem {
@@ -41,24 +47,67 @@ impl PartialOrd for FileStoreIndexItem {
 }
 
 /// Index with all the files known, allowing efficient LRU file flushing.
+///
+/// The index is stored in two files: a full dump of the index, and a journal next to it where the
+/// new files are appended as soon as they are added. This way adding a file doesn't rewrite the
+/// whole index: the journal is compacted into the dump only once in a while, when the index is
+/// flushed and when the store is closed.
 #[derive(Debug, Serialize, Deserialize)]
 pub(crate) struct FileStoreIndex {
     /// The sum of the size of all the files in the index.
     total_size: u64,
     /// The list of all the files known in the index.
     known_files: HashMap<FileStoreKey, FileStoreIndexItem>,
+    /// The journal file, open for appending the new files.
+    #[serde(skip)]
+    journal: Option<File>,
+    /// The number of entries in the journal since the last compaction.
+    #[serde(skip)]
+    journal_entries: usize,
+    /// Whether some files have been removed or resized since the last compaction. These changes
+    /// are not written to the journal, so the index has to be compacted.
+    #[serde(skip)]
+    files_changed: bool,
 }
 
 impl FileStoreIndex {
-    /// Load the index from the provided path.
+    /// An empty index.
+    fn empty() -> FileStoreIndex {
+        FileStoreIndex {
+            total_size: 0,
+            known_files: HashMap::new(),
+            journal: None,
+            journal_entries: 0,
+            files_changed: false,
+        }
+    }
+
+    /// The path of the journal of the index stored at `path`.
+    fn journal_path(path: &Path) -> PathBuf {
+        path.with_extension("journal")
+    }
+
+    /// Load the index from the provided path, applying the entries of its journal.
     pub(crate) fn load<P: AsRef<Path>>(path: P) -> Result<FileStoreIndex, Error> {
         let path = path.as_ref();
+        let mut index = FileStoreIndex::load_dump(path)?;
+        let journal_path = FileStoreIndex::journal_path(path);
+        let replayed = index.replay_journal(&journal_path)?;
+        if replayed > 0 {
+            // the journal may end with a partial entry, start from a clean one
+            debug!("Applied {replayed} entries of the index journal");
+            index.store(path)?;
+        } else {
+            index.open_journal(&journal_path)?;
+        }
+        Ok(index)
+    }
+
+    /// Load the full dump of the index.
+    fn load_dump(path: &Path) -> Result<FileStoreIndex, Error> {
         if !path.exists() {
             debug!("Index at {path:?} not found, creating new one");
-            return Ok(FileStoreIndex {
-                total_size: 0,
-                known_files: HashMap::new(),
-            });
+            return Ok(FileStoreIndex::empty());
         }
 
         debug!("Loading index from {path:?}");
@@ -69,17 +118,69 @@ impl FileStoreIndex {
 
         if reader.read_exact(&mut magic).is_ok_and(|_| magic != MAGIC) {
             info!("FileStore version mismatch:\nExpected: {MAGIC:?}\nFound: {magic:?}");
-            return Ok(FileStoreIndex {
-                total_size: 0,
-                known_files: HashMap::new(),
-            });
+            return Ok(FileStoreIndex::empty());
         }
 
         bincode::deserialize_from(reader).context("Failed to deserialize index file")
     }
 
-    /// Store a dump of this index to the path provided.
-    pub(crate) fn store<P: AsRef<Path>>(&self, path: P) -> Result<(), Error> {
+    /// Add to the index the files written in the journal, returning how many entries have been
+    /// applied. Applying an entry already in the index is harmless.
+    fn replay_journal(&mut self, journal_path: &Path) -> Result<usize, Error> {
+        let file = match File::open(journal_path) {
+            Ok(file) => file,
+            Err(_) => return Ok(0),
+        };
+        let mut reader = BufReader::new(file);
+        let mut magic = [0u8; MAGIC.len()];
+        if reader.read_exact(&mut magic).is_err() || magic != MAGIC {
+            return Ok(0);
+        }
+        let mut replayed = 0;
+        // stop at the first invalid entry: it's the one that was being written when task-maker
+        // stopped
+        while let Ok((key, item)) =
+            bincode::deserialize_from::<_, (FileStoreKey, FileStoreIndexItem)>(&mut reader)
+        {
+            let size = item.size;
+            if self.known_files.insert(key, item).is_none() {
+                self.total_size += size;
+            }
+            replayed += 1;
+        }
+        Ok(replayed)
+    }
+
+    /// Start a new empty journal, for appending the files added from now on.
+    fn open_journal(&mut self, journal_path: &Path) -> Result<(), Error> {
+        let mut journal = File::create(journal_path).with_context(|| {
+            format!(
+                "Failed to create index journal at {}",
+                journal_path.display()
+            )
+        })?;
+        journal
+            .write_all(MAGIC)
+            .context("Failed to write journal magic number")?;
+        self.journal = Some(journal);
+        self.journal_entries = 0;
+        Ok(())
+    }
+
+    /// Write the changes to the index to disk: the new files are already in the journal, so the
+    /// full index is stored only if the journal is becoming too long or some files have been
+    /// removed or resized.
+    pub(crate) fn sync<P: AsRef<Path>>(&mut self, path: P) -> Result<(), Error> {
+        let long_journal =
+            self.journal_entries >= MIN_COMPACTION_ENTRIES.max(self.known_files.len());
+        if self.files_changed || long_journal {
+            self.store(path)?;
+        }
+        Ok(())
+    }
+
+    /// Store a dump of this index to the path provided, emptying the journal.
+    pub(crate) fn store<P: AsRef<Path>>(&mut self, path: P) -> Result<(), Error> {
         let path = path.as_ref();
         debug!("Saving index file at {}", path.display());
 
@@ -95,16 +196,33 @@ impl FileStoreIndex {
             .write_all(MAGIC)
             .context("Failed to write cache magic number")?;
 
-        bincode::serialize_into(writer, &self).context("Failed to write index")?;
+        bincode::serialize_into(&mut writer, &self).context("Failed to write index")?;
+        writer.flush().context("Failed to write index")?;
+        drop(writer);
         std::fs::rename(&tmp, path)
             .with_context(|| format!("Failed to move {} -> {}", tmp.display(), path.display()))?;
+        // all the entries of the journal are now in the index
+        self.open_journal(&FileStoreIndex::journal_path(path))?;
+        self.files_changed = false;
         Ok(())
     }
 
-    /// Mark a file as accessed, bumping its position in the LRU.
-    pub(crate) fn touch(&mut self, key: &FileStoreKey) {
+    /// Mark a file as accessed at `time`, bumping its position in the LRU. The accesses are applied
+    /// in batch, so an older access doesn't override a newer one.
+    pub(crate) fn touch(&mut self, key: &FileStoreKey, time: SystemTime) {
         if let Some(file) = self.known_files.get_mut(key) {
+            file.last_access = file.last_access.max(time);
+        }
+    }
+
+    /// Update the size of a file, after it has been compressed or decompressed, marking it as
+    /// accessed.
+    pub(crate) fn resize(&mut self, key: &FileStoreKey, size: u64) {
+        if let Some(file) = self.known_files.get_mut(key) {
+            self.total_size = self.total_size - file.size + size;
+            file.size = size;
             file.last_access = SystemTime::now();
+            self.files_changed = true;
         }
     }
 
@@ -118,10 +236,20 @@ impl FileStoreIndex {
             Entry::Vacant(entry) => {
                 let metadata = std::fs::metadata(path)
                     .with_context(|| format!("Cannot get file metadata of {}", path.display()))?;
-                entry.insert(FileStoreIndexItem {
+                let item = FileStoreIndexItem {
                     size: metadata.len(),
                     last_access: SystemTime::now(),
-                });
+                };
+                if let Some(journal) = &mut self.journal {
+                    // a single write, so that a crash leaves at most a partial last entry
+                    let data = bincode::serialize(&(entry.key(), &item))
+                        .context("Failed to serialize journal entry")?;
+                    journal
+                        .write_all(&data)
+                        .context("Failed to write index journal")?;
+                    self.journal_entries += 1;
+                }
+                entry.insert(item);
                 self.total_size += metadata.len();
             }
         }
@@ -134,13 +262,12 @@ impl FileStoreIndex {
     }
 
     /// Perform a flushing operation, cleaning some space on the disk by removing the Least Recently
-    /// Used files. This function won't remove the files currently locked.
-    pub(crate) fn flush(
-        &mut self,
-        file_store: &FileStore,
-        locked_files: &LockedFiles,
-        target_size: u64,
-    ) -> Result<(), Error> {
+    /// Used files. This function won't remove the files currently locked: the shard of the locks
+    /// of each file is held while the file is removed, so no handle to it can be made meanwhile.
+    ///
+    /// If the store compresses the cold files, the files are compressed instead of being removed,
+    /// and the ones already compressed are removed.
+    pub(crate) fn flush(&mut self, file_store: &FileStore, target_size: u64) -> Result<(), Error> {
         debug!(
             "Starting flushing process from {}MiB to at most {}MiB",
             self.total_size / 1024 / 1024,
@@ -154,43 +281,65 @@ impl FileStoreIndex {
         let mut removed = 0;
         // continue to remove until the space requirement is met
         while self.total_size > target_size {
-            let (entry, key) = match priority_queue.pop() {
+            let (mut entry, key) = match priority_queue.pop() {
                 Some(e) => e,
                 // the queue is emptied before reaching the space requirement (maybe because of
                 // locking)
                 None => break,
             };
             // cannot remove a file used by some other process
-            if locked_files.ref_counts.contains_key(&key) {
+            let shard = file_store.locked_files.shard(&key).lock().unwrap();
+            if shard.ref_counts.contains_key(&key) {
                 surviving.push((key, entry));
-            } else {
-                self.total_size -= entry.size;
-                removed += entry.size;
+                continue;
+            }
+            let path = file_store.key_to_path(&key);
+            if file_store.compress_cold_files && path.exists() {
+                match file_store.compress(&key) {
+                    Ok(Some(size)) => {
+                        self.total_size -= entry.size - size;
+                        removed += entry.size - size;
+                        self.files_changed = true;
+                        entry.size = size;
+                        surviving.push((key, entry));
+                        continue;
+                    }
+                    // not worth keeping it compressed, remove it
+                    Ok(None) => {}
+                    Err(e) => warn!("Cannot compress file {path:?}: {e:?}"),
+                }
+            }
+            self.total_size -= entry.size;
+            removed += entry.size;
+            self.files_changed = true;
 
-                let path = file_store.key_to_path(&key);
-                debug!("Removing file {:?} claiming {}KiB", path, entry.size / 1024);
-                if let Err(e) = FileStore::remove_file(&path) {
-                    warn!("Cannot flush file {path:?}: {e}");
+            let path = if path.exists() {
+                path
+            } else {
+                file_store.key_to_compressed_path(&key)
+            };
+            debug!("Removing file {:?} claiming {}KiB", path, entry.size / 1024);
+            if let Err(e) = FileStore::remove_file(&path) {
+                warn!("Cannot flush file {path:?}: {e}");
+            }
+            let base_path = file_store.base_path.canonicalize().with_context(|| {
+                format!(
+                    "Invalid file store base path: {}",
+                    file_store.base_path.display()
+                )
+            })?;
+            let mut path = path.parent();
+            // remove empty directories until the root of the store is reached
+            while let Some(p) = path {
+                if p == base_path {
+                    break;
                 }
-                let base_path = file_store.base_path.canonicalize().with_context(|| {
-                    format!(
-                        "Invalid file store base path: {}",
-                        file_store.base_path.display()
-                    )
-                })?;
-                let mut path = path.parent();
-                // remove empty directories until the root of the store is reached
-                while let Some(p) = path {
-                    if p == base_path {
-                        break;
-                    }
-                    debug!("Removing {p:?}");
-                    if remove_dir(p).is_err() {
-                        debug!("... it wasn't empty");
-                        break;
-                    }
-                    path = p.parent();
+                debug!("Removing {p:?}");
+                if remove_dir(p).is_err() {
+                    debug!("... it wasn't empty");
+                    break;
                 }
+                path = p.parent();
             }
         }
         debug!("Claimed {}KiB", removed / 1024);
@@ -208,7 +357,7 @@ impl FileStoreIndex {
 
 #[cfg(test)]
 mod tests {
-    use std::fs::File;
+    use std::fs::{File, OpenOptions};
     use std::io::Write;
     use std::path::Path;
     use std::time::Duration;
@@ -216,6 +365,7 @@ mod tests {
     use pretty_assertions::{assert_eq, assert_ne};
     use tempfile::TempDir;
 
+    use super::{FileStoreIndex, MAGIC};
     use crate::{FileStore, FileStoreHandle, FileStoreKey, ReadFileIterator};
 
     fn get_cwd() -> TempDir {
@@ -266,6 +416,38 @@ mod tests {
         assert_eq!(index.known_files.len(), 1);
     }
 
+    #[test]
+    fn test_load_journal() {
+        let cwd = get_cwd();
+        let path = cwd.path().join("index.bin");
+        let journal_path = path.with_extension("journal");
+        let file = cwd.path().join("file");
+        let key = fake_file(&file, 1, 42);
+        {
+            let mut index = FileStoreIndex::load(&path).unwrap();
+            index.add(key.clone(), &file).unwrap();
+            index.sync(&path).unwrap();
+            // the new file is only in the journal
+            assert!(!path.exists());
+        }
+        // a partial entry, like the one left by a crash while writing
+        OpenOptions::new()
+            .append(true)
+            .open(&journal_path)
+            .unwrap()
+            .write_all(&[1, 2, 3])
+            .unwrap();
+        let index = FileStoreIndex::load(&path).unwrap();
+        assert_eq!(index.total_size, 42);
+        assert!(index.known_files.contains_key(&key));
+        // the journal has been compacted into the index
+        assert!(path.exists());
+        assert_eq!(
+            std::fs::metadata(&journal_path).unwrap().len(),
+            MAGIC.len() as u64
+        );
+    }
+
     #[test]
     fn test_no_flush() {
         let cwd = get_cwd();
@@ -322,8 +504,7 @@ mod tests {
 
         // force flush because the last store did a flush removing the 90
         let mut index = store.index.lock().unwrap();
-        let locked = store.locked_files.lock().unwrap();
-        index.flush(&store, &locked, 100).unwrap();
+        index.flush(&store, 100).unwrap();
 
         assert_eq!(index.total_size, 90);
         assert_eq!(index.known_files.len(), 1);
@@ -332,6 +513,41 @@ mod tests {
         assert!(!store.key_to_path(&key3).exists());
     }
 
+    #[test]
+    fn test_flush_compress() {
+        let cwd = get_cwd();
+        let mut store = FileStore::new(cwd.path(), 200, 100).unwrap();
+        store.set_compress_cold_files(true);
+        let key1 = add_file_to_store(&store, 150).key.clone();
+        // the store is full: the first file gets compressed instead of removed
+        let handle2 = add_file_to_store(&store, 160);
+        let key2 = handle2.key.clone();
+        {
+            let index = store.index.lock().unwrap();
+            assert!(index.total_size < 200);
+            assert_eq!(index.known_files.len(), 2);
+        }
+        assert!(!store.key_to_path(&key1).exists());
+        assert!(store.key_to_compressed_path(&key1).exists());
+        assert!(store.key_to_path(&key2).exists());
+
+        let handle1 = store.get(&key1).unwrap();
+        assert_eq!(std::fs::read(handle1.path()).unwrap(), vec![123; 150]);
+        assert!(!store.key_to_compressed_path(&key1).exists());
+        assert_eq!(store.index.lock().unwrap().total_size, 310);
+        drop(handle1);
+        drop(handle2);
+
+        // the files already compressed are removed
+        let mut index = store.index.lock().unwrap();
+        index.flush(&store, 0).unwrap();
+        assert!(index.total_size > 0);
+        index.flush(&store, 0).unwrap();
+        assert_eq!(index.total_size, 0);
+        assert!(!store.key_to_compressed_path(&key1).exists());
+        assert!(!store.key_to_compressed_path(&key2).exists());
+    }
+
     #[test]
     fn test_flush_touch() {
         let cwd = get_cwd();
@@ -342,8 +558,23 @@ mod tests {
         std::thread::sleep(Duration::from_millis(100));
         let after1 = index.known_files[&handle.key].last_access;
         assert_eq!(before, after1);
-        index.touch(&handle.key);
+        index.touch(&handle.key, SystemTime::now());
         let after2 = index.known_files[&handle.key].last_access;
         assert_ne!(before, after2);
     }
+
+    #[test]
+    fn test_get_touch_batched() {
+        let cwd = get_cwd();
+        let store = FileStore::new(cwd.path(), 200, 100).unwrap();
+        let key = add_file_to_store(&store, 10).key.clone();
+        let before = store.index.lock().unwrap().known_files[&key].last_access;
+        std::thread::sleep(Duration::from_millis(100));
+        store.get(&key).unwrap();
+        // the access is applied to the index only before flushing or storing it
+        let mut index = store.index.lock().unwrap();
+        assert_eq!(index.known_files[&key].last_access, before);
+        store.locked_files.apply_touches(&mut index);
+        assert_ne!(index.known_files[&key].last_access, before);
+    }
 }
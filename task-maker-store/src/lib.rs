@@ -6,6 +6,10 @@
 //!
 //! The access to the store directory via this crate is exclusive even between processes.
 //!
+//! Optionally the least-recently-used files are compressed instead of being removed, and they are
+//! decompressed when they are needed again. Only when they get old also in the compressed form
+//! they are removed.
+//!
 //! # Example
 //!
 //! Storing a file into the store and getting it back later.
@@ -47,15 +51,19 @@ use std::io::Write;
 use std::os::unix::prelude::PermissionsExt;
 use std::path::{Path, PathBuf};
 use std::sync::{Arc, Mutex};
+use std::time::SystemTime;
 
 use anyhow::{bail, Context, Error};
 use blake3::{hash, Hash, Hasher};
+pub use fast_copy::copy_file;
 use fslock::LockFile;
 pub use read_file_iterator::ReadFileIterator;
 use serde::{Deserialize, Deserializer, Serialize, Serializer};
 
 use crate::index::FileStoreIndex;
 
+mod fast_copy;
+pub mod hash_memo;
 mod index;
 mod read_file_iterator;
 
@@ -65,12 +73,37 @@ const INTEGRITY_CHECKS_ENABLED: bool = false;
 const STORE_LOCK_FILE: &str = "exclusive.lock";
 /// The name of the index of the file store.
 const STORE_INDEX_FILE: &str = "index.bin";
+/// The size from which the files are hashed memory-mapping them and using all the cores.
+const PARALLEL_HASH_MIN_SIZE: u64 = 1 << 20;
+/// The extension of the compressed files in the store.
+const COMPRESSED_EXTENSION: &str = "zst";
+/// The zstd level used for compressing the cold files.
+const COMPRESSION_LEVEL: i32 = 3;
+
+/// The number of shards of `LockedFiles`, each with its own lock.
+const LOCKED_FILES_SHARDS: usize = 64;
+
+/// The handles and the accesses of the files whose key falls in a shard of `LockedFiles`.
+#[derive(Debug, Default)]
+struct LockedFilesShard {
+    /// Map from a `FileStoreKey` to the number of handles alive.
+    ref_counts: HashMap<FileStoreKey, usize>,
+    /// The files got from the store since the index was last updated, with the time of their last
+    /// access.
+    touched: HashMap<FileStoreKey, SystemTime>,
+}
 
 /// Container with the ref counts of all the handles still alive.
+///
+/// The handles are created and dropped concurrently by all the workers, so the ref counts are split
+/// in shards by key, and the handles of different files rarely wait for each other. For the same
+/// reason the accesses to the files are not written to the index immediately, which would wait for
+/// the flushes and the syncs of the index: they are collected in the shards and applied to the
+/// index in batch before it's flushed or stored.
 #[derive(Debug)]
 struct LockedFiles {
-    /// Map from a `FileStoreKey` to the number of handles alive.
-    ref_counts: HashMap<FileStoreKey, usize>,
+    /// The shards, selected by the first byte of the key.
+    shards: Vec<Mutex<LockedFilesShard>>,
 }
 
 /// A file store will manage all the files in the store directory.
@@ -87,13 +120,15 @@ pub struct FileStore {
     /// Lock to the `FileStore` directory.
     _lock: LockFile,
     /// The files locked because there are some handles still alive.
-    locked_files: Arc<Mutex<LockedFiles>>,
+    locked_files: Arc<LockedFiles>,
     /// The index with the files known to the store. This is used when flushing the old files.
     index: Arc<Mutex<FileStoreIndex>>,
     /// Maximum size of the file store.
     max_store_size: u64,
     /// Target size of the file store after the flush.
     min_store_size: u64,
+    /// Whether the least recently used files are compressed before being removed.
+    compress_cold_files: bool,
 }
 
 /// Handle of a file in the `FileStore`, this must be computable given the content of the file, i.e.
@@ -113,8 +148,10 @@ pub struct FileStoreHandle {
     key: FileStoreKey,
     /// The path to the file on disk.
     path: PathBuf,
+    /// The size of the file, in bytes, read when the handle has been made.
+    size: u64,
     /// A reference to the locked files. Will be used to remove self from the ref counts.
-    locked_files: Arc<Mutex<LockedFiles>>,
+    locked_files: Arc<LockedFiles>,
 }
 
 impl FileStore {
@@ -169,13 +206,25 @@ impl FileStore {
         Ok(FileStore {
             base_path,
             _lock: lock,
-            locked_files: Arc::new(Mutex::new(LockedFiles::new())),
+            locked_files: Arc::new(LockedFiles::new()),
             index: Arc::new(Mutex::new(index)),
             max_store_size,
             min_store_size,
+            compress_cold_files: false,
         })
     }
 
+    /// The directory of the store.
+    pub fn base_path(&self) -> &Path {
+        &self.base_path
+    }
+
+    /// Compress the least recently used files when the store is full, removing only the files
+    /// already compressed. The compressed files are decompressed transparently when accessed.
+    pub fn set_compress_cold_files(&mut self, compress: bool) {
+        self.compress_cold_files = compress;
+    }
+
     /// Given an iterator of `Vec<u8>` consume all of it writing the content to the disk if the file
     /// is not already present on disk. The file is stored inside the base directory and `chmod -w`.
     ///
@@ -212,49 +261,99 @@ impl FileStore {
     where
         I: IntoIterator<Item = Vec<u8>>,
     {
-        let path = self.key_to_path(key);
-        trace!("Storing {path:?}");
-        // make the key to avoid racing while writing
-        let handle = FileStoreHandle::new(self, key);
-        if path.exists() {
-            trace!("File {path:?} already exists");
-            content.into_iter().last(); // consume all the iterator
-        } else {
-            // assuming moving files is atomic this should be MT-safe
-            let dir = path.parent().unwrap();
-            std::fs::create_dir_all(dir)
-                .with_context(|| format!("Cannot create directory at {}", dir.display()))?;
-            let tmpdir = tempfile::TempDir::new_in(path.parent().unwrap())
-                .context("Failed to create temporary directory for storing the file")?;
-            let tmpfile_path = tmpdir.path().join("file");
+        let mut content = Some(content);
+        let handle = self.store_with(key, |tmpfile_path| {
             let mut tmpfile =
-                std::fs::File::create(&tmpfile_path).context("Failed to create temporary file")?;
+                std::fs::File::create(tmpfile_path).context("Failed to create temporary file")?;
             if !content
+                .take()
+                .unwrap()
                 .into_iter()
                 .map(|data| tmpfile.write_all(&data))
                 .all(|r| r.is_ok())
             {
                 bail!("Failed to store file");
             }
-            std::fs::rename(&tmpfile_path, &path).with_context(|| {
-                format!(
-                    "Failed to rename {} -> {}",
-                    tmpfile_path.display(),
-                    path.display()
-                )
-            })?;
-            FileStore::mark_readonly(&path).context("Failed to mark file as readonly")?;
-            {
-                let mut index = self.index.lock().unwrap();
-                index
-                    .add(key.clone(), path)
-                    .context("Failed to add file to index")?;
-                self.maybe_flush(&mut index)?;
-                // FIXME: maybe this can be done less frequently
-                index
-                    .store(self.base_path.join(STORE_INDEX_FILE))
-                    .context("Failed to store the index to file")?;
-            }
+            Ok(())
+        })?;
+        if let Some(content) = content {
+            content.into_iter().last(); // consume all the iterator
+        }
+        Ok(handle)
+    }
+
+    /// Store a file that is already on the local disk, if it is not already present. The content
+    /// is shared with the original file when the filesystem supports reflinks, otherwise it is
+    /// copied without passing through the memory of this process.
+    ///
+    /// ```
+    /// use task_maker_store::{FileStore, FileStoreKey};
+    ///
+    /// # use anyhow::Error;
+    /// # use std::fs;
+    /// # use tempfile::TempDir;
+    /// # fn main() -> Result<(), Error> {
+    /// # let tmp = TempDir::new().unwrap();
+    /// # let store_dir = tmp.path().join("store");
+    /// # let path = tmp.path().join("file.txt");
+    /// # fs::write(&path, "hello world")?;
+    /// let store = FileStore::new(store_dir, 1000, 1000)?;
+    /// let key = FileStoreKey::from_file(&path)?;
+    /// let handle = store.store_file(&key, &path)?;
+    /// assert_eq!(fs::read(handle.path())?, b"hello world");
+    /// # Ok(())
+    /// # }
+    /// ```
+    pub fn store_file<P: AsRef<Path>>(
+        &self,
+        key: &FileStoreKey,
+        source: P,
+    ) -> Result<FileStoreHandle, Error> {
+        let source = source.as_ref();
+        self.store_with(key, |tmpfile_path| copy_file(source, tmpfile_path))
+    }
+
+    /// Store the file with the provided key, if not already present, calling `write` for writing
+    /// its content in a temporary file that is then moved inside the store.
+    fn store_with<F>(&self, key: &FileStoreKey, write: F) -> Result<FileStoreHandle, Error>
+    where
+        F: FnOnce(&Path) -> Result<(), Error>,
+    {
+        let path = self.key_to_path(key);
+        trace!("Storing {path:?}");
+        // make the key to avoid racing while writing
+        let mut handle = FileStoreHandle::new(self, key);
+        if path.exists() || self.decompress(key)? {
+            trace!("File {path:?} already exists");
+            handle.read_size();
+            return Ok(handle);
+        }
+        // assuming moving files is atomic this should be MT-safe
+        let dir = path.parent().unwrap();
+        std::fs::create_dir_all(dir)
+            .with_context(|| format!("Cannot create directory at {}", dir.display()))?;
+        let tmpdir = tempfile::TempDir::new_in(path.parent().unwrap())
+            .context("Failed to create temporary directory for storing the file")?;
+        let tmpfile_path = tmpdir.path().join("file");
+        write(&tmpfile_path)?;
+        std::fs::rename(&tmpfile_path, &path).with_context(|| {
+            format!(
+                "Failed to rename {} -> {}",
+                tmpfile_path.display(),
+                path.display()
+            )
+        })?;
+        FileStore::mark_readonly(&path).context("Failed to mark file as readonly")?;
+        handle.read_size();
+        {
+            let mut index = self.index.lock().unwrap();
+            index
+                .add(key.clone(), path)
+                .context("Failed to add file to index")?;
+            self.maybe_flush(&mut index)?;
+            index
+                .sync(self.base_path.join(STORE_INDEX_FILE))
+                .context("Failed to store the index to file")?;
         }
         Ok(handle)
     }
@@ -293,7 +392,14 @@ impl FileStore {
     pub fn get(&self, key: &FileStoreKey) -> Option<FileStoreHandle> {
         let path = self.key_to_path(key);
         if !path.exists() {
-            return None;
+            match self.decompress(key) {
+                Ok(true) => {}
+                Ok(false) => return None,
+                Err(e) => {
+                    warn!("Cannot decompress {path:?}: {e:?}");
+                    return None;
+                }
+            }
         }
         if INTEGRITY_CHECKS_ENABLED && !self.check_integrity(key) {
             warn!("File {path:?} failed the integrity check");
@@ -302,11 +408,10 @@ impl FileStore {
             }
             return None;
         }
-        {
-            let mut index = self.index.lock().unwrap();
-            index.touch(key);
-        }
-        Some(FileStoreHandle::new(self, key))
+        let mut handle = FileStoreHandle::new(self, key);
+        handle.read_size();
+        self.locked_files.touch(key);
+        Some(handle)
     }
 
     /// Path of the file to disk.
@@ -314,6 +419,89 @@ impl FileStore {
         self.base_path.join(key.suffix())
     }
 
+    /// Path of the compressed file to disk.
+    fn key_to_compressed_path(&self, key: &FileStoreKey) -> PathBuf {
+        self.key_to_path(key).with_extension(COMPRESSED_EXTENSION)
+    }
+
+    /// Replace a file of the store with its compressed version, returning its new size. If the
+    /// file doesn't become smaller it's left uncompressed and `None` is returned.
+    ///
+    /// The file must not be in use, since its uncompressed version is removed.
+    fn compress(&self, key: &FileStoreKey) -> Result<Option<u64>, Error> {
+        let path = self.key_to_path(key);
+        let compressed_path = self.key_to_compressed_path(key);
+        let tmpdir = tempfile::TempDir::new_in(path.parent().unwrap())
+            .context("Failed to create temporary directory for compressing the file")?;
+        let tmpfile_path = tmpdir.path().join("file");
+        {
+            let source = std::fs::File::open(&path)
+                .with_context(|| format!("Failed to open {}", path.display()))?;
+            let dest =
+                std::fs::File::create(&tmpfile_path).context("Failed to create temporary file")?;
+            zstd::stream::copy_encode(source, dest, COMPRESSION_LEVEL)
+                .with_context(|| format!("Failed to compress {}", path.display()))?;
+        }
+        let size = std::fs::metadata(&path)
+            .with_context(|| format!("Failed to get file metadata of {}", path.display()))?
+            .len();
+        let compressed_size = std::fs::metadata(&tmpfile_path)
+            .context("Failed to get metadata of the compressed file")?
+            .len();
+        if compressed_size >= size {
+            return Ok(None);
+        }
+        std::fs::rename(&tmpfile_path, &compressed_path).with_context(|| {
+            format!(
+                "Failed to rename {} -> {}",
+                tmpfile_path.display(),
+                compressed_path.display()
+            )
+        })?;
+        FileStore::mark_readonly(&compressed_path).context("Failed to mark file as readonly")?;
+        FileStore::remove_file(&path)?;
+        trace!("Compressed {path:?} from {size} to {compressed_size} bytes");
+        Ok(Some(compressed_size))
+    }
+
+    /// Decompress a file of the store, if its compressed version is present, returning whether it
+    /// has been decompressed. The compressed version is then removed.
+    fn decompress(&self, key: &FileStoreKey) -> Result<bool, Error> {
+        let path = self.key_to_path(key);
+        let compressed_path = self.key_to_compressed_path(key);
+        let source = match std::fs::File::open(&compressed_path) {
+            Ok(source) => source,
+            Err(_) => return Ok(false),
+        };
+        let tmpdir = tempfile::TempDir::new_in(path.parent().unwrap())
+            .context("Failed to create temporary directory for decompressing the file")?;
+        let tmpfile_path = tmpdir.path().join("file");
+        let dest =
+            std::fs::File::create(&tmpfile_path).context("Failed to create temporary file")?;
+        zstd::stream::copy_decode(source, dest)
+            .with_context(|| format!("Failed to decompress {}", compressed_path.display()))?;
+        std::fs::rename(&tmpfile_path, &path).with_context(|| {
+            format!(
+                "Failed to rename {} -> {}",
+                tmpfile_path.display(),
+                path.display()
+            )
+        })?;
+        FileStore::mark_readonly(&path).context("Failed to mark file as readonly")?;
+        // another thread may have decompressed it at the same time
+        if compressed_path.exists() {
+            if let Err(e) = FileStore::remove_file(&compressed_path) {
+                debug!("Cannot remove {compressed_path:?}: {e:?}");
+            }
+        }
+        let size = std::fs::metadata(&path)
+            .with_context(|| format!("Failed to get file metadata of {}", path.display()))?
+            .len();
+        trace!("Decompressed {path:?}");
+        self.index.lock().unwrap().resize(key, size);
+        Ok(true)
+    }
+
     /// Mark a file as readonly.
     fn mark_readonly(path: &Path) -> Result<(), Error> {
         let mut perms = std::fs::metadata(path)
@@ -362,9 +550,9 @@ impl FileStore {
     /// Check if the file store needs flushing, and do so if needed.
     fn maybe_flush(&self, index: &mut FileStoreIndex) -> Result<(), Error> {
         if index.need_flush(self.max_store_size) {
-            let locked = self.locked_files.lock().unwrap();
+            self.locked_files.apply_touches(index);
             index
-                .flush(self, &locked, self.min_store_size)
+                .flush(self, self.min_store_size)
                 .context("Failed to flush index")?;
         }
         Ok(())
@@ -375,15 +563,9 @@ impl Drop for FileStore {
     fn drop(&mut self) {
         match self.index.lock() {
             Ok(mut index) => {
-                let locked = match self.locked_files.lock() {
-                    Ok(l) => l,
-                    Err(_) => {
-                        warn!("Cannot lock locked_files due to poison");
-                        return;
-                    }
-                };
+                self.locked_files.apply_touches(&mut index);
                 if index.need_flush(self.max_store_size) {
-                    if let Err(e) = index.flush(self, &locked, self.min_store_size) {
+                    if let Err(e) = index.flush(self, self.min_store_size) {
                         warn!("Cannot flush the index: {e}");
                     }
                 }
@@ -418,6 +600,17 @@ impl FileStoreKey {
         if !path.exists() {
             bail!("Cannot read {}, maybe broken symlink?", path.display())
         }
+        let size = std::fs::metadata(path)
+            .with_context(|| format!("Failed to get file metadata of {}", path.display()))?
+            .len();
+        if size >= PARALLEL_HASH_MIN_SIZE {
+            hasher
+                .update_mmap_rayon(path)
+                .with_context(|| format!("Cannot hash {}", path.display()))?;
+            return Ok(FileStoreKey {
+                hash: hasher.finalize(),
+            });
+        }
         let file_reader = ReadFileIterator::new(path)
             .with_context(|| format!("Cannot make file iterator of {}", path.display()))?;
         file_reader
@@ -430,6 +623,22 @@ impl FileStoreKey {
         })
     }
 
+    /// Make a new `FileStoreKey` from a file on disk, using the key in the `hash_memo` if the file
+    /// didn't change since it was last hashed.
+    pub fn from_file_memo<P: AsRef<Path>>(path: P) -> Result<FileStoreKey, Error> {
+        let path = path.as_ref();
+        let metadata = match std::fs::metadata(path) {
+            Ok(metadata) => metadata,
+            Err(_) => return FileStoreKey::from_file(path),
+        };
+        if let Some(key) = hash_memo::get(&metadata) {
+            return Ok(key);
+        }
+        let key = FileStoreKey::from_file(path)?;
+        hash_memo::insert(&metadata, &key);
+        Ok(key)
+    }
+
     /// Make a new `FileStoreKey` from an in-memory file.
     pub fn from_content(content: &[u8]) -> FileStoreKey {
         FileStoreKey {
@@ -487,15 +696,22 @@ impl FileStoreHandle {
     /// Make a new handle to a file on disk.
     fn new(store: &FileStore, key: &FileStoreKey) -> FileStoreHandle {
         let path = store.key_to_path(key);
-        let mut locked_files = store.locked_files.lock().unwrap();
-        *locked_files.ref_counts.entry(key.clone()).or_default() += 1;
+        store.locked_files.lock(key);
         FileStoreHandle {
             path,
+            size: 0,
             locked_files: store.locked_files.clone(),
             key: key.clone(),
         }
     }
 
+    /// Read the size of the file, now that it is in the store.
+    fn read_size(&mut self) {
+        self.size = std::fs::metadata(&self.path)
+            .map(|metadata| metadata.len())
+            .unwrap_or(0);
+    }
+
     /// The path to the file pointed by this handle.
     pub fn path(&self) -> &Path {
         &self.path
@@ -505,6 +721,11 @@ impl FileStoreHandle {
     pub fn key(&self) -> &FileStoreKey {
         &self.key
     }
+
+    /// The size of the file pointed by this handle, in bytes.
+    pub fn size(&self) -> u64 {
+        self.size
+    }
 }
 
 impl PartialEq for FileStoreHandle {
@@ -515,11 +736,10 @@ impl PartialEq for FileStoreHandle {
 
 impl Clone for FileStoreHandle {
     fn clone(&self) -> Self {
-        let mut locked_files = self.locked_files.lock().unwrap();
-        *locked_files.ref_counts.entry(self.key.clone()).or_default() += 1;
-
+        self.locked_files.lock(&self.key);
         FileStoreHandle {
             path: self.path.clone(),
+            size: self.size,
             locked_files: self.locked_files.clone(),
             key: self.key.clone(),
         }
@@ -534,16 +754,17 @@ impl std::fmt::Display for FileStoreHandle {
 
 impl Drop for FileStoreHandle {
     fn drop(&mut self) {
-        let mut locked_files = match self.locked_files.lock() {
+        let mut shard = match self.locked_files.shard(&self.key).lock() {
             Ok(guard) => guard,
             Err(_) => return, // may happen if the thread panicked
         };
-        *locked_files
+        let ref_count = shard
             .ref_counts
             .get_mut(&self.key)
-            .expect("Ref counts are broken") -= 1;
-        if locked_files.ref_counts[&self.key] == 0 {
-            locked_files.ref_counts.remove(&self.key);
+            .expect("Ref counts are broken");
+        *ref_count -= 1;
+        if *ref_count == 0 {
+            shard.ref_counts.remove(&self.key);
         }
     }
 }
@@ -552,7 +773,46 @@ impl LockedFiles {
     /// Make a new, empty, `LockedFiles`.
     fn new() -> LockedFiles {
         LockedFiles {
-            ref_counts: HashMap::new(),
+            shards: (0..LOCKED_FILES_SHARDS)
+                .map(|_| Mutex::new(LockedFilesShard::default()))
+                .collect(),
+        }
+    }
+
+    /// The shard with the file with that key.
+    fn shard(&self, key: &FileStoreKey) -> &Mutex<LockedFilesShard> {
+        &self.shards[key.hash.as_bytes()[0] as usize % LOCKED_FILES_SHARDS]
+    }
+
+    /// Add a handle to the file with that key.
+    fn lock(&self, key: &FileStoreKey) {
+        let mut shard = self.shard(key).lock().unwrap();
+        *shard.ref_counts.entry(key.clone()).or_default() += 1;
+    }
+
+    /// The number of handles alive of the file with that key.
+    #[cfg(test)]
+    fn ref_count(&self, key: &FileStoreKey) -> usize {
+        let shard = self.shard(key).lock().unwrap();
+        shard.ref_counts.get(key).copied().unwrap_or_default()
+    }
+
+    /// Record an access to the file with that key, to be applied later to the index.
+    fn touch(&self, key: &FileStoreKey) {
+        let mut shard = self.shard(key).lock().unwrap();
+        shard.touched.insert(key.clone(), SystemTime::now());
+    }
+
+    /// Apply to the index the accesses recorded since the last time.
+    fn apply_touches(&self, index: &mut FileStoreIndex) {
+        for shard in &self.shards {
+            let touched = match shard.lock() {
+                Ok(mut shard) => std::mem::take(&mut shard.touched),
+                Err(_) => continue,
+            };
+            for (key, time) in touched {
+                index.touch(&key, time);
+            }
         }
     }
 }
@@ -647,16 +907,37 @@ mod tests {
             .readonly());
     }
 
+    #[test]
+    fn test_store_file() {
+        let cwd = get_cwd();
+        let store = FileStore::new(cwd.path().join("store"), 1000, 1000).unwrap();
+        let path = cwd.path().join("test.txt");
+        let key = fake_file(&path, "test");
+        let handle = store.store_file(&key, &path).unwrap();
+        assert_eq!(handle.path(), store.key_to_path(&key));
+        assert_eq!(std::fs::read_to_string(handle.path()).unwrap(), "test");
+        assert!(std::fs::metadata(handle.path())
+            .unwrap()
+            .permissions()
+            .readonly());
+        // the original file is left untouched
+        assert_eq!(std::fs::read_to_string(&path).unwrap(), "test");
+        assert!(store.get(&key).is_some());
+    }
+
     #[test]
     fn test_get() {
         let cwd = get_cwd();
         let store = FileStore::new(cwd.path(), 1000, 1000).unwrap();
         let handle = add_file_to_store(&cwd.path().join("test.txt"), "ciao", &store);
 
+        assert_eq!(handle.size(), 4);
+
         let handle = store.get(&handle.key).unwrap();
         let path = handle.path();
         let path_in_store = store.key_to_path(&handle.key);
         assert_eq!(path_in_store, path);
+        assert_eq!(handle.size(), 4);
     }
 
     #[test]
@@ -750,18 +1031,13 @@ mod tests {
         let store = FileStore::new(cwd.path(), 1000, 1000).unwrap();
         let handle = add_file_to_store(&cwd.path().join("test.txt"), "ciaone", &store);
         let key = handle.key.clone();
-        assert_eq!(store.locked_files.lock().unwrap().ref_counts[&key], 1);
+        assert_eq!(store.locked_files.ref_count(&key), 1);
         let handle2 = handle.clone();
-        assert_eq!(store.locked_files.lock().unwrap().ref_counts[&key], 2);
+        assert_eq!(store.locked_files.ref_count(&key), 2);
         drop(handle);
-        assert_eq!(store.locked_files.lock().unwrap().ref_counts[&key], 1);
+        assert_eq!(store.locked_files.ref_count(&key), 1);
         drop(handle2);
-        assert!(!store
-            .locked_files
-            .lock()
-            .unwrap()
-            .ref_counts
-            .contains_key(&key));
+        assert_eq!(store.locked_files.ref_count(&key), 0);
     }
 
     #[test]
@@ -770,22 +1046,43 @@ mod tests {
         let store = FileStore::new(cwd.path(), 1000, 1000).unwrap();
         let handle = add_file_to_store(&cwd.path().join("test.txt"), "ciaone", &store);
         let key = handle.key.clone();
-        assert_eq!(store.locked_files.lock().unwrap().ref_counts[&key], 1);
+        assert_eq!(store.locked_files.ref_count(&key), 1);
         let handle2 = handle.clone();
-        assert_eq!(store.locked_files.lock().unwrap().ref_counts[&key], 2);
+        assert_eq!(store.locked_files.ref_count(&key), 2);
         let handle3 = store.get(&key).unwrap();
-        assert_eq!(store.locked_files.lock().unwrap().ref_counts[&key], 3);
+        assert_eq!(store.locked_files.ref_count(&key), 3);
         drop(handle);
-        assert_eq!(store.locked_files.lock().unwrap().ref_counts[&key], 2);
+        assert_eq!(store.locked_files.ref_count(&key), 2);
         drop(handle3);
-        assert_eq!(store.locked_files.lock().unwrap().ref_counts[&key], 1);
+        assert_eq!(store.locked_files.ref_count(&key), 1);
         drop(handle2);
-        assert!(!store
+        assert_eq!(store.locked_files.ref_count(&key), 0);
+    }
+
+    #[test]
+    fn test_locked_files_sharded() {
+        let cwd = get_cwd();
+        let store = FileStore::new(cwd.path(), 1000, 1000).unwrap();
+        let handles: Vec<_> = (0..100)
+            .map(|i| {
+                add_file_to_store(&cwd.path().join(format!("{i}.txt")), &i.to_string(), &store)
+            })
+            .collect();
+        for handle in &handles {
+            assert_eq!(store.locked_files.ref_count(&handle.key), 1);
+        }
+        let used_shards = store
             .locked_files
-            .lock()
-            .unwrap()
-            .ref_counts
-            .contains_key(&key));
+            .shards
+            .iter()
+            .filter(|shard| !shard.lock().unwrap().ref_counts.is_empty())
+            .count();
+        assert!(used_shards > 1);
+        let keys: Vec<_> = handles.iter().map(|h| h.key.clone()).collect();
+        drop(handles);
+        for key in &keys {
+            assert_eq!(store.locked_files.ref_count(key), 0);
+        }
     }
 
     #[test]
@@ -803,4 +1100,14 @@ mod tests {
         assert_ne!(key1a, key2);
         assert_ne!(key1b, key2);
     }
+
+    #[test]
+    fn test_file_store_key_from_big_file() {
+        let cwd = get_cwd();
+        let path = cwd.path().join("big.txt");
+        let content: Vec<u8> = (0..3 * PARALLEL_HASH_MIN_SIZE).map(|i| i as u8).collect();
+        std::fs::write(&path, &content).unwrap();
+        let key = FileStoreKey::from_file(&path).unwrap();
+        assert_eq!(key, FileStoreKey::from_content(&content));
+    }
 }
@@ -140,6 +140,10 @@ impl TestInterface {
                 disabled_sanity_checks: vec![],
                 seed: None,
                 dry_run: false,
+                skip_failed_subtasks: false,
+                incremental: false,
+                terry_fused: false,
+                profile: vec![],
             },
         )
         .unwrap();
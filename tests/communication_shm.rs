@@ -0,0 +1,38 @@
+use task_maker_format::ioi::TestcaseEvaluationStatus::*;
+
+mod common;
+use common::TestInterface;
+
+fn communication_shm(test: TestInterface) {
+    test.success()
+        .time_limit(1.0)
+        .memory_limit(64)
+        .max_score(100.0)
+        .subtask_scores(vec![100.0])
+        .must_compile("solution.cpp")
+        .must_compile("solution.c")
+        .must_compile("wrong.cpp")
+        .must_compile("crash.cpp")
+        .solution_score("solution.cpp", vec![100.0])
+        .solution_score("solution.c", vec![100.0])
+        .solution_score("wrong.cpp", vec![0.0])
+        .solution_score("crash.cpp", vec![0.0])
+        .solution_statuses("solution.cpp", vec![Accepted("Ok!".into())])
+        .solution_statuses("wrong.cpp", vec![WrongAnswer("Ko!".into())])
+        .solution_statuses("crash.cpp", vec![RuntimeError])
+        .file_exists("check/manager");
+}
+
+#[test]
+fn communication_shm_local() {
+    better_panic::install();
+
+    communication_shm(TestInterface::run_local("communication_shm"));
+}
+
+#[test]
+fn communication_shm_remote() {
+    better_panic::install();
+
+    communication_shm(TestInterface::run_remote("communication_shm"));
+}
@@ -0,0 +1,41 @@
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+
+#include "shm_lib.h"
+
+using namespace std;
+
+// Number of operations asked to each process.
+const int ROUNDS = 10000;
+
+int main(int argc, char **argv) {
+    tm_channel ch1, ch2;
+    tm_channel_open(&ch1, argv[1], TM_MANAGER);
+    tm_channel_open(&ch2, argv[2], TM_MANAGER);
+
+    FILE *fin = fopen("input.txt", "r");
+    int a, b, c;
+    assert(3 == fscanf(fin, "%d %d %d", &a, &b, &c));
+
+    bool ok = true;
+    for (int i = 0; i < ROUNDS; i++) {
+        int res;
+        tm_write_int(&ch1, a + i);
+        tm_write_int(&ch1, b);
+        ok &= tm_read_int(&ch1, &res) && res == a + i + b;
+        tm_write_int(&ch2, res);
+        tm_write_int(&ch2, c);
+        ok &= tm_read_int(&ch2, &res) && res == (a + i + b) * c;
+    }
+    tm_channel_close(&ch1);
+    tm_channel_close(&ch2);
+
+    if (ok) {
+        fprintf(stderr, "Ok!\n");
+        printf("1.0\n");
+    } else {
+        fprintf(stderr, "Ko!\n");
+        printf("0.0\n");
+    }
+}
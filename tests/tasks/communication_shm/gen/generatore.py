@@ -0,0 +1,6 @@
+#!/usr/bin/env python3
+
+import sys
+
+a, b, c = map(int, sys.argv[1:])
+print(a, b, c)
@@ -0,0 +1,8 @@
+#include <cstdlib>
+// Crashes with the channel open, the manager must not wait for it forever.
+int op(int code, int a, int b) {
+    static int calls = 0;
+    if (++calls == 100)
+        abort();
+    return code == 0 ? a + b : a * b;
+}
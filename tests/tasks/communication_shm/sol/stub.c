@@ -0,0 +1,19 @@
+#include <stdlib.h>
+
+#include "shm_lib.h"
+
+int op(int code, int a, int b);
+
+int main(int argc, char **argv) {
+    tm_channel ch;
+    tm_channel_open(&ch, argv[1], TM_SOLUTION);
+    int code = atoi(argv[2]);
+
+    int a, b;
+    while (tm_read_int(&ch, &a) && tm_read_int(&ch, &b)) {
+        tm_write_int(&ch, op(code, a, b));
+    }
+    tm_channel_close(&ch);
+
+    return 0;
+}
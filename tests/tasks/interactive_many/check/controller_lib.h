@@ -1,4 +1,5 @@
 #include <assert.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -16,7 +17,7 @@ int start_one_solution(int (*handler)(FILE *to_solution, FILE *from_solution)) {
   printf("START_SOLUTION\n");
   fflush(stdout);
   int fdin, fdout;
-  scanf("%d%d", &fdin, &fdout);
+  if (scanf("%d %d", &fdin, &fdout) != 2) return 1;
   FILE *to_solution = fdopen(fdin, "w");
   FILE *from_solution = fdopen(fdout, "r");
   assert(to_solution);
@@ -27,21 +28,28 @@ int start_one_solution(int (*handler)(FILE *to_solution, FILE *from_solution)) {
   return ret;
 }
 
-int start_many_solutions(int (*handler)(FILE **to_solution,
-                                        FILE **from_solution, int num),
-                         int num) {
-  FILE **to_solution = (FILE **)malloc(sizeof(FILE *) * num);
-  FILE **from_solution = (FILE **)malloc(sizeof(FILE *) * num);
+// Start `num` solutions with a single request, so that they all start in
+// parallel. Returns 0 on success.
+int start_solutions(FILE **to_solution, FILE **from_solution, int num) {
+  printf("START_SOLUTIONS %d\n", num);
+  fflush(stdout);
   for (int i = 0; i < num; i++) {
-    printf("START_SOLUTION\n");
-    fflush(stdout);
     int fdin, fdout;
-    scanf("%d%d", &fdin, &fdout);
+    if (scanf("%d %d", &fdin, &fdout) != 2) return 1;
     to_solution[i] = fdopen(fdin, "w");
     from_solution[i] = fdopen(fdout, "r");
     assert(to_solution[i]);
     assert(from_solution[i]);
   }
+  return 0;
+}
+
+int start_many_solutions(int (*handler)(FILE **to_solution,
+                                        FILE **from_solution, int num),
+                         int num) {
+  FILE **to_solution = (FILE **)malloc(sizeof(FILE *) * num);
+  FILE **from_solution = (FILE **)malloc(sizeof(FILE *) * num);
+  if (start_solutions(to_solution, from_solution, num) != 0) return 1;
   int ret = handler(to_solution, from_solution, num);
   for (int i = 0; i < num; i++) {
     fclose(to_solution[i]);
@@ -51,3 +59,49 @@ int start_many_solutions(int (*handler)(FILE **to_solution,
   free(from_solution);
   return ret;
 }
+
+// Whether some data from the solution is already buffered inside the FILE, so
+// that reading it does not block even if the pipe is empty.
+int solution_has_buffered_data(FILE *from_solution) {
+#ifdef __GLIBC__
+  return from_solution->_IO_read_ptr < from_solution->_IO_read_end;
+#else
+  (void)from_solution;
+  return 0;
+#endif
+}
+
+// Call `on_ready` every time one of the solutions has something to read,
+// without blocking on the slower ones. `on_ready` receives the index of the
+// solution and should return non-zero when the solution does not need to be
+// served anymore (e.g. it exited or sent its last message). Returns when no
+// solution needs to be served.
+void serve_solutions(FILE **from_solution, int num,
+                     int (*on_ready)(int index, void *data), void *data) {
+  struct pollfd *fds = (struct pollfd *)malloc(sizeof(struct pollfd) * num);
+  int active = num;
+  for (int i = 0; i < num; i++) {
+    fds[i].fd = fileno(from_solution[i]);
+    fds[i].events = POLLIN;
+  }
+  while (active > 0) {
+    int buffered = 0;
+    for (int i = 0; i < num; i++) {
+      if (fds[i].fd >= 0 && solution_has_buffered_data(from_solution[i])) {
+        fds[i].revents = POLLIN;
+        buffered = 1;
+      } else {
+        fds[i].revents = 0;
+      }
+    }
+    if (!buffered && poll(fds, num, -1) < 0) break;
+    for (int i = 0; i < num; i++) {
+      if (fds[i].fd < 0 || !fds[i].revents) continue;
+      if (on_ready(i, data)) {
+        fds[i].fd = -1;
+        active--;
+      }
+    }
+  }
+  free(fds);
+}
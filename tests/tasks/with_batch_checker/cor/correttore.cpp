@@ -0,0 +1,43 @@
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+// Whether the test output has the same number of the correct output.
+bool check(const char* input, const char* correct, const char* output) {
+  std::ifstream in(input);     // NOLINT
+  std::ifstream cor(correct);  // NOLINT
+  std::ifstream test(output);  // NOLINT
+
+  int N, N_cor, N_test;
+  in >> N;
+  cor >> N_cor;
+  return (test >> N_test) && N_cor == N_test;
+}
+
+int main(int argc, char** argv) {
+  // With --batch the files to check are read from stdin, one testcase per line.
+  if (argc == 2 && strcmp(argv[1], "--batch") == 0) {
+    std::string input, correct, output;
+    while (std::cin >> input >> correct >> output) {
+      if (check(input.c_str(), correct.c_str(), output.c_str())) {
+        std::cout << "1.0 Ok!" << std::endl;
+      } else {
+        std::cout << "0.0 Ko!" << std::endl;
+      }
+    }
+    return 0;
+  }
+  if (argc != 4) {
+    std::cerr << "Usage: correttore <input> <correct output> <test output>"
+              << std::endl;
+    return 1;
+  }
+  if (check(argv[1], argv[2], argv[3])) {
+    std::cout << 1.0 << std::endl;
+    std::cerr << "Ok!" << std::endl;
+  } else {
+    std::cout << 0.0 << std::endl;
+    std::cerr << "Ko!" << std::endl;
+  }
+}
@@ -0,0 +1,7 @@
+#!/usr/bin/env bash
+
+read -r N
+if [ "$N" = 2 ]; then
+  exit 1
+fi
+echo "$N"
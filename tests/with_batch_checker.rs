@@ -0,0 +1,36 @@
+mod common;
+use common::TestInterface;
+use task_maker_format::ioi::TestcaseEvaluationStatus::*;
+
+fn with_batch_checker(test: TestInterface) {
+    test.success()
+        .time_limit(1.0)
+        .memory_limit(64)
+        .max_score(100.0)
+        .subtask_scores(vec![50.0, 50.0])
+        .not_compiled("soluzione.sh")
+        .not_compiled("crash.sh")
+        .solution_score("soluzione.sh", vec![50.0, 50.0])
+        .solution_score("crash.sh", vec![50.0, 0.0])
+        .solution_statuses("soluzione.sh", vec![Accepted("Ok!".into())])
+        // the crash on the last testcase doesn't prevent checking the others
+        .solution_statuses(
+            "crash.sh",
+            vec![Accepted("Ok!".into()), Accepted("Ok!".into()), RuntimeError],
+        )
+        .file_exists("cor/correttore");
+}
+
+#[test]
+fn with_batch_checker_local() {
+    better_panic::install();
+
+    with_batch_checker(TestInterface::run_local("with_batch_checker"));
+}
+
+#[test]
+fn with_batch_checker_remote() {
+    better_panic::install();
+
+    with_batch_checker(TestInterface::run_remote("with_batch_checker"));
+}